@@ -27,6 +27,9 @@
  * This code should be considered an aid for legacy code. New development
  *  shouldn't do things that require this aid in the first place.  :)
  *
+ * PhysicsFS 3.1 can do this itself, much faster, for any mounted archive or
+ *  directory; see PHYSFS_setIgnoreCase().
+ *
  * Usage: Set up PhysicsFS as you normally would, then use
  *  PHYSFSEXT_locateCorrectCase() to get a "correct" pathname to pass to
  *  functions like PHYSFS_openRead(), etc.
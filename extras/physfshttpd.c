@@ -1,20 +1,25 @@
 /*
- * This is a quick and dirty HTTP server that uses PhysicsFS to retrieve
- *  files. It is not robust at all, probably buggy, and definitely poorly
- *  designed. It's just meant to show that it can be done.
+ * This is a small HTTP server that uses PhysicsFS to retrieve files. It's
+ *  still not meant for the open internet, but it holds up to a few hundred
+ *  clients on a LAN.
  *
  * Basically, you compile this code, and run it:
- *   ./physfshttpd archive1.zip archive2.zip /path/to/a/real/dir etc...
+ *   ./physfshttpd [-p port] [-j threads] archive1.zip /path/to/a/real/dir etc...
  *
  * The files are appended in order to the PhysicsFS search path, and when
  *  a client request comes in, it looks for the file in said search path.
  *
- * My goal was to make this work in less than 300 lines of C, so again, it's
- *  not to be used for any serious purpose. Patches to make this application
- *  suck less will be readily and gratefully accepted.
+ * One thread runs an event loop (epoll on Linux, kqueue on the BSDs and
+ *  macOS) over every connection, so connections don't cost a thread each.
+ *  Files in real directories go out with sendfile() on Linux. Entries
+ *  stored as-is in an archive are memory-mapped with PHYSFS_mapFile() and
+ *  written straight from the mapping. Everything else has to be
+ *  decompressed, which a small pool of worker threads (-j, default 4)
+ *  does a chunk at a time, handing each chunk back to the event loop.
+ *  GET and HEAD, keep-alive, pipelining and single byte ranges work.
  *
  * Command line I used to build this on Linux:
- *  gcc -Wall -Werror -g -o bin/physfshttpd extras/physfshttpd.c -lphysfs
+ *  gcc -Wall -Werror -g -o bin/physfshttpd extras/physfshttpd.c -lphysfs -lpthread
  *
  * License: this code is public domain. I make no warranty that it is useful,
  *  correct, harmless, or environmentally safe.
@@ -36,14 +41,31 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#if defined(__linux__)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+      defined(__NetBSD__) || defined(__DragonFly__)
+#define USE_KQUEUE 1
+#include <sys/event.h>
+#else
+#error Please add an event API (or poll()) for this platform here.
+#endif
+
 #ifndef LACKING_SIGNALS
 #include <signal.h>
 #endif
@@ -56,231 +78,1033 @@
 
 
 #define DEFAULT_PORTNUM 8080
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define MAX_EVENTS 128
+#define REQUEST_MAX 8192            /* request line and headers, total. */
+#define CHUNK_SIZE (256 * 1024)     /* decompressed per worker job. */
+#define SEND_BUDGET (1024 * 1024)   /* per wakeup, so nobody hogs the loop. */
+#define IDLE_TIMEOUT 30             /* seconds a keep-alive can sit idle. */
+
+#define WANT_READ 1
+#define WANT_WRITE 2
+
+typedef enum
+{
+    BODY_NONE,      /* everything is in (out). */
+    BODY_SENDFILE,  /* native file: sendfile() from (fd). */
+    BODY_MAPPED,    /* stored entry: write() from (mapped). */
+    BODY_DECODE     /* anything else: workers fill (chunk). */
+} BodyType;
 
 typedef struct
 {
-    int sock;
-    struct sockaddr *addr;
-    socklen_t addrlen;
-} http_args;
+    char *data;
+    size_t len;
+    size_t pos;    /* bytes already sent. */
+    size_t alloc;
+} Buffer;
 
+typedef struct Connection
+{
+    int sock;
+    char ipstr[64];
+    char inbuf[REQUEST_MAX];
+    size_t inlen;
+    size_t reqlen;              /* bytes of (inbuf) the current request used. */
+    Buffer out;                 /* response headers, and small bodies. */
+    BodyType bodytype;
+    int keepalive;
+    int fd;                     /* BODY_SENDFILE */
+    off_t fdpos;
+    PHYSFS_File *handle;        /* BODY_MAPPED, BODY_DECODE */
+    const char *mapped;         /* BODY_MAPPED */
+    PHYSFS_sint64 remain;       /* body bytes left to send, -1 until EOF. */
+    PHYSFS_sint64 seekto;       /* BODY_DECODE: worker seeks here first. */
+    char *chunk;                /* BODY_DECODE */
+    size_t chunklen;
+    size_t chunkpos;
+    int busy;                   /* a worker has it; hands off. */
+    int failed;                 /* the worker couldn't read. */
+    int registered;             /* the poller knows about (sock). */
+    int interest;               /* WANT_READ, WANT_WRITE, or zero. */
+    time_t lastactive;
+    struct Connection *prev;    /* all live connections. */
+    struct Connection *next;
+    struct Connection *nextjob; /* worker queue, or dead list. */
+} Connection;
 
-#define txt404 \
-    "HTTP/1.0 404 Not Found\n" \
-    "Connection: close\n" \
-    "Content-Type: text/html; charset=utf-8\n" \
-    "\n" \
-    "<html><head><title>404 Not Found</title></head>\n" \
-    "<body>Can't find '%s'.</body></html>\n\n" \
+typedef struct
+{
+    Connection *conn;
+    int readable;
+    int writable;
+} PollEvent;
+
+
+/* none of this is robust against HTML escaping. */
+#define txtError \
+    "<html><head><title>%d %s</title></head>\n" \
+    "<body>%s</body></html>\n"
+
+static int poller = -1;
+static Connection listener;     /* (listener.sock) is the listen socket. */
+static Connection waker;        /* (waker.sock) is read end of wakepipe. */
+static int wakepipe[2] = { -1, -1 };
+static Connection *connections = NULL;
+static Connection *deadconns = NULL;
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobcond = PTHREAD_COND_INITIALIZER;
+static Connection *jobhead = NULL;
+static Connection *jobtail = NULL;
+static pthread_t workerThreads[MAX_WORKERS];
+static int numWorkers = 0;
+static int stopping = 0;  /* protected by joblock; tells workers to quit. */
+#ifndef LACKING_SIGNALS
+static volatile sig_atomic_t quitting = 0;  /* SIGINT/SIGTERM arrived. */
+#else
+static const int quitting = 0;
+#endif
 
-#define txt200 \
-    "HTTP/1.0 200 OK\n" \
-    "Connection: close\n" \
-    "Content-Type: %s\n" \
-    "\n"
 
 static const char *lastError(void)
 {
     return PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
 } /* lastError */
 
-static int writeAll(const char *ipstr, const int sock, void *buf, const size_t len)
+
+static int setNonBlocking(int fd)
 {
-    if (write(sock, buf, len) != len)
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return (flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+} /* setNonBlocking */
+
+
+static int bufferReserve(Buffer *buf, size_t len)
+{
+    if (buf->alloc - buf->len < len)
     {
-        printf("%s: Write error to socket.\n", ipstr);
-        return 0;
+        size_t newalloc = buf->alloc ? buf->alloc * 2 : 1024;
+        char *ptr;
+        while (newalloc - buf->len < len)
+            newalloc *= 2;
+        ptr = (char *) realloc(buf->data, newalloc);
+        if (ptr == NULL)
+            return 0;
+        buf->data = ptr;
+        buf->alloc = newalloc;
     } /* if */
 
     return 1;
-} /* writeAll */
+} /* bufferReserve */
+
+
+static int bufferAppend(Buffer *buf, const void *data, size_t len)
+{
+    if (!bufferReserve(buf, len))
+        return 0;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 1;
+} /* bufferAppend */
+
 
-static int writeString(const char *ipstr, const int sock, const char *fmt, ...)
+static int bufferPrintf(Buffer *buf, const char *fmt, ...)
 {
-    /* none of this is robust against large strings or HTML escaping. */
-    char buffer[1024];
     int len;
     va_list ap;
-    va_start(ap, fmt);
-    len = vsnprintf(buffer, sizeof (buffer), fmt, ap);
-    va_end(ap);
-    if (len < 0)
-    {
-        printf("uhoh, vsnprintf() failed!\n");
+
+    if (!bufferReserve(buf, 256))
         return 0;
-    } /* if */
 
-    return writeAll(ipstr, sock, buffer, len);
-} /* writeString */
+    while (1)
+    {
+        const size_t avail = buf->alloc - buf->len;
+        va_start(ap, fmt);
+        len = vsnprintf(buf->data + buf->len, avail, fmt, ap);
+        va_end(ap);
+        if (len < 0)
+        {
+            printf("uhoh, vsnprintf() failed!\n");
+            return 0;
+        } /* if */
+        else if ((size_t) len < avail)
+            break;
+        else if (!bufferReserve(buf, ((size_t) len) + 1))
+            return 0;
+    } /* while */
+
+    buf->len += (size_t) len;
+    return 1;
+} /* bufferPrintf */
 
 
-static void feed_file_http(const char *ipstr, int sock, const char *fname)
+/* Say what (c) should wait for. Zero takes it out of the poller entirely,
+   so a hangup can't wake us over and over while a worker has it. */
+static int pollerSet(Connection *c, const int want)
 {
-    PHYSFS_File *in = PHYSFS_openRead(fname);
+#if USE_EPOLL
+    struct epoll_event ev;
+
+    if ((want == c->interest) && ((want != 0) == c->registered))
+        return 1;
 
-    if (in == NULL)
+    memset(&ev, '\0', sizeof (ev));
+    ev.data.ptr = c;
+    ev.events = ((want & WANT_READ) ? EPOLLIN : 0) |
+                ((want & WANT_WRITE) ? EPOLLOUT : 0);
+
+    if (want == 0)
     {
-        printf("%s: Can't open [%s]: %s.\n", ipstr, fname, lastError());
-        writeString(ipstr, sock, txt404, fname);
-        return;
+        if ((c->registered) && (epoll_ctl(poller, EPOLL_CTL_DEL, c->sock, &ev) == -1))
+            return 0;
+        c->registered = 0;
     } /* if */
+    else
+    {
+        const int op = c->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (epoll_ctl(poller, op, c->sock, &ev) == -1)
+            return 0;
+        c->registered = 1;
+    } /* else */
+#elif USE_KQUEUE
+    struct kevent changes[2];
 
-    /* !!! FIXME: mimetype */
-    if (writeString(ipstr, sock, txt200, "text/plain; charset=utf-8"))
+    if ((want == c->interest) && (c->registered))
+        return 1;
+
+    EV_SET(&changes[0], c->sock, EVFILT_READ,
+           EV_ADD | ((want & WANT_READ) ? EV_ENABLE : EV_DISABLE), 0, 0, c);
+    EV_SET(&changes[1], c->sock, EVFILT_WRITE,
+           EV_ADD | ((want & WANT_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, c);
+    if (kevent(poller, changes, 2, NULL, 0, NULL) == -1)
+        return 0;
+    c->registered = 1;
+#endif
+
+    c->interest = want;
+    return 1;
+} /* pollerSet */
+
+
+static int pollerWait(PollEvent *events, const int max, const int timeoutms)
+{
+    int i, rc;
+
+#if USE_EPOLL
+    struct epoll_event evs[MAX_EVENTS];
+    rc = epoll_wait(poller, evs, (max < MAX_EVENTS) ? max : MAX_EVENTS, timeoutms);
+    for (i = 0; i < rc; i++)
     {
-        do
+        const int bad = (evs[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+        events[i].conn = (Connection *) evs[i].data.ptr;
+        events[i].readable = bad || ((evs[i].events & EPOLLIN) != 0);
+        events[i].writable = bad || ((evs[i].events & EPOLLOUT) != 0);
+    } /* for */
+#elif USE_KQUEUE
+    struct kevent evs[MAX_EVENTS];
+    struct timespec ts;
+    ts.tv_sec = timeoutms / 1000;
+    ts.tv_nsec = (timeoutms % 1000) * 1000000;
+    rc = kevent(poller, NULL, 0, evs, (max < MAX_EVENTS) ? max : MAX_EVENTS, &ts);
+    for (i = 0; i < rc; i++)
+    {
+        const int bad = (evs[i].flags & EV_ERROR) != 0;
+        events[i].conn = (Connection *) evs[i].udata;
+        events[i].readable = bad || (evs[i].filter == EVFILT_READ);
+        events[i].writable = bad || (evs[i].filter == EVFILT_WRITE);
+    } /* for */
+#endif
+
+    return rc;
+} /* pollerWait */
+
+
+/* Drop whatever the current response was sending from. */
+static void releaseBody(Connection *c)
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    if (c->handle != NULL)
+        PHYSFS_close(c->handle);
+    c->fd = -1;
+    c->handle = NULL;
+    c->mapped = NULL;
+    c->bodytype = BODY_NONE;
+    c->remain = 0;
+    c->seekto = -1;
+    c->chunklen = c->chunkpos = 0;
+    c->failed = 0;
+} /* releaseBody */
+
+
+/* The event loop might still have events for (c) this time around, so it
+   isn't freed until they're done. */
+static void closeConnection(Connection *c)
+{
+    printf("%s: closing connection.\n", c->ipstr);
+    releaseBody(c);
+    close(c->sock);  /* takes it out of the poller, too. */
+    c->sock = -1;
+
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        connections = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+
+    c->nextjob = deadconns;
+    deadconns = c;
+} /* closeConnection */
+
+
+static void freeDeadConnections(void)
+{
+    while (deadconns != NULL)
+    {
+        Connection *next = deadconns->nextjob;
+        free(deadconns->out.data);
+        free(deadconns->chunk);
+        free(deadconns);
+        deadconns = next;
+    } /* while */
+} /* freeDeadConnections */
+
+
+/* Hand (c) to a worker to decompress its next chunk. */
+static void submitJob(Connection *c)
+{
+    c->busy = 1;
+    pollerSet(c, 0);
+    c->nextjob = NULL;
+    pthread_mutex_lock(&joblock);
+    if (jobtail == NULL)
+        jobhead = c;
+    else
+        jobtail->nextjob = c;
+    jobtail = c;
+    pthread_cond_signal(&jobcond);
+    pthread_mutex_unlock(&joblock);
+} /* submitJob */
+
+
+static void *workerThread(void *unused)
+{
+    (void) unused;
+
+    while (1)
+    {
+        Connection *c;
+        int rc;
+
+        pthread_mutex_lock(&joblock);
+        while ((jobhead == NULL) && (!stopping))
+            pthread_cond_wait(&jobcond, &joblock);
+        if (stopping)
+        {
+            pthread_mutex_unlock(&joblock);
+            break;
+        } /* if */
+        c = jobhead;
+        jobhead = c->nextjob;
+        if (jobhead == NULL)
+            jobtail = NULL;
+        pthread_mutex_unlock(&joblock);
+
+        /* the event loop doesn't touch (c) until we give it back. */
+        if (c->seekto >= 0)
+        {
+            if (!PHYSFS_seek(c->handle, (PHYSFS_uint64) c->seekto))
+                c->failed = 1;
+            c->seekto = -1;
+        } /* if */
+
+        if (!c->failed)
         {
-            char buffer[1024];
-            PHYSFS_sint64 br = PHYSFS_readBytes(in, buffer, sizeof (buffer));
-            if (br == -1)
+            size_t want = CHUNK_SIZE;
+            PHYSFS_sint64 br;
+            if ((c->remain >= 0) && (c->remain < (PHYSFS_sint64) want))
+                want = (size_t) c->remain;
+            br = PHYSFS_readBytes(c->handle, c->chunk, want);
+            if (br < 0)
             {
-                printf("%s: Read error: %s.\n", ipstr, lastError());
-                break;
+                printf("%s: Read error: %s.\n", c->ipstr, lastError());
+                c->failed = 1;
             } /* if */
-
-            else if (!writeAll(ipstr, sock, buffer, (size_t) br))
+            else
             {
-                break;
-            } /* else if */
-        } while (!PHYSFS_eof(in));
+                c->chunklen = (size_t) br;
+                c->chunkpos = 0;
+            } /* else */
+        } /* if */
+
+        do
+        {
+            rc = (int) write(wakepipe[1], &c, sizeof (c));
+        } while ((rc == -1) && (errno == EINTR));
+    } /* while */
+
+    return NULL;
+} /* workerThread */
+
+
+static int queueError(Connection *c, const int code, const char *status,
+                      const char *msg, const char *extraheaders)
+{
+    Buffer body;
+    int rc;
+
+    memset(&body, '\0', sizeof (body));
+    rc = bufferPrintf(&body, txtError, code, status, msg) &&
+         bufferPrintf(&c->out,
+                      "HTTP/1.1 %d %s\r\n"
+                      "Content-Type: text/html; charset=utf-8\r\n"
+                      "Content-Length: %lu\r\n"
+                      "%s"
+                      "Connection: %s\r\n"
+                      "\r\n",
+                      code, status, (unsigned long) body.len,
+                      extraheaders ? extraheaders : "",
+                      c->keepalive ? "keep-alive" : "close") &&
+         bufferAppend(&c->out, body.data, body.len);
+    free(body.data);
+    return rc;
+} /* queueError */
+
+
+static int queueNotFound(Connection *c, const char *fname)
+{
+    Buffer msg;
+    int rc;
+    memset(&msg, '\0', sizeof (msg));
+    rc = bufferPrintf(&msg, "Can't find '%s'.", fname) &&
+         queueError(c, 404, "Not Found", msg.data, NULL);
+    free(msg.data);
+    return rc;
+} /* queueNotFound */
+
+
+/* Parse a "Range:" value for a file of (len) bytes. Only single ranges;
+   for anything else, we just send the whole thing, which is allowed.
+   Returns 1 for a range, 0 to ignore it, -1 if it can't be satisfied. */
+static int parseRange(const char *str, const PHYSFS_sint64 len,
+                      PHYSFS_sint64 *start, PHYSFS_sint64 *end)
+{
+    unsigned long long a, b;
+    char *endp;
+
+    if (strncasecmp(str, "bytes=", 6) != 0)
+        return 0;
+    str += 6;
+    if (strchr(str, ',') != NULL)
+        return 0;
+
+    if (*str == '-')  /* "-n" is the last n bytes. */
+    {
+        if (!isdigit((unsigned char) str[1]))
+            return 0;
+        b = strtoull(str + 1, &endp, 10);
+        if ((*endp != '\0') && (!isspace((unsigned char) *endp)))
+            return 0;
+        else if ((b == 0) || (len == 0))
+            return -1;
+        *start = (b >= (unsigned long long) len) ? 0 : (len - (PHYSFS_sint64) b);
+        *end = len - 1;
+        return 1;
     } /* if */
 
-    PHYSFS_close(in);
+    if (!isdigit((unsigned char) *str))
+        return 0;
+    a = strtoull(str, &endp, 10);
+    if (*endp != '-')
+        return 0;
+    str = endp + 1;
+
+    if (!isdigit((unsigned char) *str))
+    {
+        b = (unsigned long long) len - 1;  /* "n-" is from n to the end. */
+        endp = (char *) str;
+    } /* if */
+    else
+    {
+        b = strtoull(str, &endp, 10);
+        if (b < a)
+            return 0;
+    } /* else */
+
+    if ((*endp != '\0') && (!isspace((unsigned char) *endp)))
+        return 0;
+    else if (a >= (unsigned long long) len)
+        return -1;
+    else if (b >= (unsigned long long) len)
+        b = (unsigned long long) len - 1;
+
+    *start = (PHYSFS_sint64) a;
+    *end = (PHYSFS_sint64) b;
+    return 1;
+} /* parseRange */
+
+
+#if USE_EPOLL
+/* If (fname) is really a file in a native directory, open it, so sendfile()
+   can feed it straight to the socket. PhysicsFS gets to say no first. */
+static int openNative(const char *fname)
+{
+    const char *dir = PHYSFS_getRealDir(fname);
+    PHYSFS_File *check;
+    struct stat statbuf;
+    char *path;
+    int fd;
+
+    if ((dir == NULL) || (stat(dir, &statbuf) == -1) || (!S_ISDIR(statbuf.st_mode)))
+        return -1;
+
+    /* symlinks and such that PhysicsFS won't follow, we won't either. */
+    if ((check = PHYSFS_openRead(fname)) == NULL)
+        return -1;
+    PHYSFS_close(check);
+
+    path = (char *) malloc(strlen(dir) + strlen(fname) + 1);
+    if (path == NULL)
+        return -1;
+    strcpy(path, dir);
+    strcat(path, fname);  /* (fname) starts with '/'. */
+    fd = open(path, O_RDONLY);
+    free(path);
+    return fd;
+} /* openNative */
+#endif
+
+
+static int feed_file_http(Connection *c, const char *fname,
+                          const char *range, const int head)
+{
+    PHYSFS_sint64 len = -1;
+    PHYSFS_sint64 start = 0;
+    PHYSFS_sint64 end = -1;
+    const void *ptr = NULL;
+    PHYSFS_uint64 maplen = 0;
+    int ranged = 0;
+
+#if USE_EPOLL
+    if ((c->fd = openNative(fname)) != -1)
+    {
+        struct stat statbuf;
+        c->bodytype = BODY_SENDFILE;
+        if (fstat(c->fd, &statbuf) == 0)
+            len = (PHYSFS_sint64) statbuf.st_size;
+    } /* if */
+    else
+#endif
+    if ((c->handle = PHYSFS_mapFile(fname, &ptr, &maplen)) != NULL)
+    {
+        c->bodytype = BODY_MAPPED;
+        c->mapped = (const char *) ptr;
+        len = (PHYSFS_sint64) maplen;
+    } /* else if */
+
+    else if ((c->handle = PHYSFS_openRead(fname)) != NULL)
+    {
+        c->bodytype = BODY_DECODE;
+        len = PHYSFS_fileLength(c->handle);
+    } /* else if */
+
+    else
+    {
+        printf("%s: Can't open [%s]: %s.\n", c->ipstr, fname, lastError());
+        return queueNotFound(c, fname);
+    } /* else */
+
+    if ((range != NULL) && (len >= 0))
+    {
+        ranged = parseRange(range, len, &start, &end);
+        if (ranged < 0)
+        {
+            char extra[64];
+            releaseBody(c);
+            snprintf(extra, sizeof (extra), "Content-Range: bytes */%lld\r\n",
+                     (long long) len);
+            return queueError(c, 416, "Range Not Satisfiable",
+                              "Requested range not satisfiable.", extra);
+        } /* if */
+    } /* if */
+
+    if (len < 0)  /* no idea how big; send until EOF, then hang up. */
+        c->keepalive = 0;
+    else if (!ranged)
+        end = len - 1;
+
+    /* !!! FIXME: mimetype */
+    if (!bufferPrintf(&c->out, "HTTP/1.1 %s\r\n"
+                               "Content-Type: text/plain; charset=utf-8\r\n"
+                               "Accept-Ranges: bytes\r\n"
+                               "Connection: %s\r\n",
+                      ranged ? "206 Partial Content" : "200 OK",
+                      c->keepalive ? "keep-alive" : "close"))
+        return 0;
+    else if ((len >= 0) && (!bufferPrintf(&c->out, "Content-Length: %lld\r\n",
+                                          (long long) (end - start + 1))))
+        return 0;
+    else if ((ranged) && (!bufferPrintf(&c->out,
+                                   "Content-Range: bytes %lld-%lld/%lld\r\n",
+                                   (long long) start, (long long) end,
+                                   (long long) len)))
+        return 0;
+    else if (!bufferAppend(&c->out, "\r\n", 2))
+        return 0;
+
+    if ((head) || (len == 0))
+    {
+        releaseBody(c);
+        return 1;
+    } /* if */
+
+    c->remain = (len < 0) ? -1 : (end - start + 1);
+    if (c->bodytype == BODY_SENDFILE)
+        c->fdpos = (off_t) start;
+    else if (c->bodytype == BODY_MAPPED)
+        c->mapped += start;
+    else
+    {
+        if ((c->chunk == NULL) && ((c->chunk = (char *) malloc(CHUNK_SIZE)) == NULL))
+            return 0;
+        c->seekto = (start > 0) ? start : -1;
+    } /* else */
+
+    return 1;
 } /* feed_file_http */
 
 
-static void feed_dirlist_http(const char *ipstr, int sock,
-                              const char *dname, char **list)
+static int feed_dirlist_http(Connection *c, const char *dname, char **list,
+                             const int head)
 {
+    Buffer body;
+    int rc;
     int i;
 
-    if (!writeString(ipstr, sock, txt200, "text/html; charset=utf-8"))
-        return;
-
-    else if (!writeString(ipstr, sock,
+    memset(&body, '\0', sizeof (body));
+    rc = bufferPrintf(&body,
                     "<html><head><title>Directory %s</title></head>"
                     "<body><p><h1>Directory %s</h1></p><p><ul>\n",
-                    dname, dname))
-        return;
+                    dname, dname);
 
     if (strcmp(dname, "/") == 0)
         dname = "";
 
-    for (i = 0; list[i]; i++)
+    for (i = 0; (rc) && (list[i]); i++)
     {
         const char *fname = list[i];
-        if (!writeString(ipstr, sock,
-            "<li><a href='%s/%s'>%s</a></li>\n", dname, fname, fname))
-            break;
+        rc = bufferPrintf(&body, "<li><a href='%s/%s'>%s</a></li>\n",
+                          dname, fname, fname);
     } /* for */
 
-    writeString(ipstr, sock, "</ul></body></html>\n");
+    rc = rc && bufferPrintf(&body, "</ul></body></html>\n") &&
+         bufferPrintf(&c->out,
+                      "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: text/html; charset=utf-8\r\n"
+                      "Content-Length: %lu\r\n"
+                      "Connection: %s\r\n"
+                      "\r\n",
+                      (unsigned long) body.len,
+                      c->keepalive ? "keep-alive" : "close") &&
+         ((head) || (bufferAppend(&c->out, body.data, body.len)));
+
+    free(body.data);
+    return rc;
 } /* feed_dirlist_http */
 
-static void feed_dir_http(const char *ipstr, int sock, const char *dname)
+
+static int feed_dir_http(Connection *c, const char *dname, const int head)
 {
     char **list = PHYSFS_enumerateFiles(dname);
+    int rc;
+
     if (list == NULL)
     {
         printf("%s: Can't enumerate directory [%s]: %s.\n",
-               ipstr, dname, lastError());
-        writeString(ipstr, sock, txt404, dname);
-        return;
+               c->ipstr, dname, lastError());
+        return queueNotFound(c, dname);
     } /* if */
 
-    feed_dirlist_http(ipstr, sock, dname, list);
+    rc = feed_dirlist_http(c, dname, list, head);
     PHYSFS_freeList(list);
+    return rc;
 } /* feed_dir_http */
 
-static void feed_http_request(const char *ipstr, int sock, const char *fname)
+
+static int feed_http_request(Connection *c, const char *fname,
+                             const char *range, const int head)
 {
     PHYSFS_Stat statbuf;
 
-    printf("%s: requested [%s].\n", ipstr, fname);
+    printf("%s: requested [%s].\n", c->ipstr, fname);
 
     if (!PHYSFS_stat(fname, &statbuf))
     {
-        printf("%s: Can't stat [%s]: %s.\n", ipstr, fname, lastError());
-        writeString(ipstr, sock, txt404, fname);
-        return;
+        printf("%s: Can't stat [%s]: %s.\n", c->ipstr, fname, lastError());
+        return queueNotFound(c, fname);
     } /* if */
 
     if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
-        feed_dir_http(ipstr, sock, fname);
-    else
-        feed_file_http(ipstr, sock, fname);
+        return feed_dir_http(c, fname, head);
+    return feed_file_http(c, fname, range, head);
 } /* feed_http_request */
 
 
-static void *do_http(void *_args)
+/* Find the blank line after the headers. Returns bytes up to and including
+   it, or zero if we don't have it yet. */
+static size_t findRequestEnd(const char *buf, const size_t len)
 {
-    http_args *args = (http_args *) _args;
-    char ipstr[128];
-    char buffer[512];
-    char *ptr;
-    strncpy(ipstr, inet_ntoa(((struct sockaddr_in *) args->addr)->sin_addr),
-            sizeof (ipstr));
-    ipstr[sizeof (ipstr) - 1] = '\0';
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        if (buf[i] != '\n')
+            continue;
+        else if ((i + 1 < len) && (buf[i + 1] == '\n'))
+            return i + 2;
+        else if ((i + 2 < len) && (buf[i + 1] == '\r') && (buf[i + 2] == '\n'))
+            return i + 3;
+    } /* for */
 
-    printf("%s: connected.\n", ipstr);
-    read(args->sock, buffer, sizeof (buffer));
-    buffer[sizeof (buffer) - 1] = '\0';
-    ptr = strchr(buffer, '\n');
-    if (!ptr)
-        printf("%s: potentially bogus request.\n", ipstr);
-    else
+    return 0;
+} /* findRequestEnd */
+
+
+/* If a whole request is waiting in (c->inbuf), queue up its response and
+   return nonzero. Otherwise, wait for more of it. */
+static int startRequest(Connection *c)
+{
+    char request[REQUEST_MAX + 1];
+    const char *range = NULL;
+    char *method;
+    char *target;
+    char *version;
+    char *line;
+    char *next;
+    int head = 0;
+    int rc;
+
+    c->reqlen = findRequestEnd(c->inbuf, c->inlen);
+    if (c->reqlen == 0)
+    {
+        if (c->inlen < sizeof (c->inbuf))
+        {
+            pollerSet(c, WANT_READ);
+            return 0;
+        } /* if */
+
+        printf("%s: request too big.\n", c->ipstr);
+        c->reqlen = c->inlen;
+        c->keepalive = 0;
+        return queueError(c, 431, "Request Header Fields Too Large",
+                          "Request too big.", NULL);
+    } /* if */
+
+    memcpy(request, c->inbuf, c->reqlen);
+    request[c->reqlen] = '\0';
+
+    /* request line: METHOD /target HTTP/1.x */
+    method = request;
+    next = strchr(request, '\n');
+    *next = '\0';
+    next++;
+    if ((line = strchr(method, '\r')) != NULL)
+        *line = '\0';
+
+    target = strchr(method, ' ');
+    version = target ? strchr(target + 1, ' ') : NULL;
+    if ((target == NULL) || (version == NULL) || (target[1] != '/'))
+    {
+        printf("%s: potentially bogus request.\n", c->ipstr);
+        c->keepalive = 0;
+        return queueError(c, 400, "Bad Request", "Bad request.", NULL);
+    } /* if */
+    *(target++) = '\0';
+    *(version++) = '\0';
+
+    /* HTTP/1.1 keeps the connection by default, 1.0 doesn't. */
+    c->keepalive = (strcmp(version, "HTTP/1.1") == 0);
+
+    for (line = next; *line != '\0'; line = next)
     {
-        *ptr = '\0';
-        ptr = strchr(buffer, '\r');
-        if (ptr != NULL)
+        char *value;
+        char *ptr;
+
+        next = strchr(line, '\n');
+        *(next++) = '\0';
+        if ((ptr = strchr(line, '\r')) != NULL)
             *ptr = '\0';
+        if ((value = strchr(line, ':')) == NULL)
+            continue;
+        *(value++) = '\0';
+        while ((*value == ' ') || (*value == '\t'))
+            value++;
 
-        if ((toupper(buffer[0]) == 'G') &&
-            (toupper(buffer[1]) == 'E') &&
-            (toupper(buffer[2]) == 'T') &&
-            (toupper(buffer[3]) == ' ') &&
-            (toupper(buffer[4]) == '/'))
+        if (strcasecmp(line, "Connection") == 0)
         {
-            ptr = strchr(buffer + 5, ' ');
-            if (ptr != NULL)
-                *ptr = '\0';
-            feed_http_request(ipstr, args->sock, buffer + 4);
+            if (strcasecmp(value, "close") == 0)
+                c->keepalive = 0;
+            else if (strcasecmp(value, "keep-alive") == 0)
+                c->keepalive = 1;
         } /* if */
-    } /* else */
+        else if (strcasecmp(line, "Range") == 0)
+            range = value;
+    } /* for */
 
-    /* !!! FIXME: Time the transfer. */
-    printf("%s: closing connection.\n", ipstr);
-    close(args->sock);
-    free(args->addr);
-    free(args);
-    return NULL;
-} /* do_http */
+    if ((line = strchr(target, '?')) != NULL)
+        *line = '\0';  /* don't care about query strings. */
 
+    if (strcmp(method, "HEAD") == 0)
+        head = 1;
+    else if (strcmp(method, "GET") != 0)
+    {
+        printf("%s: unsupported method [%s].\n", c->ipstr, method);
+        return queueError(c, 405, "Method Not Allowed", "Method not allowed.",
+                          "Allow: GET, HEAD\r\n");
+    } /* else if */
 
-static void serve_http_request(int sock, struct sockaddr *addr,
-                               socklen_t addrlen)
-{
-    http_args *args = (http_args *) malloc(sizeof (http_args));
-    if (args == NULL)
+    rc = feed_http_request(c, target, range, head);
+    if (!rc)
     {
-        printf("out of memory.\n");
-        return;
+        printf("%s: out of memory.\n", c->ipstr);
+        releaseBody(c);
+        c->out.len = c->out.pos = 0;
+        c->keepalive = 0;
+        rc = queueError(c, 500, "Internal Server Error", "Out of memory.", NULL);
     } /* if */
-    args->addr = (struct sockaddr *) malloc(addrlen);
-    if (args->addr == NULL)
+
+    return rc;
+} /* startRequest */
+
+
+/* The current response is all sent. Returns zero if (c) is gone. */
+static int finishResponse(Connection *c)
+{
+    releaseBody(c);
+    c->out.len = c->out.pos = 0;
+
+    if (!c->keepalive)
     {
-        free(args);
-        printf("out of memory.\n");
-        return;
+        closeConnection(c);
+        return 0;
     } /* if */
 
-    args->sock = sock;
-    args->addrlen = addrlen;
-    memcpy(args->addr, addr, addrlen);
+    /* keep anything pipelined after this request. */
+    memmove(c->inbuf, c->inbuf + c->reqlen, c->inlen - c->reqlen);
+    c->inlen -= c->reqlen;
+    c->reqlen = 0;
+    return 1;
+} /* finishResponse */
+
+
+/* Send as much as we can without blocking, up to SEND_BUDGET of body. */
+static void connWrite(Connection *c)
+{
+    size_t budget = SEND_BUDGET;
+
+    while (1)
+    {
+        ssize_t bw = 0;
+
+        if (c->out.pos < c->out.len)
+            bw = write(c->sock, c->out.data + c->out.pos, c->out.len - c->out.pos);
+
+        else if (c->remain == 0)
+        {
+            if (!finishResponse(c))
+                return;
+            else if (!startRequest(c))
+                return;  /* waiting for the next request. */
+            continue;
+        } /* else if */
+
+        else if (budget == 0)
+        {
+            pollerSet(c, WANT_WRITE);  /* let everyone else have a turn. */
+            return;
+        } /* else if */
+
+        else if (c->bodytype == BODY_DECODE)
+        {
+            if (c->chunkpos == c->chunklen)
+            {
+                submitJob(c);
+                return;
+            } /* if */
+
+            bw = write(c->sock, c->chunk + c->chunkpos, c->chunklen - c->chunkpos);
+        } /* else if */
+
+        else
+        {
+            size_t len = budget;
+            if ((c->remain >= 0) && ((PHYSFS_sint64) len > c->remain))
+                len = (size_t) c->remain;
+
+#if USE_EPOLL
+            if (c->bodytype == BODY_SENDFILE)
+            {
+                bw = sendfile(c->sock, c->fd, &c->fdpos, len);
+                if (bw == 0)  /* file got shorter behind our back. */
+                {
+                    printf("%s: file truncated while sending.\n", c->ipstr);
+                    closeConnection(c);
+                    return;
+                } /* if */
+            } /* if */
+            else
+#endif
+            {
+                bw = write(c->sock, c->mapped, len);
+                if (bw > 0)
+                    c->mapped += bw;
+            } /* else */
+        } /* else */
+
+        if (bw < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                pollerSet(c, WANT_WRITE);
+            else
+            {
+                printf("%s: Write error to socket.\n", c->ipstr);
+                closeConnection(c);
+            } /* else */
+            return;
+        } /* if */
+
+        c->lastactive = time(NULL);
+        if (c->out.pos < c->out.len)
+            c->out.pos += (size_t) bw;
+        else
+        {
+            if (c->bodytype == BODY_DECODE)
+                c->chunkpos += (size_t) bw;
+            if (c->remain > 0)
+                c->remain -= bw;
+            budget = ((size_t) bw > budget) ? 0 : (budget - (size_t) bw);
+        } /* else */
+    } /* while */
+} /* connWrite */
+
+
+static void connRead(Connection *c)
+{
+    while (1)
+    {
+        const ssize_t br = read(c->sock, c->inbuf + c->inlen,
+                                sizeof (c->inbuf) - c->inlen);
+        if (br == 0)
+        {
+            closeConnection(c);  /* they hung up. */
+            return;
+        } /* if */
+        else if (br < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                closeConnection(c);
+            return;
+        } /* else if */
+
+        c->inlen += (size_t) br;
+        c->lastactive = time(NULL);
+        break;
+    } /* while */
+
+    if (startRequest(c))
+        connWrite(c);
+} /* connRead */
+
 
-    /* !!! FIXME: optionally spin a thread... */
-    do_http((void *) args);
-} /* server_http_request */
+/* Workers are done with these; carry on sending. */
+static void collectJobs(void)
+{
+    Connection *c;
+
+    while (read(waker.sock, &c, sizeof (c)) == (ssize_t) sizeof (c))
+    {
+        c->busy = 0;
+        if ((!c->failed) && (c->chunklen == 0))
+        {
+            if (c->remain < 0)
+                c->remain = 0;  /* that's the end of it. */
+            else
+                c->failed = 1;  /* it's shorter than it said it was. */
+        } /* if */
+
+        if (c->failed)
+            closeConnection(c);
+        else
+            connWrite(c);
+    } /* while */
+} /* collectJobs */
+
+
+static void acceptConnections(void)
+{
+    while (1)
+    {
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof (addr);
+        Connection *c;
+        int s;
+
+        s = accept(listener.sock, (struct sockaddr *) &addr, &addrlen);
+        if (s < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                printf("accept() failed: %s\n", strerror(errno));
+            return;
+        } /* if */
+
+        c = (Connection *) calloc(1, sizeof (Connection));
+        if ((c == NULL) || (!setNonBlocking(s)))
+        {
+            printf("out of memory.\n");
+            free(c);
+            close(s);
+            continue;
+        } /* if */
+
+        c->sock = s;
+        c->fd = -1;
+        c->seekto = -1;
+        c->lastactive = time(NULL);
+        strncpy(c->ipstr, inet_ntoa(addr.sin_addr), sizeof (c->ipstr));
+        c->ipstr[sizeof (c->ipstr) - 1] = '\0';
+
+        c->next = connections;
+        if (connections != NULL)
+            connections->prev = c;
+        connections = c;
+
+        printf("%s: connected.\n", c->ipstr);
+        if (!pollerSet(c, WANT_READ))
+            closeConnection(c);
+    } /* while */
+} /* acceptConnections */
+
+
+/* Hang up on keep-alives that have gone quiet. */
+static void closeIdleConnections(void)
+{
+    const time_t now = time(NULL);
+    Connection *c = connections;
+    while (c != NULL)
+    {
+        Connection *next = c->next;
+        if ((!c->busy) && (now - c->lastactive > IDLE_TIMEOUT))
+            closeConnection(c);
+        c = next;
+    } /* while */
+} /* closeIdleConnections */
 
 
 static int create_listen_socket(short portnum)
@@ -299,12 +1123,16 @@ static int create_listen_socket(short portnum)
     retval = socket(PF_INET, SOCK_STREAM, protocol);
     if (retval >= 0)
     {
+        const int on = 1;
         struct sockaddr_in addr;
+        memset(&addr, '\0', sizeof (addr));
         addr.sin_family = AF_INET;
         addr.sin_port = htons(portnum);
         addr.sin_addr.s_addr = INADDR_ANY;
+        setsockopt(retval, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
         if ((bind(retval, (struct sockaddr *) &addr, (socklen_t) sizeof (addr)) == -1) ||
-            (listen(retval, 5) == -1))
+            (listen(retval, SOMAXCONN) == -1) ||
+            (!setNonBlocking(retval)))
         {
             close(retval);
             retval = -1;
@@ -315,17 +1143,41 @@ static int create_listen_socket(short portnum)
 } /* create_listen_socket */
 
 
-static int listensocket = -1;
+static void stopWorkers(void)
+{
+    int i;
+
+    pthread_mutex_lock(&joblock);
+    stopping = 1;
+    pthread_cond_broadcast(&jobcond);
+    pthread_mutex_unlock(&joblock);
+
+    /* a worker finishes the chunk it's on, then sees (stopping). */
+    for (i = 0; i < numWorkers; i++)
+    {
+        if (!pthread_equal(workerThreads[i], pthread_self()))
+            pthread_join(workerThreads[i], NULL);
+    } /* for */
+    numWorkers = 0;
+} /* stopWorkers */
+
+
+#ifndef LACKING_SIGNALS
+static void requestQuit(int sig)
+{
+    (void) sig;
+    quitting = 1;
+} /* requestQuit */
+#endif
+
 
 void at_exit_cleanup(void)
 {
-    /*
-     * !!! FIXME: If thread support, signal threads to terminate and
-     * !!! FIXME:  wait for them to clean up.
-     */
+    /* no worker may be inside PhysicsFS when we deinit. */
+    stopWorkers();
 
-    if (listensocket >= 0)
-        close(listensocket);
+    if (listener.sock >= 0)
+        close(listener.sock);
 
     if (!PHYSFS_deinit())
         printf("PHYSFS_deinit() failed: %s\n", lastError());
@@ -334,25 +1186,43 @@ void at_exit_cleanup(void)
 
 int main(int argc, char **argv)
 {
-    int i;
+    PollEvent events[MAX_EVENTS];
+    time_t lastsweep = time(NULL);
     int portnum = DEFAULT_PORTNUM;
+    int workers = DEFAULT_WORKERS;
+    int i;
+#ifndef LACKING_SIGNALS
+    sigset_t quitsigs;
+#endif
 
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
 #ifndef LACKING_SIGNALS
     /* I'm not sure if this qualifies as a cheap trick... */
-    signal(SIGTERM, exit);
-    signal(SIGINT, exit);
+    /* these let the event loop return, so workers get joined cleanly. */
+    signal(SIGTERM, requestQuit);
+    signal(SIGINT, requestQuit);
     signal(SIGFPE, exit);
     signal(SIGSEGV, exit);
-    signal(SIGPIPE, exit);
+    signal(SIGPIPE, SIG_IGN);  /* a client hanging up shouldn't kill us. */
     signal(SIGILL, exit);
 #endif
 
-    if (argc == 1)
+    for (i = 1; i < argc - 1; i += 2)
+    {
+        if (strcmp(argv[i], "-p") == 0)
+            portnum = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-j") == 0)
+            workers = atoi(argv[i + 1]);
+        else
+            break;
+    } /* for */
+
+    if ((i >= argc) || (portnum <= 0) || (portnum > 65535) ||
+        (workers < 1) || (workers > MAX_WORKERS))
     {
-        printf("USAGE: %s <archive1> [archive2 [... archiveN]]\n", argv[0]);
+        printf("USAGE: %s [-p port] [-j threads] <archive1> [archive2 [... archiveN]]\n", argv[0]);
         return 42;
     } /* if */
 
@@ -362,39 +1232,101 @@ int main(int argc, char **argv)
         return 42;
     } /* if */
 
+    listener.sock = -1;
+
     /* normally, this is bad practice, but oh well. */
     atexit(at_exit_cleanup);
 
-    for (i = 1; i < argc; i++)
+    for (; i < argc; i++)
     {
         if (!PHYSFS_mount(argv[i], NULL, 1))
             printf(" WARNING: failed to add [%s] to search path.\n", argv[i]);
     } /* else */
 
-    listensocket = create_listen_socket(portnum);
-    if (listensocket < 0)
+#if USE_EPOLL
+    poller = epoll_create(MAX_EVENTS);
+#elif USE_KQUEUE
+    poller = kqueue();
+#endif
+    if (poller < 0)
+    {
+        printf("Couldn't create the event poller: %s\n", strerror(errno));
+        return 42;
+    } /* if */
+
+    if ((pipe(wakepipe) == -1) || (!setNonBlocking(wakepipe[0])))
+    {
+        printf("Couldn't create the wakeup pipe: %s\n", strerror(errno));
+        return 42;
+    } /* if */
+
+    waker.sock = wakepipe[0];
+    pollerSet(&waker, WANT_READ);
+
+#ifndef LACKING_SIGNALS
+    /* workers inherit this mask, so SIGINT/SIGTERM wake the poller. */
+    sigemptyset(&quitsigs);
+    sigaddset(&quitsigs, SIGTERM);
+    sigaddset(&quitsigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &quitsigs, NULL);
+#endif
+
+    for (i = 0; i < workers; i++)
+    {
+        if (pthread_create(&workerThreads[i], NULL, workerThread, NULL) != 0)
+        {
+            printf("Couldn't start worker threads.\n");
+            return 42;
+        } /* if */
+        numWorkers++;
+    } /* for */
+
+#ifndef LACKING_SIGNALS
+    pthread_sigmask(SIG_UNBLOCK, &quitsigs, NULL);
+#endif
+
+    listener.sock = create_listen_socket((short) portnum);
+    if (listener.sock < 0)
     {
         printf("listen socket failed to create.\n");
         return 42;
     } /* if */
+    pollerSet(&listener, WANT_READ);
 
-    while (1)  /* infinite loop for now. */
+    while (!quitting)
     {
-        struct sockaddr addr;
-        socklen_t len;
-        int s = accept(listensocket, &addr, &len);
-        if (s < 0)
+        const int rc = pollerWait(events, MAX_EVENTS, 1000);
+        if ((rc < 0) && (errno != EINTR))
         {
-            printf("accept() failed: %s\n", strerror(errno));
-            close(listensocket);
+            printf("Event poller failed: %s\n", strerror(errno));
             return 42;
         } /* if */
 
-        serve_http_request(s, &addr, len);
+        for (i = 0; i < rc; i++)
+        {
+            Connection *c = events[i].conn;
+            if (c == &listener)
+                acceptConnections();
+            else if (c == &waker)
+                collectJobs();
+            else if ((c->sock < 0) || (c->busy))
+                continue;  /* closed or handed off since we polled. */
+            else if ((events[i].readable) && (c->interest & WANT_READ))
+                connRead(c);
+            else if ((events[i].writable) && (c->interest & WANT_WRITE))
+                connWrite(c);
+        } /* for */
+
+        if (time(NULL) != lastsweep)
+        {
+            closeIdleConnections();
+            lastsweep = time(NULL);
+        } /* if */
+
+        freeDeadConnections();
     } /* while */
 
     return 0;
 } /* main */
 
 /* end of physfshttpd.c ... */
-
@@ -1,12 +1,66 @@
+/*
+ * Unpack an archive into a directory, on a thread per CPU core.
+ *
+ * The archive is walked once to make the directories and list the files,
+ *  then worker threads take files off that list, biggest first, until it's
+ *  empty. Every PHYSFS_File gets its own duplicate of the archive's i/o, so
+ *  the workers don't get in each other's way, and this doubles as a stress
+ *  test of reading one archive from many threads at once.
+ *
+ * Entries that are stored as-is get memory-mapped with PHYSFS_mapFile()
+ *  and written straight from the mapping; everything else is decompressed
+ *  through a buffer per worker. Output files are preallocated where the
+ *  system supports it.
+ *
+ * This needs POSIX (pthreads, open(), write()).
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "physfs.h"
 
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define MAX_THREADS 256
+
+typedef struct
+{
+    char *fname;  /* platform-independent, starting with '/'. */
+    PHYSFS_sint64 size;
+} UnpackFile;
+
+typedef struct
+{
+    pthread_t thread;
+    int index;
+    PHYSFS_uint64 files;
+    PHYSFS_uint64 bytes;
+    PHYSFS_uint64 mapped;  /* files written straight from a mapping. */
+    double seconds;
+} Worker;
 
 static int failure = 0;
+static const char *outdir = NULL;
+static UnpackFile *files = NULL;
+static size_t filecount = 0;
+static size_t filealloc = 0;
+static size_t nextfile = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+} /* now */
+
 
 static void modTimeToStr(PHYSFS_sint64 modtime, char *modstr, size_t strsize)
 {
@@ -25,151 +79,396 @@ static void modTimeToStr(PHYSFS_sint64 modtime, char *modstr, size_t strsize)
 } /* modTimeToStr */
 
 
-static void fail(const char *what, const char *why)
+/* Workers call this, too; PhysicsFS keeps the last error per thread. */
+static void fail(const char *what, const char *fname, const char *why)
 {
     if (why == NULL)
-        why = PHYSFS_getLastError();
-    fprintf(stderr, "%s failed: %s\n", what, why);
+        why = PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
+    pthread_mutex_lock(&lock);
+    fprintf(stderr, "%s('%s') failed: %s\n", what, fname, why);
     failure = 1;
+    pthread_mutex_unlock(&lock);
 } /* fail */
 
 
-static void dumpFile(const char *fname)
+static int writeAll(int fd, const void *buf, PHYSFS_uint64 len)
+{
+    const char *ptr = (const char *) buf;
+    while (len > 0)
+    {
+        const size_t chunk = (len > 0x40000000) ? 0x40000000 : (size_t) len;
+        const ssize_t bw = write(fd, ptr, chunk);
+        if (bw < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        } /* if */
+        ptr += bw;
+        len -= (PHYSFS_uint64) bw;
+    } /* while */
+
+    return 1;
+} /* writeAll */
+
+
+/* Copy (fname) out of the archive to (fd). Returns bytes written, -1 on
+   error. (*mapped) is set if it never went through (buf). */
+static PHYSFS_sint64 copyFile(const char *fname, int fd, char *buf,
+                              int *mapped)
 {
-    const int origfailure = failure;
-    PHYSFS_File *out = NULL;
-    PHYSFS_File *in = NULL;
+    PHYSFS_uint64 total = 0;
+    const void *ptr = NULL;
+    PHYSFS_uint64 len = 0;
+    PHYSFS_File *in;
 
-    failure = 0;
+    *mapped = 0;
+    in = PHYSFS_mapFile(fname, &ptr, &len);
+    if (in != NULL)
+    {
+        *mapped = 1;
+        if (!writeAll(fd, ptr, len))
+        {
+            fail("write", fname, strerror(errno));
+            PHYSFS_close(in);
+            return -1;
+        } /* if */
+        PHYSFS_close(in);
+        return (PHYSFS_sint64) len;
+    } /* if */
 
+    /* compressed, probably; decompress it the usual way. */
     if ((in = PHYSFS_openRead(fname)) == NULL)
-        fail("\nPHYSFS_openRead", NULL);
-    else if ((out = PHYSFS_openWrite(fname)) == NULL)
-        fail("\nPHYSFS_openWrite", NULL);
-    else
     {
-        char modstr[64];
-        PHYSFS_sint64 size = PHYSFS_fileLength(in);
+        fail("PHYSFS_openRead", fname, NULL);
+        return -1;
+    } /* if */
 
-        printf("(");
-        if (size == -1)
-            printf("?");
-        else
-            printf("%lld", (long long) size);
-        printf(" bytes");
+    while (1)
+    {
+        const PHYSFS_sint64 br = PHYSFS_readBytes(in, buf, COPY_BUFFER_SIZE);
+        if (br < 0)
+        {
+            fail("PHYSFS_readBytes", fname, NULL);
+            PHYSFS_close(in);
+            return -1;
+        } /* if */
+        else if (br == 0)
+            break;
+        else if (!writeAll(fd, buf, (PHYSFS_uint64) br))
+        {
+            fail("write", fname, strerror(errno));
+            PHYSFS_close(in);
+            return -1;
+        } /* else if */
+        total += (PHYSFS_uint64) br;
+    } /* while */
+
+    PHYSFS_close(in);
+    return (PHYSFS_sint64) total;
+} /* copyFile */
+
+
+static void unpackFile(Worker *w, const UnpackFile *f, char *buf)
+{
+    const size_t len = strlen(outdir) + strlen(f->fname) + 1;
+    char *path = (char *) malloc(len);
+    PHYSFS_sint64 written = -1;
+    int mapped = 0;
+    int fd;
+
+    if (path == NULL)
+    {
+        fail("malloc", f->fname, "Out of memory!");
+        return;
+    } /* if */
 
-        modTimeToStr(PHYSFS_getLastModTime(fname), modstr, sizeof (modstr));
-        printf(", %s)\n", modstr);
+    snprintf(path, len, "%s%s", outdir, f->fname);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        fail("open", path, strerror(errno));
+    else
+    {
+        #if defined(__linux__) || defined(__FreeBSD__)
+        /* one extent for the whole file, if the filesystem can do that.
+           It's just a hint; don't care if it fails. */
+        if (f->size > 0)
+            (void) posix_fallocate(fd, 0, (off_t) f->size);
+        #endif
+
+        written = copyFile(f->fname, fd, buf, &mapped);
+        if ((written >= 0) && (f->size >= 0) && (written != f->size))
+        {
+            fail("copy", f->fname, "BUG! bytes read != PHYSFS_stat size!");
+            written = -1;
+        } /* if */
 
-        while ( (!failure) && (!PHYSFS_eof(in)) )
+        if ((close(fd) != 0) && (written >= 0))
         {
-            static char buf[64 * 1024];
-            PHYSFS_sint64 br = PHYSFS_read(in, buf, 1, sizeof (buf));
-            if (br == -1)
-                fail("PHYSFS_read", NULL);
-            else
-            {
-                PHYSFS_sint64 bw = PHYSFS_write(out, buf, 1, br);
-                if (bw != br)
-                    fail("PHYSFS_write", NULL);
-                else
-                    size -= bw;
-            } /* else */
-        } /* while */
-
-        if ((!failure) && (size != 0))
-            fail("PHYSFS_eof", "BUG! eof != PHYSFS_fileLength bytes!");
+            fail("close", path, strerror(errno));
+            written = -1;
+        } /* if */
+
+        if (written < 0)
+            unlink(path);
     } /* else */
 
-    if (in != NULL)
-        PHYSFS_close(in);
+    if (written >= 0)
+    {
+        w->files++;
+        w->bytes += (PHYSFS_uint64) written;
+        w->mapped += mapped ? 1 : 0;
+    } /* if */
 
-    if (out != NULL)
+    free(path);
+} /* unpackFile */
+
+
+static void *workerThread(void *_w)
+{
+    Worker *w = (Worker *) _w;
+    char *buf = (char *) malloc(COPY_BUFFER_SIZE);
+    const double start = now();
+
+    if (buf == NULL)
     {
-        if (!PHYSFS_close(out))
-            fail("PHYSFS_close", NULL);
+        fail("malloc", "copy buffer", "Out of memory!");
+        return NULL;
     } /* if */
 
-    if (failure)
-        PHYSFS_delete(fname);
-    else
-        failure = origfailure;
-} /* dumpFile */
+    while (1)
+    {
+        size_t i;
+        pthread_mutex_lock(&lock);
+        i = nextfile++;
+        pthread_mutex_unlock(&lock);
+        if (i >= filecount)
+            break;
+        unpackFile(w, &files[i], buf);
+    } /* while */
+
+    w->seconds = now() - start;
+    free(buf);
+    return NULL;
+} /* workerThread */
+
+
+static void addFile(char *fname, PHYSFS_sint64 size)
+{
+    if (filecount == filealloc)
+    {
+        const size_t newalloc = filealloc ? filealloc * 2 : 1024;
+        void *ptr = realloc(files, newalloc * sizeof (UnpackFile));
+        if (ptr == NULL)
+        {
+            fail("realloc", fname, "Out of memory!");
+            free(fname);
+            return;
+        } /* if */
+        files = (UnpackFile *) ptr;
+        filealloc = newalloc;
+    } /* if */
+
+    files[filecount].fname = fname;
+    files[filecount].size = size;
+    filecount++;
+} /* addFile */
 
 
-static void unpackCallback(void *_depth, const char *origdir, const char *str)
+static PHYSFS_EnumerateCallbackResult collectCallback(void *data,
+                                                      const char *origdir,
+                                                      const char *str)
 {
-    int depth = *((int *) _depth);
-    const int len = strlen(origdir) + strlen(str) + 2;
+    const size_t len = strlen(origdir) + strlen(str) + 2;
     char *fname = (char *) malloc(len);
+    PHYSFS_Stat statbuf;
+    char modstr[64];
+
+    (void) data;
+
     if (fname == NULL)
-        fail("malloc", "Out of memory!");
-    else
     {
-        if (strcmp(origdir, "/") == 0)
-            origdir = "";
+        fail("malloc", str, "Out of memory!");
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
 
-        snprintf(fname, len, "%s/%s", origdir, str);
+    if (strcmp(origdir, "/") == 0)
+        origdir = "";
 
-        printf("%s ", fname);
-        if (PHYSFS_isDirectory(fname))
-        {
-            depth++;
-            printf("(directory)\n");
-            if (!PHYSFS_mkdir(fname))
-                fail("PHYSFS_mkdir", NULL);
-            else
-                PHYSFS_enumerateFilesCallback(fname, unpackCallback, &depth);
-        } /* if */
+    snprintf(fname, len, "%s/%s", origdir, str);
 
-        else if (PHYSFS_isSymbolicLink(fname))
-        {
-            printf("(symlink)\n");
-            /* !!! FIXME: ?  if (!symlink(fname, */
-        } /* else if */
+    if (!PHYSFS_stat(fname, &statbuf))
+    {
+        fail("PHYSFS_stat", fname, NULL);
+        free(fname);
+        return PHYSFS_ENUM_OK;
+    } /* if */
 
-        else  /* ...file. */
-        {
-            dumpFile(fname);
-        } /* else */
+    printf("%s ", fname);
+    if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+    {
+        printf("(directory)\n");
+        if (!PHYSFS_mkdir(fname))
+            fail("PHYSFS_mkdir", fname, NULL);
+        else
+            PHYSFS_enumerate(fname, collectCallback, NULL);
+        free(fname);
+    } /* if */
 
+    else if (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK)
+    {
+        printf("(symlink)\n");
+        /* !!! FIXME: ?  if (!symlink(fname, */
         free(fname);
+    } /* else if */
+
+    else  /* ...file. Workers unpack these later. */
+    {
+        printf("(");
+        if (statbuf.filesize == -1)
+            printf("?");
+        else
+            printf("%lld", (long long) statbuf.filesize);
+        modTimeToStr(statbuf.modtime, modstr, sizeof (modstr));
+        printf(" bytes, %s)\n", modstr);
+        addFile(fname, statbuf.filesize);  /* takes (fname). */
     } /* else */
-} /* unpackCallback */
+
+    return PHYSFS_ENUM_OK;
+} /* collectCallback */
+
+
+/* Biggest first, so a huge file doesn't start last and run on alone. */
+static int cmpFileSize(const void *_a, const void *_b)
+{
+    const UnpackFile *a = (const UnpackFile *) _a;
+    const UnpackFile *b = (const UnpackFile *) _b;
+    if (a->size != b->size)
+        return (a->size > b->size) ? -1 : 1;
+    return strcmp(a->fname, b->fname);
+} /* cmpFileSize */
+
+
+static int defaultThreadCount(void)
+{
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        return 1;
+    return (cores > MAX_THREADS) ? MAX_THREADS : (int) cores;
+} /* defaultThreadCount */
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "USAGE: %s [-j threads] <archive> <unpackDirectory>\n",
+            argv0);
+} /* usage */
 
 
 int main(int argc, char **argv)
 {
-    int zero = 0;
+    Worker workers[MAX_THREADS];
+    PHYSFS_uint64 totalbytes = 0;
+    int threads = defaultThreadCount();
+    int argi = 1;
+    double start;
+    double elapsed;
+    int started;
+    size_t i;
+    int t;
+
+    if ((argc == 5) && (strcmp(argv[1], "-j") == 0))
+    {
+        threads = atoi(argv[2]);
+        argi = 3;
+        if ((threads < 1) || (threads > MAX_THREADS))
+        {
+            fprintf(stderr, "threads must be 1 to %d\n", MAX_THREADS);
+            return 1;
+        } /* if */
+    } /* if */
 
-    if (argc != 3)
+    if (argc - argi != 2)
     {
-        fprintf(stderr, "USAGE: %s <archive> <unpackDirectory>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     } /* if */
 
     if (!PHYSFS_init(argv[0]))
     {
-        fprintf(stderr, "PHYSFS_init() failed: %s\n", PHYSFS_getLastError());
+        fprintf(stderr, "PHYSFS_init() failed: %s\n",
+                PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
         return 2;
     } /* if */
 
-    if (!PHYSFS_setWriteDir(argv[2]))
+    outdir = argv[argi + 1];
+    if (!PHYSFS_setWriteDir(outdir))
     {
         fprintf(stderr, "PHYSFS_setWriteDir('%s') failed: %s\n",
-                argv[2], PHYSFS_getLastError());
+                outdir, PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
         return 3;
     } /* if */
 
-    if (!PHYSFS_mount(argv[1], NULL, 1))
+    if (!PHYSFS_mount(argv[argi], NULL, 1))
     {
         fprintf(stderr, "PHYSFS_mount('%s') failed: %s\n",
-                argv[1], PHYSFS_getLastError());
+                argv[argi], PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
         return 4;
     } /* if */
 
     PHYSFS_permitSymbolicLinks(1);
-    PHYSFS_enumerateFilesCallback("/", unpackCallback, &zero);
+    PHYSFS_enumerate("/", collectCallback, NULL);
+
+    if (filecount > 1)
+        qsort(files, filecount, sizeof (UnpackFile), cmpFileSize);
+    if ((size_t) threads > filecount)
+        threads = filecount ? (int) filecount : 1;
+
+    start = now();
+    memset(workers, '\0', sizeof (workers));
+    for (t = 0; t < threads; t++)
+    {
+        workers[t].index = t;
+        if (pthread_create(&workers[t].thread, NULL, workerThread,
+                           &workers[t]) != 0)
+        {
+            fail("pthread_create", "worker", strerror(errno));
+            break;
+        } /* if */
+    } /* for */
+
+    started = t;
+    if (started == 0)  /* couldn't start any; do it here. */
+        workerThread(&workers[0]);
+    else
+    {
+        for (t = 0; t < started; t++)
+            pthread_join(workers[t].thread, NULL);
+    } /* else */
+    threads = started ? started : 1;
+    elapsed = now() - start;
+
+    for (t = 0; t < threads; t++)
+    {
+        const Worker *w = &workers[t];
+        const double mb = ((double) w->bytes) / (1024.0 * 1024.0);
+        printf("worker %d: %llu files (%llu mapped), %.1f MB in %.2fs,"
+               " %.1f MB/s\n", t, (unsigned long long) w->files,
+               (unsigned long long) w->mapped, mb, w->seconds,
+               (w->seconds > 0.0) ? (mb / w->seconds) : 0.0);
+        totalbytes += w->bytes;
+    } /* for */
+
+    printf("total: %.1f MB in %.2fs on %d thread%s, %.1f MB/s\n",
+           ((double) totalbytes) / (1024.0 * 1024.0), elapsed, threads,
+           (threads == 1) ? "" : "s",
+           (elapsed > 0.0) ?
+                ((((double) totalbytes) / (1024.0 * 1024.0)) / elapsed) : 0.0);
+
+    for (i = 0; i < filecount; i++)
+        free(files[i].fname);
+    free(files);
+
     PHYSFS_deinit();
     if (failure)
         return 5;
@@ -178,4 +477,3 @@ int main(int argc, char **argv)
 } /* main */
 
 /* end of physfsunpack.c ... */
-
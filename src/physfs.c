@@ -11,6 +11,8 @@
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_internal.h"
 
+#include <stddef.h>  /* offsetof() */
+
 #if defined(_MSC_VER)
 #include <stdarg.h>
 
@@ -47,10 +49,15 @@ typedef struct __PHYSFS_DIRHANDLE__
     char *dirName;  /* Path to archive in platform-dependent notation. */
     char *mountPoint; /* Mountpoint in virtual file tree. */
     const PHYSFS_Archiver *funcs;  /* Ptr to archiver info for this handle. */
+    PHYSFS_Stats stats;  /* counts from files closed and opens that missed. */
+    int ignoreCase;  /* non-zero if PHYSFS_setIgnoreCase() was used on us. */
+    void *watch;  /* platform change notification, while PHYSFS_watch()ing. */
     struct __PHYSFS_DIRHANDLE__ *next;  /* linked list stuff. */
 } DirHandle;
 
 
+struct __PHYSFS_ASYNCJOB__;
+
 typedef struct __PHYSFS_FILEHANDLE__
 {
     PHYSFS_Io *io;  /* Instance data unique to the archiver for this file. */
@@ -60,21 +67,40 @@ typedef struct __PHYSFS_FILEHANDLE__
     size_t bufsize;  /* Bufsize, if set (0 otherwise). Don't touch! */
     size_t buffill;  /* Buffer fill size. Don't touch! */
     size_t bufpos;  /* Buffer position. Don't touch! */
+    size_t bufrequest;  /* what PHYSFS_setBuffer() asked for. Don't touch! */
+    PHYSFS_uint8 bufmode;  /* a PHYSFS_BufferMode. Don't touch! */
+    int bufscore;  /* PHYSFS_BUFFER_ADAPTIVE: >0 wants bigger, <0 smaller. */
+    const void *mapping;  /* Set by PHYSFS_mapFile() if we must unmap it. */
+    PHYSFS_uint64 mappinglen;  /* Length of (mapping). */
+    PHYSFS_Io *asyncIo;  /* PHYSFS_readAsync()'s own duplicate of (io). */
+    struct __PHYSFS_ASYNCJOB__ *asyncJobs;  /* queued reads, oldest first. */
+    struct __PHYSFS_ASYNCJOB__ *asyncRunning;  /* read a worker is doing. */
+    void *asyncIdle;  /* semaphore PHYSFS_close() waits on if we're busy. */
+    PHYSFS_Stats stats;  /* what's been done with this handle. */
     struct __PHYSFS_FILEHANDLE__ *next;  /* linked list stuff. */
 } FileHandle;
 
 
 typedef struct __PHYSFS_ERRSTATETYPE__
 {
+#ifdef __PHYSFS_THREAD_LOCAL
+    PHYSFS_uint32 generation;  /* only valid if it matches errorGeneration. */
+#else
     void *tid;
-    PHYSFS_ErrorCode code;
     struct __PHYSFS_ERRSTATETYPE__ *next;
+#endif
+    PHYSFS_ErrorCode code;
 } ErrState;
 
 
 /* General PhysicsFS state ... */
 static int initialized = 0;
+#ifdef __PHYSFS_THREAD_LOCAL
+static __PHYSFS_THREAD_LOCAL ErrState threadErrorState;
+static PHYSFS_uint32 errorGeneration = 1;  /* bumped by freeErrorStates(). */
+#else
 static ErrState *errorStates = NULL;
+#endif
 static DirHandle *searchPath = NULL;
 static DirHandle *writeDir = NULL;
 static FileHandle *openWriteList = NULL;
@@ -82,14 +108,32 @@ static FileHandle *openReadList = NULL;
 static char *baseDir = NULL;
 static char *userDir = NULL;
 static char *prefDir = NULL;
+static char *indexCacheDir = NULL;  /* see PHYSFS_setIndexCacheDir(). */
 static int allowSymLinks = 0;
+static int verifyCrcs = 0;
+static int mapArchives = 0;  /* see PHYSFS_setMapArchives(). */
 static PHYSFS_Archiver **archivers = NULL;
 static PHYSFS_ArchiveInfo **archiveInfo = NULL;
 static volatile size_t numArchivers = 0;
+static PHYSFS_Stats globalStats;  /* closed files, misses, lock waits. */
+PHYSFS_TraceCallback __PHYSFS_traceHook = NULL;  /* PHYSFS_setTraceHook(). */
+static void *traceData = NULL;
 
 /* mutexes ... */
 static void *errorLock = NULL;     /* protects error message list.        */
-static void *stateLock = NULL;     /* protects other PhysFS static state. */
+static void *stateLock = NULL;     /* rwlock for other PhysFS static state. */
+static void *openListLock = NULL;  /* protects the open file lists.       */
+static size_t serializedDirs = 0;  /* open DirHandles needing exclusivity. */
+static int pendingMounts = 0;  /* PHYSFS_mountMany() calls still parsing. */
+static void *asyncLock = NULL;  /* protects the async i/o queue and pool. */
+static void *watchLock = NULL;  /* protects the change notification queue. */
+static void *watchCallbackLock = NULL;  /* held while calling watchers. */
+static void *internLock = NULL;  /* protects interned paths' lookup caches. */
+static PHYSFS_uint32 searchPathGeneration = 0;  /* bumped by mount changes. */
+
+/* workers PHYSFS_readAsync() and friends start with, unless told otherwise. */
+#define ASYNC_DEFAULT_THREADS 2
+static int asyncThreads = ASYNC_DEFAULT_THREADS;
 
 /* allocator ... */
 static int externalAllocator = 0;
@@ -100,10 +144,10 @@ PHYSFS_Allocator allocator;
 static inline int __PHYSFS_atomicAdd(int *ptrval, const int val)
 {
     int retval;
-    __PHYSFS_platformGrabMutex(stateLock);
-    retval = *ptrval;
-    *ptrval = retval + val;
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformGrabMutex(openListLock);
+    retval = *ptrval + val;
+    *ptrval = retval;
+    __PHYSFS_platformReleaseMutex(openListLock);
     return retval;
 } /* __PHYSFS_atomicAdd */
 
@@ -118,6 +162,198 @@ int __PHYSFS_ATOMIC_DECR(int *ptrval)
 } /* __PHYSFS_ATOMIC_DECR */
 #endif
 
+#ifdef PHYSFS_NEED_ATOMIC64_FALLBACK
+void __PHYSFS_ATOMIC_ADD64(PHYSFS_uint64 *ptrval, PHYSFS_uint64 val)
+{
+    __PHYSFS_platformGrabMutex(openListLock);
+    *ptrval += val;
+    __PHYSFS_platformReleaseMutex(openListLock);
+} /* __PHYSFS_ATOMIC_ADD64 */
+
+PHYSFS_uint64 __PHYSFS_ATOMIC_GET64(const PHYSFS_uint64 *ptrval)
+{
+    PHYSFS_uint64 retval;
+    __PHYSFS_platformGrabMutex(openListLock);
+    retval = *ptrval;
+    __PHYSFS_platformReleaseMutex(openListLock);
+    return retval;
+} /* __PHYSFS_ATOMIC_GET64 */
+#endif
+
+#define STAT_ADD(stats, field, val) __PHYSFS_ATOMIC_ADD64(&(stats)->field, val)
+
+/* Add every counter in (add) to (total). */
+static void statsAdd(PHYSFS_Stats *total, const PHYSFS_Stats *add)
+{
+    PHYSFS_uint64 *dst = (PHYSFS_uint64 *) total;
+    const PHYSFS_uint64 *src = (const PHYSFS_uint64 *) add;
+    size_t i;
+
+    for (i = 0; i < sizeof (PHYSFS_Stats) / sizeof (PHYSFS_uint64); i++)
+        __PHYSFS_ATOMIC_ADD64(&dst[i], __PHYSFS_ATOMIC_GET64(&src[i]));
+} /* statsAdd */
+
+
+/*
+ * Snapshot an open file's counters. Its Io might know better than we do how
+ *  much came off the disk, and what it cost to decompress. Hold openListLock,
+ *  so (fh) can't be closed out from under us.
+ */
+static void fileStats(const FileHandle *fh, PHYSFS_Stats *stats)
+{
+    memset(stats, '\0', sizeof (*stats));
+    statsAdd(stats, &fh->stats);
+
+    #if PHYSFS_SUPPORTS_ZIP
+    {
+        PHYSFS_Stats zs;
+        if (ZIP_ioStats(fh->io, &zs))
+        {
+            stats->rawBytesRead = 0;  /* we only saw what was decoded. */
+            statsAdd(stats, &zs);
+            if ((fh->asyncIo != NULL) && (ZIP_ioStats(fh->asyncIo, &zs)))
+                statsAdd(stats, &zs);
+        } /* if */
+    }
+    #endif
+} /* fileStats */
+
+
+
+/*
+ * Object pools; see __PHYSFS_poolAlloc(). They're simple mutex-protected
+ *  freelists: the lock is only held for a couple of pointer swaps, which
+ *  is still far cheaper than a trip through the allocator.
+ */
+#define POOL_DEFAULT_LIMIT 64
+
+static void *poolLock = NULL;  /* protects everything below. */
+static PHYSFS_uint32 poolLimit = POOL_DEFAULT_LIMIT;
+static __PHYSFS_Pool *pools = NULL;  /* every pool that has held anything. */
+
+__PHYSFS_Pool __PHYSFS_IoPool = __PHYSFS_POOL_INIT(sizeof (PHYSFS_Io), NULL);
+static __PHYSFS_Pool fileHandlePool =
+                            __PHYSFS_POOL_INIT(sizeof (FileHandle), NULL);
+
+void *__PHYSFS_poolAlloc(__PHYSFS_Pool *pool)
+{
+    void *retval = NULL;
+
+    assert(pool->size >= sizeof (void *));
+
+    if (poolLock != NULL)
+    {
+        __PHYSFS_platformGrabMutex(poolLock);
+        retval = pool->freelist;
+        if (retval != NULL)
+        {
+            pool->freelist = *((void **) retval);
+            pool->count--;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(poolLock);
+    } /* if */
+
+    if (retval != NULL)
+        *((void **) retval) = NULL;
+    else
+    {
+        retval = allocator.Malloc(pool->size);
+        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memset(retval, '\0', pool->size);
+    } /* else */
+
+    return retval;
+} /* __PHYSFS_poolAlloc */
+
+
+void __PHYSFS_poolFree(__PHYSFS_Pool *pool, void *obj)
+{
+    if (obj == NULL)
+        return;
+
+    if (poolLock != NULL)
+    {
+        __PHYSFS_platformGrabMutex(poolLock);
+        if (pool->count < poolLimit)
+        {
+            if (!pool->listed)
+            {
+                pool->listed = 1;
+                pool->next = pools;
+                pools = pool;
+            } /* if */
+            *((void **) obj) = pool->freelist;
+            pool->freelist = obj;
+            pool->count++;
+            obj = NULL;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(poolLock);
+    } /* if */
+
+    if (obj != NULL)  /* no room for it. */
+    {
+        if (pool->discard != NULL)
+            pool->discard(obj);
+        allocator.Free(obj);
+    } /* if */
+} /* __PHYSFS_poolFree */
+
+
+/* MAKE SURE you hold the poolLock before calling this! */
+static void poolTrim(void)
+{
+    __PHYSFS_Pool *pool;
+
+    for (pool = pools; pool != NULL; pool = pool->next)
+    {
+        while (pool->count > poolLimit)
+        {
+            void *obj = pool->freelist;
+            pool->freelist = *((void **) obj);
+            pool->count--;
+            *((void **) obj) = NULL;
+            if (pool->discard != NULL)
+                pool->discard(obj);
+            allocator.Free(obj);
+        } /* while */
+    } /* for */
+} /* poolTrim */
+
+
+/* empty every pool, and forget them; for PHYSFS_deinit(). */
+static void poolShutdown(void)
+{
+    const PHYSFS_uint32 limit = poolLimit;
+    __PHYSFS_Pool *pool;
+    __PHYSFS_Pool *next;
+
+    __PHYSFS_platformGrabMutex(poolLock);
+    poolLimit = 0;
+    poolTrim();
+    poolLimit = limit;
+    for (pool = pools; pool != NULL; pool = next)
+    {
+        next = pool->next;
+        pool->next = NULL;
+        pool->listed = 0;
+    } /* for */
+    pools = NULL;
+    __PHYSFS_platformReleaseMutex(poolLock);
+} /* poolShutdown */
+
+
+void PHYSFS_setPoolLimit(PHYSFS_uint32 count)
+{
+    if (poolLock == NULL)  /* not initialized; nothing is pooled yet. */
+        poolLimit = count;
+    else
+    {
+        __PHYSFS_platformGrabMutex(poolLock);
+        poolLimit = count;
+        poolTrim();
+        __PHYSFS_platformReleaseMutex(poolLock);
+    } /* else */
+} /* PHYSFS_setPoolLimit */
 
 
 /* PHYSFS_Io implementation for i/o to physical filesystem... */
@@ -128,11 +364,31 @@ typedef struct __PHYSFS_NativeIoInfo
     void *handle;
     const char *path;
     int mode;   /* 'r', 'w', or 'a' */
+    PHYSFS_uint64 pos;  /* read position, if (mode) is 'r'. */
+    PHYSFS_Io *parent;  /* non-NULL if we share (parent)'s handle. */
+    int refcount;  /* Ios using (handle), counting the parent itself. */
 } NativeIoInfo;
 
+/*
+ * Read handles keep their own position and only do positional reads, so
+ *  readAt() from other threads can't move it out from under read(), even
+ *  on platforms where a positional read moves the file pointer.
+ */
 static PHYSFS_sint64 nativeIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+
+    #ifndef PHYSFS_NO_PLATFORM_READAT
+    if (info->mode == 'r')
+    {
+        const PHYSFS_sint64 rc = __PHYSFS_platformReadAt(info->handle, buf,
+                                                         len, info->pos);
+        if (rc > 0)
+            info->pos += (PHYSFS_uint64) rc;
+        return rc;
+    } /* if */
+    #endif
+
     return __PHYSFS_platformRead(info->handle, buf, len);
 } /* nativeIo_read */
 
@@ -146,12 +402,27 @@ static PHYSFS_sint64 nativeIo_write(PHYSFS_Io *io, const void *buffer,
 static int nativeIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+
+    #ifndef PHYSFS_NO_PLATFORM_READAT
+    if (info->mode == 'r')
+    {
+        info->pos = offset;
+        return 1;
+    } /* if */
+    #endif
+
     return __PHYSFS_platformSeek(info->handle, offset);
 } /* nativeIo_seek */
 
 static PHYSFS_sint64 nativeIo_tell(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+
+    #ifndef PHYSFS_NO_PLATFORM_READAT
+    if (info->mode == 'r')
+        return (PHYSFS_sint64) info->pos;
+    #endif
+
     return __PHYSFS_platformTell(info->handle);
 } /* nativeIo_tell */
 
@@ -161,9 +432,60 @@ static PHYSFS_sint64 nativeIo_length(PHYSFS_Io *io)
     return __PHYSFS_platformFileLength(info->handle);
 } /* nativeIo_length */
 
+#ifndef PHYSFS_NO_PLATFORM_READAT
+/*
+ * Read handles only do positional reads, so duplicates can share one OS
+ *  handle and just keep their own position, like memory Ios share their
+ *  buffer. This saves an open() per file opened from an archive, and keeps
+ *  thousands of open entries from needing thousands of file descriptors.
+ */
+static PHYSFS_Io *nativeIo_share(PHYSFS_Io *io)
+{
+    NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    NativeIoInfo *newinfo = NULL;
+    PHYSFS_Io *retval = NULL;
+
+    if (info->parent != NULL)  /* avoid deep chains; share the original. */
+    {
+        io = info->parent;
+        info = (NativeIoInfo *) io->opaque;
+        assert(info->parent == NULL);
+    } /* if */
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    newinfo = (NativeIoInfo *) allocator.Malloc(sizeof (NativeIoInfo));
+    if (!newinfo)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    __PHYSFS_ATOMIC_INCR(&info->refcount);
+
+    newinfo->handle = info->handle;
+    newinfo->path = info->path;
+    newinfo->mode = info->mode;
+    newinfo->pos = 0;
+    newinfo->parent = io;
+    newinfo->refcount = 0;
+
+    memcpy(retval, io, sizeof (*retval));
+    retval->opaque = newinfo;
+    return retval;
+} /* nativeIo_share */
+#endif
+
 static PHYSFS_Io *nativeIo_duplicate(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+
+    #ifndef PHYSFS_NO_PLATFORM_READAT
+    if (info->mode == 'r')
+        return nativeIo_share(io);
+    #endif
+
+    /* writers each need their own file pointer, so open it again. */
     return __PHYSFS_createNativeIo(info->path, info->mode);
 } /* nativeIo_duplicate */
 
@@ -176,12 +498,41 @@ static int nativeIo_flush(PHYSFS_Io *io)
 static void nativeIo_destroy(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    __PHYSFS_platformClose(info->handle);
-    allocator.Free((void *) info->path);
-    allocator.Free(info);
-    allocator.Free(io);
+    PHYSFS_Io *parent = info->parent;
+
+    if (parent != NULL)
+    {
+        assert(info->handle == ((NativeIoInfo *) parent->opaque)->handle);
+        assert(info->refcount == 0);
+        allocator.Free(info);
+        allocator.Free(io);
+        parent->destroy(parent);  /* decrements refcount. */
+        return;
+    } /* if */
+
+    /* we _are_ the parent; the handle goes when the last sharer does. */
+    assert(info->refcount > 0);
+
+    if (__PHYSFS_ATOMIC_DECR(&info->refcount) == 0)
+    {
+        __PHYSFS_platformClose(info->handle);
+        allocator.Free((void *) info->path);
+        allocator.Free(info);
+        allocator.Free(io);
+    } /* if */
 } /* nativeIo_destroy */
 
+#ifndef PHYSFS_NO_PLATFORM_READAT
+static PHYSFS_sint64 nativeIo_readAt(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    return __PHYSFS_platformReadAt(info->handle, buf, len, offset);
+} /* nativeIo_readAt */
+#else
+#define nativeIo_readAt NULL
+#endif
+
 static const PHYSFS_Io __PHYSFS_nativeIoInterface =
 {
     CURRENT_PHYSFS_IO_API_VERSION, NULL,
@@ -192,7 +543,8 @@ static const PHYSFS_Io __PHYSFS_nativeIoInterface =
     nativeIo_length,
     nativeIo_duplicate,
     nativeIo_flush,
-    nativeIo_destroy
+    nativeIo_destroy,
+    nativeIo_readAt
 };
 
 PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
@@ -224,8 +576,13 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
     info->handle = handle;
     info->path = pathdup;
     info->mode = mode;
+    info->pos = 0;
+    info->parent = NULL;
+    info->refcount = 1;
     memcpy(io, &__PHYSFS_nativeIoInterface, sizeof (*io));
     io->opaque = info;
+    if (mode != 'r')
+        io->readAt = NULL;  /* only read handles can do this. */
     return io;
 
 createNativeIo_failed:
@@ -246,6 +603,7 @@ typedef struct __PHYSFS_MemoryIoInfo
     PHYSFS_uint64 pos;
     PHYSFS_Io *parent;
     int refcount;
+    int mapped;  /* non-zero if (buf) came from __PHYSFS_platformMapFile(). */
     void (*destruct)(void *);
 } MemoryIoInfo;
 
@@ -358,14 +716,33 @@ static void memoryIo_destroy(PHYSFS_Io *io)
     {
         void (*destruct)(void *) = info->destruct;
         void *buf = (void *) info->buf;
+        const PHYSFS_uint64 len = info->len;
+        const int mapped = info->mapped;
         io->opaque = NULL;  /* kill this here in case of race. */
         allocator.Free(info);
         allocator.Free(io);
-        if (destruct != NULL)
+        if (mapped)
+            __PHYSFS_platformUnmapFile(buf, len);
+        else if (destruct != NULL)
             destruct(buf);
     } /* if */
 } /* memoryIo_destroy */
 
+static PHYSFS_sint64 memoryIo_readAt(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+
+    if (offset >= info->len)
+        return 0;  /* at or past EOF; nothing to do. */
+
+    if (len > info->len - offset)
+        len = info->len - offset;
+
+    memcpy(buf, info->buf + offset, (size_t) len);
+    return (PHYSFS_sint64) len;
+} /* memoryIo_readAt */
+
 
 static const PHYSFS_Io __PHYSFS_memoryIoInterface =
 {
@@ -377,7 +754,8 @@ static const PHYSFS_Io __PHYSFS_memoryIoInterface =
     memoryIo_length,
     memoryIo_duplicate,
     memoryIo_flush,
-    memoryIo_destroy
+    memoryIo_destroy,
+    memoryIo_readAt
 };
 
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
@@ -410,6 +788,37 @@ createMemoryIo_failed:
 } /* __PHYSFS_createMemoryIo */
 
 
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path)
+{
+    PHYSFS_Io *io = NULL;
+    const void *ptr = NULL;
+    PHYSFS_sint64 len;
+    void *handle;
+
+    handle = __PHYSFS_platformOpenRead(path);
+    BAIL_IF_ERRPASS(!handle, NULL);
+
+    len = __PHYSFS_platformFileLength(handle);
+    GOTO_IF_ERRPASS(len < 0, createMappedIo_failed);
+    GOTO_IF(len == 0, PHYSFS_ERR_UNSUPPORTED, createMappedIo_failed);
+
+    ptr = __PHYSFS_platformMapFile(handle, 0, (PHYSFS_uint64) len);
+    GOTO_IF_ERRPASS(!ptr, createMappedIo_failed);
+
+    io = __PHYSFS_createMemoryIo(ptr, (PHYSFS_uint64) len, NULL);
+    GOTO_IF_ERRPASS(!io, createMappedIo_failed);
+    ((MemoryIoInfo *) io->opaque)->mapped = 1;
+
+    __PHYSFS_platformClose(handle);  /* the mapping outlives the handle. */
+    return io;
+
+createMappedIo_failed:
+    if (ptr != NULL) __PHYSFS_platformUnmapFile(ptr, (PHYSFS_uint64) len);
+    __PHYSFS_platformClose(handle);
+    return NULL;
+} /* __PHYSFS_createMappedIo */
+
+
 /* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
 
 static PHYSFS_sint64 handleIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
@@ -445,7 +854,7 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
      *  abstraction. We're allowed to: we're physfs.c!
      */
     FileHandle *origfh = (FileHandle *) io->opaque;
-    FileHandle *newfh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    FileHandle *newfh = (FileHandle *) __PHYSFS_poolAlloc(&fileHandlePool);
     PHYSFS_Io *retval = NULL;
 
     GOTO_IF(!newfh, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
@@ -469,8 +878,9 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
 
     newfh->forReading = origfh->forReading;
     newfh->dirHandle = origfh->dirHandle;
+    newfh->stats.opens = 1;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_platformGrabMutex(openListLock);
     if (newfh->forReading)
     {
         newfh->next = openReadList;
@@ -481,7 +891,7 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
         newfh->next = openWriteList;
         openWriteList = newfh;
     } /* else */
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseMutex(openListLock);
 
     memcpy(retval, io, sizeof (PHYSFS_Io));
     retval->opaque = newfh;
@@ -492,7 +902,7 @@ handleIo_dupe_failed:
     {
         if (newfh->io != NULL) newfh->io->destroy(newfh->io);
         if (newfh->buffer != NULL) allocator.Free(newfh->buffer);
-        allocator.Free(newfh);
+        __PHYSFS_poolFree(&fileHandlePool, newfh);
     } /* if */
 
     return NULL;
@@ -520,7 +930,8 @@ static const PHYSFS_Io __PHYSFS_handleIoInterface =
     handleIo_length,
     handleIo_duplicate,
     handleIo_flush,
-    handleIo_destroy
+    handleIo_destroy,
+    NULL  /* PHYSFS_File has no positional reads. */
 };
 
 static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
@@ -533,86 +944,424 @@ static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
 } /* __PHYSFS_createHandleIo */
 
 
-/* functions ... */
-
-typedef struct
-{
-    char **list;
-    PHYSFS_uint32 size;
-    PHYSFS_ErrorCode errcode;
-} EnumStringListCallbackData;
-
-static void enumStringListCallback(void *data, const char *str)
+const void *__PHYSFS_mapIo(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                           PHYSFS_uint64 len, int *mapped)
 {
-    void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    if (mapped != NULL)
+        *mapped = 0;
 
-    if (pecd->errcode)
-        return;
+    /* peel off layers until we get to something that has the bytes. */
+    while (1)
+    {
+        PHYSFS_Io *source = NULL;
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
+        if (io->read == memoryIo_read)  /* includes mapped Ios. */
+        {
+            const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+            BAIL_IF(pos > info->len, PHYSFS_ERR_PAST_EOF, NULL);
+            BAIL_IF(len > info->len - pos, PHYSFS_ERR_PAST_EOF, NULL);
+            return info->buf + pos;
+        } /* if */
 
-    if ((ptr == NULL) || (newstr == NULL))
-    {
-        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        pecd->list[pecd->size] = NULL;
-        PHYSFS_freeList(pecd->list);
-        return;
-    } /* if */
+        else if (io->read == nativeIo_read)
+        {
+            static const PHYSFS_uint8 empty = 0;
+            const NativeIoInfo *info = (const NativeIoInfo *) io->opaque;
+            const void *retval;
+            BAIL_IF(info->mode != 'r', PHYSFS_ERR_OPEN_FOR_WRITING, NULL);
+            BAIL_IF(mapped == NULL, PHYSFS_ERR_UNSUPPORTED, NULL);
+            if (len == 0)
+                return &empty;  /* can't map zero bytes, but don't need to. */
+            retval = __PHYSFS_platformMapFile(info->handle, pos, len);
+            BAIL_IF_ERRPASS(!retval, NULL);
+            *mapped = 1;
+            return retval;
+        } /* else if */
 
-    strcpy(newstr, str);
-    pecd->list[pecd->size] = newstr;
-    pecd->size++;
-} /* enumStringListCallback */
+        else if (io->read == handleIo_read)  /* skip past the buffering. */
+            source = ((FileHandle *) io->opaque)->io;
 
+        else if ((source = UNPK_sourceIo(io, &pos, len)) != NULL)
+            { /* nothing else to do. */ }
 
-static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
-{
-    EnumStringListCallbackData ecd;
-    memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    func(enumStringListCallback, &ecd);
+        #if PHYSFS_SUPPORTS_ZIP
+        else if ((source = ZIP_sourceIo(io, &pos, len)) != NULL)
+            { /* nothing else to do. */ }
+        #endif
 
-    if (ecd.errcode)
-    {
-        PHYSFS_setErrorCode(ecd.errcode);
-        return NULL;
-    } /* if */
+        BAIL_IF(!source, PHYSFS_ERR_UNSUPPORTED, NULL);
+        io = source;
+    } /* while */
 
-    ecd.list[ecd.size] = NULL;
-    return ecd.list;
-} /* doEnumStringList */
+    return NULL;  /* shouldn't hit this. */
+} /* __PHYSFS_mapIo */
 
 
-static void __PHYSFS_bubble_sort(void *a, size_t lo, size_t hi,
-                                 int (*cmpfn)(void *, size_t, size_t),
-                                 void (*swapfn)(void *, size_t, size_t))
+int __PHYSFS_prefetchIo(PHYSFS_Io *io, PHYSFS_uint64 pos, PHYSFS_uint64 len)
 {
-    size_t i;
-    int sorted;
-
-    do
+    /* peel off layers until we get to the file the bytes really live in. */
+    while (1)
     {
-        sorted = 1;
-        for (i = lo; i < hi; i++)
+        PHYSFS_Io *source = NULL;
+
+        if (len == 0)
+            return 1;  /* nothing to do. */
+
+        else if (io->read == memoryIo_read)  /* includes mapped Ios. */
         {
-            if (cmpfn(a, i, i + 1) > 0)
-            {
-                swapfn(a, i, i + 1);
-                sorted = 0;
-            } /* if */
-        } /* for */
-    } while (!sorted);
-} /* __PHYSFS_bubble_sort */
+            const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+            const MemoryIoInfo *owner = info;
+            if (info->parent != NULL)  /* duplicates share their parent's. */
+                owner = (const MemoryIoInfo *) info->parent->opaque;
+            if (!owner->mapped)
+                return 1;  /* already in memory. */
+            BAIL_IF(pos > info->len, PHYSFS_ERR_PAST_EOF, 0);
+            if (len > info->len - pos)
+                len = info->len - pos;
+            return __PHYSFS_platformPrefetchMapped(info->buf + pos, len);
+        } /* else if */
+
+        else if (io->read == nativeIo_read)
+        {
+            const NativeIoInfo *info = (const NativeIoInfo *) io->opaque;
+            BAIL_IF(info->mode != 'r', PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+            return __PHYSFS_platformPrefetch(info->handle, pos, len);
+        } /* else if */
 
+        else if (io->read == handleIo_read)  /* skip past the buffering. */
+            source = ((FileHandle *) io->opaque)->io;
 
-static void __PHYSFS_quick_sort(void *a, size_t lo, size_t hi,
-                         int (*cmpfn)(void *, size_t, size_t),
+        else if ((source = UNPK_sourceIo(io, &pos, len)) != NULL)
+            { /* nothing else to do. */ }
+
+        #if PHYSFS_SUPPORTS_ZIP
+        else if ((source = ZIP_spanIo(io, &pos, &len)) != NULL)
+            { /* nothing else to do. */ }
+        #endif
+
+        BAIL_IF(!source, PHYSFS_ERR_UNSUPPORTED, 0);
+        io = source;
+    } /* while */
+
+    return 0;  /* shouldn't hit this. */
+} /* __PHYSFS_prefetchIo */
+
+
+/*
+ * The decompressed-asset cache.
+ *
+ * Archivers can hand us a fully decompressed copy of a small file, keyed by
+ *  (archive, entry), and get it back on later opens as a duplicate of a
+ *  memory Io, so every open of a cached file shares one refcounted buffer.
+ *  When the cache holds more than the budget, the least recently used files
+ *  are dropped; their buffers are freed once nothing has them open.
+ *
+ * This is off until the app sets a budget with PHYSFS_setCacheBudget().
+ */
+#define CACHE_HASH_BUCKETS 256
+
+typedef struct __PHYSFS_CACHEENTRY__
+{
+    const void *archive;  /* archiver's opaque pointer for the archive. */
+    const void *entry;    /* archiver's identifier for the file. */
+    PHYSFS_Io *io;        /* memory Io that owns the decompressed bytes. */
+    PHYSFS_uint64 len;    /* size of the decompressed file. */
+    struct __PHYSFS_CACHEENTRY__ *hashnext;  /* hash bucket chain. */
+    struct __PHYSFS_CACHEENTRY__ *prev;  /* LRU list, more recently used. */
+    struct __PHYSFS_CACHEENTRY__ *next;  /* LRU list, less recently used. */
+} CacheEntry;
+
+static void *cacheLock = NULL;  /* protects everything below. */
+static PHYSFS_uint64 cacheBudget = 0;
+static CacheEntry *cacheBuckets[CACHE_HASH_BUCKETS];
+static CacheEntry *cacheNewest = NULL;
+static CacheEntry *cacheOldest = NULL;
+static PHYSFS_CacheStats cacheStats;
+
+static inline size_t cacheHash(const void *archive, const void *entry)
+{
+    const size_t a = (size_t) archive;
+    const size_t e = (size_t) entry;
+    return ((a >> 4) ^ (e >> 3) ^ (e >> 11)) % CACHE_HASH_BUCKETS;
+} /* cacheHash */
+
+
+/* MAKE SURE you hold the cacheLock before calling this! */
+static void cacheRemove(CacheEntry *ce)
+{
+    CacheEntry **bucket = &cacheBuckets[cacheHash(ce->archive, ce->entry)];
+
+    while (*bucket != ce)
+        bucket = &(*bucket)->hashnext;
+    *bucket = ce->hashnext;
+
+    if (ce->prev) ce->prev->next = ce->next; else cacheNewest = ce->next;
+    if (ce->next) ce->next->prev = ce->prev; else cacheOldest = ce->prev;
+
+    cacheStats.bytes -= ce->len;
+    cacheStats.entries--;
+
+    ce->io->destroy(ce->io);  /* open duplicates keep the buffer alive. */
+    allocator.Free(ce);
+} /* cacheRemove */
+
+
+/* MAKE SURE you hold the cacheLock before calling this! */
+static void cacheTrim(void)
+{
+    while ((cacheOldest != NULL) && (cacheStats.bytes > cacheBudget))
+        cacheRemove(cacheOldest);
+} /* cacheTrim */
+
+
+int __PHYSFS_cacheWants(const PHYSFS_uint64 len)
+{
+    /* don't let any one file push out a big part of the cache. */
+    return ((cacheBudget > 0) && (len <= (cacheBudget / 8)));
+} /* __PHYSFS_cacheWants */
+
+
+PHYSFS_Io *__PHYSFS_cacheLookup(const void *archive, const void *entry)
+{
+    PHYSFS_Io *retval = NULL;
+    CacheEntry *ce;
+
+    __PHYSFS_platformGrabMutex(cacheLock);
+
+    ce = cacheBuckets[cacheHash(archive, entry)];
+    while ((ce != NULL) && ((ce->archive != archive) || (ce->entry != entry)))
+        ce = ce->hashnext;
+
+    if (ce == NULL)
+        cacheStats.misses++;
+    else
+    {
+        cacheStats.hits++;
+        if (ce->prev != NULL)  /* move to the front of the LRU list. */
+        {
+            ce->prev->next = ce->next;
+            if (ce->next) ce->next->prev = ce->prev; else cacheOldest = ce->prev;
+            ce->prev = NULL;
+            ce->next = cacheNewest;
+            cacheNewest->prev = ce;
+            cacheNewest = ce;
+        } /* if */
+        retval = ce->io->duplicate(ce->io);
+    } /* else */
+
+    __PHYSFS_platformReleaseMutex(cacheLock);
+
+    return retval;
+} /* __PHYSFS_cacheLookup */
+
+
+PHYSFS_Io *__PHYSFS_cacheInsert(const void *archive, const void *entry,
+                                PHYSFS_Io *io)
+{
+    const PHYSFS_sint64 len = io->length(io);
+    PHYSFS_Io *memio = NULL;
+    PHYSFS_Io *retval = NULL;
+    CacheEntry *ce = NULL;
+    void *buf = NULL;
+
+    if (len < 0)
+        return io;  /* just don't cache it. */
+
+    buf = allocator.Malloc(len ? (size_t) len : 1);
+    if (buf == NULL)
+        return io;
+
+    if (!__PHYSFS_readAll(io, buf, (size_t) len))
+    {
+        allocator.Free(buf);
+        io->destroy(io);
+        return NULL;
+    } /* if */
+
+    memio = __PHYSFS_createMemoryIo(buf, (PHYSFS_uint64) len, allocator.Free);
+    if (memio == NULL)
+        allocator.Free(buf);
+    else
+    {
+        retval = memio->duplicate(memio);
+        ce = (CacheEntry *) allocator.Malloc(sizeof (CacheEntry));
+    } /* else */
+
+    if (retval == NULL)  /* out of memory; hand back the original. */
+    {
+        if (ce) allocator.Free(ce);
+        if (memio) memio->destroy(memio);
+        if (io->seek(io, 0))
+            return io;
+        io->destroy(io);
+        return NULL;
+    } /* if */
+
+    io->destroy(io);
+
+    if (ce == NULL)
+    {
+        memio->destroy(memio);  /* (retval) still holds the buffer. */
+        return retval;
+    } /* if */
+
+    ce->archive = archive;
+    ce->entry = entry;
+    ce->io = memio;
+    ce->len = (PHYSFS_uint64) len;
+
+    __PHYSFS_platformGrabMutex(cacheLock);
+    {
+        const size_t hashval = cacheHash(archive, entry);
+        CacheEntry *i = cacheBuckets[hashval];
+        while ((i != NULL) && ((i->archive != archive) || (i->entry != entry)))
+            i = i->hashnext;
+
+        if (i != NULL)  /* another thread beat us to it. */
+        {
+            memio->destroy(memio);
+            allocator.Free(ce);
+        } /* if */
+        else
+        {
+            ce->hashnext = cacheBuckets[hashval];
+            cacheBuckets[hashval] = ce;
+            ce->prev = NULL;
+            ce->next = cacheNewest;
+            if (cacheNewest) cacheNewest->prev = ce; else cacheOldest = ce;
+            cacheNewest = ce;
+            cacheStats.bytes += ce->len;
+            cacheStats.entries++;
+            cacheTrim();
+        } /* else */
+    }
+    __PHYSFS_platformReleaseMutex(cacheLock);
+
+    return retval;
+} /* __PHYSFS_cacheInsert */
+
+
+void __PHYSFS_cacheInvalidate(const void *archive)
+{
+    CacheEntry *ce;
+    CacheEntry *next;
+
+    __PHYSFS_platformGrabMutex(cacheLock);
+    for (ce = cacheNewest; ce != NULL; ce = next)
+    {
+        next = ce->next;
+        if (ce->archive == archive)
+            cacheRemove(ce);
+    } /* for */
+    __PHYSFS_platformReleaseMutex(cacheLock);
+} /* __PHYSFS_cacheInvalidate */
+
+
+void PHYSFS_setCacheBudget(PHYSFS_uint64 budget)
+{
+    if (cacheLock == NULL)  /* not initialized; nothing is cached yet. */
+        cacheBudget = budget;
+    else
+    {
+        __PHYSFS_platformGrabMutex(cacheLock);
+        cacheBudget = budget;
+        cacheTrim();
+        __PHYSFS_platformReleaseMutex(cacheLock);
+    } /* else */
+} /* PHYSFS_setCacheBudget */
+
+
+int PHYSFS_getCacheStats(PHYSFS_CacheStats *stats)
+{
+    BAIL_IF(!stats, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    __PHYSFS_platformGrabMutex(cacheLock);
+    memcpy(stats, &cacheStats, sizeof (*stats));
+    __PHYSFS_platformReleaseMutex(cacheLock);
+    return 1;
+} /* PHYSFS_getCacheStats */
+
+
+/* functions ... */
+
+typedef struct
+{
+    char **list;
+    PHYSFS_uint32 size;
+    PHYSFS_ErrorCode errcode;
+} EnumStringListCallbackData;
+
+static void enumStringListCallback(void *data, const char *str)
+{
+    void *ptr;
+    char *newstr;
+    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+
+    if (pecd->errcode)
+        return;
+
+    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
+    newstr = (char *) allocator.Malloc(strlen(str) + 1);
+    if (ptr != NULL)
+        pecd->list = (char **) ptr;
+
+    if ((ptr == NULL) || (newstr == NULL))
+    {
+        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        pecd->list[pecd->size] = NULL;
+        PHYSFS_freeList(pecd->list);
+        return;
+    } /* if */
+
+    strcpy(newstr, str);
+    pecd->list[pecd->size] = newstr;
+    pecd->size++;
+} /* enumStringListCallback */
+
+
+static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
+{
+    EnumStringListCallbackData ecd;
+    memset(&ecd, '\0', sizeof (ecd));
+    ecd.list = (char **) allocator.Malloc(sizeof (char *));
+    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    func(enumStringListCallback, &ecd);
+
+    if (ecd.errcode)
+    {
+        PHYSFS_setErrorCode(ecd.errcode);
+        return NULL;
+    } /* if */
+
+    ecd.list[ecd.size] = NULL;
+    return ecd.list;
+} /* doEnumStringList */
+
+
+static void __PHYSFS_bubble_sort(void *a, size_t lo, size_t hi,
+                                 int (*cmpfn)(void *, size_t, size_t),
+                                 void (*swapfn)(void *, size_t, size_t))
+{
+    size_t i;
+    int sorted;
+
+    do
+    {
+        sorted = 1;
+        for (i = lo; i < hi; i++)
+        {
+            if (cmpfn(a, i, i + 1) > 0)
+            {
+                swapfn(a, i, i + 1);
+                sorted = 0;
+            } /* if */
+        } /* for */
+    } while (!sorted);
+} /* __PHYSFS_bubble_sort */
+
+
+static void __PHYSFS_quick_sort(void *a, size_t lo, size_t hi,
+                         int (*cmpfn)(void *, size_t, size_t),
                          void (*swapfn)(void *, size_t, size_t))
 {
     size_t i;
@@ -662,6 +1411,17 @@ void __PHYSFS_sort(void *entries, size_t max,
 } /* __PHYSFS_sort */
 
 
+#ifdef __PHYSFS_THREAD_LOCAL
+/*
+ * Every thread has its own ErrState in TLS, so this needs no lock and no
+ *  searching. It's stale if it was last set before a PHYSFS_deinit().
+ */
+static ErrState *findErrorForCurrentThread(void)
+{
+    ErrState *err = &threadErrorState;
+    return (err->generation == errorGeneration) ? err : NULL;
+} /* findErrorForCurrentThread */
+#else
 static ErrState *findErrorForCurrentThread(void)
 {
     ErrState *i;
@@ -690,6 +1450,7 @@ static ErrState *findErrorForCurrentThread(void)
 
     return NULL;   /* no error available. */
 } /* findErrorForCurrentThread */
+#endif
 
 
 /* this doesn't reset the error state. */
@@ -744,6 +1505,7 @@ PHYSFS_DECL const char *PHYSFS_getErrorByCode(PHYSFS_ErrorCode code)
         case PHYSFS_ERR_DUPLICATE: return "duplicate resource";
         case PHYSFS_ERR_BAD_PASSWORD: return "bad password";
         case PHYSFS_ERR_APP_CALLBACK: return "app callback reported error";
+        case PHYSFS_ERR_CANCELLED: return "operation cancelled";
     } /* switch */
 
     return NULL;  /* don't know this error code. */
@@ -757,6 +1519,10 @@ void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
     if (!errcode)
         return;
 
+    #ifdef __PHYSFS_THREAD_LOCAL
+    err = &threadErrorState;
+    err->generation = errorGeneration;
+    #else
     err = findErrorForCurrentThread();
     if (err == NULL)
     {
@@ -776,6 +1542,7 @@ void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
         if (errorLock != NULL)
             __PHYSFS_platformReleaseMutex(errorLock);
     } /* if */
+    #endif
 
     err->code = errcode;
 } /* PHYSFS_setErrorCode */
@@ -791,6 +1558,11 @@ const char *PHYSFS_getLastError(void)
 /* MAKE SURE that errorLock is held before calling this! */
 static void freeErrorStates(void)
 {
+    #ifdef __PHYSFS_THREAD_LOCAL
+    /* can't reach other threads' TLS, so make every ErrState stale instead. */
+    if (++errorGeneration == 0)
+        errorGeneration = 1;  /* a new thread's zeroed ErrState is never valid. */
+    #else
     ErrState *i;
     ErrState *next;
 
@@ -801,6 +1573,7 @@ static void freeErrorStates(void)
     } /* for */
 
     errorStates = NULL;
+    #endif
 } /* freeErrorStates */
 
 
@@ -866,11 +1639,100 @@ static DirHandle *tryOpenDir(PHYSFS_Io *io, const PHYSFS_Archiver *funcs,
 } /* tryOpenDir */
 
 
+/* on 32-bit platforms, don't let a few big archives eat the address space. */
+#define MAX_MAPPED_ARCHIVE_32BIT (256 * 1024 * 1024)
+
+/* How much of a file's start and end we show to PHYSFS_Archiver::detect.
+   The header reaches past an .iso's first volume descriptor, the trailer
+   covers the furthest a .zip's end-of-central-directory record can be
+   from the end of the file (a 64k comment plus the record itself). */
+#define DETECT_HEADER_LEN (32768 + 2048)
+#define DETECT_TRAILER_LEN (0xFFFF + 22)
+
+/*
+ * Rank every archiver for (io), by reading the start and end of the file
+ *  once and showing it to each detect(), so openDirectory() only calls
+ *  openArchive() on archivers that might want the file. (ranks) gets one
+ *  entry per archiver: the PHYSFS_DetectResult shifted left by one, plus
+ *  one if the archiver's extension matches (ext). If detection can't run,
+ *  everything is PHYSFS_DETECT_MAYBE, and the order is what it always was.
+ */
+static void rankArchivers(PHYSFS_Io *io, const char *ext, PHYSFS_uint8 *ranks)
+{
+    PHYSFS_uint8 *buf = NULL;
+    const PHYSFS_uint8 *header = NULL;
+    const PHYSFS_uint8 *trailer = NULL;
+    PHYSFS_uint64 headerlen = 0;
+    PHYSFS_uint64 trailerlen = 0;
+    PHYSFS_uint64 len = 0;
+    PHYSFS_sint64 rc;
+    int detecting = 0;
+    size_t i;
+
+    for (i = 0; i < numArchivers; i++)
+    {
+        ranks[i] = PHYSFS_DETECT_MAYBE << 1;
+        if ((ext != NULL) && (PHYSFS_utf8stricmp(ext, archivers[i]->info.extension) == 0))
+            ranks[i] |= 1;
+        if (archivers[i]->detect != NULL)
+            detecting = 1;
+    } /* for */
+
+    if (!detecting)
+        return;
+
+    rc = io->length(io);
+    if (rc <= 0)
+        return;  /* unknown length (or nothing to look at). Try everyone. */
+
+    len = (PHYSFS_uint64) rc;
+    headerlen = (len < DETECT_HEADER_LEN) ? len : DETECT_HEADER_LEN;
+    trailerlen = (len < DETECT_TRAILER_LEN) ? len : DETECT_TRAILER_LEN;
+
+    if (len <= DETECT_HEADER_LEN + DETECT_TRAILER_LEN)  /* one read for all. */
+    {
+        buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) len);
+        if ((!buf) || (!__PHYSFS_readAllAt(io, buf, (size_t) len, 0)))
+            goto rankArchivers_done;
+        header = buf;
+        trailer = buf + (len - trailerlen);
+    } /* if */
+    else
+    {
+        buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) (headerlen + trailerlen));
+        if ( (!buf) ||
+             (!__PHYSFS_readAllAt(io, buf, (size_t) headerlen, 0)) ||
+             (!__PHYSFS_readAllAt(io, buf + headerlen, (size_t) trailerlen,
+                                  len - trailerlen)) )
+            goto rankArchivers_done;
+        header = buf;
+        trailer = buf + headerlen;
+    } /* else */
+
+    for (i = 0; i < numArchivers; i++)
+    {
+        const PHYSFS_Archiver *arc = archivers[i];
+        if (arc->detect != NULL)
+        {
+            PHYSFS_DetectResult r;
+            r = arc->detect(header, headerlen, trailer, trailerlen);
+            if ((r != PHYSFS_DETECT_NO) && (r != PHYSFS_DETECT_YES))
+                r = PHYSFS_DETECT_MAYBE;  /* garbage? Play it safe. */
+            ranks[i] = (PHYSFS_uint8) ((r << 1) | (ranks[i] & 1));
+        } /* if */
+    } /* for */
+
+rankArchivers_done:
+    if (buf != NULL)
+        allocator.Free(buf);
+} /* rankArchivers */
+
 static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
 {
     DirHandle *retval = NULL;
-    PHYSFS_Archiver **i;
-    const char *ext;
+    PHYSFS_uint8 *ranks = NULL;
+    size_t i;
+    int rank;
     int created_io = 0;
     int claimed = 0;
     PHYSFS_ErrorCode errcode;
@@ -891,34 +1753,43 @@ static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
                 return retval;
         } /* if */
 
-        io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
+        /* map archives if asked to; reading them becomes a memcpy(). */
+        if ((mapArchives) && (!forWriting))
+        {
+            if ( (sizeof (void *) >= 8) ||
+                 (statbuf.filesize <= MAX_MAPPED_ARCHIVE_32BIT) )
+                io = __PHYSFS_createMappedIo(d);
+        } /* if */
+
+        if (io == NULL)
+            io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
         BAIL_IF_ERRPASS(!io, NULL);
         created_io = 1;
     } /* if */
 
-    ext = find_filename_extension(d);
-    if (ext != NULL)
+    ranks = (PHYSFS_uint8 *) __PHYSFS_smallAlloc(numArchivers + 1);
+    if (!ranks)
     {
-        /* Look for archivers with matching file extensions first... */
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
-        {
-            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) == 0)
-                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
-        } /* for */
+        if (created_io)
+            io->destroy(io);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
 
-        /* failing an exact file extension match, try all the others... */
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
+    /* Signature matches first, then can't-tells; within each, archivers
+       with a matching file extension first, then the rest, in order. */
+    rankArchivers(io, find_filename_extension(d), ranks);
+    for (rank = (PHYSFS_DETECT_YES << 1) | 1;
+         (rank >= (PHYSFS_DETECT_MAYBE << 1)) && (retval == NULL) && !claimed;
+         rank--)
+    {
+        for (i = 0; (i < numArchivers) && (retval == NULL) && !claimed; i++)
         {
-            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) != 0)
-                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
+            if (ranks[i] == rank)
+                retval = tryOpenDir(io, archivers[i], d, forWriting, &claimed);
         } /* for */
-    } /* if */
+    } /* for */
 
-    else  /* no extension? Try them all. */
-    {
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
-            retval = tryOpenDir(io, *i, d, forWriting, &claimed);
-    } /* else */
+    __PHYSFS_smallFree(ranks);
 
     errcode = currentErrorCode();
 
@@ -1017,11 +1888,126 @@ static int partOfMountPoint(DirHandle *h, char *fname)
 } /* partOfMountPoint */
 
 
-static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
-                                  const char *mountPoint, int forWriting)
+static const PHYSFS_Archiver *staticArchivers[] =
 {
-    DirHandle *dirHandle = NULL;
-    char *tmpmntpnt = NULL;
+    #if PHYSFS_SUPPORTS_ZIP
+    &__PHYSFS_Archiver_ZIP,
+    #endif
+    #if PHYSFS_SUPPORTS_7Z
+    &__PHYSFS_Archiver_7Z,
+    #endif
+    #if PHYSFS_SUPPORTS_GRP
+    &__PHYSFS_Archiver_GRP,
+    #endif
+    #if PHYSFS_SUPPORTS_QPAK
+    &__PHYSFS_Archiver_QPAK,
+    #endif
+    #if PHYSFS_SUPPORTS_HOG
+    &__PHYSFS_Archiver_HOG,
+    #endif
+    #if PHYSFS_SUPPORTS_MVL
+    &__PHYSFS_Archiver_MVL,
+    #endif
+    #if PHYSFS_SUPPORTS_WAD
+    &__PHYSFS_Archiver_WAD,
+    #endif
+    #if PHYSFS_SUPPORTS_SLB
+    &__PHYSFS_Archiver_SLB,
+    #endif
+    #if PHYSFS_SUPPORTS_ISO9660
+    &__PHYSFS_Archiver_ISO9660,
+    #endif
+    #if PHYSFS_SUPPORTS_VDF
+    &__PHYSFS_Archiver_VDF,
+    #endif
+    NULL
+};
+
+
+/*
+ * The built-in archivers can take calls from several threads at once, but
+ *  the PHYSFS_Archiver docs promise app-supplied ones that we'll serialize
+ *  calls into them. (funcs) might be the copy that PHYSFS_registerArchiver()
+ *  made, so compare methods instead of pointers.
+ */
+static int archiverIsThreadSafe(const PHYSFS_Archiver *funcs)
+{
+    const PHYSFS_Archiver **i;
+
+    if (funcs == &__PHYSFS_Archiver_DIR)
+        return 1;
+
+    for (i = staticArchivers; *i != NULL; i++)
+    {
+        if ((*i)->openArchive == funcs->openArchive)
+            return 1;
+    } /* for */
+
+    return 0;
+} /* archiverIsThreadSafe */
+
+
+static void countLockWait(const PHYSFS_uint64 start)
+{
+    STAT_ADD(&globalStats, lockGrabs, 1);
+    STAT_ADD(&globalStats, lockWaitTime,
+             __PHYSFS_platformNanoseconds() - start);
+} /* countLockWait */
+
+
+/*
+ * Grab stateLock for something that only looks at the search path, write
+ *  dir, etc. If anything that needs serializing is mounted, we take turns
+ *  like the old days. (serializedDirs) only changes while stateLock is held
+ *  exclusively, so checking it after the shared grab is safe, and recursive
+ *  grabs always come to the same decision as the outer one did.
+ */
+static void grabStateLockShared(void)
+{
+    const PHYSFS_uint64 start = __PHYSFS_platformNanoseconds();
+    __PHYSFS_platformGrabRWLockShared(stateLock);
+    if (serializedDirs > 0)
+    {
+        __PHYSFS_platformReleaseRWLock(stateLock);
+        __PHYSFS_platformGrabRWLockExclusive(stateLock);
+    } /* if */
+    countLockWait(start);
+} /* grabStateLockShared */
+
+
+/* Grab stateLock for something that changes the search path, etc. */
+static void grabStateLockExclusive(void)
+{
+    const PHYSFS_uint64 start = __PHYSFS_platformNanoseconds();
+    __PHYSFS_platformGrabRWLockExclusive(stateLock);
+    countLockWait(start);
+} /* grabStateLockExclusive */
+
+
+/* Free a DirHandle that never made it into the search path. */
+static void discardDirHandle(DirHandle *dh)
+{
+    if (dh != NULL)
+    {
+        dh->funcs->closeArchive(dh->opaque);
+        allocator.Free(dh->dirName);
+        allocator.Free(dh->mountPoint);
+        allocator.Free(dh);
+    } /* if */
+} /* discardDirHandle */
+
+
+/*
+ * MAKE SURE you hold stateLock before calling this! This doesn't touch any
+ *  state but the archivers list, so a shared grab is enough, and several
+ *  threads can be in here at once, as long as only thread-safe archivers
+ *  are registered.
+ */
+static DirHandle *openDirHandle(PHYSFS_Io *io, const char *newDir,
+                                const char *mountPoint, int forWriting)
+{
+    DirHandle *dirHandle = NULL;
+    char *tmpmntpnt = NULL;
 
     assert(newDir != NULL);  /* should have caught this higher up. */
 
@@ -1055,20 +2041,30 @@ static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
     return dirHandle;
 
 badDirHandle:
-    if (dirHandle != NULL)
-    {
-        dirHandle->funcs->closeArchive(dirHandle->opaque);
-        allocator.Free(dirHandle->dirName);
-        allocator.Free(dirHandle->mountPoint);
-        allocator.Free(dirHandle);
-    } /* if */
-
+    discardDirHandle(dirHandle);
     __PHYSFS_smallFree(tmpmntpnt);
     return NULL;
+} /* openDirHandle */
+
+
+/* MAKE SURE you hold stateLock exclusively before calling this! */
+static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
+                                  const char *mountPoint, int forWriting)
+{
+    DirHandle *dirHandle = openDirHandle(io, newDir, mountPoint, forWriting);
+    BAIL_IF_ERRPASS(!dirHandle, NULL);
+
+    if (!archiverIsThreadSafe(dirHandle->funcs))
+        serializedDirs++;
+
+    return dirHandle;
 } /* createDirHandle */
 
 
-/* MAKE SURE you've got the stateLock held before calling this! */
+static void watchMounted(DirHandle *dh);
+static void watchForgetDirHandle(DirHandle *dh);
+
+/* MAKE SURE you've got the stateLock held exclusively before calling this! */
 static int freeDirHandle(DirHandle *dh, FileHandle *openList)
 {
     FileHandle *i;
@@ -1076,9 +2072,23 @@ static int freeDirHandle(DirHandle *dh, FileHandle *openList)
     if (dh == NULL)
         return 1;
 
+    /* nothing can be opened right now, but things can still be closed. */
+    __PHYSFS_platformGrabMutex(openListLock);
     for (i = openList; i != NULL; i = i->next)
-        BAIL_IF(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, 0);
+    {
+        BAIL_IF_MUTEX(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN,
+                      openListLock, 0);
+    } /* for */
+    __PHYSFS_platformReleaseMutex(openListLock);
 
+    if (!archiverIsThreadSafe(dh->funcs))
+    {
+        assert(serializedDirs > 0);
+        serializedDirs--;
+    } /* if */
+
+    watchForgetDirHandle(dh);
+    __PHYSFS_cacheInvalidate(dh->opaque);
     dh->funcs->closeArchive(dh->opaque);
     allocator.Free(dh->dirName);
     allocator.Free(dh->mountPoint);
@@ -1087,6 +2097,367 @@ static int freeDirHandle(DirHandle *dh, FileHandle *openList)
 } /* freeDirHandle */
 
 
+/*
+ * The search path lookup index.
+ *
+ * Archivers that keep their contents in a __PHYSFS_DirTree (anything that
+ *  uses __PHYSFS_DirTreeEnumerate for its enumerate method) can't change
+ *  once they're opened, so we can merge all their trees into one hash table
+ *  that maps a full path in the virtual tree to the first DirHandle in the
+ *  search path that has it. A lookup is then one probe here, instead of a
+ *  probe into every mounted archive. Everything else (native directories,
+ *  app-supplied archivers) might change behind our back, so those are still
+ *  walked in search path order, like before.
+ *
+ * This is off by default; see PHYSFS_setSearchPathIndex().
+ *
+ * MAKE SURE you hold the stateLock before calling any of this!
+ */
+typedef struct __PHYSFS_PATHINDEXENTRY__
+{
+    char *path;  /* full path in the virtual tree, platform-independent. */
+    PHYSFS_uint32 hashval;  /* hash of (path), not modded by bucket count. */
+    DirHandle *dirHandle;  /* first search path element that has (path). */
+    struct __PHYSFS_PATHINDEXENTRY__ *next;  /* hash bucket chain. */
+} PathIndexEntry;
+
+static int usePathIndex = 0;
+static PathIndexEntry **pathIndex = NULL;
+static size_t pathIndexBuckets = 0;
+static size_t pathIndexCount = 0;
+static size_t pathIndexUnindexed = 0;  /* search path elements not indexed. */
+
+/* (h->opaque) starts with a __PHYSFS_DirTree if this is true. */
+static inline int dirHandleHasDirTree(const DirHandle *h)
+{
+    return (h->funcs->enumerate == __PHYSFS_DirTreeEnumerate);
+} /* dirHandleHasDirTree */
+
+/* the index only knows exact names, so case-insensitive mounts aren't in it. */
+static inline int dirHandleIndexable(const DirHandle *h)
+{
+    return ((dirHandleHasDirTree(h)) && (!h->ignoreCase));
+} /* dirHandleIndexable */
+
+
+static void freePathIndex(void)
+{
+    size_t i;
+
+    for (i = 0; i < pathIndexBuckets; i++)
+    {
+        PathIndexEntry *entry;
+        PathIndexEntry *next;
+        for (entry = pathIndex[i]; entry != NULL; entry = next)
+        {
+            next = entry->next;
+            allocator.Free(entry);
+        } /* for */
+    } /* for */
+
+    allocator.Free(pathIndex);
+    pathIndex = NULL;
+    pathIndexBuckets = 0;
+    pathIndexCount = 0;
+    pathIndexUnindexed = 0;
+} /* freePathIndex */
+
+
+static PathIndexEntry *pathIndexFind(const char *path,
+                                     const PHYSFS_uint32 hashval)
+{
+    PathIndexEntry *entry;
+
+    if (pathIndexBuckets == 0)
+        return NULL;
+
+    entry = pathIndex[hashval % pathIndexBuckets];
+    for (; entry != NULL; entry = entry->next)
+    {
+        if ((entry->hashval == hashval) && (strcmp(entry->path, path) == 0))
+            return entry;
+    } /* for */
+
+    return NULL;
+} /* pathIndexFind */
+
+
+/* Keep the chains short; we have the full hash, so no strings are hashed. */
+static int pathIndexGrow(void)
+{
+    const size_t newbuckets = pathIndexBuckets ? pathIndexBuckets * 2 : 256;
+    const size_t alloclen = newbuckets * sizeof (PathIndexEntry *);
+    PathIndexEntry **newindex;
+    size_t i;
+
+    newindex = (PathIndexEntry **) allocator.Malloc(alloclen);
+    BAIL_IF(!newindex, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(newindex, '\0', alloclen);
+
+    for (i = 0; i < pathIndexBuckets; i++)
+    {
+        PathIndexEntry *entry;
+        PathIndexEntry *next;
+        for (entry = pathIndex[i]; entry != NULL; entry = next)
+        {
+            const size_t bucket = entry->hashval % newbuckets;
+            next = entry->next;
+            entry->next = newindex[bucket];
+            newindex[bucket] = entry;
+        } /* for */
+    } /* for */
+
+    allocator.Free(pathIndex);
+    pathIndex = newindex;
+    pathIndexBuckets = newbuckets;
+    return 1;
+} /* pathIndexGrow */
+
+
+/* (override) is non-zero if (h) comes before everything already indexed. */
+static int pathIndexAddPath(DirHandle *h, const char *path, const int override)
+{
+    const size_t len = strlen(path);
+    const PHYSFS_uint32 hashval = __PHYSFS_hashString(path, len);
+    PathIndexEntry *entry = pathIndexFind(path, hashval);
+    size_t bucket;
+
+    if (entry != NULL)
+    {
+        if (override)
+            entry->dirHandle = h;
+        return 1;
+    } /* if */
+
+    if (pathIndexCount >= pathIndexBuckets)
+        BAIL_IF_ERRPASS(!pathIndexGrow(), 0);
+
+    entry = (PathIndexEntry *) allocator.Malloc(sizeof (*entry) + len + 1);
+    BAIL_IF(!entry, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    entry->path = ((char *) entry) + sizeof (*entry);
+    memcpy(entry->path, path, len + 1);
+    entry->hashval = hashval;
+    entry->dirHandle = h;
+    bucket = hashval % pathIndexBuckets;
+    entry->next = pathIndex[bucket];
+    pathIndex[bucket] = entry;
+    pathIndexCount++;
+    return 1;
+} /* pathIndexAddPath */
+
+
+static int pathIndexAddDirHandle(DirHandle *h, const int override)
+{
+    const __PHYSFS_DirTree *tree = (const __PHYSFS_DirTree *) h->opaque;
+    const size_t mntpntlen = h->mountPoint ? strlen(h->mountPoint) : 0;
+    size_t buflen = mntpntlen + 64;
+    char *buf;
+    size_t i;
+
+    if (!dirHandleIndexable(h))
+    {
+        pathIndexUnindexed++;
+        return 1;
+    } /* if */
+
+    buf = (char *) allocator.Malloc(buflen);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    /* every piece of the mountpoint is a directory in the virtual tree. */
+    for (i = 0; i < mntpntlen; i++)
+    {
+        if (h->mountPoint[i] == '/')
+        {
+            memcpy(buf, h->mountPoint, i);
+            buf[i] = '\0';
+            GOTO_IF_ERRPASS(!pathIndexAddPath(h, buf, override), addFailed);
+        } /* if */
+    } /* for */
+
+    if (mntpntlen)
+        memcpy(buf, h->mountPoint, mntpntlen);
+
+    for (i = 0; i < tree->hashBuckets; i++)
+    {
+        const __PHYSFS_DirTreeEntry *entry;
+        for (entry = tree->hash[i]; entry != NULL; entry = entry->hashnext)
+        {
+            const size_t len = strlen(entry->name) + 1;
+            if ((mntpntlen + len) > buflen)
+            {
+                void *ptr;
+                buflen = mntpntlen + len;
+                ptr = allocator.Realloc(buf, buflen);
+                GOTO_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, addFailed);
+                buf = (char *) ptr;
+            } /* if */
+
+            memcpy(buf + mntpntlen, entry->name, len);
+            GOTO_IF_ERRPASS(!pathIndexAddPath(h, buf, override), addFailed);
+        } /* for */
+    } /* for */
+
+    allocator.Free(buf);
+    return 1;
+
+addFailed:
+    allocator.Free(buf);
+    return 0;
+} /* pathIndexAddDirHandle */
+
+
+static int buildPathIndex(void)
+{
+    DirHandle *i;
+
+    freePathIndex();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (!pathIndexAddDirHandle(i, 0))
+        {
+            freePathIndex();
+            return 0;
+        } /* if */
+    } /* for */
+
+    return 1;
+} /* buildPathIndex */
+
+
+/* (dh) was just added to the search path, at the front if (prepended). */
+static void pathIndexMounted(DirHandle *dh, const int prepended)
+{
+    if (!usePathIndex)
+        return;
+
+    /* if we ran out of memory, drop the index; lookups still work without. */
+    if (!pathIndexAddDirHandle(dh, prepended))
+    {
+        freePathIndex();
+        usePathIndex = 0;
+    } /* if */
+} /* pathIndexMounted */
+
+
+/*
+ * (dh) was removed from the search path and freed, so don't dereference it!
+ *  (indexed) is what dirHandleIndexable() said about it while it was alive,
+ *  and (next) is what followed it in the search path.
+ */
+static void pathIndexUnmounted(const DirHandle *dh, const int indexed,
+                               DirHandle *next)
+{
+    size_t i;
+
+    if (!usePathIndex)
+        return;
+
+    if (!indexed)
+    {
+        assert(pathIndexUnindexed > 0);
+        pathIndexUnindexed--;
+        return;
+    } /* if */
+
+    for (i = 0; i < pathIndexBuckets; i++)
+    {
+        PathIndexEntry **prev = &pathIndex[i];
+        PathIndexEntry *entry = *prev;
+        while (entry != NULL)
+        {
+            PathIndexEntry *nextentry = entry->next;
+            if (entry->dirHandle == dh)
+            {
+                *prev = nextentry;
+                allocator.Free(entry);
+                pathIndexCount--;
+            } /* if */
+            else
+            {
+                prev = &entry->next;
+            } /* else */
+            entry = nextentry;
+        } /* while */
+    } /* for */
+
+    /*
+     * Anything (dh) was hiding belongs to a later element of the search
+     *  path. Everything earlier already won its paths, so just fill in
+     *  the gaps, in order. Unindexed elements were counted already.
+     */
+    for (; next != NULL; next = next->next)
+    {
+        if (!dirHandleIndexable(next))
+            continue;
+        else if (!pathIndexAddDirHandle(next, 0))
+        {
+            freePathIndex();
+            usePathIndex = 0;
+            return;
+        } /* else if */
+    } /* for */
+} /* pathIndexUnmounted */
+
+
+/*
+ * Walks the search path for (fname), skipping archives that the lookup
+ *  index says can't have it. Use it like this:
+ *
+ *  for (i = searchPathFirst(&c, fname); i; i = searchPathNext(&c, i)) ...
+ *
+ * If the index's pick doesn't work out (a forbidden symlink, say), the rest
+ *  of the search path is walked normally, so the results always match what
+ *  you'd get with the index disabled.
+ */
+typedef struct SearchPathCursor
+{
+    DirHandle *hit;  /* first indexed element that has the path, or NULL. */
+    int pruning;  /* non-zero to skip indexed elements other than (hit). */
+} SearchPathCursor;
+
+static DirHandle *searchPathSkip(SearchPathCursor *c, DirHandle *i)
+{
+    if (c->pruning)
+    {
+        while ((i != NULL) && (i != c->hit) && (dirHandleIndexable(i)))
+            i = i->next;
+    } /* if */
+
+    return i;
+} /* searchPathSkip */
+
+
+static DirHandle *searchPathFirst(SearchPathCursor *c, const char *fname)
+{
+    c->hit = NULL;
+    c->pruning = 0;
+
+    /* zip's "$PASSWORD" suffix never shows up in a DirTree, so walk those. */
+    if ((usePathIndex) && (*fname != '\0') && (strchr(fname, '$') == NULL))
+    {
+        const PHYSFS_uint32 hashval = __PHYSFS_hashString(fname, strlen(fname));
+        const PathIndexEntry *entry = pathIndexFind(fname, hashval);
+        c->hit = entry ? entry->dirHandle : NULL;
+        c->pruning = 1;
+        if (pathIndexUnindexed == 0)
+        {
+            BAIL_IF(!c->hit, PHYSFS_ERR_NOT_FOUND, NULL);
+            return c->hit;
+        } /* if */
+    } /* if */
+
+    return searchPathSkip(c, searchPath);
+} /* searchPathFirst */
+
+
+static DirHandle *searchPathNext(SearchPathCursor *c, DirHandle *i)
+{
+    if (i == c->hit)
+        c->pruning = 0;  /* the index's pick failed; try everything else. */
+    return searchPathSkip(c, i->next);
+} /* searchPathNext */
+
+
 static char *calculateBaseDir(const char *argv0)
 {
     const char dirsep = __PHYSFS_platformDirSeparator;
@@ -1123,10 +2494,38 @@ static int initializeMutexes(void)
     if (errorLock == NULL)
         goto initializeMutexes_failed;
 
-    stateLock = __PHYSFS_platformCreateMutex();
+    stateLock = __PHYSFS_platformCreateRWLock();
     if (stateLock == NULL)
         goto initializeMutexes_failed;
 
+    openListLock = __PHYSFS_platformCreateMutex();
+    if (openListLock == NULL)
+        goto initializeMutexes_failed;
+
+    cacheLock = __PHYSFS_platformCreateMutex();
+    if (cacheLock == NULL)
+        goto initializeMutexes_failed;
+
+    asyncLock = __PHYSFS_platformCreateMutex();
+    if (asyncLock == NULL)
+        goto initializeMutexes_failed;
+
+    poolLock = __PHYSFS_platformCreateMutex();
+    if (poolLock == NULL)
+        goto initializeMutexes_failed;
+
+    watchLock = __PHYSFS_platformCreateMutex();
+    if (watchLock == NULL)
+        goto initializeMutexes_failed;
+
+    watchCallbackLock = __PHYSFS_platformCreateMutex();
+    if (watchCallbackLock == NULL)
+        goto initializeMutexes_failed;
+
+    internLock = __PHYSFS_platformCreateMutex();
+    if (internLock == NULL)
+        goto initializeMutexes_failed;
+
     return 1;  /* success. */
 
 initializeMutexes_failed:
@@ -1134,9 +2533,31 @@ initializeMutexes_failed:
         __PHYSFS_platformDestroyMutex(errorLock);
 
     if (stateLock != NULL)
-        __PHYSFS_platformDestroyMutex(stateLock);
+        __PHYSFS_platformDestroyRWLock(stateLock);
+
+    if (openListLock != NULL)
+        __PHYSFS_platformDestroyMutex(openListLock);
 
-    errorLock = stateLock = NULL;
+    if (cacheLock != NULL)
+        __PHYSFS_platformDestroyMutex(cacheLock);
+
+    if (asyncLock != NULL)
+        __PHYSFS_platformDestroyMutex(asyncLock);
+
+    if (poolLock != NULL)
+        __PHYSFS_platformDestroyMutex(poolLock);
+
+    if (watchLock != NULL)
+        __PHYSFS_platformDestroyMutex(watchLock);
+
+    if (watchCallbackLock != NULL)
+        __PHYSFS_platformDestroyMutex(watchCallbackLock);
+
+    if (internLock != NULL)
+        __PHYSFS_platformDestroyMutex(internLock);
+
+    errorLock = stateLock = openListLock = cacheLock = asyncLock = NULL;
+    poolLock = watchLock = watchCallbackLock = internLock = NULL;
     return 0;  /* failed. */
 } /* initializeMutexes */
 
@@ -1145,51 +2566,24 @@ static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
 
 static int initStaticArchivers(void)
 {
-    #define REGISTER_STATIC_ARCHIVER(arc) { \
-        if (!doRegisterArchiver(&__PHYSFS_Archiver_##arc)) { \
-            return 0; \
-        } \
-    }
+    const PHYSFS_Archiver **i;
 
-    #if PHYSFS_SUPPORTS_ZIP
-        REGISTER_STATIC_ARCHIVER(ZIP);
-    #endif
     #if PHYSFS_SUPPORTS_7Z
-        SZIP_global_init();
-        REGISTER_STATIC_ARCHIVER(7Z);
-    #endif
-    #if PHYSFS_SUPPORTS_GRP
-        REGISTER_STATIC_ARCHIVER(GRP);
-    #endif
-    #if PHYSFS_SUPPORTS_QPAK
-        REGISTER_STATIC_ARCHIVER(QPAK);
-    #endif
-    #if PHYSFS_SUPPORTS_HOG
-        REGISTER_STATIC_ARCHIVER(HOG);
-    #endif
-    #if PHYSFS_SUPPORTS_MVL
-        REGISTER_STATIC_ARCHIVER(MVL);
-    #endif
-    #if PHYSFS_SUPPORTS_WAD
-        REGISTER_STATIC_ARCHIVER(WAD);
-    #endif
-    #if PHYSFS_SUPPORTS_SLB
-        REGISTER_STATIC_ARCHIVER(SLB);
-    #endif
-    #if PHYSFS_SUPPORTS_ISO9660
-        REGISTER_STATIC_ARCHIVER(ISO9660);
-    #endif
-    #if PHYSFS_SUPPORTS_VDF
-        REGISTER_STATIC_ARCHIVER(VDF)
+    SZIP_global_init();
     #endif
 
-    #undef REGISTER_STATIC_ARCHIVER
+    for (i = staticArchivers; *i != NULL; i++)
+        BAIL_IF_ERRPASS(!doRegisterArchiver(*i), 0);
 
     return 1;
 } /* initStaticArchivers */
 
 
 static void setDefaultAllocator(void);
+static void initCrc32Table(void);
+static void asyncShutdown(const int cancel);
+static void watchShutdown(void);
+static void freeInternedPaths(void);
 static int doDeinit(void);
 
 int PHYSFS_init(const char *argv0)
@@ -1221,6 +2615,8 @@ int PHYSFS_init(const char *argv0)
     assert(baseDir[strlen(baseDir) - 1] == __PHYSFS_platformDirSeparator);
     assert(userDir[strlen(userDir) - 1] == __PHYSFS_platformDirSeparator);
 
+    initCrc32Table();
+
     if (!initStaticArchivers()) goto initFailed;
 
     initialized = 1;
@@ -1253,8 +2649,14 @@ static int closeFileHandleList(FileHandle **list)
             return 0;
         } /* if */
 
+        if (i->mapping != NULL)
+            __PHYSFS_platformUnmapFile(i->mapping, i->mappinglen);
+
+        if (i->asyncIo != NULL)  /* asyncShutdown() already ran. */
+            i->asyncIo->destroy(i->asyncIo);
+
         io->destroy(io);
-        allocator.Free(i);
+        __PHYSFS_poolFree(&fileHandlePool, i);
     } /* for */
 
     *list = NULL;
@@ -1269,6 +2671,8 @@ static void freeSearchPath(void)
     DirHandle *next = NULL;
 
     closeFileHandleList(&openReadList);
+    freePathIndex();
+    searchPathGeneration++;
 
     if (searchPath != NULL)
     {
@@ -1307,6 +2711,9 @@ static int doDeregisterArchiver(const size_t idx)
     if (archiverInUse(arc, searchPath) || archiverInUse(arc, writeDir))
         BAIL(PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
+    /* PHYSFS_mountMany() might be holding DirHandles that use it, too. */
+    BAIL_IF(pendingMounts > 0, PHYSFS_ERR_FILES_STILL_OPEN, 0);
+
     allocator.Free((void *) info->extension);
     allocator.Free((void *) info->description);
     allocator.Free((void *) info->author);
@@ -1341,12 +2748,15 @@ static void freeArchivers(void)
 
 static int doDeinit(void)
 {
+    asyncShutdown(1);  /* before any files go away. */
+    watchShutdown();  /* before any DirHandles go away. */
     closeFileHandleList(&openWriteList);
     BAIL_IF(!PHYSFS_setWriteDir(NULL), PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
     freeSearchPath();
     freeArchivers();
     freeErrorStates();
+    freeInternedPaths();
 
     if (baseDir != NULL)
     {
@@ -1366,9 +2776,15 @@ static int doDeinit(void)
         prefDir = NULL;
     } /* if */
 
-    if (archiveInfo != NULL)
+    if (indexCacheDir != NULL)
     {
-        allocator.Free(archiveInfo);
+        allocator.Free(indexCacheDir);
+        indexCacheDir = NULL;
+    } /* if */
+
+    if (archiveInfo != NULL)
+    {
+        allocator.Free(archiveInfo);
         archiveInfo = NULL;
     } /* if */
 
@@ -1379,15 +2795,32 @@ static int doDeinit(void)
     } /* if */
 
     allowSymLinks = 0;
+    mapArchives = 0;
+    usePathIndex = 0;
     initialized = 0;
 
+    if (poolLock != NULL)  /* (NULL if PHYSFS_init() failed early.) */
+        poolShutdown();
+
     if (errorLock) __PHYSFS_platformDestroyMutex(errorLock);
-    if (stateLock) __PHYSFS_platformDestroyMutex(stateLock);
+    if (stateLock) __PHYSFS_platformDestroyRWLock(stateLock);
+    if (openListLock) __PHYSFS_platformDestroyMutex(openListLock);
+    if (cacheLock) __PHYSFS_platformDestroyMutex(cacheLock);
+    if (asyncLock) __PHYSFS_platformDestroyMutex(asyncLock);
+    if (poolLock) __PHYSFS_platformDestroyMutex(poolLock);
+    if (watchLock) __PHYSFS_platformDestroyMutex(watchLock);
+    if (watchCallbackLock) __PHYSFS_platformDestroyMutex(watchCallbackLock);
+    if (internLock) __PHYSFS_platformDestroyMutex(internLock);
 
     if (allocator.Deinit != NULL)
         allocator.Deinit();
 
-    errorLock = stateLock = NULL;
+    errorLock = stateLock = openListLock = cacheLock = asyncLock = NULL;
+    poolLock = watchLock = watchCallbackLock = internLock = NULL;
+    asyncThreads = ASYNC_DEFAULT_THREADS;
+    serializedDirs = 0;
+    memset(&cacheStats, '\0', sizeof (cacheStats));
+    memset(&globalStats, '\0', sizeof (globalStats));
 
     __PHYSFS_platformDeinit();
 
@@ -1426,6 +2859,241 @@ PHYSFS_uint32 __PHYSFS_hashString(const char *str, size_t len)
 } /* __PHYSFS_hashString */
 
 
+/*
+ * CRC-32. The portable version is "slicing-by-8", but most CPUs now have
+ *  something faster, which we pick at runtime in initCrc32Table(). All of
+ *  these work on the CRC inverted, the way the algorithm wants it;
+ *  __PHYSFS_crc32() does the inversions.
+ */
+#if PHYSFS_HAVE_CRC32_PCLMUL
+#ifdef _MSC_VER
+#define PCLMUL_TARGET  /* MSVC doesn't need permission to use intrinsics. */
+#else
+#define PCLMUL_TARGET __attribute__((target("sse2,pclmul")))
+#endif
+#endif
+
+/* "slicing-by-8" tables: crc32Table[0] is the usual bytewise table, and
+   crc32Table[n] advances a CRC past n more zero bytes, so we can do eight
+   input bytes per step. */
+static PHYSFS_uint32 crc32Table[8][256];
+
+static PHYSFS_uint32 crc32Slice8(PHYSFS_uint32 crc, const PHYSFS_uint8 *ptr,
+                                 size_t len)
+{
+    /* assemble the words a byte at a time, so alignment and byte order
+       don't matter. */
+    while (len >= 8)
+    {
+        const PHYSFS_uint32 lo = crc ^ ( ((PHYSFS_uint32) ptr[0]) |
+                                         (((PHYSFS_uint32) ptr[1]) << 8) |
+                                         (((PHYSFS_uint32) ptr[2]) << 16) |
+                                         (((PHYSFS_uint32) ptr[3]) << 24) );
+        crc = crc32Table[7][lo & 0xFF] ^
+              crc32Table[6][(lo >> 8) & 0xFF] ^
+              crc32Table[5][(lo >> 16) & 0xFF] ^
+              crc32Table[4][lo >> 24] ^
+              crc32Table[3][ptr[4]] ^
+              crc32Table[2][ptr[5]] ^
+              crc32Table[1][ptr[6]] ^
+              crc32Table[0][ptr[7]];
+        ptr += 8;
+        len -= 8;
+    } /* while */
+
+    while (len--)
+        crc = crc32Table[0][(crc ^ *(ptr++)) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+} /* crc32Slice8 */
+
+
+#if PHYSFS_HAVE_CRC32_PCLMUL
+/*
+ * Carry-less multiply folding, from Intel's "Fast CRC Computation for
+ *  Generic Polynomials Using PCLMULQDQ Instruction" (Gopal, Ozturk et al.,
+ *  2009), with the bit-reflected constants for the zlib polynomial given at
+ *  the end of it: fold four 128-bit lanes at once, fold those down to one,
+ *  then Barrett-reduce to 32 bits. (len) must be at least 64 and a
+ *  multiple of 16.
+ */
+static PCLMUL_TARGET PHYSFS_uint32 crc32Pclmul(PHYSFS_uint32 crc,
+                                               const PHYSFS_uint8 *ptr,
+                                               size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xC6E41596,
+                                       0x00000001, 0x54442BD4);
+    const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xCCAA009E,
+                                       0x00000001, 0x751997D0);
+    const __m128i k5k0 = _mm_set_epi32(0, 0, 0x00000001, 0x63CD6124);
+    const __m128i poly = _mm_set_epi32(0x00000001, 0xF7011641,
+                                       0x00000001, 0xDB710641);
+    const __m128i mask32 = _mm_set_epi32(0, ~0, 0, ~0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    assert(len >= 64);
+    assert((len % 16) == 0);
+
+    x1 = _mm_loadu_si128((const __m128i *) (ptr + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (ptr + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (ptr + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (ptr + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    ptr += 64;
+    len -= 64;
+
+    while (len >= 64)  /* fold in 64 bytes at a time. */
+    {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *) (ptr + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *) (ptr + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *) (ptr + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *) (ptr + 0x30)));
+        ptr += 64;
+        len -= 64;
+    } /* while */
+
+    /* fold the four lanes into one... */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16)  /* ...and whatever's left into that, 16 at a time. */
+    {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *) ptr));
+        ptr += 16;
+        len -= 16;
+    } /* while */
+
+    /* 128 bits down to 64... */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* ...and Barrett reduction down to 32. */
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (PHYSFS_uint32) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+} /* crc32Pclmul */
+
+static int crc32HavePclmul(void)
+{
+    #ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return ((regs[2] & (1 << 1)) && (regs[3] & (1 << 26)));
+    #else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return ((ecx & (1 << 1)) && (edx & (1 << 26)));  /* PCLMULQDQ, SSE2 */
+    #endif
+} /* crc32HavePclmul */
+
+static int crc32UsePclmul = 0;
+#endif
+
+
+#if PHYSFS_HAVE_CRC32_ARM
+static PHYSFS_uint32 crc32Arm(PHYSFS_uint32 crc, const PHYSFS_uint8 *ptr,
+                              size_t len)
+{
+    while (len >= 8)
+    {
+        PHYSFS_uint64 val;
+        memcpy(&val, ptr, 8);  /* the compiler makes this an unaligned load. */
+        crc = __crc32d(crc, val);
+        ptr += 8;
+        len -= 8;
+    } /* while */
+
+    while (len--)
+        crc = __crc32b(crc, *(ptr++));
+
+    return crc;
+} /* crc32Arm */
+#endif
+
+
+static void initCrc32Table(void)
+{
+    PHYSFS_uint32 i;
+    int j;
+
+    for (i = 0; i < 256; i++)
+    {
+        PHYSFS_uint32 crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1);
+        crc32Table[0][i] = crc;
+    } /* for */
+
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+        {
+            const PHYSFS_uint32 prev = crc32Table[j - 1][i];
+            crc32Table[j][i] = (prev >> 8) ^ crc32Table[0][prev & 0xFF];
+        } /* for */
+    } /* for */
+
+    #if PHYSFS_HAVE_CRC32_PCLMUL
+    crc32UsePclmul = crc32HavePclmul();
+    #endif
+} /* initCrc32Table */
+
+
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *buf, size_t len)
+{
+    const PHYSFS_uint8 *ptr = (const PHYSFS_uint8 *) buf;
+    crc = ~crc;
+
+    #if PHYSFS_HAVE_CRC32_ARM
+    crc = crc32Arm(crc, ptr, len);
+    #else
+    #if PHYSFS_HAVE_CRC32_PCLMUL
+    if ((crc32UsePclmul) && (len >= 64))
+    {
+        const size_t chunk = len & ~((size_t) 15);
+        crc = crc32Pclmul(crc, ptr, chunk);
+        ptr += chunk;
+        len -= chunk;
+    } /* if */
+    #endif
+    crc = crc32Slice8(crc, ptr, len);
+    #endif
+
+    return ~crc;
+} /* __PHYSFS_crc32 */
+
+
 /* MAKE SURE you hold stateLock before calling this! */
 static int doRegisterArchiver(const PHYSFS_Archiver *_archiver)
 {
@@ -1465,7 +3133,20 @@ static int doRegisterArchiver(const PHYSFS_Archiver *_archiver)
     GOTO_IF(!archiver, PHYSFS_ERR_OUT_OF_MEMORY, regfailed);
 
     /* Must copy sizeof (OLD_VERSION_OF_STRUCT) when version changes! */
-    memcpy(archiver, _archiver, sizeof (*archiver));
+    if (_archiver->version == 0)  /* no enumerateStat() in version 0. */
+    {
+        memset(archiver, '\0', sizeof (*archiver));
+        memcpy(archiver, _archiver, offsetof(PHYSFS_Archiver, enumerateStat));
+    } /* if */
+    else if (_archiver->version == 1)  /* no detect() in version 1. */
+    {
+        memset(archiver, '\0', sizeof (*archiver));
+        memcpy(archiver, _archiver, offsetof(PHYSFS_Archiver, detect));
+    } /* else if */
+    else
+    {
+        memcpy(archiver, _archiver, sizeof (*archiver));
+    } /* else */
 
     info = (PHYSFS_ArchiveInfo *) &archiver->info;
     memset(info, '\0', sizeof (*info));  /* NULL in case an alloc fails. */
@@ -1515,9 +3196,9 @@ int PHYSFS_registerArchiver(const PHYSFS_Archiver *archiver)
 {
     int retval;
     BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLockExclusive();
     retval = doRegisterArchiver(archiver);
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
     return retval;
 } /* PHYSFS_registerArchiver */
 
@@ -1529,17 +3210,17 @@ int PHYSFS_deregisterArchiver(const char *ext)
     BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
     BAIL_IF(!ext, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLockExclusive();
     for (i = 0; i < numArchivers; i++)
     {
         if (PHYSFS_utf8stricmp(archiveInfo[i]->extension, ext) == 0)
         {
             const int retval = doDeregisterArchiver(i);
-            __PHYSFS_platformReleaseMutex(stateLock);
+            __PHYSFS_platformReleaseRWLock(stateLock);
             return retval;
         } /* if */
     } /* for */
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
 
     BAIL(PHYSFS_ERR_NOT_FOUND, 0);
 } /* PHYSFS_deregisterArchiver */
@@ -1650,10 +3331,10 @@ const char *PHYSFS_getWriteDir(void)
 {
     const char *retval = NULL;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLockShared();
     if (writeDir != NULL)
         retval = writeDir->dirName;
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
 
     return retval;
 } /* PHYSFS_getWriteDir */
@@ -1663,12 +3344,12 @@ int PHYSFS_setWriteDir(const char *newDir)
 {
     int retval = 1;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLockExclusive();
 
     if (writeDir != NULL)
     {
-        BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(writeDir, openWriteList),
-                            stateLock, 0);
+        BAIL_IF_RWLOCK_ERRPASS(!freeDirHandle(writeDir, openWriteList),
+                               stateLock, 0);
         writeDir = NULL;
     } /* if */
 
@@ -1676,16 +3357,64 @@ int PHYSFS_setWriteDir(const char *newDir)
     {
         writeDir = createDirHandle(NULL, newDir, NULL, 1);
         retval = (writeDir != NULL);
+        if (retval)
+            watchMounted(writeDir);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
 
     return retval;
 } /* PHYSFS_setWriteDir */
 
 
-static int doMount(PHYSFS_Io *io, const char *fname,
-                   const char *mountPoint, int appendToPath)
+int PHYSFS_setIndexCacheDir(const char *dir)
+{
+    char *ptr = NULL;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(dir && (*dir == '\0'), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (dir != NULL)
+    {
+        const size_t len = strlen(dir);
+        const int addsep = (dir[len - 1] != __PHYSFS_platformDirSeparator);
+        ptr = (char *) allocator.Malloc(len + addsep + 1);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        memcpy(ptr, dir, len);
+        if (addsep)
+            ptr[len] = __PHYSFS_platformDirSeparator;
+        ptr[len + addsep] = '\0';
+    } /* if */
+
+    grabStateLockExclusive();
+    allocator.Free(indexCacheDir);
+    indexCacheDir = ptr;
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    return 1;
+} /* PHYSFS_setIndexCacheDir */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+char *__PHYSFS_indexCachePath(const char *archive, const char *ext)
+{
+    const PHYSFS_uint32 hash = __PHYSFS_hashString(archive, strlen(archive));
+    size_t len;
+    char *retval;
+
+    if (indexCacheDir == NULL)
+        return NULL;  /* turned off; not an error. */
+
+    len = strlen(indexCacheDir) + 8 + 1 + strlen(ext) + 1;
+    retval = (char *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    snprintf(retval, len, "%s%08x.%s", indexCacheDir, (unsigned int) hash, ext);
+    return retval;
+} /* __PHYSFS_indexCachePath */
+
+
+static int doMountUntraced(PHYSFS_Io *io, const char *fname,
+                           const char *mountPoint, int appendToPath)
 {
     DirHandle *dh;
     DirHandle *prev = NULL;
@@ -1696,18 +3425,18 @@ static int doMount(PHYSFS_Io *io, const char *fname,
     if (mountPoint == NULL)
         mountPoint = "/";
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLockExclusive();
 
     for (i = searchPath; i != NULL; i = i->next)
     {
         /* already in search path? */
         if ((i->dirName != NULL) && (strcmp(fname, i->dirName) == 0))
-            BAIL_MUTEX_ERRPASS(stateLock, 1);
+            BAIL_RWLOCK_ERRPASS(stateLock, 1);
         prev = i;
     } /* for */
 
     dh = createDirHandle(io, fname, mountPoint, 0);
-    BAIL_IF_MUTEX_ERRPASS(!dh, stateLock, 0);
+    BAIL_IF_RWLOCK_ERRPASS(!dh, stateLock, 0);
 
     if (appendToPath)
     {
@@ -1722,8 +3451,28 @@ static int doMount(PHYSFS_Io *io, const char *fname,
         searchPath = dh;
     } /* else */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    searchPathGeneration++;
+    pathIndexMounted(dh, !appendToPath);
+    watchMounted(dh);
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
     return 1;
+} /* doMountUntraced */
+
+
+static int doMount(PHYSFS_Io *io, const char *fname,
+                   const char *mountPoint, int appendToPath)
+{
+    const char *mntpnt = mountPoint ? mountPoint : "/";
+    int retval;
+
+    if (!__PHYSFS_TRACING)
+        return doMountUntraced(io, fname, mountPoint, appendToPath);
+
+    __PHYSFS_trace(PHYSFS_TRACE_MOUNT, 0, mntpnt, fname, NULL, NULL, 0, 0);
+    retval = doMountUntraced(io, fname, mountPoint, appendToPath);
+    __PHYSFS_trace(PHYSFS_TRACE_MOUNT, 1, mntpnt, fname, NULL, NULL, 0, retval);
+    return retval;
 } /* doMount */
 
 
@@ -1732,7 +3481,8 @@ int PHYSFS_mountIo(PHYSFS_Io *io, const char *fname,
 {
     BAIL_IF(!io, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    BAIL_IF(io->version != 0, PHYSFS_ERR_UNSUPPORTED, 0);
+    BAIL_IF(io->version > CURRENT_PHYSFS_IO_API_VERSION,
+            PHYSFS_ERR_UNSUPPORTED, 0);
     return doMount(io, fname, mountPoint, appendToPath);
 } /* PHYSFS_mountIo */
 
@@ -1792,155 +3542,531 @@ int PHYSFS_mount(const char *newDir, const char *mountPoint, int appendToPath)
 } /* PHYSFS_mount */
 
 
-int PHYSFS_addToSearchPath(const char *newDir, int appendToPath)
-{
-    return PHYSFS_mount(newDir, NULL, appendToPath);
-} /* PHYSFS_addToSearchPath */
-
-
-int PHYSFS_removeFromSearchPath(const char *oldDir)
+int PHYSFS_mountCached(const char *newDir, const char *mountPoint,
+                       int appendToPath, PHYSFS_uint32 blockSize,
+                       PHYSFS_uint32 cacheBlocks)
 {
-    return PHYSFS_unmount(oldDir);
-} /* PHYSFS_removeFromSearchPath */
-
+    PHYSFS_Io *io = NULL;
+    PHYSFS_Io *cached = NULL;
+    PHYSFS_Stat statbuf;
+    const DirHandle *i;
+    int retval = 0;
 
-int PHYSFS_unmount(const char *oldDir)
-{
-    DirHandle *i;
-    DirHandle *prev = NULL;
-    DirHandle *next = NULL;
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!newDir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF_ERRPASS(!__PHYSFS_platformStat(newDir, &statbuf, 1), 0);
 
-    BAIL_IF(oldDir == NULL, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+        return doMount(NULL, newDir, mountPoint, appendToPath);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    /* doMount() says yes without taking the Io if this is already there. */
+    grabStateLockShared();
     for (i = searchPath; i != NULL; i = i->next)
     {
-        if (strcmp(i->dirName, oldDir) == 0)
-        {
-            next = i->next;
-            BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(i, openReadList),
-                                stateLock, 0);
-
-            if (prev == NULL)
-                searchPath = next;
-            else
-                prev->next = next;
-
-            BAIL_MUTEX_ERRPASS(stateLock, 1);
-        } /* if */
-        prev = i;
+        if ((i->dirName != NULL) && (strcmp(newDir, i->dirName) == 0))
+            BAIL_RWLOCK_ERRPASS(stateLock, 1);
     } /* for */
+    __PHYSFS_platformReleaseRWLock(stateLock);
 
-    BAIL_MUTEX(PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
-} /* PHYSFS_unmount */
+    io = __PHYSFS_createNativeIo(newDir, 'r');
+    BAIL_IF_ERRPASS(!io, 0);
+    cached = PHYSFS_createCachedIo(io, blockSize, cacheBlocks);
+    if (!cached)
+    {
+        io->destroy(io);
+        return 0;
+    } /* if */
 
+    retval = doMount(cached, newDir, mountPoint, appendToPath);
+    if (!retval)
+        cached->destroy(cached);  /* destroys (io), too. */
 
-char **PHYSFS_getSearchPath(void)
-{
-    return doEnumStringList(PHYSFS_getSearchPathCallback);
-} /* PHYSFS_getSearchPath */
+    return retval;
+} /* PHYSFS_mountCached */
 
 
-const char *PHYSFS_getMountPoint(const char *dir)
+PHYSFS_Pack *PHYSFS_createPack(const char *path,
+                               const PHYSFS_PackOptions *options)
 {
-    DirHandle *i;
-    __PHYSFS_platformGrabMutex(stateLock);
-    for (i = searchPath; i != NULL; i = i->next)
+    PHYSFS_PackOptions defaults;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF(!path, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    if (options == NULL)
     {
-        if (strcmp(i->dirName, dir) == 0)
-        {
-            const char *retval = ((i->mountPoint) ? i->mountPoint : "/");
-            __PHYSFS_platformReleaseMutex(stateLock);
-            return retval;
-        } /* if */
-    } /* for */
-    __PHYSFS_platformReleaseMutex(stateLock);
+        memset(&defaults, '\0', sizeof (defaults));
+        options = &defaults;
+    } /* if */
+    BAIL_IF(options->version != 0, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
 
-    BAIL(PHYSFS_ERR_NOT_MOUNTED, NULL);
-} /* PHYSFS_getMountPoint */
+    #if PHYSFS_SUPPORTS_ZIP
+    return (PHYSFS_Pack *) ZIP_createPack(path, options);
+    #else
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+    #endif
+} /* PHYSFS_createPack */
 
 
-void PHYSFS_getSearchPathCallback(PHYSFS_StringCallback callback, void *data)
+/* Sanitize (name) for a pack; the caller frees it with allocator.Free(). */
+static char *sanitizePackName(const char *name)
 {
-    DirHandle *i;
+    const size_t len = strlen(name) + 1;
+    char *retval;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    /* a .zip stores name lengths in 16 bits. */
+    BAIL_IF(len > 0xFFFF, PHYSFS_ERR_BAD_FILENAME, NULL);
+    retval = (char *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    if (!sanitizePlatformIndependentPath(name, retval))
+    {
+        allocator.Free(retval);
+        return NULL;
+    } /* if */
 
-    for (i = searchPath; i != NULL; i = i->next)
-        callback(data, i->dirName);
+    if (*retval == '\0')
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_BAD_FILENAME, NULL);
+    } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-} /* PHYSFS_getSearchPathCallback */
+    return retval;
+} /* sanitizePackName */
 
 
-typedef struct setSaneCfgEnumData
+int PHYSFS_addToPack(PHYSFS_Pack *pack, const char *name, const void *buffer,
+                     PHYSFS_uint64 len, int compress)
 {
-    const char *archiveExt;
-    size_t archiveExtLen;
-    int archivesFirst;
-    PHYSFS_ErrorCode errcode;
-} setSaneCfgEnumData;
+    #if PHYSFS_SUPPORTS_ZIP
+    char *fname;
+    int retval;
 
-static PHYSFS_EnumerateCallbackResult setSaneCfgEnumCallback(void *_data,
-                                                const char *dir, const char *f)
+    BAIL_IF(!pack, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!name, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF((!buffer) && (len > 0), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    fname = sanitizePackName(name);
+    BAIL_IF_ERRPASS(!fname, 0);
+    retval = ZIP_packAdd(pack, fname, buffer, len, compress);
+    allocator.Free(fname);
+    return retval;
+    #else
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+} /* PHYSFS_addToPack */
+
+
+int PHYSFS_addFileToPack(PHYSFS_Pack *pack, const char *name,
+                         const char *filename, int compress)
 {
-    setSaneCfgEnumData *data = (setSaneCfgEnumData *) _data;
-    const size_t extlen = data->archiveExtLen;
-    const size_t l = strlen(f);
-    const char *ext;
+    #if PHYSFS_SUPPORTS_ZIP
+    PHYSFS_File *f;
+    PHYSFS_Io *io;
+    char *fname;
+    int retval;
 
-    if ((l > extlen) && (f[l - extlen - 1] == '.'))
+    BAIL_IF(!pack, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!name, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!filename, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    fname = sanitizePackName(name);
+    BAIL_IF_ERRPASS(!fname, 0);
+
+    f = PHYSFS_openRead(filename);
+    io = f ? __PHYSFS_createHandleIo(f) : NULL;
+    if (io == NULL)
     {
-        ext = f + (l - extlen);
-        if (PHYSFS_utf8stricmp(ext, data->archiveExt) == 0)
-        {
-            const char dirsep = __PHYSFS_platformDirSeparator;
-            const char *d = PHYSFS_getRealDir(f);
-            const size_t allocsize = strlen(d) + l + 2;
-            char *str = (char *) __PHYSFS_smallAlloc(allocsize);
-            if (str == NULL)
-                data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-            else
-            {
-                snprintf(str, allocsize, "%s%c%s", d, dirsep, f);
-                if (!PHYSFS_mount(str, NULL, data->archivesFirst == 0))
-                    data->errcode = currentErrorCode();
-                __PHYSFS_smallFree(str);
-            } /* else */
-        } /* if */
+        if (f != NULL)
+            PHYSFS_close(f);
+        allocator.Free(fname);
+        return 0;
     } /* if */
 
-    /* !!! FIXME: if we want to abort on errors... */
-    /*return (data->errcode != PHYSFS_ERR_OK) ? PHYSFS_ENUM_ERROR : PHYSFS_ENUM_OK;*/
-
-    return PHYSFS_ENUM_OK;  /* keep going */
-} /* setSaneCfgEnumCallback */
+    retval = ZIP_packAddIo(pack, fname, io, compress);
+    io->destroy(io);  /* closes (f), too. */
+    allocator.Free(fname);
+    return retval;
+    #else
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+} /* PHYSFS_addFileToPack */
 
 
-int PHYSFS_setSaneConfig(const char *organization, const char *appName,
-                         const char *archiveExt, int includeCdRoms,
-                         int archivesFirst)
+int PHYSFS_closePack(PHYSFS_Pack *pack)
 {
-    const char *basedir;
-    const char *prefdir;
+    BAIL_IF(!pack, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    #if PHYSFS_SUPPORTS_ZIP
+    return ZIP_closePack(pack);
+    #else
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+} /* PHYSFS_closePack */
 
-    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
 
-    prefdir = PHYSFS_getPrefDir(organization, appName);
-    BAIL_IF_ERRPASS(!prefdir, 0);
+/* One PHYSFS_MountSpec's worth of work for PHYSFS_mountMany(). */
+typedef struct
+{
+    const PHYSFS_MountSpec *spec;
+    DirHandle *dirHandle;  /* what the workers opened. */
+    PHYSFS_ErrorCode errcode;  /* why (dirHandle) is NULL, if it is. */
+    int skip;  /* already in the search path, or earlier in the batch. */
+} MountJob;
 
-    basedir = PHYSFS_getBaseDir();
-    BAIL_IF_ERRPASS(!basedir, 0);
+typedef struct
+{
+    MountJob *jobs;
+    size_t count;
+    int next;  /* next job to claim; only touched with atomic ops. */
+} MountBatch;
 
-    BAIL_IF(!PHYSFS_setWriteDir(prefdir), PHYSFS_ERR_NO_WRITE_DIR, 0);
 
-    /* !!! FIXME: these can fail and we should report that... */
+/* PHYSFS_mountMany() holds stateLock (shared) on our behalf while we run. */
+static void mountWorker(void *data)
+{
+    MountBatch *batch = (MountBatch *) data;
 
-    /* Put write dir first in search path... */
-    PHYSFS_mount(prefdir, NULL, 0);
+    while (1)
+    {
+        const int idx = __PHYSFS_ATOMIC_INCR(&batch->next) - 1;
+        MountJob *job;
+        const char *mntpnt;
 
-    /* Put base path on search path... */
-    PHYSFS_mount(basedir, NULL, 1);
+        if ((idx < 0) || (((size_t) idx) >= batch->count))
+            break;  /* all claimed. */
+
+        job = &batch->jobs[idx];
+        if (job->skip)
+            continue;
+
+        mntpnt = job->spec->mountPoint ? job->spec->mountPoint : "/";
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_MOUNT, 0, mntpnt, job->spec->newDir,
+                           NULL, NULL, 0, 0);
+        } /* if */
+
+        job->dirHandle = openDirHandle(NULL, job->spec->newDir, mntpnt, 0);
+        if (!job->dirHandle)
+        {
+            job->errcode = PHYSFS_getLastErrorCode();
+            if (job->errcode == PHYSFS_ERR_OK)
+                job->errcode = PHYSFS_ERR_OTHER_ERROR;
+        } /* if */
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_MOUNT, 1, mntpnt, job->spec->newDir,
+                           NULL, NULL, 0, job->dirHandle != NULL);
+        } /* if */
+    } /* while */
+} /* mountWorker */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int alreadyMounted(const char *fname)
+{
+    DirHandle *i;
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if ((i->dirName != NULL) && (strcmp(fname, i->dirName) == 0))
+            return 1;
+    } /* for */
+    return 0;
+} /* alreadyMounted */
+
+
+/* Does every registered archiver's openArchive allow concurrent calls? */
+static int allArchiversThreadSafe(void)
+{
+    size_t i;
+    for (i = 0; i < numArchivers; i++)
+    {
+        if (!archiverIsThreadSafe(archivers[i]))
+            return 0;
+    } /* for */
+    return 1;
+} /* allArchiversThreadSafe */
+
+
+int PHYSFS_mountMany(const PHYSFS_MountSpec *specs, PHYSFS_uint32 count,
+                     int threads)
+{
+    MountBatch batch;
+    void **workers = NULL;
+    int numworkers = 0;
+    size_t i, j;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!specs && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (i = 0; i < count; i++)
+        BAIL_IF(!specs[i].newDir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (count == 0)
+        return 1;
+
+    memset(&batch, '\0', sizeof (batch));
+    batch.count = count;
+    batch.jobs = (MountJob *) allocator.Malloc(sizeof (MountJob) * count);
+    BAIL_IF(!batch.jobs, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(batch.jobs, '\0', sizeof (MountJob) * count);
+
+    /*
+     * Parse everything with stateLock held shared, so other threads can keep
+     *  reading from what's already mounted. (pendingMounts) stops anyone
+     *  deregistering an archiver our DirHandles use between here and when
+     *  we grab the lock exclusively to link them in.
+     */
+    __PHYSFS_platformGrabRWLockShared(stateLock);
+    __PHYSFS_ATOMIC_INCR(&pendingMounts);
+
+    for (i = 0; i < count; i++)
+    {
+        MountJob *job = &batch.jobs[i];
+        job->spec = &specs[i];
+        job->skip = alreadyMounted(specs[i].newDir);
+        for (j = 0; (j < i) && (!job->skip); j++)
+            job->skip = (strcmp(specs[j].newDir, specs[i].newDir) == 0);
+    } /* for */
+
+    if ((threads > 1) && (count > 1) && (allArchiversThreadSafe()))
+    {
+        if (((size_t) threads) > count)
+            threads = (int) count;
+        workers = (void **) allocator.Malloc(sizeof (void *) * (threads - 1));
+        if (workers != NULL)
+        {
+            /* if we can't start them all, we'll just have fewer helpers. */
+            while (numworkers < threads - 1)
+            {
+                void *t = __PHYSFS_platformCreateThread(mountWorker, &batch);
+                if (t == NULL)
+                    break;
+                workers[numworkers++] = t;
+            } /* while */
+        } /* if */
+    } /* if */
+
+    mountWorker(&batch);  /* this thread pitches in, too. */
+
+    for (i = 0; i < (size_t) numworkers; i++)
+        __PHYSFS_platformWaitThread(workers[i]);
+    allocator.Free(workers);
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    grabStateLockExclusive();
+    __PHYSFS_ATOMIC_DECR(&pendingMounts);
+
+    /* someone else might have mounted some of these while we unlocked. */
+    for (i = 0; i < count; i++)
+    {
+        MountJob *job = &batch.jobs[i];
+        if ((!job->skip) && (alreadyMounted(job->spec->newDir)))
+        {
+            discardDirHandle(job->dirHandle);
+            job->dirHandle = NULL;
+            job->skip = 1;
+        } /* if */
+    } /* for */
+
+    /* all or nothing: report the first failure, in the order requested. */
+    for (i = 0; i < count; i++)
+    {
+        const MountJob *job = &batch.jobs[i];
+        if ((!job->skip) && (!job->dirHandle))
+        {
+            const PHYSFS_ErrorCode errcode = job->errcode;
+            for (j = 0; j < count; j++)
+                discardDirHandle(batch.jobs[j].dirHandle);
+            allocator.Free(batch.jobs);
+            BAIL_RWLOCK(errcode, stateLock, 0);
+        } /* if */
+    } /* for */
+
+    /* link them in one at a time, just like PHYSFS_mount() would. */
+    for (i = 0; i < count; i++)
+    {
+        DirHandle *dh = batch.jobs[i].dirHandle;
+        if (dh == NULL)
+            continue;
+
+        if (!archiverIsThreadSafe(dh->funcs))
+            serializedDirs++;
+
+        if (!batch.jobs[i].spec->appendToPath)
+        {
+            dh->next = searchPath;
+            searchPath = dh;
+        } /* if */
+        else if (searchPath == NULL)
+            searchPath = dh;
+        else
+        {
+            DirHandle *prev;
+            for (prev = searchPath; prev->next != NULL; prev = prev->next) {}
+            prev->next = dh;
+        } /* else */
+
+        searchPathGeneration++;
+        pathIndexMounted(dh, !batch.jobs[i].spec->appendToPath);
+        watchMounted(dh);
+    } /* for */
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    allocator.Free(batch.jobs);
+    return 1;
+} /* PHYSFS_mountMany */
+
+
+int PHYSFS_addToSearchPath(const char *newDir, int appendToPath)
+{
+    return PHYSFS_mount(newDir, NULL, appendToPath);
+} /* PHYSFS_addToSearchPath */
+
+
+int PHYSFS_removeFromSearchPath(const char *oldDir)
+{
+    return PHYSFS_unmount(oldDir);
+} /* PHYSFS_removeFromSearchPath */
+
+
+int PHYSFS_unmount(const char *oldDir)
+{
+    DirHandle *i;
+    DirHandle *prev = NULL;
+    DirHandle *next = NULL;
+
+    BAIL_IF(oldDir == NULL, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLockExclusive();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, oldDir) == 0)
+        {
+            const int indexed = dirHandleIndexable(i);
+            next = i->next;
+            BAIL_IF_RWLOCK_ERRPASS(!freeDirHandle(i, openReadList),
+                                   stateLock, 0);
+
+            if (prev == NULL)
+                searchPath = next;
+            else
+                prev->next = next;
+
+            searchPathGeneration++;
+            pathIndexUnmounted(i, indexed, next);
+
+            BAIL_RWLOCK_ERRPASS(stateLock, 1);
+        } /* if */
+        prev = i;
+    } /* for */
+
+    BAIL_RWLOCK(PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
+} /* PHYSFS_unmount */
+
+
+char **PHYSFS_getSearchPath(void)
+{
+    return doEnumStringList(PHYSFS_getSearchPathCallback);
+} /* PHYSFS_getSearchPath */
+
+
+const char *PHYSFS_getMountPoint(const char *dir)
+{
+    DirHandle *i;
+    grabStateLockShared();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+        {
+            const char *retval = ((i->mountPoint) ? i->mountPoint : "/");
+            __PHYSFS_platformReleaseRWLock(stateLock);
+            return retval;
+        } /* if */
+    } /* for */
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    BAIL(PHYSFS_ERR_NOT_MOUNTED, NULL);
+} /* PHYSFS_getMountPoint */
+
+
+void PHYSFS_getSearchPathCallback(PHYSFS_StringCallback callback, void *data)
+{
+    DirHandle *i;
+
+    grabStateLockShared();
+
+    for (i = searchPath; i != NULL; i = i->next)
+        callback(data, i->dirName);
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+} /* PHYSFS_getSearchPathCallback */
+
+
+typedef struct setSaneCfgEnumData
+{
+    const char *archiveExt;
+    size_t archiveExtLen;
+    int archivesFirst;
+    PHYSFS_ErrorCode errcode;
+} setSaneCfgEnumData;
+
+static PHYSFS_EnumerateCallbackResult setSaneCfgEnumCallback(void *_data,
+                                                const char *dir, const char *f)
+{
+    setSaneCfgEnumData *data = (setSaneCfgEnumData *) _data;
+    const size_t extlen = data->archiveExtLen;
+    const size_t l = strlen(f);
+    const char *ext;
+
+    if ((l > extlen) && (f[l - extlen - 1] == '.'))
+    {
+        ext = f + (l - extlen);
+        if (PHYSFS_utf8stricmp(ext, data->archiveExt) == 0)
+        {
+            const char dirsep = __PHYSFS_platformDirSeparator;
+            const char *d = PHYSFS_getRealDir(f);
+            const size_t allocsize = strlen(d) + l + 2;
+            char *str = (char *) __PHYSFS_smallAlloc(allocsize);
+            if (str == NULL)
+                data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+            else
+            {
+                snprintf(str, allocsize, "%s%c%s", d, dirsep, f);
+                if (!PHYSFS_mount(str, NULL, data->archivesFirst == 0))
+                    data->errcode = currentErrorCode();
+                __PHYSFS_smallFree(str);
+            } /* else */
+        } /* if */
+    } /* if */
+
+    /* !!! FIXME: if we want to abort on errors... */
+    /*return (data->errcode != PHYSFS_ERR_OK) ? PHYSFS_ENUM_ERROR : PHYSFS_ENUM_OK;*/
+
+    return PHYSFS_ENUM_OK;  /* keep going */
+} /* setSaneCfgEnumCallback */
+
+
+int PHYSFS_setSaneConfig(const char *organization, const char *appName,
+                         const char *archiveExt, int includeCdRoms,
+                         int archivesFirst)
+{
+    const char *basedir;
+    const char *prefdir;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    prefdir = PHYSFS_getPrefDir(organization, appName);
+    BAIL_IF_ERRPASS(!prefdir, 0);
+
+    basedir = PHYSFS_getBaseDir();
+    BAIL_IF_ERRPASS(!basedir, 0);
+
+    BAIL_IF(!PHYSFS_setWriteDir(prefdir), PHYSFS_ERR_NO_WRITE_DIR, 0);
+
+    /* !!! FIXME: these can fail and we should report that... */
+
+    /* Put write dir first in search path... */
+    PHYSFS_mount(prefdir, NULL, 0);
+
+    /* Put base path on search path... */
+    PHYSFS_mount(basedir, NULL, 1);
 
     /* handle CD-ROMs... */
     if (includeCdRoms)
@@ -1961,6 +4087,9 @@ int PHYSFS_setSaneConfig(const char *organization, const char *appName,
         data.archiveExtLen = strlen(archiveExt);
         data.archivesFirst = archivesFirst;
         data.errcode = PHYSFS_ERR_OK;
+
+        /* the callback mounts things, so it can't run under a shared lock. */
+        grabStateLockExclusive();
         if (!PHYSFS_enumerate("/", setSaneCfgEnumCallback, &data))
         {
             /* !!! FIXME: use this if we're reporting errors.
@@ -1968,6 +4097,7 @@ int PHYSFS_setSaneConfig(const char *organization, const char *appName,
             if (errcode == PHYSFS_ERR_APP_CALLBACK)
                 errcode = data->errcode; */
         } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
     } /* if */
 
     return 1;
@@ -1986,41 +4116,373 @@ int PHYSFS_symbolicLinksPermitted(void)
 } /* PHYSFS_symbolicLinksPermitted */
 
 
-/*
- * Verify that (fname) (in platform-independent notation), in relation
- *  to (h) is secure. That means that each element of fname is checked
- *  for symlinks (if they aren't permitted). This also allows for quick
- *  rejection of files that exist outside an archive's mountpoint.
- *
- * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
- *  at a time), you should always pass zero for "allowMissing" for efficiency.
- *
- * (fname) must point to an output from sanitizePlatformIndependentPath(),
- *  since it will make sure that path names are in the right format for
- *  passing certain checks. It will also do checks for "insecure" pathnames
- *  like ".." which should be done once instead of once per archive. This also
- *  gives us license to treat (fname) as scratch space in this function.
- *
- * Returns non-zero if string is safe, zero if there's a security issue.
- *  PHYSFS_getLastError() will specify what was wrong. (*fname) will be
- *  updated to point past any mount point elements so it is prepared to
- *  be used with the archiver directly.
- */
-static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
+void PHYSFS_setCrcVerification(int enable)
 {
-    char *fname = *_fname;
-    int retval = 1;
-    char *start;
-    char *end;
+    verifyCrcs = enable;
+} /* PHYSFS_setCrcVerification */
 
-    if (*fname == '\0')  /* quick rejection. */
-        return 1;
 
-    /* !!! FIXME: This codeblock sucks. */
-    if (h->mountPoint != NULL)  /* NULL mountpoint means "/". */
-    {
-        size_t mntpntlen = strlen(h->mountPoint);
-        size_t len = strlen(fname);
+int PHYSFS_crcVerificationEnabled(void)
+{
+    return verifyCrcs;
+} /* PHYSFS_crcVerificationEnabled */
+
+
+int PHYSFS_verifyArchive(const char *dir, int threads)
+{
+    DirHandle *i;
+    int retval = 0;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!dir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    /* shared: other threads can keep reading while we check. */
+    grabStateLockShared();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+            break;
+    } /* for */
+
+    if (i == NULL)
+        PHYSFS_setErrorCode(PHYSFS_ERR_NOT_MOUNTED);
+    #if PHYSFS_SUPPORTS_ZIP
+    else if (i->funcs->openArchive == __PHYSFS_Archiver_ZIP.openArchive)
+        retval = ZIP_verifyArchive(i->opaque, threads);
+    #endif
+    else
+        PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);  /* no CRCs to check. */
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    return retval;
+} /* PHYSFS_verifyArchive */
+
+
+/* Add the counts of every file in (list) from (dh), or from anywhere if NULL.
+   MAKE SURE you hold openListLock before calling this! */
+static void openListStats(const FileHandle *list, const DirHandle *dh,
+                          PHYSFS_Stats *total)
+{
+    const FileHandle *i;
+    PHYSFS_Stats stats;
+
+    for (i = list; i != NULL; i = i->next)
+    {
+        if ((dh == NULL) || (i->dirHandle == dh))
+        {
+            fileStats(i, &stats);
+            statsAdd(total, &stats);
+        } /* if */
+    } /* for */
+} /* openListStats */
+
+
+int PHYSFS_getStats(PHYSFS_Stats *stats)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!stats, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    memset(stats, '\0', sizeof (*stats));
+    __PHYSFS_platformGrabMutex(openListLock);
+    statsAdd(stats, &globalStats);
+    openListStats(openReadList, NULL, stats);
+    openListStats(openWriteList, NULL, stats);
+    __PHYSFS_platformReleaseMutex(openListLock);
+
+    return 1;
+} /* PHYSFS_getStats */
+
+
+int PHYSFS_getArchiveStats(const char *dir, PHYSFS_Stats *stats)
+{
+    DirHandle *i;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!dir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!stats, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLockShared();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+            break;
+    } /* for */
+
+    if ((i == NULL) && (writeDir != NULL))
+    {
+        if (strcmp(writeDir->dirName, dir) == 0)
+            i = writeDir;
+    } /* if */
+
+    if (i == NULL)
+    {
+        __PHYSFS_platformReleaseRWLock(stateLock);
+        BAIL(PHYSFS_ERR_NOT_MOUNTED, 0);
+    } /* if */
+
+    memset(stats, '\0', sizeof (*stats));
+    __PHYSFS_platformGrabMutex(openListLock);
+    statsAdd(stats, &i->stats);
+    openListStats(openReadList, i, stats);
+    openListStats(openWriteList, i, stats);
+    __PHYSFS_platformReleaseMutex(openListLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    return 1;
+} /* PHYSFS_getArchiveStats */
+
+
+int PHYSFS_getFileStats(PHYSFS_File *handle, PHYSFS_Stats *stats)
+{
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!stats, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    __PHYSFS_platformGrabMutex(openListLock);
+    fileStats((const FileHandle *) handle, stats);
+    __PHYSFS_platformReleaseMutex(openListLock);
+    return 1;
+} /* PHYSFS_getFileStats */
+
+
+void __PHYSFS_trace(const PHYSFS_TraceEventType type, const int end,
+                    const char *path, const char *archive, const char *detail,
+                    PHYSFS_File *file, const PHYSFS_uint64 offset,
+                    const PHYSFS_sint64 result)
+{
+    const PHYSFS_TraceCallback hook = __PHYSFS_traceHook;
+    PHYSFS_TraceEvent event;
+
+    if (hook == NULL)  /* unset since the caller checked? */
+        return;
+
+    event.type = type;
+    event.end = end;
+    event.time = __PHYSFS_platformNanoseconds();
+    event.path = path;
+    event.archive = archive;
+    event.detail = detail;
+    event.file = file;
+    event.offset = offset;
+    event.result = result;
+    hook(traceData, &event);
+} /* __PHYSFS_trace */
+
+
+void PHYSFS_setTraceHook(PHYSFS_TraceCallback cb, void *data)
+{
+    traceData = data;
+    __PHYSFS_traceHook = cb;
+} /* PHYSFS_setTraceHook */
+
+
+int PHYSFS_setSearchPathIndex(int enable)
+{
+    int retval = 1;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    grabStateLockExclusive();
+    if (!enable)
+        freePathIndex();
+    else if (!usePathIndex)
+        retval = buildPathIndex();
+    usePathIndex = (enable && retval);
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    return retval;
+} /* PHYSFS_setSearchPathIndex */
+
+
+int PHYSFS_searchPathIndexed(void)
+{
+    return usePathIndex;
+} /* PHYSFS_searchPathIndexed */
+
+
+int PHYSFS_setIgnoreCase(const char *dir, int enable)
+{
+    DirHandle *i;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!dir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLockExclusive();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+            break;
+    } /* for */
+
+    BAIL_IF_RWLOCK(!i, PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
+
+    enable = (enable != 0);
+    if (i->ignoreCase != enable)
+    {
+        if ((enable) && (dirHandleHasDirTree(i)))
+        {
+            __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) i->opaque;
+            BAIL_IF_RWLOCK_ERRPASS(!__PHYSFS_DirTreeFoldCase(tree),
+                                   stateLock, 0);
+        } /* if */
+
+        i->ignoreCase = enable;
+        searchPathGeneration++;
+
+        /* (i) just joined or left the index; if we can't redo it, drop it. */
+        if ((usePathIndex) && (dirHandleHasDirTree(i)) && (!buildPathIndex()))
+            usePathIndex = 0;
+    } /* if */
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    return 1;
+} /* PHYSFS_setIgnoreCase */
+
+
+int PHYSFS_setDirCache(const char *dir, int enable)
+{
+    DirHandle *i;
+    int rc = 1;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!dir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLockExclusive();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+            break;
+    } /* for */
+
+    BAIL_IF_RWLOCK(!i, PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
+
+    /* archives keep their whole directory in memory already. */
+    if (i->funcs == &__PHYSFS_Archiver_DIR)
+        rc = DIR_setCache(i->opaque, enable != 0);
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    return rc;
+} /* PHYSFS_setDirCache */
+
+
+typedef struct
+{
+    char *piece;  /* path element to find, null-terminated, in the path. */
+    size_t len;  /* strlen(piece); matches must be the same length. */
+    int found;
+} LocateCaseData;
+
+static PHYSFS_EnumerateCallbackResult locateCaseCallback(void *_data,
+                                                         const char *origdir,
+                                                         const char *fname)
+{
+    LocateCaseData *data = (LocateCaseData *) _data;
+    if ((strlen(fname) == data->len) &&
+        (PHYSFS_utf8stricmp(fname, data->piece) == 0))
+    {
+        memcpy(data->piece, fname, data->len);
+        data->found = 1;
+        return PHYSFS_ENUM_STOP;
+    } /* if */
+
+    return PHYSFS_ENUM_OK;
+} /* locateCaseCallback */
+
+
+/*
+ * Rewrite (fname), relative to (h), to the case it actually has in (h), if
+ *  there's a case-insensitive match. (fname) is left alone otherwise; the
+ *  archiver will report it missing in due time.
+ *
+ * Archives with a __PHYSFS_DirTree do this with one hash probe. Anything
+ *  else gets each element of the path checked, and its parent directory
+ *  enumerated if it's missing, like extras/ignorecase.c does.
+ *
+ * Matches are copied over (fname), so they have to be the same length in
+ *  UTF-8; that doesn't hold for a handful of characters (the Kelvin sign
+ *  folds to a plain 'k', say), and those won't be found.
+ */
+static void locateCorrectCase(DirHandle *h, char *fname)
+{
+    PHYSFS_Stat statbuf;
+    char *start = fname;
+
+    if (dirHandleHasDirTree(h))
+    {
+        __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) h->opaque;
+        const __PHYSFS_DirTreeEntry *entry;
+        entry = (const __PHYSFS_DirTreeEntry *)
+                    __PHYSFS_DirTreeFindIgnoreCase(tree, fname);
+        if ((entry) && (strlen(entry->name) == strlen(fname)))
+            memcpy(fname, entry->name, strlen(fname));
+        return;
+    } /* if */
+
+    if (h->funcs->stat(h->opaque, fname, &statbuf))
+        return;  /* exact match, we're done. */
+
+    while (1)
+    {
+        char *end = strchr(start, '/');
+        int found;
+
+        if (end != NULL) *end = '\0';
+        found = h->funcs->stat(h->opaque, fname, &statbuf);
+        if (!found)
+        {
+            LocateCaseData data;
+            data.piece = start;
+            data.len = strlen(start);
+            data.found = 0;
+            if (start != fname) start[-1] = '\0';
+            h->funcs->enumerate(h->opaque, (start == fname) ? "" : fname,
+                                locateCaseCallback, "", &data);
+            if (start != fname) start[-1] = '/';
+            found = data.found;
+        } /* if */
+        if (end != NULL) *end = '/';
+
+        if ((!found) || (end == NULL))
+            break;
+
+        start = end + 1;
+    } /* while */
+} /* locateCorrectCase */
+
+
+/*
+ * Verify that (fname) (in platform-independent notation), in relation
+ *  to (h) is secure. That means that each element of fname is checked
+ *  for symlinks (if they aren't permitted). This also allows for quick
+ *  rejection of files that exist outside an archive's mountpoint.
+ *
+ * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
+ *  at a time), you should always pass zero for "allowMissing" for efficiency.
+ *
+ * (fname) must point to an output from sanitizePlatformIndependentPath(),
+ *  since it will make sure that path names are in the right format for
+ *  passing certain checks. It will also do checks for "insecure" pathnames
+ *  like ".." which should be done once instead of once per archive. This also
+ *  gives us license to treat (fname) as scratch space in this function.
+ *
+ * Returns non-zero if string is safe, zero if there's a security issue.
+ *  PHYSFS_getLastError() will specify what was wrong. (*fname) will be
+ *  updated to point past any mount point elements so it is prepared to
+ *  be used with the archiver directly.
+ */
+static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
+{
+    char *fname = *_fname;
+    int retval = 1;
+    char *start;
+    char *end;
+
+    if (*fname == '\0')  /* quick rejection. */
+        return 1;
+
+    /* !!! FIXME: This codeblock sucks. */
+    if (h->mountPoint != NULL)  /* NULL mountpoint means "/". */
+    {
+        size_t mntpntlen = strlen(h->mountPoint);
+        size_t len = strlen(fname);
         assert(mntpntlen > 1); /* root mount points should be NULL. */
         /* not under the mountpoint, so skip this archive. */
         BAIL_IF(len < mntpntlen-1, PHYSFS_ERR_NOT_FOUND, 0);
@@ -2036,6 +4498,9 @@ static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
         retval = 1;  /* may be reset, below. */
     } /* if */
 
+    if ((h->ignoreCase) && (*fname != '\0'))
+        locateCorrectCase(h, fname);
+
     start = fname;
     if (!allowSymLinks)
     {
@@ -2091,10 +4556,10 @@ static int doMkdir(const char *_dname, char *dname)
 
     BAIL_IF_ERRPASS(!sanitizePlatformIndependentPath(_dname, dname), 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    BAIL_IF_MUTEX(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
+    grabStateLockShared();
+    BAIL_IF_RWLOCK(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
     h = writeDir;
-    BAIL_IF_MUTEX_ERRPASS(!verifyPath(h, &dname, 1), stateLock, 0);
+    BAIL_IF_RWLOCK_ERRPASS(!verifyPath(h, &dname, 1), stateLock, 0);
 
     start = dname;
     while (1)
@@ -2119,550 +4584,3138 @@ static int doMkdir(const char *_dname, char *dname)
         if (!retval)
             break;
 
-        if (end == NULL)
-            break;
+        if (end == NULL)
+            break;
+
+        *end = '/';
+        start = end + 1;
+    } /* while */
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    return retval;
+} /* doMkdir */
+
+
+int PHYSFS_mkdir(const char *_dname)
+{
+    int retval = 0;
+    char *dname;
+    size_t len;
+
+    BAIL_IF(!_dname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_dname) + 1;
+    dname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!dname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    retval = doMkdir(_dname, dname);
+    __PHYSFS_smallFree(dname);
+    return retval;
+} /* PHYSFS_mkdir */
+
+
+static int doDelete(const char *_fname, char *fname)
+{
+    int retval;
+    DirHandle *h;
+    BAIL_IF_ERRPASS(!sanitizePlatformIndependentPath(_fname, fname), 0);
+
+    grabStateLockShared();
+
+    BAIL_IF_RWLOCK(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
+    h = writeDir;
+    BAIL_IF_RWLOCK_ERRPASS(!verifyPath(h, &fname, 0), stateLock, 0);
+    retval = h->funcs->remove(h->opaque, fname);
+
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    return retval;
+} /* doDelete */
+
+
+int PHYSFS_delete(const char *_fname)
+{
+    int retval;
+    char *fname;
+    size_t len;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    retval = doDelete(_fname, fname);
+    __PHYSFS_smallFree(fname);
+    return retval;
+} /* PHYSFS_delete */
+
+
+static DirHandle *getRealDirHandle(const char *_fname)
+{
+    DirHandle *retval = NULL;
+    char *fname = NULL;
+    size_t len;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    len = strlen(_fname) + 1;
+    fname = __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        SearchPathCursor cursor;
+        DirHandle *i;
+        grabStateLockShared();
+        for (i = searchPathFirst(&cursor, fname); i != NULL;
+             i = searchPathNext(&cursor, i))
+        {
+            char *arcfname = fname;
+            if (partOfMountPoint(i, arcfname))
+            {
+                retval = i;
+                break;
+            } /* if */
+            else if (verifyPath(i, &arcfname, 0))
+            {
+                PHYSFS_Stat statbuf;
+                if (i->funcs->stat(i->opaque, arcfname, &statbuf))
+                {
+                    retval = i;
+                    break;
+                } /* if */
+            } /* if */
+        } /* for */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return retval;
+} /* getRealDirHandle */
+
+const char *PHYSFS_getRealDir(const char *fname)
+{
+    DirHandle *dh = getRealDirHandle(fname);
+    return dh ? dh->dirName : NULL;
+} /* PHYSFS_getRealDir */
+
+
+/*
+ * An arena hands out small pieces of big chunks of memory, so things that
+ *  all go away at the same time (DirTree entries, names being merged, ...)
+ *  don't need an allocation each. Pieces can't be freed on their own;
+ *  arenaFree() releases everything at once. (*arena) starts out NULL.
+ */
+#define ARENA_ALIGN 16
+
+typedef struct __PHYSFS_ARENACHUNK__
+{
+    struct __PHYSFS_ARENACHUNK__ *next;  /* previous (full) chunk. */
+    size_t used;  /* bytes handed out so far, including this header. */
+    size_t len;   /* total size of this chunk, including this header. */
+} ArenaChunk;
+
+static inline size_t arenaAlign(const size_t len)
+{
+    return (len + (ARENA_ALIGN - 1)) & ~((size_t) (ARENA_ALIGN - 1));
+} /* arenaAlign */
+
+static void *arenaAlloc(void **_arena, const size_t chunklen, size_t len)
+{
+    ArenaChunk *arena = (ArenaChunk *) *_arena;
+    void *retval;
+
+    len = arenaAlign(len);
+    if ((arena == NULL) || ((arena->len - arena->used) < len))
+    {
+        const size_t hdrlen = arenaAlign(sizeof (ArenaChunk));
+        size_t alloclen = chunklen;
+        if (alloclen < (hdrlen + len))
+            alloclen = hdrlen + len;
+        arena = (ArenaChunk *) allocator.Malloc(alloclen);
+        BAIL_IF(!arena, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        arena->next = (ArenaChunk *) *_arena;
+        arena->used = hdrlen;
+        arena->len = alloclen;
+        *_arena = arena;
+    } /* if */
+
+    retval = ((PHYSFS_uint8 *) arena) + arena->used;
+    arena->used += len;
+    return retval;
+} /* arenaAlloc */
+
+static void arenaFree(void **_arena)
+{
+    ArenaChunk *arena;
+    ArenaChunk *next;
+
+    for (arena = (ArenaChunk *) *_arena; arena != NULL; arena = next)
+    {
+        next = arena->next;
+        allocator.Free(arena);
+    } /* for */
+
+    *_arena = NULL;
+} /* arenaFree */
+
+
+/*
+ * A set of strings, for weeding out names we've seen before. Entries and
+ *  their strings live in an arena, so adding a name is usually a hash probe
+ *  and a memcpy. Start with a zeroed-out NameSet.
+ */
+#define NAMESET_ARENA_CHUNK (16 * 1024)
+
+typedef struct NameSetEntry
+{
+    char *name;
+    PHYSFS_uint32 hashval;
+    struct NameSetEntry *next;  /* hash bucket chain. */
+} NameSetEntry;
+
+typedef struct NameSet
+{
+    NameSetEntry **buckets;
+    size_t numBuckets;  /* always a power of two (or zero). */
+    size_t count;
+    void *arena;
+} NameSet;
+
+static int nameSetGrow(NameSet *set)
+{
+    const size_t newcount = set->numBuckets ? set->numBuckets * 2 : 64;
+    const size_t alloclen = newcount * sizeof (NameSetEntry *);
+    NameSetEntry **newbuckets = (NameSetEntry **) allocator.Malloc(alloclen);
+    size_t i;
+
+    BAIL_IF(!newbuckets, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(newbuckets, '\0', alloclen);
+
+    for (i = 0; i < set->numBuckets; i++)
+    {
+        NameSetEntry *entry;
+        NameSetEntry *next;
+        for (entry = set->buckets[i]; entry != NULL; entry = next)
+        {
+            const size_t bucket = entry->hashval & (newcount - 1);
+            next = entry->next;
+            entry->next = newbuckets[bucket];
+            newbuckets[bucket] = entry;
+        } /* for */
+    } /* for */
+
+    if (set->buckets)
+        allocator.Free(set->buckets);
+    set->buckets = newbuckets;
+    set->numBuckets = newcount;
+    return 1;
+} /* nameSetGrow */
+
+/* Returns 1 if (name) is new, 0 if it was already there, -1 on error. */
+static int nameSetAdd(NameSet *set, const char *name, const size_t len)
+{
+    const PHYSFS_uint32 hashval = __PHYSFS_hashString(name, len);
+    NameSetEntry *entry;
+    size_t bucket;
+
+    if (set->numBuckets)
+    {
+        entry = set->buckets[hashval & (set->numBuckets - 1)];
+        for (; entry != NULL; entry = entry->next)
+        {
+            if ((entry->hashval == hashval) && (strcmp(entry->name, name) == 0))
+                return 0;
+        } /* for */
+    } /* if */
+
+    if (set->count >= set->numBuckets)
+        BAIL_IF_ERRPASS(!nameSetGrow(set), -1);
+
+    entry = (NameSetEntry *) arenaAlloc(&set->arena, NAMESET_ARENA_CHUNK,
+                                        sizeof (*entry) + len + 1);
+    BAIL_IF_ERRPASS(!entry, -1);
+    entry->name = ((char *) entry) + sizeof (*entry);
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    entry->hashval = hashval;
+    bucket = hashval & (set->numBuckets - 1);
+    entry->next = set->buckets[bucket];
+    set->buckets[bucket] = entry;
+    set->count++;
+    return 1;
+} /* nameSetAdd */
+
+static void nameSetFree(NameSet *set)
+{
+    if (set->buckets)
+        allocator.Free(set->buckets);
+    arenaFree(&set->arena);
+    memset(set, '\0', sizeof (*set));
+} /* nameSetFree */
+
+
+typedef struct
+{
+    NameSet names;
+    PHYSFS_EnumerateCallback callback;  /* NULL if we're building a list. */
+    void *callbackData;
+    PHYSFS_ErrorCode errcode;
+} EnumUniqueCallbackData;
+
+static PHYSFS_EnumerateCallbackResult enumUniqueCallback(void *data,
+                                        const char *origdir, const char *str)
+{
+    EnumUniqueCallbackData *pecd = (EnumUniqueCallbackData *) data;
+    const int rc = nameSetAdd(&pecd->names, str, strlen(str));
+
+    if (rc < 0)
+    {
+        pecd->errcode = currentErrorCode();
+        return PHYSFS_ENUM_ERROR;  /* better luck next time. */
+    } /* if */
+
+    else if ((rc == 0) || (pecd->callback == NULL))
+        return PHYSFS_ENUM_OK;  /* already seen, or just collecting. */
+
+    return pecd->callback(pecd->callbackData, origdir, str);
+} /* enumUniqueCallback */
+
+
+static int enumUnique(const char *path, EnumUniqueCallbackData *ecd)
+{
+    if (!PHYSFS_enumerate(path, enumUniqueCallback, ecd))
+    {
+        const PHYSFS_ErrorCode errcode = currentErrorCode();
+        BAIL_IF(errcode == PHYSFS_ERR_APP_CALLBACK && ecd->errcode,
+                ecd->errcode, 0);
+        return 0;
+    } /* if */
+
+    return 1;
+} /* enumUnique */
+
+
+int PHYSFS_enumerateUnique(const char *path, PHYSFS_EnumerateCallback cb,
+                           void *data)
+{
+    EnumUniqueCallbackData ecd;
+    int retval;
+
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    memset(&ecd, '\0', sizeof (ecd));
+    ecd.callback = cb;
+    ecd.callbackData = data;
+    retval = enumUnique(path, &ecd);
+    nameSetFree(&ecd.names);
+    return retval;
+} /* PHYSFS_enumerateUnique */
+
+
+static int enumFilesCmp(void *_a, size_t one, size_t two)
+{
+    char **a = (char **) _a;
+    return strcmp(a[one], a[two]);
+} /* enumFilesCmp */
+
+static void enumFilesSwap(void *_a, size_t one, size_t two)
+{
+    char **a = (char **) _a;
+    char *tmp = a[one];
+    a[one] = a[two];
+    a[two] = tmp;
+} /* enumFilesSwap */
+
+
+char **PHYSFS_enumerateFiles(const char *path)
+{
+    EnumUniqueCallbackData ecd;
+    char **retval;
+    size_t count = 0;
+    size_t i;
+
+    memset(&ecd, '\0', sizeof (ecd));
+    if (!enumUnique(path, &ecd))
+    {
+        nameSetFree(&ecd.names);
+        return NULL;
+    } /* if */
+
+    /* merge into a set, then sort once, instead of inserting in order. */
+    retval = (char **) allocator.Malloc(sizeof (char *) * (ecd.names.count+1));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, enumerateFilesFailed);
+
+    for (i = 0; i < ecd.names.numBuckets; i++)
+    {
+        const NameSetEntry *entry;
+        for (entry = ecd.names.buckets[i]; entry; entry = entry->next)
+        {
+            retval[count] = __PHYSFS_strdup(entry->name);
+            GOTO_IF(!retval[count], PHYSFS_ERR_OUT_OF_MEMORY,
+                    enumerateFilesFailed);
+            count++;
+        } /* for */
+    } /* for */
+
+    retval[count] = NULL;
+    nameSetFree(&ecd.names);
+    __PHYSFS_sort(retval, count, enumFilesCmp, enumFilesSwap);
+    return retval;
+
+enumerateFilesFailed:
+    if (retval)
+    {
+        retval[count] = NULL;
+        PHYSFS_freeList(retval);
+    } /* if */
+    nameSetFree(&ecd.names);
+    return NULL;
+} /* PHYSFS_enumerateFiles */
+
+
+/*
+ * Broke out to seperate function so we can use stack allocation gratuitously.
+ */
+static PHYSFS_EnumerateCallbackResult enumerateFromMountPoint(DirHandle *i,
+                                    const char *arcfname,
+                                    PHYSFS_EnumerateCallback callback,
+                                    const char *_fname, void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval;
+    const size_t len = strlen(arcfname);
+    char *ptr = NULL;
+    char *end = NULL;
+    const size_t slen = strlen(i->mountPoint) + 1;
+    char *mountPoint = (char *) __PHYSFS_smallAlloc(slen);
+
+    BAIL_IF(!mountPoint, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+
+    strcpy(mountPoint, i->mountPoint);
+    ptr = mountPoint + ((len) ? len + 1 : 0);
+    end = strchr(ptr, '/');
+    assert(end);  /* should always find a terminating '/'. */
+    *end = '\0';
+    retval = callback(data, _fname, ptr);
+    __PHYSFS_smallFree(mountPoint);
+
+    BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+    return retval;
+} /* enumerateFromMountPoint */
+
+
+typedef struct SymlinkFilterData
+{
+    PHYSFS_EnumerateCallback callback;
+    void *callbackData;
+    DirHandle *dirhandle;
+    const char *arcfname;
+    PHYSFS_ErrorCode errcode;
+} SymlinkFilterData;
+
+static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
+                                    const char *origdir, const char *fname)
+{
+    SymlinkFilterData *data = (SymlinkFilterData *) _data;
+    const DirHandle *dh = data->dirhandle;
+    const char *arcfname = data->arcfname;
+    PHYSFS_Stat statbuf;
+    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
+    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(slen);
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+
+    if (path == NULL)
+    {
+        data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
+
+    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
+
+    if (!dh->funcs->stat(dh->opaque, path, &statbuf))
+    {
+        data->errcode = currentErrorCode();
+        retval = PHYSFS_ENUM_ERROR;
+    } /* if */
+    else
+    {
+        /* Pass it on to the application if it's not a symlink. */
+        if (statbuf.filetype != PHYSFS_FILETYPE_SYMLINK)
+        {
+            retval = data->callback(data->callbackData, origdir, fname);
+            if (retval == PHYSFS_ENUM_ERROR)
+                data->errcode = PHYSFS_ERR_APP_CALLBACK;
+        } /* if */
+    } /* else */
+
+    __PHYSFS_smallFree(path);
+
+    return retval;
+} /* enumCallbackFilterSymLinks */
+
+
+int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    size_t len;
+    char *fname;
+
+    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    len = strlen(_fn) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    if (!sanitizePlatformIndependentPath(_fn, fname))
+        retval = PHYSFS_ENUM_STOP;
+    else
+    {
+        DirHandle *i;
+        SymlinkFilterData filterdata;
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 0, _fn, NULL, NULL, NULL,
+                           0, 0);
+        } /* if */
+
+        grabStateLockShared();
+
+        if (!allowSymLinks)
+        {
+            memset(&filterdata, '\0', sizeof (filterdata));
+            filterdata.callback = cb;
+            filterdata.callbackData = data;
+        } /* if */
+
+        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        {
+            char *arcfname = fname;
+
+            if (partOfMountPoint(i, arcfname))
+                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
+
+            else if (verifyPath(i, &arcfname, 0))
+            {
+                PHYSFS_Stat statbuf;
+                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+                {
+                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
+                        continue;  /* no such dir in this archive, skip it. */
+                } /* if */
+
+                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
+                    continue;  /* not a directory in this archive, skip it. */
+
+                else if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
+                {
+                    filterdata.dirhandle = i;
+                    filterdata.arcfname = arcfname;
+                    filterdata.errcode = PHYSFS_ERR_OK;
+                    retval = i->funcs->enumerate(i->opaque, arcfname,
+                                                 enumCallbackFilterSymLinks,
+                                                 _fn, &filterdata);
+                    if (retval == PHYSFS_ENUM_ERROR)
+                    {
+                        if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
+                            PHYSFS_setErrorCode(filterdata.errcode);
+                    } /* if */
+                } /* else if */
+                else
+                {
+                    retval = i->funcs->enumerate(i->opaque, arcfname,
+                                                 cb, _fn, data);
+                } /* else */
+            } /* else if */
+        } /* for */
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 1, _fn, NULL, NULL, NULL,
+                           0, retval != PHYSFS_ENUM_ERROR);
+        } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+
+    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
+} /* PHYSFS_enumerate */
+
+
+typedef struct
+{
+    NameSet names;
+    PHYSFS_EnumerateStatCallback callback;
+    void *callbackData;
+    int skipSymLinks;
+    DirHandle *dirhandle;  /* for archivers without enumerateStat(). */
+    const char *arcfname;
+    PHYSFS_ErrorCode errcode;
+} EnumStatCallbackData;
+
+static PHYSFS_EnumerateCallbackResult enumStatCallback(void *data,
+                                    const char *origdir, const char *fname,
+                                    const PHYSFS_Stat *stat)
+{
+    EnumStatCallbackData *pecd = (EnumStatCallbackData *) data;
+    PHYSFS_EnumerateCallbackResult retval;
+    int rc;
+
+    if ((pecd->skipSymLinks) && (stat->filetype == PHYSFS_FILETYPE_SYMLINK))
+        return PHYSFS_ENUM_OK;
+
+    rc = nameSetAdd(&pecd->names, fname, strlen(fname));
+    if (rc < 0)
+    {
+        pecd->errcode = currentErrorCode();
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
+
+    else if (rc == 0)
+        return PHYSFS_ENUM_OK;  /* an earlier search path element has it. */
+
+    retval = pecd->callback(pecd->callbackData, origdir, fname, stat);
+    if (retval == PHYSFS_ENUM_ERROR)
+        pecd->errcode = PHYSFS_ERR_APP_CALLBACK;
+    return retval;
+} /* enumStatCallback */
+
+
+/* Archivers without an enumerateStat() method get a stat() per file. */
+static PHYSFS_EnumerateCallbackResult enumStatFallbackCallback(void *data,
+                                    const char *origdir, const char *fname)
+{
+    EnumStatCallbackData *pecd = (EnumStatCallbackData *) data;
+    const DirHandle *dh = pecd->dirhandle;
+    const char *arcfname = pecd->arcfname;
+    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
+    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(slen);
+    PHYSFS_EnumerateCallbackResult retval;
+    PHYSFS_Stat statbuf;
+
+    if (path == NULL)
+    {
+        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
+
+    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
+
+    if (dh->funcs->stat(dh->opaque, path, &statbuf))
+        retval = enumStatCallback(data, origdir, fname, &statbuf);
+    else
+    {
+        pecd->errcode = currentErrorCode();
+        retval = PHYSFS_ENUM_ERROR;
+    } /* else */
+
+    __PHYSFS_smallFree(path);
+
+    return retval;
+} /* enumStatFallbackCallback */
+
+
+/*
+ * A piece of a mount point is a directory, as far as PHYSFS_stat() cares,
+ *  unless it's the last piece: that's the archive's root directory.
+ */
+static PHYSFS_EnumerateCallbackResult enumStatMountPointCallback(void *data,
+                                    const char *origdir, const char *fname)
+{
+    EnumStatCallbackData *pecd = (EnumStatCallbackData *) data;
+    const DirHandle *dh = pecd->dirhandle;
+    const size_t arclen = strlen(pecd->arcfname);
+    const size_t len = (arclen ? arclen + 1 : 0) + strlen(fname) + 1;
+    PHYSFS_Stat statbuf;
+
+    if (strlen(dh->mountPoint) == len)
+    {
+        if (dh->funcs->stat(dh->opaque, "", &statbuf))
+            return enumStatCallback(data, origdir, fname, &statbuf);
+    } /* if */
+
+    statbuf.filesize = -1;
+    statbuf.modtime = -1;
+    statbuf.createtime = -1;
+    statbuf.accesstime = -1;
+    statbuf.filetype = PHYSFS_FILETYPE_DIRECTORY;
+    statbuf.readonly = 1;
+    return enumStatCallback(data, origdir, fname, &statbuf);
+} /* enumStatMountPointCallback */
+
+
+int PHYSFS_enumerateStat(const char *_fn, PHYSFS_EnumerateStatCallback cb,
+                         void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    EnumStatCallbackData ecd;
+    size_t len;
+    char *fname;
+
+    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    len = strlen(_fn) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    memset(&ecd, '\0', sizeof (ecd));
+    ecd.callback = cb;
+    ecd.callbackData = data;
+
+    if (!sanitizePlatformIndependentPath(_fn, fname))
+        retval = PHYSFS_ENUM_STOP;
+    else
+    {
+        DirHandle *i;
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 0, _fn, NULL, NULL, NULL,
+                           0, 0);
+        } /* if */
+
+        grabStateLockShared();
+
+        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        {
+            char *arcfname = fname;
+
+            ecd.errcode = PHYSFS_ERR_OK;
+
+            if (partOfMountPoint(i, arcfname))
+            {
+                ecd.dirhandle = i;
+                ecd.arcfname = arcfname;
+                ecd.skipSymLinks = 0;
+                retval = enumerateFromMountPoint(i, arcfname,
+                                                 enumStatMountPointCallback,
+                                                 _fn, &ecd);
+            } /* if */
+
+            else if (verifyPath(i, &arcfname, 0))
+            {
+                PHYSFS_Stat statbuf;
+                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+                {
+                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
+                        continue;  /* no such dir in this archive, skip it. */
+                } /* if */
+
+                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
+                    continue;  /* not a directory in this archive, skip it. */
+
+                ecd.skipSymLinks = ((!allowSymLinks) &&
+                                    (i->funcs->info.supportsSymlinks));
+
+                if (i->funcs->enumerateStat != NULL)
+                {
+                    retval = i->funcs->enumerateStat(i->opaque, arcfname,
+                                                     enumStatCallback,
+                                                     _fn, &ecd);
+                } /* if */
+                else
+                {
+                    ecd.dirhandle = i;
+                    ecd.arcfname = arcfname;
+                    retval = i->funcs->enumerate(i->opaque, arcfname,
+                                                 enumStatFallbackCallback,
+                                                 _fn, &ecd);
+                } /* else */
+            } /* else if */
+
+            if (retval == PHYSFS_ENUM_ERROR)
+            {
+                const PHYSFS_ErrorCode errcode = currentErrorCode();
+                if ((errcode == PHYSFS_ERR_APP_CALLBACK) && (ecd.errcode))
+                    PHYSFS_setErrorCode(ecd.errcode);
+            } /* if */
+        } /* for */
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 1, _fn, NULL, NULL, NULL,
+                           0, retval != PHYSFS_ENUM_ERROR);
+        } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    nameSetFree(&ecd.names);
+    __PHYSFS_smallFree(fname);
+
+    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
+} /* PHYSFS_enumerateStat */
+
+
+typedef struct
+{
+    PHYSFS_EnumFilesCallback callback;
+    void *data;
+} LegacyEnumFilesCallbackData;
+
+static PHYSFS_EnumerateCallbackResult enumFilesCallbackAlwaysSucceed(void *d,
+                                    const char *origdir, const char *fname)
+{
+    LegacyEnumFilesCallbackData *cbdata = (LegacyEnumFilesCallbackData *) d;
+    cbdata->callback(cbdata->data, origdir, fname);
+    return PHYSFS_ENUM_OK;
+} /* enumFilesCallbackAlwaysSucceed */
+
+void PHYSFS_enumerateFilesCallback(const char *fname,
+                                   PHYSFS_EnumFilesCallback callback,
+                                   void *data)
+{
+    LegacyEnumFilesCallbackData cbdata;
+    cbdata.callback = callback;
+    cbdata.data = data;
+    (void) PHYSFS_enumerate(fname, enumFilesCallbackAlwaysSucceed, &cbdata);
+} /* PHYSFS_enumerateFilesCallback */
+
+
+/*
+ * PHYSFS_enumerateGlob() walks each search path element's tree once, only
+ *  going down directories that the pattern can still match. Archives with a
+ *  __PHYSFS_DirTree are walked through their children lists, and pieces of
+ *  the pattern without wildcards are looked up directly instead of scanned
+ *  for, so a pattern that starts with "textures" never looks at anything
+ *  outside that directory. Other archivers (native dirs, mostly) get
+ *  enumerated and stat'd as we go.
+ *
+ * Matches are remembered in a hash, so something that shows up in several
+ *  archives is only reported once, like PHYSFS_enumerateFiles() does. The
+ *  hash only holds matches, not everything we looked at.
+ */
+typedef struct GlobNode
+{
+    size_t mountDepth;  /* mountpoint pieces above us (numMount: in archive)*/
+    const __PHYSFS_DirTreeEntry *entry;  /* our entry, if there's a DirTree. */
+} GlobNode;
+
+typedef struct GlobState
+{
+    char **comps;  /* the pattern, split on '/'. */
+    size_t numComps;
+    PHYSFS_EnumerateCallback callback;
+    void *callbackData;
+    DirHandle *dh;  /* search path element we're walking. */
+    __PHYSFS_DirTree *tree;  /* (dh)'s tree, if it has one. */
+    int checkSymlinks;  /* non-zero if we have to stat to skip symlinks. */
+    char **mountComps;  /* (dh)'s mountpoint, split on '/'. */
+    size_t numMount;
+    size_t arcOffset;  /* where in (path) the archive's own path starts. */
+    char *path;  /* virtual path of what we're looking at. */
+    size_t pathLen;
+    size_t pathAlloc;
+    NameSet seen;  /* everything we've reported. */
+} GlobState;
+
+static inline int globIsStarStar(const char *comp)
+{
+    return ((comp[0] == '*') && (comp[1] == '*') && (comp[2] == '\0'));
+} /* globIsStarStar */
+
+static inline int globIsWild(const char *comp)
+{
+    return (strpbrk(comp, "*?") != NULL);
+} /* globIsWild */
+
+static inline const char *globNextChar(const char *str)
+{
+    str++;
+    while ((*str & 0xC0) == 0x80)  /* skip UTF-8 continuation bytes. */
+        str++;
+    return str;
+} /* globNextChar */
+
+/* '*' matches any run of characters, '?' matches any one character. */
+static int globMatch(const char *pat, const char *str)
+{
+    const char *starpat = NULL;
+    const char *starstr = NULL;
+
+    while (*str)
+    {
+        if (*pat == '*')
+        {
+            while (*pat == '*')
+                pat++;
+            if (*pat == '\0')
+                return 1;  /* trailing '*' eats the rest. */
+            starpat = pat;
+            starstr = str;
+        } /* if */
+        else if (*pat == '?')
+        {
+            pat++;
+            str = globNextChar(str);
+        } /* else if */
+        else if (*pat == *str)
+        {
+            pat++;
+            str++;
+        } /* else if */
+        else if (starpat != NULL)  /* let the last '*' eat one more char. */
+        {
+            starstr = globNextChar(starstr);
+            str = starstr;
+            pat = starpat;
+        } /* else if */
+        else
+        {
+            return 0;
+        } /* else */
+    } /* while */
+
+    while (*pat == '*')
+        pat++;
+
+    return (*pat == '\0');
+} /* globMatch */
+
+static inline const char *globArcPath(const GlobState *g)
+{
+    return (g->pathLen >= g->arcOffset) ? g->path + g->arcOffset : "";
+} /* globArcPath */
+
+static int globPush(GlobState *g, const char *name, size_t *oldlen)
+{
+    const size_t namelen = strlen(name);
+    const size_t needed = g->pathLen + namelen + 2;
+
+    if (needed > g->pathAlloc)
+    {
+        size_t newalloc = g->pathAlloc ? g->pathAlloc * 2 : 256;
+        void *ptr;
+        while (newalloc < needed)
+            newalloc *= 2;
+        ptr = allocator.Realloc(g->path, newalloc);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        g->path = (char *) ptr;
+        g->pathAlloc = newalloc;
+    } /* if */
+
+    *oldlen = g->pathLen;
+    if (g->pathLen > 0)
+        g->path[g->pathLen++] = '/';
+    memcpy(g->path + g->pathLen, name, namelen + 1);
+    g->pathLen += namelen;
+    return 1;
+} /* globPush */
+
+static inline void globPop(GlobState *g, const size_t oldlen)
+{
+    g->pathLen = oldlen;
+    g->path[oldlen] = '\0';
+} /* globPop */
+
+/* Report (g->path) to the app, unless we've done it already. */
+static PHYSFS_EnumerateCallbackResult globEmit(GlobState *g)
+{
+    const int rc = nameSetAdd(&g->seen, g->path, g->pathLen);
+    PHYSFS_EnumerateCallbackResult retval;
+    char *sep;
+
+    if (rc <= 0)  /* another archive had it first, or out of memory. */
+        return (rc < 0) ? PHYSFS_ENUM_ERROR : PHYSFS_ENUM_OK;
+
+    sep = strrchr(g->path, '/');
+    if (sep == NULL)
+        retval = g->callback(g->callbackData, "", g->path);
+    else
+    {
+        *sep = '\0';
+        retval = g->callback(g->callbackData, g->path, sep + 1);
+        *sep = '/';
+    } /* else */
+
+    BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+    return retval;
+} /* globEmit */
+
+static PHYSFS_EnumerateCallbackResult globVisit(GlobState *g,
+                                                const GlobNode *node,
+                                                const size_t pi);
+
+/*
+ * (name) is a child of the node we're visiting, found as (child). (isdir)
+ *  is -1 if we don't know yet and need to stat it. (pi) is the piece of the
+ *  pattern that (name) has to match.
+ */
+static PHYSFS_EnumerateCallbackResult globChild(GlobState *g,
+                                                const GlobNode *child,
+                                                const char *name, int isdir,
+                                                const size_t pi)
+{
+    const char *comp = g->comps[pi];
+    const int last = (pi == (g->numComps - 1));
+    const int starstar = globIsStarStar(comp);
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    size_t oldlen;
+
+    if ((!starstar) && (!globMatch(comp, name)))
+        return PHYSFS_ENUM_OK;  /* prune it. */
+    else if ((!last) && (isdir == 0))
+        return PHYSFS_ENUM_OK;  /* need to go deeper, but can't. */
+
+    BAIL_IF_ERRPASS(!globPush(g, name, &oldlen), PHYSFS_ENUM_ERROR);
+
+    if ((child->mountDepth == g->numMount) &&
+        ((isdir < 0) || (g->checkSymlinks)))
+    {
+        PHYSFS_Stat statbuf;
+        const DirHandle *dh = g->dh;
+        if (!dh->funcs->stat(dh->opaque, globArcPath(g), &statbuf))
+            isdir = -2;  /* vanished, or broken; skip it. */
+        else if ((!allowSymLinks) &&
+                 (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK))
+            isdir = -2;
+        else
+            isdir = (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY);
+    } /* if */
+
+    if ((isdir == -2) || ((!last) && (!isdir)))
+        retval = PHYSFS_ENUM_OK;
+    else if (!starstar)
+        retval = last ? globEmit(g) : globVisit(g, child, pi + 1);
+    else
+    {
+        /* "**" matches (name), and goes on to match things under it. */
+        if (last)
+            retval = globEmit(g);
+        if ((retval == PHYSFS_ENUM_OK) && (isdir))
+            retval = globVisit(g, child, pi);
+    } /* else */
+
+    globPop(g, oldlen);
+    return retval;
+} /* globChild */
+
+typedef struct GlobNames
+{
+    char **list;  /* always NULL-terminated. */
+    size_t count;
+} GlobNames;
+
+static PHYSFS_EnumerateCallbackResult globCollect(void *data,
+                                        const char *origdir, const char *str)
+{
+    GlobNames *names = (GlobNames *) data;
+    void *ptr;
+
+    ptr = allocator.Realloc(names->list, (names->count + 2) * sizeof (char *));
+    BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    names->list = (char **) ptr;
+    names->list[names->count] = __PHYSFS_strdup(str);
+    BAIL_IF(!names->list[names->count], PHYSFS_ERR_OUT_OF_MEMORY,
+            PHYSFS_ENUM_ERROR);
+    names->list[++names->count] = NULL;
+    return PHYSFS_ENUM_OK;
+} /* globCollect */
+
+static PHYSFS_EnumerateCallbackResult globVisit(GlobState *g,
+                                                const GlobNode *node,
+                                                const size_t pi)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    const char *comp = g->comps[pi];
+    GlobNode child;
+
+    /* "**" can match no directories at all, too. */
+    if ((globIsStarStar(comp)) && (pi < (g->numComps - 1)))
+    {
+        retval = globVisit(g, node, pi + 1);
+        if (retval != PHYSFS_ENUM_OK)
+            return retval;
+    } /* if */
+
+    if (node->mountDepth < g->numMount)  /* only child is the next piece. */
+    {
+        child.mountDepth = node->mountDepth + 1;
+        child.entry = NULL;
+        if ((child.mountDepth == g->numMount) && (g->tree))
+            child.entry = g->tree->root;
+        return globChild(g, &child, g->mountComps[node->mountDepth], 1, pi);
+    } /* if */
+
+    child.mountDepth = node->mountDepth;
+    child.entry = NULL;
+
+    if (!globIsWild(comp))  /* look it up, don't go looking for it. */
+    {
+        int isdir = -1;
+        if (g->tree)
+        {
+            size_t oldlen;
+            BAIL_IF_ERRPASS(!globPush(g, comp, &oldlen), PHYSFS_ENUM_ERROR);
+            child.entry = (const __PHYSFS_DirTreeEntry *)
+                            __PHYSFS_DirTreeFind(g->tree, globArcPath(g));
+            globPop(g, oldlen);
+            if (child.entry == NULL)
+                return PHYSFS_ENUM_OK;
+            isdir = child.entry->isdir;
+        } /* if */
+        return globChild(g, &child, comp, isdir, pi);
+    } /* if */
+
+    if (g->tree)
+    {
+        const __PHYSFS_DirTreeEntry *entry = node->entry->children;
+        for (; (entry) && (retval == PHYSFS_ENUM_OK); entry = entry->sibling)
+        {
+            const char *name = strrchr(entry->name, '/');
+            child.entry = entry;
+            retval = globChild(g, &child, name ? name + 1 : entry->name,
+                               entry->isdir, pi);
+        } /* for */
+    } /* if */
+    else
+    {
+        const DirHandle *dh = g->dh;
+        GlobNames names;
+        size_t i;
+
+        names.count = 0;
+        names.list = (char **) allocator.Malloc(sizeof (char *));
+        BAIL_IF(!names.list, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+        names.list[0] = NULL;
+
+        /* recursing changes (g->path), so get the whole list first. */
+        if (dh->funcs->enumerate(dh->opaque, globArcPath(g), globCollect,
+                                 "", &names) != PHYSFS_ENUM_ERROR)
+        {
+            for (i = 0; (i < names.count) && (retval == PHYSFS_ENUM_OK); i++)
+                retval = globChild(g, &child, names.list[i], -1, pi);
+        } /* if */
+        else if (currentErrorCode() == PHYSFS_ERR_OUT_OF_MEMORY)
+        {
+            retval = PHYSFS_ENUM_ERROR;
+        } /* else if */
+
+        for (i = 0; i < names.count; i++)
+            allocator.Free(names.list[i]);
+        allocator.Free(names.list);
+    } /* else */
+
+    return retval;
+} /* globVisit */
+
+/* Split (str) on '/' in place. Returns a list of pieces, NULL if no memory. */
+static char **globSplit(char *str, size_t *count)
+{
+    char **retval;
+    size_t total = 1;
+    char *ptr;
+
+    for (ptr = str; *ptr; ptr++)
+        total += (*ptr == '/');
+
+    retval = (char **) allocator.Malloc(sizeof (char *) * total);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    *count = 0;
+    for (ptr = str; ptr != NULL; )
+    {
+        char *sep = strchr(ptr, '/');
+        if (sep != NULL)
+            *(sep++) = '\0';
+        if (*ptr != '\0')  /* mountpoints end with '/'. */
+            retval[(*count)++] = ptr;
+        ptr = sep;
+    } /* for */
+
+    return retval;
+} /* globSplit */
+
+static PHYSFS_EnumerateCallbackResult globDirHandle(GlobState *g,
+                                                    DirHandle *dh)
+{
+    PHYSFS_EnumerateCallbackResult retval;
+    char *mntpnt = NULL;
+    GlobNode root;
+
+    g->dh = dh;
+    g->tree = dirHandleHasDirTree(dh) ? (__PHYSFS_DirTree *) dh->opaque : NULL;
+    g->checkSymlinks = ((!allowSymLinks) && (dh->funcs->info.supportsSymlinks));
+    g->mountComps = NULL;
+    g->numMount = 0;
+    g->arcOffset = 0;
+
+    if (dh->mountPoint != NULL)
+    {
+        g->arcOffset = strlen(dh->mountPoint);
+        mntpnt = __PHYSFS_strdup(dh->mountPoint);
+        BAIL_IF(!mntpnt, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+        g->mountComps = globSplit(mntpnt, &g->numMount);
+        if (!g->mountComps)
+        {
+            allocator.Free(mntpnt);
+            return PHYSFS_ENUM_ERROR;
+        } /* if */
+    } /* if */
+
+    root.mountDepth = 0;
+    root.entry = ((g->tree) && (g->numMount == 0)) ? g->tree->root : NULL;
+    retval = globVisit(g, &root, 0);
+
+    if (mntpnt != NULL)
+    {
+        allocator.Free(g->mountComps);
+        allocator.Free(mntpnt);
+    } /* if */
+    return retval;
+} /* globDirHandle */
+
+
+int PHYSFS_enumerateGlob(const char *pattern, PHYSFS_EnumerateCallback cb,
+                         void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    GlobState g;
+    char *pat;
+    size_t i, j;
+
+    BAIL_IF(!pattern, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    pat = (char *) allocator.Malloc(strlen(pattern) + 1);
+    BAIL_IF(!pat, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (!sanitizePlatformIndependentPath(pattern, pat))
+    {
+        allocator.Free(pat);
+        return 0;
+    } /* if */
+
+    memset(&g, '\0', sizeof (g));
+    g.callback = cb;
+    g.callbackData = data;
+    g.pathAlloc = 256;
+    g.path = (char *) allocator.Malloc(g.pathAlloc);
+    g.comps = globSplit(pat, &g.numComps);
+    if ((!g.path) || (!g.comps))
+    {
+        if (g.path)
+            allocator.Free(g.path);
+        else
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+        if (g.comps)
+            allocator.Free(g.comps);
+        allocator.Free(pat);
+        return 0;
+    } /* if */
+    g.path[0] = '\0';
+
+    /* "**" twice in a row is the same as once, but a lot more work. */
+    for (i = j = 0; i < g.numComps; i++)
+    {
+        if ((j == 0) || (!globIsStarStar(g.comps[i])) ||
+            (!globIsStarStar(g.comps[j - 1])))
+            g.comps[j++] = g.comps[i];
+    } /* for */
+    g.numComps = j;
+
+    if (g.numComps > 0)
+    {
+        DirHandle *dh;
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 0, pattern, NULL, NULL,
+                           NULL, 0, 0);
+        } /* if */
+
+        grabStateLockShared();
+        for (dh = searchPath; (dh) && (retval == PHYSFS_ENUM_OK); dh = dh->next)
+            retval = globDirHandle(&g, dh);
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_ENUMERATE, 1, pattern, NULL, NULL,
+                           NULL, 0, retval != PHYSFS_ENUM_ERROR);
+        } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    nameSetFree(&g.seen);
+    allocator.Free(g.path);
+    allocator.Free(g.comps);
+    allocator.Free(pat);
+
+    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
+} /* PHYSFS_enumerateGlob */
+
+
+int PHYSFS_exists(const char *fname)
+{
+    return (getRealDirHandle(fname) != NULL);
+} /* PHYSFS_exists */
+
+
+PHYSFS_sint64 PHYSFS_getLastModTime(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), -1);
+    return statbuf.modtime;
+} /* PHYSFS_getLastModTime */
+
+
+int PHYSFS_isDirectory(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
+    return (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY);
+} /* PHYSFS_isDirectory */
+
+
+int PHYSFS_isSymbolicLink(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
+    return (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK);
+} /* PHYSFS_isSymbolicLink */
+
+
+static PHYSFS_File *doOpenWrite(const char *_fname, int appending)
+{
+    FileHandle *fh = NULL;
+    size_t len;
+    char *fname;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        PHYSFS_Io *io = NULL;
+        DirHandle *h = NULL;
+        const PHYSFS_Archiver *f;
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_OPEN, 0, _fname, NULL, NULL, NULL,
+                           0, 0);
+        } /* if */
+
+        grabStateLockShared();
+
+        GOTO_IF(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, doOpenWriteEnd);
+
+        h = writeDir;
+        GOTO_IF_ERRPASS(!verifyPath(h, &fname, 0), doOpenWriteEnd);
+
+        f = h->funcs;
+        if (appending)
+            io = f->openAppend(h->opaque, fname);
+        else
+            io = f->openWrite(h->opaque, fname);
+
+        GOTO_IF_ERRPASS(!io, doOpenWriteEnd);
+
+        fh = (FileHandle *) __PHYSFS_poolAlloc(&fileHandlePool);
+        if (fh == NULL)
+        {
+            io->destroy(io);
+            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, doOpenWriteEnd);
+        } /* if */
+        else
+        {
+            memset(fh, '\0', sizeof (FileHandle));
+            fh->io = io;
+            fh->dirHandle = h;
+            fh->stats.opens = 1;
+            __PHYSFS_platformGrabMutex(openListLock);
+            fh->next = openWriteList;
+            openWriteList = fh;
+            __PHYSFS_platformReleaseMutex(openListLock);
+        } /* else */
+
+        doOpenWriteEnd:
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_OPEN, 1, _fname,
+                           fh ? h->dirName : NULL,
+                           fh ? h->funcs->info.extension : NULL,
+                           (PHYSFS_File *) fh, 0, fh != NULL);
+        } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return ((PHYSFS_File *) fh);
+} /* doOpenWrite */
+
+
+PHYSFS_File *PHYSFS_openWrite(const char *filename)
+{
+    return doOpenWrite(filename, 0);
+} /* PHYSFS_openWrite */
+
+
+PHYSFS_File *PHYSFS_openAppend(const char *filename)
+{
+    return doOpenWrite(filename, 1);
+} /* PHYSFS_openAppend */
+
+
+/*
+ * MAKE SURE you hold the stateLock before calling this! (fname) is sanitized,
+ *  and gets scribbled on. On success, (*_h) is the search path element that
+ *  opened it, and (*_arcfname) is (fname) as that element knows it.
+ */
+static PHYSFS_Io *openReadSearch(char *fname, DirHandle **_h,
+                                 char **_arcfname)
+{
+    SearchPathCursor cursor;
+    DirHandle *i;
+
+    BAIL_IF(!searchPath, PHYSFS_ERR_NOT_FOUND, NULL);
+
+    for (i = searchPathFirst(&cursor, fname); i != NULL;
+         i = searchPathNext(&cursor, i))
+    {
+        char *arcfname = fname;
+        if (verifyPath(i, &arcfname, 0))
+        {
+            PHYSFS_Io *io = i->funcs->openRead(i->opaque, arcfname);
+            if (io)
+            {
+                *_h = i;
+                *_arcfname = arcfname;
+                return io;
+            } /* if */
+            else if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
+            {
+                STAT_ADD(&i->stats, openMisses, 1);
+            } /* else if */
+        } /* if */
+    } /* for */
+
+    STAT_ADD(&globalStats, openMisses, 1);
+    return NULL;
+} /* openReadSearch */
+
+
+/* MAKE SURE you hold the stateLock! This destroys (io) if it fails. */
+static FileHandle *openReadHandle(PHYSFS_Io *io, const DirHandle *h)
+{
+    FileHandle *fh = (FileHandle *) __PHYSFS_poolAlloc(&fileHandlePool);
+    if (fh == NULL)
+    {
+        io->destroy(io);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    memset(fh, '\0', sizeof (FileHandle));
+    fh->io = io;
+    fh->forReading = 1;
+    fh->dirHandle = h;
+    fh->stats.opens = 1;
+    __PHYSFS_platformGrabMutex(openListLock);
+    fh->next = openReadList;
+    openReadList = fh;
+    __PHYSFS_platformReleaseMutex(openListLock);
+    return fh;
+} /* openReadHandle */
+
+
+PHYSFS_File *PHYSFS_openRead(const char *_fname)
+{
+    FileHandle *fh = NULL;
+    char *fname;
+    size_t len;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        DirHandle *i = NULL;
+        char *arcfname = NULL;
+        PHYSFS_Io *io = NULL;
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_OPEN, 0, _fname, NULL, NULL, NULL,
+                           0, 0);
+        } /* if */
+
+        grabStateLockShared();
+
+        io = openReadSearch(fname, &i, &arcfname);
+        if (io != NULL)
+            fh = openReadHandle(io, i);
+
+        if (__PHYSFS_TRACING)
+        {
+            __PHYSFS_trace(PHYSFS_TRACE_OPEN, 1, _fname,
+                           fh ? i->dirName : NULL,
+                           fh ? i->funcs->info.extension : NULL,
+                           (PHYSFS_File *) fh, 0, fh != NULL);
+        } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return ((PHYSFS_File *) fh);
+} /* PHYSFS_openRead */
+
+
+PHYSFS_File *PHYSFS_mapFile(const char *fname, const void **ptr,
+                            PHYSFS_uint64 *len)
+{
+    FileHandle *fh;
+    PHYSFS_sint64 filelen;
+    int mapped = 0;
+
+    BAIL_IF(!ptr, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!len, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+
+    fh = (FileHandle *) PHYSFS_openRead(fname);
+    BAIL_IF_ERRPASS(!fh, NULL);
+
+    filelen = fh->io->length(fh->io);
+    GOTO_IF_ERRPASS(filelen < 0, mapFile_failed);
+
+    *ptr = __PHYSFS_mapIo(fh->io, 0, (PHYSFS_uint64) filelen, &mapped);
+    GOTO_IF_ERRPASS(!*ptr, mapFile_failed);
+    *len = (PHYSFS_uint64) filelen;
+
+    if (mapped)  /* PHYSFS_close() will unmap it. */
+    {
+        fh->mapping = *ptr;
+        fh->mappinglen = *len;
+    } /* if */
+
+    return ((PHYSFS_File *) fh);
+
+mapFile_failed:
+    PHYSFS_close((PHYSFS_File *) fh);
+    return NULL;
+} /* PHYSFS_mapFile */
+
+
+void PHYSFS_setMapArchives(int enable)
+{
+    mapArchives = enable;
+} /* PHYSFS_setMapArchives */
+
+
+int PHYSFS_archivesMapped(void)
+{
+    return mapArchives;
+} /* PHYSFS_archivesMapped */
+
+
+/* One file for PHYSFS_readFiles(). */
+typedef struct
+{
+    const char *fname;  /* as the app gave it to us. */
+    char *sanitized;  /* our copy of (fname), in platform-independent form. */
+    char *arcfname;  /* points into (sanitized), past (dirHandle)'s mount. */
+    DirHandle *dirHandle;  /* where we'll read it from. */
+    PHYSFS_uint32 group;  /* (dirHandle)'s place in the search path. */
+    PHYSFS_uint64 pos;  /* where the data is in the archive, if (known). */
+    int known;  /* zero if we couldn't tell where the data is. */
+    PHYSFS_uint32 order;  /* place in the app's list, to keep sorts stable. */
+} ReadFilesItem;
+
+
+static int readFilesCmp(void *_a, size_t one, size_t two)
+{
+    const ReadFilesItem *a = ((const ReadFilesItem *) _a) + one;
+    const ReadFilesItem *b = ((const ReadFilesItem *) _a) + two;
+
+    if (a->group != b->group)
+        return (a->group < b->group) ? -1 : 1;
+    else if (a->known != b->known)  /* unknown positions go first. */
+        return a->known ? 1 : -1;
+    else if ((a->known) && (a->pos != b->pos))
+        return (a->pos < b->pos) ? -1 : 1;
+    return (a->order < b->order) ? -1 : ((a->order > b->order) ? 1 : 0);
+} /* readFilesCmp */
+
+
+static void readFilesSwap(void *_a, size_t one, size_t two)
+{
+    ReadFilesItem *a = ((ReadFilesItem *) _a) + one;
+    ReadFilesItem *b = ((ReadFilesItem *) _a) + two;
+    ReadFilesItem tmp;
+    memcpy(&tmp, a, sizeof (ReadFilesItem));
+    memcpy(a, b, sizeof (ReadFilesItem));
+    memcpy(b, &tmp, sizeof (ReadFilesItem));
+} /* readFilesSwap */
+
+
+/*
+ * Does (h) have (item)'s file? Archivers we know the insides of can say
+ *  where its data is without opening it, so we can sort reads by position.
+ *  MAKE SURE you hold the stateLock before calling this!
+ */
+static int readFilesLocate(DirHandle *h, ReadFilesItem *item)
+{
+    PHYSFS_Stat statbuf;
+    int rc;
+
+    if (h->funcs->openRead == UNPK_openRead)
+        rc = UNPK_entryPos(h->opaque, item->arcfname, &item->pos);
+    #if PHYSFS_SUPPORTS_ZIP
+    else if (h->funcs->openArchive == __PHYSFS_Archiver_ZIP.openArchive)
+        rc = ZIP_entryPos(h->opaque, item->arcfname, &item->pos);
+    #endif
+    else if (!h->funcs->stat(h->opaque, item->arcfname, &statbuf))
+        rc = 0;
+    else if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+        BAIL(PHYSFS_ERR_NOT_A_FILE, 0);
+    else
+        rc = -1;
+
+    item->known = (rc > 0);
+    return (rc != 0);
+} /* readFilesLocate */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static int readFilesFind(ReadFilesItem *item)
+{
+    SearchPathCursor cursor;
+    DirHandle *i;
+    PHYSFS_uint32 group;
+    const size_t len = strlen(item->fname) + 1;
+
+    item->sanitized = (char *) allocator.Malloc(len);
+    BAIL_IF(!item->sanitized, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    BAIL_IF_ERRPASS(!sanitizePlatformIndependentPath(item->fname,
+                                                     item->sanitized), 0);
+    BAIL_IF(!searchPath, PHYSFS_ERR_NOT_FOUND, 0);
+
+    for (i = searchPathFirst(&cursor, item->sanitized); i != NULL;
+         i = searchPathNext(&cursor, i))
+    {
+        char *arcfname = item->sanitized;
+        if (verifyPath(i, &arcfname, 0))
+        {
+            item->arcfname = arcfname;
+            if (readFilesLocate(i, item))
+            {
+                DirHandle *j;
+                for (group = 0, j = searchPath; j != i; j = j->next)
+                    group++;
+                item->dirHandle = i;
+                item->group = group;
+                return 1;
+            } /* if */
+        } /* if */
+    } /* for */
+
+    return 0;  /* the last thing we tried set the error. */
+} /* readFilesFind */
+
+
+/* Count one of PHYSFS_readFiles()'s reads, like a file opened and closed. */
+static void readFilesCount(DirHandle *h, PHYSFS_Io *io, PHYSFS_uint64 len)
+{
+    PHYSFS_Stats stats;
+
+    memset(&stats, '\0', sizeof (stats));
+    #if PHYSFS_SUPPORTS_ZIP
+    ZIP_ioStats(io, &stats);
+    #endif
+
+    if (stats.rawBytesRead == 0)  /* mapped, or not ours to know. */
+        stats.rawBytesRead = len;
+    stats.opens = 1;
+    stats.bytesRead = len;
+    statsAdd(&h->stats, &stats);
+    statsAdd(&globalStats, &stats);
+} /* readFilesCount */
+
+
+int PHYSFS_readFiles(const char **fnames, PHYSFS_uint32 count,
+                     PHYSFS_ReadFilesCallback callback, void *data)
+{
+    ReadFilesItem *items = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_uint64 buflen = 0;
+    PHYSFS_uint32 i;
+    int retval = 0;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!fnames && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!callback, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (i = 0; i < count; i++)
+        BAIL_IF(!fnames[i], PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (count == 0)
+        return 1;
+
+    items = (ReadFilesItem *) allocator.Malloc(sizeof (ReadFilesItem) * count);
+    BAIL_IF(!items, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(items, '\0', sizeof (ReadFilesItem) * count);
+
+    /* the search path can't change until we're done with it. */
+    grabStateLockShared();
+
+    /* find everything before reading anything, so a typo fails fast. */
+    for (i = 0; i < count; i++)
+    {
+        items[i].fname = fnames[i];
+        items[i].order = i;
+        GOTO_IF_ERRPASS(!readFilesFind(&items[i]), readFilesEnd);
+    } /* for */
+
+    /* one pass through each archive, front to back. */
+    __PHYSFS_sort(items, (size_t) count, readFilesCmp, readFilesSwap);
+
+    for (i = 0; i < count; i++)
+    {
+        const ReadFilesItem *item = &items[i];
+        DirHandle *h = item->dirHandle;
+        PHYSFS_EnumerateCallbackResult rc;
+        const void *ptr = NULL;
+        PHYSFS_sint64 len;
+        PHYSFS_Io *io;
+
+        io = h->funcs->openRead(h->opaque, item->arcfname);
+        GOTO_IF_ERRPASS(!io, readFilesEnd);
+
+        len = io->length(io);
+        if (len < 0)
+        {
+            io->destroy(io);
+            goto readFilesEnd;
+        } /* if */
+
+        /* stored files in mapped archives (and cached ones) get no copy.
+           Nothing gets mapped just for this, though: the app expects a
+           read error, not a SIGBUS, if the file is truncated under us. */
+        ptr = __PHYSFS_mapIo(io, 0, (PHYSFS_uint64) len, NULL);
+        if (ptr == NULL)
+        {
+            PHYSFS_getLastErrorCode();  /* not in memory; not an error. */
+            if (((PHYSFS_uint64) len) > buflen)
+            {
+                void *newbuf;
+                GOTO_IF(((size_t) len) != len, PHYSFS_ERR_OUT_OF_MEMORY,
+                        readFilesReadFailed);
+                newbuf = allocator.Realloc(buf, (size_t) len);
+                GOTO_IF(!newbuf, PHYSFS_ERR_OUT_OF_MEMORY, readFilesReadFailed);
+                buf = (PHYSFS_uint8 *) newbuf;
+                buflen = (PHYSFS_uint64) len;
+            } /* if */
+
+            if (!__PHYSFS_readAll(io, buf, (size_t) len))
+            {
+                /* a short read with no error: it shrank under us. */
+                if (currentErrorCode() == PHYSFS_ERR_OK)
+                    PHYSFS_setErrorCode(PHYSFS_ERR_IO);
+                goto readFilesReadFailed;
+            } /* if */
+            ptr = buf;
+        } /* if */
+
+        rc = callback(data, item->fname, ptr, (PHYSFS_uint64) len);
+
+        readFilesCount(h, io, (PHYSFS_uint64) len);
+        io->destroy(io);
+
+        if (rc == PHYSFS_ENUM_ERROR)
+            GOTO(PHYSFS_ERR_APP_CALLBACK, readFilesEnd);
+        else if (rc == PHYSFS_ENUM_STOP)
+            break;
+        continue;
+
+    readFilesReadFailed:
+        io->destroy(io);
+        goto readFilesEnd;
+    } /* for */
+
+    retval = 1;
+
+readFilesEnd:
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    for (i = 0; i < count; i++)
+        allocator.Free(items[i].sanitized);
+    allocator.Free(items);
+    allocator.Free(buf);
+    return retval;
+} /* PHYSFS_readFiles */
+
+
+/*
+ * Async i/o.
+ *
+ * Requests go in one queue, highest priority first and in the order they
+ *  came in otherwise, and a small pool of workers (started the first time
+ *  something is queued) takes them off the front. Reads for the same
+ *  PHYSFS_File also sit in that handle's own list, oldest first, and a
+ *  worker only takes a read if it's the oldest one for its handle and no
+ *  other worker is busy with that handle, so each handle's reads finish in
+ *  the order they were asked for, callbacks included. Reads go through a
+ *  duplicate of the handle's Io, so they don't move the app's file position
+ *  and don't touch its buffer.
+ */
+typedef enum
+{
+    ASYNC_OPEN,
+    ASYNC_READ,
+    ASYNC_PREFETCH  /* PHYSFS_prefetch(): open, hint, close. No callback. */
+} AsyncJobType;
+
+typedef struct __PHYSFS_ASYNCJOB__
+{
+    AsyncJobType type;
+    PHYSFS_uint64 ticket;  /* what the app gets to cancel this with. */
+    int priority;  /* bigger goes first. */
+    FileHandle *handle;  /* ASYNC_READ: who we read for. */
+    char *fname;  /* ASYNC_OPEN, ASYNC_PREFETCH: what to open. */
+    void *buffer;  /* ASYNC_READ: where the data goes... */
+    PHYSFS_uint64 len;  /* ...how much of it... */
+    PHYSFS_uint64 offset;  /* ...and from where in the file. */
+    PHYSFS_AsyncCallback callback;
+    void *callbackData;
+    void *worker;  /* thread id of whoever is running us. */
+    struct __PHYSFS_ASYNCJOB__ *next;  /* the queue, in running order. */
+    struct __PHYSFS_ASYNCJOB__ *nextInHandle;  /* (handle)'s reads. */
+} AsyncJob;
+
+/* everything here is protected by asyncLock. */
+static AsyncJob *asyncQueue = NULL;
+static PHYSFS_uint64 asyncNextTicket = 1;
+static void *asyncWork = NULL;  /* semaphore: posted once per queued job. */
+static void **asyncWorkers = NULL;
+static int asyncNumWorkers = 0;
+static int asyncStopping = 0;  /* workers quit once the queue is empty. */
+
+
+static void asyncFinish(AsyncJob *job, PHYSFS_File *file,
+                        const PHYSFS_sint64 result,
+                        const PHYSFS_ErrorCode error)
+{
+    PHYSFS_AsyncResult res;
+    if (job->callback == NULL)
+        return;  /* PHYSFS_prefetch() doesn't care how it went. */
+    res.ticket = job->ticket;
+    res.file = file;
+    res.buffer = job->buffer;
+    res.result = result;
+    res.error = error;
+    job->callback(job->callbackData, &res);
+} /* asyncFinish */
+
+
+static void asyncFreeJob(AsyncJob *job)
+{
+    allocator.Free(job->fname);
+    allocator.Free(job);
+} /* asyncFreeJob */
+
+
+/* Tell the apps about jobs we pulled out of the queue, outside asyncLock. */
+static void asyncCancelList(AsyncJob *list)
+{
+    AsyncJob *next;
+    for (; list != NULL; list = next)
+    {
+        next = list->next;
+        asyncFinish(list, (PHYSFS_File *) list->handle, -1,
+                    PHYSFS_ERR_CANCELLED);
+        asyncFreeJob(list);
+    } /* for */
+} /* asyncCancelList */
+
+
+/* MAKE SURE you hold asyncLock before calling this! */
+static void asyncUnqueue(AsyncJob *job)
+{
+    AsyncJob **ptr;
+
+    for (ptr = &asyncQueue; *ptr != job; ptr = &(*ptr)->next)
+        assert(*ptr != NULL);
+    *ptr = job->next;
+
+    if (job->type == ASYNC_READ)
+    {
+        for (ptr = &job->handle->asyncJobs; *ptr != job;
+             ptr = &(*ptr)->nextInHandle)
+            assert(*ptr != NULL);
+        *ptr = job->nextInHandle;
+    } /* if */
+
+    job->next = job->nextInHandle = NULL;
+} /* asyncUnqueue */
+
+
+/* MAKE SURE you hold asyncLock before calling this! */
+static AsyncJob *asyncPickJob(void)
+{
+    AsyncJob *i;
+    for (i = asyncQueue; i != NULL; i = i->next)
+    {
+        if (i->type != ASYNC_READ)
+            break;
+        else if ((!i->handle->asyncRunning) && (i->handle->asyncJobs == i))
+            break;
+    } /* for */
+
+    if (i != NULL)
+    {
+        asyncUnqueue(i);
+        i->worker = __PHYSFS_platformGetThreadID();
+        if (i->type == ASYNC_READ)
+            i->handle->asyncRunning = i;
+    } /* if */
+
+    return i;
+} /* asyncPickJob */
+
+
+static void asyncRunJob(AsyncJob *job)
+{
+    if (job->type == ASYNC_OPEN)
+    {
+        PHYSFS_File *file = PHYSFS_openRead(job->fname);
+        const PHYSFS_ErrorCode err = file ? PHYSFS_ERR_OK : currentErrorCode();
+        PHYSFS_getLastErrorCode();  /* don't leave it in the worker's state. */
+        asyncFinish(job, file, file ? 0 : -1, err);
+    } /* if */
+
+    else if (job->type == ASYNC_PREFETCH)
+    {
+        /* opening is enough to fill the decompressed-asset cache, if it
+           wants this file; otherwise, get the OS reading the raw bytes. */
+        PHYSFS_File *file = PHYSFS_openRead(job->fname);
+        if (file != NULL)
+        {
+            const PHYSFS_sint64 len = PHYSFS_fileLength(file);
+            if (len > 0)
+                PHYSFS_prefetchRange(file, 0, (PHYSFS_uint64) len);
+            PHYSFS_close(file);
+        } /* if */
+        PHYSFS_getLastErrorCode();  /* it's just a hint; drop any error. */
+    } /* else if */
+
+    else
+    {
+        PHYSFS_Io *io = job->handle->asyncIo;
+        PHYSFS_uint8 *buf = (PHYSFS_uint8 *) job->buffer;
+        PHYSFS_uint64 remain = job->len;
+        PHYSFS_sint64 retval = 0;
+        PHYSFS_ErrorCode err = PHYSFS_ERR_OK;
+
+        if (!io->seek(io, job->offset))
+            retval = -1;
+
+        /* like PHYSFS_readBytes(): short reads are only for end-of-file. */
+        while ((retval >= 0) && (remain > 0))
+        {
+            const PHYSFS_sint64 rc = io->read(io, buf, remain);
+            if (rc <= 0)
+            {
+                if ((rc < 0) && (retval == 0))
+                    retval = -1;
+                break;
+            } /* if */
+            buf += rc;
+            remain -= (PHYSFS_uint64) rc;
+            retval += rc;
+        } /* while */
+
+        if (retval > 0)
+        {
+            STAT_ADD(&job->handle->stats, bytesRead, retval);
+            STAT_ADD(&job->handle->stats, rawBytesRead, retval);
+        } /* if */
+
+        if (retval < 0)
+        {
+            err = PHYSFS_getLastErrorCode();
+            if (err == PHYSFS_ERR_OK)
+                err = PHYSFS_ERR_IO;
+        } /* if */
+
+        asyncFinish(job, (PHYSFS_File *) job->handle, retval, err);
+    } /* else */
+} /* asyncRunJob */
+
+
+static void asyncWorker(void *data)
+{
+    void *work = data;  /* the pool's semaphore; asyncWork might change. */
+
+    while (__PHYSFS_platformWaitSemaphore(work))
+    {
+        AsyncJob *job;
+
+        __PHYSFS_platformGrabMutex(asyncLock);
+        if ((asyncStopping) && (asyncQueue == NULL))
+        {
+            __PHYSFS_platformReleaseMutex(asyncLock);
+            __PHYSFS_platformPostSemaphore(work);  /* wake the next one. */
+            break;
+        } /* if */
+
+        /* nothing we can run yet means it's in line behind a busy handle;
+           we'll get another post when that handle's read finishes. */
+        job = asyncPickJob();
+        __PHYSFS_platformReleaseMutex(asyncLock);
+
+        if (job == NULL)
+            continue;
+
+        asyncRunJob(job);
+
+        __PHYSFS_platformGrabMutex(asyncLock);
+        if ((job->type == ASYNC_READ) && (job->handle != NULL))
+        {
+            FileHandle *fh = job->handle;  /* NULL if closed from callback. */
+            fh->asyncRunning = NULL;
+            if (fh->asyncIdle != NULL)
+                __PHYSFS_platformPostSemaphore(fh->asyncIdle);
+            if (fh->asyncJobs != NULL)
+                __PHYSFS_platformPostSemaphore(work);
+        } /* if */
+
+        /* asyncShutdown() posts just once, and that can go to a worker that
+           finds nothing but reads stuck behind this one. Keep someone awake
+           until the queue is empty and they can all quit. */
+        if (asyncStopping)
+            __PHYSFS_platformPostSemaphore(work);
+        __PHYSFS_platformReleaseMutex(asyncLock);
+
+        asyncFreeJob(job);
+    } /* while */
+} /* asyncWorker */
+
+
+/* MAKE SURE you hold asyncLock before calling this! */
+static int asyncStartPool(void)
+{
+    int i;
+
+    if (asyncNumWorkers > 0)
+        return 1;
+
+    /* asyncShutdown() is still draining the old pool. */
+    BAIL_IF(asyncStopping, PHYSFS_ERR_BUSY, 0);
+
+    asyncWork = __PHYSFS_platformCreateSemaphore(0);
+    BAIL_IF_ERRPASS(!asyncWork, 0);
+
+    asyncWorkers = (void **) allocator.Malloc(sizeof (void *) * asyncThreads);
+    GOTO_IF(!asyncWorkers, PHYSFS_ERR_OUT_OF_MEMORY, startPoolFailed);
+
+    for (i = 0; i < asyncThreads; i++)
+    {
+        void *t = __PHYSFS_platformCreateThread(asyncWorker, asyncWork);
+        if (t == NULL)
+            break;
+        asyncWorkers[asyncNumWorkers++] = t;
+    } /* for */
+
+    GOTO_IF_ERRPASS(asyncNumWorkers == 0, startPoolFailed);
+    return 1;
+
+startPoolFailed:
+    allocator.Free(asyncWorkers);
+    asyncWorkers = NULL;
+    __PHYSFS_platformDestroySemaphore(asyncWork);
+    asyncWork = NULL;
+    return 0;
+} /* asyncStartPool */
+
+
+/*
+ * Stop the worker pool, after running everything that's queued, unless
+ *  (cancel), in which case queued requests are cancelled instead. Requests
+ *  that are already running always finish. Don't hold any locks!
+ */
+static void asyncShutdown(const int cancel)
+{
+    AsyncJob *cancelled = NULL;
+    void **workers;
+    void *work;
+    int count;
+    int i;
+
+    if (asyncLock == NULL)
+        return;  /* PHYSFS_init() failed before we got this far. */
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    if (cancel)
+    {
+        while (asyncQueue != NULL)
+        {
+            AsyncJob *job = asyncQueue;
+            asyncUnqueue(job);
+            job->next = cancelled;
+            cancelled = job;
+        } /* while */
+    } /* if */
+
+    workers = asyncWorkers;
+    count = asyncNumWorkers;
+    work = asyncWork;
+    asyncWorkers = NULL;
+    asyncNumWorkers = 0;
+    asyncWork = NULL;
+    asyncStopping++;  /* more than one of us can be draining. */
+    if (work != NULL)
+        __PHYSFS_platformPostSemaphore(work);
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    for (i = 0; i < count; i++)
+        __PHYSFS_platformWaitThread(workers[i]);
+    allocator.Free(workers);
+    if (work != NULL)
+        __PHYSFS_platformDestroySemaphore(work);
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    asyncStopping--;
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    asyncCancelList(cancelled);  /* (cancelled) is newest first; fine. */
+} /* asyncShutdown */
+
+
+/* Cancel (fh)'s queued reads and wait out its running one. No locks held! */
+static void asyncForgetHandle(FileHandle *fh)
+{
+    AsyncJob *cancelled = NULL;
+    AsyncJob **tail = &cancelled;
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    while (fh->asyncJobs != NULL)
+    {
+        AsyncJob *job = fh->asyncJobs;
+        asyncUnqueue(job);
+        *tail = job;  /* keep them oldest first. */
+        tail = &job->next;
+    } /* while */
+
+    while (fh->asyncRunning != NULL)
+    {
+        AsyncJob *running = fh->asyncRunning;
+        void *idle;
+
+        /* closing from the running read's own callback? It's done reading,
+           so just make sure the worker doesn't touch (fh) afterwards. */
+        if (running->worker == __PHYSFS_platformGetThreadID())
+        {
+            running->handle = NULL;
+            fh->asyncRunning = NULL;
+            break;
+        } /* if */
+
+        /* PHYSFS_readAsync() made this before it queued anything, so
+           there's nothing here that can fail. */
+        idle = fh->asyncIdle;
+        assert(idle != NULL);
+        __PHYSFS_platformReleaseMutex(asyncLock);
+        __PHYSFS_platformWaitSemaphore(idle);
+        __PHYSFS_platformGrabMutex(asyncLock);
+    } /* while */
+
+    if (fh->asyncIdle != NULL)
+    {
+        __PHYSFS_platformDestroySemaphore(fh->asyncIdle);
+        fh->asyncIdle = NULL;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    asyncCancelList(cancelled);
+} /* asyncForgetHandle */
+
+
+/* Queue (job) and give it a ticket. Eats (job) on failure. */
+static PHYSFS_uint64 asyncSubmit(AsyncJob *job)
+{
+    PHYSFS_uint64 retval;
+    AsyncJob **ptr;
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    if (!asyncStartPool())
+    {
+        __PHYSFS_platformReleaseMutex(asyncLock);
+        asyncFreeJob(job);
+        return 0;
+    } /* if */
+
+    retval = job->ticket = asyncNextTicket++;
+
+    for (ptr = &asyncQueue; *ptr != NULL; ptr = &(*ptr)->next)
+    {
+        if ((*ptr)->priority < job->priority)
+            break;
+    } /* for */
+    job->next = *ptr;
+    *ptr = job;
+
+    if (job->type == ASYNC_READ)
+    {
+        for (ptr = &job->handle->asyncJobs; *ptr; ptr = &(*ptr)->nextInHandle)
+            /* spin */ ;
+        *ptr = job;
+    } /* if */
+
+    __PHYSFS_platformPostSemaphore(asyncWork);
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    return retval;
+} /* asyncSubmit */
+
+
+int PHYSFS_setAsyncThreads(int threads)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(threads < 0, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    /* let what's queued finish; the pool restarts on the next request. */
+    asyncShutdown(0);
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    asyncThreads = threads ? threads : ASYNC_DEFAULT_THREADS;
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    return 1;
+} /* PHYSFS_setAsyncThreads */
+
+
+PHYSFS_uint64 PHYSFS_readAsync(PHYSFS_File *handle, void *buffer,
+                               PHYSFS_uint64 len, PHYSFS_uint64 offset,
+                               int priority, PHYSFS_AsyncCallback callback,
+                               void *data)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    AsyncJob *job;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!callback, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!buffer && len, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len),PHYSFS_ERR_INVALID_ARGUMENT,0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+
+    /* the handle's own Io belongs to PHYSFS_readBytes(), so get our own,
+       and the semaphore PHYSFS_close() waits on, while we can still fail.
+       Shared state lock: archivers read their mount's info to duplicate. */
+    grabStateLockShared();
+    __PHYSFS_platformGrabMutex(asyncLock);
+    if (fh->asyncIdle == NULL)
+        fh->asyncIdle = __PHYSFS_platformCreateSemaphore(0);
+    if ((fh->asyncIdle != NULL) && (fh->asyncIo == NULL))
+        fh->asyncIo = fh->io->duplicate(fh->io);
+    __PHYSFS_platformReleaseMutex(asyncLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    BAIL_IF_ERRPASS(!fh->asyncIdle || !fh->asyncIo, 0);
+
+    job = (AsyncJob *) allocator.Malloc(sizeof (AsyncJob));
+    BAIL_IF(!job, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(job, '\0', sizeof (AsyncJob));
+    job->type = ASYNC_READ;
+    job->priority = priority;
+    job->handle = fh;
+    job->buffer = buffer;
+    job->len = len;
+    job->offset = offset;
+    job->callback = callback;
+    job->callbackData = data;
+    return asyncSubmit(job);
+} /* PHYSFS_readAsync */
+
+
+static AsyncJob *asyncCreateNamedJob(const AsyncJobType type,
+                                     const char *fname)
+{
+    const size_t len = strlen(fname) + 1;
+    AsyncJob *job = (AsyncJob *) allocator.Malloc(sizeof (AsyncJob));
+    BAIL_IF(!job, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(job, '\0', sizeof (AsyncJob));
+
+    job->fname = (char *) allocator.Malloc(len);
+    if (!job->fname)
+    {
+        allocator.Free(job);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+    memcpy(job->fname, fname, len);
+
+    job->type = type;
+    return job;
+} /* asyncCreateNamedJob */
+
+
+PHYSFS_uint64 PHYSFS_openReadAsync(const char *fname, int priority,
+                                   PHYSFS_AsyncCallback callback, void *data)
+{
+    AsyncJob *job;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!callback, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    job = asyncCreateNamedJob(ASYNC_OPEN, fname);
+    BAIL_IF_ERRPASS(!job, 0);
+    job->priority = priority;
+    job->callback = callback;
+    job->callbackData = data;
+    return asyncSubmit(job);
+} /* PHYSFS_openReadAsync */
+
+
+int PHYSFS_prefetch(const char *fname)
+{
+    AsyncJob *job;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    job = asyncCreateNamedJob(ASYNC_PREFETCH, fname);
+    BAIL_IF_ERRPASS(!job, 0);
+    job->priority = -0x7FFFFFFF - 1;  /* behind everything anyone waits on. */
+    return (asyncSubmit(job) != 0);
+} /* PHYSFS_prefetch */
+
+
+int PHYSFS_prefetchRange(PHYSFS_File *handle, PHYSFS_uint64 offset,
+                         PHYSFS_uint64 len)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_sint64 filelen;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+
+    filelen = fh->io->length(fh->io);
+    BAIL_IF_ERRPASS(filelen < 0, 0);
+    if (offset >= (PHYSFS_uint64) filelen)
+        return 1;  /* nothing out there to fetch. */
+    else if (len > ((PHYSFS_uint64) filelen) - offset)
+        len = ((PHYSFS_uint64) filelen) - offset;
+
+    return __PHYSFS_prefetchIo(fh->io, offset, len);
+} /* PHYSFS_prefetchRange */
+
+
+int PHYSFS_cancelAsync(PHYSFS_uint64 ticket)
+{
+    AsyncJob *job;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    for (job = asyncQueue; job != NULL; job = job->next)
+    {
+        if (job->ticket == ticket)
+            break;
+    } /* for */
+
+    if (job != NULL)
+        asyncUnqueue(job);
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    /* already running, already done, or never was. */
+    BAIL_IF(!job, PHYSFS_ERR_NOT_FOUND, 0);
+
+    asyncCancelList(job);
+    return 1;
+} /* PHYSFS_cancelAsync */
+
+
+/*
+ * Change notification.
+ *
+ * While anything is PHYSFS_watch()ed, each native directory in the search
+ *  path (and the write dir) has a platform watch on it, and we ask that to
+ *  keep an eye on the directory each watched file lives in, too, for
+ *  platforms that don't watch whole trees. The platform calls
+ *  watchChanged() from its own thread; we turn what it says back into a
+ *  path in the virtual tree and queue it for the dispatcher thread,
+ *  which looks every watched file that could be affected up again, and
+ *  calls the app if the answer changed: a different search path element
+ *  wins, or the winning file (or the write dir's copy) is new, gone or
+ *  touched. Mounting and unmounting queue the same work for what they
+ *  might hide or uncover.
+ *
+ * The watch list, and each Watch's state, only change with stateLock held
+ *  exclusively, or by the dispatcher while it holds stateLock at all, so
+ *  nobody else needs a lock to look at them. watchLock protects the event
+ *  queue and the (removed) flags, and is the only thing the platform's
+ *  threads ever grab. The dispatcher holds watchCallbackLock while it calls
+ *  the app, so PHYSFS_unwatch() can wait for it to be done with a Watch.
+ */
+#ifdef PHYSFS_NO_PLATFORM_WATCH
+/* no backend: native directories can't be watched, but mounts still are. */
+#define __PHYSFS_platformCreateWatch(dir, fn, data) \
+    ((void) (fn), watchUnsupported())
+#define __PHYSFS_platformWatchDir(watch, dir) (1)
+#define __PHYSFS_platformDestroyWatch(watch)
+
+static void *watchUnsupported(void)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* watchUnsupported */
+#endif
 
-        *end = '/';
-        start = end + 1;
-    } /* while */
+typedef struct
+{
+    DirHandle *dirHandle;  /* search path element that has it, or NULL. */
+    PHYSFS_FileType filetype;
+    PHYSFS_sint64 filesize;
+    PHYSFS_sint64 modtime;
+    int inWriteDir;  /* the write dir has it, mounted or not. */
+    PHYSFS_sint64 writesize;
+    PHYSFS_sint64 writemodtime;
+} WatchState;
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    return retval;
-} /* doMkdir */
+typedef struct __PHYSFS_WATCH__
+{
+    char *fname;  /* sanitized, so it compares with paths in the tree. */
+    PHYSFS_WatchCallback callback;
+    void *data;
+    WatchState state;  /* what it looked like the last time we checked. */
+    int dirty;  /* something it depends on might have changed. */
+    int touched;  /* ...and that something was the file it resolves to. */
+    int removed;  /* PHYSFS_unwatch()ed; don't call it anymore. */
+    struct __PHYSFS_WATCH__ *next;
+    struct __PHYSFS_WATCH__ *nextFire;  /* dispatcher's list to call. */
+} Watch;
+
+typedef struct __PHYSFS_WATCHEVENT__
+{
+    DirHandle *dirHandle;  /* where it happened. */
+    char *path;  /* in the virtual tree; NULL if anything might have. */
+    struct __PHYSFS_WATCHEVENT__ *next;
+} WatchEvent;
+
+static Watch *watchList = NULL;
+static void *watchThread = NULL;  /* the dispatcher, once it's started. */
+
+/* everything here is protected by watchLock. */
+static WatchEvent *watchEvents = NULL;  /* oldest first. */
+static WatchEvent **watchEventsTail = &watchEvents;
+static int watchLostEvents = 0;  /* couldn't queue one; check everything. */
+static int watchPosted = 0;  /* dispatcher has a wakeup coming already. */
+static int watchStopping = 0;
+static void *watchWork = NULL;  /* semaphore: there's something to do. */
+static void *watchThreadID = NULL;
+static Watch *watchGraveyard = NULL;  /* unwatched from a callback. */
+
+
+/* MAKE SURE you hold watchLock before calling this! */
+static void watchWake(void)
+{
+    if ((watchWork != NULL) && (!watchPosted))
+    {
+        watchPosted = 1;
+        __PHYSFS_platformPostSemaphore(watchWork);
+    } /* if */
+} /* watchWake */
 
 
-int PHYSFS_mkdir(const char *_dname)
+/* Where (fname) is inside (h), or NULL if it's not under (h)'s mountpoint. */
+static const char *watchArcPath(const DirHandle *h, const char *fname)
 {
-    int retval = 0;
-    char *dname;
     size_t len;
 
-    BAIL_IF(!_dname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_dname) + 1;
-    dname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF(!dname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
-    retval = doMkdir(_dname, dname);
-    __PHYSFS_smallFree(dname);
-    return retval;
-} /* PHYSFS_mkdir */
+    if (h->mountPoint == NULL)
+        return fname;
 
+    len = strlen(h->mountPoint) - 1;  /* without its trailing '/'. */
+    if (strncmp(fname, h->mountPoint, len) != 0)
+        return NULL;
+    else if (fname[len] == '\0')
+        return fname + len;
+    else if (fname[len] != '/')
+        return NULL;
+    return fname + len + 1;
+} /* watchArcPath */
 
-static int doDelete(const char *_fname, char *fname)
-{
-    int retval;
-    DirHandle *h;
-    BAIL_IF_ERRPASS(!sanitizePlatformIndependentPath(_fname, fname), 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+/* Could (h) being mounted or not change what (fname) finds? */
+static int watchConcerns(DirHandle *h, char *fname)
+{
+    return ((watchArcPath(h, fname) != NULL) || (partOfMountPoint(h, fname)));
+} /* watchConcerns */
 
-    BAIL_IF_MUTEX(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
-    h = writeDir;
-    BAIL_IF_MUTEX_ERRPASS(!verifyPath(h, &fname, 0), stateLock, 0);
-    retval = h->funcs->remove(h->opaque, fname);
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    return retval;
-} /* doDelete */
+/* Is a change to (path) a change to (fname)? */
+static int watchCovers(const char *path, const char *fname)
+{
+    const size_t len = strlen(path);
+    if (len == 0)
+        return 1;  /* the root changed, so everything might have. */
+    else if (strncmp(fname, path, len) != 0)
+        return 0;
+    return ((fname[len] == '\0') || (fname[len] == '/'));
+} /* watchCovers */
 
 
-int PHYSFS_delete(const char *_fname)
+/*
+ * Turn (native), something the platform says changed under (h), into where
+ *  that is in the virtual tree, in (buf). Returns zero if it's not
+ *  somewhere we know how to map (FSEvents likes to resolve symlinks in
+ *  paths, so a mismatch isn't unusual). (buf) needs to have strlen(native)
+ *  plus strlen(h->mountPoint) plus one chars available.
+ */
+static int watchVirtualPath(const DirHandle *h, const char *native, char *buf)
 {
-    int retval;
-    char *fname;
-    size_t len;
+    const char dirsep = __PHYSFS_platformDirSeparator;
+    const char *base = h->dirName;
+    size_t baselen = strlen(base);
+    char *ptr;
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
-    retval = doDelete(_fname, fname);
-    __PHYSFS_smallFree(fname);
-    return retval;
-} /* PHYSFS_delete */
+    if ((baselen > 0) && (base[baselen - 1] == dirsep))
+        baselen--;
+    if (strncmp(native, base, baselen) != 0)
+        return 0;
 
+    native += baselen;
+    if ((*native != '\0') && (*native != dirsep))
+        return 0;  /* just a prefix of the name: "/a/bc" under "/a/b". */
 
-static DirHandle *getRealDirHandle(const char *_fname)
+    while (*native == dirsep)
+        native++;
+
+    strcpy(buf, h->mountPoint ? h->mountPoint : "");
+    ptr = buf + strlen(buf);
+    for ( ; *native; native++)
+        *(ptr++) = (*native == dirsep) ? '/' : *native;
+    while ((ptr > buf) && (ptr[-1] == '/'))
+        ptr--;
+    *ptr = '\0';
+    return 1;
+} /* watchVirtualPath */
+
+
+/* Called on the platform's threads! This must only grab watchLock. */
+static void watchChanged(void *data, const char *path)
 {
-    DirHandle *retval = NULL;
-    char *fname = NULL;
-    size_t len;
+    DirHandle *h = (DirHandle *) data;
+    WatchEvent *event = NULL;
+    size_t len = 0;
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
-    len = strlen(_fname) + 1;
-    fname = __PHYSFS_smallAlloc(len);
-    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    /* case-insensitive matches are too hard to do here; check everything. */
+    if ((path != NULL) && (!h->ignoreCase))
+        len = strlen(path) + (h->mountPoint ? strlen(h->mountPoint) : 0) + 1;
+
+    event = (WatchEvent *) allocator.Malloc(sizeof (WatchEvent) + len);
+    if (event != NULL)
     {
-        DirHandle *i;
-        __PHYSFS_platformGrabMutex(stateLock);
-        for (i = searchPath; i != NULL; i = i->next)
+        event->dirHandle = h;
+        event->path = NULL;
+        event->next = NULL;
+        if (len > 0)
         {
-            char *arcfname = fname;
-            if (partOfMountPoint(i, arcfname))
-            {
-                retval = i;
-                break;
-            } /* if */
-            else if (verifyPath(i, &arcfname, 0))
-            {
-                PHYSFS_Stat statbuf;
-                if (i->funcs->stat(i->opaque, arcfname, &statbuf))
-                {
-                    retval = i;
-                    break;
-                } /* if */
-            } /* if */
-        } /* for */
-        __PHYSFS_platformReleaseMutex(stateLock);
+            char *buf = (char *) (event + 1);
+            if (watchVirtualPath(h, path, buf))
+                event->path = buf;
+        } /* if */
     } /* if */
 
-    __PHYSFS_smallFree(fname);
-    return retval;
-} /* getRealDirHandle */
-
-const char *PHYSFS_getRealDir(const char *fname)
-{
-    DirHandle *dh = getRealDirHandle(fname);
-    return dh ? dh->dirName : NULL;
-} /* PHYSFS_getRealDir */
+    __PHYSFS_platformGrabMutex(watchLock);
+    if (event == NULL)
+        watchLostEvents = 1;
+    else
+    {
+        *watchEventsTail = event;
+        watchEventsTail = &event->next;
+    } /* else */
+    watchWake();
+    __PHYSFS_platformReleaseMutex(watchLock);
+} /* watchChanged */
 
 
-static int locateInStringList(const char *str,
-                              char **list,
-                              PHYSFS_uint32 *pos)
+/* Drop queued events for (h), or for everything if (h) is NULL. */
+static void watchPurgeEvents(const DirHandle *h)
 {
-    PHYSFS_uint32 len = *pos;
-    PHYSFS_uint32 half_len;
-    PHYSFS_uint32 lo = 0;
-    PHYSFS_uint32 middle;
-    int cmp;
+    WatchEvent *purged = NULL;
+    WatchEvent **ptr;
 
-    while (len > 0)
+    __PHYSFS_platformGrabMutex(watchLock);
+    ptr = &watchEvents;
+    while (*ptr != NULL)
     {
-        half_len = len >> 1;
-        middle = lo + half_len;
-        cmp = strcmp(list[middle], str);
-
-        if (cmp == 0)  /* it's in the list already. */
-            return 1;
-        else if (cmp > 0)
-            len = half_len;
+        WatchEvent *event = *ptr;
+        if ((h == NULL) || (event->dirHandle == h))
+        {
+            *ptr = event->next;
+            event->next = purged;
+            purged = event;
+        } /* if */
         else
         {
-            lo = middle + 1;
-            len -= half_len + 1;
+            ptr = &event->next;
         } /* else */
     } /* while */
+    watchEventsTail = ptr;
+    __PHYSFS_platformReleaseMutex(watchLock);
 
-    *pos = lo;
-    return 0;
-} /* locateInStringList */
+    while (purged != NULL)
+    {
+        WatchEvent *next = purged->next;
+        allocator.Free(purged);
+        purged = next;
+    } /* while */
+} /* watchPurgeEvents */
 
 
-static PHYSFS_EnumerateCallbackResult enumFilesCallback(void *data,
-                                        const char *origdir, const char *str)
+/* MAKE SURE you hold stateLock exclusively before calling this! */
+static int watchDirHandle(DirHandle *h)
 {
-    PHYSFS_uint32 pos;
-    void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    if ((h == NULL) || (h->watch != NULL))
+        return 1;
+    else if (h->funcs != &__PHYSFS_Archiver_DIR)
+        return 1;  /* archives don't change under us. */
 
-    /*
-     * See if file is in the list already, and if not, insert it in there
-     *  alphabetically...
-     */
-    pos = pecd->size;
-    if (locateInStringList(str, pecd->list, &pos))
-        return PHYSFS_ENUM_OK;  /* already in the list, but keep going. */
+    h->watch = __PHYSFS_platformCreateWatch(h->dirName, watchChanged, h);
+    return (h->watch != NULL);
+} /* watchDirHandle */
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
 
-    if ((ptr == NULL) || (newstr == NULL))
+/* MAKE SURE you hold stateLock exclusively before calling this! No others! */
+static void watchUnwatchDirHandle(DirHandle *h)
+{
+    if ((h != NULL) && (h->watch != NULL))
     {
-        if (newstr)
-            allocator.Free(newstr);
-
-        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        return PHYSFS_ENUM_ERROR;  /* better luck next time. */
+        __PHYSFS_platformDestroyWatch(h->watch);  /* no callbacks after. */
+        h->watch = NULL;
+        watchPurgeEvents(h);
     } /* if */
+} /* watchUnwatchDirHandle */
 
-    strcpy(newstr, str);
 
-    if (pos != pecd->size)
-    {
-        memmove(&pecd->list[pos+1], &pecd->list[pos],
-                 sizeof (char *) * ((pecd->size) - pos));
-    } /* if */
+/* MAKE SURE you hold stateLock exclusively before calling this! No others! */
+static void watchUnwatchAll(void)
+{
+    DirHandle *i;
+    for (i = searchPath; i != NULL; i = i->next)
+        watchUnwatchDirHandle(i);
+    watchUnwatchDirHandle(writeDir);
+} /* watchUnwatchAll */
 
-    pecd->list[pos] = newstr;
-    pecd->size++;
 
-    return PHYSFS_ENUM_OK;
-} /* enumFilesCallback */
+/*
+ * Have (h)'s watch look at the directory (fname) is in, or the closest
+ *  one on the way there that exists, so we hear about it being created.
+ *  MAKE SURE you hold stateLock before calling this!
+ */
+static int watchAddDirsIn(DirHandle *h, const char *fname)
+{
+    const char dirsep = __PHYSFS_platformDirSeparator;
+    const char *arcpath = watchArcPath(h, fname);
+    const char *base = h->dirName;
+    const size_t baselen = strlen(base);
+    char *native;
+    char *ptr;
+    int retval = 1;
 
+    if ((h->watch == NULL) || (arcpath == NULL) || (*arcpath == '\0'))
+        return 1;  /* not ours, or it's the root, which is always watched. */
 
-char **PHYSFS_enumerateFiles(const char *path)
-{
-    EnumStringListCallbackData ecd;
-    memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    if (!PHYSFS_enumerate(path, enumFilesCallback, &ecd))
-    {
-        const PHYSFS_ErrorCode errcode = currentErrorCode();
-        PHYSFS_uint32 i;
-        for (i = 0; i < ecd.size; i++)
-            allocator.Free(ecd.list[i]);
-        allocator.Free(ecd.list);
-        BAIL_IF(errcode == PHYSFS_ERR_APP_CALLBACK, ecd.errcode, NULL);
-        return NULL;
-    } /* if */
+    native = (char *) __PHYSFS_smallAlloc(baselen + strlen(arcpath) + 2);
+    BAIL_IF(!native, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    strcpy(native, base);
+    ptr = native + baselen;
+    if ((baselen > 0) && (ptr[-1] != dirsep))
+        *(ptr++) = dirsep;
+    strcpy(ptr, arcpath);
 
-    ecd.list[ecd.size] = NULL;
-    return ecd.list;
-} /* PHYSFS_enumerateFiles */
+    /* watch the directory the file really is in, whatever case it has. */
+    if (h->ignoreCase)
+        locateCorrectCase(h, ptr);
 
+    for ( ; *ptr; ptr++)
+    {
+        if (*ptr == '/')
+            *ptr = dirsep;
+    } /* for */
 
-/*
- * Broke out to seperate function so we can use stack allocation gratuitously.
- */
-static PHYSFS_EnumerateCallbackResult enumerateFromMountPoint(DirHandle *i,
-                                    const char *arcfname,
-                                    PHYSFS_EnumerateCallback callback,
-                                    const char *_fname, void *data)
-{
-    PHYSFS_EnumerateCallbackResult retval;
-    const size_t len = strlen(arcfname);
-    char *ptr = NULL;
-    char *end = NULL;
-    const size_t slen = strlen(i->mountPoint) + 1;
-    char *mountPoint = (char *) __PHYSFS_smallAlloc(slen);
+    while (1)
+    {
+        PHYSFS_Stat statbuf;
 
-    BAIL_IF(!mountPoint, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+        /* drop the last element; we want the directory it's in. */
+        while ((ptr > native + baselen) && (*ptr != dirsep))
+            ptr--;
+        if (ptr <= native + baselen)
+            break;  /* got back to the root. */
+        *ptr = '\0';
 
-    strcpy(mountPoint, i->mountPoint);
-    ptr = mountPoint + ((len) ? len + 1 : 0);
-    end = strchr(ptr, '/');
-    assert(end);  /* should always find a terminating '/'. */
-    *end = '\0';
-    retval = callback(data, _fname, ptr);
-    __PHYSFS_smallFree(mountPoint);
+        if ((__PHYSFS_platformStat(native, &statbuf, 1)) &&
+            (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY))
+        {
+            retval = __PHYSFS_platformWatchDir(h->watch, native);
+            break;
+        } /* if */
+    } /* while */
 
-    BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+    __PHYSFS_smallFree(native);
     return retval;
-} /* enumerateFromMountPoint */
+} /* watchAddDirsIn */
 
 
-typedef struct SymlinkFilterData
+/* MAKE SURE you hold stateLock before calling this! */
+static int watchAddDirs(const char *fname)
 {
-    PHYSFS_EnumerateCallback callback;
-    void *callbackData;
-    DirHandle *dirhandle;
-    const char *arcfname;
-    PHYSFS_ErrorCode errcode;
-} SymlinkFilterData;
+    int retval = 1;
+    DirHandle *i;
 
-static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
-                                    const char *origdir, const char *fname)
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (!watchAddDirsIn(i, fname))
+            retval = 0;
+    } /* for */
+
+    if ((writeDir != NULL) && (!watchAddDirsIn(writeDir, fname)))
+        retval = 0;
+
+    return retval;
+} /* watchAddDirs */
+
+
+/*
+ * Find out what (fname) resolves to right now, the way PHYSFS_stat() would,
+ *  and what the write dir has there. MAKE SURE you hold stateLock before
+ *  calling this!
+ */
+static void watchResolve(const char *fname, WatchState *state)
 {
-    SymlinkFilterData *data = (SymlinkFilterData *) _data;
-    const DirHandle *dh = data->dirhandle;
-    const char *arcfname = data->arcfname;
+    const size_t len = strlen(fname) + 1;
+    char *buf = (char *) __PHYSFS_smallAlloc(len);
     PHYSFS_Stat statbuf;
-    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
-    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
-    char *path = (char *) __PHYSFS_smallAlloc(slen);
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
-
-    if (path == NULL)
-    {
-        data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        return PHYSFS_ENUM_ERROR;
-    } /* if */
+    char *arcfname;
+    DirHandle *i;
 
-    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
+    memset(state, '\0', sizeof (*state));
+    state->filetype = PHYSFS_FILETYPE_OTHER;
+    state->filesize = state->modtime = -1;
+    state->writesize = state->writemodtime = -1;
+    if (buf == NULL)
+        return;  /* looks gone; we'll notice it's back next time. */
 
-    if (!dh->funcs->stat(dh->opaque, path, &statbuf))
+    for (i = searchPath; i != NULL; i = i->next)
     {
-        data->errcode = currentErrorCode();
-        retval = PHYSFS_ENUM_ERROR;
-    } /* if */
-    else
+        strcpy(buf, fname);
+        arcfname = buf;
+        if (partOfMountPoint(i, arcfname))
+        {
+            state->dirHandle = i;
+            state->filetype = PHYSFS_FILETYPE_DIRECTORY;
+            break;
+        } /* if */
+        else if ((verifyPath(i, &arcfname, 0)) &&
+                 (i->funcs->stat(i->opaque, arcfname, &statbuf)))
+        {
+            state->dirHandle = i;
+            state->filetype = statbuf.filetype;
+            state->filesize = statbuf.filesize;
+            state->modtime = statbuf.modtime;
+            break;
+        } /* else if */
+    } /* for */
+
+    if (writeDir != NULL)
     {
-        /* Pass it on to the application if it's not a symlink. */
-        if (statbuf.filetype != PHYSFS_FILETYPE_SYMLINK)
+        strcpy(buf, fname);
+        arcfname = buf;
+        if ((verifyPath(writeDir, &arcfname, 0)) &&
+            (writeDir->funcs->stat(writeDir->opaque, arcfname, &statbuf)))
         {
-            retval = data->callback(data->callbackData, origdir, fname);
-            if (retval == PHYSFS_ENUM_ERROR)
-                data->errcode = PHYSFS_ERR_APP_CALLBACK;
+            state->inWriteDir = 1;
+            state->writesize = statbuf.filesize;
+            state->writemodtime = statbuf.modtime;
         } /* if */
-    } /* else */
+    } /* if */
 
-    __PHYSFS_smallFree(path);
+    __PHYSFS_smallFree(buf);
+} /* watchResolve */
 
-    return retval;
-} /* enumCallbackFilterSymLinks */
+
+static int watchStatesMatch(const WatchState *a, const WatchState *b)
+{
+    return ( (a->dirHandle == b->dirHandle) &&
+             (a->filetype == b->filetype) &&
+             (a->filesize == b->filesize) &&
+             (a->modtime == b->modtime) &&
+             (a->inWriteDir == b->inWriteDir) &&
+             (a->writesize == b->writesize) &&
+             (a->writemodtime == b->writemodtime) );
+} /* watchStatesMatch */
+
+
+/*
+ * Could (path) changing under (h) matter to (fname)? A NULL (path) means
+ *  anything in (h) might have changed, and a NULL (h) means we lost track
+ *  of everything.
+ */
+static int watchAffects(DirHandle *h, const char *path, const char *fname)
+{
+    if (h == NULL)
+        return 1;
+    else if (path != NULL)
+        return watchCovers(path, fname);
+    return ((h == writeDir) || (watchConcerns(h, (char *) fname)));
+} /* watchAffects */
 
 
-int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
+/* Flag the Watches that a change might matter to. Hold stateLock first! */
+static void watchMark(DirHandle *h, const char *path)
 {
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
-    size_t len;
-    char *fname;
+    Watch *w;
 
-    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (w = watchList; w != NULL; w = w->next)
+    {
+        if (!watchAffects(h, path, w->fname))
+            continue;
 
-    len = strlen(_fn) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        w->dirty = 1;
+        if ((h == NULL) || (h == writeDir) || (h == w->state.dirHandle))
+            w->touched = 1;
+    } /* for */
+} /* watchMark */
 
-    if (!sanitizePlatformIndependentPath(_fn, fname))
-        retval = PHYSFS_ENUM_STOP;
-    else
-    {
-        DirHandle *i;
-        SymlinkFilterData filterdata;
 
-        __PHYSFS_platformGrabMutex(stateLock);
+static void watchDispatcher(void *data)
+{
+    void *work = data;  /* watchWork goes NULL when we're told to stop. */
+
+    __PHYSFS_platformGrabMutex(watchLock);
+    watchThreadID = __PHYSFS_platformGetThreadID();
+    __PHYSFS_platformReleaseMutex(watchLock);
 
-        if (!allowSymLinks)
+    while (__PHYSFS_platformWaitSemaphore(work))
+    {
+        WatchEvent *events;
+        Watch *fire = NULL;
+        Watch **firetail = &fire;
+        Watch *graveyard;
+        Watch *w;
+        int lost;
+
+        __PHYSFS_platformGrabMutex(watchCallbackLock);
+        grabStateLockShared();
+
+        __PHYSFS_platformGrabMutex(watchLock);
+        if (watchStopping)
         {
-            memset(&filterdata, '\0', sizeof (filterdata));
-            filterdata.callback = cb;
-            filterdata.callbackData = data;
+            __PHYSFS_platformReleaseMutex(watchLock);
+            __PHYSFS_platformReleaseRWLock(stateLock);
+            __PHYSFS_platformReleaseMutex(watchCallbackLock);
+            break;
         } /* if */
-
-        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        events = watchEvents;
+        watchEvents = NULL;
+        watchEventsTail = &watchEvents;
+        lost = watchLostEvents;
+        watchLostEvents = 0;
+        watchPosted = 0;
+        __PHYSFS_platformReleaseMutex(watchLock);
+
+        /* a DIR mount's cache might not have heard about this yet. */
+        if ((events != NULL) || (lost))
+            DIR_dirtyCaches();
+
+        if (lost)
+            watchMark(NULL, NULL);
+
+        while (events != NULL)
         {
-            char *arcfname = fname;
-
-            if (partOfMountPoint(i, arcfname))
-                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
+            WatchEvent *next = events->next;
+            watchMark(events->dirHandle, events->path);
+            allocator.Free(events);
+            events = next;
+        } /* while */
 
-            else if (verifyPath(i, &arcfname, 0))
+        for (w = watchList; w != NULL; w = w->next)
+        {
+            WatchState state;
+            if (!w->dirty)
+                continue;
+
+            /* directories on the way to it might have shown up. */
+            watchAddDirs(w->fname);
+            watchResolve(w->fname, &state);
+            if ((w->touched) || (!watchStatesMatch(&state, &w->state)))
             {
-                PHYSFS_Stat statbuf;
-                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
-                {
-                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
-                        continue;  /* no such dir in this archive, skip it. */
-                } /* if */
-
-                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
-                    continue;  /* not a directory in this archive, skip it. */
+                w->nextFire = NULL;
+                *firetail = w;
+                firetail = &w->nextFire;
+            } /* if */
 
-                else if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
-                {
-                    filterdata.dirhandle = i;
-                    filterdata.arcfname = arcfname;
-                    filterdata.errcode = PHYSFS_ERR_OK;
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 enumCallbackFilterSymLinks,
-                                                 _fn, &filterdata);
-                    if (retval == PHYSFS_ENUM_ERROR)
-                    {
-                        if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
-                            PHYSFS_setErrorCode(filterdata.errcode);
-                    } /* if */
-                } /* else if */
-                else
-                {
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 cb, _fn, data);
-                } /* else */
-            } /* else if */
+            w->state = state;
+            w->dirty = w->touched = 0;
         } /* for */
 
-        __PHYSFS_platformReleaseMutex(stateLock);
-    } /* if */
+        __PHYSFS_platformReleaseRWLock(stateLock);
 
-    __PHYSFS_smallFree(fname);
+        /* Watches can't be freed until we let go of watchCallbackLock. */
+        for (w = fire; w != NULL; w = w->nextFire)
+        {
+            int removed;
+            __PHYSFS_platformGrabMutex(watchLock);
+            removed = w->removed;
+            __PHYSFS_platformReleaseMutex(watchLock);
+            if (!removed)
+                w->callback(w->data, w->fname);
+        } /* for */
 
-    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
-} /* PHYSFS_enumerate */
+        __PHYSFS_platformGrabMutex(watchLock);
+        graveyard = watchGraveyard;
+        watchGraveyard = NULL;
+        __PHYSFS_platformReleaseMutex(watchLock);
 
+        while (graveyard != NULL)
+        {
+            Watch *next = graveyard->next;
+            allocator.Free(graveyard);
+            graveyard = next;
+        } /* while */
 
-typedef struct
-{
-    PHYSFS_EnumFilesCallback callback;
-    void *data;
-} LegacyEnumFilesCallbackData;
+        __PHYSFS_platformReleaseMutex(watchCallbackLock);
+    } /* while */
+} /* watchDispatcher */
 
-static PHYSFS_EnumerateCallbackResult enumFilesCallbackAlwaysSucceed(void *d,
-                                    const char *origdir, const char *fname)
-{
-    LegacyEnumFilesCallbackData *cbdata = (LegacyEnumFilesCallbackData *) d;
-    cbdata->callback(cbdata->data, origdir, fname);
-    return PHYSFS_ENUM_OK;
-} /* enumFilesCallbackAlwaysSucceed */
 
-void PHYSFS_enumerateFilesCallback(const char *fname,
-                                   PHYSFS_EnumFilesCallback callback,
-                                   void *data)
+/* MAKE SURE you hold stateLock exclusively before calling this! */
+static int watchStart(void)
 {
-    LegacyEnumFilesCallbackData cbdata;
-    cbdata.callback = callback;
-    cbdata.data = data;
-    (void) PHYSFS_enumerate(fname, enumFilesCallbackAlwaysSucceed, &cbdata);
-} /* PHYSFS_enumerateFilesCallback */
+    void *work;
 
+    if (watchThread != NULL)
+        return 1;
 
-int PHYSFS_exists(const char *fname)
-{
-    return (getRealDirHandle(fname) != NULL);
-} /* PHYSFS_exists */
+    work = __PHYSFS_platformCreateSemaphore(0);
+    BAIL_IF_ERRPASS(!work, 0);
 
+    __PHYSFS_platformGrabMutex(watchLock);
+    watchWork = work;
+    __PHYSFS_platformReleaseMutex(watchLock);
 
-PHYSFS_sint64 PHYSFS_getLastModTime(const char *fname)
-{
-    PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), -1);
-    return statbuf.modtime;
-} /* PHYSFS_getLastModTime */
+    watchThread = __PHYSFS_platformCreateThread(watchDispatcher, work);
+    if (watchThread == NULL)
+    {
+        __PHYSFS_platformGrabMutex(watchLock);
+        watchWork = NULL;
+        __PHYSFS_platformReleaseMutex(watchLock);
+        __PHYSFS_platformDestroySemaphore(work);
+        return 0;
+    } /* if */
+
+    return 1;
+} /* watchStart */
 
 
-int PHYSFS_isDirectory(const char *fname)
+/*
+ * Stop the dispatcher and drop every Watch. Don't hold any locks! Nothing
+ *  can be in a callback, since PHYSFS_deinit() isn't allowed from there.
+ */
+static void watchShutdown(void)
 {
-    PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
-    return (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY);
-} /* PHYSFS_isDirectory */
+    void *thread;
+    void *work;
 
+    if (watchLock == NULL)
+        return;  /* PHYSFS_init() failed before we got this far. */
 
-int PHYSFS_isSymbolicLink(const char *fname)
-{
-    PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
-    return (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK);
-} /* PHYSFS_isSymbolicLink */
+    grabStateLockExclusive();
+    while (watchList != NULL)
+    {
+        Watch *next = watchList->next;
+        allocator.Free(watchList);
+        watchList = next;
+    } /* while */
+    watchUnwatchAll();
+    thread = watchThread;
+    watchThread = NULL;
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    __PHYSFS_platformGrabMutex(watchLock);
+    work = watchWork;
+    watchWork = NULL;
+    watchStopping = 1;
+    if (work != NULL)
+        __PHYSFS_platformPostSemaphore(work);
+    __PHYSFS_platformReleaseMutex(watchLock);
+
+    if (thread != NULL)
+        __PHYSFS_platformWaitThread(thread);
+    if (work != NULL)
+        __PHYSFS_platformDestroySemaphore(work);
+
+    watchPurgeEvents(NULL);
+    watchStopping = watchLostEvents = watchPosted = 0;
+    watchThreadID = NULL;
+} /* watchShutdown */
 
 
-static PHYSFS_File *doOpenWrite(const char *_fname, int appending)
+/*
+ * (dh) just joined the search path, or became the write dir: watch it if
+ *  anyone cares, and look at what it might have changed. MAKE SURE you hold
+ *  stateLock exclusively before calling this!
+ */
+static void watchMounted(DirHandle *dh)
 {
-    FileHandle *fh = NULL;
-    size_t len;
-    char *fname;
+    Watch *w;
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (watchList == NULL)
+        return;
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    /* a directory we can't watch still gets mounted; we just won't hear
+       about what happens inside it. */
+    watchDirHandle(dh);
+
+    for (w = watchList; w != NULL; w = w->next)
     {
-        PHYSFS_Io *io = NULL;
-        DirHandle *h = NULL;
-        const PHYSFS_Archiver *f;
+        if ((dh == writeDir) || (watchConcerns(dh, w->fname)))
+            w->dirty = 1;
+    } /* for */
 
-        __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_platformGrabMutex(watchLock);
+    watchWake();
+    __PHYSFS_platformReleaseMutex(watchLock);
+} /* watchMounted */
 
-        GOTO_IF(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, doOpenWriteEnd);
 
-        h = writeDir;
-        GOTO_IF_ERRPASS(!verifyPath(h, &fname, 0), doOpenWriteEnd);
+/* (dh) is about to be freed. MAKE SURE you hold stateLock exclusively! */
+static void watchForgetDirHandle(DirHandle *dh)
+{
+    Watch *w;
 
-        f = h->funcs;
-        if (appending)
-            io = f->openAppend(h->opaque, fname);
-        else
-            io = f->openWrite(h->opaque, fname);
+    watchUnwatchDirHandle(dh);
 
-        GOTO_IF_ERRPASS(!io, doOpenWriteEnd);
+    if (watchList == NULL)
+        return;
 
-        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-        if (fh == NULL)
+    for (w = watchList; w != NULL; w = w->next)
+    {
+        if (w->state.dirHandle == dh)
         {
-            io->destroy(io);
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, doOpenWriteEnd);
+            w->state.dirHandle = NULL;  /* (dh) might get reused. */
+            w->dirty = w->touched = 1;
         } /* if */
-        else
+        else if ((dh == writeDir) || (watchConcerns(dh, w->fname)))
         {
-            memset(fh, '\0', sizeof (FileHandle));
-            fh->io = io;
-            fh->dirHandle = h;
-            fh->next = openWriteList;
-            openWriteList = fh;
-        } /* else */
-
-        doOpenWriteEnd:
-        __PHYSFS_platformReleaseMutex(stateLock);
-    } /* if */
+            w->dirty = 1;
+        } /* else if */
+    } /* for */
 
-    __PHYSFS_smallFree(fname);
-    return ((PHYSFS_File *) fh);
-} /* doOpenWrite */
+    __PHYSFS_platformGrabMutex(watchLock);
+    watchWake();
+    __PHYSFS_platformReleaseMutex(watchLock);
+} /* watchForgetDirHandle */
 
 
-PHYSFS_File *PHYSFS_openWrite(const char *filename)
+int PHYSFS_watch(const char *fname, PHYSFS_WatchCallback callback, void *data)
 {
-    return doOpenWrite(filename, 0);
-} /* PHYSFS_openWrite */
+    const size_t len = fname ? strlen(fname) + 1 : 0;
+    DirHandle *i;
+    Watch *w;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!callback, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    w = (Watch *) allocator.Malloc(sizeof (Watch) + len);
+    BAIL_IF(!w, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(w, '\0', sizeof (Watch));
+    w->fname = (char *) (w + 1);
+    w->callback = callback;
+    w->data = data;
+    if (!sanitizePlatformIndependentPath(fname, w->fname))
+    {
+        allocator.Free(w);
+        return 0;
+    } /* if */
 
+    grabStateLockExclusive();
+    GOTO_IF_ERRPASS(!watchStart(), watchFailed);
+    for (i = searchPath; i != NULL; i = i->next)
+        GOTO_IF_ERRPASS(!watchDirHandle(i), watchFailed);
+    GOTO_IF_ERRPASS(!watchDirHandle(writeDir), watchFailed);
+    GOTO_IF_ERRPASS(!watchAddDirs(w->fname), watchFailed);
 
-PHYSFS_File *PHYSFS_openAppend(const char *filename)
-{
-    return doOpenWrite(filename, 1);
-} /* PHYSFS_openAppend */
+    /* the watches go up first, so nothing slips between them and this. */
+    watchResolve(w->fname, &w->state);
+    w->next = watchList;
+    watchList = w;
 
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    return 1;
 
-PHYSFS_File *PHYSFS_openRead(const char *_fname)
+watchFailed:
+    if (watchList == NULL)
+        watchUnwatchAll();
+    __PHYSFS_platformReleaseRWLock(stateLock);
+    allocator.Free(w);
+    return 0;
+} /* PHYSFS_watch */
+
+
+int PHYSFS_unwatch(const char *_fname, PHYSFS_WatchCallback callback,
+                   void *data)
 {
-    FileHandle *fh = NULL;
+    Watch *prev = NULL;
+    Watch *w;
     char *fname;
     size_t len;
+    int fromCallback;
 
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     len = strlen(_fname) + 1;
     fname = (char *) __PHYSFS_smallAlloc(len);
     BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+    {
+        __PHYSFS_smallFree(fname);
+        return 0;
+    } /* if */
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    grabStateLockExclusive();
+    for (w = watchList; w != NULL; w = w->next)
     {
-        DirHandle *i = NULL;
-        PHYSFS_Io *io = NULL;
+        if ((w->callback == callback) && (w->data == data) &&
+            (strcmp(w->fname, fname) == 0))
+            break;
+        prev = w;
+    } /* for */
 
-        __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_smallFree(fname);
 
-        GOTO_IF(!searchPath, PHYSFS_ERR_NOT_FOUND, openReadEnd);
+    if (w == NULL)
+        BAIL_RWLOCK(PHYSFS_ERR_NOT_FOUND, stateLock, 0);
 
-        for (i = searchPath; i != NULL; i = i->next)
-        {
-            char *arcfname = fname;
-            if (verifyPath(i, &arcfname, 0))
-            {
-                io = i->funcs->openRead(i->opaque, arcfname);
-                if (io)
-                    break;
-            } /* if */
-        } /* for */
+    if (prev == NULL)
+        watchList = w->next;
+    else
+        prev->next = w->next;
 
-        GOTO_IF_ERRPASS(!io, openReadEnd);
+    /* the dispatcher might have it on its list to call; keep it alive. */
+    __PHYSFS_platformGrabMutex(watchLock);
+    w->removed = 1;
+    fromCallback = (watchThreadID == __PHYSFS_platformGetThreadID());
+    if (fromCallback)
+    {
+        w->next = watchGraveyard;
+        watchGraveyard = w;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(watchLock);
 
-        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-        if (fh == NULL)
-        {
-            io->destroy(io);
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, openReadEnd);
-        } /* if */
+    if (watchList == NULL)  /* nobody's listening; let the OS off the hook. */
+        watchUnwatchAll();
 
-        memset(fh, '\0', sizeof (FileHandle));
-        fh->io = io;
-        fh->forReading = 1;
-        fh->dirHandle = i;
-        fh->next = openReadList;
-        openReadList = fh;
+    __PHYSFS_platformReleaseRWLock(stateLock);
 
-        openReadEnd:
-        __PHYSFS_platformReleaseMutex(stateLock);
+    if (!fromCallback)
+    {
+        /* wait out a callback that's running now; it can't call us after. */
+        __PHYSFS_platformGrabMutex(watchCallbackLock);
+        __PHYSFS_platformReleaseMutex(watchCallbackLock);
+        allocator.Free(w);
     } /* if */
 
-    __PHYSFS_smallFree(fname);
-    return ((PHYSFS_File *) fh);
-} /* PHYSFS_openRead */
+    return 1;
+} /* PHYSFS_unwatch */
 
 
 static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
@@ -2688,8 +7741,24 @@ static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
                     return -1;
             } /* if */
 
+            if (handle->mapping != NULL)  /* from PHYSFS_mapFile(). */
+                __PHYSFS_platformUnmapFile(handle->mapping, handle->mappinglen);
+
+            /* keep this file's counts once it's gone. */
+            {
+                PHYSFS_Stats stats;
+                fileStats(handle, &stats);
+                statsAdd(&((DirHandle *) handle->dirHandle)->stats, &stats);
+                statsAdd(&globalStats, &stats);
+            }
+
+            if (handle->asyncIo != NULL)  /* asyncForgetHandle() ran. */
+                handle->asyncIo->destroy(handle->asyncIo);
+
             /* ...then close the underlying file. */
             io->destroy(io);
+            if (!handle->forReading)
+                DIR_dirtyCaches();  /* its size and times are final now. */
 
             if (tmp != NULL)  /* free any associated buffer. */
                 allocator.Free(tmp);
@@ -2699,7 +7768,7 @@ static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
             else
                 prev->next = handle->next;
 
-            allocator.Free(handle);
+            __PHYSFS_poolFree(&fileHandlePool, handle);
             return 1;
         } /* if */
         prev = i;
@@ -2712,25 +7781,99 @@ static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
 int PHYSFS_close(PHYSFS_File *_handle)
 {
     FileHandle *handle = (FileHandle *) _handle;
+    FileHandle *i;
     int rc;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    if (__PHYSFS_TRACING)
+        __PHYSFS_trace(PHYSFS_TRACE_CLOSE, 0, NULL, NULL, NULL, _handle, 0, 0);
+
+    /* settle any async reads first; their callbacks might need locks. */
+    __PHYSFS_platformGrabMutex(openListLock);
+    for (i = openReadList; (i != NULL) && (i != handle); i = i->next) {}
+    __PHYSFS_platformReleaseMutex(openListLock);
+    if (i != NULL)
+        asyncForgetHandle(handle);
+
+    /* shared, so the file's archiver is serialized if it has to be. */
+    grabStateLockShared();
+    __PHYSFS_platformGrabMutex(openListLock);
 
     /* -1 == close failure. 0 == not found. 1 == success. */
     rc = closeHandleInOpenList(&openReadList, handle);
-    BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
     if (!rc)
-    {
         rc = closeHandleInOpenList(&openWriteList, handle);
-        BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
+
+    __PHYSFS_platformReleaseMutex(openListLock);
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    if (__PHYSFS_TRACING)
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_CLOSE, 1, NULL, NULL, NULL, _handle, 0,
+                       rc == 1);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF_ERRPASS(rc == -1, 0);
     BAIL_IF(!rc, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     return 1;
 } /* PHYSFS_close */
 
 
+/*
+ * PHYSFS_BUFFER_ADAPTIVE keeps score: a refill after the previous fill was
+ *  used up in order votes for a bigger buffer, and a read too big for the
+ *  buffer, or a seek that throws away most of what we read ahead, votes for
+ *  a smaller one. Enough votes either way doubles or halves it.
+ */
+#define ADAPTIVE_BUFFER_MIN 1024
+#define ADAPTIVE_BUFFER_MAX (1024 * 1024)
+#define ADAPTIVE_BUFFER_VOTES 4
+
+/* Only call this while the buffer is empty; nothing in it gets moved. */
+static void adaptBufferSize(FileHandle *fh)
+{
+    const size_t request = fh->bufrequest;
+    size_t newsize = fh->bufsize;
+    PHYSFS_uint8 *newbuf;
+
+    assert(fh->bufpos == fh->buffill);
+
+    if (fh->bufscore >= ADAPTIVE_BUFFER_VOTES)
+    {
+        const size_t maxsize = (request > ADAPTIVE_BUFFER_MAX) ?
+                                request : ADAPTIVE_BUFFER_MAX;
+        if (newsize <= (maxsize / 2))
+            newsize *= 2;
+    } /* if */
+
+    else if (fh->bufscore <= -ADAPTIVE_BUFFER_VOTES)
+    {
+        const size_t minsize = (request < ADAPTIVE_BUFFER_MIN) ?
+                                request : ADAPTIVE_BUFFER_MIN;
+        if ((newsize / 2) >= minsize)
+            newsize /= 2;
+    } /* else if */
+
+    else
+    {
+        return;  /* not sure yet. */
+    } /* else */
+
+    fh->bufscore = 0;
+    if (newsize == fh->bufsize)
+        return;
+
+    /* if this fails, keep the buffer we've got; it still works. */
+    newbuf = (PHYSFS_uint8 *) allocator.Realloc(fh->buffer, newsize);
+    if (newbuf != NULL)
+    {
+        fh->buffer = newbuf;
+        fh->bufsize = newsize;
+    } /* if */
+
+    fh->buffill = fh->bufpos = 0;
+} /* adaptBufferSize */
+
+
 static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *_buffer, size_t len)
 {
     PHYSFS_uint8 *buffer = (PHYSFS_uint8 *) _buffer;
@@ -2750,13 +7893,50 @@ static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *_buffer, size_t len)
             retval += cpy;
         } /* if */
 
+        else if ((fh->bufmode != PHYSFS_BUFFER_NORMAL) && (len >= fh->bufsize))
+        {
+            /* buffer is empty, and it would just be in the way. Skip it. */
+            PHYSFS_Io *io = fh->io;
+            const PHYSFS_sint64 rc = io->read(io, buffer, len);
+            fh->buffill = fh->bufpos = 0;
+            if (fh->bufmode == PHYSFS_BUFFER_ADAPTIVE)
+            {
+                fh->bufscore--;
+                adaptBufferSize(fh);
+            } /* if */
+
+            if (rc > 0)
+            {
+                STAT_ADD(&fh->stats, rawBytesRead, rc);
+                retval += rc;
+            } /* if */
+            else if (retval == 0)  /* report already-read data, or failure. */
+            {
+                retval = rc;
+            } /* else if */
+            break;
+        } /* else if */
+
         else   /* buffer is empty, refill it. */
         {
             PHYSFS_Io *io = fh->io;
-            const PHYSFS_sint64 rc = io->read(io, fh->buffer, fh->bufsize);
+            PHYSFS_sint64 rc;
+
+            if (fh->bufmode == PHYSFS_BUFFER_ADAPTIVE)
+            {
+                if (fh->buffill == fh->bufsize)  /* used a whole fill? */
+                    fh->bufscore++;
+                adaptBufferSize(fh);
+            } /* if */
+
+            rc = io->read(io, fh->buffer, fh->bufsize);
             fh->bufpos = 0;
+            STAT_ADD(&fh->stats, bufferRefills, 1);
             if (rc > 0)
+            {
                 fh->buffill = (size_t) rc;
+                STAT_ADD(&fh->stats, rawBytesRead, rc);
+            } /* if */
             else
             {
                 fh->buffill = 0;
@@ -2785,6 +7965,8 @@ PHYSFS_sint64 PHYSFS_readBytes(PHYSFS_File *handle, void *buffer,
 {
     const size_t len = (size_t) _len;
     FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_uint64 tracepos = 0;
+    PHYSFS_sint64 retval;
 
 #ifdef PHYSFS_NO_64BIT_SUPPORT
     const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFF);
@@ -2798,10 +7980,33 @@ PHYSFS_sint64 PHYSFS_readBytes(PHYSFS_File *handle, void *buffer,
     BAIL_IF(_len > maxlen, PHYSFS_ERR_INVALID_ARGUMENT, -1);
     BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, -1);
     BAIL_IF_ERRPASS(len == 0, 0);
+
+    if (__PHYSFS_TRACING)
+    {
+        tracepos = (PHYSFS_uint64) PHYSFS_tell(handle);
+        __PHYSFS_trace(PHYSFS_TRACE_READ, 0, NULL, NULL, NULL, handle,
+                       tracepos, 0);
+    } /* if */
+
     if (fh->buffer)
-        return doBufferedRead(fh, buffer, len);
+        retval = doBufferedRead(fh, buffer, len);
+    else
+    {
+        retval = fh->io->read(fh->io, buffer, len);
+        if (retval > 0)
+            STAT_ADD(&fh->stats, rawBytesRead, retval);
+    } /* else */
 
-    return fh->io->read(fh->io, buffer, len);
+    if (retval > 0)
+        STAT_ADD(&fh->stats, bytesRead, retval);
+
+    if (__PHYSFS_TRACING)
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_READ, 1, NULL, NULL, NULL, handle,
+                       tracepos, retval);
+    } /* if */
+
+    return retval;
 } /* PHYSFS_readBytes */
 
 
@@ -2895,7 +8100,11 @@ PHYSFS_sint64 PHYSFS_tell(PHYSFS_File *handle)
 int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
 {
     FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_uint64 start;
+    int retval;
+
     BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
+    STAT_ADD(&fh->stats, seeks, 1);
 
     if (fh->buffer && fh->forReading)
     {
@@ -2912,141 +8121,598 @@ int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
         } /* if */
     } /* if */
 
-    /* we have to fall back to a 'raw' seek. */
-    fh->buffill = fh->bufpos = 0;
-    return fh->io->seek(fh->io, pos);
-} /* PHYSFS_seek */
+    /* we have to fall back to a 'raw' seek. */
+    if ((fh->buffer) && (fh->bufmode == PHYSFS_BUFFER_ADAPTIVE))
+    {
+        /* did we throw away most of what we read ahead? */
+        if ((fh->buffill - fh->bufpos) > (fh->buffill / 2))
+            fh->bufscore--;
+        fh->buffill = fh->bufpos = 0;
+        adaptBufferSize(fh);
+    } /* if */
+
+    fh->buffill = fh->bufpos = 0;
+    if (__PHYSFS_TRACING)
+        __PHYSFS_trace(PHYSFS_TRACE_SEEK, 0, NULL, NULL, NULL, handle, pos, 0);
+    start = __PHYSFS_platformNanoseconds();
+    retval = fh->io->seek(fh->io, pos);
+    STAT_ADD(&fh->stats, seekTime, __PHYSFS_platformNanoseconds() - start);
+    if (__PHYSFS_TRACING)
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_SEEK, 1, NULL, NULL, NULL, handle, pos,
+                       retval);
+    } /* if */
+    return retval;
+} /* PHYSFS_seek */
+
+
+PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle)
+{
+    PHYSFS_Io *io = ((FileHandle *) handle)->io;
+    return io->length(io);
+} /* PHYSFS_filelength */
+
+
+int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 _bufsize)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    const size_t bufsize = (size_t) _bufsize;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(_bufsize))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
+
+    /*
+     * For reads, we need to move the file pointer to where it would be
+     *  if we weren't buffering, so that the next read will get the
+     *  right chunk of stuff from the file. PHYSFS_flush() handles writes.
+     */
+    if ((fh->forReading) && (fh->buffill != fh->bufpos))
+    {
+        PHYSFS_uint64 pos;
+        const PHYSFS_sint64 curpos = fh->io->tell(fh->io);
+        BAIL_IF_ERRPASS(curpos == -1, 0);
+        pos = ((curpos - fh->buffill) + fh->bufpos);
+        BAIL_IF_ERRPASS(!fh->io->seek(fh->io, pos), 0);
+    } /* if */
+
+    if (bufsize == 0)  /* delete existing buffer. */
+    {
+        if (fh->buffer)
+        {
+            allocator.Free(fh->buffer);
+            fh->buffer = NULL;
+        } /* if */
+    } /* if */
+
+    else
+    {
+        PHYSFS_uint8 *newbuf;
+        newbuf = (PHYSFS_uint8 *) allocator.Realloc(fh->buffer, bufsize);
+        BAIL_IF(!newbuf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        fh->buffer = newbuf;
+    } /* else */
+
+    fh->bufsize = fh->bufrequest = bufsize;
+    fh->buffill = fh->bufpos = 0;
+    fh->bufscore = 0;
+    return 1;
+} /* PHYSFS_setBuffer */
+
+
+int PHYSFS_setBufferMode(PHYSFS_File *handle, PHYSFS_BufferMode mode)
+{
+    FileHandle *fh = (FileHandle *) handle;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+    BAIL_IF((mode != PHYSFS_BUFFER_NORMAL) &&
+            (mode != PHYSFS_BUFFER_DIRECT) &&
+            (mode != PHYSFS_BUFFER_ADAPTIVE), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    fh->bufmode = (PHYSFS_uint8) mode;
+    fh->bufscore = 0;
+    return 1;
+} /* PHYSFS_setBufferMode */
+
+
+int PHYSFS_buildSeekIndex(PHYSFS_File *handle)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    int rc = 1;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+
+    /* the Io ends up back where it was, so any buffered data stays good. */
+    #if PHYSFS_SUPPORTS_ZIP
+    rc = ZIP_buildSeekIndex(fh->io);
+    if (rc == -1)
+        rc = 1;  /* not a ZIP entry; its seeks are as fast as they'll get. */
+    #endif
+
+    return rc;
+} /* PHYSFS_buildSeekIndex */
+
+
+void PHYSFS_setSolidBlockCacheBudget(PHYSFS_uint64 budget)
+{
+    #if PHYSFS_SUPPORTS_7Z
+    SZIP_setBlockCacheBudget(budget);
+    #endif
+} /* PHYSFS_setSolidBlockCacheBudget */
+
+
+int PHYSFS_flush(PHYSFS_File *handle)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_Io *io;
+    PHYSFS_sint64 rc;
+
+    if ((fh->forReading) || (fh->bufpos == fh->buffill))
+        return 1;  /* open for read or buffer empty are successful no-ops. */
+
+    /* dump buffer to disk. */
+    io = fh->io;
+    rc = io->write(io, fh->buffer + fh->bufpos, fh->buffill - fh->bufpos);
+    BAIL_IF_ERRPASS(rc <= 0, 0);
+    fh->bufpos = fh->buffill = 0;
+    return 1;
+} /* PHYSFS_flush */
+
+
+static void statDefaults(PHYSFS_Stat *stat)
+{
+    stat->filesize = -1;
+    stat->modtime = -1;
+    stat->createtime = -1;
+    stat->accesstime = -1;
+    stat->filetype = PHYSFS_FILETYPE_OTHER;
+    stat->readonly = 1;
+} /* statDefaults */
+
+
+/* A mountpoint is a read-only directory, even if nothing's in it. */
+static void statMountPoint(PHYSFS_Stat *stat)
+{
+    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+    stat->readonly = 1;
+} /* statMountPoint */
+
+
+/*
+ * MAKE SURE you hold the stateLock before calling this! (fname) is sanitized,
+ *  not "", and gets scribbled on. (*_h) is set to the search path element
+ *  that answered, or NULL if none did. (*_arcfname) is (fname) as (*_h)
+ *  knows it, or NULL if (fname) is part of (*_h)'s mountpoint.
+ */
+static int statSearch(char *fname, PHYSFS_Stat *stat, DirHandle **_h,
+                      char **_arcfname)
+{
+    SearchPathCursor cursor;
+    DirHandle *i;
+    int retval = 0;
+
+    *_h = NULL;
+    *_arcfname = NULL;
+
+    for (i = searchPathFirst(&cursor, fname); i != NULL;
+         i = searchPathNext(&cursor, i))
+    {
+        char *arcfname = fname;
+        if (partOfMountPoint(i, arcfname))
+        {
+            statMountPoint(stat);
+            *_h = i;
+            return 1;
+        } /* if */
+        else if (verifyPath(i, &arcfname, 0))
+        {
+            retval = i->funcs->stat(i->opaque, arcfname, stat);
+            if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
+            {
+                *_h = i;
+                *_arcfname = arcfname;
+                return retval;
+            } /* if */
+        } /* else if */
+    } /* for */
+
+    return 0;
+} /* statSearch */
+
+
+int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
+{
+    int retval = 0;
+    char *fname;
+    size_t len;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!stat, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    /* set some sane defaults... */
+    statDefaults(stat);
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        if (*fname == '\0')
+        {
+            stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+            stat->readonly = !writeDir; /* Writeable if we have a writeDir */
+            retval = 1;
+        } /* if */
+        else
+        {
+            DirHandle *h;
+            char *arcfname;
+            grabStateLockShared();
+            retval = statSearch(fname, stat, &h, &arcfname);
+            __PHYSFS_platformReleaseRWLock(stateLock);
+        } /* else */
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return retval;
+} /* PHYSFS_stat */
+
+
+/*
+ * Interned paths; see PHYSFS_internPath().
+ *
+ * Each one keeps its sanitized path, and what PHYSFS_openReadId() and
+ *  PHYSFS_statId() found for it last time. That's only trusted while
+ *  searchPathGeneration and allowSymLinks are what they were, and only if
+ *  everything in the search path up to the winner is an archive with a
+ *  DirTree, since those can't change behind our back. Anything else is
+ *  looked up the normal way every time, minus the sanitizing.
+ *
+ * Interned paths are never freed before PHYSFS_deinit(). internLock
+ *  protects the table and every PathIdCache.
+ */
+typedef enum PathIdCacheState
+{
+    PATHID_UNRESOLVED,  /* look it up the normal way. */
+    PATHID_ENTRY,  /* (dirHandle) has it, at (entry). */
+    PATHID_MOUNTPOINT,  /* it's part of (dirHandle)'s mountpoint. */
+    PATHID_MISSING  /* nothing in the search path has it. */
+} PathIdCacheState;
+
+typedef struct PathIdCache
+{
+    PathIdCacheState state;
+    PHYSFS_uint32 generation;  /* searchPathGeneration when we resolved. */
+    int symlinks;  /* allowSymLinks when we resolved. */
+    DirHandle *dirHandle;
+    void *entry;  /* an entry in (dirHandle)'s DirTree. */
+} PathIdCache;
+
+struct PHYSFS_InternedPath
+{
+    char *path;  /* sanitized, platform-independent. */
+    size_t len;  /* strlen(path). */
+    PHYSFS_uint32 hashval;  /* __PHYSFS_hashString(path, len). */
+    PathIdCache open;  /* what PHYSFS_openReadId() found. */
+    PathIdCache stat;  /* what PHYSFS_statId() found. */
+    struct PHYSFS_InternedPath *next;  /* hash bucket chain. */
+};
+
+static struct PHYSFS_InternedPath **internTable = NULL;
+static size_t internBuckets = 0;  /* always a power of two. */
+static size_t internCount = 0;
+
+
+/* MAKE SURE you hold internLock before calling this! */
+static int internGrow(void)
+{
+    const size_t newbuckets = internBuckets ? internBuckets * 2 : 256;
+    const size_t alloclen = newbuckets * sizeof (PHYSFS_PathId);
+    PHYSFS_PathId *newtable;
+    size_t i;
+
+    newtable = (PHYSFS_PathId *) allocator.Malloc(alloclen);
+    BAIL_IF(!newtable, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(newtable, '\0', alloclen);
+
+    for (i = 0; i < internBuckets; i++)
+    {
+        PHYSFS_PathId id;
+        PHYSFS_PathId next;
+        for (id = internTable[i]; id != NULL; id = next)
+        {
+            const size_t bucket = id->hashval & (newbuckets - 1);
+            next = id->next;
+            id->next = newtable[bucket];
+            newtable[bucket] = id;
+        } /* for */
+    } /* for */
+
+    allocator.Free(internTable);
+    internTable = newtable;
+    internBuckets = newbuckets;
+    return 1;
+} /* internGrow */
+
+
+static void freeInternedPaths(void)
+{
+    size_t i;
+
+    for (i = 0; i < internBuckets; i++)
+    {
+        PHYSFS_PathId id;
+        PHYSFS_PathId next;
+        for (id = internTable[i]; id != NULL; id = next)
+        {
+            next = id->next;
+            allocator.Free(id);
+        } /* for */
+    } /* for */
+
+    allocator.Free(internTable);
+    internTable = NULL;
+    internBuckets = 0;
+    internCount = 0;
+} /* freeInternedPaths */
+
+
+PHYSFS_PathId PHYSFS_internPath(const char *_fname)
+{
+    PHYSFS_PathId retval = NULL;
+    PHYSFS_uint32 hashval;
+    char *fname;
+    size_t len;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+    {
+        __PHYSFS_smallFree(fname);
+        return NULL;
+    } /* if */
+
+    len = strlen(fname);
+    hashval = __PHYSFS_hashString(fname, len);
+
+    __PHYSFS_platformGrabMutex(internLock);
+
+    if (internBuckets != 0)
+    {
+        retval = internTable[hashval & (internBuckets - 1)];
+        for (; retval != NULL; retval = retval->next)
+        {
+            if ((retval->hashval == hashval) && (retval->len == len) &&
+                (memcmp(retval->path, fname, len) == 0))
+                break;
+        } /* for */
+    } /* if */
+
+    if (retval == NULL)
+    {
+        if (internCount >= internBuckets)
+            GOTO_IF_ERRPASS(!internGrow(), internPathEnd);
+
+        retval = (PHYSFS_PathId) allocator.Malloc(sizeof (*retval) + len + 1);
+        GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, internPathEnd);
+        memset(retval, '\0', sizeof (*retval));
+        retval->path = ((char *) retval) + sizeof (*retval);
+        memcpy(retval->path, fname, len + 1);
+        retval->len = len;
+        retval->hashval = hashval;
+        retval->next = internTable[hashval & (internBuckets - 1)];
+        internTable[hashval & (internBuckets - 1)] = retval;
+        internCount++;
+    } /* if */
+
+internPathEnd:
+    __PHYSFS_platformReleaseMutex(internLock);
+    __PHYSFS_smallFree(fname);
+    return retval;
+} /* PHYSFS_internPath */
 
 
-PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle)
+const char *PHYSFS_getPathIdString(PHYSFS_PathId id)
 {
-    PHYSFS_Io *io = ((FileHandle *) handle)->io;
-    return io->length(io);
-} /* PHYSFS_filelength */
+    BAIL_IF(!id, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    return id->path;
+} /* PHYSFS_getPathIdString */
 
 
-int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 _bufsize)
+/* MAKE SURE you hold the stateLock before calling this! */
+static void pathIdGetCache(const PathIdCache *cache, PathIdCache *out)
 {
-    FileHandle *fh = (FileHandle *) handle;
-    const size_t bufsize = (size_t) _bufsize;
+    __PHYSFS_platformGrabMutex(internLock);
+    *out = *cache;
+    __PHYSFS_platformReleaseMutex(internLock);
 
-    if (!__PHYSFS_ui64FitsAddressSpace(_bufsize))
-        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if ((out->generation != searchPathGeneration) ||
+        (out->symlinks != allowSymLinks))
+        out->state = PATHID_UNRESOLVED;
+} /* pathIdGetCache */
 
-    BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
 
-    /*
-     * For reads, we need to move the file pointer to where it would be
-     *  if we weren't buffering, so that the next read will get the
-     *  right chunk of stuff from the file. PHYSFS_flush() handles writes.
-     */
-    if ((fh->forReading) && (fh->buffill != fh->bufpos))
-    {
-        PHYSFS_uint64 pos;
-        const PHYSFS_sint64 curpos = fh->io->tell(fh->io);
-        BAIL_IF_ERRPASS(curpos == -1, 0);
-        pos = ((curpos - fh->buffill) + fh->bufpos);
-        BAIL_IF_ERRPASS(!fh->io->seek(fh->io, pos), 0);
-    } /* if */
+static __PHYSFS_DirTreeEntry *dirTreeFind(__PHYSFS_DirTree *dt,
+                                          const char *path,
+                                          const PHYSFS_uint32 hashval);
 
-    if (bufsize == 0)  /* delete existing buffer. */
+/*
+ * MAKE SURE you hold the stateLock before calling this! (h) won the search
+ *  for (path) (or is NULL if nothing had it), and (arcfname) is (path) as
+ *  (h) knows it (or NULL if (path) is part of (h)'s mountpoint). This only
+ *  remembers that if nothing up to (h) can change until the search path does.
+ */
+static void pathIdSetCache(PathIdCache *cache, const DirHandle *h,
+                           const char *arcfname)
+{
+    PathIdCache result;
+    DirHandle *i;
+
+    for (i = searchPath; i != h; i = i->next)
     {
-        if (fh->buffer)
-        {
-            allocator.Free(fh->buffer);
-            fh->buffer = NULL;
-        } /* if */
-    } /* if */
+        if (!dirHandleHasDirTree(i))
+            return;
+    } /* for */
 
+    memset(&result, '\0', sizeof (result));
+    result.generation = searchPathGeneration;
+    result.symlinks = allowSymLinks;
+    result.dirHandle = i;
+
+    if (i == NULL)
+        result.state = PATHID_MISSING;
+    else if (arcfname == NULL)
+        result.state = PATHID_MOUNTPOINT;
+    else if (!dirHandleHasDirTree(i))
+        return;
     else
     {
-        PHYSFS_uint8 *newbuf;
-        newbuf = (PHYSFS_uint8 *) allocator.Realloc(fh->buffer, bufsize);
-        BAIL_IF(!newbuf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
-        fh->buffer = newbuf;
+        /* (arcfname) has the right case now, even if (i) ignores it. */
+        __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) i->opaque;
+        if ((tree->openEntry == NULL) || (tree->statEntry == NULL))
+            return;
+        else if (*arcfname == '\0')
+            result.entry = tree->root;
+        else
+        {
+            const size_t len = strlen(arcfname);
+            const PHYSFS_uint32 hashval = __PHYSFS_hashString(arcfname, len);
+            result.entry = dirTreeFind(tree, arcfname, hashval);
+            if (result.entry == NULL)
+                return;  /* zip's "$PASSWORD" suffix, say. */
+        } /* else */
+        result.state = PATHID_ENTRY;
     } /* else */
 
-    fh->bufsize = bufsize;
-    fh->buffill = fh->bufpos = 0;
-    return 1;
-} /* PHYSFS_setBuffer */
+    __PHYSFS_platformGrabMutex(internLock);
+    *cache = result;
+    __PHYSFS_platformReleaseMutex(internLock);
+} /* pathIdSetCache */
 
 
-int PHYSFS_flush(PHYSFS_File *handle)
+PHYSFS_File *PHYSFS_openReadId(PHYSFS_PathId id)
 {
-    FileHandle *fh = (FileHandle *) handle;
-    PHYSFS_Io *io;
-    PHYSFS_sint64 rc;
+    FileHandle *fh = NULL;
+    DirHandle *i = NULL;
+    PHYSFS_Io *io = NULL;
+    PathIdCache cache;
 
-    if ((fh->forReading) || (fh->bufpos == fh->buffill))
-        return 1;  /* open for read or buffer empty are successful no-ops. */
+    BAIL_IF(!id, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
 
-    /* dump buffer to disk. */
-    io = fh->io;
-    rc = io->write(io, fh->buffer + fh->bufpos, fh->buffill - fh->bufpos);
-    BAIL_IF_ERRPASS(rc <= 0, 0);
-    fh->bufpos = fh->buffill = 0;
-    return 1;
-} /* PHYSFS_flush */
+    if (__PHYSFS_TRACING)
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_OPEN, 0, id->path, NULL, NULL, NULL,
+                       0, 0);
+    } /* if */
 
+    grabStateLockShared();
 
-int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
+    pathIdGetCache(&id->open, &cache);
+    if (cache.state == PATHID_ENTRY)
+    {
+        const __PHYSFS_DirTree *tree;
+        i = cache.dirHandle;
+        tree = (const __PHYSFS_DirTree *) i->opaque;
+        io = tree->openEntry(i->opaque, cache.entry);
+    } /* if */
+
+    /* not cached, or the cached pick failed: do it the long way. */
+    if (io == NULL)
+    {
+        char *fname = (char *) __PHYSFS_smallAlloc(id->len + 1);
+        char *arcfname = NULL;
+        GOTO_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, openReadIdEnd);
+        memcpy(fname, id->path, id->len + 1);
+        io = openReadSearch(fname, &i, &arcfname);
+        if (io != NULL)
+            pathIdSetCache(&id->open, i, arcfname);
+        __PHYSFS_smallFree(fname);
+    } /* if */
+
+    if (io != NULL)
+        fh = openReadHandle(io, i);
+
+openReadIdEnd:
+    if (__PHYSFS_TRACING)
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_OPEN, 1, id->path,
+                       fh ? i->dirName : NULL,
+                       fh ? i->funcs->info.extension : NULL,
+                       (PHYSFS_File *) fh, 0, fh != NULL);
+    } /* if */
+    __PHYSFS_platformReleaseRWLock(stateLock);
+
+    return ((PHYSFS_File *) fh);
+} /* PHYSFS_openReadId */
+
+
+int PHYSFS_statId(PHYSFS_PathId id, PHYSFS_Stat *stat)
 {
+    DirHandle *i = NULL;
+    PathIdCache cache;
     int retval = 0;
-    char *fname;
-    size_t len;
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!id, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!stat, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, 0);
 
-    /* set some sane defaults... */
-    stat->filesize = -1;
-    stat->modtime = -1;
-    stat->createtime = -1;
-    stat->accesstime = -1;
-    stat->filetype = PHYSFS_FILETYPE_OTHER;
-    stat->readonly = 1;
+    statDefaults(stat);
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    if (id->len == 0)
     {
-        if (*fname == '\0')
+        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        stat->readonly = !writeDir; /* Writeable if we have a writeDir */
+        return 1;
+    } /* if */
+
+    grabStateLockShared();
+
+    pathIdGetCache(&id->stat, &cache);
+    switch (cache.state)
+    {
+        case PATHID_ENTRY:
         {
-            stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-            stat->readonly = !writeDir; /* Writeable if we have a writeDir */
+            const __PHYSFS_DirTree *tree;
+            i = cache.dirHandle;
+            tree = (const __PHYSFS_DirTree *) i->opaque;
+            retval = tree->statEntry(i->opaque, cache.entry, stat);
+            break;
+        } /* case */
+
+        case PATHID_MOUNTPOINT:
+            statMountPoint(stat);
             retval = 1;
-        } /* if */
-        else
+            break;
+
+        case PATHID_MISSING:
+            PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+            break;
+
+        case PATHID_UNRESOLVED:
         {
-            DirHandle *i;
-            int exists = 0;
-            __PHYSFS_platformGrabMutex(stateLock);
-            for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
-            {
-                char *arcfname = fname;
-                exists = partOfMountPoint(i, arcfname);
-                if (exists)
-                {
-                    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-                    stat->readonly = 1;
-                    retval = 1;
-                } /* if */
-                else if (verifyPath(i, &arcfname, 0))
-                {
-                    retval = i->funcs->stat(i->opaque, arcfname, stat);
-                    if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
-                        exists = 1;
-                } /* else if */
-            } /* for */
-            __PHYSFS_platformReleaseMutex(stateLock);
-        } /* else */
-    } /* if */
+            char *fname = (char *) __PHYSFS_smallAlloc(id->len + 1);
+            char *arcfname = NULL;
+            GOTO_IF(!fname, PHYSFS_ERR_OUT_OF_MEMORY, statIdEnd);
+            memcpy(fname, id->path, id->len + 1);
+            retval = statSearch(fname, stat, &i, &arcfname);
+            if ((retval) || ((i == NULL) &&
+                (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)))
+                pathIdSetCache(&id->stat, i, arcfname);
+            __PHYSFS_smallFree(fname);
+            break;
+        } /* case */
+    } /* switch */
 
-    __PHYSFS_smallFree(fname);
+statIdEnd:
+    __PHYSFS_platformReleaseRWLock(stateLock);
     return retval;
-} /* PHYSFS_stat */
+} /* PHYSFS_statId */
 
 
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
@@ -3056,6 +8722,16 @@ int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
 } /* __PHYSFS_readAll */
 
 
+int __PHYSFS_readAllAt(PHYSFS_Io *io, void *buf, const size_t _len,
+                       const PHYSFS_uint64 pos)
+{
+    const PHYSFS_uint64 len = (PHYSFS_uint64) _len;
+    if (__PHYSFS_ioHasReadAt(io))
+        return (io->readAt(io, buf, len, pos) == len);
+    return ((io->seek(io, pos)) && (io->read(io, buf, len) == len));
+} /* __PHYSFS_readAllAt */
+
+
 void *__PHYSFS_initSmallAlloc(void *ptr, const size_t len)
 {
     void *useHeap = ((ptr == NULL) ? ((void *) 1) : ((void *) 0));
@@ -3142,38 +8818,150 @@ static void setDefaultAllocator(void)
 } /* setDefaultAllocator */
 
 
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen)
+/*
+ * DirTree entries and their names are carved out of an arena; archives don't
+ *  remove entries once they're open, so the arena is only freed in
+ *  __PHYSFS_DirTreeDeinit.
+ */
+#define DIRTREE_ARENA_CHUNK (64 * 1024)
+#define DIRTREE_MAX_HINTED_BUCKETS (256 * 1024)
+#define DIRTREE_MAX_HINTED_ARENA (64 * 1024 * 1024)
+
+static inline size_t dirTreeAlign(const size_t len)
+{
+    return arenaAlign(len);  /* enough for anything archivers put in entries. */
+} /* dirTreeAlign */
+
+static void *dirTreeAlloc(__PHYSFS_DirTree *dt, size_t len)
+{
+    return arenaAlloc(&dt->arena, DIRTREE_ARENA_CHUNK, len);
+} /* dirTreeAlloc */
+
+
+/* (entrycount) is how many entries the archiver expects, or zero.
+   (namebytes) is about how long their names add up to, or zero. */
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen,
+                         const PHYSFS_uint64 entrycount,
+                         const PHYSFS_uint64 namebytes)
 {
     static char rootpath[2] = { '/', '\0' };
+    PHYSFS_uint64 reserve;
     size_t alloclen;
 
     assert(entrylen >= sizeof (__PHYSFS_DirTreeEntry));
 
     memset(dt, '\0', sizeof (*dt));
 
-    dt->root = (__PHYSFS_DirTreeEntry *) allocator.Malloc(entrylen);
-    BAIL_IF(!dt->root, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    /* get every entry and name in one chunk, if we know how much that is.
+       Each name is aligned, so it might take up to ARENA_ALIGN more. Huge
+       guesses are probably bogus; we'll grow from a sane size instead. */
+    reserve = DIRTREE_ARENA_CHUNK;
+    if ((entrycount < DIRTREE_MAX_HINTED_ARENA) &&
+        (namebytes < DIRTREE_MAX_HINTED_ARENA))
+    {
+        const PHYSFS_uint64 want = namebytes +
+                (entrycount * (dirTreeAlign(entrylen) + ARENA_ALIGN));
+        if ((want > reserve) && (want <= DIRTREE_MAX_HINTED_ARENA))
+            reserve = want;
+    } /* if */
+
+    dt->root = (__PHYSFS_DirTreeEntry *) arenaAlloc(&dt->arena,
+                                                    (size_t) reserve,
+                                                    entrylen);
+    BAIL_IF_ERRPASS(!dt->root, 0);
     memset(dt->root, '\0', entrylen);
     dt->root->name = rootpath;
     dt->root->isdir = 1;
-    dt->hashBuckets = 64;
-    if (!dt->hashBuckets)
-        dt->hashBuckets = 1;
     dt->entrylen = entrylen;
 
+    /* aim for about one entry per bucket; don't trust huge counts, though. */
+    dt->hashBuckets = 64;
+    while ((dt->hashBuckets < entrycount) &&
+           (dt->hashBuckets < DIRTREE_MAX_HINTED_BUCKETS))
+        dt->hashBuckets *= 2;
+
     alloclen = dt->hashBuckets * sizeof (__PHYSFS_DirTreeEntry *);
     dt->hash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
-    BAIL_IF(!dt->hash, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (!dt->hash)
+    {
+        __PHYSFS_DirTreeDeinit(dt);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
     memset(dt->hash, '\0', alloclen);
 
     return 1;
 } /* __PHYSFS_DirTreeInit */
 
 
-static inline PHYSFS_uint32 hashPathName(__PHYSFS_DirTree *dt, const char *name)
+/* hashBuckets is always a power of two. */
+static inline size_t dirTreeBucket(const __PHYSFS_DirTree *dt,
+                                   const PHYSFS_uint32 hashval)
+{
+    return (size_t) (hashval & (dt->hashBuckets - 1));
+} /* dirTreeBucket */
+
+
+static int dirTreeGrow(__PHYSFS_DirTree *dt)
+{
+    const size_t newbuckets = dt->hashBuckets * 2;
+    const size_t alloclen = newbuckets * sizeof (__PHYSFS_DirTreeEntry *);
+    __PHYSFS_DirTreeEntry **newhash;
+    size_t i;
+
+    newhash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
+    BAIL_IF(!newhash, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(newhash, '\0', alloclen);
+
+    for (i = 0; i < dt->hashBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry;
+        __PHYSFS_DirTreeEntry *next;
+        for (entry = dt->hash[i]; entry != NULL; entry = next)
+        {
+            const size_t bucket = entry->hashval & (newbuckets - 1);
+            next = entry->hashnext;
+            entry->hashnext = newhash[bucket];
+            newhash[bucket] = entry;
+        } /* for */
+    } /* for */
+
+    allocator.Free(dt->hash);
+    dt->hash = newhash;
+    dt->hashBuckets = newbuckets;
+    return 1;
+} /* dirTreeGrow */
+
+
+static __PHYSFS_DirTreeEntry *dirTreeFind(__PHYSFS_DirTree *dt,
+                                          const char *path,
+                                          const PHYSFS_uint32 hashval)
+{
+    __PHYSFS_DirTreeEntry *retval;
+
+    /*
+     * Don't move hits to the front of the hash chain here: several threads
+     *  can be searching the same tree at once under a shared stateLock.
+     */
+    for (retval = dt->hash[dirTreeBucket(dt, hashval)]; retval;
+         retval = retval->hashnext)
+    {
+        if ((retval->hashval == hashval) && (strcmp(retval->name, path) == 0))
+            return retval;
+    } /* for */
+
+    return NULL;
+} /* dirTreeFind */
+
+
+static void dirTreeFoldAdd(__PHYSFS_DirTree *dt,
+                           __PHYSFS_DirTreeEntry *entry)
 {
-    return __PHYSFS_hashString(name, strlen(name)) % dt->hashBuckets;
-} /* hashPathName */
+    const PHYSFS_uint32 hashval = PHYSFS_utf8HashFolded(entry->name);
+    const size_t bucket = (size_t) (hashval & (dt->foldBuckets - 1));
+    entry->foldhashval = hashval;
+    entry->foldnext = dt->foldhash[bucket];
+    dt->foldhash[bucket] = entry;
+} /* dirTreeFoldAdd */
 
 
 /* Fill in missing parent directories. */
@@ -3185,18 +8973,10 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
     if (sep)
     {
         *sep = '\0';  /* chop off last piece. */
-        retval = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(dt, name);
-
-        if (retval != NULL)
-        {
-            *sep = '/';
-            BAIL_IF(!retval->isdir, PHYSFS_ERR_CORRUPT, NULL);
-            return retval;  /* already hashed. */
-        } /* if */
-
-        /* okay, this is a new dir. Build and hash us. */
-        retval = (__PHYSFS_DirTreeEntry*)__PHYSFS_DirTreeAdd(dt, name, 1);
+        retval = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeAdd(dt, name, 1);
         *sep = '/';
+        BAIL_IF_ERRPASS(!retval, NULL);
+        BAIL_IF(!retval->isdir, PHYSFS_ERR_CORRUPT, NULL);
     } /* if */
 
     return retval;
@@ -3205,25 +8985,37 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 {
-    __PHYSFS_DirTreeEntry *retval = __PHYSFS_DirTreeFind(dt, name);
+    const size_t namelen = strlen(name);
+    const PHYSFS_uint32 hashval = __PHYSFS_hashString(name, namelen);
+    __PHYSFS_DirTreeEntry *retval = dirTreeFind(dt, name, hashval);
     if (!retval)
     {
-        const size_t alloclen = strlen(name) + 1 + dt->entrylen;
-        PHYSFS_uint32 hashval;
+        const size_t entrylen = dirTreeAlign(dt->entrylen);
+        size_t alloclen;
+        size_t bucket;
         __PHYSFS_DirTreeEntry *parent = addAncestors(dt, name);
         BAIL_IF_ERRPASS(!parent, NULL);
         assert(dt->entrylen >= sizeof (__PHYSFS_DirTreeEntry));
-        retval = (__PHYSFS_DirTreeEntry *) allocator.Malloc(alloclen);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+        if (dt->entryCount >= dt->hashBuckets)
+            BAIL_IF_ERRPASS(!dirTreeGrow(dt), NULL);
+
+        alloclen = entrylen + namelen + 1;
+        retval = (__PHYSFS_DirTreeEntry *) dirTreeAlloc(dt, alloclen);
+        BAIL_IF_ERRPASS(!retval, NULL);
         memset(retval, '\0', dt->entrylen);
-        retval->name = ((char *) retval) + dt->entrylen;
-        strcpy(retval->name, name);
-        hashval = hashPathName(dt, name);
-        retval->hashnext = dt->hash[hashval];
-        dt->hash[hashval] = retval;
+        retval->name = ((char *) retval) + entrylen;
+        memcpy(retval->name, name, namelen + 1);
+        retval->hashval = hashval;
+        bucket = dirTreeBucket(dt, hashval);
+        retval->hashnext = dt->hash[bucket];
+        dt->hash[bucket] = retval;
         retval->sibling = parent->children;
         retval->isdir = isdir;
         parent->children = retval;
+        dt->entryCount++;
+        if (dt->foldhash)
+            dirTreeFoldAdd(dt, retval);
     } /* if */
 
     return retval;
@@ -3233,44 +9025,90 @@ void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 /* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
 {
-    PHYSFS_uint32 hashval;
-    __PHYSFS_DirTreeEntry *prev = NULL;
     __PHYSFS_DirTreeEntry *retval;
 
     if (*path == '\0')
         return dt->root;
 
-    hashval = hashPathName(dt, path);
-    for (retval = dt->hash[hashval]; retval; retval = retval->hashnext)
+    retval = dirTreeFind(dt, path, __PHYSFS_hashString(path, strlen(path)));
+    BAIL_IF(!retval, PHYSFS_ERR_NOT_FOUND, NULL);
+    return retval;
+} /* __PHYSFS_DirTreeFind */
+
+
+/* Case-insensitive lookups are rare, so only pay for folding names here. */
+int __PHYSFS_DirTreeFoldCase(__PHYSFS_DirTree *dt)
+{
+    size_t alloclen;
+    size_t i;
+
+    if (dt->foldhash)
+        return 1;  /* already done. */
+
+    alloclen = dt->hashBuckets * sizeof (__PHYSFS_DirTreeEntry *);
+    dt->foldhash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
+    BAIL_IF(!dt->foldhash, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(dt->foldhash, '\0', alloclen);
+    dt->foldBuckets = dt->hashBuckets;
+
+    for (i = 0; i < dt->hashBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry;
+        for (entry = dt->hash[i]; entry != NULL; entry = entry->hashnext)
+            dirTreeFoldAdd(dt, entry);
+    } /* for */
+
+    return 1;
+} /* __PHYSFS_DirTreeFoldCase */
+
+
+void *__PHYSFS_DirTreeFindIgnoreCase(__PHYSFS_DirTree *dt, const char *path)
+{
+    __PHYSFS_DirTreeEntry *retval;
+    PHYSFS_uint32 hashval;
+
+    if (*path == '\0')
+        return dt->root;
+
+    /* an exact match wins, if there is one. */
+    retval = dirTreeFind(dt, path, __PHYSFS_hashString(path, strlen(path)));
+    if ((retval) || (!dt->foldhash))
     {
-        if (strcmp(retval->name, path) == 0)
-        {
-            if (prev != NULL)  /* move this to the front of the list */
-            {
-                prev->hashnext = retval->hashnext;
-                retval->hashnext = dt->hash[hashval];
-                dt->hash[hashval] = retval;
-            } /* if */
+        BAIL_IF(!retval, PHYSFS_ERR_NOT_FOUND, NULL);
+        return retval;
+    } /* if */
 
+    hashval = PHYSFS_utf8HashFolded(path);
+    for (retval = dt->foldhash[hashval & (dt->foldBuckets - 1)]; retval;
+         retval = retval->foldnext)
+    {
+        if ((retval->foldhashval == hashval) &&
+            (PHYSFS_utf8stricmp(retval->name, path) == 0))
             return retval;
-        } /* if */
-
-        prev = retval;
     } /* for */
 
     BAIL(PHYSFS_ERR_NOT_FOUND, NULL);
-} /* __PHYSFS_DirTreeFind */
+} /* __PHYSFS_DirTreeFindIgnoreCase */
+
 
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
                               const char *dname, PHYSFS_EnumerateCallback cb,
                               const char *origdir, void *callbackdata)
 {
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
     __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
     const __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
     BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
+    return __PHYSFS_DirTreeEnumerateEntry(entry, cb, origdir, callbackdata);
+} /* __PHYSFS_DirTreeEnumerate */
+
 
-    entry = entry->children;
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateEntry(
+                              const __PHYSFS_DirTreeEntry *dir,
+                              PHYSFS_EnumerateCallback cb,
+                              const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    const __PHYSFS_DirTreeEntry *entry = dir->children;
 
     while (entry && (retval == PHYSFS_ENUM_OK))
     {
@@ -3282,7 +9120,45 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
     } /* while */
 
     return retval;
-} /* __PHYSFS_DirTreeEnumerate */
+} /* __PHYSFS_DirTreeEnumerateEntry */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStat(void *opaque,
+                              const char *dname,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata,
+                              __PHYSFS_DirTreeStatFn statfn)
+{
+    __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
+    __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
+    BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
+    return __PHYSFS_DirTreeEnumerateStatEntry(opaque, entry, cb, origdir,
+                                              callbackdata, statfn);
+} /* __PHYSFS_DirTreeEnumerateStat */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStatEntry(
+                              void *opaque, __PHYSFS_DirTreeEntry *dir,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata,
+                              __PHYSFS_DirTreeStatFn statfn)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    __PHYSFS_DirTreeEntry *entry = dir->children;
+
+    while (entry && (retval == PHYSFS_ENUM_OK))
+    {
+        const char *name = entry->name;
+        const char *ptr = strrchr(name, '/');
+        PHYSFS_Stat statbuf;
+        BAIL_IF_ERRPASS(!statfn(opaque, entry, &statbuf), PHYSFS_ENUM_ERROR);
+        retval = cb(callbackdata, origdir, ptr ? ptr + 1 : name, &statbuf);
+        BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+        entry = entry->sibling;
+    } /* while */
+
+    return retval;
+} /* __PHYSFS_DirTreeEnumerateStatEntry */
 
 
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
@@ -3294,24 +9170,19 @@ void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
     {
         assert(dt->root->sibling == NULL);
         assert(dt->hash || (dt->root->children == NULL));
-        allocator.Free(dt->root);
     } /* if */
 
     if (dt->hash)
-    {
-        size_t i;
-        for (i = 0; i < dt->hashBuckets; i++)
-        {
-            __PHYSFS_DirTreeEntry *entry;
-            __PHYSFS_DirTreeEntry *next;
-            for (entry = dt->hash[i]; entry; entry = next)
-            {
-                next = entry->hashnext;
-                allocator.Free(entry);
-            } /* for */
-        } /* for */
         allocator.Free(dt->hash);
-    } /* if */
+
+    if (dt->foldhash)
+        allocator.Free(dt->foldhash);
+
+    arenaFree(&dt->arena);  /* the root and every entry live in here. */
+
+    dt->root = NULL;
+    dt->hash = NULL;
+    dt->foldhash = NULL;
 } /* __PHYSFS_DirTreeDeinit */
 
 /* end of physfs.c ... */
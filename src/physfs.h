@@ -140,7 +140,8 @@
  *  type where possible.
  *
  * Currently supported archive types:
- *   - .ZIP (pkZip/WinZip/Info-ZIP compatible)
+ *   - .ZIP (pkZip/WinZip/Info-ZIP compatible; stored, deflated and LZMA
+ *           entries, and Zstandard ones if built with PHYSFS_ZIP_ZSTD)
  *   - .7Z  (7zip archives)
  *   - .ISO (ISO9660 files, CD-ROM images)
  *   - .GRP (Build Engine groupfile archives)
@@ -1458,6 +1459,9 @@ PHYSFS_DECL PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle);
  *
  * PhysicsFS file handles are unbuffered by default.
  *
+ * By default, every read goes through the buffer. See PHYSFS_setBufferMode()
+ *  to let big reads skip it, or to let PhysicsFS pick the size as it goes.
+ *
  * Please check the return value of this function! Failures can include
  *  not being able to seek backwards in a read-only file when removing the
  *  buffer, not being able to allocate the buffer, and not being able to
@@ -1471,6 +1475,7 @@ PHYSFS_DECL PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle);
  * \sa PHYSFS_read
  * \sa PHYSFS_write
  * \sa PHYSFS_close
+ * \sa PHYSFS_setBufferMode
  */
 PHYSFS_DECL int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 bufsize);
 
@@ -2734,6 +2739,13 @@ typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_EnumerateCallback)(void *data,
  *  control if it wants enumeration to stop early. See the documentation for
  *  PHYSFS_EnumerateCallback for details on how your callback should behave.
  *
+ * Your callback may read files and stat paths, but it must not change the
+ *  search path or the write dir (PHYSFS_mount(), PHYSFS_unmount(),
+ *  PHYSFS_setWriteDir(), etc) while the enumeration is running. Those calls
+ *  wait for every other thread to get out of PhysicsFS, this one included,
+ *  so trying it from a callback will hang the app. Other threads can still
+ *  call into PhysicsFS while this runs.
+ *
  *    \param dir Directory, in platform-independent notation, to enumerate.
  *    \param c Callback function to notify about search path elements.
  *    \param d Application-defined data passed to callback. Can be NULL.
@@ -3042,9 +3054,10 @@ typedef struct PHYSFS_Io
     /**
      * \brief Binary compatibility information.
      *
-     * This must be set to zero at this time. Future versions of this
-     *  struct will increment this field, so we know what a given
-     *  implementation supports. We'll presumably keep supporting older
+     * Set this to 0 or 1. Version 1 added readAt(); a version 0 struct
+     *  ends at destroy(), so older code keeps working unchanged. Future
+     *  versions of this struct will increment this field, so we know what a
+     *  given implementation supports. We'll presumably keep supporting older
      *  versions as we offer new features, though.
      */
     PHYSFS_uint32 version;
@@ -3194,6 +3207,31 @@ typedef struct PHYSFS_Io
      *   \param s The i/o instance to destroy.
      */
     void (*destroy)(struct PHYSFS_Io *io);
+
+    /**
+     * \brief Read data from a specific position, without seeking.
+     *
+     * Read (len) bytes starting at byte (offset) from the start of the
+     *  stream into (buf). This is only here in version 1 and later, and it's
+     *  optional even then: set it to NULL if you can't do it.
+     *
+     * This doesn't use the position that read(), seek() and tell() work
+     *  with, and it mustn't change it. It must be safe to call from several
+     *  threads at once on the same instance, even while another thread is
+     *  using read() and seek(). That's what lets archivers share one
+     *  instance among every file opened from them, instead of calling
+     *  duplicate() for each one.
+     *
+     *   \param io The i/o instance to read from.
+     *   \param buf The buffer to store data into. It must be at least
+     *                 (len) bytes long and can't be NULL.
+     *   \param len The number of bytes to read.
+     *   \param offset The byte offset to start reading from.
+     *  \return Number of bytes read, which is less than (len) only at the
+     *          end of the stream. -1 if complete failure.
+     */
+    PHYSFS_sint64 (*readAt)(struct PHYSFS_Io *io, void *buf, PHYSFS_uint64 len,
+                            PHYSFS_uint64 offset);
 } PHYSFS_Io;
 
 
@@ -3395,7 +3433,8 @@ typedef enum PHYSFS_ErrorCode
     PHYSFS_ERR_OS_ERROR,         /**< Unspecified OS-level error.           */
     PHYSFS_ERR_DUPLICATE,        /**< Duplicate entry.                      */
     PHYSFS_ERR_BAD_PASSWORD,     /**< Bad password.                         */
-    PHYSFS_ERR_APP_CALLBACK      /**< Application callback reported error.  */
+    PHYSFS_ERR_APP_CALLBACK,     /**< Application callback reported error.  */
+    PHYSFS_ERR_CANCELLED         /**< Async request cancelled.              */
 } PHYSFS_ErrorCode;
 
 
@@ -3558,6 +3597,50 @@ PHYSFS_DECL void PHYSFS_setErrorCode(PHYSFS_ErrorCode code);
 PHYSFS_DECL const char *PHYSFS_getPrefDir(const char *org, const char *app);
 
 
+/**
+ * \typedef PHYSFS_EnumerateStatCallback
+ * \brief Function signature for callbacks that enumerate with metadata.
+ *
+ * This is PHYSFS_EnumerateCallback with one more argument: what
+ *  PHYSFS_stat() would report for $origdir/$fname. It's used with
+ *  PHYSFS_enumerateStat(), and by the PHYSFS_Archiver::enumerateStat method.
+ *
+ *    \param data User-defined data pointer, passed through from the API
+ *                that eventually called the callback.
+ *    \param origdir A string containing the full path, in platform-independent
+ *                   notation, of the directory containing this file.
+ *    \param fname The filename that is being enumerated, without the path.
+ *    \param stat Metadata for this file. Only valid until the callback
+ *                returns; copy it if you want to keep it.
+ *   \return A value from PHYSFS_EnumerateCallbackResult.
+ *           All other values are (currently) undefined; don't use them.
+ *
+ * \sa PHYSFS_enumerateStat
+ * \sa PHYSFS_EnumerateCallback
+ */
+typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_EnumerateStatCallback)(
+                                       void *data, const char *origdir,
+                                       const char *fname,
+                                       const PHYSFS_Stat *stat);
+
+
+/**
+ * \enum PHYSFS_DetectResult
+ * \brief Possible return values from PHYSFS_Archiver::detect.
+ *
+ * These values rank how likely it is that a file belongs to an archiver,
+ *  judging only by the bytes at its start and end.
+ *
+ * \sa PHYSFS_Archiver
+ */
+typedef enum PHYSFS_DetectResult
+{
+    PHYSFS_DETECT_NO = 0,     /**< Definitely not this format; skip it. */
+    PHYSFS_DETECT_MAYBE = 1,  /**< Can't tell; try openArchive() anyhow. */
+    PHYSFS_DETECT_YES = 2     /**< The format's signature is there. */
+} PHYSFS_DetectResult;
+
+
 /**
  * \struct PHYSFS_Archiver
  * \brief Abstract interface to provide support for user-defined archives.
@@ -3619,8 +3702,10 @@ typedef struct PHYSFS_Archiver
     /**
      * \brief Binary compatibility information.
      *
-     * This must be set to zero at this time. Future versions of this
-     *  struct will increment this field, so we know what a given
+     * Set this to 0, 1 or 2. Version 0 is the struct as it was in PhysicsFS
+     *  2.1, without enumerateStat(); version 1 adds it, and version 2 adds
+     *  detect(). Future versions of
+     *  this struct will increment this field, so we know what a given
      *  implementation supports. We'll presumably keep supporting older
      *  versions as we offer new features, though.
      */
@@ -3777,6 +3862,51 @@ typedef struct PHYSFS_Archiver
      *  there are still files open from this archive.
      */
     void (*closeArchive)(void *opaque);
+
+    /**
+     * \brief List all files in (dirname), with their metadata.
+     *
+     * This is only looked at if (version) is 1 or higher, and even then it
+     *  can be NULL; PhysicsFS will call enumerate(), and then stat() on each
+     *  file, instead. Provide it if you can fill in a PHYSFS_Stat for each
+     *  file more cheaply while you're listing them, because you already
+     *  have that information in memory, or the OS gives it to you along
+     *  with the directory listing.
+     *
+     * It follows all the same rules as enumerate(), except (cb) also gets a
+     *  PHYSFS_Stat for each file, filled in exactly as stat() would fill it
+     *  in. In particular, symlinks must be reported as
+     *  PHYSFS_FILETYPE_SYMLINK and not followed, since PhysicsFS uses that
+     *  to decide whether to skip them.
+     */
+    PHYSFS_EnumerateCallbackResult (*enumerateStat)(void *opaque,
+                     const char *dirname, PHYSFS_EnumerateStatCallback cb,
+                     const char *origdir, void *callbackdata);
+
+    /**
+     * \brief Guess if a file is in this archiver's format.
+     *
+     * This is only looked at if (version) is 2 or higher, and even then it
+     *  can be NULL, which is the same as always answering
+     *  PHYSFS_DETECT_MAYBE.
+     *
+     * When mounting a file, PhysicsFS reads its first 34 kilobytes into
+     *  (header) and its last 64 kilobytes or so into (trailer), once, and
+     *  shows them to every archiver's detect() before calling any
+     *  openArchive(). Archivers that answer PHYSFS_DETECT_YES get the
+     *  first try, archivers that answer PHYSFS_DETECT_NO are never tried
+     *  at all. Either buffer is only shorter than that if the whole file
+     *  is, and for small files they overlap; check (headerLen) and
+     *  (trailerLen) before looking at anything.
+     *
+     * Only answer PHYSFS_DETECT_NO if openArchive() couldn't possibly
+     *  succeed with this data. If detection can't run (the file's length
+     *  is unknown, or reading fails), every archiver is tried, in the
+     *  usual order, as if detect() wasn't there.
+     */
+    PHYSFS_DetectResult (*detect)(const void *header, PHYSFS_uint64 headerLen,
+                                  const void *trailer,
+                                  PHYSFS_uint64 trailerLen);
 } PHYSFS_Archiver;
 
 /**
@@ -3844,6 +3974,1790 @@ PHYSFS_DECL int PHYSFS_deregisterArchiver(const char *ext);
 
 /* Everything above this line is part of the PhysicsFS 2.1 API. */
 
+
+/**
+ * \fn int PHYSFS_setSearchPathIndex(int enable)
+ * \brief Enable or disable the search path lookup index.
+ *
+ * By default, opening or stat'ing a file walks the search path in order,
+ *  asking each mounted archive if it has the file. If you mount dozens of
+ *  archives (patches, DLC, mods...), every lookup that misses has to ask
+ *  every single one of them before giving up.
+ *
+ * With the lookup index enabled, PhysicsFS keeps a single hash table that
+ *  merges the directory trees of every mounted archive, so it knows which
+ *  archive is going to win without asking them all. This is kept up to date
+ *  as you mount and unmount things. PHYSFS_openRead(), PHYSFS_stat() (and
+ *  everything built on it, like PHYSFS_exists()), and PHYSFS_getRealDir()
+ *  use it.
+ *
+ * Only archives whose contents can't change after mounting are indexed
+ *  (which is all the built-in archivers except real directories and .iso
+ *  images, which only read a directory the first time something looks in
+ *  it). Native directories, .iso images, and archivers registered by the
+ *  application are still checked the slow way, in search path order, so
+ *  results are identical either way; this only changes how fast they arrive.
+ *
+ * The index costs memory: roughly one small allocation per file and
+ *  directory in the mounted archives.
+ *
+ * If PhysicsFS runs out of memory while keeping the index current during a
+ *  mount or unmount, it quietly drops the index and goes back to walking
+ *  the search path; PHYSFS_searchPathIndexed() will report zero then.
+ *
+ * This is reset to disabled by PHYSFS_deinit().
+ *
+ *   \param enable non-zero to build and use the index, zero to free it.
+ *  \return non-zero on success, zero on failure (out of memory, or not
+ *          initialized). Use PHYSFS_getLastErrorCode() to obtain the specific
+ *          error.
+ *
+ * \sa PHYSFS_searchPathIndexed
+ */
+PHYSFS_DECL int PHYSFS_setSearchPathIndex(int enable);
+
+
+/**
+ * \fn int PHYSFS_searchPathIndexed(void)
+ * \brief Determine if the search path lookup index is in use.
+ *
+ *  \return non-zero if the lookup index is in use, zero otherwise.
+ *
+ * \sa PHYSFS_setSearchPathIndex
+ */
+PHYSFS_DECL int PHYSFS_searchPathIndexed(void);
+
+
+/**
+ * \fn PHYSFS_File *PHYSFS_mapFile(const char *filename, const void **ptr, PHYSFS_uint64 *len)
+ * \brief Open a file for reading and get a pointer straight to its bytes.
+ *
+ * This opens (filename) just like PHYSFS_openRead() does, but also gives you
+ *  a read-only pointer to the entire contents of the file, so you can use
+ *  the data without reading it into a buffer of your own first. Where
+ *  possible, this points right into a memory mapping of the file on disk,
+ *  so the data comes straight from the OS's page cache and nothing is
+ *  copied at all.
+ *
+ * This only works when the bytes in the archive are the bytes of the file:
+ *  files in native directories, stored (uncompressed, unencrypted) entries
+ *  in .zip files, files in the simple formats (.grp, .hog, .mvl, .pak,
+ *  .slb, .vdf, .wad, .iso), and anything in an archive mounted with
+ *  PHYSFS_mountMemory(). Otherwise, this fails with PHYSFS_ERR_UNSUPPORTED
+ *  and you should fall back to PHYSFS_openRead() and PHYSFS_readBytes().
+ *  It also fails on platforms that can't memory-map files, unless the data
+ *  is already in memory.
+ *
+ * The pointer stays valid until you PHYSFS_close() the returned handle,
+ *  and you can't unmount the file's archive until then. Never write through
+ *  the pointer. You can still read from the handle normally, if you like.
+ *
+ * Be aware that if the file is truncated by some other process while you
+ *  have it mapped, touching the missing part of the mapping will likely
+ *  crash your program (SIGBUS on Unix, an access violation on Windows).
+ *  Don't map files that something else might be rewriting.
+ *
+ *   \param filename File to open and map, in platform-independent notation.
+ *   \param ptr On success, receives a pointer to the file's contents.
+ *   \param len On success, receives the length of the file in bytes.
+ *  \return A valid PhysicsFS filehandle on success, NULL on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_openRead
+ * \sa PHYSFS_close
+ * \sa PHYSFS_setMapArchives
+ */
+PHYSFS_DECL PHYSFS_File *PHYSFS_mapFile(const char *filename, const void **ptr,
+                                        PHYSFS_uint64 *len);
+
+
+/**
+ * \fn void PHYSFS_setMapArchives(int enable)
+ * \brief Memory-map whole archives when they're mounted.
+ *
+ * With this enabled, archives mounted by path afterwards for reading
+ *  are memory-mapped in their entirety (if the platform can, and on 32-bit
+ *  builds only if they're 256 megabytes or smaller), instead of being read
+ *  through ordinary file i/o. Reading from them then costs a memcpy() out of
+ *  the OS's page cache instead of a system call, which helps a lot when
+ *  you read many small files. Archives already mounted are left alone.
+ *
+ * This is disabled by default, for a good reason: if a mapped archive is
+ *  truncated on disk while it's mounted (by a patcher, a download that's
+ *  still in progress, a full disk, a network share going away), touching
+ *  the missing part kills your process outright with SIGBUS on Unix, or an
+ *  access violation on Windows, where ordinary file i/o would just fail the
+ *  read with an error you can handle. Only enable this if nothing will
+ *  rewrite your archives while they're mounted.
+ *
+ * PHYSFS_mapFile() works whether or not this is enabled, and carries the
+ *  same hazard for the files it maps.
+ *
+ *   \param enable nonzero to map archives, zero to read them normally.
+ *
+ * \sa PHYSFS_archivesMapped
+ * \sa PHYSFS_mapFile
+ */
+PHYSFS_DECL void PHYSFS_setMapArchives(int enable);
+
+
+/**
+ * \fn int PHYSFS_archivesMapped(void)
+ * \brief Determine if archives are memory-mapped when they're mounted.
+ *
+ *  \return nonzero if they are, zero if not.
+ *
+ * \sa PHYSFS_setMapArchives
+ */
+PHYSFS_DECL int PHYSFS_archivesMapped(void);
+
+
+/**
+ * \fn int PHYSFS_buildSeekIndex(PHYSFS_File *handle)
+ * \brief Make seeking around in a compressed file fast.
+ *
+ * Seeking backwards in a compressed file normally means decompressing it
+ *  again from the start, throwing data away until reaching the new position.
+ *  For big files, that can take a long time.
+ *
+ * To avoid that, PhysicsFS can save the decompressor's state at regular
+ *  intervals as it works through a file, and later seeks resume from the
+ *  closest of these checkpoints instead of the start. This happens on its
+ *  own for large compressed files (16 megabytes and up, currently), while
+ *  they are read. This function decompresses the whole file once right now
+ *  to build that index, so even the first seek is fast, and turns it on for
+ *  smaller files too. The file position is left where it was.
+ *
+ * The index is shared by every handle open on the same file, and is kept
+ *  until the archive is unmounted. It costs a little over 40 kilobytes for
+ *  every 4 megabytes of uncompressed data.
+ *
+ * Currently only deflated .zip entries get an index. For anything else,
+ *  this does nothing and reports success, since seeking is already as fast
+ *  as PhysicsFS can make it; LZMA and Zstandard .zip entries still decode
+ *  from the start of the file when seeking backwards.
+ *
+ *   \param handle File handle opened for reading.
+ *  \return non-zero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_seek
+ */
+PHYSFS_DECL int PHYSFS_buildSeekIndex(PHYSFS_File *handle);
+
+
+/**
+ * \fn void PHYSFS_setSolidBlockCacheBudget(PHYSFS_uint64 budget)
+ * \brief Set how much decompressed data each 7zip archive may keep around.
+ *
+ * 7zip archives usually pack many files into one compressed "solid block,"
+ *  which has to be decompressed in full to get at any file inside it. To
+ *  keep from doing that work over and over, each mounted 7zip archive holds
+ *  on to the blocks it decompressed, and every file opened from a block
+ *  reads directly out of that shared copy. When the blocks an archive holds
+ *  add up to more than (budget) bytes, the ones used least recently are let
+ *  go; memory is actually freed once no open file is still using them.
+ *
+ * Large files that were compressed on their own, rather than in a solid
+ *  block, don't use this cache: they are decompressed as they are read.
+ *
+ * The default is 32 megabytes per archive. A budget of zero turns the cache
+ *  off. A new budget takes effect the next time a file is opened from each
+ *  archive. This may be called before PHYSFS_init(), and the setting
+ *  survives PHYSFS_deinit().
+ *
+ *   \param budget Maximum bytes of decompressed blocks to keep per archive.
+ *
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL void PHYSFS_setSolidBlockCacheBudget(PHYSFS_uint64 budget);
+
+
+/**
+ * \fn void PHYSFS_setCacheBudget(PHYSFS_uint64 budget)
+ * \brief Keep decompressed copies of small, often-used files in memory.
+ *
+ * Every time a compressed file is opened, PhysicsFS normally decompresses
+ *  it again from the start. If your app opens the same small files over and
+ *  over (shaders, config files, UI images...), that work adds up.
+ *
+ * With a nonzero budget, PhysicsFS keeps fully decompressed copies of small
+ *  compressed files from archives, up to a total of (budget) bytes across
+ *  all archives. Opening a cached file skips the archive completely, and
+ *  every handle open on it shares the same copy. Once the cache is over
+ *  budget, the least recently used files are dropped. A file is only cached
+ *  if it is no bigger than an eighth of the budget, so one big file can't
+ *  force everything else out.
+ *
+ * Currently, only compressed, unencrypted .zip entries are cached. A file's
+ *  cached copy goes away when its archive is unmounted.
+ *
+ * The cache is off (a budget of zero) by default. Lowering the budget drops
+ *  files right away until the cache fits; zero empties it. This may be
+ *  called before PHYSFS_init(), and the setting survives PHYSFS_deinit().
+ *
+ *   \param budget Maximum bytes of decompressed data to keep, or zero.
+ *
+ * \sa PHYSFS_getCacheStats
+ */
+PHYSFS_DECL void PHYSFS_setCacheBudget(PHYSFS_uint64 budget);
+
+
+/**
+ * \struct PHYSFS_CacheStats
+ * \brief How well the decompressed-asset cache is working.
+ *
+ * \sa PHYSFS_getCacheStats
+ * \sa PHYSFS_setCacheBudget
+ */
+typedef struct PHYSFS_CacheStats
+{
+    PHYSFS_uint64 hits;  /**< opens served from the cache. */
+    PHYSFS_uint64 misses;  /**< cacheable opens that weren't cached yet. */
+    PHYSFS_uint64 bytes;  /**< decompressed bytes in the cache right now. */
+    PHYSFS_uint64 entries;  /**< files in the cache right now. */
+} PHYSFS_CacheStats;
+
+
+/**
+ * \fn int PHYSFS_getCacheStats(PHYSFS_CacheStats *stats)
+ * \brief Get the decompressed-asset cache's counters.
+ *
+ * The hit and miss counts start at zero in PHYSFS_init() and only ever go
+ *  up until PHYSFS_deinit().
+ *
+ *   \param stats Filled in with the current counters.
+ *  \return non-zero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_setCacheBudget
+ */
+PHYSFS_DECL int PHYSFS_getCacheStats(PHYSFS_CacheStats *stats);
+
+
+/**
+ * \fn void PHYSFS_setPoolLimit(PHYSFS_uint32 count)
+ * \brief Set how many freed internal objects PhysicsFS keeps for reuse.
+ *
+ * Every file you open needs a few small internal structures, and files
+ *  opened from compressed .zip entries also need a read buffer and a
+ *  decompressor. Instead of freeing all of that on PHYSFS_close() and
+ *  allocating it again for the next open, PhysicsFS keeps up to (count)
+ *  of each kind of object in a pool, and reuses them. An app that opens
+ *  and closes thousands of files a second spends a lot less time in the
+ *  allocator that way.
+ *
+ * Pooled objects hold memory while they wait; a pooled .zip decompressor
+ *  with its buffer is around 60 kilobytes. Set (count) to about the number
+ *  of files you expect to have open at once. The default is 64. Zero turns
+ *  pooling off. Lowering the limit frees extra pooled objects right away.
+ *  This may be called before PHYSFS_init(), and the setting survives
+ *  PHYSFS_deinit(), which empties the pools.
+ *
+ *   \param count Most objects of each kind to keep around for reuse.
+ *
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL void PHYSFS_setPoolLimit(PHYSFS_uint32 count);
+
+
+/**
+ * \fn int PHYSFS_setIndexCacheDir(const char *dir)
+ * \brief Keep snapshots of archive indexes on disk to speed up mounting.
+ *
+ * Opening a .zip file means reading and parsing its whole central directory,
+ *  which can take a long time for archives with many thousands of files. If
+ *  you set an index cache directory, PhysicsFS writes a small snapshot of
+ *  each .zip archive's parsed index there the first time it is mounted, and
+ *  later mounts of the same archive load the snapshot instead.
+ *
+ * A snapshot is only used if the archive's size, modification time and
+ *  central directory all still match the ones it was made from; otherwise it
+ *  is ignored and replaced. A missing, stale or damaged snapshot never makes
+ *  a mount fail, and neither does failing to write one.
+ *
+ * The directory must already exist and be writable; PhysicsFS won't create
+ *  it. PHYSFS_getPrefDir() is a good choice. Snapshot file names are hashes
+ *  of the archive's name, so don't keep anything else in this directory.
+ *
+ * The index cache is off by default. This setting goes away at
+ *  PHYSFS_deinit().
+ *
+ *   \param dir The directory in platform-dependent notation, or NULL to stop
+ *              using the index cache.
+ *  \return non-zero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_getPrefDir
+ * \sa PHYSFS_mount
+ */
+PHYSFS_DECL int PHYSFS_setIndexCacheDir(const char *dir);
+
+
+/**
+ * \struct PHYSFS_MountSpec
+ * \brief One archive or directory for PHYSFS_mountMany() to mount.
+ *
+ * The fields mean the same thing as PHYSFS_mount()'s parameters.
+ *
+ * \sa PHYSFS_mountMany
+ */
+typedef struct PHYSFS_MountSpec
+{
+    const char *newDir;  /**< dir or archive, in platform-dependent notation. */
+    const char *mountPoint;  /**< where it goes; NULL or "" is the root. */
+    int appendToPath;  /**< nonzero to append to the search path. */
+} PHYSFS_MountSpec;
+
+
+/**
+ * \fn int PHYSFS_mountMany(const PHYSFS_MountSpec *specs, PHYSFS_uint32 count, int threads)
+ * \brief Mount several archives at once, opening them in parallel.
+ *
+ * This does the same thing as calling PHYSFS_mount() for each of (specs), in
+ *  order, but opens the archives and parses their directories on up to
+ *  (threads) threads at once, including the calling thread. For a game
+ *  that mounts dozens of archives at startup, this can divide the time it
+ *  takes by the number of cores (and disks) available.
+ *
+ * Other threads can keep reading from what's already mounted while this
+ *  works; the new archives all show up in the search path at once, once
+ *  everything is open, in the same order PHYSFS_mount() would have put
+ *  them. If any of them fails to open, none of them are mounted, and the
+ *  error is the one from the first failure in (specs).
+ *
+ * Like PHYSFS_mount(), mounting something that's already in the search path
+ *  does nothing and isn't an error, and the same goes for something listed
+ *  more than once in (specs).
+ *
+ * If you've registered your own archivers with PHYSFS_registerArchiver(),
+ *  this opens everything on the calling thread, since we promised those
+ *  archivers we wouldn't call into them from several threads at once. The
+ *  same happens if the platform can't start threads.
+ *
+ *   \param specs An array of (count) things to mount.
+ *   \param count Number of elements in (specs).
+ *   \param threads Most threads to use, including the calling one. One (or
+ *                  less) does everything on the calling thread.
+ *  \return nonzero if everything was mounted, zero if nothing was. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_MountSpec
+ */
+PHYSFS_DECL int PHYSFS_mountMany(const PHYSFS_MountSpec *specs,
+                                 PHYSFS_uint32 count, int threads);
+
+
+/**
+ * \typedef PHYSFS_ReadFilesCallback
+ * \brief Function signature for callbacks that get PHYSFS_readFiles() data.
+ *
+ * (buf) holds all (len) bytes of the file named (fname), which is the same
+ *  pointer you passed to PHYSFS_readFiles(). (buf) is only valid until the
+ *  callback returns, so copy anything you want to keep.
+ *
+ * Return PHYSFS_ENUM_OK to keep going, PHYSFS_ENUM_STOP to skip the rest of
+ *  the files, or PHYSFS_ENUM_ERROR to fail with PHYSFS_ERR_APP_CALLBACK.
+ *
+ * \sa PHYSFS_readFiles
+ */
+typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_ReadFilesCallback)(void *data,
+                            const char *fname, const void *buf,
+                            PHYSFS_uint64 len);
+
+
+/**
+ * \fn int PHYSFS_readFiles(const char **fnames, PHYSFS_uint32 count, PHYSFS_ReadFilesCallback callback, void *data)
+ * \brief Read many whole files in whatever order is fastest.
+ *
+ * This reads every file in (fnames), as PHYSFS_openRead() would find them,
+ *  and hands each one's contents to (callback). Instead of reading them in
+ *  the order listed, it finds them all first and reads each archive's files
+ *  in the order they're stored, so loading thousands of small files turns
+ *  into a few front-to-back passes over the archives instead of thousands
+ *  of seeks. Files from plain directories, and from archive types whose
+ *  layout PhysicsFS can't see without opening files, are read first, in the
+ *  order listed.
+ *
+ * For stored files in archives that are already in memory (mounted with
+ *  PHYSFS_mountMemory(), or mapped after PHYSFS_setMapArchives()), the
+ *  buffer you get points right at the archive's data, so there's not even
+ *  a copy. Everything else is read into a buffer first.
+ *
+ * If any of (fnames) can't be found, this fails before calling (callback)
+ *  at all. If a read fails partway, it stops there, and (callback) will have
+ *  seen some of the files.
+ *
+ * Don't mount or unmount anything, or change the write directory, from
+ *  (callback).
+ *
+ *   \param fnames Array of (count) files to read, in platform-independent
+ *                 notation.
+ *   \param count Number of elements in (fnames).
+ *   \param callback Gets each file's contents.
+ *   \param data Passed to (callback) untouched.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_ReadFilesCallback
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL int PHYSFS_readFiles(const char **fnames, PHYSFS_uint32 count,
+                                 PHYSFS_ReadFilesCallback callback,
+                                 void *data);
+
+
+/**
+ * \struct PHYSFS_AsyncResult
+ * \brief What an async request did, passed to its PHYSFS_AsyncCallback.
+ *
+ * \sa PHYSFS_AsyncCallback
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_openReadAsync
+ */
+typedef struct PHYSFS_AsyncResult
+{
+    PHYSFS_uint64 ticket;  /**< What PHYSFS_readAsync() etc returned. */
+    PHYSFS_File *file;  /**< File read from, or just opened (NULL if not). */
+    void *buffer;  /**< Buffer passed to PHYSFS_readAsync(); NULL for opens. */
+    PHYSFS_sint64 result;  /**< Bytes read (0 for opens), or -1 on failure. */
+    PHYSFS_ErrorCode error;  /**< Why it failed, or PHYSFS_ERR_OK. */
+} PHYSFS_AsyncResult;
+
+
+/**
+ * \typedef PHYSFS_AsyncCallback
+ * \brief Function signature for async request completion callbacks.
+ *
+ * This is called once for every request that was successfully queued:
+ *  when it's done, when it fails, or when it's cancelled (in which case
+ *  (result)->error is PHYSFS_ERR_CANCELLED). It usually runs on one of
+ *  PhysicsFS's worker threads, so don't take long, and be prepared to hand
+ *  the result back to your own threads. (result) is only valid until the
+ *  callback returns.
+ *
+ * For an opened file, you own (result)->file and must PHYSFS_close() it.
+ *  You may close a file from the callback for one of its own reads.
+ *
+ *   \param data The pointer you passed with the request.
+ *   \param result What happened.
+ *
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_openReadAsync
+ */
+typedef void (*PHYSFS_AsyncCallback)(void *data,
+                                     const PHYSFS_AsyncResult *result);
+
+
+/**
+ * \fn int PHYSFS_setAsyncThreads(int threads)
+ * \brief Set how many worker threads service async requests.
+ *
+ * PhysicsFS starts a small pool of threads the first time you make an async
+ *  request. This waits for everything already queued to finish, stops the
+ *  pool, and sets how many threads the next one gets. This is meant to be
+ *  called once, before your first request; calling it while requests are
+ *  in flight will stall you until they're done.
+ *
+ *   \param threads Number of workers to use, or zero for the default (2).
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_openReadAsync
+ */
+PHYSFS_DECL int PHYSFS_setAsyncThreads(int threads);
+
+
+/**
+ * \fn PHYSFS_uint64 PHYSFS_readAsync(PHYSFS_File *handle, void *buffer, PHYSFS_uint64 len, PHYSFS_uint64 offset, int priority, PHYSFS_AsyncCallback callback, void *data)
+ * \brief Read data from a PhysicsFS filehandle without waiting for it.
+ *
+ * This queues a read of up to (len) bytes, starting (offset) bytes into
+ *  the file, and returns immediately. A worker thread reads into (buffer)
+ *  and then calls (callback). Like PHYSFS_readBytes(), you only get a short
+ *  read at the end of the file.
+ *
+ * This reads through the file's own private duplicate, so it doesn't move
+ *  the position PHYSFS_tell() reports, and PHYSFS_readBytes() on the same
+ *  handle doesn't disturb it.
+ *
+ * Requests with a bigger (priority) run first, and equal priorities run in
+ *  the order you made them. Reads from the same file always finish in the
+ *  order you made them, though, whatever their priority, so a later read
+ *  never jumps ahead of an earlier one on the same handle. Reads from
+ *  different files can run at the same time.
+ *
+ * (buffer) must stay valid until (callback) runs. Closing the file cancels
+ *  its reads that haven't started yet, and waits for one that has.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param buffer buffer to store read data into.
+ *   \param len number of bytes to read.
+ *   \param offset where in the file to read from.
+ *   \param priority bigger numbers run sooner.
+ *   \param callback called when the read is done, failed, or cancelled.
+ *   \param data passed to (callback) untouched.
+ *  \return a nonzero ticket for PHYSFS_cancelAsync(), or zero if the
+ *          request couldn't be queued, in which case (callback) won't be
+ *          called. Use PHYSFS_getLastErrorCode() to obtain the specific
+ *          error.
+ *
+ * \sa PHYSFS_AsyncCallback
+ * \sa PHYSFS_cancelAsync
+ * \sa PHYSFS_readBytes
+ */
+PHYSFS_DECL PHYSFS_uint64 PHYSFS_readAsync(PHYSFS_File *handle, void *buffer,
+                                           PHYSFS_uint64 len,
+                                           PHYSFS_uint64 offset, int priority,
+                                           PHYSFS_AsyncCallback callback,
+                                           void *data);
+
+
+/**
+ * \fn PHYSFS_uint64 PHYSFS_openReadAsync(const char *fname, int priority, PHYSFS_AsyncCallback callback, void *data)
+ * \brief Open a file for reading without waiting for it.
+ *
+ * This queues a PHYSFS_openRead() of (fname) and returns immediately. A
+ *  worker thread opens the file and then passes the new PHYSFS_File (or
+ *  NULL) to (callback). Priorities work like PHYSFS_readAsync().
+ *
+ *   \param fname File to open, in platform-independent notation.
+ *   \param priority bigger numbers run sooner.
+ *   \param callback called when the open is done, failed, or cancelled.
+ *   \param data passed to (callback) untouched.
+ *  \return a nonzero ticket for PHYSFS_cancelAsync(), or zero if the
+ *          request couldn't be queued, in which case (callback) won't be
+ *          called. Use PHYSFS_getLastErrorCode() to obtain the specific
+ *          error.
+ *
+ * \sa PHYSFS_AsyncCallback
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL PHYSFS_uint64 PHYSFS_openReadAsync(const char *fname,
+                                               int priority,
+                                               PHYSFS_AsyncCallback callback,
+                                               void *data);
+
+
+/**
+ * \fn int PHYSFS_cancelAsync(PHYSFS_uint64 ticket)
+ * \brief Cancel an async request that hasn't started yet.
+ *
+ * If the request is still waiting in the queue, it's removed, and its
+ *  callback is called with PHYSFS_ERR_CANCELLED before this returns, on the
+ *  calling thread. Requests that are already running finish normally.
+ *
+ *   \param ticket What PHYSFS_readAsync() or PHYSFS_openReadAsync()
+ *                 returned.
+ *  \return nonzero if the request was cancelled, zero if it's already
+ *          running or done (PHYSFS_ERR_NOT_FOUND).
+ *
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_openReadAsync
+ */
+PHYSFS_DECL int PHYSFS_cancelAsync(PHYSFS_uint64 ticket);
+
+
+/**
+ * \fn int PHYSFS_prefetch(const char *fname)
+ * \brief Hint that a file will be read soon.
+ *
+ * This queues a low-priority job on the async worker pool (see
+ *  PHYSFS_readAsync()) and returns immediately. The job finds (fname) as
+ *  PHYSFS_openRead() would and asks the OS to start reading the bytes it's
+ *  stored as into its cache, so a later open and read doesn't wait on the
+ *  disk. For a file inside an archive, that means the right part of the
+ *  archive. If PHYSFS_setCacheBudget() is in use and the file is one it
+ *  keeps, it's decompressed into the cache, too.
+ *
+ * This is only a hint: it might not help, and you're never told whether it
+ *  did. Prefetches run after any other async request that's queued.
+ *
+ *   \param fname File to prefetch, in platform-independent notation.
+ *  \return nonzero if the hint was queued, zero on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_prefetchRange
+ * \sa PHYSFS_readAsync
+ */
+PHYSFS_DECL int PHYSFS_prefetch(const char *fname);
+
+
+/**
+ * \fn int PHYSFS_prefetchRange(PHYSFS_File *handle, PHYSFS_uint64 offset, PHYSFS_uint64 len)
+ * \brief Hint that part of an open file will be read soon.
+ *
+ * This asks the OS to start reading the data for (len) bytes of (handle),
+ *  starting (offset) bytes into the file, into its cache, and returns
+ *  without waiting for it. For a file inside an archive, the hint goes to
+ *  the part of the archive that holds those bytes; for compressed ZIP
+ *  entries that's an estimate. It doesn't move the file position.
+ *
+ * This only works when the data comes from a native file, or from an archive
+ *  that keeps it at a known place in one (ZIP and the simple "unpacked"
+ *  formats like GRP, HOG, WAD and SLB). Data already in memory succeeds
+ *  without doing anything. On platforms with no way to give such a hint,
+ *  this fails with PHYSFS_ERR_UNSUPPORTED.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param offset where in the file the data starts.
+ *   \param len how much data will be read. It's fine to go past the end.
+ *  \return nonzero if the hint was given, zero if not. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error. Failing
+ *          is harmless; reads just won't get any faster.
+ *
+ * \sa PHYSFS_prefetch
+ */
+PHYSFS_DECL int PHYSFS_prefetchRange(PHYSFS_File *handle,
+                                     PHYSFS_uint64 offset,
+                                     PHYSFS_uint64 len);
+
+
+/**
+ * \fn void PHYSFS_setCrcVerification(int enable)
+ * \brief Check ZIP entries' CRC-32 as they're read.
+ *
+ * ZIP archives store a CRC-32 of every file, but by default PhysicsFS
+ *  doesn't look at it. With this enabled, files opened from ZIP archives
+ *  afterwards keep a running CRC of the data as you read it, and when
+ *  the read that reaches the end of the file finds it doesn't match, that
+ *  read fails with PHYSFS_ERR_CORRUPT (even though it filled your buffer),
+ *  as does every read after it. This costs very little: the CRC is done
+ *  with CPU instructions made for it when the CPU has them.
+ *
+ * Only data read in one pass from the start gets checked. Seeking backwards
+ *  is fine, but if you seek forward past data you never read, there's no
+ *  way to check that file this time, and you won't get an error for it.
+ *  Files the decompressed-asset cache (see PHYSFS_setCacheBudget()) keeps
+ *  are checked as they go into the cache, if this was enabled then.
+ *
+ * This is disabled by default.
+ *
+ *   \param enable nonzero to check CRCs, zero to leave them be.
+ *
+ * \sa PHYSFS_crcVerificationEnabled
+ * \sa PHYSFS_verifyArchive
+ */
+PHYSFS_DECL void PHYSFS_setCrcVerification(int enable);
+
+
+/**
+ * \fn int PHYSFS_crcVerificationEnabled(void)
+ * \brief Determine if ZIP entries' CRCs are checked.
+ *
+ *  \return nonzero if they are, zero if not.
+ *
+ * \sa PHYSFS_setCrcVerification
+ */
+PHYSFS_DECL int PHYSFS_crcVerificationEnabled(void);
+
+
+/**
+ * \fn int PHYSFS_verifyArchive(const char *dir, int threads)
+ * \brief Check every file in a mounted archive for corruption.
+ *
+ * This reads every file in the archive that was mounted as (dir), the same
+ *  string you passed to PHYSFS_mount(), and checks each against the CRC-32
+ *  the archive stored for it, whether or not PHYSFS_setCrcVerification() is
+ *  enabled. It spreads the files over up to (threads) threads, counting the
+ *  calling one, and returns when they're all done. Other threads can keep
+ *  using PhysicsFS meanwhile, but nothing can be mounted or unmounted until
+ *  this returns.
+ *
+ * Only ZIP archives have CRCs to check. Files encrypted with traditional
+ *  PKWARE encryption are skipped, as there's no password to decrypt them
+ *  with, so success says nothing about those; an archive of nothing but
+ *  encrypted files always passes.
+ *
+ *   \param dir Archive to check, as passed to PHYSFS_mount().
+ *   \param threads Most threads to use, including the calling one. One (or
+ *                  less) does it all on the calling thread.
+ *  \return nonzero if every file that could be checked is intact, zero on
+ *          error. Use PHYSFS_getLastErrorCode() to obtain the specific error:
+ *          PHYSFS_ERR_CORRUPT if anything didn't match,
+ *          PHYSFS_ERR_UNSUPPORTED if (dir) isn't a ZIP archive.
+ *
+ * \sa PHYSFS_setCrcVerification
+ */
+PHYSFS_DECL int PHYSFS_verifyArchive(const char *dir, int threads);
+
+
+/**
+ * \struct PHYSFS_Stats
+ * \brief Counters for what PhysicsFS has been doing.
+ *
+ * Every field is a running total. Take two snapshots and subtract one from
+ *  the other to see what happened in between. Times are in nanoseconds,
+ *  from a monotonic clock, and are only as precise as the platform's clock.
+ *
+ * Some counters only make sense at some levels: (lockGrabs) and
+ *  (lockWaitTime) are only counted library-wide, by PHYSFS_getStats(), and
+ *  (openMisses) is always zero for a single open file.
+ *
+ * \sa PHYSFS_getStats
+ * \sa PHYSFS_getArchiveStats
+ * \sa PHYSFS_getFileStats
+ */
+typedef struct PHYSFS_Stats
+{
+    PHYSFS_uint64 opens;  /**< Files opened, for reading or writing. */
+    PHYSFS_uint64 openMisses;  /**< Opens for reading that didn't find it. */
+    PHYSFS_uint64 bytesRead;  /**< Bytes of file data the app read. */
+    PHYSFS_uint64 rawBytesRead;  /**< Bytes read from storage, compressed. */
+    PHYSFS_uint64 seeks;  /**< Calls to PHYSFS_seek(). */
+    PHYSFS_uint64 seekTime;  /**< Time spent in PHYSFS_seek(). */
+    PHYSFS_uint64 seekDecodedBytes;  /**< Decompressed just to skip past. */
+    PHYSFS_uint64 decompressTime;  /**< Time spent decompressing. */
+    PHYSFS_uint64 bufferRefills;  /**< Times a file buffer was refilled. */
+    PHYSFS_uint64 lockGrabs;  /**< Times the library's state lock was taken. */
+    PHYSFS_uint64 lockWaitTime;  /**< Time spent waiting for it. */
+} PHYSFS_Stats;
+
+
+/**
+ * \fn int PHYSFS_getStats(PHYSFS_Stats *stats)
+ * \brief Get counters for everything PhysicsFS has done since init.
+ *
+ * These add up every file ever opened, open or closed, on top of the
+ *  library-wide counters. They're kept with cheap atomic adds, so they're
+ *  always on; while other threads are busy, the snapshot might be a hair
+ *  out of date in places, but no count is ever torn or lost.
+ *
+ * Decompression counts (rawBytesRead that differ from bytesRead,
+ *  seekDecodedBytes, decompressTime) come from .ZIP entries. For files from
+ *  anywhere else, (rawBytesRead) is what was read from the file itself,
+ *  which might be more than (bytesRead) with a buffer set.
+ *
+ * Everything starts from zero again after PHYSFS_deinit().
+ *
+ *   \param stats Filled in with the counts.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_getArchiveStats
+ * \sa PHYSFS_getFileStats
+ */
+PHYSFS_DECL int PHYSFS_getStats(PHYSFS_Stats *stats);
+
+
+/**
+ * \fn int PHYSFS_getArchiveStats(const char *dir, PHYSFS_Stats *stats)
+ * \brief Get counters for one mounted archive.
+ *
+ * Like PHYSFS_getStats(), but only counts files opened from the archive
+ *  that was mounted as (dir), the same string you passed to PHYSFS_mount(),
+ *  since it was mounted. (openMisses) counts the times an open looked in this
+ *  archive and didn't find the file there. The write dir counts too, by the
+ *  name passed to PHYSFS_setWriteDir().
+ *
+ *   \param dir Archive to report on, as passed to PHYSFS_mount().
+ *   \param stats Filled in with the counts.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error: PHYSFS_ERR_NOT_MOUNTED if (dir)
+ *          isn't mounted.
+ *
+ * \sa PHYSFS_getStats
+ */
+PHYSFS_DECL int PHYSFS_getArchiveStats(const char *dir, PHYSFS_Stats *stats);
+
+
+/**
+ * \fn int PHYSFS_getFileStats(PHYSFS_File *handle, PHYSFS_Stats *stats)
+ * \brief Get counters for one open file.
+ *
+ * Like PHYSFS_getStats(), but only for (handle), since it was opened. Its
+ *  (opens) is always 1. Reads done by PHYSFS_readAsync() count here, too.
+ *
+ *   \param handle File to report on.
+ *   \param stats Filled in with the counts.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_getStats
+ */
+PHYSFS_DECL int PHYSFS_getFileStats(PHYSFS_File *handle, PHYSFS_Stats *stats);
+
+
+/**
+ * \enum PHYSFS_TraceEventType
+ * \brief What a PHYSFS_TraceEvent is timing.
+ *
+ * \sa PHYSFS_TraceEvent
+ * \sa PHYSFS_setTraceHook
+ */
+typedef enum PHYSFS_TraceEventType
+{
+    PHYSFS_TRACE_MOUNT,      /**< PHYSFS_mount() and friends. */
+    PHYSFS_TRACE_OPEN,       /**< PHYSFS_openRead(), openWrite, openAppend. */
+    PHYSFS_TRACE_READ,       /**< PHYSFS_readBytes(). */
+    PHYSFS_TRACE_SEEK,       /**< PHYSFS_seek(). */
+    PHYSFS_TRACE_CLOSE,      /**< PHYSFS_close(). */
+    PHYSFS_TRACE_ENUMERATE,  /**< PHYSFS_enumerate() and friends. */
+    PHYSFS_TRACE_DECODE      /**< An archiver decompressing something. */
+} PHYSFS_TraceEventType;
+
+
+/**
+ * \struct PHYSFS_TraceEvent
+ * \brief One end of something PhysicsFS did, for a trace hook.
+ *
+ * Every traced operation gets two events, one as it starts (with (end) set
+ *  to zero) and one as it finishes, on the same thread. Operations can nest:
+ *  a PHYSFS_TRACE_DECODE usually happens inside a PHYSFS_TRACE_READ or
+ *  PHYSFS_TRACE_OPEN.
+ *
+ * Strings are only good until the hook returns; copy them if you need them.
+ *
+ * \sa PHYSFS_setTraceHook
+ */
+typedef struct PHYSFS_TraceEvent
+{
+    PHYSFS_TraceEventType type;  /**< What's happening. */
+    int end;  /**< Zero when it starts, nonzero when it's done. */
+    PHYSFS_uint64 time;  /**< Nanoseconds; same clock as PHYSFS_Stats. */
+    const char *path;  /**< File or directory in the search path, or NULL. */
+    const char *archive;  /**< Archive's name as mounted, if known, or NULL. */
+    const char *detail;  /**< What the archiver's doing ("deflate"), or NULL. */
+    PHYSFS_File *file;  /**< Handle involved, or NULL. Don't use at CLOSE. */
+    PHYSFS_uint64 offset;  /**< Where in (file) a read or seek starts. */
+    PHYSFS_sint64 result;  /**< At the end: bytes read, or nonzero success. */
+} PHYSFS_TraceEvent;
+
+
+/**
+ * \typedef PHYSFS_TraceCallback
+ * \brief Function signature for PHYSFS_setTraceHook().
+ *
+ *   \param data The pointer passed to PHYSFS_setTraceHook().
+ *   \param event What just started or finished.
+ *
+ * \sa PHYSFS_setTraceHook
+ */
+typedef void (*PHYSFS_TraceCallback)(void *data,
+                                     const PHYSFS_TraceEvent *event);
+
+
+/**
+ * \fn void PHYSFS_setTraceHook(PHYSFS_TraceCallback cb, void *data)
+ * \brief Have PhysicsFS report when things start and finish.
+ *
+ * This is for profilers: hook it up to something that draws timelines, and
+ *  you can see exactly which file load stalled a frame, and whether it was
+ *  waiting on the disk or on decompression.
+ *
+ * PhysicsFS calls (cb) when it starts and finishes mounting, opening,
+ *  reading, seeking, closing and enumerating, and when archivers decompress
+ *  something big enough to matter, like a whole .ZIP entry, the part of one
+ *  a seek skips over, or a 7zip block (which might hold many files). The
+ *  (detail) of an open says what kind of archive the file came from, and for
+ *  PHYSFS_TRACE_DECODE, it says what sort of decompressing is going on.
+ *  Seeks that stay inside a file's buffer are too cheap to bother reporting.
+ *
+ * The hook is called from whatever thread is doing the work, often while
+ *  PhysicsFS holds internal locks, so it must be thread safe, it should be
+ *  quick, and it must not call back into PhysicsFS.
+ *
+ * With no hook set (the default), tracing costs next to nothing. Set the
+ *  hook while no other threads are using PhysicsFS. The hook stays set
+ *  across PHYSFS_deinit() and PHYSFS_init().
+ *
+ *   \param cb Function to call with each event, or NULL to stop tracing.
+ *   \param data Passed to (cb) as-is.
+ *
+ * \sa PHYSFS_getStats
+ */
+PHYSFS_DECL void PHYSFS_setTraceHook(PHYSFS_TraceCallback cb, void *data);
+
+
+/**
+ * \fn int PHYSFS_setIgnoreCase(const char *dir, int enable)
+ * \brief Look up files in a mounted archive without regard to case.
+ *
+ * Content authored on Windows tends to refer to "Textures/Wall.PNG" when the
+ *  file is really "textures/wall.png", which only works there because the
+ *  filesystem doesn't care. This makes lookups in one element of the search
+ *  path not care, either: opening, stat'ing, enumerating and
+ *  PHYSFS_getRealDir() all find names that match with PHYSFS_utf8stricmp().
+ *
+ * This does what extras/ignorecase.c does, but much faster. For archives
+ *  (.zip, .7z, and the rest of the built-in formats), PhysicsFS keeps a
+ *  hash of every case-folded name, so a lookup costs one probe whether or
+ *  not the case matches. That hash is built the first time you enable this
+ *  on an archive, and costs a little memory per entry. Native directories,
+ *  .iso images and archivers registered by the application are searched an
+ *  element at a time, enumerating directories only when the exact name
+ *  isn't there.
+ *
+ * Some caveats:
+ *  - An exact match always wins. If an archive has several names that only
+ *    differ by case, and none match exactly, which one you get is undefined.
+ *  - The mount point itself is still matched exactly.
+ *  - Names whose case-folded forms are a different length in UTF-8 than
+ *    what you asked for (the Kelvin sign, for example) aren't found.
+ *  - This doesn't do anything with the write directory.
+ *  - Archives with this enabled are left out of the search path lookup
+ *    index (see PHYSFS_setSearchPathIndex()), and searched in order.
+ *
+ * This is reset when (dir) is unmounted.
+ *
+ *   \param dir directory or archive previously added to the path, in
+ *              platform-dependent notation. This must match the string
+ *              used when adding, even if your string would also reference
+ *              the same file with a different string of characters.
+ *   \param enable non-zero to ignore case, zero to go back to exact matches.
+ *  \return non-zero on success, zero on failure (not mounted, or out of
+ *          memory). Use PHYSFS_getLastErrorCode() to obtain the specific
+ *          error.
+ *
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_utf8stricmp
+ */
+PHYSFS_DECL int PHYSFS_setIgnoreCase(const char *dir, int enable);
+
+
+/**
+ * \fn int PHYSFS_setDirCache(const char *dir, int enable)
+ * \brief Answer lookups in a mounted directory from memory.
+ *
+ * Every lookup in a real directory on the search path normally goes to the
+ *  OS. Mount thirty directories of loose override files, and a file that's
+ *  only in the last archive costs thirty failed stat() calls to find.
+ *
+ * With this enabled on a directory mount, PhysicsFS keeps a snapshot of
+ *  the parts of that directory tree that have been looked at: the first
+ *  lookup, stat or enumeration that reaches into a subdirectory lists it,
+ *  with each entry's stat, and later ones are answered from memory,
+ *  whether the file is there or not. Opening a file that is there still
+ *  goes to the OS, of course.
+ *
+ * The snapshot is kept honest with the OS's change notification (inotify
+ *  on Linux, FSEvents on macOS, ReadDirectoryChangesW() on Windows). Any
+ *  change in a directory that's been looked at throws the whole snapshot
+ *  away, and it's rebuilt as lookups need it, so this is best for trees that
+ *  don't change often. Changes made through PhysicsFS (writing, deleting,
+ *  making directories) are seen right away. Changes made by other
+ *  programs show up as soon as the OS tells us about them, which is
+ *  usually a few milliseconds, but not instant. Access times and the size
+ *  of a file that's still open for writing can lag behind, too.
+ *
+ * Anything the snapshot can't vouch for (paths that go through a symbolic
+ *  link, say, or if the OS runs out of watches) goes to the OS like before.
+ *
+ * Archives already keep their whole directory in memory, so this succeeds
+ *  without doing anything for them. This is reset when (dir) is unmounted.
+ *
+ *   \param dir directory previously added to the path, in platform-dependent
+ *              notation. This must match the string used when adding.
+ *   \param enable non-zero to cache, zero to go back to asking the OS.
+ *  \return non-zero on success, zero on failure (not mounted, or the
+ *          platform has no change notification, which is
+ *          PHYSFS_ERR_UNSUPPORTED). Use PHYSFS_getLastErrorCode() to obtain
+ *          the specific error.
+ *
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_setIgnoreCase
+ */
+PHYSFS_DECL int PHYSFS_setDirCache(const char *dir, int enable);
+
+
+/**
+ * \typedef PHYSFS_WatchCallback
+ * \brief Function signature for PHYSFS_watch() notifications.
+ *
+ * This is called on a PhysicsFS thread when a file you're watching might
+ *  have changed. Only one notification runs at a time. Don't take long,
+ *  and be ready to hand the news over to your own threads.
+ *
+ * You can use most of PhysicsFS from here, including PHYSFS_watch() and
+ *  PHYSFS_unwatch() (even on this same watch). Just don't call
+ *  PHYSFS_deinit().
+ *
+ *   \param data The pointer you passed to PHYSFS_watch().
+ *   \param fname The file you're watching, in platform-independent
+ *                notation, as PhysicsFS sanitized it: no leading '/', and
+ *                no doubled or trailing ones.
+ *
+ * \sa PHYSFS_watch
+ */
+typedef void (*PHYSFS_WatchCallback)(void *data, const char *fname);
+
+
+/**
+ * \fn int PHYSFS_watch(const char *fname, PHYSFS_WatchCallback callback, void *data)
+ * \brief Get told when a file changes, instead of polling for it.
+ *
+ * Watching PHYSFS_getLastModTime() for hot reloading costs a search path
+ *  walk and a stat() for every file, every time. This asks the OS to tell
+ *  us about changes instead (inotify on Linux, FSEvents on macOS,
+ *  ReadDirectoryChangesW() on Windows), so watched files cost nothing until
+ *  something actually happens to them.
+ *
+ * (callback) is called when what (fname) resolves to changes. That means:
+ *  - The file that PHYSFS_openRead() would open is created, deleted,
+ *    written to, replaced or renamed.
+ *  - A different element of the search path starts winning for (fname).
+ *    Say a file appears in a patch directory mounted ahead of the
+ *    archive that had it. Mounting and unmounting count, too.
+ *  - The file of that name in the write directory changes. This works
+ *    whether or not the write directory is in the search path.
+ *
+ * Changes to copies that are hidden behind the winning one don't trigger
+ *  a call. Reports come a few milliseconds after the change, and one
+ *  change (an editor saving a file, say) can cause more than one call.
+ *  Sometimes a call comes when nothing changed at all, if the OS couldn't
+ *  say exactly what happened. Watching a directory tells you when it
+ *  appears, goes away or wins in a different place. It doesn't tell you
+ *  about the files in it.
+ *
+ * Only native directories are watched. Archives are read once, when they
+ *  are mounted, so changing an archive file on disk isn't reported. If a
+ *  directory mounted later can't be watched, it's mounted anyway, and
+ *  changes inside it aren't reported.
+ *
+ * You can watch the same file more than once, with different callbacks or
+ *  data.
+ *
+ *   \param fname File to watch, in platform-independent notation. It doesn't
+ *                need to exist yet.
+ *   \param callback Called when (fname) changes.
+ *   \param data Passed to (callback) untouched.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error. This is PHYSFS_ERR_UNSUPPORTED if
+ *          a native directory is mounted and this platform can't watch
+ *          directories.
+ *
+ * \sa PHYSFS_unwatch
+ * \sa PHYSFS_WatchCallback
+ * \sa PHYSFS_getLastModTime
+ */
+PHYSFS_DECL int PHYSFS_watch(const char *fname, PHYSFS_WatchCallback callback,
+                             void *data);
+
+
+/**
+ * \fn int PHYSFS_unwatch(const char *fname, PHYSFS_WatchCallback callback, void *data)
+ * \brief Stop watching a file.
+ *
+ * This undoes one PHYSFS_watch() with the same arguments. Once it returns,
+ *  that (callback) won't be called again for that watch. When you call it
+ *  from your own watch's callback, though, it returns right away, since
+ *  that callback is still running.
+ *
+ * When nothing is watched anymore, PhysicsFS gives its OS watches back.
+ *
+ *   \param fname File that was watched, in platform-independent notation.
+ *   \param callback The callback passed to PHYSFS_watch().
+ *   \param data The data passed to PHYSFS_watch().
+ *  \return nonzero on success, zero on error (PHYSFS_ERR_NOT_FOUND if there
+ *          is no such watch). Use PHYSFS_getLastErrorCode() to obtain the
+ *          specific error.
+ *
+ * \sa PHYSFS_watch
+ */
+PHYSFS_DECL int PHYSFS_unwatch(const char *fname,
+                               PHYSFS_WatchCallback callback, void *data);
+
+
+/**
+ * \fn int PHYSFS_enumerateGlob(const char *pattern, PHYSFS_EnumerateCallback c, void *d)
+ * \brief Find everything in the search path that matches a wildcard pattern.
+ *
+ * This is like PHYSFS_enumerate(), but instead of listing one directory, it
+ *  reports everything, in any directory, whose full path matches (pattern).
+ *  (pattern) is in platform-independent notation, and each piece of it
+ *  between '/' separators can use these:
+ *
+ *  - '*' matches any number of characters (including none), but not '/'.
+ *  - '?' matches any one character (a whole UTF-8 sequence, not a byte).
+ *  - A piece that is exactly "**" matches any number of directories,
+ *    including none. The pieces "textures", "**" and "*.dds", joined with
+ *    '/', find every .dds file anywhere under "textures". A pattern that
+ *    ends with "**" matches everything under the directory before it.
+ *
+ * Everything else matches itself, case-sensitively, even in archives set up
+ *  with PHYSFS_setIgnoreCase().
+ *
+ * This doesn't list everything and then filter it: it walks down only the
+ *  directories that can still match, looking pieces without wildcards up
+ *  directly, so it's cheap to search a small corner of a huge search path.
+ *  Matches are passed to (c) as they're found, with (origdir) set to the
+ *  directory the match is in (with no leading '/'; the root is "") and
+ *  (fname) set to its name. Directories can match, too. Something that is
+ *  in several search path elements is only reported once, and the order of
+ *  the results isn't defined.
+ *
+ * (c) works the same as it does for PHYSFS_enumerate(): return
+ *  PHYSFS_ENUM_STOP to end the search early (this function still returns
+ *  non-zero), or PHYSFS_ENUM_ERROR to fail with PHYSFS_ERR_APP_CALLBACK.
+ *  The same rules about not changing the search path from the callback
+ *  apply. Symbolic links are left out unless PHYSFS_permitSymbolicLinks()
+ *  allows them.
+ *
+ *   \param pattern Wildcard pattern to match against full paths.
+ *   \param c Callback function to notify about matches.
+ *   \param d Application-defined data passed to callback. Can be NULL.
+ *  \return non-zero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_enumerate
+ * \sa PHYSFS_EnumerateCallback
+ */
+PHYSFS_DECL int PHYSFS_enumerateGlob(const char *pattern,
+                                     PHYSFS_EnumerateCallback c, void *d);
+
+
+/**
+ * \fn int PHYSFS_enumerateUnique(const char *dir, PHYSFS_EnumerateCallback c, void *d)
+ * \brief Enumerate a directory, reporting each name only once.
+ *
+ * PHYSFS_enumerate() calls (c) once for each search path element that has
+ *  something by a given name in (dir), so a name that's in ten mounted
+ *  archives gets reported ten times. This reports it only the first time,
+ *  like the list from PHYSFS_enumerateFiles(), but without building a list:
+ *  names go to (c) as they're found, in whatever order that is.
+ *
+ * PhysicsFS remembers the names it has reported until this returns, which
+ *  costs a little memory per unique name.
+ *
+ * Everything else works like PHYSFS_enumerate(), including what (c) can
+ *  return and what it can't do.
+ *
+ *   \param dir Directory, in platform-independent notation, to enumerate.
+ *   \param c Callback function to notify about search path elements.
+ *   \param d Application-defined data passed to callback. Can be NULL.
+ *  \return non-zero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_enumerate
+ * \sa PHYSFS_enumerateFiles
+ */
+PHYSFS_DECL int PHYSFS_enumerateUnique(const char *dir,
+                                       PHYSFS_EnumerateCallback c, void *d);
+
+
+/**
+ * \fn int PHYSFS_enumerateStat(const char *dir, PHYSFS_EnumerateStatCallback c, void *d)
+ * \brief Enumerate a directory, with each file's metadata.
+ *
+ * This works like PHYSFS_enumerateUnique(), but (c) also gets a PHYSFS_Stat
+ *  for each name, holding what PHYSFS_stat() would report for it: the
+ *  metadata from the first search path element that has that name.
+ *
+ * Listing a directory and then calling PHYSFS_stat() on every name in it
+ *  walks the search path again for each name, and for native directories,
+ *  asks the OS about each file separately. Archives already know everything
+ *  a PHYSFS_Stat needs as they list their contents, and operating systems
+ *  can often hand it over along with the directory listing, so this is
+ *  usually much faster.
+ *
+ * Everything else works like PHYSFS_enumerate(), including what (c) can
+ *  return and what it can't do.
+ *
+ *   \param dir Directory, in platform-independent notation, to enumerate.
+ *   \param c Callback function to notify about search path elements.
+ *   \param d Application-defined data passed to callback. Can be NULL.
+ *  \return non-zero on success, zero on failure. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_enumerateUnique
+ * \sa PHYSFS_stat
+ * \sa PHYSFS_EnumerateStatCallback
+ */
+PHYSFS_DECL int PHYSFS_enumerateStat(const char *dir,
+                                     PHYSFS_EnumerateStatCallback c, void *d);
+
+
+/**
+ * \enum PHYSFS_BufferMode
+ * \brief How a read buffer from PHYSFS_setBuffer() gets used.
+ *
+ * \sa PHYSFS_setBufferMode
+ */
+typedef enum PHYSFS_BufferMode
+{
+    PHYSFS_BUFFER_NORMAL,   /**< Every read goes through the buffer. */
+    PHYSFS_BUFFER_DIRECT,   /**< Reads bigger than the buffer skip it. */
+    PHYSFS_BUFFER_ADAPTIVE  /**< Like DIRECT, and resize it to fit reads. */
+} PHYSFS_BufferMode;
+
+/**
+ * \fn int PHYSFS_setBufferMode(PHYSFS_File *handle, PHYSFS_BufferMode mode)
+ * \brief Decide how a file's read buffer should be used.
+ *
+ * Normally, once PHYSFS_setBuffer() gives a file opened for reading a
+ *  buffer, every read goes through it, one buffer-full at a time, and gets
+ *  copied out to you; that's ideal for lots of little reads, but a waste
+ *  when you want a few megabytes in one go.
+ *
+ * With PHYSFS_BUFFER_DIRECT, a read that's bigger than the buffer takes
+ *  whatever is already buffered, and then reads the rest straight into your
+ *  memory, without touching the buffer.
+ *
+ * PHYSFS_BUFFER_ADAPTIVE does that too, and also watches how you read: if
+ *  you keep working through the file in small sequential reads, the buffer
+ *  grows, so it's refilled less often; if you mostly seek around, or only
+ *  do big reads that skip the buffer, it shrinks, so less data gets read
+ *  ahead and thrown away. It stays somewhere between a kilobyte (or the
+ *  size you asked for, if that's smaller) and a megabyte (or the size you
+ *  asked for, if that's bigger). Calling PHYSFS_setBuffer() again starts
+ *  over with the new size.
+ *
+ * The mode sticks to (handle) across calls to PHYSFS_setBuffer(), but does
+ *  nothing while the file has no buffer. Files start with
+ *  PHYSFS_BUFFER_NORMAL. Buffers for writing aren't affected by this, so
+ *  this fails with PHYSFS_ERR_OPEN_FOR_WRITING on files opened for writing.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param mode One of the PHYSFS_BufferMode values.
+ *  \return nonzero if successful, zero on error.
+ *
+ * \sa PHYSFS_setBuffer
+ */
+PHYSFS_DECL int PHYSFS_setBufferMode(PHYSFS_File *handle,
+                                     PHYSFS_BufferMode mode);
+
+
+/**
+ * \typedef PHYSFS_PathId
+ * \brief A path that PhysicsFS has already checked and remembers.
+ *
+ * Get one from PHYSFS_internPath(), and use it with PHYSFS_openReadId() and
+ *  PHYSFS_statId(). It's an opaque pointer; NULL is never a valid one.
+ *
+ * \sa PHYSFS_internPath
+ */
+typedef struct PHYSFS_InternedPath *PHYSFS_PathId;
+
+
+/**
+ * \fn PHYSFS_PathId PHYSFS_internPath(const char *fname)
+ * \brief Do the string work for a path once, instead of on every call.
+ *
+ * Every function that takes a path copies it, checks it for things like
+ *  ".." and doubled '/' separators, compares it to each mountpoint and
+ *  hashes it again in each archive it looks in. For a file you open over
+ *  and over, that's the same work every time.
+ *
+ * This does the checking once and hands back an id for the path. Passing
+ *  the same path (or one that sanitizes to the same thing) again returns
+ *  the same id. PHYSFS_openReadId() and PHYSFS_statId() then skip the string
+ *  work entirely, and remember which search path element answered last
+ *  time, and where in it. Mounting or unmounting anything, and calling
+ *  PHYSFS_setIgnoreCase() or PHYSFS_permitSymbolicLinks(), makes them look
+ *  again the next time.
+ *
+ * That memory is only used when everything in the search path up to the
+ *  winner is an archive, since those can't change once they're mounted. A
+ *  native directory anywhere before the winner could gain the file at any
+ *  moment, so those lookups walk the search path every time, like
+ *  PHYSFS_openRead() does. They still skip the sanitizing.
+ *
+ * Ids stay valid, and keep their memory, until PHYSFS_deinit(). There's no
+ *  way to free one early, so intern the paths you'll use a lot, not every
+ *  path you see. This is safe to call from any thread.
+ *
+ *   \param fname Path in platform-independent notation. It doesn't need to
+ *                exist.
+ *  \return An id for (fname), or NULL on error (out of memory, or a bad
+ *          path). Use PHYSFS_getLastErrorCode() to obtain the specific
+ *          error.
+ *
+ * \sa PHYSFS_openReadId
+ * \sa PHYSFS_statId
+ * \sa PHYSFS_getPathIdString
+ */
+PHYSFS_DECL PHYSFS_PathId PHYSFS_internPath(const char *fname);
+
+
+/**
+ * \fn const char *PHYSFS_getPathIdString(PHYSFS_PathId id)
+ * \brief Get the path an id stands for.
+ *
+ * This is the path that was passed to PHYSFS_internPath(), as PhysicsFS
+ *  sanitized it: no leading '/', and no doubled or trailing ones.
+ *
+ *   \param id An id from PHYSFS_internPath().
+ *  \return The path. Don't free or change it. It's valid until
+ *          PHYSFS_deinit().
+ *
+ * \sa PHYSFS_internPath
+ */
+PHYSFS_DECL const char *PHYSFS_getPathIdString(PHYSFS_PathId id);
+
+
+/**
+ * \fn PHYSFS_File *PHYSFS_openReadId(PHYSFS_PathId id)
+ * \brief Open an interned path for reading.
+ *
+ * This is PHYSFS_openRead(), for a path you've passed to
+ *  PHYSFS_internPath(). It opens the same file PHYSFS_openRead() would.
+ *  If the file it found last time can't be opened now, it searches again,
+ *  the normal way.
+ *
+ *   \param id An id from PHYSFS_internPath().
+ *  \return A valid PhysicsFS filehandle on success, NULL on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_internPath
+ * \sa PHYSFS_openRead
+ */
+PHYSFS_DECL PHYSFS_File *PHYSFS_openReadId(PHYSFS_PathId id);
+
+
+/**
+ * \fn int PHYSFS_statId(PHYSFS_PathId id, PHYSFS_Stat *stat)
+ * \brief Get information about an interned path.
+ *
+ * This is PHYSFS_stat(), for a path you've passed to PHYSFS_internPath().
+ *  When the search path is all archives, a path that isn't there is
+ *  remembered, too, so asking about it again is nearly free.
+ *
+ *   \param id An id from PHYSFS_internPath().
+ *   \param stat pointer to a structure to fill in with data about (id).
+ *  \return non-zero on success, zero on failure. On failure, the stat's
+ *          contents are undefined. Use PHYSFS_getLastErrorCode() to obtain
+ *          the specific error.
+ *
+ * \sa PHYSFS_internPath
+ * \sa PHYSFS_stat
+ */
+PHYSFS_DECL int PHYSFS_statId(PHYSFS_PathId id, PHYSFS_Stat *stat);
+
+/**
+ * \fn void PHYSFS_utf8FoldCase(const char *src, char *dst, PHYSFS_uint64 len)
+ * \brief Case fold a whole UTF-8 string.
+ *
+ * This runs every codepoint of (src) through PHYSFS_caseFold() and writes
+ *  the result to (dst) as UTF-8. Two strings that PHYSFS_utf8stricmp() says
+ *  are equal fold to the same bytes, so you can fold names once and then
+ *  use strcmp(), or your own hash table, on them.
+ *
+ * Low-ASCII runs are folded many bytes at a time on CPUs that allow it.
+ *
+ * Folding can make a string longer (the German Eszett becomes "ss"), but
+ *  never more than three times longer, so a destination buffer of
+ *  (strlen(src) * 3) + 1 bytes is always enough. Strings that don't fit in
+ *  the destination buffer will be truncated, but will always be
+ *  null-terminated and never have an incomplete UTF-8 sequence at the end.
+ *  Invalid UTF-8 sequences become '?' characters. If the buffer length is
+ *  0, this function does nothing.
+ *
+ *   \param src Null-terminated source string in UTF-8 format.
+ *   \param dst Buffer to store the folded UTF-8 string.
+ *   \param len Size, in bytes, of destination buffer.
+ *
+ * \sa PHYSFS_caseFold
+ * \sa PHYSFS_utf8HashFolded
+ */
+PHYSFS_DECL void PHYSFS_utf8FoldCase(const char *src, char *dst,
+                                     PHYSFS_uint64 len);
+
+
+/**
+ * \fn PHYSFS_uint32 PHYSFS_utf8HashFolded(const char *str)
+ * \brief Hash a UTF-8 string without regard to case.
+ *
+ * Any two strings that PHYSFS_utf8stricmp() says are equal get the same
+ *  hash, so this is what you want for a case-insensitive hash table. It
+ *  folds as it goes, so there's no buffer to allocate. The value is the same
+ *  on every platform.
+ *
+ *   \param str Null-terminated string in UTF-8 format.
+ *  \return The hash value.
+ *
+ * \sa PHYSFS_utf8FoldCase
+ * \sa PHYSFS_utf8stricmp
+ */
+PHYSFS_DECL PHYSFS_uint32 PHYSFS_utf8HashFolded(const char *str);
+
+
+/**
+ * \fn int PHYSFS_utf8IsValid(const char *str)
+ * \brief See if a string is well-formed UTF-8.
+ *
+ * The other UTF-8 functions quietly turn bad sequences into '?' characters.
+ *  This tells you if there are any: bytes that can't start a sequence,
+ *  sequences cut short, overlong encodings, UTF-16 surrogates, and values
+ *  past U+10FFFF or that are U+FFFE or U+FFFF.
+ *
+ * Low-ASCII runs are checked many bytes at a time on CPUs that allow it.
+ *
+ *   \param str Null-terminated string to check.
+ *  \return non-zero if (str) is valid UTF-8, zero if not.
+ */
+PHYSFS_DECL int PHYSFS_utf8IsValid(const char *str);
+
+
+/**
+ * \struct PHYSFS_RangeSource
+ * \brief Where PHYSFS_createRangeIo() gets its bytes from.
+ *
+ * This is the small piece of a remote file that PhysicsFS can't do for you:
+ *  fetching a span of bytes from somewhere. For a file on a web server or
+ *  CDN, fetch() makes an HTTP request with a "Range: bytes=A-B" header and
+ *  length() comes from a HEAD request's Content-Length, using whatever HTTP
+ *  library your app already has. PhysicsFS does the caching, readahead and
+ *  the PHYSFS_Io interface on top.
+ *
+ * fetch() is called from several threads at once, for different spans,
+ *  when PhysicsFS reads ahead, so it must be thread safe.
+ *
+ * \sa PHYSFS_createRangeIo
+ */
+typedef struct PHYSFS_RangeSource
+{
+    /**
+     * \brief Binary compatibility information.
+     *
+     * This must be set to zero at this time. Future versions of this
+     *  struct will increment this field, so we know what a given
+     *  implementation supports.
+     */
+    PHYSFS_uint32 version;
+
+    /**
+     * \brief Instance data for your source.
+     *
+     * Passed to every method. PhysicsFS doesn't look at it.
+     */
+    void *opaque;
+
+    /**
+     * \brief Name for this data, for the disk cache.
+     *
+     * Blocks cached on disk are filed under this string, so it needs to
+     *  change when the data does: a URL with a version or an ETag in it
+     *  works well. Can be NULL if you don't use a disk cache.
+     */
+    const char *name;
+
+    /**
+     * \brief Report the total size of the data, in bytes.
+     *
+     * Called once, by PHYSFS_createRangeIo(). Return -1 and set the error
+     *  with PHYSFS_setErrorCode() if it can't be determined.
+     */
+    PHYSFS_sint64 (*length)(void *opaque);
+
+    /**
+     * \brief Fetch (len) bytes from (offset) into (buf).
+     *
+     * The span is always inside the data. Return the number of bytes
+     *  fetched; anything but (len) is a failure, for which you should set
+     *  the error with PHYSFS_setErrorCode(). Failures aren't cached, so the
+     *  next read of the same bytes calls this again.
+     */
+    PHYSFS_sint64 (*fetch)(void *opaque, void *buf, PHYSFS_uint64 len,
+                           PHYSFS_uint64 offset);
+
+    /**
+     * \brief Clean up.
+     *
+     * Called when the last PHYSFS_Io using this source is destroyed. Free
+     *  (opaque) and whatever else you need to. Can be NULL.
+     */
+    void (*destroy)(void *opaque);
+} PHYSFS_RangeSource;
+
+
+/**
+ * \fn PHYSFS_Io *PHYSFS_createRangeIo(const PHYSFS_RangeSource *src, PHYSFS_uint32 blockSize, PHYSFS_uint32 cacheBlocks, const char *cacheDir)
+ * \brief Make a read-only, cached PHYSFS_Io from a PHYSFS_RangeSource.
+ *
+ * This lets you mount an archive that lives somewhere else, like a
+ *  multi-gigabyte .zip on a CDN, with PHYSFS_mountIo(), without downloading
+ *  it first. Only the pieces that are actually read get fetched: for a
+ *  .zip, that's its central directory at mount time, and then the files
+ *  you open.
+ *
+ * The data is read in fixed-size blocks of (blockSize) bytes, and the last
+ *  (cacheBlocks) blocks used are kept in memory. When reads look
+ *  sequential, the next few blocks are fetched ahead, on background
+ *  threads, so reading through a file in order rarely waits on the
+ *  network. If
+ *  (cacheDir) isn't NULL, fetched blocks are also written to files in that
+ *  directory (in platform-dependent notation, and created if missing), and
+ *  read back from there in later sessions before fetching again. A
+ *  subdirectory of PHYSFS_getPrefDir() is a good place for it.
+ *
+ * Duplicates of the PHYSFS_Io (one for each file opened in a mounted
+ *  archive, for example) share one cache.
+ *
+ * On success, the PHYSFS_Io owns the source: (src) is copied, and its
+ *  destroy() method is called when the last duplicate is destroyed. On
+ *  failure, nothing is called and (src) still belongs to you.
+ *
+ *   \param src The source of the data. Copied, so it can be on the stack.
+ *   \param blockSize Bytes per block, or 0 for a default (64 kilobytes).
+ *   \param cacheBlocks Blocks to keep in memory, or 0 for a default (64).
+ *   \param cacheDir Directory to cache blocks on disk in, or NULL.
+ *  \return A new PHYSFS_Io, NULL on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_RangeSource
+ * \sa PHYSFS_mountIo
+ */
+PHYSFS_DECL PHYSFS_Io *PHYSFS_createRangeIo(const PHYSFS_RangeSource *src,
+                                            PHYSFS_uint32 blockSize,
+                                            PHYSFS_uint32 cacheBlocks,
+                                            const char *cacheDir);
+
+/**
+ * \fn PHYSFS_Io *PHYSFS_createCachedIo(PHYSFS_Io *io, PHYSFS_uint32 blockSize, PHYSFS_uint32 cacheBlocks)
+ * \brief Put a read-ahead block cache in front of a PHYSFS_Io.
+ *
+ * Archivers read in small pieces: a few bytes at a time while parsing a
+ *  directory, a few kilobytes at a time while decompressing. On optical
+ *  media, SD cards and network shares, each of those can be a round trip.
+ *  This wraps (io) in a PHYSFS_Io that reads it in aligned blocks of
+ *  (blockSize) bytes, keeps the last (cacheBlocks) of them in memory, and
+ *  when reads look sequential, reads the next few blocks ahead on
+ *  background threads.
+ *
+ * It's the same cache as PHYSFS_createRangeIo(), without the disk tier,
+ *  and the result is read-only. PHYSFS_mountCached() sets one up for you.
+ *
+ * On success, the new PHYSFS_Io owns (io) and destroys it when the last of
+ *  its duplicates is destroyed; don't use (io) directly after this. On
+ *  failure, (io) is untouched and still yours.
+ *
+ *   \param io The PHYSFS_Io to read through.
+ *   \param blockSize Bytes per block, or 0 for a default (64 kilobytes).
+ *   \param cacheBlocks Blocks to keep in memory, or 0 for a default (64).
+ *  \return A new PHYSFS_Io, NULL on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_mountCached
+ * \sa PHYSFS_createRangeIo
+ */
+PHYSFS_DECL PHYSFS_Io *PHYSFS_createCachedIo(PHYSFS_Io *io,
+                                             PHYSFS_uint32 blockSize,
+                                             PHYSFS_uint32 cacheBlocks);
+
+
+/**
+ * \fn int PHYSFS_mountCached(const char *newDir, const char *mountPoint, int appendToPath, PHYSFS_uint32 blockSize, PHYSFS_uint32 cacheBlocks)
+ * \brief Mount an archive on slow media through a read-ahead block cache.
+ *
+ * This is PHYSFS_mount(), except an archive file is read through
+ *  PHYSFS_createCachedIo(), with (blockSize) and (cacheBlocks) passed
+ *  through, instead of being memory-mapped or read directly. Use it for
+ *  archives on optical media, SD cards or network shares, where many small
+ *  reads cost much more than a few big ones.
+ *
+ * Directories are mounted just like PHYSFS_mount() would; there's nothing
+ *  to cache there.
+ *
+ *   \param newDir directory or archive to add to the path, in
+ *                   platform-dependent notation.
+ *   \param mountPoint Location in the interpolated tree that this archive
+ *                      will be "mounted", in platform-independent notation.
+ *                      NULL or "" is equivalent to "/".
+ *   \param appendToPath nonzero to append to search path, zero to prepend.
+ *   \param blockSize Bytes per block, or 0 for a default (64 kilobytes).
+ *   \param cacheBlocks Blocks to keep in memory, or 0 for a default (64).
+ *  \return nonzero if added to path, zero on failure (bogus archive, dir
+ *          missing, etc). Use PHYSFS_getLastErrorCode() to obtain
+ *          the specific error.
+ *
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_createCachedIo
+ */
+PHYSFS_DECL int PHYSFS_mountCached(const char *newDir, const char *mountPoint,
+                                   int appendToPath, PHYSFS_uint32 blockSize,
+                                   PHYSFS_uint32 cacheBlocks);
+
+
+/**
+ * \enum PHYSFS_PackCompression
+ * \brief How PHYSFS_createPack() compresses the entries that ask for it.
+ *
+ * PhysicsFS can read all of these back. Which ones it can write depends on
+ *  how it was built: deflate needs libdeflate or the system's zlib (the
+ *  bundled decoder only decodes), and Zstandard needs libzstd.
+ *
+ * \sa PHYSFS_PackOptions
+ */
+typedef enum PHYSFS_PackCompression
+{
+    PHYSFS_PACK_STORE,    /**< Don't compress anything.          */
+    PHYSFS_PACK_DEFLATE,  /**< Deflate, which any .zip tool reads. */
+    PHYSFS_PACK_ZSTD      /**< Zstandard: faster to decode.      */
+} PHYSFS_PackCompression;
+
+
+/**
+ * \struct PHYSFS_PackOptions
+ * \brief Settings for PHYSFS_createPack().
+ *
+ * Zero everything but the fields you care about; zeros are good defaults.
+ *
+ * \sa PHYSFS_createPack
+ */
+typedef struct PHYSFS_PackOptions
+{
+    /**
+     * \brief Binary compatibility information.
+     *
+     * This must be set to zero at this time. Future versions of this
+     *  struct will increment this field, so we know what a given
+     *  implementation supports.
+     */
+    PHYSFS_uint32 version;
+
+    /**
+     * \brief How entries that ask for compression get it.
+     *
+     * An entry that doesn't get smaller is stored instead.
+     */
+    PHYSFS_PackCompression compression;
+
+    /**
+     * \brief Compression level, or zero for the method's default.
+     *
+     * 1 to 12 for deflate (with zlib, anything above 9 is 9), 1 to 22
+     *  for Zstandard.
+     */
+    int level;
+
+    /**
+     * \brief Align stored entries' data to this many bytes.
+     *
+     * With 4096 (a page, most places), stored entries can be memory-mapped
+     *  straight out of the pack; see PHYSFS_mapFile(). A power of two up
+     *  to 32768, or zero for no alignment.
+     */
+    PHYSFS_uint32 alignment;
+
+    /**
+     * \brief Threads to compress on, counting the one writing the pack.
+     *
+     * Zero for a default (4). One does everything on the calling thread.
+     */
+    PHYSFS_uint32 threads;
+
+    /**
+     * \brief Modification time for every entry.
+     *
+     * In seconds since the epoch, like PHYSFS_Stat::modtime. The same
+     *  time everywhere keeps packs built from the same data identical,
+     *  byte for byte; it's written as UTC, so the build machine's time zone
+     *  doesn't matter either. Zero is the earliest time a .zip can hold:
+     *  the start of 1980.
+     */
+    PHYSFS_sint64 modtime;
+} PHYSFS_PackOptions;
+
+
+/**
+ * \struct PHYSFS_Pack
+ * \brief A .zip archive being written by PHYSFS_createPack().
+ *
+ * \sa PHYSFS_createPack
+ * \sa PHYSFS_closePack
+ */
+typedef struct PHYSFS_Pack PHYSFS_Pack;
+
+
+/**
+ * \fn PHYSFS_Pack *PHYSFS_createPack(const char *path, const PHYSFS_PackOptions *options)
+ * \brief Start writing a .zip archive.
+ *
+ * This makes the packs that PhysicsFS mounts, without needing a separate
+ *  zip tool: add files with PHYSFS_addToPack() and PHYSFS_addFileToPack(),
+ *  then finish it with PHYSFS_closePack().
+ *
+ * Entries are compressed on a pool of (options->threads) threads, but
+ *  written in the order they were added, so the same files added in the
+ *  same order make the same pack every time. Stored entries are padded
+ *  to (options->alignment), so they can be memory-mapped, and the central
+ *  directory is sorted by name. Entries over 64 megabytes are always
+ *  stored, and written straight through from the calling thread.
+ *
+ * The pack isn't usable until PHYSFS_closePack() succeeds. Only one thread
+ *  should use a given PHYSFS_Pack at a time.
+ *
+ *   \param path Where to write the pack, in platform-dependent notation.
+ *               An existing file there is replaced.
+ *   \param options Settings, or NULL for the defaults: stored entries,
+ *                  unaligned.
+ *  \return A new PHYSFS_Pack, NULL on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error. PHYSFS_ERR_UNSUPPORTED means this
+ *          build can't write (options->compression).
+ *
+ * \sa PHYSFS_addToPack
+ * \sa PHYSFS_addFileToPack
+ * \sa PHYSFS_closePack
+ */
+PHYSFS_DECL PHYSFS_Pack *PHYSFS_createPack(const char *path,
+                                           const PHYSFS_PackOptions *options);
+
+/**
+ * \fn int PHYSFS_addToPack(PHYSFS_Pack *pack, const char *name, const void *buffer, PHYSFS_uint64 len, int compress)
+ * \brief Add a file to a pack from memory.
+ *
+ * (buffer) is copied (or written out right away), so you can reuse it as
+ *  soon as this returns. Parent directories of (name) don't need adding;
+ *  they're implied. Adding the same name twice makes PHYSFS_closePack()
+ *  fail with PHYSFS_ERR_DUPLICATE.
+ *
+ *   \param pack The pack to add to.
+ *   \param name Name in the pack, in platform-independent notation.
+ *   \param buffer The file's contents.
+ *   \param len Bytes in (buffer).
+ *   \param compress nonzero to compress it, zero to store it as-is.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error. Other than for a bad (name),
+ *          once this fails the pack is ruined, and everything after it
+ *          fails, too.
+ *
+ * \sa PHYSFS_addFileToPack
+ */
+PHYSFS_DECL int PHYSFS_addToPack(PHYSFS_Pack *pack, const char *name,
+                                 const void *buffer, PHYSFS_uint64 len,
+                                 int compress);
+
+/**
+ * \fn int PHYSFS_addFileToPack(PHYSFS_Pack *pack, const char *name, const char *filename, int compress)
+ * \brief Add a file from the search path to a pack.
+ *
+ * This is PHYSFS_addToPack(), with the contents read from (filename), as
+ *  PHYSFS_openRead() would find it.
+ *
+ *   \param pack The pack to add to.
+ *   \param name Name in the pack, in platform-independent notation.
+ *   \param filename File to read, in platform-independent notation.
+ *   \param compress nonzero to compress it, zero to store it as-is.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error. As with PHYSFS_addToPack(), this
+ *          ruins the pack, unless it failed on (name), or on opening
+ *          (filename).
+ *
+ * \sa PHYSFS_addToPack
+ */
+PHYSFS_DECL int PHYSFS_addFileToPack(PHYSFS_Pack *pack, const char *name,
+                                     const char *filename, int compress);
+
+/**
+ * \fn int PHYSFS_closePack(PHYSFS_Pack *pack)
+ * \brief Finish writing a pack, and free it.
+ *
+ * This waits for everything still being compressed, writes it, and then
+ *  writes the central directory. (pack) is gone when this returns, either
+ *  way; if it fails, so did the pack, and the file is deleted.
+ *
+ *   \param pack The pack to finish.
+ *  \return nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \sa PHYSFS_createPack
+ */
+PHYSFS_DECL int PHYSFS_closePack(PHYSFS_Pack *pack);
+
+/* Everything above this line is part of the PhysicsFS 3.1 API. */
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,6 +20,34 @@ typedef struct
     CLookToRead lookStream;   /* lzma sdk i/o interface (higher level). */
 } SZIPLookToRead;
 
+/*
+ * Decoded 7zip folders ("solid blocks") are kept in a small per-archive
+ *  cache, so opening several files from the same block only decompresses it
+ *  once, and every open file reads straight out of the shared buffer. Once
+ *  an archive's cached blocks add up to more than the budget set with
+ *  PHYSFS_setSolidBlockCacheBudget(), the least recently used are dropped.
+ *
+ * Big files that sit alone in their own LZMA, LZMA2 or stored folder skip
+ *  the cache entirely: they are decoded incrementally into a buffer the size
+ *  of the LZMA dictionary, so memory use doesn't grow with the file size.
+ *  Seeking backwards in one of these restarts decoding from the beginning.
+ */
+#define SZIP_DEFAULT_BLOCK_CACHE_BUDGET  (32 * 1024 * 1024)
+#define SZIP_STREAM_THRESHOLD            (16 * 1024 * 1024)
+#define SZIP_READBUFSIZE                 (16 * 1024)
+
+static PHYSFS_uint64 blockCacheBudget = SZIP_DEFAULT_BLOCK_CACHE_BUDGET;
+
+/* One SZIPblock is kept for each decoded folder. */
+typedef struct SZIPblock
+{
+    UInt32 folder;            /* folder index in lzma sdk database.  */
+    Byte *data;               /* decoded contents of the folder.     */
+    size_t size;              /* bytes in (data).                    */
+    int refcount;             /* open files, plus one while cached.  */
+    struct SZIPblock *next;   /* next block, less recently used.     */
+} SZIPblock;
+
 /* One SZIPentry is kept for each file in an open 7zip archive. */
 typedef struct
 {
@@ -33,8 +61,41 @@ typedef struct
     __PHYSFS_DirTree tree;    /* manages directory tree.           */
     PHYSFS_Io *io;            /* physfs i/o interface for this archive. */
     CSzArEx db;               /* lzma sdk archive database object. */
+    void *lock;               /* serializes (io) and the block cache.   */
+    SZIPblock *blocks;        /* cached blocks, most recently used first. */
+    PHYSFS_uint64 cachedbytes; /* total size of everything in (blocks). */
 } SZIPinfo;
 
+/* One SZIPblockfile is kept for each open file served from a block. */
+typedef struct
+{
+    SZIPblock *block;         /* block we hold a reference on, or NULL. */
+    const Byte *data;         /* this file's bytes inside (block).  */
+    PHYSFS_uint64 len;        /* size of this file.                 */
+    PHYSFS_uint64 pos;        /* current position in this file.     */
+} SZIPblockfile;
+
+/* One SZIPstream is kept for each open file decoded incrementally. */
+typedef struct
+{
+    SZIPinfo *info;           /* archive this file lives in.        */
+    PHYSFS_Io *io;            /* our own handle on the archive.     */
+    PHYSFS_uint32 dbidx;      /* index into lzma sdk database.      */
+    UInt32 method;            /* k_Copy, k_LZMA or k_LZMA2.         */
+    CLzma2Dec lzma;           /* (lzma.decoder) is used for k_LZMA. */
+    PHYSFS_uint64 packstart;  /* archive offset of compressed data. */
+    PHYSFS_uint64 packsize;   /* bytes of compressed data.          */
+    PHYSFS_uint64 packpos;    /* compressed bytes read so far.      */
+    PHYSFS_uint64 size;       /* uncompressed size of this file.    */
+    PHYSFS_uint64 decoded;    /* bytes produced since the start.    */
+    PHYSFS_uint64 pos;        /* current position in this file.     */
+    size_t dicread;           /* bytes in decoder's dic already read. */
+    UInt32 crc;               /* running crc of the (decoded) bytes. */
+    size_t inpos;             /* next unused byte in (inbuf).       */
+    size_t inlen;             /* bytes available in (inbuf).        */
+    Byte inbuf[SZIP_READBUFSIZE];  /* compressed data, read ahead.  */
+} SZIPstream;
+
 
 static PHYSFS_ErrorCode szipErrorCode(const SRes rc)
 {
@@ -181,14 +242,20 @@ static int szipLoadEntry(SZIPinfo *info, const PHYSFS_uint32 idx)
 } /* szipLoadEntry */
 
 
+static PHYSFS_Io *szipOpenEntry(void *opaque, void *_entry);
+static int szipStatEntry(void *opaque, void *_entry, PHYSFS_Stat *stat);
+
 static int szipLoadEntries(SZIPinfo *info)
 {
     int retval = 0;
 
-    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry)))
+    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry),
+                             info->db.NumFiles, 0))
     {
         const PHYSFS_uint32 count = info->db.NumFiles;
         PHYSFS_uint32 i;
+        info->tree.openEntry = szipOpenEntry;
+        info->tree.statEntry = szipStatEntry;
         for (i = 0; i < count; i++)
             BAIL_IF_ERRPASS(!szipLoadEntry(info, i), 0);
         retval = 1;
@@ -198,11 +265,29 @@ static int szipLoadEntries(SZIPinfo *info)
 } /* szipLoadEntries */
 
 
+static void szipReleaseBlock(SZIPblock *block)
+{
+    if ((block != NULL) && (__PHYSFS_ATOMIC_DECR(&block->refcount) == 0))
+    {
+        SZIP_ISzAlloc_Free(NULL, block->data);
+        allocator.Free(block);
+    } /* if */
+} /* szipReleaseBlock */
+
+
 static void SZIP_closeArchive(void *opaque)
 {
     SZIPinfo *info = (SZIPinfo *) opaque;
     if (info)
     {
+        while (info->blocks != NULL)
+        {
+            SZIPblock *next = info->blocks->next;
+            szipReleaseBlock(info->blocks);
+            info->blocks = next;
+        } /* while */
+        if (info->lock)
+            __PHYSFS_platformDestroyMutex(info->lock);
         if (info->io)
             info->io->destroy(info->io);
         SzArEx_Free(&info->db, &SZIP_SzAlloc);
@@ -236,6 +321,9 @@ static void *SZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     SzArEx_Init(&info->db);
 
+    info->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF(!info->lock, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+
     info->io = io;
 
     szipInitStream(&stream, io);
@@ -253,65 +341,650 @@ failed:
 } /* SZIP_openArchive */
 
 
-static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+/* MAKE SURE you hold (info->lock) before calling this! */
+static SZIPblock *szipFindBlock(SZIPinfo *info, const UInt32 folder)
 {
-    /* !!! FIXME: the current lzma sdk C API only allows you to decompress
-       !!! FIXME:  the entire file at once, which isn't ideal. Fix this in the
-       !!! FIXME:  SDK and then convert this all to a streaming interface. */
+    SZIPblock *prev = NULL;
+    SZIPblock *block;
 
-    SZIPinfo *info = (SZIPinfo *) opaque;
-    SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+    for (block = info->blocks; block != NULL; block = block->next)
+    {
+        if (block->folder == folder)
+        {
+            if (prev != NULL)  /* move to front of LRU list. */
+            {
+                prev->next = block->next;
+                block->next = info->blocks;
+                info->blocks = block;
+            } /* if */
+            return block;
+        } /* if */
+        prev = block;
+    } /* for */
+
+    return NULL;
+} /* szipFindBlock */
+
+
+/* MAKE SURE you hold (info->lock) before calling this! */
+static void szipTrimBlockCache(SZIPinfo *info)
+{
+    while ((info->blocks != NULL) && (info->cachedbytes > blockCacheBudget))
+    {
+        SZIPblock *prev = NULL;
+        SZIPblock *block = info->blocks;
+        while (block->next != NULL)
+        {
+            prev = block;
+            block = block->next;
+        } /* while */
+
+        if (prev != NULL)
+            prev->next = NULL;
+        else
+            info->blocks = NULL;
+
+        info->cachedbytes -= block->size;
+        szipReleaseBlock(block);  /* open files might still hold it. */
+    } /* while */
+} /* szipTrimBlockCache */
+
+
+static PHYSFS_sint64 SZIP_blockRead(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    SZIPblockfile *finfo = (SZIPblockfile *) io->opaque;
+    const PHYSFS_uint64 avail = finfo->len - finfo->pos;
+
+    if (len > avail)
+        len = avail;
+
+    if (len > 0)
+    {
+        memcpy(buf, finfo->data + finfo->pos, (size_t) len);
+        finfo->pos += len;
+    } /* if */
+
+    return (PHYSFS_sint64) len;
+} /* SZIP_blockRead */
+
+static PHYSFS_sint64 SZIP_write(PHYSFS_Io *io, const void *b, PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, -1);
+} /* SZIP_write */
+
+static int SZIP_blockSeek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPblockfile *finfo = (SZIPblockfile *) io->opaque;
+    BAIL_IF(offset > finfo->len, PHYSFS_ERR_PAST_EOF, 0);
+    finfo->pos = offset;
+    return 1;
+} /* SZIP_blockSeek */
+
+static PHYSFS_sint64 SZIP_blockTell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPblockfile *) io->opaque)->pos;
+} /* SZIP_blockTell */
+
+static PHYSFS_sint64 SZIP_blockLength(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPblockfile *) io->opaque)->len;
+} /* SZIP_blockLength */
+
+static PHYSFS_Io *szipCreateBlockIo(SZIPblock *block, const Byte *data,
+                                    const PHYSFS_uint64 len);
+
+static PHYSFS_Io *SZIP_blockDuplicate(PHYSFS_Io *io)
+{
+    SZIPblockfile *finfo = (SZIPblockfile *) io->opaque;
+    return szipCreateBlockIo(finfo->block, finfo->data, finfo->len);
+} /* SZIP_blockDuplicate */
+
+static int SZIP_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
+
+static void SZIP_blockDestroy(PHYSFS_Io *io)
+{
+    SZIPblockfile *finfo = (SZIPblockfile *) io->opaque;
+    szipReleaseBlock(finfo->block);
+    allocator.Free(finfo);
+    allocator.Free(io);
+} /* SZIP_blockDestroy */
+
+static PHYSFS_sint64 SZIP_blockReadAt(PHYSFS_Io *io, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const SZIPblockfile *finfo = (const SZIPblockfile *) io->opaque;
+
+    if (offset >= finfo->len)
+        return 0;
+
+    if (len > finfo->len - offset)
+        len = finfo->len - offset;
+
+    memcpy(buf, finfo->data + offset, (size_t) len);
+    return (PHYSFS_sint64) len;
+} /* SZIP_blockReadAt */
+
+
+static const PHYSFS_Io SZIP_BlockIo =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_blockRead,
+    SZIP_write,
+    SZIP_blockSeek,
+    SZIP_blockTell,
+    SZIP_blockLength,
+    SZIP_blockDuplicate,
+    SZIP_flush,
+    SZIP_blockDestroy,
+    SZIP_blockReadAt
+};
+
+
+/* On success, the new Io holds its own reference on (block). */
+static PHYSFS_Io *szipCreateBlockIo(SZIPblock *block, const Byte *data,
+                                    const PHYSFS_uint64 len)
+{
+    SZIPblockfile *finfo = NULL;
+    PHYSFS_Io *retval = NULL;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    finfo = (SZIPblockfile *) allocator.Malloc(sizeof (SZIPblockfile));
+    if (!finfo)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    if (block != NULL)
+        __PHYSFS_ATOMIC_INCR(&block->refcount);
+
+    finfo->block = block;
+    finfo->data = data;
+    finfo->len = len;
+    finfo->pos = 0;
+
+    memcpy(retval, &SZIP_BlockIo, sizeof (*retval));
+    retval->opaque = finfo;
+    return retval;
+} /* szipCreateBlockIo */
+
+
+static PHYSFS_Io *szipOpenBlockFile(SZIPinfo *info, const PHYSFS_uint32 idx)
+{
+    const UInt32 folder = info->db.FileToFolder[idx];
     ISzAlloc *alloc = &SZIP_SzAlloc;
     SZIPLookToRead stream;
+    SZIPblock *block = NULL;
     PHYSFS_Io *retval = NULL;
-    PHYSFS_Io *io = NULL;
-    UInt32 blockIndex = 0xFFFFFFFF;
+    UInt32 blockIndex = folder;
     Byte *outBuffer = NULL;
     size_t outBufferSize = 0;
     size_t offset = 0;
     size_t outSizeProcessed = 0;
-    void *buf = NULL;
     SRes rc;
 
-    BAIL_IF_ERRPASS(!entry, NULL);
-    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
+    if (folder == (UInt32) -1)  /* no data stream at all: empty file. */
+        return szipCreateBlockIo(NULL, NULL, 0);
 
-    io = info->io->duplicate(info->io);
-    GOTO_IF_ERRPASS(!io, SZIP_openRead_failed);
+    __PHYSFS_platformGrabMutex(info->lock);
 
-    szipInitStream(&stream, io);
+    block = szipFindBlock(info, folder);
+    if (block != NULL)
+    {
+        outBuffer = block->data;
+        outBufferSize = block->size;
+    } /* if */
 
-    rc = SzArEx_Extract(&info->db, &stream.lookStream.s, entry->dbidx,
+    /* this only decompresses when (outBuffer) isn't this block already. */
+    if ((__PHYSFS_TRACING) && (block == NULL))
+        __PHYSFS_trace(PHYSFS_TRACE_DECODE, 0, NULL, NULL, "7z block",
+                       NULL, 0, 0);
+    szipInitStream(&stream, info->io);
+    rc = SzArEx_Extract(&info->db, &stream.lookStream.s, idx,
                         &blockIndex, &outBuffer, &outBufferSize, &offset,
                         &outSizeProcessed, alloc, alloc);
-    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), SZIP_openRead_failed);
-
-    io->destroy(io);
-    io = NULL;
+    if ((__PHYSFS_TRACING) && (block == NULL))
+    {
+        __PHYSFS_trace(PHYSFS_TRACE_DECODE, 1, NULL, NULL, "7z block", NULL,
+                       0, (rc == SZ_OK) ? (PHYSFS_sint64) outBufferSize : 0);
+    } /* if */
+    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), SZIP_openBlockFile_failed);
 
-    buf = allocator.Malloc(outSizeProcessed);
-    GOTO_IF(rc != SZ_OK, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openRead_failed);
-    memcpy(buf, outBuffer + offset, outSizeProcessed);
+    if (block == NULL)
+    {
+        block = (SZIPblock *) allocator.Malloc(sizeof (SZIPblock));
+        GOTO_IF(!block, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openBlockFile_failed);
+        block->folder = folder;
+        block->data = outBuffer;
+        block->size = outBufferSize;
+        block->refcount = 1;  /* the cache's reference. */
+        block->next = info->blocks;
+        info->blocks = block;
+        info->cachedbytes += outBufferSize;
+    } /* if */
 
-    alloc->Free(alloc, outBuffer);
-    outBuffer = NULL;
+    retval = szipCreateBlockIo(block, outBuffer + offset, outSizeProcessed);
 
-    retval = __PHYSFS_createMemoryIo(buf, outSizeProcessed, allocator.Free);
-    GOTO_IF_ERRPASS(!retval, SZIP_openRead_failed);
+    /* if this pushed (block) itself out of the cache, (retval) keeps it. */
+    szipTrimBlockCache(info);
+    __PHYSFS_platformReleaseMutex(info->lock);
 
     return retval;
 
-SZIP_openRead_failed:
-    if (io != NULL)
-        io->destroy(io);
+SZIP_openBlockFile_failed:
+    if ((block == NULL) && (outBuffer != NULL))
+        alloc->Free(alloc, outBuffer);
+    __PHYSFS_platformReleaseMutex(info->lock);
+    return NULL;
+} /* szipOpenBlockFile */
 
-    if (buf)
-        allocator.Free(buf);
 
-    if (outBuffer)
-        alloc->Free(alloc, outBuffer);
+/* Returns non-zero if (idx) is a big file alone in a folder that we can
+   decode incrementally with a buffer much smaller than the file. */
+static int szipCanStream(const SZIPinfo *info, const PHYSFS_uint32 idx,
+                         CSzFolder *folder)
+{
+    const CSzAr *ar = &info->db.db;
+    const UInt32 fo = info->db.FileToFolder[idx];
+    const PHYSFS_uint64 size = SzArEx_GetFileSize(&info->db, idx);
+    const CSzCoderInfo *coder;
+    const Byte *props;
+    CLzmaProps lzmaprops;
+    CSzData sd;
+    SRes rc;
+
+    if ((fo == (UInt32) -1) || (size < SZIP_STREAM_THRESHOLD))
+        return 0;
+    else if (SzAr_GetFolderUnpackSize(ar, fo) != size)
+        return 0;  /* solid block; these go through the block cache. */
+
+    sd.Data = ar->CodersData + ar->FoCodersOffsets[fo];
+    sd.Size = ar->FoCodersOffsets[fo + 1] - ar->FoCodersOffsets[fo];
+    if (SzGetNextFolderItem(folder, &sd) != SZ_OK)
+        return 0;
+    else if ((folder->NumCoders != 1) || (folder->NumPackStreams != 1))
+        return 0;  /* filters like BCJ want the whole block at once. */
+
+    coder = &folder->Coders[0];
+    props = ar->CodersData + ar->FoCodersOffsets[fo] + coder->PropsOffset;
+    if (coder->MethodID == k_Copy)
+        return 1;
+    else if (coder->MethodID == k_LZMA)
+    {
+        if (LzmaProps_Decode(&lzmaprops, props, coder->PropsSize) != SZ_OK)
+            return 0;
+    } /* else if */
+    else if (coder->MethodID == k_LZMA2)
+    {
+        Byte oldprops[LZMA_PROPS_SIZE];
+        if (coder->PropsSize != 1)
+            return 0;
+        else if (Lzma2Dec_GetOldProps(props[0], oldprops) != SZ_OK)
+            return 0;
+
+        rc = LzmaProps_Decode(&lzmaprops, oldprops, LZMA_PROPS_SIZE);
+        if (rc != SZ_OK)
+            return 0;
+    } /* else if */
+    else
+    {
+        return 0;
+    } /* else */
+
+    /* no point if the dictionary is as big as the file itself. */
+    return (((PHYSFS_uint64) lzmaprops.dicSize) < size);
+} /* szipCanStream */
+
+
+static int szipStreamReset(SZIPstream *finfo)
+{
+    BAIL_IF_ERRPASS(!finfo->io->seek(finfo->io, finfo->packstart), 0);
+    finfo->packpos = 0;
+    finfo->inpos = finfo->inlen = 0;
+    finfo->decoded = 0;
+    finfo->pos = 0;
+    finfo->dicread = 0;
+    finfo->crc = CRC_INIT_VAL;
+    if (finfo->method == k_LZMA2)
+        Lzma2Dec_Init(&finfo->lzma);
+    else if (finfo->method == k_LZMA)
+        LzmaDec_Init(&finfo->lzma.decoder);
+    return 1;
+} /* szipStreamReset */
+
+
+/* Call this once every byte of the file went through (finfo->crc). */
+static int szipStreamVerify(const SZIPstream *finfo)
+{
+    const CSzArEx *db = &finfo->info->db;
+    const UInt32 folder = db->FileToFolder[finfo->dbidx];
+    const UInt32 crc = CRC_GET_DIGEST(finfo->crc);
+
+    if (SzBitWithVals_Check(&db->CRCs, finfo->dbidx))
+        BAIL_IF(crc != db->CRCs.Vals[finfo->dbidx], PHYSFS_ERR_CORRUPT, 0);
+    else if (SzBitWithVals_Check(&db->db.FolderCRCs, folder))
+        BAIL_IF(crc != db->db.FolderCRCs.Vals[folder], PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* szipStreamVerify */
+
+
+/* Decode some more of the file into the decoder's dictionary buffer. */
+static int szipStreamDecode(SZIPstream *finfo)
+{
+    CLzmaDec *dec = &finfo->lzma.decoder;
+    const PHYSFS_uint64 remaining = finfo->size - finfo->decoded;
+    ELzmaStatus status;
+    SizeT dicpos;
+    SizeT diclimit;
+    SizeT inlen;
+    SRes rc;
+
+    if (dec->dicPos == dec->dicBufSize)  /* wrap the dictionary around. */
+    {
+        dec->dicPos = 0;
+        finfo->dicread = 0;
+    } /* if */
+
+    dicpos = dec->dicPos;
+    diclimit = dec->dicBufSize;
+    if ((PHYSFS_uint64) (diclimit - dicpos) > remaining)
+        diclimit = dicpos + (SizeT) remaining;
+
+    if ((finfo->inpos == finfo->inlen) && (finfo->packpos < finfo->packsize))
+    {
+        PHYSFS_Io *io = finfo->io;
+        PHYSFS_uint64 want = finfo->packsize - finfo->packpos;
+        PHYSFS_sint64 br;
+        if (want > SZIP_READBUFSIZE)
+            want = SZIP_READBUFSIZE;
+        br = io->read(io, finfo->inbuf, want);
+        BAIL_IF_ERRPASS(br < 0, 0);
+        BAIL_IF(br == 0, PHYSFS_ERR_CORRUPT, 0);
+        finfo->inpos = 0;
+        finfo->inlen = (size_t) br;
+        finfo->packpos += (PHYSFS_uint64) br;
+    } /* if */
+
+    inlen = (SizeT) (finfo->inlen - finfo->inpos);
+    if (finfo->method == k_LZMA2)
+    {
+        rc = Lzma2Dec_DecodeToDic(&finfo->lzma, diclimit,
+                                  finfo->inbuf + finfo->inpos, &inlen,
+                                  LZMA_FINISH_ANY, &status);
+    } /* if */
+    else
+    {
+        rc = LzmaDec_DecodeToDic(dec, diclimit,
+                                 finfo->inbuf + finfo->inpos, &inlen,
+                                 LZMA_FINISH_ANY, &status);
+    } /* else */
+
+    BAIL_IF(rc != SZ_OK, szipErrorCode(rc), 0);
+    BAIL_IF((inlen == 0) && (dec->dicPos == dicpos), PHYSFS_ERR_CORRUPT, 0);
+
+    finfo->inpos += (size_t) inlen;
+    finfo->crc = g_CrcUpdate(finfo->crc, dec->dic + dicpos,
+                             dec->dicPos - dicpos, g_CrcTable);
+    finfo->decoded += (PHYSFS_uint64) (dec->dicPos - dicpos);
+
+    if (finfo->decoded == finfo->size)
+        BAIL_IF_ERRPASS(!szipStreamVerify(finfo), 0);
+
+    return 1;
+} /* szipStreamDecode */
+
+
+/* (buf) can be NULL to just skip ahead. */
+static PHYSFS_sint64 szipStreamRead(SZIPstream *finfo, void *buf,
+                                    PHYSFS_uint64 len)
+{
+    CLzmaDec *dec = &finfo->lzma.decoder;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buf;
+    const PHYSFS_uint64 avail = finfo->size - finfo->pos;
+    PHYSFS_uint64 total = 0;
+
+    if (len > avail)
+        len = avail;
+
+    if (finfo->method == k_Copy)
+    {
+        PHYSFS_Io *io = finfo->io;
+        const int sequential = (finfo->pos == finfo->decoded);
+        PHYSFS_sint64 br;
+
+        if (len == 0)
+            return 0;
+        else if (ptr == NULL)
+        {
+            finfo->pos += len;
+            return (PHYSFS_sint64) len;
+        } /* else if */
+
+        BAIL_IF_ERRPASS(!io->seek(io, finfo->packstart + finfo->pos), -1);
+        br = io->read(io, ptr, len);
+        BAIL_IF_ERRPASS(br < 0, -1);
+        finfo->pos += (PHYSFS_uint64) br;
+
+        /* only a straight read from start to end can check the crc. */
+        if (sequential)
+        {
+            finfo->crc = g_CrcUpdate(finfo->crc, ptr, (size_t) br, g_CrcTable);
+            finfo->decoded += (PHYSFS_uint64) br;
+            if (finfo->decoded == finfo->size)
+                BAIL_IF_ERRPASS(!szipStreamVerify(finfo), -1);
+        } /* if */
+        return br;
+    } /* if */
+
+    while (total < len)
+    {
+        PHYSFS_uint64 cpy = (PHYSFS_uint64) (dec->dicPos - finfo->dicread);
+        if (cpy == 0)
+        {
+            if (!szipStreamDecode(finfo))
+                return (total > 0) ? (PHYSFS_sint64) total : -1;
+            continue;
+        } /* if */
+
+        if (cpy > (len - total))
+            cpy = len - total;
+
+        if (ptr != NULL)
+            memcpy(ptr + total, dec->dic + finfo->dicread, (size_t) cpy);
+        finfo->dicread += (size_t) cpy;
+        finfo->pos += cpy;
+        total += cpy;
+    } /* while */
+
+    return (PHYSFS_sint64) total;
+} /* szipStreamRead */
+
+
+static PHYSFS_sint64 SZIP_streamRead(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len)
+{
+    return szipStreamRead((SZIPstream *) io->opaque, buf, len);
+} /* SZIP_streamRead */
+
+static int SZIP_streamSeek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPstream *finfo = (SZIPstream *) io->opaque;
+
+    BAIL_IF(offset > finfo->size, PHYSFS_ERR_PAST_EOF, 0);
+
+    if (finfo->method == k_Copy)
+    {
+        finfo->pos = offset;
+        return 1;
+    } /* if */
+
+    if (offset < finfo->pos)
+    {
+        const PHYSFS_uint64 back = finfo->pos - offset;
+        if (back <= (PHYSFS_uint64) finfo->dicread)  /* still in the dic. */
+        {
+            finfo->dicread -= (size_t) back;
+            finfo->pos = offset;
+            return 1;
+        } /* if */
+
+        BAIL_IF_ERRPASS(!szipStreamReset(finfo), 0);
+    } /* if */
+
+    while (finfo->pos < offset)
+    {
+        const PHYSFS_sint64 rc = szipStreamRead(finfo, NULL,
+                                                offset - finfo->pos);
+        BAIL_IF_ERRPASS(rc <= 0, 0);
+    } /* while */
+
+    return 1;
+} /* SZIP_streamSeek */
+
+static PHYSFS_sint64 SZIP_streamTell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->pos;
+} /* SZIP_streamTell */
+
+static PHYSFS_sint64 SZIP_streamLength(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->size;
+} /* SZIP_streamLength */
+
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const PHYSFS_uint32 idx,
+                                 const CSzFolder *folder);
+
+static PHYSFS_Io *SZIP_streamDuplicate(PHYSFS_Io *io)
+{
+    SZIPstream *finfo = (SZIPstream *) io->opaque;
+    SZIPinfo *info = finfo->info;
+    CSzFolder folder;
+    const int rc = szipCanStream(info, finfo->dbidx, &folder);
+    assert(rc);  /* it worked when we first opened this. */
+    (void) rc;
+    return szipOpenStream(info, finfo->dbidx, &folder);
+} /* SZIP_streamDuplicate */
+
+static void SZIP_streamDestroy(PHYSFS_Io *io)
+{
+    SZIPstream *finfo = (SZIPstream *) io->opaque;
+    if (finfo->method != k_Copy)
+    {
+        SZIP_ISzAlloc_Free(NULL, finfo->lzma.decoder.dic);
+        LzmaDec_FreeProbs(&finfo->lzma.decoder, &SZIP_SzAlloc);
+    } /* if */
+    finfo->io->destroy(finfo->io);
+    allocator.Free(finfo);
+    allocator.Free(io);
+} /* SZIP_streamDestroy */
+
+
+static const PHYSFS_Io SZIP_StreamIo =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_streamRead,
+    SZIP_write,
+    SZIP_streamSeek,
+    SZIP_streamTell,
+    SZIP_streamLength,
+    SZIP_streamDuplicate,
+    SZIP_flush,
+    SZIP_streamDestroy,
+    NULL  /* the decoder only goes forward. */
+};
+
+
+/* (folder) must have been filled in by a successful szipCanStream(). */
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const PHYSFS_uint32 idx,
+                                 const CSzFolder *folder)
+{
+    const CSzAr *ar = &info->db.db;
+    const UInt32 fo = info->db.FileToFolder[idx];
+    const UInt32 packidx = ar->FoStartPackStreamIndex[fo];
+    const CSzCoderInfo *coder = &folder->Coders[0];
+    const Byte *props = ar->CodersData + ar->FoCodersOffsets[fo]
+                        + coder->PropsOffset;
+    ISzAlloc *alloc = &SZIP_SzAlloc;
+    SZIPstream *finfo = NULL;
+    PHYSFS_Io *retval = NULL;
+    CLzmaDec *dec;
+    SRes rc = SZ_OK;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openStream_failed);
+    finfo = (SZIPstream *) allocator.Malloc(sizeof (SZIPstream));
+    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openStream_failed);
+    memset(finfo, '\0', sizeof (SZIPstream));
+
+    finfo->info = info;
+    finfo->dbidx = idx;
+    finfo->method = coder->MethodID;
+    finfo->packstart = info->db.dataPos + ar->PackPositions[packidx];
+    finfo->packsize = ar->PackPositions[packidx + 1] - ar->PackPositions[packidx];
+    finfo->size = SzArEx_GetFileSize(&info->db, idx);
+
+    dec = &finfo->lzma.decoder;
+    Lzma2Dec_Construct(&finfo->lzma);
+    if (finfo->method == k_LZMA2)
+        rc = Lzma2Dec_AllocateProbs(&finfo->lzma, props[0], alloc);
+    else if (finfo->method == k_LZMA)
+        rc = LzmaDec_AllocateProbs(dec, props, coder->PropsSize, alloc);
+    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), SZIP_openStream_failed);
+
+    if (finfo->method != k_Copy)
+    {
+        dec->dicBufSize = (SizeT) dec->prop.dicSize;
+        dec->dic = (Byte *) allocator.Malloc(dec->dicBufSize);
+        GOTO_IF(!dec->dic, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openStream_failed);
+    } /* if */
+
+    finfo->io = info->io->duplicate(info->io);
+    GOTO_IF_ERRPASS(!finfo->io, SZIP_openStream_failed);
+    GOTO_IF_ERRPASS(!szipStreamReset(finfo), SZIP_openStream_failed);
+
+    memcpy(retval, &SZIP_StreamIo, sizeof (*retval));
+    retval->opaque = finfo;
+    return retval;
+
+SZIP_openStream_failed:
+    if (finfo != NULL)
+    {
+        if (finfo->io != NULL)
+            finfo->io->destroy(finfo->io);
+        SZIP_ISzAlloc_Free(NULL, finfo->lzma.decoder.dic);
+        LzmaDec_FreeProbs(&finfo->lzma.decoder, alloc);
+        allocator.Free(finfo);
+    } /* if */
+
+    if (retval != NULL)
+        allocator.Free(retval);
 
     return NULL;
+} /* szipOpenStream */
+
+
+static PHYSFS_Io *szipOpenEntry(void *opaque, void *_entry)
+{
+    SZIPinfo *info = (SZIPinfo *) opaque;
+    SZIPentry *entry = (SZIPentry *) _entry;
+    CSzFolder folder;
+
+    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
+
+    if (szipCanStream(info, entry->dbidx, &folder))
+        return szipOpenStream(info, entry->dbidx, &folder);
+
+    return szipOpenBlockFile(info, entry->dbidx);
+} /* szipOpenEntry */
+
+
+static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+{
+    SZIPinfo *info = (SZIPinfo *) opaque;
+    SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+    BAIL_IF_ERRPASS(!entry, NULL);
+    return szipOpenEntry(opaque, entry);
 } /* SZIP_openRead */
 
 
@@ -348,15 +1021,11 @@ static inline PHYSFS_uint64 lzmasdkTimeToPhysfsTime(const CNtfsFileTime *t)
 } /* lzmasdkTimeToPhysfsTime */
 
 
-static int SZIP_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+static int szipStatEntry(void *opaque, void *_entry, PHYSFS_Stat *stat)
 {
     SZIPinfo *info = (SZIPinfo *) opaque;
-    SZIPentry *entry;
-    PHYSFS_uint32 idx;
-
-    entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
-    BAIL_IF_ERRPASS(!entry, 0);
-    idx = entry->dbidx;
+    const SZIPentry *entry = (const SZIPentry *) _entry;
+    const PHYSFS_uint32 idx = entry->dbidx;
 
     if (entry->tree.isdir)
     {
@@ -387,9 +1056,30 @@ static int SZIP_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
 	stat->readonly = 1;
 
     return 1;
+} /* szipStatEntry */
+
+
+static int SZIP_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+{
+    SZIPinfo *info = (SZIPinfo *) opaque;
+    SZIPentry *entry;
+
+    entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+    BAIL_IF_ERRPASS(!entry, 0);
+    return szipStatEntry(opaque, entry, stat);
 } /* SZIP_stat */
 
 
+static PHYSFS_EnumerateCallbackResult SZIP_enumerateStat(void *opaque,
+                               const char *dname,
+                               PHYSFS_EnumerateStatCallback cb,
+                               const char *origdir, void *callbackdata)
+{
+    return __PHYSFS_DirTreeEnumerateStat(opaque, dname, cb, origdir,
+                                         callbackdata, szipStatEntry);
+} /* SZIP_enumerateStat */
+
+
 void SZIP_global_init(void)
 {
     /* this just needs to calculate some things, so it only ever
@@ -403,6 +1093,152 @@ void SZIP_global_init(void)
 } /* SZIP_global_init */
 
 
+void SZIP_setBlockCacheBudget(const PHYSFS_uint64 budget)
+{
+    blockCacheBudget = budget;
+} /* SZIP_setBlockCacheBudget */
+
+
+/*
+ * Raw LZMA streams, for other archivers (ZIP's compression method 14), so
+ *  they don't need their own copy of the LZMA SDK. Like our streamed files,
+ *  these decode through a circular dictionary buffer, which shrinks to the
+ *  size of the whole output if that's smaller than the dictionary.
+ */
+typedef struct
+{
+    CLzmaDec decoder;           /* LZMA SDK's state.                   */
+    PHYSFS_uint64 size;         /* total uncompressed size.            */
+    PHYSFS_uint64 decoded;      /* bytes the decoder has produced.     */
+    SizeT dicread;              /* bytes of the dictionary handed out. */
+} SZIPlzma;
+
+void *SZIP_lzmaCreate(const PHYSFS_uint8 *props, const size_t propslen,
+                      const PHYSFS_uint64 size)
+{
+    SZIPlzma *lzma = (SZIPlzma *) allocator.Malloc(sizeof (SZIPlzma));
+    CLzmaDec *dec;
+    SRes rc;
+
+    BAIL_IF(!lzma, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(lzma, '\0', sizeof (SZIPlzma));
+    lzma->size = size;
+
+    dec = &lzma->decoder;
+    LzmaDec_Construct(dec);
+    rc = LzmaDec_AllocateProbs(dec, props, (unsigned) propslen, &SZIP_SzAlloc);
+    if (rc != SZ_OK)
+    {
+        allocator.Free(lzma);
+        BAIL(szipErrorCode(rc), NULL);
+    } /* if */
+
+    dec->dicBufSize = (SizeT) dec->prop.dicSize;
+    if (((PHYSFS_uint64) dec->dicBufSize) > size)
+        dec->dicBufSize = (SizeT) (size ? size : 1);
+    dec->dic = (Byte *) allocator.Malloc(dec->dicBufSize);
+    if (!dec->dic)
+    {
+        LzmaDec_FreeProbs(dec, &SZIP_SzAlloc);
+        allocator.Free(lzma);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    LzmaDec_Init(dec);
+    return lzma;
+} /* SZIP_lzmaCreate */
+
+
+int SZIP_lzmaDecode(void *opaque, const PHYSFS_uint8 **in, size_t *inlen,
+                    PHYSFS_uint8 **out, size_t *outlen)
+{
+    SZIPlzma *lzma = (SZIPlzma *) opaque;
+    CLzmaDec *dec = &lzma->decoder;
+
+    while (*outlen > 0)
+    {
+        const PHYSFS_uint64 remaining = lzma->size - lzma->decoded;
+        SizeT cpy = dec->dicPos - lzma->dicread;
+        SizeT dicpos;
+        SizeT diclimit;
+        SizeT srclen;
+        ELzmaStatus status;
+        SRes rc;
+
+        if (cpy > 0)
+        {
+            if (cpy > *outlen)
+                cpy = (SizeT) *outlen;
+            memcpy(*out, dec->dic + lzma->dicread, cpy);
+            lzma->dicread += cpy;
+            *out += cpy;
+            *outlen -= cpy;
+            continue;
+        } /* if */
+
+        else if (remaining == 0)
+            break;
+
+        if (dec->dicPos == dec->dicBufSize)  /* wrap the dictionary around. */
+        {
+            dec->dicPos = 0;
+            lzma->dicread = 0;
+        } /* if */
+
+        dicpos = dec->dicPos;
+        diclimit = dec->dicBufSize;
+        if ((PHYSFS_uint64) (diclimit - dicpos) > remaining)
+            diclimit = dicpos + (SizeT) remaining;
+
+        srclen = (SizeT) *inlen;
+        rc = LzmaDec_DecodeToDic(dec, diclimit, *in, &srclen,
+                                 LZMA_FINISH_ANY, &status);
+        BAIL_IF(rc != SZ_OK, szipErrorCode(rc), -1);
+        *in += srclen;
+        *inlen -= srclen;
+        lzma->decoded += (PHYSFS_uint64) (dec->dicPos - dicpos);
+
+        if (dec->dicPos == dicpos)
+        {
+            /* an end marker before the end of the file is no good. */
+            BAIL_IF(status == LZMA_STATUS_FINISHED_WITH_MARK,
+                    PHYSFS_ERR_CORRUPT, -1);
+            if (srclen == 0)
+            {
+                BAIL_IF(*inlen > 0, PHYSFS_ERR_CORRUPT, -1);
+                break;  /* need more input. */
+            } /* if */
+        } /* if */
+    } /* while */
+
+    return ((lzma->decoded == lzma->size) && (dec->dicPos == lzma->dicread));
+} /* SZIP_lzmaDecode */
+
+
+void SZIP_lzmaDestroy(void *opaque)
+{
+    SZIPlzma *lzma = (SZIPlzma *) opaque;
+    if (lzma != NULL)
+    {
+        SZIP_ISzAlloc_Free(NULL, lzma->decoder.dic);
+        LzmaDec_FreeProbs(&lzma->decoder, &SZIP_SzAlloc);
+        allocator.Free(lzma);
+    } /* if */
+} /* SZIP_lzmaDestroy */
+
+
+static PHYSFS_DetectResult SZIP_detect(const void *header,
+                                       PHYSFS_uint64 headerLen,
+                                       const void *trailer,
+                                       PHYSFS_uint64 trailerLen)
+{
+    static const PHYSFS_uint8 wantedsig[] = { '7','z',0xBC,0xAF,0x27,0x1C };
+    const int found = ( (headerLen >= sizeof (wantedsig)) &&
+                        (memcmp(header, wantedsig, sizeof (wantedsig)) == 0) );
+    return found ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* SZIP_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_7Z =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -421,7 +1257,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_7Z =
     SZIP_remove,
     SZIP_mkdir,
     SZIP_stat,
-    SZIP_closeArchive
+    SZIP_closeArchive,
+    SZIP_enumerateStat,
+    SZIP_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_7Z */
@@ -12,6 +12,51 @@
 /* There's no PHYSFS_Io interface here. Use __PHYSFS_createNativeIo(). */
 
 
+/*
+ * The metadata cache (see PHYSFS_setDirCache()) is a __PHYSFS_DirTree
+ *  snapshot of the parts of the tree that lookups have reached into: a
+ *  directory's children are read, with their stats, the first time
+ *  something looks inside it, and it's watched for changes from then on.
+ *  Any change anywhere throws the whole snapshot away; it's rebuilt, just
+ *  as lazily, by the next lookup. DirTrees can't lose entries, and loose
+ *  files on a developer's disk don't change often enough to be worth more
+ *  bookkeeping than that.
+ *
+ * (changes) is bumped from the platform's watch thread; the snapshot is
+ *  stale if it moved since we built it, or if (dirCacheGeneration) did,
+ *  which is bumped whenever we write something to disk ourselves, so a
+ *  lookup right after PHYSFS_close() doesn't have to wait on the OS to tell
+ *  us about it.
+ *
+ * Everything else in here is only touched with (lock) held.
+ */
+typedef struct
+{
+    __PHYSFS_DirTreeEntry tree;
+    PHYSFS_Stat stat;
+    int loaded;  /* directories: non-zero once children are in the tree. */
+} DIRcacheEntry;
+
+typedef struct
+{
+    __PHYSFS_DirTree tree;
+    int built;  /* non-zero if (tree) is initialized. */
+    int broken;  /* non-zero if we couldn't watch something: don't trust us. */
+    void *lock;
+    void *watch;
+    PHYSFS_uint64 changes;
+    PHYSFS_uint64 seenChanges;
+    PHYSFS_uint64 seenGeneration;
+} DIRcache;
+
+typedef struct
+{
+    char *base;  /* platform-dependent, with a dir separator at the end. */
+    DIRcache *cache;  /* NULL unless PHYSFS_setDirCache() asked for one. */
+} DIRinfo;
+
+static PHYSFS_uint64 dirCacheGeneration = 0;
+
 
 static char *cvtToDependent(const char *prepend, const char *path,
                             char *buf, const size_t buflen)
@@ -44,7 +89,7 @@ static void *DIR_openArchive(PHYSFS_Io *io, const char *name,
 {
     PHYSFS_Stat st;
     const char dirsep = __PHYSFS_platformDirSeparator;
-    char *retval = NULL;
+    DIRinfo *retval = NULL;
     const size_t namelen = strlen(name);
     const size_t seplen = 1;
 
@@ -55,29 +100,302 @@ static void *DIR_openArchive(PHYSFS_Io *io, const char *name,
         BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
 
     *claimed = 1;
-    retval = allocator.Malloc(namelen + seplen + 1);
+    retval = (DIRinfo *) allocator.Malloc(sizeof (DIRinfo));
     BAIL_IF(retval == NULL, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    retval->cache = NULL;
+    retval->base = (char *) allocator.Malloc(namelen + seplen + 1);
+    if (retval->base == NULL)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
 
-    strcpy(retval, name);
+    strcpy(retval->base, name);
 
     /* make sure there's a dir separator at the end of the string */
-    if (retval[namelen - 1] != dirsep)
+    if (retval->base[namelen - 1] != dirsep)
     {
-        retval[namelen] = dirsep;
-        retval[namelen + 1] = '\0';
+        retval->base[namelen] = dirsep;
+        retval->base[namelen + 1] = '\0';
     } /* if */
 
     return retval;
 } /* DIR_openArchive */
 
 
+/* Throw the snapshot away if anything changed since we built it, and start
+   a fresh one. MAKE SURE you hold cache->lock! */
+static int dirCacheRefresh(DIRinfo *info)
+{
+    DIRcache *cache = info->cache;
+    const PHYSFS_uint64 changes = __PHYSFS_ATOMIC_GET64(&cache->changes);
+    const PHYSFS_uint64 gen = __PHYSFS_ATOMIC_GET64(&dirCacheGeneration);
+    DIRcacheEntry *root;
+
+    if ((cache->built) && (changes == cache->seenChanges) &&
+        (gen == cache->seenGeneration))
+        return 1;  /* still good. */
+
+    if (cache->built)
+    {
+        __PHYSFS_DirTreeDeinit(&cache->tree);
+        cache->built = 0;
+    } /* if */
+
+    /* note these first: a change while we read the disk means another go. */
+    cache->seenChanges = changes;
+    cache->seenGeneration = gen;
+
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeInit(&cache->tree,
+                                          sizeof (DIRcacheEntry), 0, 0), 0);
+    cache->built = 1;
+
+    root = (DIRcacheEntry *) cache->tree.root;
+    BAIL_IF_ERRPASS(!__PHYSFS_platformStat(info->base, &root->stat, 0), 0);
+    root->loaded = 0;
+    return 1;
+} /* dirCacheRefresh */
+
+
+typedef struct
+{
+    DIRcache *cache;
+    const char *dname;  /* platform-independent; "" for the root. */
+} DIRcacheLoadData;
+
+static PHYSFS_EnumerateCallbackResult dirCacheLoadCallback(void *_data,
+                                const char *origdir, const char *fname,
+                                const PHYSFS_Stat *stat)
+{
+    DIRcacheLoadData *data = (DIRcacheLoadData *) _data;
+    const size_t dlen = strlen(data->dname);
+    const size_t len = dlen + strlen(fname) + 2;
+    char *name = (char *) __PHYSFS_smallAlloc(len);
+    DIRcacheEntry *entry;
+
+    BAIL_IF(!name, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    snprintf(name, len, "%s%s%s", data->dname, dlen ? "/" : "", fname);
+    entry = (DIRcacheEntry *) __PHYSFS_DirTreeAdd(&data->cache->tree, name,
+                          stat->filetype == PHYSFS_FILETYPE_DIRECTORY);
+    __PHYSFS_smallFree(name);
+    BAIL_IF_ERRPASS(!entry, PHYSFS_ENUM_ERROR);
+
+    memcpy(&entry->stat, stat, sizeof (PHYSFS_Stat));
+    entry->loaded = 0;
+    return PHYSFS_ENUM_OK;
+} /* dirCacheLoadCallback */
+
+
+/* Read (dir)'s children in, if they aren't yet. MAKE SURE you hold the lock! */
+static int dirCacheLoad(DIRinfo *info, DIRcacheEntry *dir)
+{
+    DIRcache *cache = info->cache;
+    const int isroot = (&dir->tree == cache->tree.root);
+    DIRcacheLoadData data;
+    PHYSFS_EnumerateCallbackResult rc;
+    char *d;
+
+    if (dir->loaded)
+        return 1;
+
+    data.cache = cache;
+    data.dname = isroot ? "" : dir->tree.name;
+    CVT_TO_DEPENDENT(d, info->base, data.dname);
+    BAIL_IF_ERRPASS(!d, 0);
+
+    /* watch it before reading it, so nothing can slip in between. */
+    #ifndef PHYSFS_NO_PLATFORM_WATCH
+    if ((!isroot) && (!__PHYSFS_platformWatchDir(cache->watch, d)))
+    {
+        cache->broken = 1;  /* out of watches, probably. */
+        __PHYSFS_smallFree(d);
+        return 0;
+    } /* if */
+    #endif
+
+    rc = __PHYSFS_platformEnumerateStat(d, dirCacheLoadCallback,
+                                        data.dname, &data);
+    __PHYSFS_smallFree(d);
+    BAIL_IF_ERRPASS(rc == PHYSFS_ENUM_ERROR, 0);
+
+    dir->loaded = 1;
+    return 1;
+} /* dirCacheLoad */
+
+
+/* Can we look inside (entry)? 1 if so, 0 if it's not a directory, -1 if only
+   the OS can say. MAKE SURE you hold cache->lock! */
+static int dirCacheEnter(DIRinfo *info, DIRcacheEntry *entry)
+{
+    if (entry->stat.filetype == PHYSFS_FILETYPE_SYMLINK)
+        return -1;  /* let the OS follow it. */
+    else if (entry->stat.filetype != PHYSFS_FILETYPE_DIRECTORY)
+        return 0;
+    return dirCacheLoad(info, entry) ? 1 : -1;
+} /* dirCacheEnter */
+
+
+/*
+ * Look up (path) in the snapshot, reading in directories on the way there
+ *  (and (path)'s own children, too, if (loadKids)). Returns 1 and sets
+ *  (*_entry) if it's there, and 0 (with PHYSFS_ERR_NOT_FOUND) if it isn't.
+ *  Returns -1 if only the OS can say: an I/O error, a symlink on the way,
+ *  or something we couldn't watch. MAKE SURE you hold cache->lock!
+ */
+static int dirCacheFind(DIRinfo *info, const char *path, const int loadKids,
+                        DIRcacheEntry **_entry)
+{
+    DIRcache *cache = info->cache;
+    DIRcacheEntry *entry;
+
+    if ((cache->broken) || (!dirCacheRefresh(info)))
+        return -1;
+
+    /* anything in the tree got there from a listing of its parent. */
+    entry = (DIRcacheEntry *) __PHYSFS_DirTreeFind(&cache->tree, path);
+    if (!entry)
+    {
+        const size_t len = strlen(path);
+        char *buf = (char *) __PHYSFS_smallAlloc(len + 1);
+        char *ptr;
+        int rc;
+
+        if (!buf)
+            return -1;
+        memcpy(buf, path, len + 1);
+
+        entry = (DIRcacheEntry *) cache->tree.root;
+        ptr = buf;
+        while ((rc = dirCacheEnter(info, entry)) == 1)
+        {
+            char *sep = strchr(ptr, '/');
+            if (sep) *sep = '\0';
+            entry = (DIRcacheEntry *) __PHYSFS_DirTreeFind(&cache->tree, buf);
+            if (!entry)
+                rc = 0;
+            if ((!entry) || (!sep))
+                break;
+            *sep = '/';
+            ptr = sep + 1;
+        } /* while */
+
+        __PHYSFS_smallFree(buf);
+        if (rc == -1)
+            return -1;
+        BAIL_IF(rc == 0, PHYSFS_ERR_NOT_FOUND, 0);
+    } /* if */
+
+    if ((loadKids) && (entry->tree.isdir) && (!dirCacheLoad(info, entry)))
+        return -1;
+
+    *_entry = entry;
+    return 1;
+} /* dirCacheFind */
+
+
+/* A copy of one directory's listing, so callbacks can run without the lock
+   (and do things to the disk that make us throw the snapshot away). */
+typedef struct
+{
+    const char *name;
+    PHYSFS_Stat stat;
+} DIRcacheListItem;
+
+/*
+ * Enumerate (dname) from the cache. Returns zero if only the OS can say,
+ *  and non-zero, with (*retval) set, if the cache answered. (statcb) is
+ *  used instead of (cb) if it isn't NULL.
+ */
+static int dirCacheEnumerate(DIRinfo *info, const char *dname,
+                             PHYSFS_EnumerateCallback cb,
+                             PHYSFS_EnumerateStatCallback statcb,
+                             const char *origdir, void *callbackdata,
+                             PHYSFS_EnumerateCallbackResult *retval)
+{
+    DIRcache *cache = info->cache;
+    const __PHYSFS_DirTreeEntry *child;
+    DIRcacheListItem *items = NULL;
+    DIRcacheEntry *entry = NULL;
+    size_t count = 0;
+    size_t namelen = 0;
+    size_t i;
+    char *ptr;
+    int rc;
+
+    __PHYSFS_platformGrabMutex(cache->lock);
+    rc = dirCacheFind(info, dname, 1, &entry);
+    if ((rc == 1) && (entry->stat.filetype != PHYSFS_FILETYPE_DIRECTORY))
+        rc = -1;  /* let the OS complain about it. */
+
+    if (rc == 1)
+    {
+        for (child = entry->tree.children; child; child = child->sibling)
+        {
+            const char *name = strrchr(child->name, '/');
+            namelen += strlen(name ? name + 1 : child->name) + 1;
+            count++;
+        } /* for */
+
+        items = (DIRcacheListItem *) allocator.Malloc(
+                    (count * sizeof (DIRcacheListItem)) + namelen + 1);
+        if (!items)
+        {
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+            rc = 0;
+        } /* if */
+        else
+        {
+            ptr = (char *) (items + count);
+            i = 0;
+            for (child = entry->tree.children; child; child = child->sibling)
+            {
+                const char *name = strrchr(child->name, '/');
+                name = name ? name + 1 : child->name;
+                strcpy(ptr, name);
+                items[i].name = ptr;
+                memcpy(&items[i].stat, &((const DIRcacheEntry *) child)->stat,
+                       sizeof (PHYSFS_Stat));
+                ptr += strlen(name) + 1;
+                i++;
+            } /* for */
+        } /* else */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(cache->lock);
+
+    if (rc == -1)
+        return 0;  /* ask the OS. */
+
+    *retval = (rc == 1) ? PHYSFS_ENUM_OK : PHYSFS_ENUM_ERROR;
+    for (i = 0; (i < count) && (*retval == PHYSFS_ENUM_OK) && (items); i++)
+    {
+        if (statcb)
+            *retval = statcb(callbackdata, origdir, items[i].name, &items[i].stat);
+        else
+            *retval = cb(callbackdata, origdir, items[i].name);
+        if (*retval == PHYSFS_ENUM_ERROR)
+            PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+    } /* for */
+
+    if (items)
+        allocator.Free(items);
+
+    return 1;
+} /* dirCacheEnumerate */
+
+
 static PHYSFS_EnumerateCallbackResult DIR_enumerate(void *opaque,
                          const char *dname, PHYSFS_EnumerateCallback cb,
                          const char *origdir, void *callbackdata)
 {
+    DIRinfo *info = (DIRinfo *) opaque;
     char *d;
     PHYSFS_EnumerateCallbackResult retval;
-    CVT_TO_DEPENDENT(d, opaque, dname);
+
+    if ((info->cache) && (dirCacheEnumerate(info, dname, cb, NULL, origdir,
+                                            callbackdata, &retval)))
+        return retval;
+
+    CVT_TO_DEPENDENT(d, info->base, dname);
     BAIL_IF_ERRPASS(!d, PHYSFS_ENUM_ERROR);
     retval = __PHYSFS_platformEnumerate(d, cb, origdir, callbackdata);
     __PHYSFS_smallFree(d);
@@ -85,12 +403,64 @@ static PHYSFS_EnumerateCallbackResult DIR_enumerate(void *opaque,
 } /* DIR_enumerate */
 
 
+static PHYSFS_EnumerateCallbackResult DIR_enumerateStat(void *opaque,
+                         const char *dname, PHYSFS_EnumerateStatCallback cb,
+                         const char *origdir, void *callbackdata)
+{
+    DIRinfo *info = (DIRinfo *) opaque;
+    char *d;
+    PHYSFS_EnumerateCallbackResult retval;
+
+    if ((info->cache) && (dirCacheEnumerate(info, dname, NULL, cb, origdir,
+                                            callbackdata, &retval)))
+        return retval;
+
+    CVT_TO_DEPENDENT(d, info->base, dname);
+    BAIL_IF_ERRPASS(!d, PHYSFS_ENUM_ERROR);
+    retval = __PHYSFS_platformEnumerateStat(d, cb, origdir, callbackdata);
+    __PHYSFS_smallFree(d);
+    return retval;
+} /* DIR_enumerateStat */
+
+
+/* Stat (name) from the cache: 1 if it's there, 0 if it isn't, -1 if only the
+   OS can say. */
+static int dirCacheStat(DIRinfo *info, const char *name, PHYSFS_Stat *stat)
+{
+    DIRcache *cache = info->cache;
+    DIRcacheEntry *entry = NULL;
+    int rc;
+
+    __PHYSFS_platformGrabMutex(cache->lock);
+    rc = dirCacheFind(info, name, 0, &entry);
+    if (rc == 1)
+        memcpy(stat, &entry->stat, sizeof (PHYSFS_Stat));
+    __PHYSFS_platformReleaseMutex(cache->lock);
+
+    return rc;
+} /* dirCacheStat */
+
+
+/* We changed something on disk; no snapshot can trust what it saw. */
+void DIR_dirtyCaches(void)
+{
+    __PHYSFS_ATOMIC_ADD64(&dirCacheGeneration, 1);
+} /* DIR_dirtyCaches */
+
+
 static PHYSFS_Io *doOpen(void *opaque, const char *name, const int mode)
 {
+    DIRinfo *info = (DIRinfo *) opaque;
     PHYSFS_Io *io = NULL;
     char *f = NULL;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
+    if ((mode == 'r') && (info->cache))
+    {
+        PHYSFS_Stat statbuf;
+        BAIL_IF_ERRPASS(dirCacheStat(info, name, &statbuf) == 0, NULL);
+    } /* if */
+
+    CVT_TO_DEPENDENT(f, info->base, name);
     BAIL_IF_ERRPASS(!f, NULL);
 
     io = __PHYSFS_createNativeIo(f, mode);
@@ -101,6 +471,10 @@ static PHYSFS_Io *doOpen(void *opaque, const char *name, const int mode)
         __PHYSFS_platformStat(f, &statbuf, 0);  /* !!! FIXME: why are we stating here? */
         PHYSFS_setErrorCode(err);
     } /* if */
+    else if (mode != 'r')
+    {
+        DIR_dirtyCaches();  /* it exists now, and might be shorter. */
+    } /* else if */
 
     __PHYSFS_smallFree(f);
 
@@ -131,10 +505,12 @@ static int DIR_remove(void *opaque, const char *name)
     int retval;
     char *f;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
+    CVT_TO_DEPENDENT(f, ((DIRinfo *) opaque)->base, name);
     BAIL_IF_ERRPASS(!f, 0);
     retval = __PHYSFS_platformDelete(f);
     __PHYSFS_smallFree(f);
+    if (retval)
+        DIR_dirtyCaches();
     return retval;
 } /* DIR_remove */
 
@@ -144,26 +520,115 @@ static int DIR_mkdir(void *opaque, const char *name)
     int retval;
     char *f;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
+    CVT_TO_DEPENDENT(f, ((DIRinfo *) opaque)->base, name);
     BAIL_IF_ERRPASS(!f, 0);
     retval = __PHYSFS_platformMkDir(f);
     __PHYSFS_smallFree(f);
+    if (retval)
+        DIR_dirtyCaches();
     return retval;
 } /* DIR_mkdir */
 
 
+static void dirCacheDestroy(DIRcache *cache)
+{
+    #ifndef PHYSFS_NO_PLATFORM_WATCH
+    if (cache->watch)  /* no more callbacks once this returns. */
+        __PHYSFS_platformDestroyWatch(cache->watch);
+    #endif
+
+    if (cache->built)
+        __PHYSFS_DirTreeDeinit(&cache->tree);
+
+    if (cache->lock)
+        __PHYSFS_platformDestroyMutex(cache->lock);
+
+    allocator.Free(cache);
+} /* dirCacheDestroy */
+
+
+#ifndef PHYSFS_NO_PLATFORM_WATCH
+/* The platform's watch thread calls this; it can't do much more than this. */
+static void dirCacheWatchCallback(void *data, const char *path)
+{
+    DIRcache *cache = (DIRcache *) data;
+    __PHYSFS_ATOMIC_ADD64(&cache->changes, 1);
+} /* dirCacheWatchCallback */
+#endif
+
+
+static DIRcache *dirCacheCreate(const char *base)
+{
+#ifdef PHYSFS_NO_PLATFORM_WATCH
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);  /* we'd never know it went stale. */
+#else
+    DIRcache *cache = (DIRcache *) allocator.Malloc(sizeof (DIRcache));
+    BAIL_IF(!cache, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(cache, '\0', sizeof (*cache));
+
+    cache->lock = __PHYSFS_platformCreateMutex();
+    if (!cache->lock)
+    {
+        dirCacheDestroy(cache);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    cache->watch = __PHYSFS_platformCreateWatch(base, dirCacheWatchCallback,
+                                                cache);
+    if (!cache->watch)
+    {
+        dirCacheDestroy(cache);
+        return NULL;
+    } /* if */
+
+    return cache;
+#endif
+} /* dirCacheCreate */
+
+
+int DIR_setCache(void *opaque, const int enable)
+{
+    DIRinfo *info = (DIRinfo *) opaque;
+
+    if ((enable) && (!info->cache))
+    {
+        info->cache = dirCacheCreate(info->base);
+        BAIL_IF_ERRPASS(!info->cache, 0);
+    } /* if */
+    else if ((!enable) && (info->cache))
+    {
+        dirCacheDestroy(info->cache);
+        info->cache = NULL;
+    } /* else if */
+
+    return 1;
+} /* DIR_setCache */
+
+
 static void DIR_closeArchive(void *opaque)
 {
-    allocator.Free(opaque);
+    DIRinfo *info = (DIRinfo *) opaque;
+    if (info->cache)
+        dirCacheDestroy(info->cache);
+    allocator.Free(info->base);
+    allocator.Free(info);
 } /* DIR_closeArchive */
 
 
 static int DIR_stat(void *opaque, const char *name, PHYSFS_Stat *stat)
 {
+    DIRinfo *info = (DIRinfo *) opaque;
     int retval = 0;
     char *d;
 
-    CVT_TO_DEPENDENT(d, opaque, name);
+    if (info->cache)
+    {
+        retval = dirCacheStat(info, name, stat);
+        if (retval != -1)
+            return retval;
+    } /* if */
+
+    CVT_TO_DEPENDENT(d, info->base, name);
     BAIL_IF_ERRPASS(!d, 0);
     retval = __PHYSFS_platformStat(d, stat, 0);
     __PHYSFS_smallFree(d);
@@ -189,7 +654,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_DIR =
     DIR_remove,
     DIR_mkdir,
     DIR_stat,
-    DIR_closeArchive
+    DIR_closeArchive,
+    DIR_enumerateStat,
+    NULL  /* detect: never asked, it doesn't deal with files. */
 };
 
 /* end of physfs_archiver_dir.c ... */
@@ -76,7 +76,7 @@ static void *GRP_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &count, sizeof(count)), NULL);
     count = PHYSFS_swapULE32(count);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!grpLoadEntries(io, count, unpkarc))
@@ -89,6 +89,17 @@ static void *GRP_openArchive(PHYSFS_Io *io, const char *name,
 } /* GRP_openArchive */
 
 
+static PHYSFS_DetectResult GRP_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    const int found = ( (headerLen >= 12) &&
+                        (memcmp(header, "KenSilverman", 12) == 0) );
+    return found ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* GRP_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_GRP =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -107,7 +118,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_GRP =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    GRP_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_GRP */
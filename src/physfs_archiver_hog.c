@@ -74,7 +74,7 @@ static void *HOG_openArchive(PHYSFS_Io *io, const char *name,
 
     *claimed = 1;
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, 0);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!hogLoadEntries(io, unpkarc))
@@ -87,6 +87,16 @@ static void *HOG_openArchive(PHYSFS_Io *io, const char *name,
 } /* HOG_openArchive */
 
 
+static PHYSFS_DetectResult HOG_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    const int found = ((headerLen >= 3) && (memcmp(header, "DHF", 3) == 0));
+    return found ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* HOG_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_HOG =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -105,7 +115,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_HOG =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    HOG_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_HOG */
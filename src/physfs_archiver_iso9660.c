@@ -39,11 +39,9 @@
    fields aren't aligned anyhow, so you have to serialize them in any case
    to avoid crashes on many CPU archs in any case. */
 
-static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
-                              const char *base, const PHYSFS_uint64 dirstart,
-                              const PHYSFS_uint64 dirend, void *unpkarc);
-
-static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
+/* Directories are added with where their records are, but those records
+   aren't read until something looks inside; see UNPK_setDirLoader(). */
+static int iso9660AddEntry(const int joliet, const int isdir,
                            const char *base, PHYSFS_uint8 *fname,
                            const int fnamelen, const PHYSFS_sint64 ts,
                            const PHYSFS_uint64 pos, const PHYSFS_uint64 len,
@@ -56,9 +54,6 @@ static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
     void *entry;
     int i;
 
-    if (fnamelen == 1 && ((fname[0] == 0) || (fname[0] == 1)))
-        return 1;  /* Magic that represents "." and "..", ignore */
-
     BAIL_IF(fnamelen == 0, PHYSFS_ERR_CORRUPT, 0);
     assert(fnamelen > 0);
     assert(fnamelen <= 255);
@@ -115,12 +110,6 @@ static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
     } /* else */
 
     entry = UNPK_addEntry(unpkarc, fullpath, isdir, ts, ts, pos, len);
-    if ((entry) && (isdir))
-    {
-        if (!iso9660LoadEntries(io, joliet, fullpath, pos, pos + len, unpkarc))
-            entry = NULL;  /* so we report a failure later. */
-    } /* if */
-
     __PHYSFS_smallFree(fullpath);
     return entry != NULL;
 } /* iso9660AddEntry */
@@ -209,12 +198,15 @@ static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
         t.tm_isdst = -1;
         timestamp = (PHYSFS_sint64) mktime(&t);
 
+        if (fnamelen == 1 && ((fname[0] == 0) || (fname[0] == 1)))
+            continue;  /* Magic that represents "." and "..", ignore */
+
         extent += extattrlen;  /* skip extended attribute record. */
 
-        /* infinite loop, corrupt file? */
+        /* a directory inside itself, corrupt file? */
         BAIL_IF((extent * 2048) == dirstart, PHYSFS_ERR_CORRUPT, 0);
 
-        if (!iso9660AddEntry(io, joliet, isdir, base, fname, fnamelen,
+        if (!iso9660AddEntry(joliet, isdir, base, fname, fnamelen,
                              timestamp, extent * 2048, datalen, unpkarc))
         {
             return 0;
@@ -224,6 +216,19 @@ static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
     return 1;
 } /* iso9660LoadEntries */
 
+static int iso9660LoadDir(void *unpkarc, PHYSFS_Io *io, const char *path,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
+{
+    return iso9660LoadEntries(io, 0, path, pos, pos + len, unpkarc);
+} /* iso9660LoadDir */
+
+static int iso9660LoadJolietDir(void *unpkarc, PHYSFS_Io *io,
+                                const char *path, const PHYSFS_uint64 pos,
+                                const PHYSFS_uint64 len)
+{
+    return iso9660LoadEntries(io, 1, path, pos, pos + len, unpkarc);
+} /* iso9660LoadJolietDir */
+
 
 static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
                                  PHYSFS_uint64 *_rootlen, int *_joliet,
@@ -346,10 +351,12 @@ static void *ISO9660_openArchive(PHYSFS_Io *io, const char *filename,
     if (!parseVolumeDescriptor(io, &rootpos, &len, &joliet, claimed))
         return NULL;
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, 0);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!iso9660LoadEntries(io, joliet, "", rootpos, rootpos + len, unpkarc))
+    if (!UNPK_setDirLoader(unpkarc,
+                           joliet ? iso9660LoadJolietDir : iso9660LoadDir,
+                           rootpos, len))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
@@ -359,6 +366,20 @@ static void *ISO9660_openArchive(PHYSFS_Io *io, const char *filename,
 } /* ISO9660_openArchive */
 
 
+static PHYSFS_DetectResult ISO9660_detect(const void *header,
+                                          PHYSFS_uint64 headerLen,
+                                          const void *trailer,
+                                          PHYSFS_uint64 trailerLen)
+{
+    /* the Primary Volume Descriptor is at 32768; its "CD001" follows the
+       type byte. parseVolumeDescriptor() refuses anything else there. */
+    const PHYSFS_uint8 *pvd = ((const PHYSFS_uint8 *) header) + 32768;
+    if (headerLen < 32768 + 6)
+        return PHYSFS_DETECT_NO;
+    return (memcmp(pvd + 1, "CD001", 5) == 0) ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* ISO9660_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_ISO9660 =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -370,14 +391,16 @@ const PHYSFS_Archiver __PHYSFS_Archiver_ISO9660 =
         0,  /* supportsSymlinks */
     },
     ISO9660_openArchive,
-    UNPK_enumerate,
+    UNPK_lazyEnumerate,
     UNPK_openRead,
     UNPK_openWrite,
     UNPK_openAppend,
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    ISO9660_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_ISO9660 */
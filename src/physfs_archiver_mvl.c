@@ -70,7 +70,7 @@ static void *MVL_openArchive(PHYSFS_Io *io, const char *name,
     BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &count, sizeof(count)), NULL);
     count = PHYSFS_swapULE32(count);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!mvlLoadEntries(io, count, unpkarc))
@@ -83,6 +83,16 @@ static void *MVL_openArchive(PHYSFS_Io *io, const char *name,
 } /* MVL_openArchive */
 
 
+static PHYSFS_DetectResult MVL_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    const int found = ((headerLen >= 4) && (memcmp(header, "DMVL", 4) == 0));
+    return found ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* MVL_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_MVL =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -101,7 +111,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_MVL =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    MVL_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_MVL */
@@ -86,7 +86,7 @@ static void *QPAK_openArchive(PHYSFS_Io *io, const char *name,
 
     BAIL_IF_ERRPASS(!io->seek(io, pos), NULL);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!qpakLoadEntries(io, count, unpkarc))
@@ -99,6 +99,21 @@ static void *QPAK_openArchive(PHYSFS_Io *io, const char *name,
 } /* QPAK_openArchive */
 
 
+static PHYSFS_DetectResult QPAK_detect(const void *header,
+                                       PHYSFS_uint64 headerLen,
+                                       const void *trailer,
+                                       PHYSFS_uint64 trailerLen)
+{
+    PHYSFS_uint32 val;
+    if (headerLen < sizeof (val))
+        return PHYSFS_DETECT_NO;
+    memcpy(&val, header, sizeof (val));
+    if (PHYSFS_swapULE32(val) != QPAK_SIG)
+        return PHYSFS_DETECT_NO;
+    return PHYSFS_DETECT_YES;
+} /* QPAK_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_QPAK =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -117,7 +132,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_QPAK =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    QPAK_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_QPAK */
@@ -94,7 +94,7 @@ static void *SLB_openArchive(PHYSFS_Io *io, const char *name,
     /* seek to the table of contents */
     BAIL_IF_ERRPASS(!io->seek(io, tocPos), NULL);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!slbLoadEntries(io, count, unpkarc))
@@ -109,6 +109,25 @@ static void *SLB_openArchive(PHYSFS_Io *io, const char *name,
 } /* SLB_openArchive */
 
 
+static PHYSFS_DetectResult SLB_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    /* No identifier (see SLB_openArchive()), but we can rule out anything
+       that openArchive() would refuse from the first 12 bytes alone. */
+    PHYSFS_uint32 vals[3];  /* version, count, tocPos */
+    if (headerLen < sizeof (vals))
+        return PHYSFS_DETECT_NO;
+    memcpy(vals, header, sizeof (vals));
+    if ( (PHYSFS_swapULE32(vals[0]) != 0) ||
+         (PHYSFS_swapULE32(vals[1]) == 0) ||
+         (PHYSFS_swapULE32(vals[2]) == 0) )
+        return PHYSFS_DETECT_NO;
+    return PHYSFS_DETECT_MAYBE;
+} /* SLB_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_SLB =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -127,7 +146,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_SLB =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    SLB_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_SLB */
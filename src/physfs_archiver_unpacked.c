@@ -16,12 +16,21 @@
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_internal.h"
 
+/*
+ * Lazy archives (loadDir != NULL) add entries while other threads are looking
+ *  things up, so every lookup in the tree goes through (lock). Entries never
+ *  move or go away, and a directory's children are only added before it's
+ *  marked loaded, so what a lookup hands back is safe to use without it.
+ */
 typedef struct
 {
     __PHYSFS_DirTree tree;
     PHYSFS_Io *io;
+    UNPK_LoadDirFn loadDir;
+    void *lock;
 } UNPKinfo;
 
+/* In lazy archives, a directory's startPos and size locate its records. */
 typedef struct
 {
     __PHYSFS_DirTreeEntry tree;
@@ -29,13 +38,20 @@ typedef struct
     PHYSFS_uint64 size;
     PHYSFS_sint64 ctime;
     PHYSFS_sint64 mtime;
+    int loaded;  /* lazy directories: non-zero once children are added. */
 } UNPKentry;
 
+/*
+ * If the archive's Io has readAt(), every open file shares it (shared is
+ *  non-zero) and reads at startPos + curPos; otherwise each one has its own
+ *  duplicate, positioned with seek().
+ */
 typedef struct
 {
     PHYSFS_Io *io;
     UNPKentry *entry;
-    PHYSFS_uint32 curPos;
+    PHYSFS_uint64 curPos;
+    int shared;
 } UNPKfileinfo;
 
 
@@ -49,6 +65,9 @@ void UNPK_closeArchive(void *opaque)
         if (info->io)
             info->io->destroy(info->io);
 
+        if (info->lock)
+            __PHYSFS_platformDestroyMutex(info->lock);
+
         allocator.Free(info);
     } /* if */
 } /* UNPK_closeArchive */
@@ -73,9 +92,13 @@ static PHYSFS_sint64 UNPK_read(PHYSFS_Io *io, void *buffer, PHYSFS_uint64 len)
     if (bytesLeft < len)
         len = bytesLeft;
 
-    rc = finfo->io->read(finfo->io, buffer, len);
+    if (finfo->shared)
+        rc = finfo->io->readAt(finfo->io, buffer, len,
+                               entry->startPos + finfo->curPos);
+    else
+        rc = finfo->io->read(finfo->io, buffer, len);
     if (rc > 0)
-        finfo->curPos += (PHYSFS_uint32) rc;
+        finfo->curPos += (PHYSFS_uint64) rc;
 
     return rc;
 } /* UNPK_read */
@@ -100,9 +123,12 @@ static int UNPK_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
     int rc;
 
     BAIL_IF(offset >= entry->size, PHYSFS_ERR_PAST_EOF, 0);
-    rc = finfo->io->seek(finfo->io, entry->startPos + offset);
+    if (finfo->shared)
+        rc = 1;
+    else
+        rc = finfo->io->seek(finfo->io, entry->startPos + offset);
     if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
+        finfo->curPos = offset;
 
     return rc;
 } /* UNPK_seek */
@@ -124,11 +150,19 @@ static PHYSFS_Io *UNPK_duplicate(PHYSFS_Io *_io)
     GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_duplicate_failed);
     GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_duplicate_failed);
 
-    io = origfinfo->io->duplicate(origfinfo->io);
-    if (!io) goto UNPK_duplicate_failed;
+    if (origfinfo->shared)
+        io = origfinfo->io;
+    else
+    {
+        io = origfinfo->io->duplicate(origfinfo->io);
+        if (!io) goto UNPK_duplicate_failed;
+        if (!io->seek(io, origfinfo->entry->startPos))
+            goto UNPK_duplicate_failed;
+    } /* else */
     finfo->io = io;
     finfo->entry = origfinfo->entry;
     finfo->curPos = 0;
+    finfo->shared = origfinfo->shared;
     memcpy(retval, _io, sizeof (PHYSFS_Io));
     retval->opaque = finfo;
     return retval;
@@ -136,7 +170,7 @@ static PHYSFS_Io *UNPK_duplicate(PHYSFS_Io *_io)
 UNPK_duplicate_failed:
     if (finfo != NULL) allocator.Free(finfo);
     if (retval != NULL) allocator.Free(retval);
-    if (io != NULL) io->destroy(io);
+    if ((io != NULL) && (!origfinfo->shared)) io->destroy(io);
     return NULL;
 } /* UNPK_duplicate */
 
@@ -145,11 +179,28 @@ static int UNPK_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
 static void UNPK_destroy(PHYSFS_Io *io)
 {
     UNPKfileinfo *finfo = (UNPKfileinfo *) io->opaque;
-    finfo->io->destroy(finfo->io);
+    if (!finfo->shared)  /* shared ones belong to the archive. */
+        finfo->io->destroy(finfo->io);
     allocator.Free(finfo);
     allocator.Free(io);
 } /* UNPK_destroy */
 
+/* only offered when (finfo->io) has a readAt() to pass this on to. */
+static PHYSFS_sint64 UNPK_readAt(PHYSFS_Io *io, void *buffer,
+                                 PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const UNPKfileinfo *finfo = (const UNPKfileinfo *) io->opaque;
+    const UNPKentry *entry = finfo->entry;
+
+    if (offset >= entry->size)
+        return 0;
+
+    if (len > entry->size - offset)
+        len = entry->size - offset;
+
+    return finfo->io->readAt(finfo->io, buffer, len, entry->startPos + offset);
+} /* UNPK_readAt */
+
 
 static const PHYSFS_Io UNPK_Io =
 {
@@ -161,49 +212,144 @@ static const PHYSFS_Io UNPK_Io =
     UNPK_length,
     UNPK_duplicate,
     UNPK_flush,
-    UNPK_destroy
+    UNPK_destroy,
+    UNPK_readAt
 };
 
 
+/* Add (dir)'s children, if they aren't yet. MAKE SURE you hold info->lock! */
+static int loadDirEntry(UNPKinfo *info, UNPKentry *dir)
+{
+    const __PHYSFS_DirTreeEntry *root = info->tree.root;
+    const char *path = (&dir->tree == root) ? "" : dir->tree.name;
+
+    assert(dir->tree.isdir);
+    if (!dir->loaded)
+    {
+        BAIL_IF_ERRPASS(!info->loadDir(info, info->io, path,
+                                       dir->startPos, dir->size), 0);
+        dir->loaded = 1;
+    } /* if */
+
+    return 1;
+} /* loadDirEntry */
+
+
+/* Load each directory on the way to (path). MAKE SURE you hold info->lock! */
+static UNPKentry *findLazyEntry(UNPKinfo *info, const char *path)
+{
+    UNPKentry *retval = (UNPKentry *) info->tree.root;
+    const size_t len = strlen(path);
+    char *buf;
+    char *ptr;
+
+    /* anything already in the tree got there through its loaded parent. */
+    if (len > 0)
+    {
+        retval = (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+        if (retval)
+            return retval;
+        retval = (UNPKentry *) info->tree.root;
+    } /* if */
+
+    buf = (char *) __PHYSFS_smallAlloc(len + 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(buf, path, len + 1);
+
+    for (ptr = buf; *ptr != '\0'; ptr++)
+    {
+        char *sep;
+
+        GOTO_IF(!retval->tree.isdir, PHYSFS_ERR_NOT_FOUND, findLazy_failed);
+        GOTO_IF_ERRPASS(!loadDirEntry(info, retval), findLazy_failed);
+
+        sep = strchr(ptr, '/');
+        if (sep) *sep = '\0';
+        retval = (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, buf);
+        GOTO_IF_ERRPASS(!retval, findLazy_failed);
+        if (!sep)
+            break;
+        *sep = '/';
+        ptr = sep;
+    } /* for */
+
+    __PHYSFS_smallFree(buf);
+    return retval;
+
+findLazy_failed:
+    __PHYSFS_smallFree(buf);
+    return NULL;
+} /* findLazyEntry */
+
+
+/* (loadKids) also reads a lazy directory's own children, for enumerating. */
+static UNPKentry *findEntryLoading(UNPKinfo *info, const char *path,
+                                   const int loadKids)
+{
+    UNPKentry *retval;
+
+    if (!info->loadDir)
+        return (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    retval = findLazyEntry(info, path);
+    if ((retval) && (loadKids) && (retval->tree.isdir))
+    {
+        if (!loadDirEntry(info, retval))
+            retval = NULL;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    return retval;
+} /* findEntryLoading */
+
+
 static inline UNPKentry *findEntry(UNPKinfo *info, const char *path)
 {
-    return (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, path);
+    return findEntryLoading(info, path, 0);
 } /* findEntry */
 
 
-PHYSFS_Io *UNPK_openRead(void *opaque, const char *name)
+static PHYSFS_Io *unpkOpenEntry(void *opaque, void *_entry)
 {
     PHYSFS_Io *retval = NULL;
     UNPKinfo *info = (UNPKinfo *) opaque;
     UNPKfileinfo *finfo = NULL;
-    UNPKentry *entry = findEntry(info, name);
+    UNPKentry *entry = (UNPKentry *) _entry;
 
-    BAIL_IF_ERRPASS(!entry, NULL);
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
     retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_openRead_failed);
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, unpkOpenEntry_failed);
 
     finfo = (UNPKfileinfo *) allocator.Malloc(sizeof (UNPKfileinfo));
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_openRead_failed);
+    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, unpkOpenEntry_failed);
 
-    finfo->io = info->io->duplicate(info->io);
-    GOTO_IF_ERRPASS(!finfo->io, UNPK_openRead_failed);
+    finfo->shared = __PHYSFS_ioHasReadAt(info->io);
+    if (finfo->shared)
+        finfo->io = info->io;
+    else
+    {
+        finfo->io = info->io->duplicate(info->io);
+        GOTO_IF_ERRPASS(!finfo->io, unpkOpenEntry_failed);
 
-    if (!finfo->io->seek(finfo->io, entry->startPos))
-        goto UNPK_openRead_failed;
+        if (!finfo->io->seek(finfo->io, entry->startPos))
+            goto unpkOpenEntry_failed;
+    } /* else */
 
     finfo->curPos = 0;
     finfo->entry = entry;
 
     memcpy(retval, &UNPK_Io, sizeof (*retval));
     retval->opaque = finfo;
+    if (!finfo->shared)
+        retval->readAt = NULL;  /* nothing to pass it on to. */
     return retval;
 
-UNPK_openRead_failed:
+unpkOpenEntry_failed:
     if (finfo != NULL)
     {
-        if (finfo->io != NULL)
+        if ((finfo->io != NULL) && (!finfo->shared))
             finfo->io->destroy(finfo->io);
         allocator.Free(finfo);
     } /* if */
@@ -212,9 +358,44 @@ UNPK_openRead_failed:
         allocator.Free(retval);
 
     return NULL;
+} /* unpkOpenEntry */
+
+
+PHYSFS_Io *UNPK_openRead(void *opaque, const char *name)
+{
+    UNPKentry *entry = findEntry((UNPKinfo *) opaque, name);
+    BAIL_IF_ERRPASS(!entry, NULL);
+    return unpkOpenEntry(opaque, entry);
 } /* UNPK_openRead */
 
 
+PHYSFS_Io *UNPK_sourceIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 len)
+{
+    const UNPKfileinfo *finfo = (const UNPKfileinfo *) io->opaque;
+    const UNPKentry *entry;
+
+    if (io->read != UNPK_read)
+        return NULL;  /* not ours. */
+
+    entry = finfo->entry;
+    if ((*pos > entry->size) || (len > entry->size - *pos))
+        return NULL;
+
+    *pos += entry->startPos;
+    return finfo->io;
+} /* UNPK_sourceIo */
+
+
+int UNPK_entryPos(void *opaque, const char *name, PHYSFS_uint64 *pos)
+{
+    const UNPKentry *entry = findEntry((UNPKinfo *) opaque, name);
+    BAIL_IF_ERRPASS(!entry, 0);
+    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, 0);
+    *pos = entry->startPos;
+    return 1;
+} /* UNPK_entryPos */
+
+
 PHYSFS_Io *UNPK_openWrite(void *opaque, const char *name)
 {
     BAIL(PHYSFS_ERR_READ_ONLY, NULL);
@@ -239,12 +420,9 @@ int UNPK_mkdir(void *opaque, const char *name)
 } /* UNPK_mkdir */
 
 
-int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+static int unpkStatEntry(void *opaque, void *_entry, PHYSFS_Stat *stat)
 {
-    UNPKinfo *info = (UNPKinfo *) opaque;
-    const UNPKentry *entry = findEntry(info, path);
-
-    BAIL_IF_ERRPASS(!entry, 0);
+    const UNPKentry *entry = (const UNPKentry *) _entry;
 
     if (entry->tree.isdir)
     {
@@ -263,9 +441,41 @@ int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
     stat->readonly = 1;
 
     return 1;
+} /* unpkStatEntry */
+
+
+int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry = findEntry(info, path);
+    BAIL_IF_ERRPASS(!entry, 0);
+    return unpkStatEntry(opaque, entry, stat);
 } /* UNPK_stat */
 
 
+PHYSFS_EnumerateCallbackResult UNPK_enumerateStat(void *opaque,
+                               const char *dname,
+                               PHYSFS_EnumerateStatCallback cb,
+                               const char *origdir, void *callbackdata)
+{
+    UNPKentry *entry = findEntryLoading((UNPKinfo *) opaque, dname, 1);
+    BAIL_IF_ERRPASS(!entry, PHYSFS_ENUM_ERROR);
+    return __PHYSFS_DirTreeEnumerateStatEntry(opaque, &entry->tree, cb,
+                                        origdir, callbackdata, unpkStatEntry);
+} /* UNPK_enumerateStat */
+
+
+PHYSFS_EnumerateCallbackResult UNPK_lazyEnumerate(void *opaque,
+                              const char *dname, PHYSFS_EnumerateCallback cb,
+                              const char *origdir, void *callbackdata)
+{
+    UNPKentry *entry = findEntryLoading((UNPKinfo *) opaque, dname, 1);
+    BAIL_IF_ERRPASS(!entry, PHYSFS_ENUM_ERROR);
+    return __PHYSFS_DirTreeEnumerateEntry(&entry->tree, cb, origdir,
+                                          callbackdata);
+} /* UNPK_lazyEnumerate */
+
+
 void *UNPK_addEntry(void *opaque, char *name, const int isdir,
                     const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
                     const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
@@ -276,8 +486,9 @@ void *UNPK_addEntry(void *opaque, char *name, const int isdir,
     entry = (UNPKentry *) __PHYSFS_DirTreeAdd(&info->tree, name, isdir);
     BAIL_IF_ERRPASS(!entry, NULL);
 
-    entry->startPos = isdir ? 0 : pos;
-    entry->size = isdir ? 0 : len;
+    /* lazy archives need to know where a directory's own records are. */
+    entry->startPos = ((isdir) && (!info->loadDir)) ? 0 : pos;
+    entry->size = ((isdir) && (!info->loadDir)) ? 0 : len;
     entry->ctime = ctime;
     entry->mtime = mtime;
 
@@ -285,21 +496,42 @@ void *UNPK_addEntry(void *opaque, char *name, const int isdir,
 } /* UNPK_addEntry */
 
 
-void *UNPK_openArchive(PHYSFS_Io *io)
+void *UNPK_openArchive(PHYSFS_Io *io, const PHYSFS_uint64 entrycount)
 {
     UNPKinfo *info = (UNPKinfo *) allocator.Malloc(sizeof (UNPKinfo));
     BAIL_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
 
-    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry)))
+    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), entrycount, 0))
     {
         allocator.Free(info);
         return NULL;
     } /* if */
 
     info->io = io;
+    info->loadDir = NULL;
+    info->lock = NULL;
+    info->tree.openEntry = unpkOpenEntry;
+    info->tree.statEntry = unpkStatEntry;
 
     return info;
 } /* UNPK_openArchive */
 
+
+int UNPK_setDirLoader(void *opaque, UNPK_LoadDirFn loadDir,
+                      const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *root = (UNPKentry *) info->tree.root;
+
+    assert(info->loadDir == NULL);
+    info->lock = __PHYSFS_platformCreateMutex();
+    BAIL_IF_ERRPASS(!info->lock, 0);
+    info->loadDir = loadDir;
+    root->startPos = pos;
+    root->size = len;
+    root->loaded = 0;
+    return 1;
+} /* UNPK_setDirLoader */
+
 /* end of physfs_archiver_unpacked.c ... */
 
@@ -129,7 +129,7 @@ static void *VDF_openArchive(PHYSFS_Io *io, const char *name,
 
     BAIL_IF_ERRPASS(!io->seek(io, rootCatOffset), NULL);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!vdfLoadEntries(io, count, vdfDosTimeToEpoch(timestamp), unpkarc))
@@ -142,6 +142,21 @@ static void *VDF_openArchive(PHYSFS_Io *io, const char *name,
 } /* VDF_openArchive */
 
 
+static PHYSFS_DetectResult VDF_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    const PHYSFS_uint8 *sig = ((const PHYSFS_uint8 *) header) + VDF_COMMENT_LENGTH;
+    if (headerLen < VDF_COMMENT_LENGTH + VDF_SIGNATURE_LENGTH)
+        return PHYSFS_DETECT_NO;
+    else if ((memcmp(sig, VDF_SIGNATURE_G1, VDF_SIGNATURE_LENGTH) != 0) &&
+             (memcmp(sig, VDF_SIGNATURE_G2, VDF_SIGNATURE_LENGTH) != 0))
+        return PHYSFS_DETECT_NO;
+    return PHYSFS_DETECT_YES;
+} /* VDF_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_VDF =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -160,7 +175,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_VDF =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    VDF_detect
 };
 
 #endif /* defined PHYSFS_SUPPORTS_VDF */
@@ -95,7 +95,7 @@ static void *WAD_openArchive(PHYSFS_Io *io, const char *name,
 
     BAIL_IF_ERRPASS(!io->seek(io, directoryOffset), 0);
 
-    unpkarc = UNPK_openArchive(io);
+    unpkarc = UNPK_openArchive(io, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!wadLoadEntries(io, count, unpkarc))
@@ -108,6 +108,18 @@ static void *WAD_openArchive(PHYSFS_Io *io, const char *name,
 } /* WAD_openArchive */
 
 
+static PHYSFS_DetectResult WAD_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    const int found = ( (headerLen >= 4) &&
+                        ( (memcmp(header, "IWAD", 4) == 0) ||
+                          (memcmp(header, "PWAD", 4) == 0) ) );
+    return found ? PHYSFS_DETECT_YES : PHYSFS_DETECT_NO;
+} /* WAD_detect */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_WAD =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -126,7 +138,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_WAD =
     UNPK_remove,
     UNPK_mkdir,
     UNPK_stat,
-    UNPK_closeArchive
+    UNPK_closeArchive,
+    UNPK_enumerateStat,
+    WAD_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_WAD */
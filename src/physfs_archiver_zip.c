@@ -15,7 +15,29 @@
 #include <errno.h>
 #include <time.h>
 
+/*
+ * Deflated entries are inflated by the bundled miniz, unless we're built
+ *  with PHYSFS_ZIP_SYSTEM_ZLIB, to use the system's zlib instead (or zlib-ng
+ *  in its zlib-compatible mode, which is a good deal faster). Building with
+ *  PHYSFS_ZIP_HAVE_LIBDEFLATE also lets libdeflate decode entries that are
+ *  read in one piece. PHYSFS_ZIP_HAVE_ZSTD adds Zstandard (method 93)
+ *  entries through libzstd, and LZMA (method 14) entries use the 7zip
+ *  archiver's LZMA SDK, so they come with 7zip support.
+ */
+#if PHYSFS_ZIP_SYSTEM_ZLIB
+#define ZLIB_CONST 1  /* so next_in is const, like miniz's. */
+#include <zlib.h>
+#else
 #include "physfs_miniz.h"
+#endif
+
+#if PHYSFS_ZIP_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#if PHYSFS_ZIP_HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 /*
  * A buffer of ZIP_READBUFSIZE is allocated for each compressed file opened,
@@ -31,6 +53,27 @@
  */
 #define ZIP_READBUFSIZE   (16 * 1024)
 
+/*
+ * A read that wants all of a compressed entry, from the start, skips the
+ *  streaming decoder and decodes the whole thing straight into the caller's
+ *  buffer in one go, if the method's decoder can. The compressed data has
+ *  to be in memory for that: mapped archives just point at it, otherwise
+ *  it's read into a temporary buffer, if it's no bigger than this.
+ */
+#define ZIP_WHOLE_READ_LIMIT  (16 * 1024 * 1024)
+
+/*
+ * Deflated entries at least ZIP_SEEK_INDEX_THRESHOLD bytes big get a seek
+ *  index: as they're decoded, we save the inflater's state after roughly
+ *  every ZIP_CHECKPOINT_INTERVAL bytes of output, and later seeks resume
+ *  from the nearest checkpoint instead of decoding from the start of the
+ *  entry again. Each checkpoint costs a little over 40 kilobytes, and they
+ *  live until the archive is unmounted. PHYSFS_buildSeekIndex() turns this
+ *  on for smaller entries, too.
+ */
+#define ZIP_CHECKPOINT_INTERVAL   (4 * 1024 * 1024)
+#define ZIP_SEEK_INDEX_THRESHOLD  (16 * 1024 * 1024)
+
 
 /*
  * Entries are "unresolved" until they are first opened. At that time,
@@ -52,6 +95,23 @@ typedef enum
 } ZipResolveType;
 
 
+/*
+ * The inflater's state partway through a deflated entry. These are only
+ *  ever created at input buffer boundaries, so there's no unconsumed
+ *  compressed data to save.
+ */
+typedef struct _ZIPcheckpoint
+{
+    PHYSFS_uint64 uncompressed_position;  /* tell() position here.      */
+    PHYSFS_uint64 compressed_position;    /* offset in compressed data. */
+    PHYSFS_uint32 crypto_keys[3];         /* for "traditional" crypto.  */
+#if PHYSFS_ZIP_SYSTEM_ZLIB
+    z_stream stream;                      /* inflateCopy() of inflater. */
+#else
+    inflate_state state;                  /* all of miniz's state.      */
+#endif
+} ZIPcheckpoint;
+
 /*
  * One ZIPentry is kept for each file in an open ZIP archive.
  */
@@ -70,6 +130,10 @@ typedef struct _ZIPentry
     PHYSFS_uint64 uncompressed_size;    /* uncompressed size              */
     PHYSFS_sint64 last_mod_time;        /* last file mod time             */
     PHYSFS_uint32 dos_mod_time;         /* original MS-DOS style mod time */
+    ZIPcheckpoint **checkpoints;        /* seek index, sorted by position */
+    PHYSFS_uint32 checkpoint_count;     /* number of (checkpoints).       */
+    int want_checkpoints;               /* index even if it's small.      */
+    struct _ZIPentry *next_indexed;     /* other entries with checkpoints */
 } ZIPentry;
 
 /*
@@ -81,21 +145,37 @@ typedef struct
     PHYSFS_Io *io;            /* the i/o interface for this archive.    */
     int zip64;                /* non-zero if this is a Zip64 archive.   */
     int has_crypto;           /* non-zero if any entry uses encryption. */
+    void *lock;               /* serializes resolution, seek indexes.   */
+    ZIPentry *indexed;        /* entries with checkpoints, to free.     */
 } ZIPinfo;
 
+struct _ZIPdecoder;
+
 /*
  * One ZIPfileinfo is kept for each open file in a ZIP archive.
  */
 typedef struct
 {
+    ZIPinfo *info;                        /* archive we came from.      */
     ZIPentry *entry;                      /* Info on file.              */
     PHYSFS_Io *io;                        /* physical file handle.      */
-    PHYSFS_uint32 compressed_position;    /* offset in compressed data. */
-    PHYSFS_uint32 uncompressed_position;  /* tell() position.           */
+    int shared_io;                        /* (io) is the archive's own. */
+    PHYSFS_uint64 io_position;            /* readAt() spot, if shared.  */
+    PHYSFS_uint64 compressed_position;    /* offset in compressed data. */
+    PHYSFS_uint64 uncompressed_position;  /* tell() position.           */
     PHYSFS_uint8 *buffer;                 /* decompression buffer.      */
     PHYSFS_uint32 crypto_keys[3];         /* for "traditional" crypto.  */
     PHYSFS_uint32 initial_crypto_keys[3]; /* for "traditional" crypto.  */
+    const struct _ZIPdecoder *decoder;    /* NULL for stored entries.   */
+    const PHYSFS_uint8 *next_in;          /* unused data in (buffer).   */
+    size_t avail_in;                      /* bytes left at (next_in).   */
     z_stream stream;                      /* zlib stream state.         */
+    void *decoder_state;                  /* other decoders' state.     */
+    PHYSFS_uint64 next_checkpoint;        /* 0 if we don't save any.    */
+    int crc_check;                        /* 1 checking, -1 failed.     */
+    PHYSFS_uint32 crc;                    /* crc-32 of data so far.     */
+    PHYSFS_uint64 crc_position;           /* how much (crc) covers.     */
+    PHYSFS_Stats stats;                   /* see ZIP_ioStats().         */
 } ZIPfileinfo;
 
 
@@ -109,7 +189,9 @@ typedef struct
 
 /* compression methods... */
 #define COMPMETH_NONE 0
-/* ...and others... */
+#define COMPMETH_DEFLATE 8
+#define COMPMETH_LZMA 14
+#define COMPMETH_ZSTD 93
 
 
 #define UNIX_FILETYPE_MASK    0170000
@@ -152,10 +234,41 @@ static PHYSFS_uint8 zip_decrypt_byte(const PHYSFS_uint32 *keys)
     return (PHYSFS_uint8) ((tmp * (tmp ^ 1)) >> 8);
 } /* zip_decrypt_byte */
 
-static PHYSFS_sint64 zip_read_decrypt(ZIPfileinfo *finfo, void *buf, PHYSFS_uint64 len)
+/*
+ * Raw reads and seeks of an entry's bytes go through these. If the archive's
+ *  Io has readAt(), open files share it and just keep their own position,
+ *  so they never contend for a file pointer; otherwise each one has a
+ *  duplicate Io to read and seek.
+ */
+static PHYSFS_sint64 zip_read_raw(ZIPfileinfo *finfo, void *buf,
+                                  PHYSFS_uint64 len)
 {
     PHYSFS_Io *io = finfo->io;
-    const PHYSFS_sint64 br = io->read(io, buf, len);
+    PHYSFS_sint64 br;
+
+    if (!finfo->shared_io)
+        return io->read(io, buf, len);
+
+    br = io->readAt(io, buf, len, finfo->io_position);
+    if (br > 0)
+        finfo->io_position += (PHYSFS_uint64) br;
+    return br;
+} /* zip_read_raw */
+
+static int zip_seek_raw(ZIPfileinfo *finfo, PHYSFS_uint64 pos)
+{
+    if (!finfo->shared_io)
+        return finfo->io->seek(finfo->io, pos);
+    finfo->io_position = pos;
+    return 1;
+} /* zip_seek_raw */
+
+static PHYSFS_sint64 zip_read_decrypt(ZIPfileinfo *finfo, void *buf, PHYSFS_uint64 len)
+{
+    const PHYSFS_sint64 br = zip_read_raw(finfo, buf, len);
+
+    if (br > 0)
+        __PHYSFS_ATOMIC_ADD64(&finfo->stats.rawBytesRead, br);
 
     /* Decompression the new data if necessary. */
     if (zip_entry_is_tradional_crypto(finfo->entry) && (br > 0))
@@ -264,6 +377,306 @@ static int zlib_err(const int rc)
     return rc;
 } /* zlib_err */
 
+
+/*
+ * Every compression method we can decode has a ZIPdecoder; stored entries
+ *  don't, they're just read straight through.
+ *
+ * init() is called with (finfo->io) at the start of the entry's data (past
+ *  any crypto header). It can read a method-specific header there with
+ *  zip_read_decrypt(), as long as it adds that to
+ *  (finfo->compressed_position). decode() works like SZIP_lzmaDecode(), and
+ *  end() has to be safe to call more than once. decodeAll() decodes a whole
+ *  entry that's entirely in memory, without init(), into exactly (dstlen)
+ *  bytes; both lengths fit in 32 bits. It's optional.
+ *
+ * Only decoders with (checkpoints) set keep their state in (finfo->stream)
+ *  where the seek index can save it. (name) is for trace events.
+ *
+ * If (reusable) is set, init() can also be called on state it set up
+ *  before, and resets it in place instead of starting from nothing. Those
+ *  decoders don't end() on a rewind, or when their file is closed, since
+ *  ZIPfileinfos go back to a pool with the state still in them.
+ */
+typedef struct _ZIPdecoder
+{
+    PHYSFS_uint16 method;
+    const char *name;
+    int checkpoints;
+    int reusable;
+    int (*init)(ZIPfileinfo *finfo);
+    int (*decode)(ZIPfileinfo *finfo, const PHYSFS_uint8 **in, size_t *inlen,
+                  PHYSFS_uint8 **out, size_t *outlen);
+    void (*end)(ZIPfileinfo *finfo);
+    int (*decodeAll)(const PHYSFS_uint8 *src, const size_t srclen,
+                     PHYSFS_uint8 *dst, const size_t dstlen);
+} ZIPdecoder;
+
+
+static int zip_inflate_init(ZIPfileinfo *finfo)
+{
+    if (finfo->stream.state != NULL)  /* still set up from last time? */
+        return (zlib_err(inflateReset(&finfo->stream)) == Z_OK);
+    initializeZStream(&finfo->stream);
+    return (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) == Z_OK);
+} /* zip_inflate_init */
+
+static int zip_inflate_decode(ZIPfileinfo *finfo,
+                              const PHYSFS_uint8 **in, size_t *inlen,
+                              PHYSFS_uint8 **out, size_t *outlen)
+{
+    z_stream *stream = &finfo->stream;
+    int rc;
+
+    stream->next_in = *in;
+    stream->avail_in = (uInt) *inlen;  /* never more than ZIP_READBUFSIZE. */
+    stream->next_out = *out;
+    stream->avail_out = (uInt) ((*outlen > 0x7FFFFFFF) ? 0x7FFFFFFF : *outlen);
+
+    rc = zlib_err(inflate(stream, Z_SYNC_FLUSH));
+
+    *inlen -= (size_t) (stream->next_in - *in);
+    *in = stream->next_in;
+    *outlen -= (size_t) (stream->next_out - *out);
+    *out = stream->next_out;
+
+    if (rc == Z_STREAM_END)
+        return 1;
+    return (rc == Z_OK) ? 0 : -1;
+} /* zip_inflate_decode */
+
+static void zip_inflate_end(ZIPfileinfo *finfo)
+{
+    inflateEnd(&finfo->stream);
+} /* zip_inflate_end */
+
+static int zip_inflate_all(const PHYSFS_uint8 *src, const size_t srclen,
+                           PHYSFS_uint8 *dst, const size_t dstlen)
+{
+#if PHYSFS_ZIP_HAVE_LIBDEFLATE
+    struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+    enum libdeflate_result rc;
+    BAIL_IF(!d, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    rc = libdeflate_deflate_decompress(d, src, srclen, dst, dstlen, NULL);
+    libdeflate_free_decompressor(d);
+    BAIL_IF(rc != LIBDEFLATE_SUCCESS, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+#else
+    z_stream stream;
+    int rc;
+
+    initializeZStream(&stream);
+    BAIL_IF_ERRPASS(zlib_err(inflateInit2(&stream, -MAX_WBITS)) != Z_OK, 0);
+    stream.next_in = src;
+    stream.avail_in = (uInt) srclen;
+    stream.next_out = dst;
+    stream.avail_out = (uInt) dstlen;
+    rc = zlib_err(inflate(&stream, Z_FINISH));
+    inflateEnd(&stream);
+
+    /* both are acceptable outcomes, if everything came out... */
+    BAIL_IF_ERRPASS((rc != Z_OK) && (rc != Z_STREAM_END), 0);
+    BAIL_IF(stream.total_out != dstlen, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+#endif
+} /* zip_inflate_all */
+
+
+#if PHYSFS_SUPPORTS_7Z
+/*
+ * LZMA entries start with a little header of their own: the LZMA SDK
+ *  version that made them (two bytes), then the size of the LZMA properties
+ *  (two bytes, always 5), then the properties. If general purpose bit 1 is
+ *  set, there's an end marker after the data, too, but we know the size
+ *  anyhow.
+ */
+#define ZIP_LZMA_HEADER_SIZE 4
+#define ZIP_LZMA_PROPS_SIZE 5
+
+static int zip_lzma_props_size(const PHYSFS_uint8 *header)
+{
+    const PHYSFS_uint16 len = (PHYSFS_uint16) (header[2] | (header[3] << 8));
+    BAIL_IF(len != ZIP_LZMA_PROPS_SIZE, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* zip_lzma_props_size */
+
+static int zip_lzma_init(ZIPfileinfo *finfo)
+{
+    PHYSFS_uint8 header[ZIP_LZMA_HEADER_SIZE + ZIP_LZMA_PROPS_SIZE];
+    const PHYSFS_sint64 br = zip_read_decrypt(finfo, header, sizeof (header));
+    BAIL_IF_ERRPASS(br < 0, 0);
+    BAIL_IF(br != sizeof (header), PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF_ERRPASS(!zip_lzma_props_size(header), 0);
+    finfo->compressed_position += (PHYSFS_uint64) br;
+    finfo->decoder_state = SZIP_lzmaCreate(header + ZIP_LZMA_HEADER_SIZE,
+                                           ZIP_LZMA_PROPS_SIZE,
+                                           finfo->entry->uncompressed_size);
+    return (finfo->decoder_state != NULL);
+} /* zip_lzma_init */
+
+static int zip_lzma_decode(ZIPfileinfo *finfo,
+                           const PHYSFS_uint8 **in, size_t *inlen,
+                           PHYSFS_uint8 **out, size_t *outlen)
+{
+    /* a failed rewind leaves us without a decoder. */
+    BAIL_IF(!finfo->decoder_state, PHYSFS_ERR_CORRUPT, -1);
+    return SZIP_lzmaDecode(finfo->decoder_state, in, inlen, out, outlen);
+} /* zip_lzma_decode */
+
+static void zip_lzma_end(ZIPfileinfo *finfo)
+{
+    SZIP_lzmaDestroy(finfo->decoder_state);
+    finfo->decoder_state = NULL;
+} /* zip_lzma_end */
+
+static int zip_lzma_all(const PHYSFS_uint8 *src, const size_t srclen,
+                        PHYSFS_uint8 *dst, const size_t dstlen)
+{
+    const size_t hdrlen = ZIP_LZMA_HEADER_SIZE + ZIP_LZMA_PROPS_SIZE;
+    size_t inlen = srclen - hdrlen;
+    size_t outlen = dstlen;
+    void *lzma;
+    int rc;
+
+    BAIL_IF(srclen < hdrlen, PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF_ERRPASS(!zip_lzma_props_size(src), 0);
+    lzma = SZIP_lzmaCreate(src + ZIP_LZMA_HEADER_SIZE,
+                           ZIP_LZMA_PROPS_SIZE, dstlen);
+    BAIL_IF_ERRPASS(!lzma, 0);
+    src += hdrlen;
+    rc = SZIP_lzmaDecode(lzma, &src, &inlen, &dst, &outlen);
+    SZIP_lzmaDestroy(lzma);
+    BAIL_IF_ERRPASS(rc < 0, 0);
+    BAIL_IF(rc == 0, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* zip_lzma_all */
+#endif
+
+
+#if PHYSFS_ZIP_HAVE_ZSTD
+static int zip_zstd_init(ZIPfileinfo *finfo)
+{
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    BAIL_IF(!dstream, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (ZSTD_isError(ZSTD_initDStream(dstream)))
+    {
+        ZSTD_freeDStream(dstream);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    finfo->decoder_state = dstream;
+    return 1;
+} /* zip_zstd_init */
+
+static int zip_zstd_decode(ZIPfileinfo *finfo,
+                           const PHYSFS_uint8 **in, size_t *inlen,
+                           PHYSFS_uint8 **out, size_t *outlen)
+{
+    ZSTD_DStream *dstream = (ZSTD_DStream *) finfo->decoder_state;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t rc;
+
+    /* a failed rewind leaves us without a decoder. */
+    BAIL_IF(!dstream, PHYSFS_ERR_CORRUPT, -1);
+
+    input.src = *in;
+    input.size = *inlen;
+    input.pos = 0;
+    output.dst = *out;
+    output.size = *outlen;
+    output.pos = 0;
+    rc = ZSTD_decompressStream(dstream, &output, &input);
+    BAIL_IF(ZSTD_isError(rc), PHYSFS_ERR_CORRUPT, -1);
+
+    *in += input.pos;
+    *inlen -= input.pos;
+    *out += output.pos;
+    *outlen -= output.pos;
+
+    /* frames can be concatenated, so the end of one doesn't mean much;
+       ZIP_read() stops at the entry's size anyhow. */
+    return 0;
+} /* zip_zstd_decode */
+
+static void zip_zstd_end(ZIPfileinfo *finfo)
+{
+    if (finfo->decoder_state != NULL)
+        ZSTD_freeDStream((ZSTD_DStream *) finfo->decoder_state);
+    finfo->decoder_state = NULL;
+} /* zip_zstd_end */
+
+static int zip_zstd_all(const PHYSFS_uint8 *src, const size_t srclen,
+                        PHYSFS_uint8 *dst, const size_t dstlen)
+{
+    const size_t rc = ZSTD_decompress(dst, dstlen, src, srclen);
+    BAIL_IF(ZSTD_isError(rc) || (rc != dstlen), PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* zip_zstd_all */
+#endif
+
+
+static const ZIPdecoder zip_decoders[] =
+{
+    { COMPMETH_DEFLATE, "deflate", 1, 1, zip_inflate_init, zip_inflate_decode,
+      zip_inflate_end, zip_inflate_all },
+#if PHYSFS_SUPPORTS_7Z
+    { COMPMETH_LZMA, "lzma", 0, 0, zip_lzma_init, zip_lzma_decode,
+      zip_lzma_end, zip_lzma_all },
+#endif
+#if PHYSFS_ZIP_HAVE_ZSTD
+    { COMPMETH_ZSTD, "zstd", 0, 0, zip_zstd_init, zip_zstd_decode,
+      zip_zstd_end, zip_zstd_all },
+#endif
+};
+
+static const ZIPdecoder *zip_find_decoder(const PHYSFS_uint16 method)
+{
+    size_t i;
+    for (i = 0; i < __PHYSFS_ARRAYLEN(zip_decoders); i++)
+    {
+        if (zip_decoders[i].method == method)
+            return &zip_decoders[i];
+    } /* for */
+
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* zip_find_decoder */
+
+
+/*
+ * The seek index saves the inflater's state in a checkpoint, and restores
+ *  it from there into a freshly init()'d inflater. That's a plain copy with
+ *  miniz; zlib keeps pointers in its state, so it has to copy it for us.
+ */
+static int zip_checkpoint_save(ZIPcheckpoint *cp, ZIPfileinfo *finfo)
+{
+#if PHYSFS_ZIP_SYSTEM_ZLIB
+    return (zlib_err(inflateCopy(&cp->stream, &finfo->stream)) == Z_OK);
+#else
+    memcpy(&cp->state, finfo->stream.state, sizeof (inflate_state));
+    return 1;
+#endif
+} /* zip_checkpoint_save */
+
+static int zip_checkpoint_restore(ZIPfileinfo *finfo, const ZIPcheckpoint *cp)
+{
+#if PHYSFS_ZIP_SYSTEM_ZLIB
+    inflateEnd(&finfo->stream);
+    return (zlib_err(inflateCopy(&finfo->stream, (z_stream *) &cp->stream))
+            == Z_OK);
+#else
+    memcpy(finfo->stream.state, &cp->state, sizeof (inflate_state));
+    return 1;
+#endif
+} /* zip_checkpoint_restore */
+
+static void zip_checkpoint_free(ZIPcheckpoint *cp)
+{
+#if PHYSFS_ZIP_SYSTEM_ZLIB
+    inflateEnd(&cp->stream);
+#endif
+    allocator.Free(cp);
+} /* zip_checkpoint_free */
+
 /*
  * Read an unsigned 64-bit int and swap to native byte order.
  */
@@ -299,6 +712,241 @@ static int readui16(PHYSFS_Io *io, PHYSFS_uint16 *val)
 } /* readui16 */
 
 
+/* MAKE SURE you hold (finfo->info->lock) before calling this! */
+static void zip_set_next_checkpoint(ZIPfileinfo *finfo)
+{
+    const ZIPentry *entry = finfo->entry;
+
+    if (finfo->decoder == NULL)
+        finfo->next_checkpoint = 0;  /* seeking is already cheap. */
+    else if (!finfo->decoder->checkpoints)
+        finfo->next_checkpoint = 0;  /* can't save this decoder's state. */
+    else if ( (!entry->want_checkpoints) &&
+              (entry->uncompressed_size < ZIP_SEEK_INDEX_THRESHOLD) )
+        finfo->next_checkpoint = 0;  /* not worth the memory. */
+    else
+    {
+        const PHYSFS_uint64 count = (PHYSFS_uint64) entry->checkpoint_count;
+        finfo->next_checkpoint = (count + 1) * ZIP_CHECKPOINT_INTERVAL;
+    } /* else */
+} /* zip_set_next_checkpoint */
+
+
+/*
+ * Save the inflater's state at (pos) in the entry's seek index. Only call
+ *  this when there's no unconsumed input left in (finfo->buffer). Failing
+ *  here isn't an error, it just makes later seeks slower.
+ */
+static void zip_add_checkpoint(ZIPfileinfo *finfo, const PHYSFS_uint64 pos)
+{
+    ZIPinfo *info = finfo->info;
+    ZIPentry *entry = finfo->entry;
+    ZIPcheckpoint *cp;
+
+    cp = (ZIPcheckpoint *) allocator.Malloc(sizeof (ZIPcheckpoint));
+    if (cp != NULL)
+    {
+        cp->uncompressed_position = pos;
+        cp->compressed_position = finfo->compressed_position;
+        memcpy(cp->crypto_keys, finfo->crypto_keys, sizeof (cp->crypto_keys));
+        if (!zip_checkpoint_save(cp, finfo))
+        {
+            allocator.Free(cp);
+            cp = NULL;
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(info->lock);
+
+    /* another handle on this entry might have already been through here. */
+    if ((cp != NULL) && (entry->checkpoint_count > 0))
+    {
+        const ZIPcheckpoint *last;
+        last = entry->checkpoints[entry->checkpoint_count - 1];
+        if (last->uncompressed_position >= pos)
+        {
+            zip_checkpoint_free(cp);
+            cp = NULL;
+        } /* if */
+    } /* if */
+
+    if (cp != NULL)
+    {
+        const size_t len = sizeof (ZIPcheckpoint *) *
+                           (entry->checkpoint_count + 1);
+        void *ptr = allocator.Realloc(entry->checkpoints, len);
+        if (ptr == NULL)
+            zip_checkpoint_free(cp);
+        else
+        {
+            entry->checkpoints = (ZIPcheckpoint **) ptr;
+            if (entry->checkpoint_count == 0)
+            {
+                entry->next_indexed = info->indexed;
+                info->indexed = entry;
+            } /* if */
+            entry->checkpoints[entry->checkpoint_count++] = cp;
+        } /* else */
+    } /* if */
+
+    zip_set_next_checkpoint(finfo);
+    if (finfo->next_checkpoint <= pos)  /* out of memory? Stop trying. */
+        finfo->next_checkpoint = 0;
+
+    __PHYSFS_platformReleaseMutex(info->lock);
+} /* zip_add_checkpoint */
+
+
+/* Find the last checkpoint at or before (pos), or NULL if there isn't one. */
+static const ZIPcheckpoint *zip_find_checkpoint(ZIPfileinfo *finfo,
+                                                const PHYSFS_uint64 pos)
+{
+    const ZIPentry *entry = finfo->entry;
+    const ZIPcheckpoint *retval = NULL;
+    PHYSFS_uint32 lo = 0;
+    PHYSFS_uint32 hi;
+
+    __PHYSFS_platformGrabMutex(finfo->info->lock);
+    hi = entry->checkpoint_count;
+    while (lo < hi)
+    {
+        const PHYSFS_uint32 middle = lo + ((hi - lo) / 2);
+        const ZIPcheckpoint *cp = entry->checkpoints[middle];
+        if (cp->uncompressed_position <= pos)
+        {
+            retval = cp;
+            lo = middle + 1;
+        } /* if */
+        else
+        {
+            hi = middle;
+        } /* else */
+    } /* while */
+    __PHYSFS_platformReleaseMutex(finfo->info->lock);
+
+    /* checkpoints are never changed or freed while files are open. */
+    return retval;
+} /* zip_find_checkpoint */
+
+
+static void zip_free_checkpoints(ZIPinfo *info)
+{
+    ZIPentry *entry;
+    ZIPentry *next;
+
+    for (entry = info->indexed; entry != NULL; entry = next)
+    {
+        PHYSFS_uint32 i;
+        next = entry->next_indexed;
+        for (i = 0; i < entry->checkpoint_count; i++)
+            zip_checkpoint_free(entry->checkpoints[i]);
+        allocator.Free(entry->checkpoints);
+        entry->checkpoints = NULL;
+        entry->checkpoint_count = 0;
+        entry->next_indexed = NULL;
+    } /* for */
+
+    info->indexed = NULL;
+} /* zip_free_checkpoints */
+
+
+/*
+ * Fold (len) bytes that ZIP_read() just produced at (start) into the file's
+ *  running CRC, as far as they continue where it left off, and check it
+ *  once it covers the whole file. Bytes we already saw (after a seek
+ *  backwards) are skipped; a seek forward past bytes we never saw means
+ *  we just can't check this time. Returns zero if the file is corrupt.
+ */
+static int zip_check_crc(ZIPfileinfo *finfo, const PHYSFS_uint8 *buf,
+                         const PHYSFS_uint64 start, const PHYSFS_uint64 len)
+{
+    const ZIPentry *entry = finfo->entry;
+    const PHYSFS_uint64 end = start + len;
+
+    if ((start <= finfo->crc_position) && (end > finfo->crc_position))
+    {
+        const PHYSFS_uint64 skip = finfo->crc_position - start;
+        finfo->crc = __PHYSFS_crc32(finfo->crc, buf + skip,
+                                    (size_t) (len - skip));
+        finfo->crc_position = end;
+        if ((end == entry->uncompressed_size) && (finfo->crc != entry->crc))
+            finfo->crc_check = -1;
+    } /* if */
+
+    return (finfo->crc_check != -1);
+} /* zip_check_crc */
+
+
+/*
+ * Decode all of (finfo)'s entry into (buf) with one decodeAll() call, if
+ *  that's possible. Returns 1 if it worked, -1 on error, and 0 if the
+ *  streaming decoder has to do it instead; nothing's changed then.
+ */
+static int zip_decode_whole(ZIPfileinfo *finfo, void *buf)
+{
+    const ZIPentry *entry = finfo->entry;
+    const PHYSFS_uint64 csize = entry->compressed_size;
+    const PHYSFS_uint8 *src = NULL;
+    PHYSFS_uint8 *tmp = NULL;
+    PHYSFS_Io *io = finfo->io;
+    PHYSFS_ErrorCode errcode;
+    PHYSFS_uint64 start;
+    int rc;
+
+    if (finfo->decoder->decodeAll == NULL)
+        return 0;
+    else if (zip_entry_is_tradional_crypto(entry))
+        return 0;
+    else if ((csize > 0xFFFFFFFF) || (entry->uncompressed_size > 0xFFFFFFFF))
+        return 0;
+
+    /* only if the archive is already in memory; see __PHYSFS_mapIo(). */
+    errcode = PHYSFS_getLastErrorCode();
+    src = (const PHYSFS_uint8 *) __PHYSFS_mapIo(io, entry->offset, csize,
+                                                NULL);
+    if (src == NULL)
+    {
+        /* not being in memory isn't an error; put back what was there. */
+        PHYSFS_getLastErrorCode();
+        PHYSFS_setErrorCode(errcode);
+        if (csize > ZIP_WHOLE_READ_LIMIT)
+            return 0;
+        tmp = (PHYSFS_uint8 *) allocator.Malloc((size_t) (csize ? csize : 1));
+        if (tmp == NULL)
+            return 0;
+        else if (!__PHYSFS_readAllAt(io, tmp, (size_t) csize, entry->offset))
+        {
+            allocator.Free(tmp);
+            return -1;
+        } /* else if */
+        src = tmp;
+    } /* if */
+
+    if (__PHYSFS_TRACING)
+        __PHYSFS_trace(PHYSFS_TRACE_DECODE, 0, NULL, NULL,
+                       finfo->decoder->name, NULL, 0, 0);
+    start = __PHYSFS_platformNanoseconds();
+    rc = finfo->decoder->decodeAll(src, (size_t) csize, (PHYSFS_uint8 *) buf,
+                                   (size_t) entry->uncompressed_size);
+    __PHYSFS_ATOMIC_ADD64(&finfo->stats.decompressTime,
+                          __PHYSFS_platformNanoseconds() - start);
+    if (__PHYSFS_TRACING)
+        __PHYSFS_trace(PHYSFS_TRACE_DECODE, 1, NULL, NULL,
+                       finfo->decoder->name, NULL, 0, rc ? csize : 0);
+    __PHYSFS_ATOMIC_ADD64(&finfo->stats.rawBytesRead, csize);
+
+    if (tmp != NULL)
+        allocator.Free(tmp);
+
+    BAIL_IF_ERRPASS(!rc, -1);
+
+    /* the streaming decoder is stale now, so a seek back will start over. */
+    finfo->avail_in = 0;
+    finfo->compressed_position = csize;
+    return 1;
+} /* zip_decode_whole */
+
+
 static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) _io->opaque;
@@ -307,31 +955,52 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
     PHYSFS_sint64 maxread = (PHYSFS_sint64) len;
     PHYSFS_sint64 avail = entry->uncompressed_size -
                           finfo->uncompressed_position;
+    int rc = 0;
 
     if (avail < maxread)
         maxread = avail;
 
+    /* keep saying so, in case a buffered read ate the first report. */
+    BAIL_IF(finfo->crc_check == -1, PHYSFS_ERR_CORRUPT, -1);
     BAIL_IF_ERRPASS(maxread == 0, 0);    /* quick rejection. */
 
-    if (entry->compression_method == COMPMETH_NONE)
+    if (finfo->decoder == NULL)
         retval = zip_read_decrypt(finfo, buf, maxread);
+    else if ( (finfo->uncompressed_position == 0) &&
+              (maxread == entry->uncompressed_size) &&
+              ((rc = zip_decode_whole(finfo, buf)) != 0) )
+    {
+        BAIL_IF_ERRPASS(rc < 0, -1);
+        retval = maxread;
+    } /* else if */
     else
     {
-        finfo->stream.next_out = buf;
-        finfo->stream.avail_out = (uInt) maxread;
+        PHYSFS_uint8 *out = (PHYSFS_uint8 *) buf;
+        size_t outlen;
+
+        if ((PHYSFS_uint64) maxread > (PHYSFS_uint64) ((size_t) -1))
+            maxread = (PHYSFS_sint64) ((size_t) -1);  /* 32-bit size_t. */
+        outlen = (size_t) maxread;
 
-        while (retval < maxread)
+        while (outlen > 0)
         {
-            const PHYSFS_uint32 before = (PHYSFS_uint32) finfo->stream.total_out;
-            int rc;
+            const size_t before_in = finfo->avail_in;
+            const size_t before_out = outlen;
+            PHYSFS_uint64 start;
 
-            if (finfo->stream.avail_in == 0)
+            if (finfo->avail_in == 0)
             {
                 PHYSFS_sint64 br;
 
                 br = entry->compressed_size - finfo->compressed_position;
                 if (br > 0)
                 {
+                    const PHYSFS_uint64 pos = finfo->uncompressed_position +
+                                  (PHYSFS_uint64) (out - (PHYSFS_uint8 *) buf);
+                    if ( (finfo->next_checkpoint != 0) &&
+                         (pos >= finfo->next_checkpoint) )
+                        zip_add_checkpoint(finfo, pos);
+
                     if (br > ZIP_READBUFSIZE)
                         br = ZIP_READBUFSIZE;
 
@@ -339,22 +1008,43 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
                     if (br <= 0)
                         break;
 
-                    finfo->compressed_position += (PHYSFS_uint32) br;
-                    finfo->stream.next_in = finfo->buffer;
-                    finfo->stream.avail_in = (unsigned int) br;
+                    finfo->compressed_position += (PHYSFS_uint64) br;
+                    finfo->next_in = finfo->buffer;
+                    finfo->avail_in = (size_t) br;
                 } /* if */
             } /* if */
 
-            rc = zlib_err(inflate(&finfo->stream, Z_SYNC_FLUSH));
-            retval += (finfo->stream.total_out - before);
+            start = __PHYSFS_platformNanoseconds();
+            rc = finfo->decoder->decode(finfo, &finfo->next_in,
+                                        &finfo->avail_in, &out, &outlen);
+            __PHYSFS_ATOMIC_ADD64(&finfo->stats.decompressTime,
+                                  __PHYSFS_platformNanoseconds() - start);
+            if ((rc == 0) && (finfo->avail_in == before_in) &&
+                (outlen == before_out))
+            {
+                PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);  /* truncated? */
+                rc = -1;
+            } /* if */
 
-            if (rc != Z_OK)
-                break;
+            if (rc != 0)
+                break;  /* end of the stream, or an error. */
         } /* while */
+
+        retval = (PHYSFS_sint64) (out - (PHYSFS_uint8 *) buf);
+        BAIL_IF_ERRPASS((rc < 0) && (retval == 0), -1);
     } /* else */
 
     if (retval > 0)
-        finfo->uncompressed_position += (PHYSFS_uint32) retval;
+    {
+        const PHYSFS_uint64 start = finfo->uncompressed_position;
+        finfo->uncompressed_position += (PHYSFS_uint64) retval;
+        if (finfo->crc_check)
+        {
+            const int ok = zip_check_crc(finfo, (const PHYSFS_uint8 *) buf,
+                                         start, (PHYSFS_uint64) retval);
+            BAIL_IF(!ok, PHYSFS_ERR_CORRUPT, -1);
+        } /* if */
+    } /* if */
 
     return retval;
 } /* ZIP_read */
@@ -376,57 +1066,100 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) _io->opaque;
     ZIPentry *entry = finfo->entry;
-    PHYSFS_Io *io = finfo->io;
     const int encrypted = zip_entry_is_tradional_crypto(entry);
 
     BAIL_IF(offset > entry->uncompressed_size, PHYSFS_ERR_PAST_EOF, 0);
 
     if (!encrypted && (entry->compression_method == COMPMETH_NONE))
     {
-        PHYSFS_sint64 newpos = offset + entry->offset;
-        BAIL_IF_ERRPASS(!io->seek(io, newpos), 0);
-        finfo->uncompressed_position = (PHYSFS_uint32) offset;
+        BAIL_IF_ERRPASS(!zip_seek_raw(finfo, entry->offset + offset), 0);
+        finfo->uncompressed_position = offset;
     } /* if */
 
     else
     {
         /*
-         * If seeking backwards, we need to redecode the file
-         *  from the start and throw away the compressed bits until we hit
-         *  the offset we need. If seeking forward, we still need to
-         *  decode, but we don't rewind first.
+         * If seeking backwards, we need to redecode the file from the
+         *  nearest checkpoint before the offset (or the start, if there
+         *  isn't one) and throw away the compressed bits until we hit the
+         *  offset we need. If seeking forward, we still need to decode, but
+         *  we don't rewind first, unless a checkpoint gets us closer.
          */
-        if (offset < finfo->uncompressed_position)
+        const ZIPcheckpoint *cp = zip_find_checkpoint(finfo, offset);
+        const PHYSFS_uint64 cppos = cp ? cp->uncompressed_position : 0;
+        const char *what = finfo->decoder ? finfo->decoder->name : "decrypt";
+        PHYSFS_uint64 skipfrom;
+        int rc = 1;
+
+        if ( (offset < finfo->uncompressed_position) ||
+             (cppos > finfo->uncompressed_position) )
         {
-            /* we do a copy so state is sane if inflateInit2() fails. */
-            z_stream str;
-            initializeZStream(&str);
-            if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
-                return 0;
+            const PHYSFS_uint64 cpos = cp ? cp->compressed_position : 0;
 
-            if (!io->seek(io, entry->offset + (encrypted ? 12 : 0)))
+            if (!zip_seek_raw(finfo, entry->offset + (encrypted?12:0) + cpos))
                 return 0;
 
-            inflateEnd(&finfo->stream);
-            memcpy(&finfo->stream, &str, sizeof (z_stream));
-            finfo->uncompressed_position = finfo->compressed_position = 0;
+            finfo->avail_in = 0;
+            if (cp == NULL)
+            {
+                finfo->uncompressed_position = finfo->compressed_position = 0;
+                if (encrypted)
+                    memcpy(finfo->crypto_keys, finfo->initial_crypto_keys, 12);
+            } /* if */
+            else
+            {
+                finfo->uncompressed_position = cppos;
+                finfo->compressed_position = cpos;
+                memcpy(finfo->crypto_keys, cp->crypto_keys, 12);
+            } /* else */
+
+            if (finfo->decoder != NULL)
+            {
+                /* init() might read a header, so it goes after the seek. */
+                if (!finfo->decoder->reusable)
+                    finfo->decoder->end(finfo);
+                if (!finfo->decoder->init(finfo))
+                    return 0;
+                else if ((cp != NULL) && (!zip_checkpoint_restore(finfo, cp)))
+                    return 0;
+            } /* if */
 
-            if (encrypted)
-                memcpy(finfo->crypto_keys, finfo->initial_crypto_keys, 12);
+            __PHYSFS_platformGrabMutex(finfo->info->lock);
+            zip_set_next_checkpoint(finfo);
+            __PHYSFS_platformReleaseMutex(finfo->info->lock);
         } /* if */
 
+        skipfrom = finfo->uncompressed_position;
+        if ((__PHYSFS_TRACING) && (skipfrom != offset))
+            __PHYSFS_trace(PHYSFS_TRACE_DECODE, 0, NULL, NULL, what, NULL,
+                           skipfrom, 0);
+
         while (finfo->uncompressed_position != offset)
         {
-            PHYSFS_uint8 buf[512];
-            PHYSFS_uint32 maxread;
+            PHYSFS_uint8 buf[4096];
+            PHYSFS_uint64 maxread;
 
-            maxread = (PHYSFS_uint32) (offset - finfo->uncompressed_position);
+            maxread = offset - finfo->uncompressed_position;
             if (maxread > sizeof (buf))
                 maxread = sizeof (buf);
 
-            if (ZIP_read(_io, buf, maxread) != maxread)
-                return 0;
+            if (ZIP_read(_io, buf, maxread) != (PHYSFS_sint64) maxread)
+            {
+                rc = 0;
+                break;
+            } /* if */
+            __PHYSFS_ATOMIC_ADD64(&finfo->stats.seekDecodedBytes, maxread);
         } /* while */
+
+        if ((__PHYSFS_TRACING) && (skipfrom != offset))
+        {
+            const PHYSFS_uint64 done = finfo->uncompressed_position - skipfrom;
+            __PHYSFS_trace(PHYSFS_TRACE_DECODE, 1, NULL, NULL, what, NULL,
+                           skipfrom, rc ? (PHYSFS_sint64) done : 0);
+        } /* if */
+
+        if (!rc)
+            return 0;
     } /* else */
 
     return 1;
@@ -440,27 +1173,80 @@ static PHYSFS_sint64 ZIP_length(PHYSFS_Io *io)
 } /* ZIP_length */
 
 
-static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry);
+/*
+ * ZIPfileinfos come from a pool, and keep their read buffer and inflater
+ *  while they wait there, so opening a deflated entry usually allocates
+ *  nothing and just resets the inflater.
+ */
+static void zip_discard_fileinfo(void *obj)
+{
+    ZIPfileinfo *finfo = (ZIPfileinfo *) obj;
+    if (finfo->stream.state != NULL)
+        inflateEnd(&finfo->stream);
+    if (finfo->buffer != NULL)
+        allocator.Free(finfo->buffer);
+} /* zip_discard_fileinfo */
+
+static __PHYSFS_Pool zipFileInfoPool =
+                __PHYSFS_POOL_INIT(sizeof (ZIPfileinfo), zip_discard_fileinfo);
+
+/* A zeroed ZIPfileinfo, except for whatever buffer and inflater it kept. */
+static ZIPfileinfo *zip_alloc_fileinfo(void)
+{
+    ZIPfileinfo *finfo = (ZIPfileinfo *) __PHYSFS_poolAlloc(&zipFileInfoPool);
+    PHYSFS_uint8 *buffer;
+    z_stream stream;
+
+    BAIL_IF_ERRPASS(!finfo, NULL);
+
+    /* zlib's state points back at the z_stream, so it goes back in place. */
+    buffer = finfo->buffer;
+    memcpy(&stream, &finfo->stream, sizeof (stream));
+    memset(finfo, '\0', sizeof (*finfo));
+    finfo->buffer = buffer;
+    memcpy(&finfo->stream, &stream, sizeof (stream));
+    if (finfo->stream.state == NULL)
+        initializeZStream(&finfo->stream);
+    return finfo;
+} /* zip_alloc_fileinfo */
+
+/* (finfo->io) has to be dealt with already. */
+static void zip_free_fileinfo(ZIPfileinfo *finfo)
+{
+    if ((finfo->decoder != NULL) && (!finfo->decoder->reusable))
+        finfo->decoder->end(finfo);
+    __PHYSFS_poolFree(&zipFileInfoPool, finfo);
+} /* zip_free_fileinfo */
+
+
+static int zip_get_io(ZIPfileinfo *finfo, PHYSFS_Io *io, ZIPinfo *inf,
+                      ZIPentry *entry);
 
 static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
 {
     ZIPfileinfo *origfinfo = (ZIPfileinfo *) io->opaque;
-    PHYSFS_Io *retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    ZIPfileinfo *finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-    memset(finfo, '\0', sizeof (*finfo));
+    PHYSFS_Io *retval = (PHYSFS_Io *) __PHYSFS_poolAlloc(&__PHYSFS_IoPool);
+    ZIPfileinfo *finfo = zip_alloc_fileinfo();
+    GOTO_IF_ERRPASS(!retval, failed);
+    GOTO_IF_ERRPASS(!finfo, failed);
 
+    finfo->info = origfinfo->info;
     finfo->entry = origfinfo->entry;
-    finfo->io = zip_get_io(origfinfo->io, NULL, finfo->entry);
-    GOTO_IF_ERRPASS(!finfo->io, failed);
+    finfo->crc_check = (origfinfo->crc_check != 0);
+    finfo->decoder = origfinfo->decoder;
+    GOTO_IF_ERRPASS(!zip_get_io(finfo, origfinfo->io, NULL, finfo->entry),
+                    failed);
 
-    initializeZStream(&finfo->stream);
-    if (finfo->entry->compression_method != COMPMETH_NONE)
+    __PHYSFS_platformGrabMutex(finfo->info->lock);
+    zip_set_next_checkpoint(finfo);
+    __PHYSFS_platformReleaseMutex(finfo->info->lock);
+
+    if (finfo->decoder != NULL)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+        if (finfo->buffer == NULL)
+            finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
         GOTO_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-        if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
+        if (!finfo->decoder->init(finfo))
             goto failed;
     } /* if */
 
@@ -471,21 +1257,12 @@ static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
 failed:
     if (finfo != NULL)
     {
-        if (finfo->io != NULL)
+        if ((finfo->io != NULL) && (!finfo->shared_io))
             finfo->io->destroy(finfo->io);
-
-        if (finfo->buffer != NULL)
-        {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
-        } /* if */
-
-        allocator.Free(finfo);
+        zip_free_fileinfo(finfo);
     } /* if */
 
-    if (retval != NULL)
-        allocator.Free(retval);
-
+    __PHYSFS_poolFree(&__PHYSFS_IoPool, retval);
     return NULL;
 } /* ZIP_duplicate */
 
@@ -494,21 +1271,39 @@ static int ZIP_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
 static void ZIP_destroy(PHYSFS_Io *io)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
-    finfo->io->destroy(finfo->io);
+    if (!finfo->shared_io)  /* a shared one belongs to the archive. */
+        finfo->io->destroy(finfo->io);
 
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-        inflateEnd(&finfo->stream);
+    zip_free_fileinfo(finfo);
+    __PHYSFS_poolFree(&__PHYSFS_IoPool, io);
+} /* ZIP_destroy */
 
-    if (finfo->buffer != NULL)
-        allocator.Free(finfo->buffer);
+/*
+ * Only offered for stored, unencrypted entries in a shared Io, where the
+ *  bytes are just a slice of the archive. This doesn't check the crc-32.
+ */
+static PHYSFS_sint64 ZIP_readAt(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len,
+                                PHYSFS_uint64 offset)
+{
+    ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
+    const ZIPentry *entry = finfo->entry;
+    PHYSFS_sint64 br;
 
-    allocator.Free(finfo);
-    allocator.Free(io);
-} /* ZIP_destroy */
+    if (offset >= entry->uncompressed_size)
+        return 0;
 
+    if (len > entry->uncompressed_size - offset)
+        len = entry->uncompressed_size - offset;
 
-static const PHYSFS_Io ZIP_Io =
-{
+    br = finfo->io->readAt(finfo->io, buf, len, entry->offset + offset);
+    if (br > 0)
+        __PHYSFS_ATOMIC_ADD64(&finfo->stats.rawBytesRead, br);
+    return br;
+} /* ZIP_readAt */
+
+
+static const PHYSFS_Io ZIP_Io =
+{
     CURRENT_PHYSFS_IO_API_VERSION, NULL,
     ZIP_read,
     ZIP_write,
@@ -517,7 +1312,8 @@ static const PHYSFS_Io ZIP_Io =
     ZIP_length,
     ZIP_duplicate,
     ZIP_flush,
-    ZIP_destroy
+    ZIP_destroy,
+    ZIP_readAt
 };
 
 
@@ -768,29 +1564,18 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 
     else  /* symlink target path is compressed... */
     {
-        z_stream stream;
+        const ZIPdecoder *decoder = zip_find_decoder(entry->compression_method);
         const size_t complen = (size_t) entry->compressed_size;
         PHYSFS_uint8 *compressed = (PHYSFS_uint8*) __PHYSFS_smallAlloc(complen);
-        if (compressed != NULL)
+        if ((compressed != NULL) && (decoder != NULL))
         {
             if (__PHYSFS_readAll(io, compressed, complen))
             {
-                initializeZStream(&stream);
-                stream.next_in = compressed;
-                stream.avail_in = (unsigned int) complen;
-                stream.next_out = (unsigned char *) path;
-                stream.avail_out = (unsigned int) size;
-                if (zlib_err(inflateInit2(&stream, -MAX_WBITS)) == Z_OK)
-                {
-                    rc = zlib_err(inflate(&stream, Z_FINISH));
-                    inflateEnd(&stream);
-
-                    /* both are acceptable outcomes... */
-                    rc = ((rc == Z_OK) || (rc == Z_STREAM_END));
-                } /* if */
+                rc = decoder->decodeAll(compressed, complen,
+                                        (PHYSFS_uint8 *) path, size);
             } /* if */
-            __PHYSFS_smallFree(compressed);
         } /* if */
+        __PHYSFS_smallFree(compressed);
     } /* else */
 
     if (rc)
@@ -909,6 +1694,20 @@ static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 } /* zip_resolve */
 
 
+/*
+ * Resolving updates (entry) and seeks (info->io), and we can be called from
+ *  several threads at once, so only let one thread resolve at a time.
+ */
+static int zip_resolve_locked(ZIPinfo *info, ZIPentry *entry)
+{
+    int retval;
+    __PHYSFS_platformGrabMutex(info->lock);
+    retval = zip_resolve(info->io, info, entry);
+    __PHYSFS_platformReleaseMutex(info->lock);
+    return retval;
+} /* zip_resolve_locked */
+
+
 static int zip_entry_is_symlink(const ZIPentry *entry)
 {
     return ((entry->resolved == ZIP_UNRESOLVED_SYMLINK) ||
@@ -985,57 +1784,86 @@ static PHYSFS_sint64 zip_dos_time_to_physfs_time(PHYSFS_uint32 dostime)
 } /* zip_dos_time_to_physfs_time */
 
 
+/*
+ * The central directory is parsed out of memory: it's mapped or read in one
+ *  go, so each entry costs a few loads instead of a dozen tiny reads and
+ *  seeks through the Io, which adds up quickly for archives with a lot of
+ *  files, and more so when the Io is slow or remote.
+ */
+typedef struct
+{
+    const PHYSFS_uint8 *ptr;
+    PHYSFS_uint64 avail;
+} ZIPcdir;
+
+#define ZIP_CENTRAL_DIR_RECORDLEN 46
+
+static inline PHYSFS_uint16 zip_le16(const PHYSFS_uint8 *p)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) p[0]) |
+                            (((PHYSFS_uint16) p[1]) << 8));
+} /* zip_le16 */
+
+static inline PHYSFS_uint32 zip_le32(const PHYSFS_uint8 *p)
+{
+    return ((PHYSFS_uint32) p[0]) | (((PHYSFS_uint32) p[1]) << 8) |
+           (((PHYSFS_uint32) p[2]) << 16) | (((PHYSFS_uint32) p[3]) << 24);
+} /* zip_le32 */
+
+static inline PHYSFS_uint64 zip_le64(const PHYSFS_uint8 *p)
+{
+    return ((PHYSFS_uint64) zip_le32(p)) |
+           (((PHYSFS_uint64) zip_le32(p + 4)) << 32);
+} /* zip_le64 */
+
+
 static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
-                                const PHYSFS_uint64 ofs_fixup)
+                                const PHYSFS_uint64 ofs_fixup,
+                                ZIPcdir *cdir)
 {
-    PHYSFS_Io *io = info->io;
+    const PHYSFS_uint8 *rec = cdir->ptr;
+    const PHYSFS_uint8 *extra;
     ZIPentry entry;
     ZIPentry *retval = NULL;
     PHYSFS_uint16 fnamelen, extralen, commentlen;
     PHYSFS_uint32 external_attr;
     PHYSFS_uint32 starting_disk;
     PHYSFS_uint64 offset;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint32 ui32;
-    PHYSFS_sint64 si64;
+    PHYSFS_uint64 reclen;
     char *name = NULL;
     int isdir = 0;
 
     /* sanity check with central directory signature... */
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    BAIL_IF(ui32 != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(cdir->avail < ZIP_CENTRAL_DIR_RECORDLEN, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(zip_le32(rec) != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
 
     memset(&entry, '\0', sizeof (entry));
 
     /* Get the pertinent parts of the record... */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version_needed), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.general_bits), NULL);  /* general bits */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.compression_method), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &entry.dos_mod_time), NULL);
+    entry.version = zip_le16(rec + 4);
+    entry.version_needed = zip_le16(rec + 6);
+    entry.general_bits = zip_le16(rec + 8);
+    entry.compression_method = zip_le16(rec + 10);
+    entry.dos_mod_time = zip_le32(rec + 12);
     entry.last_mod_time = zip_dos_time_to_physfs_time(entry.dos_mod_time);
-    BAIL_IF_ERRPASS(!readui32(io, &entry.crc), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.compressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.uncompressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui16(io, &fnamelen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &extralen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &commentlen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);
-    starting_disk = (PHYSFS_uint32) ui16;
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);  /* internal file attribs */
-    BAIL_IF_ERRPASS(!readui32(io, &external_attr), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    offset = (PHYSFS_uint64) ui32;
+    entry.crc = zip_le32(rec + 16);
+    entry.compressed_size = (PHYSFS_uint64) zip_le32(rec + 20);
+    entry.uncompressed_size = (PHYSFS_uint64) zip_le32(rec + 24);
+    fnamelen = zip_le16(rec + 28);
+    extralen = zip_le16(rec + 30);
+    commentlen = zip_le16(rec + 32);
+    starting_disk = (PHYSFS_uint32) zip_le16(rec + 34);
+    /* rec + 36 is the internal file attribs; we don't care about those. */
+    external_attr = zip_le32(rec + 38);
+    offset = (PHYSFS_uint64) zip_le32(rec + 42);
+
+    reclen = ZIP_CENTRAL_DIR_RECORDLEN + fnamelen + extralen + commentlen;
+    BAIL_IF(cdir->avail < reclen, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(fnamelen == 0, PHYSFS_ERR_CORRUPT, NULL);
 
     name = (char *) __PHYSFS_smallAlloc(fnamelen + 1);
     BAIL_IF(!name, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    if (!__PHYSFS_readAll(io, name, fnamelen))
-    {
-        __PHYSFS_smallFree(name);
-        return NULL;
-    } /* if */
+    memcpy(name, rec + ZIP_CENTRAL_DIR_RECORDLEN, fnamelen);
 
     if (name[fnamelen - 1] == '/')
     {
@@ -1070,8 +1898,7 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
                                 ZIP_UNRESOLVED_SYMLINK : ZIP_UNRESOLVED_FILE;
     } /* else */
 
-    si64 = io->tell(io);
-    BAIL_IF_ERRPASS(si64 == -1, NULL);
+    extra = rec + ZIP_CENTRAL_DIR_RECORDLEN + fnamelen;
 
     /* If the actual sizes didn't fit in 32-bits, look for the Zip64
         extended information extra field... */
@@ -1086,19 +1913,20 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
         PHYSFS_uint16 len = 0;
         while (extralen > 4)
         {
-            BAIL_IF_ERRPASS(!readui16(io, &sig), NULL);
-            BAIL_IF_ERRPASS(!readui16(io, &len), NULL);
+            sig = zip_le16(extra);
+            len = zip_le16(extra + 2);
+            BAIL_IF(len > extralen - 4, PHYSFS_ERR_CORRUPT, NULL);
 
-            si64 += 4 + len;
-            extralen -= 4 + len;
-            if (sig != ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
+            extra += 4;
+            extralen -= 4;
+            if (sig == ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
             {
-                BAIL_IF_ERRPASS(!io->seek(io, si64), NULL);
-                continue;
+                found = 1;
+                break;
             } /* if */
 
-            found = 1;
-            break;
+            extra += len;
+            extralen -= len;
         } /* while */
 
         BAIL_IF(!found, PHYSFS_ERR_CORRUPT, NULL);
@@ -1106,28 +1934,31 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
         if (retval->uncompressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->uncompressed_size), NULL);
+            retval->uncompressed_size = zip_le64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
         if (retval->compressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->compressed_size), NULL);
+            retval->compressed_size = zip_le64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
         if (offset == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &offset), NULL);
+            offset = zip_le64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
         if (starting_disk == 0xFFFFFFFF)
         {
-            BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui32(io, &starting_disk), NULL);
+            BAIL_IF(len < 4, PHYSFS_ERR_CORRUPT, NULL);
+            starting_disk = zip_le32(extra);
             len -= 4;
         } /* if */
 
@@ -1138,37 +1969,468 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 
     retval->offset = offset + ofs_fixup;
 
-    /* seek to the start of the next entry in the central directory... */
-    BAIL_IF_ERRPASS(!io->seek(io, si64 + extralen + commentlen), NULL);
+    /* move on to the start of the next entry in the central directory... */
+    cdir->ptr += reclen;
+    cdir->avail -= reclen;
 
     return retval;  /* success. */
 } /* zip_load_entry */
 
 
+/*
+ * On-disk index snapshots, for PHYSFS_setIndexCacheDir().
+ *
+ * A snapshot is everything zip_load_entries() learns from the central
+ *  directory, one record per entry in central directory order, so adding
+ *  them back to the DirTree in the same order rebuilds the same tree. It's
+ *  keyed on the archive's length and mod time, and a CRC of the central
+ *  directory itself, so a rebuilt or replaced archive never matches a stale
+ *  snapshot. Everything is little endian, and a CRC of the whole file at the
+ *  end catches snapshots that were cut short or damaged.
+ *
+ *  header: "PHYSFSZI", u32 version, u64 archive length, s64 archive mod time,
+ *          u64 central dir offset, u32 central dir crc, u64 entry count.
+ *  record: u8 isdir, u8 resolved, u16 version, u16 version_needed,
+ *          u16 general_bits, u16 compression_method, u32 crc,
+ *          u32 dos_mod_time, u64 offset, u64 compressed_size,
+ *          u64 uncompressed_size, s64 last_mod_time, u16 namelen, name.
+ *  trailer: u32 crc of everything before it.
+ */
+#define ZIP_INDEX_VERSION 1
+#define ZIP_INDEX_HEADERLEN (8 + 4 + 8 + 8 + 8 + 4 + 8)
+#define ZIP_INDEX_RECORDLEN (1 + 1 + 2 + 2 + 2 + 2 + 4 + 4 + 8 + 8 + 8 + 8 + 2)
+
+static const PHYSFS_uint8 zipIndexMagic[8] =
+    { 'P', 'H', 'Y', 'S', 'F', 'S', 'Z', 'I' };
+
+typedef struct
+{
+    PHYSFS_uint64 archive_len;
+    PHYSFS_sint64 mtime;
+    PHYSFS_uint64 cdir_ofs;
+    PHYSFS_uint32 cdir_crc;
+    PHYSFS_uint64 count;
+} ZIPindexKey;
+
+/* A snapshot being built in memory while the central directory is parsed. */
+typedef struct
+{
+    PHYSFS_uint8 *buf;
+    size_t len;
+    size_t alloc;
+    int failed;  /* ran out of memory; don't write a snapshot. */
+} ZIPindexWriter;
+
+/* A snapshot being read back. */
+typedef struct
+{
+    const PHYSFS_uint8 *ptr;
+    size_t avail;
+} ZIPindexReader;
+
+
+static void zip_index_put(ZIPindexWriter *w, const void *ptr, const size_t len)
+{
+    if (w->failed)
+        return;
+
+    if (w->len + len > w->alloc)
+    {
+        size_t newalloc = w->alloc ? w->alloc : (64 * 1024);
+        void *newbuf;
+        while (newalloc < w->len + len)
+            newalloc *= 2;
+        newbuf = allocator.Realloc(w->buf, newalloc);
+        if (!newbuf)
+        {
+            w->failed = 1;
+            return;
+        } /* if */
+        w->buf = (PHYSFS_uint8 *) newbuf;
+        w->alloc = newalloc;
+    } /* if */
+
+    memcpy(w->buf + w->len, ptr, len);
+    w->len += len;
+} /* zip_index_put */
+
+
+static void zip_index_putui(ZIPindexWriter *w, PHYSFS_uint64 val, size_t len)
+{
+    PHYSFS_uint8 buf[8];
+    size_t i;
+
+    assert(len <= sizeof (buf));
+    for (i = 0; i < len; i++, val >>= 8)
+        buf[i] = (PHYSFS_uint8) (val & 0xFF);
+    zip_index_put(w, buf, len);
+} /* zip_index_putui */
+
+
+static PHYSFS_uint64 zip_index_getui(ZIPindexReader *r, size_t len)
+{
+    PHYSFS_uint64 retval = 0;
+    size_t i;
+
+    assert(r->avail >= len);  /* callers check for enough data up front. */
+    for (i = len; i > 0; i--)
+        retval = (retval << 8) | ((PHYSFS_uint64) r->ptr[i - 1]);
+    r->ptr += len;
+    r->avail -= len;
+    return retval;
+} /* zip_index_getui */
+
+
+static void zip_index_put_header(ZIPindexWriter *w, const ZIPindexKey *key)
+{
+    zip_index_put(w, zipIndexMagic, sizeof (zipIndexMagic));
+    zip_index_putui(w, ZIP_INDEX_VERSION, 4);
+    zip_index_putui(w, key->archive_len, 8);
+    zip_index_putui(w, (PHYSFS_uint64) key->mtime, 8);
+    zip_index_putui(w, key->cdir_ofs, 8);
+    zip_index_putui(w, key->cdir_crc, 4);
+    zip_index_putui(w, key->count, 8);
+} /* zip_index_put_header */
+
+
+static void zip_index_put_entry(ZIPindexWriter *w, const ZIPentry *entry)
+{
+    const size_t namelen = strlen(entry->tree.name);
+    assert(namelen <= 0xFFFF);  /* came from a 16-bit length in the archive. */
+    zip_index_putui(w, entry->tree.isdir ? 1 : 0, 1);
+    zip_index_putui(w, (PHYSFS_uint64) entry->resolved, 1);
+    zip_index_putui(w, entry->version, 2);
+    zip_index_putui(w, entry->version_needed, 2);
+    zip_index_putui(w, entry->general_bits, 2);
+    zip_index_putui(w, entry->compression_method, 2);
+    zip_index_putui(w, entry->crc, 4);
+    zip_index_putui(w, entry->dos_mod_time, 4);
+    zip_index_putui(w, entry->offset, 8);
+    zip_index_putui(w, entry->compressed_size, 8);
+    zip_index_putui(w, entry->uncompressed_size, 8);
+    zip_index_putui(w, (PHYSFS_uint64) entry->last_mod_time, 8);
+    zip_index_putui(w, namelen, 2);
+    zip_index_put(w, entry->tree.name, namelen);
+} /* zip_index_put_entry */
+
+
 /* This leaves things allocated on error; the caller will clean up the mess. */
 static int zip_load_entries(ZIPinfo *info,
                             const PHYSFS_uint64 data_ofs,
                             const PHYSFS_uint64 central_ofs,
-                            const PHYSFS_uint64 entry_count)
+                            const PHYSFS_uint64 entry_count,
+                            ZIPindexWriter *snapshot)
 {
     PHYSFS_Io *io = info->io;
     const int zip64 = info->zip64;
+    const PHYSFS_sint64 iolen = io->length(io);
+    const PHYSFS_uint8 *buf;
+    PHYSFS_uint8 *tmp = NULL;
+    PHYSFS_uint64 len;
     PHYSFS_uint64 i;
+    ZIPcdir cdir;
+    int retval = 0;
 
-    BAIL_IF_ERRPASS(!io->seek(io, central_ofs), 0);
+    if (entry_count == 0)
+        return 1;
+
+    /* The central directory runs up to the end-of-central-dir record, which
+       has to be near the end of the file, so take everything from there on
+       and let the records say where they stop; not every writer gets the
+       central directory's size right. */
+    BAIL_IF_ERRPASS(iolen < 0, 0);
+    BAIL_IF(central_ofs >= (PHYSFS_uint64) iolen, PHYSFS_ERR_CORRUPT, 0);
+    len = ((PHYSFS_uint64) iolen) - central_ofs;
+    BAIL_IF((len / ZIP_CENTRAL_DIR_RECORDLEN) < entry_count,
+            PHYSFS_ERR_CORRUPT, 0);
+
+    /* only if the archive is already in memory; a file that shrinks while
+       we mount it has to be an error, not a SIGBUS. See __PHYSFS_mapIo(). */
+    buf = (const PHYSFS_uint8 *) __PHYSFS_mapIo(io, central_ofs, len, NULL);
+    if (buf == NULL)
+    {
+        PHYSFS_getLastErrorCode();  /* not in memory; not an error. */
+        BAIL_IF(len != (PHYSFS_uint64) ((size_t) len),
+                PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        tmp = (PHYSFS_uint8 *) allocator.Malloc((size_t) len);
+        BAIL_IF(!tmp, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        if (!__PHYSFS_readAllAt(io, tmp, (size_t) len, central_ofs))
+        {
+            /* a short read with no error: it shrank under us. */
+            const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+            PHYSFS_setErrorCode(err ? err : PHYSFS_ERR_IO);
+            goto zip_load_entries_done;
+        } /* if */
+        buf = tmp;
+    } /* if */
+
+    cdir.ptr = buf;
+    cdir.avail = len;
 
     for (i = 0; i < entry_count; i++)
     {
-        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs);
-        BAIL_IF_ERRPASS(!entry, 0);
+        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs, &cdir);
+        GOTO_IF_ERRPASS(!entry, zip_load_entries_done);
         if (zip_entry_is_tradional_crypto(entry))
             info->has_crypto = 1;
+        if (snapshot)
+            zip_index_put_entry(snapshot, entry);
     } /* for */
 
-    return 1;
+    retval = 1;
+
+zip_load_entries_done:
+    allocator.Free(tmp);
+    return retval;
 } /* zip_load_entries */
 
 
+/* Fill in (key) for the archive we're opening. Zero if we can't. */
+static int zip_index_key(ZIPinfo *info, const char *name,
+                         const PHYSFS_uint64 cdir_ofs,
+                         const PHYSFS_uint64 count, ZIPindexKey *key)
+{
+    PHYSFS_Io *io = info->io;
+    const PHYSFS_sint64 len = io->length(io);
+    const size_t bufsize = 64 * 1024;
+    PHYSFS_uint64 remain;
+    PHYSFS_uint8 *buf;
+    PHYSFS_Stat statbuf;
+
+    BAIL_IF_ERRPASS(len < 0, 0);
+    BAIL_IF(cdir_ofs > (PHYSFS_uint64) len, PHYSFS_ERR_CORRUPT, 0);
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc(bufsize);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    key->archive_len = (PHYSFS_uint64) len;
+    key->cdir_ofs = cdir_ofs;
+    key->cdir_crc = 0;
+    key->count = count;
+
+    /* archives inside archives don't have a mod time; the CRC will have to
+       do for them. */
+    if (__PHYSFS_platformStat(name, &statbuf, 1))
+        key->mtime = statbuf.modtime;
+    else
+        key->mtime = -1;
+
+    /* the central directory runs to the end of the file, past any Zip64
+       records and the end-of-central-dir record, which we want too. */
+    GOTO_IF_ERRPASS(!io->seek(io, cdir_ofs), zip_index_key_failed);
+    for (remain = key->archive_len - cdir_ofs; remain > 0; )
+    {
+        const size_t br = (remain < bufsize) ? (size_t) remain : bufsize;
+        GOTO_IF_ERRPASS(!__PHYSFS_readAll(io, buf, br), zip_index_key_failed);
+        key->cdir_crc = __PHYSFS_crc32(key->cdir_crc, buf, br);
+        remain -= br;
+    } /* for */
+
+    allocator.Free(buf);
+    return 1;
+
+zip_index_key_failed:
+    allocator.Free(buf);
+    return 0;
+} /* zip_index_key */
+
+
+/* Check everything but the records' contents before we touch the tree. */
+static int zip_index_verify(const PHYSFS_uint8 *buf, const size_t len,
+                            const ZIPindexKey *key)
+{
+    ZIPindexReader r;
+    PHYSFS_uint64 i;
+
+    BAIL_IF(len < ZIP_INDEX_HEADERLEN + 4, PHYSFS_ERR_CORRUPT, 0);
+    r.ptr = buf + (len - 4);
+    r.avail = 4;
+    BAIL_IF(zip_index_getui(&r, 4) != __PHYSFS_crc32(0, buf, len - 4),
+            PHYSFS_ERR_CORRUPT, 0);
+
+    BAIL_IF(memcmp(buf, zipIndexMagic, sizeof (zipIndexMagic)) != 0,
+            PHYSFS_ERR_CORRUPT, 0);
+    r.ptr = buf + sizeof (zipIndexMagic);
+    r.avail = len - sizeof (zipIndexMagic) - 4;
+    BAIL_IF(zip_index_getui(&r, 4) != ZIP_INDEX_VERSION,
+            PHYSFS_ERR_UNSUPPORTED, 0);
+
+    /* any mismatch here means the archive changed since the snapshot. */
+    BAIL_IF(zip_index_getui(&r, 8) != key->archive_len, PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(zip_index_getui(&r, 8) != (PHYSFS_uint64) key->mtime,
+            PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(zip_index_getui(&r, 8) != key->cdir_ofs, PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(zip_index_getui(&r, 4) != key->cdir_crc, PHYSFS_ERR_CORRUPT, 0);
+    BAIL_IF(zip_index_getui(&r, 8) != key->count, PHYSFS_ERR_CORRUPT, 0);
+
+    for (i = 0; i < key->count; i++)
+    {
+        size_t namelen;
+        BAIL_IF(r.avail < ZIP_INDEX_RECORDLEN, PHYSFS_ERR_CORRUPT, 0);
+        r.ptr += ZIP_INDEX_RECORDLEN - 2;
+        r.avail -= ZIP_INDEX_RECORDLEN - 2;
+        namelen = (size_t) zip_index_getui(&r, 2);
+        BAIL_IF(r.avail < namelen, PHYSFS_ERR_CORRUPT, 0);
+        r.ptr += namelen;
+        r.avail -= namelen;
+    } /* for */
+
+    BAIL_IF(r.avail != 0, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* zip_index_verify */
+
+
+/* This leaves things allocated on error; the caller will clean up the mess. */
+static int zip_index_load_entries(ZIPinfo *info, const PHYSFS_uint8 *buf,
+                                  const size_t len, const ZIPindexKey *key)
+{
+    ZIPindexReader r;
+    char *name;
+    PHYSFS_uint64 i;
+
+    BAIL_IF_ERRPASS(!zip_index_verify(buf, len, key), 0);
+    name = (char *) allocator.Malloc(0xFFFF + 1);
+    BAIL_IF(!name, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    r.ptr = buf + ZIP_INDEX_HEADERLEN;
+    r.avail = len - ZIP_INDEX_HEADERLEN - 4;
+
+    for (i = 0; i < key->count; i++)
+    {
+        ZIPentry entry;
+        ZIPentry *retval;
+        size_t namelen;
+        int isdir;
+
+        memset(&entry, '\0', sizeof (entry));
+        isdir = (int) zip_index_getui(&r, 1);
+        entry.resolved = (ZipResolveType) zip_index_getui(&r, 1);
+        entry.version = (PHYSFS_uint16) zip_index_getui(&r, 2);
+        entry.version_needed = (PHYSFS_uint16) zip_index_getui(&r, 2);
+        entry.general_bits = (PHYSFS_uint16) zip_index_getui(&r, 2);
+        entry.compression_method = (PHYSFS_uint16) zip_index_getui(&r, 2);
+        entry.crc = (PHYSFS_uint32) zip_index_getui(&r, 4);
+        entry.dos_mod_time = (PHYSFS_uint32) zip_index_getui(&r, 4);
+        entry.offset = zip_index_getui(&r, 8);
+        entry.compressed_size = zip_index_getui(&r, 8);
+        entry.uncompressed_size = zip_index_getui(&r, 8);
+        entry.last_mod_time = (PHYSFS_sint64) zip_index_getui(&r, 8);
+        namelen = (size_t) zip_index_getui(&r, 2);
+        memcpy(name, r.ptr, namelen);
+        name[namelen] = '\0';
+        r.ptr += namelen;
+        r.avail -= namelen;
+
+        /* zip_load_entry() only ever records these three states. */
+        GOTO_IF((entry.resolved != ZIP_UNRESOLVED_FILE) &&
+                (entry.resolved != ZIP_UNRESOLVED_SYMLINK) &&
+                (entry.resolved != ZIP_DIRECTORY), PHYSFS_ERR_CORRUPT,
+                zip_index_load_failed);
+
+        retval = (ZIPentry *) __PHYSFS_DirTreeAdd(&info->tree, name, isdir);
+        GOTO_IF_ERRPASS(!retval, zip_index_load_failed);
+        GOTO_IF(retval->last_mod_time != 0, PHYSFS_ERR_CORRUPT,  /* dupe? */
+                zip_index_load_failed);
+
+        memcpy(((PHYSFS_uint8 *) retval) + sizeof (__PHYSFS_DirTreeEntry),
+               ((PHYSFS_uint8 *) &entry) + sizeof (__PHYSFS_DirTreeEntry),
+               sizeof (*retval) - sizeof (__PHYSFS_DirTreeEntry));
+
+        if (zip_entry_is_tradional_crypto(retval))
+            info->has_crypto = 1;
+    } /* for */
+
+    allocator.Free(name);
+    return 1;
+
+zip_index_load_failed:
+    allocator.Free(name);
+    return 0;
+} /* zip_index_load_entries */
+
+
+/* Non-zero if (path) held a good snapshot for (key) and we loaded it. */
+static int zip_index_load(ZIPinfo *info, const char *path,
+                          const ZIPindexKey *key)
+{
+    const void *mapped = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_sint64 len;
+    int retval = 0;
+    void *handle;
+
+    handle = __PHYSFS_platformOpenRead(path);
+    if (!handle)
+        return 0;  /* no snapshot yet; not an error. */
+
+    len = __PHYSFS_platformFileLength(handle);
+    if ((len <= 0) || ((PHYSFS_uint64) len != (size_t) len))
+        ;  /* obviously not an index snapshot. */
+    else if ((mapped = __PHYSFS_platformMapFile(handle, 0, len)) != NULL)
+        buf = (PHYSFS_uint8 *) mapped;
+    else if ((buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) len)) != NULL)
+    {
+        if (__PHYSFS_platformRead(handle, buf, len) != len)
+        {
+            allocator.Free(buf);
+            buf = NULL;
+        } /* if */
+    } /* else if */
+    __PHYSFS_platformClose(handle);
+
+    if (buf != NULL)
+    {
+        retval = zip_index_load_entries(info, buf, (size_t) len, key);
+        if (mapped)
+            __PHYSFS_platformUnmapFile(mapped, len);
+        else
+            allocator.Free(buf);
+    } /* if */
+
+    return retval;
+} /* zip_index_load */
+
+
+/*
+ * Failing to write a snapshot is never an error; we'll try next time.
+ * Loaders map (path), so it's never rewritten in place: truncating it under
+ *  a loader is a SIGBUS there. We write a file of our own next to it and
+ *  rename that over (path), so a loader sees an old snapshot or a new one,
+ *  never a partial one. Two savers racing just means the last rename wins.
+ */
+static void zip_index_save(const char *path, ZIPindexWriter *w)
+{
+    const PHYSFS_uint32 unique = (PHYSFS_uint32)
+                    (((size_t) __PHYSFS_platformGetThreadID()) ^
+                     __PHYSFS_platformNanoseconds());
+    const size_t len = strlen(path) + 1 + 8 + 4 + 1;
+    char *tmppath;
+    void *handle;
+    int ok;
+
+    zip_index_putui(w, __PHYSFS_crc32(0, w->buf, w->len), 4);
+    if (w->failed)
+        return;
+
+    tmppath = (char *) allocator.Malloc(len);
+    if (!tmppath)
+        return;
+    snprintf(tmppath, len, "%s.%08x.tmp", path, (unsigned int) unique);
+
+    handle = __PHYSFS_platformOpenWrite(tmppath);
+    if (handle)
+    {
+        const PHYSFS_sint64 rc = __PHYSFS_platformWrite(handle, w->buf, w->len);
+        ok = ((rc == (PHYSFS_sint64) w->len) && __PHYSFS_platformFlush(handle));
+        __PHYSFS_platformClose(handle);
+        if ((!ok) || (!__PHYSFS_platformRename(tmppath, path)))
+            __PHYSFS_platformDelete(tmppath);
+    } /* if */
+
+    allocator.Free(tmppath);
+} /* zip_index_save */
+
+
 static PHYSFS_sint64 zip64_find_end_of_central_dir(PHYSFS_Io *io,
                                                    PHYSFS_sint64 _pos,
                                                    PHYSFS_uint64 offset)
@@ -1261,6 +2523,7 @@ static PHYSFS_sint64 zip64_find_end_of_central_dir(PHYSFS_Io *io,
 static int zip64_parse_end_of_central_dir(ZIPinfo *info,
                                           PHYSFS_uint64 *data_start,
                                           PHYSFS_uint64 *dir_ofs,
+                                          PHYSFS_uint64 *dir_size,
                                           PHYSFS_uint64 *entry_count,
                                           PHYSFS_sint64 pos)
 {
@@ -1336,7 +2599,7 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
     BAIL_IF(ui64 != *entry_count, PHYSFS_ERR_CORRUPT, 0);
 
     /* size of the central directory */
-    BAIL_IF_ERRPASS(!readui64(io, &ui64), 0);
+    BAIL_IF_ERRPASS(!readui64(io, dir_size), 0);
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui64(io, dir_ofs), 0);
@@ -1356,6 +2619,7 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
 static int zip_parse_end_of_central_dir(ZIPinfo *info,
                                         PHYSFS_uint64 *data_start,
                                         PHYSFS_uint64 *dir_ofs,
+                                        PHYSFS_uint64 *dir_size,
                                         PHYSFS_uint64 *entry_count)
 {
     PHYSFS_Io *io = info->io;
@@ -1378,7 +2642,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 
     /* Seek back to see if "Zip64 end of central directory locator" exists. */
     /* this record is 20 bytes before end-of-central-dir */
-    rc = zip64_parse_end_of_central_dir(info, data_start, dir_ofs,
+    rc = zip64_parse_end_of_central_dir(info, data_start, dir_ofs, dir_size,
                                         entry_count, pos - 20);
 
     /* Error or success? Bounce out of here. Keep going if not zip64. */
@@ -1409,6 +2673,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 
     /* size of the central directory */
     BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    *dir_size = (PHYSFS_uint64) ui32;
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui32(io, &offset32), 0);
@@ -1452,20 +2717,49 @@ static void ZIP_closeArchive(void *opaque)
     if (info->io)
         info->io->destroy(info->io);
 
+    zip_free_checkpoints(info);
     __PHYSFS_DirTreeDeinit(&info->tree);
 
+    if (info->lock)
+        __PHYSFS_platformDestroyMutex(info->lock);
+
     allocator.Free(info);
 } /* ZIP_closeArchive */
 
 
+static PHYSFS_Io *zipOpenEntry(void *opaque, void *entry);
+static int zipStatResolved(void *opaque, void *entry, PHYSFS_Stat *stat);
+
+/* (dirsize) is the central directory's size, to guess how long the names
+   are: each record is 46 bytes plus its name, extra field and comment. */
+static int zip_init_tree(ZIPinfo *info, const PHYSFS_uint64 count,
+                         const PHYSFS_uint64 dirsize)
+{
+    const PHYSFS_uint64 fixed = count * ZIP_CENTRAL_DIR_RECORDLEN;
+    const PHYSFS_uint64 namebytes = (dirsize > fixed) ? dirsize - fixed : 0;
+    ZIPentry *root;
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry),
+                                          count, namebytes), 0);
+    root = (ZIPentry *) info->tree.root;
+    root->resolved = ZIP_DIRECTORY;
+    info->tree.openEntry = zipOpenEntry;
+    info->tree.statEntry = zipStatResolved;
+    return 1;
+} /* zip_init_tree */
+
+
 static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
                              int forWriting, int *claimed)
 {
     ZIPinfo *info = NULL;
-    ZIPentry *root = NULL;
     PHYSFS_uint64 dstart = 0;  /* data start */
     PHYSFS_uint64 cdir_ofs;  /* central dir offset */
+    PHYSFS_uint64 cdir_size;  /* central dir size, as the archive claims */
     PHYSFS_uint64 count;
+    ZIPindexWriter snapshot;
+    ZIPindexKey key;
+    char *indexpath = NULL;
+    int loaded = 0;
 
     assert(io != NULL);  /* shouldn't ever happen. */
 
@@ -1474,192 +2768,535 @@ static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     *claimed = 1;
 
+    memset(&snapshot, '\0', sizeof (snapshot));
+
     info = (ZIPinfo *) allocator.Malloc(sizeof (ZIPinfo));
     BAIL_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
     memset(info, '\0', sizeof (ZIPinfo));
 
     info->io = io;
 
-    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &count))
+    info->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF(!info->lock, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openarchive_failed);
+
+    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &cdir_size,
+                                      &count))
         goto ZIP_openarchive_failed;
-    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry)))
+    else if (!zip_init_tree(info, count, cdir_size))
         goto ZIP_openarchive_failed;
 
-    root = (ZIPentry *) info->tree.root;
-    root->resolved = ZIP_DIRECTORY;
+    indexpath = __PHYSFS_indexCachePath(name, "zipidx");
+    if ((indexpath) && (!zip_index_key(info, name, cdir_ofs, count, &key)))
+    {
+        allocator.Free(indexpath);  /* can't key it, so don't cache it. */
+        indexpath = NULL;
+    } /* if */
 
-    if (!zip_load_entries(info, dstart, cdir_ofs, count))
-        goto ZIP_openarchive_failed;
+    if (indexpath)
+    {
+        loaded = zip_index_load(info, indexpath, &key);
+        if (!loaded)  /* throw away anything a bad snapshot added. */
+        {
+            __PHYSFS_DirTreeDeinit(&info->tree);
+            info->has_crypto = 0;
+            if (!zip_init_tree(info, count, cdir_size))
+                goto ZIP_openarchive_failed;
+            zip_index_put_header(&snapshot, &key);
+        } /* if */
+    } /* if */
+
+    if (!loaded)
+    {
+        ZIPindexWriter *w = indexpath ? &snapshot : NULL;
+        if (!zip_load_entries(info, dstart, cdir_ofs, count, w))
+            goto ZIP_openarchive_failed;
+        if (indexpath)
+            zip_index_save(indexpath, &snapshot);
+    } /* if */
+
+    allocator.Free(snapshot.buf);
+    allocator.Free(indexpath);
 
     assert(info->tree.root->sibling == NULL);
     return info;
 
 ZIP_openarchive_failed:
+    allocator.Free(snapshot.buf);
+    allocator.Free(indexpath);
     info->io = NULL;  /* don't let ZIP_closeArchive destroy (io). */
     ZIP_closeArchive(info);
     return NULL;
 } /* ZIP_openArchive */
 
 
-static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry)
+/*
+ * Set up (finfo->io) to read (entry)'s data from (io): share (io) if it has
+ *  readAt(), or duplicate it. Returns zero on error, with (finfo->io) NULL.
+ */
+static int zip_get_io(ZIPfileinfo *finfo, PHYSFS_Io *io, ZIPinfo *inf,
+                      ZIPentry *entry)
 {
+    PHYSFS_uint64 offset;
     int success;
-    PHYSFS_Io *retval = io->duplicate(io);
-    BAIL_IF_ERRPASS(!retval, NULL);
 
     assert(!entry->tree.isdir); /* should have been checked before calling. */
 
-    /* (inf) can be NULL if we already resolved. */
-    success = (inf == NULL) || zip_resolve(retval, inf, entry);
+    finfo->shared_io = __PHYSFS_ioHasReadAt(io);
+    if (finfo->shared_io)
+    {
+        /* (inf) can be NULL if we already resolved. */
+        finfo->io = io;
+        success = (inf == NULL) || zip_resolve_locked(inf, entry);
+    } /* if */
+    else
+    {
+        finfo->io = io->duplicate(io);
+        BAIL_IF_ERRPASS(!finfo->io, 0);
+        success = (inf == NULL) || zip_resolve(finfo->io, inf, entry);
+    } /* else */
+
     if (success)
     {
-        PHYSFS_sint64 offset;
         offset = ((entry->symlink) ? entry->symlink->offset : entry->offset);
-        success = retval->seek(retval, offset);
+        success = zip_seek_raw(finfo, offset);
     } /* if */
 
     if (!success)
     {
-        retval->destroy(retval);
-        retval = NULL;
+        if (!finfo->shared_io)
+            finfo->io->destroy(finfo->io);
+        finfo->io = NULL;
     } /* if */
 
-    return retval;
+    return success;
 } /* zip_get_io */
 
 
-static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
+/* (entry) must be resolved, and not a directory. */
+static PHYSFS_Io *zip_open_entry(ZIPinfo *info, ZIPentry *entry,
+                                 const PHYSFS_uint8 *password)
 {
+    ZIPentry *real = ((entry->symlink != NULL) ? entry->symlink : entry);
     PHYSFS_Io *retval = NULL;
-    ZIPinfo *info = (ZIPinfo *) opaque;
-    ZIPentry *entry = zip_find_entry(info, filename);
     ZIPfileinfo *finfo = NULL;
-    PHYSFS_Io *io = NULL;
-    PHYSFS_uint8 *password = NULL;
-
-    /* if not found, see if maybe "$PASSWORD" is appended. */
-    if ((!entry) && (info->has_crypto))
-    {
-        const char *ptr = strrchr(filename, '$');
-        if (ptr != NULL)
-        {
-            const size_t len = (size_t) (ptr - filename);
-            char *str = (char *) __PHYSFS_smallAlloc(len + 1);
-            BAIL_IF(!str, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-            memcpy(str, filename, len);
-            str[len] = '\0';
-            entry = zip_find_entry(info, str);
-            __PHYSFS_smallFree(str);
-            password = (PHYSFS_uint8 *) (ptr + 1);
-        } /* if */
-    } /* if */
-
-    BAIL_IF_ERRPASS(!entry, NULL);
-
-    BAIL_IF_ERRPASS(!zip_resolve(info->io, info, entry), NULL);
 
-    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
-
-    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
+    retval = (PHYSFS_Io *) __PHYSFS_poolAlloc(&__PHYSFS_IoPool);
+    GOTO_IF_ERRPASS(!retval, zip_open_entry_failed);
 
-    finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-    memset(finfo, '\0', sizeof (ZIPfileinfo));
+    finfo = zip_alloc_fileinfo();
+    GOTO_IF_ERRPASS(!finfo, zip_open_entry_failed);
 
-    io = zip_get_io(info->io, info, entry);
-    GOTO_IF_ERRPASS(!io, ZIP_openRead_failed);
-    finfo->io = io;
-    finfo->entry = ((entry->symlink != NULL) ? entry->symlink : entry);
-    initializeZStream(&finfo->stream);
+    GOTO_IF_ERRPASS(!zip_get_io(finfo, info->io, info, entry),
+                    zip_open_entry_failed);
+    finfo->info = info;
+    finfo->entry = real;
+    finfo->crc_check = (PHYSFS_crcVerificationEnabled() != 0);
 
-    if (finfo->entry->compression_method != COMPMETH_NONE)
+    if (real->compression_method != COMPMETH_NONE)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        if (!finfo->buffer)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-        else if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
-            goto ZIP_openRead_failed;
+        finfo->decoder = zip_find_decoder(real->compression_method);
+        GOTO_IF_ERRPASS(!finfo->decoder, zip_open_entry_failed);
     } /* if */
 
+    __PHYSFS_platformGrabMutex(info->lock);
+    zip_set_next_checkpoint(finfo);
+    __PHYSFS_platformReleaseMutex(info->lock);
+
     if (!zip_entry_is_tradional_crypto(entry))
-        GOTO_IF(password != NULL, PHYSFS_ERR_BAD_PASSWORD, ZIP_openRead_failed);
+        GOTO_IF(password != NULL, PHYSFS_ERR_BAD_PASSWORD,
+                zip_open_entry_failed);
     else
     {
         PHYSFS_uint8 crypto_header[12];
-        GOTO_IF(password == NULL, PHYSFS_ERR_BAD_PASSWORD, ZIP_openRead_failed);
-        if (io->read(io, crypto_header, 12) != 12)
-            goto ZIP_openRead_failed;
+        GOTO_IF(password == NULL, PHYSFS_ERR_BAD_PASSWORD,
+                zip_open_entry_failed);
+        if (zip_read_raw(finfo, crypto_header, 12) != 12)
+            goto zip_open_entry_failed;
         else if (!zip_prep_crypto_keys(finfo, crypto_header, password))
-            goto ZIP_openRead_failed;
+            goto zip_open_entry_failed;
+    } /* if */
+
+    /* after the crypto header, since init() might read past it. */
+    if (finfo->decoder != NULL)
+    {
+        if (finfo->buffer == NULL)
+            finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+        if (!finfo->buffer)
+            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, zip_open_entry_failed);
+        else if (!finfo->decoder->init(finfo))
+            goto zip_open_entry_failed;
     } /* if */
 
     memcpy(retval, &ZIP_Io, sizeof (PHYSFS_Io));
     retval->opaque = finfo;
-
+    if ( (!finfo->shared_io) || (finfo->decoder != NULL) ||
+         (zip_entry_is_tradional_crypto(entry)) )
+        retval->readAt = NULL;  /* not just a slice of the archive. */
     return retval;
 
-ZIP_openRead_failed:
+zip_open_entry_failed:
     if (finfo != NULL)
     {
-        if (finfo->io != NULL)
+        if ((finfo->io != NULL) && (!finfo->shared_io))
             finfo->io->destroy(finfo->io);
-
-        if (finfo->buffer != NULL)
-        {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
-        } /* if */
-
-        allocator.Free(finfo);
+        zip_free_fileinfo(finfo);
     } /* if */
 
-    if (retval != NULL)
-        allocator.Free(retval);
-
+    __PHYSFS_poolFree(&__PHYSFS_IoPool, retval);
     return NULL;
-} /* ZIP_openRead */
+} /* zip_open_entry */
 
 
-static PHYSFS_Io *ZIP_openWrite(void *opaque, const char *filename)
+static PHYSFS_Io *zip_open_found(ZIPinfo *info, ZIPentry *entry,
+                                 PHYSFS_uint8 *password)
 {
-    BAIL(PHYSFS_ERR_READ_ONLY, NULL);
-} /* ZIP_openWrite */
+    PHYSFS_Io *retval = NULL;
+    ZIPentry *real = NULL;
+    int cacheable = 0;
 
+    BAIL_IF_ERRPASS(!zip_resolve_locked(info, entry), NULL);
 
-static PHYSFS_Io *ZIP_openAppend(void *opaque, const char *filename)
-{
-    BAIL(PHYSFS_ERR_READ_ONLY, NULL);
-} /* ZIP_openAppend */
+    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
+    /* never keep decrypted data around in the cache. */
+    real = ((entry->symlink != NULL) ? entry->symlink : entry);
+    cacheable = ( (password == NULL) &&
+                  (real->compression_method != COMPMETH_NONE) &&
+                  (!zip_entry_is_tradional_crypto(entry)) &&
+                  (__PHYSFS_cacheWants(real->uncompressed_size)) );
 
-static int ZIP_remove(void *opaque, const char *name)
-{
-    BAIL(PHYSFS_ERR_READ_ONLY, 0);
-} /* ZIP_remove */
+    if (cacheable)
+    {
+        retval = __PHYSFS_cacheLookup(info, real);
+        if (retval != NULL)
+            return retval;
+    } /* if */
 
+    retval = zip_open_entry(info, entry, password);
+    if ((retval != NULL) && (cacheable))
+        return __PHYSFS_cacheInsert(info, real, retval);
 
-static int ZIP_mkdir(void *opaque, const char *name)
-{
-    BAIL(PHYSFS_ERR_READ_ONLY, 0);
-} /* ZIP_mkdir */
+    return retval;
+} /* zip_open_found */
 
 
-static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
+static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
 {
     ZIPinfo *info = (ZIPinfo *) opaque;
     ZIPentry *entry = zip_find_entry(info, filename);
+    PHYSFS_uint8 *password = NULL;
 
-    if (entry == NULL)
-        return 0;
-
-    else if (!zip_resolve(info->io, info, entry))
-        return 0;
-
-    else if (entry->resolved == ZIP_DIRECTORY)
+    /* if not found, see if maybe "$PASSWORD" is appended. */
+    if ((!entry) && (info->has_crypto))
     {
-        stat->filesize = 0;
-        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        const char *ptr = strrchr(filename, '$');
+        if (ptr != NULL)
+        {
+            const size_t len = (size_t) (ptr - filename);
+            char *str = (char *) __PHYSFS_smallAlloc(len + 1);
+            BAIL_IF(!str, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+            memcpy(str, filename, len);
+            str[len] = '\0';
+            entry = zip_find_entry(info, str);
+            __PHYSFS_smallFree(str);
+            password = (PHYSFS_uint8 *) (ptr + 1);
+        } /* if */
+    } /* if */
+
+    BAIL_IF_ERRPASS(!entry, NULL);
+    return zip_open_found(info, entry, password);
+} /* ZIP_openRead */
+
+
+/* For __PHYSFS_DirTree::openEntry. */
+static PHYSFS_Io *zipOpenEntry(void *opaque, void *entry)
+{
+    return zip_open_found((ZIPinfo *) opaque, (ZIPentry *) entry, NULL);
+} /* zipOpenEntry */
+
+
+static PHYSFS_Io *ZIP_openWrite(void *opaque, const char *filename)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, NULL);
+} /* ZIP_openWrite */
+
+
+static PHYSFS_Io *ZIP_openAppend(void *opaque, const char *filename)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, NULL);
+} /* ZIP_openAppend */
+
+
+static int ZIP_remove(void *opaque, const char *name)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, 0);
+} /* ZIP_remove */
+
+
+int ZIP_buildSeekIndex(PHYSFS_Io *io)
+{
+    ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
+    PHYSFS_uint64 pos;
+
+    if (io->read != ZIP_read)
+        return -1;  /* not ours. */
+    else if (finfo->decoder == NULL)
+        return 1;  /* seeking is already cheap. */
+    else if (!finfo->decoder->checkpoints)
+        return 1;  /* nothing to save; seeks just decode from the start. */
+
+    __PHYSFS_platformGrabMutex(finfo->info->lock);
+    finfo->entry->want_checkpoints = 1;
+    zip_set_next_checkpoint(finfo);
+    __PHYSFS_platformReleaseMutex(finfo->info->lock);
+
+    /*
+     * Rewind, then decode everything to fill in the index (skipping ahead
+     *  past whatever is indexed already), then go back to where we were.
+     */
+    pos = finfo->uncompressed_position;
+    BAIL_IF_ERRPASS(!ZIP_seek(io, 0), 0);
+    BAIL_IF_ERRPASS(!ZIP_seek(io, finfo->entry->uncompressed_size), 0);
+    return ZIP_seek(io, pos);
+} /* ZIP_buildSeekIndex */
+
+
+int ZIP_ioStats(PHYSFS_Io *io, PHYSFS_Stats *stats)
+{
+    const ZIPfileinfo *finfo = (const ZIPfileinfo *) io->opaque;
+
+    if (io->read != ZIP_read)
+        return 0;  /* not ours. */
+
+    memset(stats, '\0', sizeof (*stats));
+    stats->rawBytesRead = __PHYSFS_ATOMIC_GET64(&finfo->stats.rawBytesRead);
+    stats->seekDecodedBytes =
+                    __PHYSFS_ATOMIC_GET64(&finfo->stats.seekDecodedBytes);
+    stats->decompressTime = __PHYSFS_ATOMIC_GET64(&finfo->stats.decompressTime);
+    return 1;
+} /* ZIP_ioStats */
+
+
+PHYSFS_Io *ZIP_sourceIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 len)
+{
+    const ZIPfileinfo *finfo = (const ZIPfileinfo *) io->opaque;
+    const ZIPentry *entry;
+
+    if (io->read != ZIP_read)
+        return NULL;  /* not ours. */
+
+    /* only stored, unencrypted entries are the same bytes as the archive. */
+    entry = finfo->entry;
+    if (entry->compression_method != COMPMETH_NONE)
+        return NULL;
+    else if (zip_entry_is_tradional_crypto(entry))
+        return NULL;
+    else if (*pos > entry->uncompressed_size)
+        return NULL;
+    else if (len > entry->uncompressed_size - *pos)
+        return NULL;
+
+    *pos += entry->offset;
+    return finfo->io;
+} /* ZIP_sourceIo */
+
+
+PHYSFS_Io *ZIP_spanIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 *len)
+{
+    const ZIPfileinfo *finfo = (const ZIPfileinfo *) io->opaque;
+    const ZIPentry *entry;
+    PHYSFS_uint64 usize, csize, start, end;
+
+    if (io->read != ZIP_read)
+        return NULL;  /* not ours. */
+
+    entry = finfo->entry;
+    usize = entry->uncompressed_size;
+    csize = entry->compressed_size;
+    if ((*pos > usize) || (*len > usize - *pos))
+        return NULL;
+
+    if ((usize == csize) || (usize == 0))  /* stored, or nothing to scale. */
+    {
+        start = *pos;
+        end = *pos + *len;
+    } /* if */
+    else
+    {
+        /* We can't know where a compressed byte range starts without
+           decoding up to it, so assume the ratio holds across the entry
+           and pad the guess a little. Close is good enough for a hint. */
+        const PHYSFS_uint64 slack = 16 * 1024;
+        const double ratio = ((double) csize) / ((double) usize);
+        start = (PHYSFS_uint64) (((double) *pos) * ratio);
+        end = (PHYSFS_uint64) (((double) (*pos + *len)) * ratio) + slack;
+        start = (start > slack) ? start - slack : 0;
+        if (end > csize)
+            end = csize;
+        if (start > end)
+            start = end;
+    } /* else */
+
+    *pos = entry->offset + start;
+    *len = end - start;
+    return finfo->io;
+} /* ZIP_spanIo */
+
+
+typedef struct
+{
+    ZIPinfo *info;
+    ZIPentry **entries;  /* files to check. */
+    PHYSFS_uint32 count;
+    int next;  /* atomic; next index a worker should take, plus one. */
+    int failed;  /* atomic; non-zero once anything failed. */
+    PHYSFS_ErrorCode errcode;  /* set by the first failure. */
+} ZIPverifyBatch;
+
+static int zip_verify_entry(ZIPinfo *info, ZIPentry *entry, void *buf)
+{
+    PHYSFS_Io *io = zip_open_entry(info, entry, NULL);
+    PHYSFS_sint64 rc;
+
+    BAIL_IF_ERRPASS(!io, 0);
+    ((ZIPfileinfo *) io->opaque)->crc_check = 1;  /* whatever the app set. */
+    do
+    {
+        rc = io->read(io, buf, ZIP_READBUFSIZE);
+    } while (rc > 0);
+    io->destroy(io);
+
+    return (rc == 0);
+} /* zip_verify_entry */
+
+static void zip_verify_worker(void *data)
+{
+    ZIPverifyBatch *batch = (ZIPverifyBatch *) data;
+    void *buf = allocator.Malloc(ZIP_READBUFSIZE);
+    PHYSFS_ErrorCode err = PHYSFS_ERR_OUT_OF_MEMORY;
+    int rc = (buf != NULL);
+
+    while ((rc) && (!batch->failed))
+    {
+        const int i = __PHYSFS_ATOMIC_INCR(&batch->next) - 1;
+        if (((PHYSFS_uint32) i) >= batch->count)
+            break;
+        rc = zip_verify_entry(batch->info, batch->entries[i], buf);
+        if (!rc)
+            err = PHYSFS_getLastErrorCode();
+    } /* while */
+
+    if ((!rc) && (__PHYSFS_ATOMIC_INCR(&batch->failed) == 1))
+        batch->errcode = err;  /* only the first one gets to say why. */
+
+    allocator.Free(buf);
+} /* zip_verify_worker */
+
+
+int ZIP_verifyArchive(void *opaque, int threads)
+{
+    ZIPinfo *info = (ZIPinfo *) opaque;
+    ZIPverifyBatch batch;
+    void **workers = NULL;
+    int numworkers = 0;
+    size_t i;
+
+    memset(&batch, '\0', sizeof (batch));
+    batch.info = info;
+    batch.entries = (ZIPentry **) allocator.Malloc(sizeof (ZIPentry *) *
+                                          (info->tree.entryCount + 1));
+    BAIL_IF(!batch.entries, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    /* resolve everything up front; a bad local header is corruption too. */
+    for (i = 0; i < info->tree.hashBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *t;
+        for (t = info->tree.hash[i]; t != NULL; t = t->hashnext)
+        {
+            ZIPentry *entry = (ZIPentry *) t;
+            if (entry->tree.isdir)
+                continue;
+            else if (!zip_resolve_locked(info, entry))
+            {
+                allocator.Free(batch.entries);
+                return 0;
+            } /* else if */
+            else if (entry->symlink != NULL)
+                continue;  /* we'll check what it points to on its own. */
+            else if (zip_entry_is_tradional_crypto(entry))
+                continue;  /* no password to decrypt it; documented skip. */
+            batch.entries[batch.count++] = entry;
+        } /* for */
+    } /* for */
+
+    if ((threads > 1) && (batch.count > 1))
+    {
+        if (((PHYSFS_uint32) threads) > batch.count)
+            threads = (int) batch.count;
+        workers = (void **) allocator.Malloc(sizeof (void *) * (threads - 1));
+        if (workers != NULL)  /* if not, we'll just do it all here. */
+        {
+            while (numworkers < threads - 1)
+            {
+                void *t = __PHYSFS_platformCreateThread(zip_verify_worker,
+                                                        &batch);
+                if (t == NULL)
+                    break;  /* use what we've got. */
+                workers[numworkers++] = t;
+            } /* while */
+        } /* if */
+    } /* if */
+
+    zip_verify_worker(&batch);  /* this thread pitches in, too. */
+
+    while (numworkers > 0)
+        __PHYSFS_platformWaitThread(workers[--numworkers]);
+
+    allocator.Free(workers);
+    allocator.Free(batch.entries);
+
+    BAIL_IF(batch.failed, batch.errcode, 0);
+    return 1;
+} /* ZIP_verifyArchive */
+
+
+int ZIP_entryPos(void *opaque, const char *name, PHYSFS_uint64 *pos)
+{
+    ZIPinfo *info = (ZIPinfo *) opaque;
+    const ZIPentry *entry = zip_find_entry(info, name);
+
+    if ((!entry) && (info->has_crypto) && (strchr(name, '$') != NULL))
+        return -1;  /* maybe a password; let ZIP_openRead() sort it out. */
+
+    BAIL_IF_ERRPASS(!entry, 0);
+    BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, 0);
+
+    /* resolving moves (offset) from the local header to the data. */
+    __PHYSFS_platformGrabMutex(info->lock);
+    *pos = entry->offset;
+    __PHYSFS_platformReleaseMutex(info->lock);
+    return 1;
+} /* ZIP_entryPos */
+
+
+static int ZIP_mkdir(void *opaque, const char *name)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, 0);
+} /* ZIP_mkdir */
+
+
+/*
+ * Everything here comes from the central directory, so this doesn't have to
+ *  resolve (entry) first, and enumerating doesn't read any local headers.
+ */
+static int zipStatEntry(void *opaque, void *_entry, PHYSFS_Stat *stat)
+{
+    const ZIPentry *entry = (const ZIPentry *) _entry;
+
+    if ((entry->resolved == ZIP_DIRECTORY) || (entry->tree.isdir))
+    {
+        stat->filesize = 0;
+        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
     } /* if */
 
     else if (zip_entry_is_symlink(entry))
@@ -1674,15 +3311,965 @@ static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
         stat->filetype = PHYSFS_FILETYPE_REGULAR;
     } /* else */
 
-    stat->modtime = ((entry) ? entry->last_mod_time : 0);
+    stat->modtime = entry->last_mod_time;
     stat->createtime = stat->modtime;
     stat->accesstime = -1;
     stat->readonly = 1; /* .zip files are always read only */
 
     return 1;
+} /* zipStatEntry */
+
+
+/* For __PHYSFS_DirTree::statEntry; stat() wants symlinks resolved. */
+static int zipStatResolved(void *opaque, void *entry, PHYSFS_Stat *stat)
+{
+    if (!zip_resolve_locked((ZIPinfo *) opaque, (ZIPentry *) entry))
+        return 0;
+    return zipStatEntry(opaque, entry, stat);
+} /* zipStatResolved */
+
+
+static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
+{
+    ZIPinfo *info = (ZIPinfo *) opaque;
+    ZIPentry *entry = zip_find_entry(info, filename);
+
+    if (entry == NULL)
+        return 0;
+
+    return zipStatResolved(opaque, entry, stat);
 } /* ZIP_stat */
 
 
+static PHYSFS_EnumerateCallbackResult ZIP_enumerateStat(void *opaque,
+                               const char *dname,
+                               PHYSFS_EnumerateStatCallback cb,
+                               const char *origdir, void *callbackdata)
+{
+    return __PHYSFS_DirTreeEnumerateStat(opaque, dname, cb, origdir,
+                                         callbackdata, zipStatEntry);
+} /* ZIP_enumerateStat */
+
+
+static PHYSFS_DetectResult ZIP_detect(const void *header,
+                                      PHYSFS_uint64 headerLen,
+                                      const void *trailer,
+                                      PHYSFS_uint64 trailerLen)
+{
+    /* mirror isZip(): a local file signature up front, or an
+       end-of-central-dir signature anywhere zip_find_end_of_central_dir()
+       would look for one, which is all inside (trailer). */
+    const PHYSFS_uint8 *ptr = (const PHYSFS_uint8 *) trailer;
+    PHYSFS_uint32 sig = 0;
+    PHYSFS_uint64 i;
+
+    if (headerLen >= sizeof (sig))
+    {
+        memcpy(&sig, header, sizeof (sig));
+        if (PHYSFS_swapULE32(sig) == ZIP_LOCAL_FILE_SIG)
+            return PHYSFS_DETECT_YES;
+    } /* if */
+
+    for (i = trailerLen; i >= sizeof (sig); i--)  /* back to front, like it. */
+    {
+        memcpy(&sig, ptr + (i - sizeof (sig)), sizeof (sig));
+        if (PHYSFS_swapULE32(sig) == ZIP_END_OF_CENTRAL_DIR_SIG)
+            return PHYSFS_DETECT_YES;
+    } /* for */
+
+    return PHYSFS_DETECT_NO;
+} /* ZIP_detect */
+
+
+/*
+ * The pack writer, for PHYSFS_createPack().
+ *
+ * Entries are compressed by a pool of worker threads, but only the thread
+ *  adding them writes anything, and strictly in the order they were added:
+ *  each add queues a job, then writes out every finished job at the front
+ *  of the queue, waiting on the front one while too many are in flight.
+ *  Entries too big to hold in memory skip the queue and are stored, with
+ *  their crc-32 patched into the local header once it's known.
+ */
+#define ZIP_PACK_DEFAULT_THREADS 4
+#define ZIP_PACK_MAX_JOB (64 * 1024 * 1024)
+#define ZIP_PACK_COPY_BUFSIZE (1024 * 1024)
+#define ZIP_PACK_MAX_ALIGNMENT 32768
+#define ZIP_PACK_ALIGN_EXTRA_FIELD_SIG 0xD935  /* what Android's zipalign uses. */
+#define ZIP_PACK_UTF8_NAMES (1 << 11)  /* general purpose bit 11. */
+#define ZIP_PACK_DOS_EPOCH 0x00210000  /* 1980-01-01 00:00:00, MS-DOS style. */
+#define ZIP_LOCAL_FILE_HEADERLEN 30
+
+typedef struct
+{
+    char *name;
+    PHYSFS_uint16 method;
+    PHYSFS_uint32 crc;
+    PHYSFS_uint64 compressed_size;
+    PHYSFS_uint64 uncompressed_size;
+    PHYSFS_uint64 offset;  /* of the local header. */
+} ZIPpackEntry;
+
+typedef struct _ZIPpackJob
+{
+    PHYSFS_uint64 entry;        /* index into the pack's (entries).       */
+    PHYSFS_uint8 *data;         /* the file, uncompressed.                */
+    PHYSFS_uint64 len;          /* bytes at (data).                       */
+    int compress;               /* try to compress it?                    */
+    PHYSFS_uint8 *out;          /* compressed data, or NULL to store it.  */
+    size_t outlen;              /* bytes at (out).                        */
+    PHYSFS_uint32 crc;          /* crc-32 of (data).                      */
+    int done;                   /* a worker is finished with it.          */
+    struct _ZIPpackJob *next;   /* the job added after this one.          */
+} ZIPpackJob;
+
+typedef struct
+{
+    PHYSFS_Io *io;                 /* the pack itself.                       */
+    char *path;                    /* where it is, to delete it on failure.  */
+    PHYSFS_PackCompression compression;
+    int level;                     /* zero for the method's default.         */
+    PHYSFS_uint32 alignment;       /* for stored entries' data.              */
+    PHYSFS_uint32 dostime;         /* every entry's mod time.                */
+    PHYSFS_uint64 pos;             /* bytes written so far.                  */
+    ZIPpackEntry *entries;         /* in the order they were added.          */
+    PHYSFS_uint64 entrycount;
+    PHYSFS_uint64 entryalloc;
+    int zip64;                     /* needs Zip64 end-of-central-dir records. */
+    void *lock;                    /* guards the job list.                   */
+    void *work;                    /* posted for each job queued.            */
+    void *done;                    /* posted for each job finished.          */
+    ZIPpackJob *head;              /* oldest job not written yet.            */
+    ZIPpackJob *tail;              /* newest job.                            */
+    ZIPpackJob *queued;            /* oldest job no worker has taken yet.    */
+    PHYSFS_uint32 inflight;        /* jobs from (head) to (tail).            */
+    void **workers;
+    PHYSFS_uint32 numworkers;
+    int quit;                      /* workers should exit.                   */
+    PHYSFS_ErrorCode failed;       /* first error, PHYSFS_ERR_OK if none.    */
+} ZIPpack;
+
+
+static void zip_pack_le(PHYSFS_uint8 *ptr, PHYSFS_uint64 val, size_t len)
+{
+    for (; len > 0; len--, val >>= 8)
+        *(ptr++) = (PHYSFS_uint8) (val & 0xFF);
+} /* zip_pack_le */
+
+
+/* Can this build write (compression)? */
+static int zip_pack_can_encode(const PHYSFS_PackCompression compression)
+{
+    switch (compression)
+    {
+        case PHYSFS_PACK_STORE: return 1;
+#if PHYSFS_ZIP_HAVE_LIBDEFLATE || PHYSFS_ZIP_SYSTEM_ZLIB
+        case PHYSFS_PACK_DEFLATE: return 1;
+#endif
+#if PHYSFS_ZIP_HAVE_ZSTD
+        case PHYSFS_PACK_ZSTD: return 1;
+#endif
+        default: break;
+    } /* switch */
+
+    return 0;
+} /* zip_pack_can_encode */
+
+
+/* Compress (len) bytes at (src) with (pack)'s method. Returns NULL if it
+   can't, or if it didn't get any smaller; the entry is just stored then. */
+static PHYSFS_uint8 *zip_pack_encode(const ZIPpack *pack,
+                                     const PHYSFS_uint8 *src,
+                                     const size_t len, size_t *outlen)
+{
+    PHYSFS_uint8 *retval = NULL;
+    size_t rc = 0;
+
+    if (pack->compression == PHYSFS_PACK_DEFLATE)
+    {
+#if PHYSFS_ZIP_HAVE_LIBDEFLATE
+        struct libdeflate_compressor *c;
+        c = libdeflate_alloc_compressor(pack->level ? pack->level : 6);
+        if (c != NULL)
+        {
+            const size_t bound = libdeflate_deflate_compress_bound(c, len);
+            retval = (PHYSFS_uint8 *) allocator.Malloc(bound);
+            if (retval != NULL)
+                rc = libdeflate_deflate_compress(c, src, len, retval, bound);
+            libdeflate_free_compressor(c);
+        } /* if */
+#elif PHYSFS_ZIP_SYSTEM_ZLIB
+        const int level = (pack->level == 0) ? Z_DEFAULT_COMPRESSION :
+                          ((pack->level > 9) ? 9 : pack->level);
+        z_stream stream;
+
+        initializeZStream(&stream);
+        if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK)
+        {
+            const size_t bound = (size_t) deflateBound(&stream, (uLong) len);
+            retval = (PHYSFS_uint8 *) allocator.Malloc(bound);
+            if (retval != NULL)
+            {
+                /* jobs are never more than ZIP_PACK_MAX_JOB bytes. */
+                stream.next_in = src;
+                stream.avail_in = (uInt) len;
+                stream.next_out = retval;
+                stream.avail_out = (uInt) bound;
+                if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+                    rc = (size_t) stream.total_out;
+            } /* if */
+            deflateEnd(&stream);
+        } /* if */
+#endif
+    } /* if */
+
+#if PHYSFS_ZIP_HAVE_ZSTD
+    else if (pack->compression == PHYSFS_PACK_ZSTD)
+    {
+        const size_t bound = ZSTD_compressBound(len);
+        retval = (PHYSFS_uint8 *) allocator.Malloc(bound);
+        if (retval != NULL)
+        {
+            const int level = pack->level ? pack->level : ZSTD_CLEVEL_DEFAULT;
+            rc = ZSTD_compress(retval, bound, src, len, level);
+            if (ZSTD_isError(rc))
+                rc = 0;
+        } /* if */
+    } /* else if */
+#endif
+
+    if ((rc == 0) || (rc >= len))  /* failed, or not worth it. */
+    {
+        if (retval != NULL)
+            allocator.Free(retval);
+        return NULL;
+    } /* if */
+
+    *outlen = rc;
+    return retval;
+} /* zip_pack_encode */
+
+
+static PHYSFS_uint16 zip_pack_method(const ZIPpack *pack, const int compressed)
+{
+    if (!compressed)
+        return COMPMETH_NONE;
+    return (pack->compression == PHYSFS_PACK_ZSTD) ?
+                COMPMETH_ZSTD : COMPMETH_DEFLATE;
+} /* zip_pack_method */
+
+
+/* "version needed to extract": 1.0 to store, 2.0 to deflate, 4.5 for Zip64
+   and 6.3 for Zstandard. (zip64) depends on the local header's offset,
+   too, so it's the same in both headers. */
+static PHYSFS_uint16 zip_pack_version(const ZIPpackEntry *entry)
+{
+    const int zip64 = (entry->compressed_size >= 0xFFFFFFFF) ||
+                      (entry->uncompressed_size >= 0xFFFFFFFF) ||
+                      (entry->offset >= 0xFFFFFFFF);
+    PHYSFS_uint16 retval = 10;
+
+    if (entry->method == COMPMETH_ZSTD)
+        retval = 63;
+    else if (entry->method == COMPMETH_DEFLATE)
+        retval = 20;
+
+    if ((zip64) && (retval < 45))
+        retval = 45;
+
+    return retval;
+} /* zip_pack_version */
+
+
+static PHYSFS_uint32 zip_pack_dos_time(const PHYSFS_sint64 modtime)
+{
+    const time_t t = (time_t) modtime;
+    const struct tm *tm;
+
+    if (modtime <= 0)
+        return ZIP_PACK_DOS_EPOCH;
+
+    tm = gmtime(&t);
+    if ((tm == NULL) || (tm->tm_year < 80) || (tm->tm_year > 80 + 127))
+        return ZIP_PACK_DOS_EPOCH;  /* a .zip can't say when that was. */
+
+    return (((PHYSFS_uint32) (tm->tm_year - 80)) << 25) |
+           (((PHYSFS_uint32) (tm->tm_mon + 1)) << 21) |
+           (((PHYSFS_uint32) tm->tm_mday) << 16) |
+           (((PHYSFS_uint32) tm->tm_hour) << 11) |
+           (((PHYSFS_uint32) tm->tm_min) << 5) |
+           (((PHYSFS_uint32) tm->tm_sec) >> 1);
+} /* zip_pack_dos_time */
+
+
+static int zip_pack_write(ZIPpack *pack, const void *buf,
+                          const PHYSFS_uint64 len)
+{
+    PHYSFS_Io *io = pack->io;
+    if (len > 0)
+        BAIL_IF_ERRPASS(io->write(io, buf, len) != (PHYSFS_sint64) len, 0);
+    pack->pos += len;
+    return 1;
+} /* zip_pack_write */
+
+
+/* Add a central directory entry for (name), with the sizes still zero. */
+static ZIPpackEntry *zip_pack_new_entry(ZIPpack *pack, const char *name)
+{
+    const size_t namelen = strlen(name);
+    ZIPpackEntry *entry;
+
+    BAIL_IF((namelen == 0) || (namelen > 0xFFFF), PHYSFS_ERR_BAD_FILENAME, NULL);
+
+    if (pack->entrycount == pack->entryalloc)
+    {
+        const PHYSFS_uint64 newalloc = pack->entryalloc ?
+                                       pack->entryalloc * 2 : 256;
+        void *ptr = allocator.Realloc(pack->entries,
+                                      (size_t) (newalloc * sizeof (*entry)));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        pack->entries = (ZIPpackEntry *) ptr;
+        pack->entryalloc = newalloc;
+    } /* if */
+
+    entry = &pack->entries[pack->entrycount];
+    memset(entry, '\0', sizeof (*entry));
+    entry->name = (char *) allocator.Malloc(namelen + 1);
+    BAIL_IF(!entry->name, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(entry->name, name, namelen + 1);
+    pack->entrycount++;
+    return entry;
+} /* zip_pack_new_entry */
+
+
+/* Write (entry)'s local header, here; its data goes right after it. Stored
+   entries are padded with an extra field, so their data is aligned. */
+static int zip_pack_write_local(ZIPpack *pack, ZIPpackEntry *entry)
+{
+    const size_t namelen = strlen(entry->name);
+    PHYSFS_uint8 *hdr;
+    PHYSFS_uint8 *ptr;
+    size_t extralen = 0;
+    size_t pad = 0;
+    size_t hdrlen;
+    int zip64;
+    int rc;
+
+    entry->offset = pack->pos;
+    zip64 = (entry->compressed_size >= 0xFFFFFFFF) ||
+            (entry->uncompressed_size >= 0xFFFFFFFF);
+    if (zip64)
+        extralen += 20;
+
+    if ((entry->method == COMPMETH_NONE) && (pack->alignment > 1))
+    {
+        const PHYSFS_uint64 datapos = pack->pos + ZIP_LOCAL_FILE_HEADERLEN +
+                                      namelen + extralen;
+        const PHYSFS_uint32 align = pack->alignment;
+        pad = (size_t) ((align - (datapos % align)) % align);
+        if ((pad > 0) && (pad < 4))
+            pad += align;  /* has to fit the extra field's own header. */
+        extralen += pad;
+    } /* if */
+
+    hdrlen = ZIP_LOCAL_FILE_HEADERLEN + namelen + extralen;
+    hdr = (PHYSFS_uint8 *) __PHYSFS_smallAlloc(hdrlen);
+    BAIL_IF(!hdr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(hdr, '\0', hdrlen);
+
+    zip_pack_le(hdr, ZIP_LOCAL_FILE_SIG, 4);
+    zip_pack_le(hdr + 4, zip_pack_version(entry), 2);
+    zip_pack_le(hdr + 6, ZIP_PACK_UTF8_NAMES, 2);
+    zip_pack_le(hdr + 8, entry->method, 2);
+    zip_pack_le(hdr + 10, pack->dostime, 4);
+    zip_pack_le(hdr + 14, entry->crc, 4);
+    zip_pack_le(hdr + 18, zip64 ? 0xFFFFFFFF : entry->compressed_size, 4);
+    zip_pack_le(hdr + 22, zip64 ? 0xFFFFFFFF : entry->uncompressed_size, 4);
+    zip_pack_le(hdr + 26, namelen, 2);
+    zip_pack_le(hdr + 28, extralen, 2);
+    memcpy(hdr + ZIP_LOCAL_FILE_HEADERLEN, entry->name, namelen);
+
+    ptr = hdr + ZIP_LOCAL_FILE_HEADERLEN + namelen;
+    if (zip64)  /* a local header has both sizes, or neither. */
+    {
+        zip_pack_le(ptr, ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG, 2);
+        zip_pack_le(ptr + 2, 16, 2);
+        zip_pack_le(ptr + 4, entry->uncompressed_size, 8);
+        zip_pack_le(ptr + 12, entry->compressed_size, 8);
+        ptr += 20;
+    } /* if */
+
+    if (pad > 0)  /* the rest of the padding is already zeroed. */
+    {
+        zip_pack_le(ptr, ZIP_PACK_ALIGN_EXTRA_FIELD_SIG, 2);
+        zip_pack_le(ptr + 2, pad - 4, 2);
+    } /* if */
+
+    rc = zip_pack_write(pack, hdr, hdrlen);
+    __PHYSFS_smallFree(hdr);
+    return rc;
+} /* zip_pack_write_local */
+
+
+/* Write (entry)'s central directory record. */
+static int zip_pack_write_central(ZIPpack *pack, const ZIPpackEntry *entry)
+{
+    const size_t namelen = strlen(entry->name);
+    const int bigusize = (entry->uncompressed_size >= 0xFFFFFFFF);
+    const int bigcsize = (entry->compressed_size >= 0xFFFFFFFF);
+    const int bigofs = (entry->offset >= 0xFFFFFFFF);
+    const size_t extralen = (bigusize || bigcsize || bigofs) ?
+                            (4 + (8 * (bigusize + bigcsize + bigofs))) : 0;
+    const size_t hdrlen = ZIP_CENTRAL_DIR_RECORDLEN + namelen + extralen;
+    const PHYSFS_uint16 version = zip_pack_version(entry);
+    PHYSFS_uint8 *hdr;
+    PHYSFS_uint8 *ptr;
+    int rc;
+
+    hdr = (PHYSFS_uint8 *) __PHYSFS_smallAlloc(hdrlen);
+    BAIL_IF(!hdr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(hdr, '\0', hdrlen);
+
+    /* "made by" MS-DOS, so nothing takes the attributes for Unix ones. The
+       disk number, comment and attributes stay zero. */
+    zip_pack_le(hdr, ZIP_CENTRAL_DIR_SIG, 4);
+    zip_pack_le(hdr + 4, version, 2);
+    zip_pack_le(hdr + 6, version, 2);
+    zip_pack_le(hdr + 8, ZIP_PACK_UTF8_NAMES, 2);
+    zip_pack_le(hdr + 10, entry->method, 2);
+    zip_pack_le(hdr + 12, pack->dostime, 4);
+    zip_pack_le(hdr + 16, entry->crc, 4);
+    zip_pack_le(hdr + 20, bigcsize ? 0xFFFFFFFF : entry->compressed_size, 4);
+    zip_pack_le(hdr + 24, bigusize ? 0xFFFFFFFF : entry->uncompressed_size, 4);
+    zip_pack_le(hdr + 28, namelen, 2);
+    zip_pack_le(hdr + 30, extralen, 2);
+    zip_pack_le(hdr + 42, bigofs ? 0xFFFFFFFF : entry->offset, 4);
+    memcpy(hdr + ZIP_CENTRAL_DIR_RECORDLEN, entry->name, namelen);
+
+    ptr = hdr + ZIP_CENTRAL_DIR_RECORDLEN + namelen;
+    if (extralen > 0)  /* only what didn't fit, in this order. */
+    {
+        pack->zip64 = 1;
+        zip_pack_le(ptr, ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG, 2);
+        zip_pack_le(ptr + 2, extralen - 4, 2);
+        ptr += 4;
+        if (bigusize)
+        {
+            zip_pack_le(ptr, entry->uncompressed_size, 8);
+            ptr += 8;
+        } /* if */
+        if (bigcsize)
+        {
+            zip_pack_le(ptr, entry->compressed_size, 8);
+            ptr += 8;
+        } /* if */
+        if (bigofs)
+            zip_pack_le(ptr, entry->offset, 8);
+    } /* if */
+
+    rc = zip_pack_write(pack, hdr, hdrlen);
+    __PHYSFS_smallFree(hdr);
+    return rc;
+} /* zip_pack_write_central */
+
+
+/* Write the end-of-central-dir record, and the Zip64 ones, if we need them. */
+static int zip_pack_write_end(ZIPpack *pack, const PHYSFS_uint64 cdir_ofs)
+{
+    const PHYSFS_uint64 cdir_len = pack->pos - cdir_ofs;
+    const PHYSFS_uint64 count = pack->entrycount;
+    PHYSFS_uint8 buf[56 + 20 + 22];
+    PHYSFS_uint8 *ptr = buf;
+
+    memset(buf, '\0', sizeof (buf));
+
+    if ((pack->zip64) || (count >= 0xFFFF) ||
+        (cdir_ofs >= 0xFFFFFFFF) || (cdir_len >= 0xFFFFFFFF))
+    {
+        const PHYSFS_uint64 zip64_ofs = pack->pos;
+        zip_pack_le(ptr, ZIP64_END_OF_CENTRAL_DIR_SIG, 4);
+        zip_pack_le(ptr + 4, 56 - 12, 8);  /* the rest of this record. */
+        zip_pack_le(ptr + 12, 45, 2);
+        zip_pack_le(ptr + 14, 45, 2);
+        zip_pack_le(ptr + 24, count, 8);
+        zip_pack_le(ptr + 32, count, 8);
+        zip_pack_le(ptr + 40, cdir_len, 8);
+        zip_pack_le(ptr + 48, cdir_ofs, 8);
+        ptr += 56;
+
+        zip_pack_le(ptr, ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG, 4);
+        zip_pack_le(ptr + 8, zip64_ofs, 8);
+        zip_pack_le(ptr + 16, 1, 4);  /* total number of disks. */
+        ptr += 20;
+    } /* if */
+
+    zip_pack_le(ptr, ZIP_END_OF_CENTRAL_DIR_SIG, 4);
+    zip_pack_le(ptr + 8, (count >= 0xFFFF) ? 0xFFFF : count, 2);
+    zip_pack_le(ptr + 10, (count >= 0xFFFF) ? 0xFFFF : count, 2);
+    zip_pack_le(ptr + 12, (cdir_len >= 0xFFFFFFFF) ? 0xFFFFFFFF : cdir_len, 4);
+    zip_pack_le(ptr + 16, (cdir_ofs >= 0xFFFFFFFF) ? 0xFFFFFFFF : cdir_ofs, 4);
+    ptr += 22;
+
+    return zip_pack_write(pack, buf, (PHYSFS_uint64) (ptr - buf));
+} /* zip_pack_write_end */
+
+
+/* CRC and maybe compress a job's data. Workers run this without the lock;
+   nothing else touches (job) until it's marked done. */
+static void zip_pack_run_job(const ZIPpack *pack, ZIPpackJob *job)
+{
+    job->crc = __PHYSFS_crc32(0, job->data, (size_t) job->len);
+    if (job->compress)
+        job->out = zip_pack_encode(pack, job->data, (size_t) job->len,
+                                   &job->outlen);
+    if (job->out != NULL)  /* don't need this anymore. */
+    {
+        allocator.Free(job->data);
+        job->data = NULL;
+    } /* if */
+} /* zip_pack_run_job */
+
+
+static void zip_pack_free_job(ZIPpackJob *job)
+{
+    if (job->data != NULL)
+        allocator.Free(job->data);
+    if (job->out != NULL)
+        allocator.Free(job->out);
+    allocator.Free(job);
+} /* zip_pack_free_job */
+
+
+static int zip_pack_write_job(ZIPpack *pack, const ZIPpackJob *job)
+{
+    ZIPpackEntry *entry = &pack->entries[job->entry];
+    const int compressed = (job->out != NULL);
+
+    entry->method = zip_pack_method(pack, compressed);
+    entry->crc = job->crc;
+    entry->uncompressed_size = job->len;
+    entry->compressed_size = compressed ? job->outlen : job->len;
+
+    BAIL_IF_ERRPASS(!zip_pack_write_local(pack, entry), 0);
+    if (compressed)
+        return zip_pack_write(pack, job->out, job->outlen);
+    return zip_pack_write(pack, job->data, job->len);
+} /* zip_pack_write_job */
+
+
+static void zip_pack_worker(void *data)
+{
+    ZIPpack *pack = (ZIPpack *) data;
+
+    while (1)
+    {
+        ZIPpackJob *job;
+
+        __PHYSFS_platformWaitSemaphore(pack->work);
+        __PHYSFS_platformGrabMutex(pack->lock);
+        if (pack->quit)
+        {
+            __PHYSFS_platformReleaseMutex(pack->lock);
+            break;
+        } /* if */
+        job = pack->queued;
+        assert(job != NULL);  /* there's a post for every job queued. */
+        pack->queued = job->next;
+        __PHYSFS_platformReleaseMutex(pack->lock);
+
+        zip_pack_run_job(pack, job);
+
+        __PHYSFS_platformGrabMutex(pack->lock);
+        job->done = 1;
+        __PHYSFS_platformReleaseMutex(pack->lock);
+        __PHYSFS_platformPostSemaphore(pack->done);
+    } /* while */
+} /* zip_pack_worker */
+
+
+/* Write out finished jobs, oldest first, until no more than (maxinflight)
+   are left. After a failure, this just throws them away. */
+static int zip_pack_drain(ZIPpack *pack, const PHYSFS_uint32 maxinflight)
+{
+    while (pack->inflight > maxinflight)
+    {
+        ZIPpackJob *job = pack->head;
+        int done;
+
+        __PHYSFS_platformGrabMutex(pack->lock);
+        done = job->done;
+        if (done)
+        {
+            pack->head = job->next;
+            if (pack->head == NULL)
+                pack->tail = NULL;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(pack->lock);
+
+        if (!done)
+        {
+            /* posts can be left over from jobs we didn't wait for, so
+               this might not be the one we want; we'll check again. */
+            __PHYSFS_platformWaitSemaphore(pack->done);
+            continue;
+        } /* if */
+
+        pack->inflight--;
+        if ((pack->failed == PHYSFS_ERR_OK) && (!zip_pack_write_job(pack, job)))
+            pack->failed = PHYSFS_getLastErrorCode();
+        zip_pack_free_job(job);
+    } /* while */
+
+    BAIL_IF(pack->failed != PHYSFS_ERR_OK, pack->failed, 0);
+    return 1;
+} /* zip_pack_drain */
+
+
+/* Hand (data) to a worker, or run it here if there aren't any. The job
+   owns (data) from here on, even if this fails. */
+static int zip_pack_queue(ZIPpack *pack, const char *name, PHYSFS_uint8 *data,
+                          const PHYSFS_uint64 len, const int compress)
+{
+    ZIPpackJob *job;
+
+    GOTO_IF_ERRPASS(!zip_pack_new_entry(pack, name), queueFailed);
+    job = (ZIPpackJob *) allocator.Malloc(sizeof (ZIPpackJob));
+    GOTO_IF(!job, PHYSFS_ERR_OUT_OF_MEMORY, queueFailed);
+
+    memset(job, '\0', sizeof (*job));
+    job->entry = pack->entrycount - 1;
+    job->data = data;
+    job->len = len;
+    job->compress = ((compress) && (len > 0) &&
+                     (pack->compression != PHYSFS_PACK_STORE));
+
+    if (pack->numworkers == 0)
+    {
+        zip_pack_run_job(pack, job);
+        job->done = 1;
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(pack->lock);
+    if (pack->tail == NULL)
+        pack->head = job;
+    else
+        pack->tail->next = job;
+    pack->tail = job;
+    if ((pack->numworkers > 0) && (pack->queued == NULL))
+        pack->queued = job;
+    __PHYSFS_platformReleaseMutex(pack->lock);
+
+    pack->inflight++;
+    if (pack->numworkers > 0)
+        __PHYSFS_platformPostSemaphore(pack->work);
+
+    /* a couple each keeps the workers busy while we write. */
+    return zip_pack_drain(pack, pack->numworkers * 2);
+
+queueFailed:
+    allocator.Free(data);
+    return 0;
+} /* zip_pack_queue */
+
+
+/* Store (len) bytes from (buf), or from (io) if (buf) is NULL, right now,
+   without holding it all in memory. */
+static int zip_pack_stream(ZIPpack *pack, const char *name,
+                           const PHYSFS_uint8 *buf, PHYSFS_Io *io,
+                           const PHYSFS_uint64 len)
+{
+    PHYSFS_uint8 *tmp = NULL;
+    PHYSFS_uint8 crcbuf[4];
+    ZIPpackEntry *entry;
+    PHYSFS_uint64 remain;
+    PHYSFS_uint32 crc = 0;
+
+    BAIL_IF_ERRPASS(!zip_pack_drain(pack, 0), 0);  /* keep them in order. */
+
+    entry = zip_pack_new_entry(pack, name);
+    BAIL_IF_ERRPASS(!entry, 0);
+    entry->method = COMPMETH_NONE;
+    entry->compressed_size = entry->uncompressed_size = len;
+    BAIL_IF_ERRPASS(!zip_pack_write_local(pack, entry), 0);
+
+    if (buf == NULL)
+    {
+        tmp = (PHYSFS_uint8 *) allocator.Malloc(ZIP_PACK_COPY_BUFSIZE);
+        BAIL_IF(!tmp, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+
+    for (remain = len; remain > 0; )
+    {
+        const size_t chunk = (remain < ZIP_PACK_COPY_BUFSIZE) ?
+                             (size_t) remain : ZIP_PACK_COPY_BUFSIZE;
+        const PHYSFS_uint8 *ptr = buf ? buf + (len - remain) : tmp;
+        if (buf == NULL)
+            GOTO_IF_ERRPASS(!__PHYSFS_readAll(io, tmp, chunk), streamFailed);
+        crc = __PHYSFS_crc32(crc, ptr, chunk);
+        GOTO_IF_ERRPASS(!zip_pack_write(pack, ptr, chunk), streamFailed);
+        remain -= chunk;
+    } /* for */
+
+    if (tmp != NULL)
+        allocator.Free(tmp);
+
+    /* now that we know it, go back and fill in the crc-32. */
+    entry->crc = crc;
+    zip_pack_le(crcbuf, crc, sizeof (crcbuf));
+    BAIL_IF_ERRPASS(!pack->io->seek(pack->io, entry->offset + 14), 0);
+    BAIL_IF_ERRPASS(pack->io->write(pack->io, crcbuf, 4) != 4, 0);
+    BAIL_IF_ERRPASS(!pack->io->seek(pack->io, pack->pos), 0);
+    return 1;
+
+streamFailed:
+    if (tmp != NULL)
+        allocator.Free(tmp);
+    return 0;
+} /* zip_pack_stream */
+
+
+static void zip_pack_fail(ZIPpack *pack)
+{
+    if (pack->failed == PHYSFS_ERR_OK)
+    {
+        pack->failed = PHYSFS_getLastErrorCode();
+        if (pack->failed == PHYSFS_ERR_OK)
+            pack->failed = PHYSFS_ERR_OTHER_ERROR;
+    } /* if */
+} /* zip_pack_fail */
+
+
+static int zip_pack_cmp(void *_a, size_t one, size_t two)
+{
+    const ZIPpackEntry *entries = (const ZIPpackEntry *) _a;
+    return strcmp(entries[one].name, entries[two].name);
+} /* zip_pack_cmp */
+
+
+static void zip_pack_swap(void *_a, size_t one, size_t two)
+{
+    ZIPpackEntry *entries = (ZIPpackEntry *) _a;
+    ZIPpackEntry tmp;
+    memcpy(&tmp, &entries[one], sizeof (tmp));
+    memcpy(&entries[one], &entries[two], sizeof (tmp));
+    memcpy(&entries[two], &tmp, sizeof (tmp));
+} /* zip_pack_swap */
+
+
+/* Sort the central directory by name, so directories come before what's in
+   them, and write it. */
+static int zip_pack_finish(ZIPpack *pack)
+{
+    const PHYSFS_uint64 cdir_ofs = pack->pos;
+    PHYSFS_uint64 i;
+
+    if (pack->entrycount > 1)
+    {
+        __PHYSFS_sort(pack->entries, (size_t) pack->entrycount,
+                      zip_pack_cmp, zip_pack_swap);
+    } /* if */
+
+    for (i = 0; i < pack->entrycount; i++)
+    {
+        const ZIPpackEntry *entry = &pack->entries[i];
+        BAIL_IF((i > 0) && (strcmp(entry[-1].name, entry->name) == 0),
+                PHYSFS_ERR_DUPLICATE, 0);
+        BAIL_IF_ERRPASS(!zip_pack_write_central(pack, entry), 0);
+    } /* for */
+
+    BAIL_IF_ERRPASS(!zip_pack_write_end(pack, cdir_ofs), 0);
+    return pack->io->flush(pack->io);
+} /* zip_pack_finish */
+
+
+/* Stop the workers, free everything, and delete the pack if it failed. */
+static void zip_pack_free(ZIPpack *pack)
+{
+    PHYSFS_uint64 i;
+
+    if (pack->numworkers > 0)
+    {
+        __PHYSFS_platformGrabMutex(pack->lock);
+        pack->quit = 1;
+        __PHYSFS_platformReleaseMutex(pack->lock);
+        for (i = 0; i < pack->numworkers; i++)
+            __PHYSFS_platformPostSemaphore(pack->work);
+        for (i = 0; i < pack->numworkers; i++)
+            __PHYSFS_platformWaitThread(pack->workers[i]);
+    } /* if */
+
+    while (pack->head != NULL)
+    {
+        ZIPpackJob *next = pack->head->next;
+        zip_pack_free_job(pack->head);
+        pack->head = next;
+    } /* while */
+
+    for (i = 0; i < pack->entrycount; i++)
+        allocator.Free(pack->entries[i].name);
+
+    if (pack->io != NULL)
+    {
+        pack->io->destroy(pack->io);
+        if (pack->failed != PHYSFS_ERR_OK)
+            __PHYSFS_platformDelete(pack->path);
+    } /* if */
+
+    if (pack->work != NULL)
+        __PHYSFS_platformDestroySemaphore(pack->work);
+    if (pack->done != NULL)
+        __PHYSFS_platformDestroySemaphore(pack->done);
+    if (pack->lock != NULL)
+        __PHYSFS_platformDestroyMutex(pack->lock);
+
+    allocator.Free(pack->workers);
+    allocator.Free(pack->entries);
+    allocator.Free(pack->path);
+    allocator.Free(pack);
+} /* zip_pack_free */
+
+
+void *ZIP_createPack(const char *path, const PHYSFS_PackOptions *opts)
+{
+    const PHYSFS_uint32 align = opts->alignment;
+    PHYSFS_uint32 threads = opts->threads;
+    ZIPpack *pack;
+
+    BAIL_IF(!zip_pack_can_encode(opts->compression), PHYSFS_ERR_UNSUPPORTED, NULL);
+    BAIL_IF((align > ZIP_PACK_MAX_ALIGNMENT) || (align & (align - 1)),
+            PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+
+    pack = (ZIPpack *) allocator.Malloc(sizeof (ZIPpack));
+    BAIL_IF(!pack, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(pack, '\0', sizeof (*pack));
+    pack->compression = opts->compression;
+    pack->level = opts->level;
+    pack->alignment = align;
+    pack->dostime = zip_pack_dos_time(opts->modtime);
+
+    pack->path = (char *) allocator.Malloc(strlen(path) + 1);
+    GOTO_IF(!pack->path, PHYSFS_ERR_OUT_OF_MEMORY, createPackFailed);
+    strcpy(pack->path, path);
+
+    pack->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!pack->lock, createPackFailed);
+
+    pack->io = __PHYSFS_createNativeIo(path, 'w');
+    GOTO_IF_ERRPASS(!pack->io, createPackFailed);
+
+    /* with nothing to compress, workers would only copy things around. */
+    if (threads == 0)
+        threads = ZIP_PACK_DEFAULT_THREADS;
+    if ((threads > 1) && (pack->compression != PHYSFS_PACK_STORE))
+    {
+        pack->work = __PHYSFS_platformCreateSemaphore(0);
+        pack->done = __PHYSFS_platformCreateSemaphore(0);
+        pack->workers = (void **) allocator.Malloc(sizeof (void *) *
+                                                   (threads - 1));
+        if ((pack->work != NULL) && (pack->done != NULL) &&
+            (pack->workers != NULL))  /* if not, we'll do it all here. */
+        {
+            while (pack->numworkers < threads - 1)
+            {
+                void *t = __PHYSFS_platformCreateThread(zip_pack_worker, pack);
+                if (t == NULL)
+                    break;  /* use what we've got. */
+                pack->workers[pack->numworkers++] = t;
+            } /* while */
+        } /* if */
+    } /* if */
+
+    return pack;
+
+createPackFailed:
+    zip_pack_fail(pack);
+    zip_pack_free(pack);
+    return NULL;
+} /* ZIP_createPack */
+
+
+int ZIP_packAdd(void *opaque, const char *name, const void *buf,
+                const PHYSFS_uint64 len, const int compress)
+{
+    ZIPpack *pack = (ZIPpack *) opaque;
+    PHYSFS_uint8 *data;
+    int rc;
+
+    BAIL_IF(pack->failed != PHYSFS_ERR_OK, pack->failed, 0);
+
+    if (len > ZIP_PACK_MAX_JOB)
+        rc = zip_pack_stream(pack, name, (const PHYSFS_uint8 *) buf, NULL, len);
+    else
+    {
+        data = (PHYSFS_uint8 *) allocator.Malloc(len ? (size_t) len : 1);
+        if (data == NULL)
+        {
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+            rc = 0;
+        } /* if */
+        else
+        {
+            memcpy(data, buf, (size_t) len);
+            rc = zip_pack_queue(pack, name, data, len, compress);
+        } /* else */
+    } /* else */
+
+    if (!rc)
+        zip_pack_fail(pack);
+    return rc;
+} /* ZIP_packAdd */
+
+
+int ZIP_packAddIo(void *opaque, const char *name, PHYSFS_Io *io,
+                  const int compress)
+{
+    ZIPpack *pack = (ZIPpack *) opaque;
+    const PHYSFS_sint64 len = io->length(io);
+    PHYSFS_uint8 *data;
+    int rc = 0;
+
+    BAIL_IF(pack->failed != PHYSFS_ERR_OK, pack->failed, 0);
+
+    if (len < 0)
+        rc = 0;
+    else if (len > ZIP_PACK_MAX_JOB)
+        rc = zip_pack_stream(pack, name, NULL, io, (PHYSFS_uint64) len);
+    else
+    {
+        data = (PHYSFS_uint8 *) allocator.Malloc(len ? (size_t) len : 1);
+        if (data == NULL)
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+        else if (!__PHYSFS_readAll(io, data, (size_t) len))
+            allocator.Free(data);
+        else
+            rc = zip_pack_queue(pack, name, data, (PHYSFS_uint64) len, compress);
+    } /* else */
+
+    if (!rc)
+        zip_pack_fail(pack);
+    return rc;
+} /* ZIP_packAddIo */
+
+
+int ZIP_closePack(void *opaque)
+{
+    ZIPpack *pack = (ZIPpack *) opaque;
+    PHYSFS_ErrorCode err;
+
+    /* this waits for, and throws away, everything queued after a failure. */
+    if (!zip_pack_drain(pack, 0))
+        zip_pack_fail(pack);
+    else if (!zip_pack_finish(pack))
+        zip_pack_fail(pack);
+
+    err = pack->failed;
+    zip_pack_free(pack);
+    BAIL_IF(err != PHYSFS_ERR_OK, err, 0);
+    return 1;
+} /* ZIP_closePack */
+
+
 const PHYSFS_Archiver __PHYSFS_Archiver_ZIP =
 {
     CURRENT_PHYSFS_ARCHIVER_API_VERSION,
@@ -1701,7 +4288,9 @@ const PHYSFS_Archiver __PHYSFS_Archiver_ZIP =
     ZIP_remove,
     ZIP_mkdir,
     ZIP_stat,
-    ZIP_closeArchive
+    ZIP_closeArchive,
+    ZIP_enumerateStat,
+    ZIP_detect
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_ZIP */
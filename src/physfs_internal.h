@@ -107,21 +107,67 @@ const void *__PHYSFS_winrtCalcBaseDir(void);
 const void *__PHYSFS_winrtCalcPrefDir(void);
 #endif
 
-/* atomic operations. */
+/* atomic operations. These all return the new value, like the Win32 API. */
 #if defined(_MSC_VER) && (_MSC_VER >= 1500)
 #include <intrin.h>
 __PHYSFS_COMPILE_TIME_ASSERT(LongEqualsInt, sizeof (int) == sizeof (long));
 #define __PHYSFS_ATOMIC_INCR(ptrval) _InterlockedIncrement((long*)(ptrval))
 #define __PHYSFS_ATOMIC_DECR(ptrval) _InterlockedDecrement((long*)(ptrval))
 #elif defined(__clang__) || (defined(__GNUC__) && (((__GNUC__ * 10000) + (__GNUC_MINOR__ * 100)) >= 40100))
-#define __PHYSFS_ATOMIC_INCR(ptrval) __sync_fetch_and_add(ptrval, 1)
-#define __PHYSFS_ATOMIC_DECR(ptrval) __sync_fetch_and_add(ptrval, -1)
+#define __PHYSFS_ATOMIC_INCR(ptrval) __sync_add_and_fetch(ptrval, 1)
+#define __PHYSFS_ATOMIC_DECR(ptrval) __sync_sub_and_fetch(ptrval, 1)
 #else
 #define PHYSFS_NEED_ATOMIC_OP_FALLBACK 1
 int __PHYSFS_ATOMIC_INCR(int *ptrval);
 int __PHYSFS_ATOMIC_DECR(int *ptrval);
 #endif
 
+/* 64-bit counters for statistics. These are relaxed: they don't order
+   anything, they just never lose an update or tear. */
+#if defined(_MSC_VER) && (_MSC_VER >= 1500) && (defined(_M_X64) || defined(_M_ARM64))
+#define __PHYSFS_ATOMIC_ADD64(ptrval, val) ((void) _InterlockedExchangeAdd64((__int64 volatile *) (ptrval), (__int64) (val)))
+#define __PHYSFS_ATOMIC_GET64(ptrval) (*((const volatile PHYSFS_uint64 *) (ptrval)))
+#elif defined(__clang__) || (defined(__GNUC__) && (((__GNUC__ * 10000) + (__GNUC_MINOR__ * 100)) >= 40700))
+#define __PHYSFS_ATOMIC_ADD64(ptrval, val) ((void) __atomic_fetch_add((ptrval), (PHYSFS_uint64) (val), __ATOMIC_RELAXED))
+#define __PHYSFS_ATOMIC_GET64(ptrval) __atomic_load_n((ptrval), __ATOMIC_RELAXED)
+#else
+#define PHYSFS_NEED_ATOMIC64_FALLBACK 1
+void __PHYSFS_ATOMIC_ADD64(PHYSFS_uint64 *ptrval, PHYSFS_uint64 val);
+PHYSFS_uint64 __PHYSFS_ATOMIC_GET64(const PHYSFS_uint64 *ptrval);
+#endif
+
+/* CPU instructions __PHYSFS_crc32() can use. The x86 ones are checked for
+   at runtime, so these headers have to work without -msse etc. */
+#if ((defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))) || \
+     (defined(_MSC_VER) && (_MSC_VER >= 1500) && \
+      (defined(_M_IX86) || defined(_M_X64))))
+#define PHYSFS_HAVE_CRC32_PCLMUL 1
+#ifndef _MSC_VER  /* <intrin.h> has everything on MSVC. */
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+/* !!! FIXME: only when the compiler targets ARMv8.1+ (or Apple Silicon);
+   !!! FIXME:  finding out at runtime is different on every OS. */
+#define PHYSFS_HAVE_CRC32_ARM 1
+#include <arm_acle.h>
+#endif
+
+/*
+ * thread-local storage, for per-thread error state. Build with
+ *  PHYSFS_NO_THREAD_LOCAL defined if your toolchain or OS can't do this
+ *  (for example, a PhysicsFS DLL loaded with LoadLibrary() on Windows XP),
+ *  and physfs.c will fall back to a mutex-guarded list.
+ */
+#if defined(PHYSFS_NO_THREAD_LOCAL) || defined(PHYSFS_PLATFORM_OS2)
+/* no TLS. */
+#elif defined(_MSC_VER)
+#define __PHYSFS_THREAD_LOCAL __declspec(thread)
+#elif defined(__clang__) || (defined(__GNUC__) && !defined(__APPLE__))
+#define __PHYSFS_THREAD_LOCAL __thread
+#endif
+
 
 /*
  * Interface for small allocations. If you need a little scratch space for
@@ -205,13 +251,67 @@ void __PHYSFS_smallFree(void *ptr);
 #if PHYSFS_SUPPORTS_7Z
 /* 7zip support needs a global init function called at startup (no deinit). */
 extern void SZIP_global_init(void);
+/* Per-archive limit on cached, decoded solid blocks. */
+void SZIP_setBlockCacheBudget(const PHYSFS_uint64 budget);
+/* A raw LZMA decoder for (size) bytes, from a 5-byte LZMA properties header,
+   for other archivers. SZIP_lzmaDecode() moves (*in) and (*out) along past
+   what it used and made, shrinking (*inlen) and (*outlen) to match, and
+   returns 1 once all (size) bytes are out, 0 if it needs more, or -1 on
+   error. */
+void *SZIP_lzmaCreate(const PHYSFS_uint8 *props, const size_t propslen,
+                      const PHYSFS_uint64 size);
+int SZIP_lzmaDecode(void *opaque, const PHYSFS_uint8 **in, size_t *inlen,
+                    PHYSFS_uint8 **out, size_t *outlen);
+void SZIP_lzmaDestroy(void *opaque);
+#endif
+
+#if PHYSFS_SUPPORTS_ZIP
+/* Read every file in a ZIP archive (with ZIP_openArchive()'s opaque) and
+   check its CRC, with up to (threads) threads, counting the calling one.
+   Fails with the first error any of them hit, like PHYSFS_ERR_CORRUPT. */
+int ZIP_verifyArchive(void *opaque, int threads);
+/* See UNPK_sourceIo(); this is the same thing for ZIP file Ios. */
+PHYSFS_Io *ZIP_sourceIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 len);
+/* Like ZIP_sourceIo(), but works for compressed entries too: adjusts (*pos)
+   and (*len) to roughly the part of the archive that (*len) bytes of file
+   data at (*pos) decode from. Only good for hints, like prefetching. */
+PHYSFS_Io *ZIP_spanIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 *len);
+/* Fill in the seek index for a ZIP file Io. Returns -1 if (io) isn't one. */
+int ZIP_buildSeekIndex(PHYSFS_Io *io);
+/* See UNPK_entryPos(). This is where the entry's local header is if it hasn't
+   been opened yet, which is just as good for ordering reads. Returns -1 if
+   only opening the file can tell (a "$PASSWORD" suffix, say). */
+int ZIP_entryPos(void *opaque, const char *name, PHYSFS_uint64 *pos);
+/* Fill in (*stats) with what a ZIP file Io knows and physfs.c can't see:
+   rawBytesRead, seekDecodedBytes and decompressTime. Everything else is
+   zeroed. Returns 0, and leaves (*stats) alone, if (io) isn't a ZIP Io. */
+int ZIP_ioStats(PHYSFS_Io *io, PHYSFS_Stats *stats);
+/* The pack writer behind PHYSFS_createPack() and friends. (name) is already
+   sanitized. ZIP_packAddIo() reads all of (io) from its current position.
+   ZIP_closePack() frees (pack) whether it succeeds or not. */
+void *ZIP_createPack(const char *path, const PHYSFS_PackOptions *opts);
+int ZIP_packAdd(void *pack, const char *name, const void *buf,
+                const PHYSFS_uint64 len, const int compress);
+int ZIP_packAddIo(void *pack, const char *name, PHYSFS_Io *io,
+                  const int compress);
+int ZIP_closePack(void *pack);
 #endif
 
+/* The DIR archiver's metadata cache; see PHYSFS_setDirCache(). DIR_setCache()
+   takes a DIR archive's opaque pointer. DIR_dirtyCaches() tells every cache
+   that we just changed something on disk ourselves. */
+int DIR_setCache(void *opaque, const int enable);
+void DIR_dirtyCaches(void);
+
 /* The latest supported PHYSFS_Io::version value. */
-#define CURRENT_PHYSFS_IO_API_VERSION 0
+#define CURRENT_PHYSFS_IO_API_VERSION 1
+
+/* Non-zero if (io) has a usable readAt(). Version 0 structs don't have the
+   field at all, so check that before looking at it. */
+#define __PHYSFS_ioHasReadAt(io) (((io)->version >= 1) && ((io)->readAt))
 
 /* The latest supported PHYSFS_Archiver::version value. */
-#define CURRENT_PHYSFS_ARCHIVER_API_VERSION 0
+#define CURRENT_PHYSFS_ARCHIVER_API_VERSION 2
 
 /* This byteorder stuff was lifted from SDL. https://www.libsdl.org/ */
 #define PHYSFS_LIL_ENDIAN  1234
@@ -274,6 +374,10 @@ void __PHYSFS_sort(void *entries, size_t max,
 #define GOTO_MUTEX_ERRPASS(m, g) do { __PHYSFS_platformReleaseMutex(m); goto g; } while (0)
 #define GOTO_IF_MUTEX(c, e, m, g) do { if (c) { if (e) PHYSFS_setErrorCode(e); __PHYSFS_platformReleaseMutex(m); goto g; } } while (0)
 #define GOTO_IF_MUTEX_ERRPASS(c, m, g) do { if (c) { __PHYSFS_platformReleaseMutex(m); goto g; } } while (0)
+#define BAIL_RWLOCK(e, l, r) do { if (e) PHYSFS_setErrorCode(e); __PHYSFS_platformReleaseRWLock(l); return r; } while (0)
+#define BAIL_RWLOCK_ERRPASS(l, r) do { __PHYSFS_platformReleaseRWLock(l); return r; } while (0)
+#define BAIL_IF_RWLOCK(c, e, l, r) do { if (c) { if (e) PHYSFS_setErrorCode(e); __PHYSFS_platformReleaseRWLock(l); return r; } } while (0)
+#define BAIL_IF_RWLOCK_ERRPASS(c, l, r) do { if (c) { __PHYSFS_platformReleaseRWLock(l); return r; } } while (0)
 
 #define __PHYSFS_ARRAYLEN(x) ( (sizeof (x)) / (sizeof (x[0])) )
 
@@ -314,6 +418,12 @@ char *__PHYSFS_strdup(const char *str);
  */
 PHYSFS_uint32 __PHYSFS_hashString(const char *str, size_t len);
 
+/*
+ * Update a standard (zlib/PKZIP) CRC-32 with (len) bytes from (buf). Start
+ *  with a (crc) of zero.
+ */
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *buf, size_t len);
+
 
 /*
  * The current allocator. Not valid before PHYSFS_init is called!
@@ -326,7 +436,9 @@ extern PHYSFS_Allocator __PHYSFS_AllocatorHooks;
 /*
  * Create a PHYSFS_Io for a file in the physical filesystem.
  *  This path is in platform-dependent notation. (mode) must be 'r', 'w', or
- *  'a' for Read, Write, or Append.
+ *  'a' for Read, Write, or Append. Duplicates of an 'r' Io share its OS
+ *  handle, each with its own position, where the platform has
+ *  __PHYSFS_platformReadAt(); the handle closes with the last of them.
  */
 PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode);
 
@@ -338,6 +450,85 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode);
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
                                    void (*destruct)(void *));
 
+/*
+ * Create a read-only PHYSFS_Io for a file in the physical filesystem that
+ *  reads from a memory mapping of the whole file, so reads don't need a
+ *  system call and duplicates share the mapping instead of reopening the
+ *  file. Fails if the platform can't map this file; use
+ *  __PHYSFS_createNativeIo() then.
+ */
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path);
+
+/*
+ * Get a read-only pointer to (len) bytes of (io)'s data, starting at (pos),
+ *  without copying anything. This works for memory, mapped and native Ios,
+ *  and for archivers' Ios that serve uncompressed bytes straight out of one
+ *  of those. If (*mapped) is set to non-zero, the data was mapped just for
+ *  you: hand the pointer and (len) to __PHYSFS_platformUnmapFile() when done.
+ *  Otherwise, the pointer is good for as long as (io) is.
+ * Pass a NULL (mapped) to only take bytes that are already in memory (memory
+ *  Ios, and mapped ones the app opted into with PHYSFS_setMapArchives()).
+ *  Native files then fail with PHYSFS_ERR_UNSUPPORTED instead of being
+ *  mapped, since a file truncated under a fresh mapping is a SIGBUS where
+ *  reading it would just be an error. Only PHYSFS_mapFile(), whose caller
+ *  accepted that, should map native files.
+ *  Returns NULL on error.
+ */
+const void *__PHYSFS_mapIo(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                           PHYSFS_uint64 len, int *mapped);
+
+/*
+ * Tell the OS we'll want (len) bytes of (io)'s data, starting at (pos),
+ *  soon. This peels layers like __PHYSFS_mapIo(), so a file inside an
+ *  archive hints the archive's own file, and works for compressed ZIP
+ *  entries too. Memory Ios have nothing to fetch and just succeed.
+ *  Returns zero if the hint couldn't be given; that's harmless.
+ */
+int __PHYSFS_prefetchIo(PHYSFS_Io *io, PHYSFS_uint64 pos, PHYSFS_uint64 len);
+
+
+/*
+ * The decompressed-asset cache, for archivers whose files cost real work to
+ *  open. If __PHYSFS_cacheWants() says a file of (len) bytes is worth it,
+ *  try __PHYSFS_cacheLookup() first; it returns NULL on a miss (without
+ *  setting an error). On a miss, open the file as usual and pass the Io to
+ *  __PHYSFS_cacheInsert(), which reads it all in, takes ownership of it,
+ *  and returns the Io to hand back to the caller instead (NULL on error).
+ *  (archive) is the archiver's opaque pointer, and (entry) anything that
+ *  uniquely identifies the file in it for as long as the archive is open.
+ *  physfs.c drops an archive's entries before it calls closeArchive.
+ */
+int __PHYSFS_cacheWants(const PHYSFS_uint64 len);
+PHYSFS_Io *__PHYSFS_cacheLookup(const void *archive, const void *entry);
+PHYSFS_Io *__PHYSFS_cacheInsert(const void *archive, const void *entry,
+                                PHYSFS_Io *io);
+void __PHYSFS_cacheInvalidate(const void *archive);
+
+
+/*
+ * Where an archiver should keep its on-disk index snapshot for the archive
+ *  named (archive), as a platform-dependent path ending in ".(ext)". This
+ *  returns NULL without setting an error if the app hasn't turned the index
+ *  cache on with PHYSFS_setIndexCacheDir(). Free the result with
+ *  allocator.Free(). MAKE SURE you hold the stateLock before calling this;
+ *  openArchive methods are always called with it held.
+ */
+char *__PHYSFS_indexCachePath(const char *archive, const char *ext);
+
+
+/*
+ * Report an event to the app's PHYSFS_setTraceHook() hook, stamped with the
+ *  time. Check __PHYSFS_TRACING first, so this costs nothing when there's
+ *  no hook. Archivers use this for PHYSFS_TRACE_DECODE, passing NULL for
+ *  what they don't know; the read or open it's nested in says which file.
+ */
+extern PHYSFS_TraceCallback __PHYSFS_traceHook;
+#define __PHYSFS_TRACING (__PHYSFS_traceHook != NULL)
+void __PHYSFS_trace(const PHYSFS_TraceEventType type, const int end,
+                    const char *path, const char *archive, const char *detail,
+                    PHYSFS_File *file, const PHYSFS_uint64 offset,
+                    const PHYSFS_sint64 result);
+
 
 /*
  * Read (len) bytes from (io) into (buf). Returns non-zero on success,
@@ -345,12 +536,51 @@ PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
  */
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t len);
 
+/*
+ * Read (len) bytes from (io) into (buf), starting at (pos). This uses
+ *  readAt() if (io) has it, and seeks and reads otherwise. Returns non-zero
+ *  on success, zero on i/o error.
+ */
+int __PHYSFS_readAllAt(PHYSFS_Io *io, void *buf, const size_t len,
+                       const PHYSFS_uint64 pos);
+
+/*
+ * Freelists for fixed-size objects that are allocated and freed all the
+ *  time, like the structs behind every open file. __PHYSFS_poolFree() keeps
+ *  up to PHYSFS_setPoolLimit() objects in each pool for __PHYSFS_poolAlloc()
+ *  to hand out again, and only gives the rest back to the allocator.
+ *
+ * New objects come zeroed. Recycled ones come back as they were freed, so
+ *  they can hang on to buffers and such between uses, except for the first
+ *  pointer's worth of bytes, which the freelist borrows and zeroes again.
+ *  (discard), if not NULL, releases whatever an object still holds just
+ *  before it really goes back to the allocator. Define pools statically
+ *  with __PHYSFS_POOL_INIT; PHYSFS_deinit() empties them all.
+ */
+typedef struct __PHYSFS_Pool
+{
+    size_t size;                 /* bytes per object.                  */
+    void (*discard)(void *obj);  /* NULL, or cleanup before freeing.   */
+    void *freelist;              /* objects waiting to be reused.      */
+    PHYSFS_uint32 count;         /* objects in (freelist).             */
+    int listed;                  /* non-zero once in the list of pools. */
+    struct __PHYSFS_Pool *next;  /* next pool holding objects.         */
+} __PHYSFS_Pool;
+
+#define __PHYSFS_POOL_INIT(size, discard) { (size), (discard), NULL, 0, 0, NULL }
+
+void *__PHYSFS_poolAlloc(__PHYSFS_Pool *pool);
+void __PHYSFS_poolFree(__PHYSFS_Pool *pool, void *obj);
+
+/* A pool of PHYSFS_Io structs for archivers' file Ios to share. */
+extern __PHYSFS_Pool __PHYSFS_IoPool;
+
 
 /* These are shared between some archivers. */
 
 void UNPK_abandonArchive(void *opaque);
 void UNPK_closeArchive(void *opaque);
-void *UNPK_openArchive(PHYSFS_Io *io);
+void *UNPK_openArchive(PHYSFS_Io *io, const PHYSFS_uint64 entrycount);
 void *UNPK_addEntry(void *opaque, char *name, const int isdir,
                     const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
                     const PHYSFS_uint64 pos, const PHYSFS_uint64 len);
@@ -360,8 +590,37 @@ PHYSFS_Io *UNPK_openAppend(void *opaque, const char *name);
 int UNPK_remove(void *opaque, const char *name);
 int UNPK_mkdir(void *opaque, const char *name);
 int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
+PHYSFS_EnumerateCallbackResult UNPK_enumerateStat(void *opaque,
+                               const char *dname,
+                               PHYSFS_EnumerateStatCallback cb,
+                               const char *origdir, void *callbackdata);
+/* If (io) came from UNPK_openRead(), return the Io its data comes from, and
+   adjust (*pos) to match. NULL if it didn't, or (len) goes past the file. */
+PHYSFS_Io *UNPK_sourceIo(PHYSFS_Io *io, PHYSFS_uint64 *pos, PHYSFS_uint64 len);
+/* Where file (name)'s data starts in the archive, without opening it. Returns
+   1 and sets (*pos), or 0 and sets the error if (name) isn't a file here. */
+int UNPK_entryPos(void *opaque, const char *name, PHYSFS_uint64 *pos);
 #define UNPK_enumerate __PHYSFS_DirTreeEnumerate
 
+/*
+ * Lazy directories: instead of adding everything at open time, an archiver
+ *  can hand UNPK_addEntry() the (pos) and (len) of each directory's own
+ *  records, and UNPK calls (loadDir) to add that directory's children the
+ *  first time a lookup, enumerate or stat reaches into it. (path) is the
+ *  directory's full name ("" for the root), to prefix children's names with.
+ *  These archives must use UNPK_lazyEnumerate, not UNPK_enumerate, since
+ *  the higher level walks a __PHYSFS_DirTree directly when it can.
+ */
+typedef int (*UNPK_LoadDirFn)(void *opaque, PHYSFS_Io *io, const char *path,
+                              const PHYSFS_uint64 pos, const PHYSFS_uint64 len);
+/* Call right after UNPK_openArchive(); (pos),(len) locate the root's records.
+   Returns zero and sets the error on failure. */
+int UNPK_setDirLoader(void *opaque, UNPK_LoadDirFn loadDir,
+                      const PHYSFS_uint64 pos, const PHYSFS_uint64 len);
+PHYSFS_EnumerateCallbackResult UNPK_lazyEnumerate(void *opaque,
+                              const char *dname, PHYSFS_EnumerateCallback cb,
+                              const char *origdir, void *callbackdata);
+
 
 
 /* Optional API many archivers use this to manage their directory tree. */
@@ -373,6 +632,9 @@ typedef struct __PHYSFS_DirTreeEntry
     struct __PHYSFS_DirTreeEntry *hashnext;  /* next item in hash bucket.    */
     struct __PHYSFS_DirTreeEntry *children;  /* linked list of kids, if dir. */
     struct __PHYSFS_DirTreeEntry *sibling;   /* next item in same dir.       */
+    struct __PHYSFS_DirTreeEntry *foldnext;  /* next in case-folded bucket. */
+    PHYSFS_uint32 hashval;           /* __PHYSFS_hashString() of (name). */
+    PHYSFS_uint32 foldhashval;  /* PHYSFS_utf8HashFolded() of (name). */
     int isdir;
 } __PHYSFS_DirTreeEntry;
 
@@ -380,17 +642,57 @@ typedef struct __PHYSFS_DirTree
 {
     __PHYSFS_DirTreeEntry *root;    /* root of directory tree.             */
     __PHYSFS_DirTreeEntry **hash;  /* all entries hashed for fast lookup. */
-    size_t hashBuckets;            /* number of buckets in hash.          */
+    size_t hashBuckets;    /* number of buckets in hash (power of two). */
+    size_t entryCount;             /* number of entries in hash.          */
     size_t entrylen;    /* size in bytes of entries (including subclass). */
+    void *arena;           /* memory that entries are allocated from.    */
+    __PHYSFS_DirTreeEntry **foldhash;  /* by folded name; NULL until needed. */
+    size_t foldBuckets;    /* number of buckets in foldhash (power of two). */
+    /* Optional, for callers that hold on to entries __PHYSFS_DirTreeFind()
+       returned (PHYSFS_openReadId(), say): open or stat one without looking
+       its name up again. If NULL, they use the archiver's methods. */
+    PHYSFS_Io *(*openEntry)(void *opaque, void *entry);
+    int (*statEntry)(void *opaque, void *entry, PHYSFS_Stat *stat);
 } __PHYSFS_DirTree;
 
 
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen);
+/* (entrycount) sizes the hash table up front, and with (namebytes), the
+   total length of the names, the first block of memory entries come from.
+   Pass zero for either if unknown. */
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen,
+                         const PHYSFS_uint64 entrycount,
+                         const PHYSFS_uint64 namebytes);
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir);
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path);
+/* Build the case-folded hash, if it isn't already. Entries added later go
+   in it, too. Returns zero and sets the error if out of memory. */
+int __PHYSFS_DirTreeFoldCase(__PHYSFS_DirTree *dt);
+/* Like __PHYSFS_DirTreeFind(), but if there's no exact match, take any name
+   that matches with PHYSFS_utf8stricmp(). Needs __PHYSFS_DirTreeFoldCase(). */
+void *__PHYSFS_DirTreeFindIgnoreCase(__PHYSFS_DirTree *dt, const char *path);
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
                               const char *dname, PHYSFS_EnumerateCallback cb,
                               const char *origdir, void *callbackdata);
+/* Fills in (stat) for one of (opaque)'s entries, like PHYSFS_Archiver::stat
+   does for a filename. Returns zero and sets the error on failure. */
+typedef int (*__PHYSFS_DirTreeStatFn)(void *opaque, void *entry,
+                                      PHYSFS_Stat *stat);
+/* For PHYSFS_Archiver::enumerateStat; (statfn) fills in each child's stat. */
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStat(void *opaque,
+                              const char *dname,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata,
+                              __PHYSFS_DirTreeStatFn statfn);
+/* The same two, for an entry that's already been looked up. */
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateEntry(
+                              const __PHYSFS_DirTreeEntry *dir,
+                              PHYSFS_EnumerateCallback cb,
+                              const char *origdir, void *callbackdata);
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStatEntry(
+                              void *opaque, __PHYSFS_DirTreeEntry *dir,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata,
+                              __PHYSFS_DirTreeStatFn statfn);
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt);
 
 
@@ -501,6 +803,21 @@ void *__PHYSFS_platformOpenAppend(const char *filename);
  */
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len);
 
+/*
+ * Read like __PHYSFS_platformRead(), but starting at byte (pos) of the file,
+ *  without using the file pointer; pread(), basically. It's fine if the
+ *  file pointer moves, as long as several threads can do this on one handle
+ *  at once. A read stopping short is only allowed at the end of the file.
+ *
+ * Platforms that can't do this define PHYSFS_NO_PLATFORM_READAT in
+ *  physfs_platforms.h and don't implement it; native Ios just don't offer
+ *  readAt() there.
+ */
+#ifndef PHYSFS_NO_PLATFORM_READAT
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 pos);
+#endif
+
 /*
  * Write more data to a platform-specific file handle. (opaque) should be
  *  cast to whatever data type your platform uses. Write a maximum of (len)
@@ -553,6 +870,45 @@ PHYSFS_sint64 __PHYSFS_platformTell(void *opaque);
 PHYSFS_sint64 __PHYSFS_platformFileLength(void *handle);
 
 
+/*
+ * Map (len) bytes of an open file, starting at (pos), read-only into memory.
+ *  (opaque) is from __PHYSFS_platformOpenRead(), and may be closed while the
+ *  mapping is still in use. (len) is never zero, and (pos) needn't be aligned
+ *  to anything; the platform deals with page sizes.
+ *
+ * Return a pointer to the byte at (pos), or NULL and call
+ *  PHYSFS_setErrorCode() if mapping isn't possible. Platforms without
+ *  memory-mapped files can just fail with PHYSFS_ERR_UNSUPPORTED.
+ */
+const void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 pos,
+                                     PHYSFS_uint64 len);
+
+/*
+ * Release a mapping made by __PHYSFS_platformMapFile(). (ptr) and (len) are
+ *  what was returned and asked for when it was mapped. This should never fail.
+ */
+void __PHYSFS_platformUnmapFile(const void *ptr, PHYSFS_uint64 len);
+
+/*
+ * Ask the OS to start reading (len) bytes of an open file, starting at
+ *  (pos), into its cache, without waiting for it to happen. (opaque) is from
+ *  __PHYSFS_platformOpenRead(). This is only a hint, so it should never
+ *  block on the actual I/O.
+ *
+ * Return non-zero if the hint was given, zero and call PHYSFS_setErrorCode()
+ *  otherwise. Platforms without such a thing can just fail with
+ *  PHYSFS_ERR_UNSUPPORTED.
+ */
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 pos,
+                              PHYSFS_uint64 len);
+
+/*
+ * Same as __PHYSFS_platformPrefetch(), but for (len) bytes at (ptr), inside
+ *  a mapping from __PHYSFS_platformMapFile(). (ptr) needn't be aligned.
+ */
+int __PHYSFS_platformPrefetchMapped(const void *ptr, PHYSFS_uint64 len);
+
+
 /*
  * Read filesystem metadata for a specific path.
  *
@@ -635,6 +991,87 @@ char *__PHYSFS_platformCalcPrefDir(const char *org, const char *app);
 void *__PHYSFS_platformGetThreadID(void);
 
 
+/*
+ * Return a monotonic clock's time, in nanoseconds. Only the difference
+ *  between two of these means anything; they're for timing things in
+ *  PHYSFS_getStats(). This has to be cheap, and never fail. It's fine to be
+ *  less precise than a nanosecond.
+ */
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void);
+
+
+/*
+ * Start a new thread that runs (fn)(data), and return an opaque handle to it
+ *  for __PHYSFS_platformWaitThread(). Return NULL and set the error if a
+ *  thread can't be started; platforms without threads can always fail with
+ *  PHYSFS_ERR_UNSUPPORTED, since callers have to be ready to do the work on
+ *  the calling thread instead.
+ */
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data);
+
+/*
+ * Wait for a thread from __PHYSFS_platformCreateThread() to return from its
+ *  function, and clean up any resources associated with it. (thread) is
+ *  invalid after this call.
+ */
+void __PHYSFS_platformWaitThread(void *thread);
+
+/*
+ * Create a counting semaphore that starts at (initial). Return (NULL) and set
+ *  the error if you couldn't create one. Platforms without threads don't
+ *  need these, since they can't start threads to wait on them.
+ */
+void *__PHYSFS_platformCreateSemaphore(const PHYSFS_uint32 initial);
+
+/*
+ * Destroy a semaphore from __PHYSFS_platformCreateSemaphore(). Nothing is
+ *  waiting on it when this is called.
+ */
+void __PHYSFS_platformDestroySemaphore(void *sem);
+
+/*
+ * Wait until (sem)'s count is above zero, then decrement it. Return zero if
+ *  something went horribly wrong, non-zero otherwise.
+ */
+int __PHYSFS_platformWaitSemaphore(void *sem);
+
+/*
+ * Increment (sem)'s count, waking up one thread waiting on it, if any.
+ */
+void __PHYSFS_platformPostSemaphore(void *sem);
+
+
+#ifndef PHYSFS_NO_PLATFORM_WATCH
+/*
+ * Change notification for native directories, for anything that caches what
+ *  it saw on disk. __PHYSFS_platformCreateWatch() starts watching directory
+ *  (dir), in platform-dependent notation; __PHYSFS_platformWatchDir() adds
+ *  more directories (usually subdirectories of the first) to the same watch.
+ *  Whenever something directly inside a watched directory is created,
+ *  deleted, renamed, or has its contents or attributes changed, or the
+ *  directory itself goes away, call (fn)(data, path) with the changed
+ *  thing's full path in platform-dependent notation. Pass a NULL (path) if
+ *  you lost track (an event queue overflowed, say) and anything might have
+ *  changed.
+ *
+ * (fn) can be called from any thread, and must never be called once
+ *  __PHYSFS_platformDestroyWatch() returns. It's not allowed to call into
+ *  PhysicsFS. Reporting more changes than were asked for is fine (platforms
+ *  that watch whole trees at once can make __PHYSFS_platformWatchDir() a
+ *  no-op for subdirectories of (dir)), but missing one is not.
+ *
+ * Return NULL (or zero) and set the error on failure. Platforms that can't
+ *  do this define PHYSFS_NO_PLATFORM_WATCH in physfs_platforms.h, and then
+ *  don't need these at all.
+ */
+typedef void (*__PHYSFS_WatchCallback)(void *data, const char *path);
+void *__PHYSFS_platformCreateWatch(const char *dir, __PHYSFS_WatchCallback fn,
+                                   void *data);
+int __PHYSFS_platformWatchDir(void *watch, const char *dir);
+void __PHYSFS_platformDestroyWatch(void *watch);
+#endif
+
+
 /*
  * Enumerate a directory of files. This follows the rules for the
  *  PHYSFS_Archiver::enumerate() method, except that the (dirName) that is
@@ -647,6 +1084,18 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
                                PHYSFS_EnumerateCallback callback,
                                const char *origdir, void *callbackdata);
 
+/*
+ * Like __PHYSFS_platformEnumerate(), but follows the rules for the
+ *  PHYSFS_Archiver::enumerateStat() method: each file is passed to the
+ *  callback with what __PHYSFS_platformStat(path, stat, 0) would report for
+ *  it. Use whatever the OS hands back with the directory listing, so we
+ *  don't have to look up each file by name again.
+ */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata);
+
 /*
  * Make a directory in the actual filesystem. (path) is specified in
  *  platform-dependent notation. On error, return zero and set the error
@@ -669,6 +1118,16 @@ int __PHYSFS_platformMkDir(const char *path);
 int __PHYSFS_platformDelete(const char *path);
 
 
+/*
+ * Rename the file (src) to (dst), both in platform-dependent notation. If
+ *  (dst) exists, it's replaced; where the platform can, atomically, so
+ *  anything opening (dst) gets either the old file or the new one, whole.
+ *
+ * On error, return zero and set the error message. Return non-zero on success.
+ */
+int __PHYSFS_platformRename(const char *src, const char *dst);
+
+
 /*
  * Create a platform-specific mutex. This can be whatever datatype your
  *  platform uses for mutexes, but it is cast to a (void *) for abstractness.
@@ -715,6 +1174,63 @@ int __PHYSFS_platformGrabMutex(void *mutex);
  */
 void __PHYSFS_platformReleaseMutex(void *mutex);
 
+/*
+ * Create a platform-specific reader/writer lock. Any number of threads can
+ *  hold it shared at the same time, but only one thread can hold it
+ *  exclusively, and only when nobody holds it shared. It's cast to a
+ *  (void *) for abstractness, like mutexes are.
+ *
+ * PhysicsFS depends on these rules:
+ *  - A shared grab must never wait on a thread that is merely _waiting_ for
+ *    an exclusive grab, so a thread can take it shared recursively without
+ *    deadlocking (archivers that read through a mounted PHYSFS_File do this).
+ *  - Exclusive grabs are recursive, and the thread holding it exclusively
+ *    can also take it shared (which can just count as another exclusive
+ *    grab).
+ *  - There's no upgrading: a thread holding it only shared won't ask for it
+ *    exclusively. If it did, it would deadlock.
+ *
+ * Return (NULL) if you couldn't create one. Systems without threads can
+ *  return any arbitrary non-NULL value.
+ */
+void *__PHYSFS_platformCreateRWLock(void);
+
+/*
+ * Destroy a platform-specific reader/writer lock, and clean up any resources
+ *  associated with it. (rwlock) is a value previously returned by
+ *  __PHYSFS_platformCreateRWLock(). This can be a no-op on single-threaded
+ *  platforms.
+ */
+void __PHYSFS_platformDestroyRWLock(void *rwlock);
+
+/*
+ * Grab shared possession of a reader/writer lock, blocking while another
+ *  thread holds it exclusively.
+ *
+ * Return non-zero if the lock was grabbed, zero if there was an
+ *  unrecoverable problem grabbing it. As with __PHYSFS_platformGrabMutex(),
+ *  _DO NOT_ call PHYSFS_setErrorCode() or the BAIL_*MACRO* macros in here.
+ */
+int __PHYSFS_platformGrabRWLockShared(void *rwlock);
+
+/*
+ * Grab exclusive possession of a reader/writer lock, blocking while any
+ *  other thread holds it, shared or exclusive.
+ *
+ * Return non-zero if the lock was grabbed, zero if there was an
+ *  unrecoverable problem grabbing it. As with __PHYSFS_platformGrabMutex(),
+ *  _DO NOT_ call PHYSFS_setErrorCode() or the BAIL_*MACRO* macros in here.
+ */
+int __PHYSFS_platformGrabRWLockExclusive(void *rwlock);
+
+/*
+ * Give back one grab of a reader/writer lock, whichever kind it was. Once
+ *  every grab has been given back, threads waiting on the lock may proceed.
+ *
+ * _DO NOT_ call PHYSFS_setErrorCode() or the BAIL_*MACRO* macros in here.
+ */
+void __PHYSFS_platformReleaseRWLock(void *rwlock);
+
 #if PHYSFS_HAVE_PRAGMA_VISIBILITY
 #pragma GCC visibility pop
 #endif
@@ -639,6 +639,29 @@ static int mz_inflate(mz_streamp pStream, int flush)
   return ((status == TINFL_STATUS_DONE) && (!pState->m_dict_avail)) ? MZ_STREAM_END : MZ_OK;
 }
 
+static int mz_inflateReset(mz_streamp pStream)
+{
+  inflate_state *pDecomp;
+  if ((!pStream) || (!pStream->state)) return MZ_STREAM_ERROR;
+
+  pStream->data_type = 0;
+  pStream->adler = 0;
+  pStream->msg = NULL;
+  pStream->total_in = 0;
+  pStream->total_out = 0;
+  pStream->reserved = 0;
+
+  pDecomp = (inflate_state*)pStream->state;
+  tinfl_init(&pDecomp->m_decomp);
+  pDecomp->m_dict_ofs = 0;
+  pDecomp->m_dict_avail = 0;
+  pDecomp->m_last_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  pDecomp->m_first_call = 1;
+  pDecomp->m_has_flushed = 0;
+
+  return MZ_OK;
+}
+
 static int mz_inflateEnd(mz_streamp pStream)
 {
   if (!pStream)
@@ -658,6 +681,7 @@ static int mz_inflateEnd(mz_streamp pStream)
   #define inflateInit2          mz_inflateInit2
   #define inflate               mz_inflate
   #define inflateEnd            mz_inflateEnd
+  #define inflateReset          mz_inflateReset
   #define Z_SYNC_FLUSH          MZ_SYNC_FLUSH
   #define Z_FINISH              MZ_FINISH
   #define Z_OK                  MZ_OK
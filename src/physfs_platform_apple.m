@@ -13,6 +13,10 @@
 
 #include <Foundation/Foundation.h>
 
+#ifndef PHYSFS_NO_PLATFORM_WATCH
+#include <CoreServices/CoreServices.h>
+#endif
+
 #include "physfs_internal.h"
 
 int __PHYSFS_platformInit(void)
@@ -182,6 +186,121 @@ void __PHYSFS_platformDetectAvailableCDs(PHYSFS_StringCallback cb, void *data)
 #endif /* !defined(PHYSFS_NO_CDROM_SUPPORT) */
 } /* __PHYSFS_platformDetectAvailableCDs */
 
+
+#ifndef PHYSFS_NO_PLATFORM_WATCH
+
+/* FSEvents watches whole trees, and calls us on a queue of our own. */
+typedef struct
+{
+    FSEventStreamRef stream;
+    dispatch_queue_t queue;
+    __PHYSFS_WatchCallback fn;
+    void *data;
+} FSEventsWatch;
+
+static void fseventsCallback(ConstFSEventStreamRef stream, void *info,
+                             size_t count, void *eventPaths,
+                             const FSEventStreamEventFlags *flags,
+                             const FSEventStreamEventId *ids)
+{
+    const FSEventStreamEventFlags lost = kFSEventStreamEventFlagMustScanSubDirs
+                                       | kFSEventStreamEventFlagUserDropped
+                                       | kFSEventStreamEventFlagKernelDropped
+                                       | kFSEventStreamEventFlagRootChanged;
+    FSEventsWatch *w = (FSEventsWatch *) info;
+    const char **paths = (const char **) eventPaths;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        w->fn(w->data, (flags[i] & lost) ? NULL : paths[i]);
+} /* fseventsCallback */
+
+
+static void fseventsFlush(void *unused) { /* no-op */ }
+
+
+void *__PHYSFS_platformCreateWatch(const char *dir, __PHYSFS_WatchCallback fn,
+                                   void *data)
+{
+    const FSEventStreamCreateFlags flags = kFSEventStreamCreateFlagNoDefer
+                                         | kFSEventStreamCreateFlagWatchRoot
+                                         | kFSEventStreamCreateFlagFileEvents;
+    FSEventStreamContext ctx;
+    CFStringRef cfdir;
+    CFArrayRef cfdirs;
+    FSEventsWatch *w = (FSEventsWatch *) allocator.Malloc(sizeof (*w));
+    BAIL_IF(!w, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    w->fn = fn;
+    w->data = data;
+
+    cfdir = CFStringCreateWithCString(NULL, dir, kCFStringEncodingUTF8);
+    if (!cfdir)
+    {
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    cfdirs = CFArrayCreate(NULL, (const void **) &cfdir, 1,
+                           &kCFTypeArrayCallBacks);
+    CFRelease(cfdir);
+    if (!cfdirs)
+    {
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    memset(&ctx, '\0', sizeof (ctx));
+    ctx.info = w;
+    w->stream = FSEventStreamCreate(NULL, fseventsCallback, &ctx, cfdirs,
+                                    kFSEventStreamEventIdSinceNow, 0.0, flags);
+    CFRelease(cfdirs);
+    if (!w->stream)
+    {
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    w->queue = dispatch_queue_create("org.icculus.physfs.watch", NULL);
+    if (!w->queue)
+    {
+        FSEventStreamRelease(w->stream);
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    FSEventStreamSetDispatchQueue(w->stream, w->queue);
+    if (!FSEventStreamStart(w->stream))
+    {
+        FSEventStreamInvalidate(w->stream);
+        FSEventStreamRelease(w->stream);
+        dispatch_release(w->queue);
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    return w;
+} /* __PHYSFS_platformCreateWatch */
+
+
+int __PHYSFS_platformWatchDir(void *watch, const char *dir)
+{
+    return 1;  /* the stream already covers everything under its root. */
+} /* __PHYSFS_platformWatchDir */
+
+
+void __PHYSFS_platformDestroyWatch(void *watch)
+{
+    FSEventsWatch *w = (FSEventsWatch *) watch;
+    FSEventStreamStop(w->stream);
+    FSEventStreamInvalidate(w->stream);
+    FSEventStreamRelease(w->stream);
+    dispatch_sync_f(w->queue, NULL, fseventsFlush);  /* let callbacks finish. */
+    dispatch_release(w->queue);
+    allocator.Free(w);
+} /* __PHYSFS_platformDestroyWatch */
+
+#endif /* !PHYSFS_NO_PLATFORM_WATCH */
+
 #endif /* PHYSFS_PLATFORM_APPLE */
 
 /* end of physfs_platform_apple.m ... */
@@ -21,6 +21,7 @@
 #define INCL_DOSDEVICES
 #define INCL_DOSDEVIOCTL
 #define INCL_DOSMISC
+#define INCL_DOSPROFILE
 #include <os2.h>
 #include <uconv.h>
 
@@ -418,20 +419,16 @@ char *__PHYSFS_platformCalcPrefDir(const char *org, const char *app)
     return __PHYSFS_platformCalcBaseDir(NULL);  /* !!! FIXME: ? */
 } /* __PHYSFS_platformCalcPrefDir */
 
-PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
-                               PHYSFS_EnumerateCallback callback,
-                               const char *origdir, void *callbackdata)
-{                                        
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+/* Start a DosFindFirst() search of everything in (dirname). */
+static int findFirstInDir(const char *dirname, HDIR *hdir,
+                          FILEFINDBUF3 *fb, ULONG *count)
+{
     size_t utf8len = strlen(dirname);
     char *utf8 = (char *) __PHYSFS_smallAlloc(utf8len + 5);
     char *cpspec = NULL;
-    FILEFINDBUF3 fb;
-    HDIR hdir = HDIR_CREATE;
-    ULONG count = 1;
     APIRET rc;
 
-    BAIL_IF(!utf8, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    BAIL_IF(!utf8, PHYSFS_ERR_OUT_OF_MEMORY, 0);
 
     strcpy(utf8, dirname);
     if (utf8[utf8len - 1] != '\\')
@@ -441,15 +438,33 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
 
     cpspec = cvtUtf8ToCodepage(utf8);
     __PHYSFS_smallFree(utf8);
-    BAIL_IF_ERRPASS(!cpspec, PHYSFS_ENUM_ERROR);
+    BAIL_IF_ERRPASS(!cpspec, 0);
 
-    rc = DosFindFirst((unsigned char *) cpspec, &hdir,
+    *hdir = HDIR_CREATE;
+    *count = 1;
+    rc = DosFindFirst((unsigned char *) cpspec, hdir,
                       FILE_DIRECTORY | FILE_ARCHIVED |
                       FILE_READONLY | FILE_HIDDEN | FILE_SYSTEM,
-                      &fb, sizeof (fb), &count, FIL_STANDARD);
+                      fb, sizeof (*fb), count, FIL_STANDARD);
     allocator.Free(cpspec);
 
-    BAIL_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), PHYSFS_ENUM_ERROR);
+    BAIL_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), 0);
+    return 1;
+} /* findFirstInDir */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata)
+{                                        
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    char *utf8 = NULL;
+    FILEFINDBUF3 fb;
+    HDIR hdir;
+    ULONG count;
+
+    BAIL_IF_ERRPASS(!findFirstInDir(dirname, &hdir, &fb, &count),
+                    PHYSFS_ENUM_ERROR);
 
     while (count == 1)
     {
@@ -668,6 +683,34 @@ PHYSFS_sint64 __PHYSFS_platformFileLength(void *opaque)
 } /* __PHYSFS_platformFileLength */
 
 
+const void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 pos,
+                                     PHYSFS_uint64 len)
+{
+    /* !!! FIXME: OS/2 has no file mapping; callers fall back to reading. */
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, PHYSFS_uint64 len)
+{
+    assert(0 && "can't get here, nothing was ever mapped.");
+} /* __PHYSFS_platformUnmapFile */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 pos,
+                              PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME: anything on OS/2? */
+} /* __PHYSFS_platformPrefetch */
+
+
+int __PHYSFS_platformPrefetchMapped(const void *ptr, PHYSFS_uint64 len)
+{
+    assert(0 && "can't get here, nothing was ever mapped.");
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+} /* __PHYSFS_platformPrefetchMapped */
+
+
 int __PHYSFS_platformFlush(void *opaque)
 {
     const APIRET rc = DosResetBuffer((HFILE) opaque);
@@ -702,6 +745,26 @@ done:
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    char *cpsrc = cvtUtf8ToCodepage(src);
+    char *cpdst = cvtUtf8ToCodepage(dst);
+    APIRET rc;
+    int retval = 0;
+
+    GOTO_IF_ERRPASS(!cpsrc || !cpdst, done);
+    DosDelete(cpdst);  /* DosMove won't replace; ignore errors here. */
+    rc = DosMove(cpsrc, cpdst);
+    GOTO_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), done);
+    retval = 1;  /* success */
+
+done:
+    allocator.Free(cpdst);
+    allocator.Free(cpsrc);
+    return retval;
+} /* __PHYSFS_platformRename */
+
+
 /* Convert to a format PhysicsFS can grok... */
 PHYSFS_sint64 os2TimeToUnixTime(const FDATE *date, const FTIME *time)
 {
@@ -765,6 +828,79 @@ done:
 } /* __PHYSFS_platformStat */
 
 
+/* DosFindNext() hands us everything DosQueryPathInfo() would. */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    char *utf8 = NULL;
+    FILEFINDBUF3 fb;
+    HDIR hdir;
+    ULONG count;
+
+    BAIL_IF_ERRPASS(!findFirstInDir(dirname, &hdir, &fb, &count),
+                    PHYSFS_ENUM_ERROR);
+
+    while (count == 1)
+    {
+        if ((strcmp(fb.achName, ".") != 0) && (strcmp(fb.achName, "..") != 0))
+        {
+            PHYSFS_Stat st;
+
+            if (fb.attrFile & FILE_DIRECTORY)
+            {
+                st.filetype = PHYSFS_FILETYPE_DIRECTORY;
+                st.filesize = 0;
+            } /* if */
+            else
+            {
+                st.filetype = PHYSFS_FILETYPE_REGULAR;
+                st.filesize = fb.cbFile;
+            } /* else */
+
+            st.modtime = os2TimeToUnixTime(&fb.fdateLastWrite,
+                                           &fb.ftimeLastWrite);
+            if (st.modtime < 0)
+                st.modtime = 0;
+
+            st.accesstime = os2TimeToUnixTime(&fb.fdateLastAccess,
+                                              &fb.ftimeLastAccess);
+            if (st.accesstime < 0)
+                st.accesstime = 0;
+
+            st.createtime = os2TimeToUnixTime(&fb.fdateCreation,
+                                              &fb.ftimeCreation);
+            if (st.createtime < 0)
+                st.createtime = 0;
+
+            st.readonly = ((fb.attrFile & FILE_READONLY) == FILE_READONLY);
+
+            utf8 = cvtCodepageToUtf8(fb.achName);
+            if (!utf8)
+                retval = PHYSFS_ENUM_ERROR;
+            else
+            {
+                retval = callback(callbackdata, origdir, utf8, &st);
+                allocator.Free(utf8);
+                if (retval == PHYSFS_ENUM_ERROR)
+                    PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+            } /* else */
+        } /* if */
+
+        if (retval != PHYSFS_ENUM_OK)
+            break;
+
+        DosFindNext(hdir, &fb, sizeof (fb), &count);
+    } /* while */
+
+    DosFindClose(hdir);
+
+    return retval;
+} /* __PHYSFS_platformEnumerateStat */
+
+
 void *__PHYSFS_platformGetThreadID(void)
 {
     PTIB ptib;
@@ -780,6 +916,153 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+    static ULONG freq = 0;  /* never changes; a racy first call is ok. */
+    PHYSFS_uint64 now;
+    QWORD qw;
+
+    if ((freq == 0) && (DosTmrQueryFreq(&freq) != NO_ERROR))
+        freq = 0;
+
+    if ((freq == 0) || (DosTmrQueryTime(&qw) != NO_ERROR))
+    {
+        ULONG ms = 0;  /* fall back to the millisecond counter. */
+        DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof (ms));
+        return ((PHYSFS_uint64) ms) * 1000000;
+    } /* if */
+
+    now = (((PHYSFS_uint64) qw.ulHi) << 32) | ((PHYSFS_uint64) qw.ulLo);
+    return ((now / freq) * __PHYSFS_UI64(1000000000)) +
+           (((now % freq) * __PHYSFS_UI64(1000000000)) / freq);
+} /* __PHYSFS_platformNanoseconds */
+
+
+typedef struct
+{
+    TID tid;
+    void (*fn)(void *);
+    void *data;
+} OS2Thread;
+
+
+static void APIENTRY os2ThreadEntry(ULONG arg)
+{
+    OS2Thread *t = (OS2Thread *) arg;
+    t->fn(t->data);
+} /* os2ThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    APIRET rc;
+    OS2Thread *t = (OS2Thread *) allocator.Malloc(sizeof (*t));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    rc = DosCreateThread(&t->tid, os2ThreadEntry, (ULONG) t,
+                         CREATE_READY | STACK_SPARSE, 256 * 1024);
+    if (rc != NO_ERROR)
+    {
+        allocator.Free(t);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    return ((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    OS2Thread *t = (OS2Thread *) thread;
+    DosWaitThread(&t->tid, DCWW_WAIT);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+/* an event semaphore that stays posted while (count) is above zero. */
+typedef struct
+{
+    HMTX mutex;
+    HEV event;
+    PHYSFS_uint32 count;
+} OS2Semaphore;
+
+
+void *__PHYSFS_platformCreateSemaphore(const PHYSFS_uint32 initial)
+{
+    APIRET rc;
+    OS2Semaphore *s = (OS2Semaphore *) allocator.Malloc(sizeof (*s));
+    BAIL_IF(!s, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    rc = DosCreateMutexSem(NULL, &s->mutex, 0, 0);
+    if (rc != NO_ERROR)
+    {
+        allocator.Free(s);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    rc = DosCreateEventSem(NULL, &s->event, 0, (initial > 0));
+    if (rc != NO_ERROR)
+    {
+        DosCloseMutexSem(s->mutex);
+        allocator.Free(s);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    s->count = initial;
+    return ((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    OS2Semaphore *s = (OS2Semaphore *) sem;
+    DosCloseEventSem(s->event);
+    DosCloseMutexSem(s->mutex);
+    allocator.Free(s);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+int __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    OS2Semaphore *s = (OS2Semaphore *) sem;
+
+    while (1)
+    {
+        ULONG posts = 0;
+        if (DosRequestMutexSem(s->mutex, SEM_INDEFINITE_WAIT) != NO_ERROR)
+            return 0;
+
+        if (s->count > 0)
+        {
+            if (--s->count == 0)
+                DosResetEventSem(s->event, &posts);
+            DosReleaseMutexSem(s->mutex);
+            return 1;
+        } /* if */
+
+        DosReleaseMutexSem(s->mutex);
+        if (DosWaitEventSem(s->event, SEM_INDEFINITE_WAIT) != NO_ERROR)
+            return 0;
+    } /* while */
+
+    return 0;  /* shouldn't hit this. */
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    OS2Semaphore *s = (OS2Semaphore *) sem;
+    if (DosRequestMutexSem(s->mutex, SEM_INDEFINITE_WAIT) == NO_ERROR)
+    {
+        s->count++;
+        DosPostEventSem(s->event);
+        DosReleaseMutexSem(s->mutex);
+    } /* if */
+} /* __PHYSFS_platformPostSemaphore */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     HMTX hmtx = NULLHANDLE;
@@ -807,6 +1090,107 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     DosReleaseMutexSem((HMTX) mutex);
 } /* __PHYSFS_platformReleaseMutex */
 
+
+/*
+ * Writers hold a mutex semaphore the whole time; readers only grab it long
+ *  enough to bump a counter. A writer waiting for readers to drain polls.
+ */
+typedef struct
+{
+    HMTX hmtx;  /* held by the writer the entire time. */
+    void *owner;  /* holds it exclusively, if (count) > 0. */
+    PHYSFS_uint32 count;  /* exclusive grabs by (owner). */
+    volatile int readers;  /* shared grabs from everyone else. */
+} OS2RWLock;
+
+
+void *__PHYSFS_platformCreateRWLock(void)
+{
+    OS2RWLock *l = (OS2RWLock *) allocator.Malloc(sizeof (OS2RWLock));
+    APIRET rc;
+
+    BAIL_IF(!l, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    rc = DosCreateMutexSem(NULL, &l->hmtx, 0, 0);
+    if (rc != NO_ERROR)
+    {
+        allocator.Free(l);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    l->owner = NULL;
+    l->count = 0;
+    l->readers = 0;
+    return l;
+} /* __PHYSFS_platformCreateRWLock */
+
+
+void __PHYSFS_platformDestroyRWLock(void *rwlock)
+{
+    OS2RWLock *l = (OS2RWLock *) rwlock;
+    DosCloseMutexSem(l->hmtx);
+    allocator.Free(l);
+} /* __PHYSFS_platformDestroyRWLock */
+
+
+int __PHYSFS_platformGrabRWLockShared(void *rwlock)
+{
+    /* Do _NOT_ set the physfs error message in here! */
+    OS2RWLock *l = (OS2RWLock *) rwlock;
+    if (DosRequestMutexSem(l->hmtx, SEM_INDEFINITE_WAIT) != NO_ERROR)
+        return 0;
+    else if ((l->count > 0) && (l->owner == __PHYSFS_platformGetThreadID()))
+        l->count++;  /* we hold it exclusively; keep the semaphore. */
+    else
+    {
+        __PHYSFS_ATOMIC_INCR((int *) &l->readers);
+        DosReleaseMutexSem(l->hmtx);
+    } /* else */
+    return 1;
+} /* __PHYSFS_platformGrabRWLockShared */
+
+
+int __PHYSFS_platformGrabRWLockExclusive(void *rwlock)
+{
+    /* Do _NOT_ set the physfs error message in here! */
+    OS2RWLock *l = (OS2RWLock *) rwlock;
+    void *tid = __PHYSFS_platformGetThreadID();
+
+    if (DosRequestMutexSem(l->hmtx, SEM_INDEFINITE_WAIT) != NO_ERROR)
+        return 0;
+
+    if ((l->count == 0) || (l->owner != tid))
+    {
+        /* don't hold the semaphore here, or a recursive reader deadlocks. */
+        while (l->readers > 0)
+        {
+            DosReleaseMutexSem(l->hmtx);
+            DosSleep(1);
+            if (DosRequestMutexSem(l->hmtx, SEM_INDEFINITE_WAIT) != NO_ERROR)
+                return 0;
+        } /* while */
+        l->owner = tid;
+    } /* if */
+
+    l->count++;
+    return 1;
+} /* __PHYSFS_platformGrabRWLockExclusive */
+
+
+void __PHYSFS_platformReleaseRWLock(void *rwlock)
+{
+    OS2RWLock *l = (OS2RWLock *) rwlock;
+    if ((l->count > 0) && (l->owner == __PHYSFS_platformGetThreadID()))
+    {
+        if (--l->count == 0)
+            l->owner = NULL;
+        DosReleaseMutexSem(l->hmtx);
+    } /* if */
+    else
+    {
+        __PHYSFS_ATOMIC_DECR((int *) &l->readers);
+    } /* else */
+} /* __PHYSFS_platformReleaseRWLock */
+
 #endif  /* PHYSFS_PLATFORM_OS2 */
 
 /* end of physfs_platform_os2.c ... */
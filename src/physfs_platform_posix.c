@@ -21,7 +21,15 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#if PHYSFS_PLATFORM_LINUX
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 #include "physfs_internal.h"
 
@@ -227,6 +235,36 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 pos)
+{
+    const int fd = *((int *) opaque);
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buffer;
+    PHYSFS_sint64 totalRead = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    /* pread() can stop short of EOF, unlike our contract, so keep going. */
+    while (len > 0)
+    {
+        const ssize_t rc = pread(fd, ptr, (size_t) len, (off_t) pos);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        BAIL_IF(rc == -1, errcodeFromErrno(), totalRead ? totalRead : -1);
+        if (rc == 0)
+            break;  /* EOF. */
+        assert(rc <= len);
+        ptr += rc;
+        pos += (PHYSFS_uint64) rc;
+        len -= (PHYSFS_uint64) rc;
+        totalRead += (PHYSFS_sint64) rc;
+    } /* while */
+
+    return totalRead;
+} /* __PHYSFS_platformReadAt */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -272,6 +310,72 @@ PHYSFS_sint64 __PHYSFS_platformFileLength(void *opaque)
 } /* __PHYSFS_platformFileLength */
 
 
+const void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 pos,
+                                     PHYSFS_uint64 len)
+{
+    const int fd = *((int *) opaque);
+    const PHYSFS_uint64 pagesize = (PHYSFS_uint64) sysconf(_SC_PAGESIZE);
+    const PHYSFS_uint64 adjust = pos % pagesize;  /* mmap wants alignment. */
+    void *ptr;
+
+    assert(len > 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len + adjust),
+            PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    ptr = mmap(NULL, (size_t) (len + adjust), PROT_READ, MAP_SHARED,
+               fd, (off_t) (pos - adjust));
+    BAIL_IF(ptr == MAP_FAILED, errcodeFromErrno(), NULL);
+    return ((const PHYSFS_uint8 *) ptr) + adjust;
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, PHYSFS_uint64 len)
+{
+    const size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t adjust = ((size_t) ptr) % pagesize;
+    (void) munmap((void *) (((const PHYSFS_uint8 *) ptr) - adjust),
+                  (size_t) (len + adjust));
+} /* __PHYSFS_platformUnmapFile */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 pos,
+                              PHYSFS_uint64 len)
+{
+    const int fd = *((int *) opaque);
+
+    #if defined(POSIX_FADV_WILLNEED)
+    /* readahead() would be more direct on Linux, but it blocks. */
+    const int rc = posix_fadvise(fd, (off_t) pos, (off_t) len,
+                                 POSIX_FADV_WILLNEED);
+    BAIL_IF(rc != 0, errcodeFromErrnoError(rc), 0);
+    return 1;
+    #elif defined(F_RDADVISE)  /* Apple platforms. */
+    struct radvisory ra;
+    ra.ra_offset = (off_t) pos;
+    ra.ra_count = (len > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) len;
+    BAIL_IF(fcntl(fd, F_RDADVISE, &ra) == -1, errcodeFromErrno(), 0);
+    return 1;
+    #else
+    (void) fd;
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+} /* __PHYSFS_platformPrefetch */
+
+
+int __PHYSFS_platformPrefetchMapped(const void *ptr, PHYSFS_uint64 len)
+{
+    const size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t adjust = ((size_t) ptr) % pagesize;  /* madvise wants it. */
+    void *start = (void *) (((const PHYSFS_uint8 *) ptr) - adjust);
+
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len + adjust),
+            PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(madvise(start, (size_t) (len + adjust), MADV_WILLNEED) == -1,
+            errcodeFromErrno(), 0);
+    return 1;
+} /* __PHYSFS_platformPrefetchMapped */
+
+
 int __PHYSFS_platformFlush(void *opaque)
 {
     const int fd = *((int *) opaque);
@@ -296,25 +400,28 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
-int __PHYSFS_platformStat(const char *fname, PHYSFS_Stat *st, const int follow)
+int __PHYSFS_platformRename(const char *src, const char *dst)
 {
-    struct stat statbuf;
-    const int rc = follow ? stat(fname, &statbuf) : lstat(fname, &statbuf);
-    BAIL_IF(rc == -1, errcodeFromErrno(), 0);
+    BAIL_IF(rename(src, dst) == -1, errcodeFromErrno(), 0);
+    return 1;
+} /* __PHYSFS_platformRename */
+
 
-    if (S_ISREG(statbuf.st_mode))
+static void convertStat(const struct stat *statbuf, PHYSFS_Stat *st)
+{
+    if (S_ISREG(statbuf->st_mode))
     {
         st->filetype = PHYSFS_FILETYPE_REGULAR;
-        st->filesize = statbuf.st_size;
+        st->filesize = statbuf->st_size;
     } /* if */
 
-    else if(S_ISDIR(statbuf.st_mode))
+    else if(S_ISDIR(statbuf->st_mode))
     {
         st->filetype = PHYSFS_FILETYPE_DIRECTORY;
         st->filesize = 0;
     } /* else if */
 
-    else if(S_ISLNK(statbuf.st_mode))
+    else if(S_ISLNK(statbuf->st_mode))
     {
         st->filetype = PHYSFS_FILETYPE_SYMLINK;
         st->filesize = 0;
@@ -323,18 +430,101 @@ int __PHYSFS_platformStat(const char *fname, PHYSFS_Stat *st, const int follow)
     else
     {
         st->filetype = PHYSFS_FILETYPE_OTHER;
-        st->filesize = statbuf.st_size;
+        st->filesize = statbuf->st_size;
     } /* else */
 
-    st->modtime = statbuf.st_mtime;
-    st->createtime = statbuf.st_ctime;
-    st->accesstime = statbuf.st_atime;
+    st->modtime = statbuf->st_mtime;
+    st->createtime = statbuf->st_ctime;
+    st->accesstime = statbuf->st_atime;
+} /* convertStat */
+
 
+int __PHYSFS_platformStat(const char *fname, PHYSFS_Stat *st, const int follow)
+{
+    struct stat statbuf;
+    const int rc = follow ? stat(fname, &statbuf) : lstat(fname, &statbuf);
+    BAIL_IF(rc == -1, errcodeFromErrno(), 0);
+    convertStat(&statbuf, st);
     st->readonly = (access(fname, W_OK) == -1);
     return 1;
 } /* __PHYSFS_platformStat */
 
 
+/*
+ * readdir()'s d_type doesn't tell us sizes or times, so we still need a stat
+ *  per file, but we can do it relative to the open directory with fstatat(),
+ *  which saves the kernel from walking the whole path again for each one.
+ */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    DIR *dir;
+    struct dirent *ent;
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+
+    dir = opendir(dirname);
+    BAIL_IF(dir == NULL, errcodeFromErrno(), PHYSFS_ENUM_ERROR);
+
+    while ((retval == PHYSFS_ENUM_OK) && ((ent = readdir(dir)) != NULL))
+    {
+        const char *name = ent->d_name;
+        struct stat statbuf;
+        PHYSFS_Stat st;
+        int err = 0;
+
+        if (name[0] == '.')  /* ignore "." and ".." */
+        {
+            if ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))
+                continue;
+        } /* if */
+
+        #ifdef AT_SYMLINK_NOFOLLOW
+        if (fstatat(dirfd(dir), name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+            err = errno;
+        else
+            st.readonly = (faccessat(dirfd(dir), name, W_OK, 0) == -1);
+        #else
+        {
+            const size_t len = strlen(dirname) + strlen(name) + 2;
+            char *path = (char *) __PHYSFS_smallAlloc(len);
+            if (path == NULL)
+            {
+                PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+                retval = PHYSFS_ENUM_ERROR;
+                break;
+            } /* if */
+            snprintf(path, len, "%s/%s", dirname, name);
+            if (lstat(path, &statbuf) == -1)
+                err = errno;
+            else
+                st.readonly = (access(path, W_OK) == -1);
+            __PHYSFS_smallFree(path);
+        }
+        #endif
+
+        if (err == ENOENT)
+            continue;  /* deleted while we were looking at it. */
+        else if (err != 0)
+        {
+            PHYSFS_setErrorCode(errcodeFromErrnoError(err));
+            retval = PHYSFS_ENUM_ERROR;
+            break;
+        } /* if */
+
+        convertStat(&statbuf, &st);
+        retval = callback(callbackdata, origdir, name, &st);
+        if (retval == PHYSFS_ENUM_ERROR)
+            PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+    } /* while */
+
+    closedir(dir);
+
+    return retval;
+} /* __PHYSFS_platformEnumerateStat */
+
+
 typedef struct
 {
     pthread_mutex_t mutex;
@@ -349,6 +539,142 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+    struct timeval tv;
+
+    #ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return (((PHYSFS_uint64) ts.tv_sec) * __PHYSFS_UI64(1000000000)) +
+               ((PHYSFS_uint64) ts.tv_nsec);
+    } /* if */
+    #endif
+
+    /* not monotonic, but the best we've got. */
+    gettimeofday(&tv, NULL);
+    return (((PHYSFS_uint64) tv.tv_sec) * __PHYSFS_UI64(1000000000)) +
+           (((PHYSFS_uint64) tv.tv_usec) * 1000);
+} /* __PHYSFS_platformNanoseconds */
+
+
+typedef struct
+{
+    pthread_t thread;
+    void (*fn)(void *);
+    void *data;
+} PthreadThread;
+
+
+static void *pthreadEntry(void *arg)
+{
+    PthreadThread *t = (PthreadThread *) arg;
+    t->fn(t->data);
+    return NULL;
+} /* pthreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    PthreadThread *t = (PthreadThread *) allocator.Malloc(sizeof (*t));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    if (pthread_create(&t->thread, NULL, pthreadEntry, t) != 0)
+    {
+        allocator.Free(t);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    return ((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    PthreadThread *t = (PthreadThread *) thread;
+    pthread_join(t->thread, NULL);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+/* POSIX semaphores aren't everywhere (Mac OS X), so build our own. */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    PHYSFS_uint32 count;
+} PthreadSemaphore;
+
+
+void *__PHYSFS_platformCreateSemaphore(const PHYSFS_uint32 initial)
+{
+    PthreadSemaphore *s;
+    s = (PthreadSemaphore *) allocator.Malloc(sizeof (PthreadSemaphore));
+    BAIL_IF(!s, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    if (pthread_mutex_init(&s->mutex, NULL) != 0)
+    {
+        allocator.Free(s);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    if (pthread_cond_init(&s->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&s->mutex);
+        allocator.Free(s);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    s->count = initial;
+    return ((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    allocator.Free(s);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+int __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+
+    if (pthread_mutex_lock(&s->mutex) != 0)
+        return 0;
+
+    while (s->count == 0)
+    {
+        if (pthread_cond_wait(&s->cond, &s->mutex) != 0)
+        {
+            pthread_mutex_unlock(&s->mutex);
+            return 0;
+        } /* if */
+    } /* while */
+
+    s->count--;
+    pthread_mutex_unlock(&s->mutex);
+    return 1;
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    if (pthread_mutex_lock(&s->mutex) == 0)
+    {
+        s->count++;
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    } /* if */
+} /* __PHYSFS_platformPostSemaphore */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     int rc;
@@ -411,6 +737,366 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     } /* if */
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t owner;  /* holds it exclusively, if (count) > 0. */
+    PHYSFS_uint32 count;  /* exclusive grabs by (owner). */
+    PHYSFS_uint32 readers;  /* shared grabs from everyone else. */
+} PthreadRWLock;
+
+
+void *__PHYSFS_platformCreateRWLock(void)
+{
+    PthreadRWLock *l;
+    l = (PthreadRWLock *) allocator.Malloc(sizeof (PthreadRWLock));
+    BAIL_IF(!l, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    if (pthread_mutex_init(&l->mutex, NULL) != 0)
+    {
+        allocator.Free(l);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    if (pthread_cond_init(&l->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&l->mutex);
+        allocator.Free(l);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    l->owner = (pthread_t) 0xDEADBEEF;
+    l->count = 0;
+    l->readers = 0;
+    return ((void *) l);
+} /* __PHYSFS_platformCreateRWLock */
+
+
+void __PHYSFS_platformDestroyRWLock(void *rwlock)
+{
+    PthreadRWLock *l = (PthreadRWLock *) rwlock;
+    assert((l->count == 0) && (l->readers == 0));  /* catch programming errors. */
+    pthread_cond_destroy(&l->cond);
+    pthread_mutex_destroy(&l->mutex);
+    allocator.Free(l);
+} /* __PHYSFS_platformDestroyRWLock */
+
+
+int __PHYSFS_platformGrabRWLockShared(void *rwlock)
+{
+    PthreadRWLock *l = (PthreadRWLock *) rwlock;
+    pthread_t tid = pthread_self();
+
+    if (pthread_mutex_lock(&l->mutex) != 0)
+        return 0;
+
+    if ((l->count > 0) && (l->owner == tid))
+        l->count++;  /* we hold it exclusively; that's good enough. */
+    else
+    {
+        /* Don't wait on pending writers, so recursive readers can't hang. */
+        while (l->count > 0)
+        {
+            if (pthread_cond_wait(&l->cond, &l->mutex) != 0)
+            {
+                pthread_mutex_unlock(&l->mutex);
+                return 0;
+            } /* if */
+        } /* while */
+        l->readers++;
+    } /* else */
+
+    pthread_mutex_unlock(&l->mutex);
+    return 1;
+} /* __PHYSFS_platformGrabRWLockShared */
+
+
+int __PHYSFS_platformGrabRWLockExclusive(void *rwlock)
+{
+    PthreadRWLock *l = (PthreadRWLock *) rwlock;
+    pthread_t tid = pthread_self();
+
+    if (pthread_mutex_lock(&l->mutex) != 0)
+        return 0;
+
+    if ((l->count == 0) || (l->owner != tid))
+    {
+        while ((l->count > 0) || (l->readers > 0))
+        {
+            if (pthread_cond_wait(&l->cond, &l->mutex) != 0)
+            {
+                pthread_mutex_unlock(&l->mutex);
+                return 0;
+            } /* if */
+        } /* while */
+        l->owner = tid;
+    } /* if */
+
+    l->count++;
+    pthread_mutex_unlock(&l->mutex);
+    return 1;
+} /* __PHYSFS_platformGrabRWLockExclusive */
+
+
+void __PHYSFS_platformReleaseRWLock(void *rwlock)
+{
+    PthreadRWLock *l = (PthreadRWLock *) rwlock;
+
+    if (pthread_mutex_lock(&l->mutex) != 0)
+        return;
+
+    if ((l->count > 0) && (l->owner == pthread_self()))
+    {
+        if (--l->count == 0)
+        {
+            l->owner = (pthread_t) 0xDEADBEEF;
+            pthread_cond_broadcast(&l->cond);
+        } /* if */
+    } /* if */
+    else
+    {
+        assert(l->readers > 0);  /* catch programming errors. */
+        if ((l->readers > 0) && (--l->readers == 0))
+            pthread_cond_broadcast(&l->cond);
+    } /* else */
+
+    pthread_mutex_unlock(&l->mutex);
+} /* __PHYSFS_platformReleaseRWLock */
+
+
+#if PHYSFS_PLATFORM_LINUX
+
+/*
+ * inotify only watches single directories, so we remember the path of each
+ *  one we asked for, indexed by watch descriptor (the kernel hands those out
+ *  counting up from 1), to turn events back into paths. The watch thread
+ *  sleeps in poll() until there are events, or until (wakefd) says it's
+ *  time to go.
+ */
+typedef struct
+{
+    int fd;
+    int wakefd[2];
+    void *thread;
+    pthread_mutex_t mutex;  /* protects (paths) and (pathspace). */
+    char **paths;
+    size_t pathspace;
+    __PHYSFS_WatchCallback fn;
+    void *data;
+} InotifyWatch;
+
+#define INOTIFY_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+                            IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+
+/* (event) came from (w->fd); tell (w->fn) what it was about. */
+static void inotifyReport(InotifyWatch *w, const struct inotify_event *event)
+{
+    const char *name = (event->len > 0) ? event->name : "";
+    const size_t wd = (size_t) event->wd;
+    char *path = NULL;
+
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        w->fn(w->data, NULL);
+        return;
+    } /* if */
+
+    pthread_mutex_lock(&w->mutex);
+    if ((event->wd >= 0) && (wd < w->pathspace) && (w->paths[wd] != NULL))
+    {
+        const char *dir = w->paths[wd];
+        const size_t dirlen = strlen(dir);
+        const int needsep = ((*name) && (dirlen > 0) && (dir[dirlen-1] != '/'));
+        path = (char *) allocator.Malloc(dirlen + strlen(name) + 2);
+        if (path != NULL)
+            sprintf(path, "%s%s%s", dir, needsep ? "/" : "", name);
+
+        if (event->mask & IN_IGNORED)  /* the kernel dropped this watch. */
+        {
+            allocator.Free(w->paths[wd]);
+            w->paths[wd] = NULL;
+        } /* if */
+    } /* if */
+    pthread_mutex_unlock(&w->mutex);
+
+    w->fn(w->data, path);  /* NULL path if we lost track: anything changed. */
+    if (path != NULL)
+        allocator.Free(path);
+} /* inotifyReport */
+
+
+static void inotifyThread(void *arg)
+{
+    InotifyWatch *w = (InotifyWatch *) arg;
+    struct pollfd fds[2];
+
+    fds[0].fd = w->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = w->wakefd[0];
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        union { struct inotify_event event; char buf[4096]; } u;
+        ssize_t br;
+        char *ptr;
+
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            w->fn(w->data, NULL);  /* can't wait anymore, so assume the worst. */
+            break;
+        } /* if */
+
+        if (fds[1].revents)
+            break;  /* __PHYSFS_platformDestroyWatch() wants us gone. */
+
+        br = read(w->fd, u.buf, sizeof (u.buf));
+        if (br <= 0)
+        {
+            if ((br == -1) && ((errno == EINTR) || (errno == EAGAIN)))
+                continue;
+            w->fn(w->data, NULL);
+            break;
+        } /* if */
+
+        for (ptr = u.buf; ptr < u.buf + br; )
+        {
+            const struct inotify_event *event;
+            event = (const struct inotify_event *) ptr;
+            inotifyReport(w, event);
+            ptr += sizeof (struct inotify_event) + event->len;
+        } /* for */
+    } /* while */
+} /* inotifyThread */
+
+
+int __PHYSFS_platformWatchDir(void *watch, const char *dir)
+{
+    InotifyWatch *w = (InotifyWatch *) watch;
+    char *path;
+    size_t wd;
+    int rc;
+
+    path = (char *) allocator.Malloc(strlen(dir) + 1);
+    BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    strcpy(path, dir);
+
+    pthread_mutex_lock(&w->mutex);
+
+    rc = inotify_add_watch(w->fd, dir, INOTIFY_WATCH_MASK);
+    if (rc == -1)
+    {
+        const int err = errno;
+        pthread_mutex_unlock(&w->mutex);
+        allocator.Free(path);
+        BAIL(errcodeFromErrnoError(err), 0);
+    } /* if */
+
+    wd = (size_t) rc;
+    if (wd >= w->pathspace)
+    {
+        size_t newspace = w->pathspace ? w->pathspace : 16;
+        void *ptr;
+        while (newspace <= wd)
+            newspace *= 2;
+        ptr = allocator.Realloc(w->paths, newspace * sizeof (char *));
+        if (!ptr)
+        {
+            inotify_rm_watch(w->fd, rc);
+            pthread_mutex_unlock(&w->mutex);
+            allocator.Free(path);
+            BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        } /* if */
+        w->paths = (char **) ptr;
+        memset(w->paths + w->pathspace, '\0',
+               (newspace - w->pathspace) * sizeof (char *));
+        w->pathspace = newspace;
+    } /* if */
+
+    if (w->paths[wd] != NULL)  /* already watching it. */
+        allocator.Free(path);
+    else
+        w->paths[wd] = path;
+
+    pthread_mutex_unlock(&w->mutex);
+    return 1;
+} /* __PHYSFS_platformWatchDir */
+
+
+void *__PHYSFS_platformCreateWatch(const char *dir, __PHYSFS_WatchCallback fn,
+                                   void *data)
+{
+    InotifyWatch *w = (InotifyWatch *) allocator.Malloc(sizeof (InotifyWatch));
+    BAIL_IF(!w, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(w, '\0', sizeof (*w));
+    w->fn = fn;
+    w->data = data;
+    w->wakefd[0] = w->wakefd[1] = -1;
+
+    if (pthread_mutex_init(&w->mutex, NULL) != 0)
+    {
+        allocator.Free(w);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    GOTO_IF(w->fd == -1, errcodeFromErrno(), createWatch_failed);
+    GOTO_IF(pipe(w->wakefd) == -1, errcodeFromErrno(), createWatch_failed);
+    fcntl(w->wakefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(w->wakefd[1], F_SETFD, FD_CLOEXEC);
+
+    /* watch (dir) before there's a thread to race with us. */
+    GOTO_IF_ERRPASS(!__PHYSFS_platformWatchDir(w, dir), createWatch_failed);
+
+    w->thread = __PHYSFS_platformCreateThread(inotifyThread, w);
+    GOTO_IF_ERRPASS(!w->thread, createWatch_failed);
+
+    return w;
+
+createWatch_failed:
+    w->thread = NULL;
+    __PHYSFS_platformDestroyWatch(w);
+    return NULL;
+} /* __PHYSFS_platformCreateWatch */
+
+
+void __PHYSFS_platformDestroyWatch(void *watch)
+{
+    InotifyWatch *w = (InotifyWatch *) watch;
+    size_t i;
+
+    if (w->thread != NULL)
+    {
+        const char byte = 0;
+        while ((write(w->wakefd[1], &byte, 1) == -1) && (errno == EINTR)) {}
+        __PHYSFS_platformWaitThread(w->thread);
+    } /* if */
+
+    if (w->fd != -1) close(w->fd);  /* drops the kernel's watches, too. */
+    if (w->wakefd[0] != -1) close(w->wakefd[0]);
+    if (w->wakefd[1] != -1) close(w->wakefd[1]);
+
+    for (i = 0; i < w->pathspace; i++)
+    {
+        if (w->paths[i] != NULL)
+            allocator.Free(w->paths[i]);
+    } /* for */
+
+    if (w->paths != NULL)
+        allocator.Free(w->paths);
+    pthread_mutex_destroy(&w->mutex);
+    allocator.Free(w);
+} /* __PHYSFS_platformDestroyWatch */
+
+#endif  /* PHYSFS_PLATFORM_LINUX */
+
 #endif  /* PHYSFS_PLATFORM_POSIX */
 
 /* end of physfs_platform_posix.c ... */
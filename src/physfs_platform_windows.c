@@ -631,20 +631,306 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
-PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
-                               PHYSFS_EnumerateCallback callback,
-                               const char *origdir, void *callbackdata)
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+    /* this never changes while the system's up; a racy first call is ok. */
+    static LONGLONG freq = 0;
+    LARGE_INTEGER li;
+    LONGLONG now;
+
+    if (freq == 0)
+    {
+        QueryPerformanceFrequency(&li);
+        freq = li.QuadPart;
+    } /* if */
+
+    QueryPerformanceCounter(&li);
+    now = li.QuadPart;
+
+    /* split it up, so the multiply can't overflow. */
+    return (((PHYSFS_uint64) (now / freq)) * __PHYSFS_UI64(1000000000)) +
+           ((((PHYSFS_uint64) (now % freq)) * __PHYSFS_UI64(1000000000)) /
+            ((PHYSFS_uint64) freq));
+} /* __PHYSFS_platformNanoseconds */
+
+
+typedef struct
+{
+    HANDLE handle;
+    void (*fn)(void *);
+    void *data;
+} WinThread;
+
+
+static DWORD WINAPI winThreadEntry(LPVOID arg)
+{
+    WinThread *t = (WinThread *) arg;
+    t->fn(t->data);
+    return 0;
+} /* winThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+#ifdef PHYSFS_PLATFORM_WINRT
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);  /* !!! FIXME: use the thread pool? */
+#else
+    WinThread *t = (WinThread *) allocator.Malloc(sizeof (*t));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    t->handle = CreateThread(NULL, 0, winThreadEntry, t, 0, NULL);
+    if (t->handle == NULL)
+    {
+        const DWORD err = GetLastError();
+        allocator.Free(t);
+        BAIL(errcodeFromWinApiError(err), NULL);
+    } /* if */
+
+    return ((void *) t);
+#endif
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    WinThread *t = (WinThread *) thread;
+    WaitForSingleObjectEx(t->handle, INFINITE, FALSE);
+    CloseHandle(t->handle);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(const PHYSFS_uint32 initial)
+{
+    HANDLE h;
+    #ifdef PHYSFS_PLATFORM_WINRT
+    h = CreateSemaphoreExW(NULL, (LONG) initial, 0x7FFFFFFF, NULL, 0,
+                           SEMAPHORE_ALL_ACCESS);
+    #else
+    h = CreateSemaphoreW(NULL, (LONG) initial, 0x7FFFFFFF, NULL);
+    #endif
+    BAIL_IF(h == NULL, errcodeFromWinApi(), NULL);
+    return ((void *) h);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    CloseHandle((HANDLE) sem);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+int __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    const DWORD rc = WaitForSingleObjectEx((HANDLE) sem, INFINITE, FALSE);
+    return (rc == WAIT_OBJECT_0);
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    ReleaseSemaphore((HANDLE) sem, 1, NULL);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+#ifndef PHYSFS_NO_PLATFORM_WATCH
+
+/*
+ * ReadDirectoryChangesW() watches a whole tree from one directory handle.
+ *  The watch thread waits on the overlapped read and on (wake), which
+ *  __PHYSFS_platformDestroyWatch() signals when it's time to go.
+ */
+typedef struct
+{
+    HANDLE dir;
+    HANDLE wake;
+    OVERLAPPED ov;
+    void *thread;
+    char *path;  /* what we're watching, with a trailing '\\'. */
+    __PHYSFS_WatchCallback fn;
+    void *data;
+    DWORD buf[16 * 1024];  /* DWORD-aligned, as the API insists. */
+} WinWatch;
+
+#define WINWATCH_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | \
+                         FILE_NOTIFY_CHANGE_DIR_NAME | \
+                         FILE_NOTIFY_CHANGE_ATTRIBUTES | \
+                         FILE_NOTIFY_CHANGE_SIZE | \
+                         FILE_NOTIFY_CHANGE_LAST_WRITE | \
+                         FILE_NOTIFY_CHANGE_CREATION)
+
+
+/* (info) is one record from (w->buf); tell (w->fn) where it happened. */
+static void winWatchReport(WinWatch *w, const FILE_NOTIFY_INFORMATION *info)
+{
+    const DWORD wlen = info->FileNameLength / sizeof (WCHAR);
+    const size_t pathlen = strlen(w->path);
+    char *path = NULL;
+    WCHAR *wname;
+
+    wname = (WCHAR *) allocator.Malloc((wlen + 1) * sizeof (WCHAR));
+    if (wname != NULL)
+    {
+        const size_t len = pathlen + (wlen * 4) + 1;
+        memcpy(wname, info->FileName, wlen * sizeof (WCHAR));
+        wname[wlen] = 0;
+        path = (char *) allocator.Malloc(len);
+        if (path != NULL)
+        {
+            memcpy(path, w->path, pathlen);
+            PHYSFS_utf8FromUtf16((const PHYSFS_uint16 *) wname,
+                                 path + pathlen, len - pathlen);
+        } /* if */
+        allocator.Free(wname);
+    } /* if */
+
+    w->fn(w->data, path);  /* NULL path if we ran out of memory. */
+    if (path != NULL)
+        allocator.Free(path);
+} /* winWatchReport */
+
+
+static void winWatchThread(void *arg)
+{
+    WinWatch *w = (WinWatch *) arg;
+    HANDLE handles[2];
+
+    handles[0] = w->ov.hEvent;
+    handles[1] = w->wake;
+
+    while (1)
+    {
+        DWORD br = 0;
+        DWORD rc;
+
+        ResetEvent(w->ov.hEvent);
+        if (!ReadDirectoryChangesW(w->dir, w->buf, sizeof (w->buf), TRUE,
+                                   WINWATCH_FILTER, NULL, &w->ov, NULL))
+        {
+            w->fn(w->data, NULL);  /* can't watch anymore; assume the worst. */
+            break;
+        } /* if */
+
+        rc = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        if (rc != WAIT_OBJECT_0)  /* woken up, or something went wrong. */
+        {
+            CancelIo(w->dir);
+            GetOverlappedResult(w->dir, &w->ov, &br, TRUE);
+            if (rc != WAIT_OBJECT_0 + 1)
+                w->fn(w->data, NULL);
+            break;
+        } /* if */
+
+        if (!GetOverlappedResult(w->dir, &w->ov, &br, FALSE))
+        {
+            w->fn(w->data, NULL);
+            break;
+        } /* if */
+        else if (br == 0)  /* overflowed (w->buf); we lost track. */
+            w->fn(w->data, NULL);
+        else
+        {
+            const BYTE *ptr = (const BYTE *) w->buf;
+            while (1)
+            {
+                const FILE_NOTIFY_INFORMATION *info;
+                info = (const FILE_NOTIFY_INFORMATION *) ptr;
+                winWatchReport(w, info);
+                if (info->NextEntryOffset == 0)
+                    break;
+                ptr += info->NextEntryOffset;
+            } /* while */
+        } /* else */
+    } /* while */
+} /* winWatchThread */
+
+
+void *__PHYSFS_platformCreateWatch(const char *dir, __PHYSFS_WatchCallback fn,
+                                   void *data)
+{
+    const size_t len = strlen(dir);
+    const DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    const DWORD flags = FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED;
+    WCHAR *wdir = NULL;
+    WinWatch *w = (WinWatch *) allocator.Malloc(sizeof (WinWatch));
+    BAIL_IF(!w, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(w, '\0', sizeof (*w) - sizeof (w->buf));
+    w->dir = INVALID_HANDLE_VALUE;
+    w->fn = fn;
+    w->data = data;
+
+    w->path = (char *) allocator.Malloc(len + 2);
+    GOTO_IF(!w->path, PHYSFS_ERR_OUT_OF_MEMORY, createWatch_failed);
+    strcpy(w->path, dir);
+    if ((len == 0) || (dir[len - 1] != '\\'))
+        strcat(w->path, "\\");
+
+    UTF8_TO_UNICODE_STACK(wdir, dir);
+    GOTO_IF(!wdir, PHYSFS_ERR_OUT_OF_MEMORY, createWatch_failed);
+    w->dir = CreateFileW(wdir, FILE_LIST_DIRECTORY, share, NULL,
+                         OPEN_EXISTING, flags, NULL);
+    if (w->dir == INVALID_HANDLE_VALUE)
+    {
+        const PHYSFS_ErrorCode err = errcodeFromWinApi();
+        __PHYSFS_smallFree(wdir);
+        GOTO(err, createWatch_failed);
+    } /* if */
+    __PHYSFS_smallFree(wdir);
+
+    w->ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    GOTO_IF(!w->ov.hEvent, errcodeFromWinApi(), createWatch_failed);
+    w->wake = CreateEventW(NULL, TRUE, FALSE, NULL);
+    GOTO_IF(!w->wake, errcodeFromWinApi(), createWatch_failed);
+
+    w->thread = __PHYSFS_platformCreateThread(winWatchThread, w);
+    GOTO_IF_ERRPASS(!w->thread, createWatch_failed);
+
+    return w;
+
+createWatch_failed:
+    __PHYSFS_platformDestroyWatch(w);
+    return NULL;
+} /* __PHYSFS_platformCreateWatch */
+
+
+int __PHYSFS_platformWatchDir(void *watch, const char *dir)
+{
+    return 1;  /* the watch already covers everything under its root. */
+} /* __PHYSFS_platformWatchDir */
+
+
+void __PHYSFS_platformDestroyWatch(void *watch)
+{
+    WinWatch *w = (WinWatch *) watch;
+
+    if (w->thread != NULL)
+    {
+        SetEvent(w->wake);
+        __PHYSFS_platformWaitThread(w->thread);
+    } /* if */
+
+    if (w->wake) CloseHandle(w->wake);
+    if (w->ov.hEvent) CloseHandle(w->ov.hEvent);
+    if (w->dir != INVALID_HANDLE_VALUE) CloseHandle(w->dir);
+    if (w->path) allocator.Free(w->path);
+    allocator.Free(w);
+} /* __PHYSFS_platformDestroyWatch */
+
+#endif  /* !PHYSFS_NO_PLATFORM_WATCH */
+
+
+/* Start a FindFirstFileW() search of everything in (dirname). */
+static HANDLE findFirstInDir(const char *dirname, WIN32_FIND_DATAW *entw)
 {
-    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
     HANDLE dir = INVALID_HANDLE_VALUE;
-    WIN32_FIND_DATAW entw;
     size_t len = strlen(dirname);
     char *searchPath = NULL;
     WCHAR *wSearchPath = NULL;
 
     /* Allocate a new string for path, maybe '\\', "*", and NULL terminator */
     searchPath = (char *) __PHYSFS_smallAlloc(len + 3);
-    BAIL_IF(!searchPath, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    BAIL_IF(!searchPath, PHYSFS_ERR_OUT_OF_MEMORY, INVALID_HANDLE_VALUE);
 
     /* Copy current dirname */
     strcpy(searchPath, dirname);
@@ -661,11 +947,24 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
 
     UTF8_TO_UNICODE_STACK(wSearchPath, searchPath);
     __PHYSFS_smallFree(searchPath);
-    BAIL_IF_ERRPASS(!wSearchPath, PHYSFS_ENUM_ERROR);
+    BAIL_IF_ERRPASS(!wSearchPath, INVALID_HANDLE_VALUE);
 
-    dir = winFindFirstFileW(wSearchPath, &entw);
+    dir = winFindFirstFileW(wSearchPath, entw);
     __PHYSFS_smallFree(wSearchPath);
-    BAIL_IF(dir==INVALID_HANDLE_VALUE, errcodeFromWinApi(), PHYSFS_ENUM_ERROR);
+    BAIL_IF(dir==INVALID_HANDLE_VALUE, errcodeFromWinApi(), dir);
+    return dir;
+} /* findFirstInDir */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    WIN32_FIND_DATAW entw;
+    HANDLE dir = findFirstInDir(dirname, &entw);
+
+    BAIL_IF_ERRPASS(dir == INVALID_HANDLE_VALUE, PHYSFS_ENUM_ERROR);
 
     do
     {
@@ -780,6 +1079,45 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 pos)
+{
+    HANDLE h = (HANDLE) opaque;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buf;
+    PHYSFS_sint64 totalRead = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    /* An OVERLAPPED offset on a synchronous handle reads from there. It
+       moves the file pointer too, but native Ios don't rely on it. */
+    while (len > 0)
+    {
+        const DWORD thislen = (len > 0xFFFFFFFF) ? 0xFFFFFFFF : (DWORD) len;
+        OVERLAPPED overlapped;
+        DWORD numRead = 0;
+
+        memset(&overlapped, '\0', sizeof (overlapped));
+        overlapped.Offset = (DWORD) (pos & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD) (pos >> 32);
+        if (!ReadFile(h, ptr, thislen, &numRead, &overlapped))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+            BAIL(errcodeFromWinApi(), -1);
+        } /* if */
+        ptr += numRead;
+        pos += (PHYSFS_uint64) numRead;
+        len -= (PHYSFS_uint64) numRead;
+        totalRead += (PHYSFS_sint64) numRead;
+        if (numRead != thislen)
+            break;
+    } /* while */
+
+    return totalRead;
+} /* __PHYSFS_platformReadAt */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -832,6 +1170,124 @@ PHYSFS_sint64 __PHYSFS_platformFileLength(void *opaque)
 } /* __PHYSFS_platformFileLength */
 
 
+static DWORD winMapGranularity(void)
+{
+    SYSTEM_INFO info;
+    #ifdef PHYSFS_PLATFORM_WINRT
+    GetNativeSystemInfo(&info);
+    #else
+    GetSystemInfo(&info);
+    #endif
+    return info.dwAllocationGranularity;
+} /* winMapGranularity */
+
+
+const void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 pos,
+                                     PHYSFS_uint64 len)
+{
+    HANDLE h = (HANDLE) opaque;
+    const PHYSFS_uint64 adjust = pos % winMapGranularity();
+    const PHYSFS_uint64 start = pos - adjust;
+    HANDLE mapping;
+    void *ptr;
+
+    assert(len > 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len + adjust),
+            PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    #ifdef PHYSFS_PLATFORM_WINRT
+    mapping = CreateFileMappingFromApp(h, NULL, PAGE_READONLY, 0, NULL);
+    #else
+    mapping = CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+    #endif
+    BAIL_IF(mapping == NULL, errcodeFromWinApi(), NULL);
+
+    #ifdef PHYSFS_PLATFORM_WINRT
+    ptr = MapViewOfFileFromApp(mapping, FILE_MAP_READ, start,
+                               (SIZE_T) (len + adjust));
+    #else
+    ptr = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD) (start >> 32),
+                        (DWORD) (start & 0xFFFFFFFF), (SIZE_T) (len + adjust));
+    #endif
+
+    /* the view keeps the mapping object alive until it is unmapped. */
+    if (ptr == NULL)
+    {
+        const PHYSFS_ErrorCode err = errcodeFromWinApi();
+        CloseHandle(mapping);
+        BAIL(err, NULL);
+    } /* if */
+
+    CloseHandle(mapping);
+    return ((const PHYSFS_uint8 *) ptr) + adjust;
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, PHYSFS_uint64 len)
+{
+    const size_t adjust = ((size_t) ptr) % winMapGranularity();
+    (void) UnmapViewOfFile(((const PHYSFS_uint8 *) ptr) - adjust);
+} /* __PHYSFS_platformUnmapFile */
+
+
+#ifndef PHYSFS_PLATFORM_WINRT
+/* PrefetchVirtualMemory() showed up in Windows 8; look it up, so we still
+   run on older ones, and so older SDKs don't need to know about it. */
+typedef struct { PVOID VirtualAddress; SIZE_T NumberOfBytes; } WinPrefRange;
+typedef BOOL (WINAPI *fnPVM)(HANDLE, ULONG_PTR, WinPrefRange *, ULONG);
+
+static fnPVM winPrefetchVirtualMemory(void)
+{
+    static fnPVM retval = NULL;
+    static int looked = 0;
+    if (!looked)
+    {
+        HMODULE lib = GetModuleHandleA("kernel32.dll");
+        if (lib)
+            retval = (fnPVM) GetProcAddress(lib, "PrefetchVirtualMemory");
+        looked = 1;
+    } /* if */
+    return retval;
+} /* winPrefetchVirtualMemory */
+#endif
+
+
+int __PHYSFS_platformPrefetchMapped(const void *ptr, PHYSFS_uint64 len)
+{
+    #ifdef PHYSFS_PLATFORM_WINRT
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME: no GetModuleHandle. */
+    #else
+    const fnPVM pPrefetch = winPrefetchVirtualMemory();
+    WinPrefRange range;
+
+    BAIL_IF(!pPrefetch, PHYSFS_ERR_UNSUPPORTED, 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len),PHYSFS_ERR_INVALID_ARGUMENT,0);
+    range.VirtualAddress = (PVOID) ptr;
+    range.NumberOfBytes = (SIZE_T) len;
+    BAIL_IF(!pPrefetch(GetCurrentProcess(), 1, &range, 0),
+            errcodeFromWinApi(), 0);
+    return 1;
+    #endif
+} /* __PHYSFS_platformPrefetchMapped */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 pos,
+                              PHYSFS_uint64 len)
+{
+    /* it needs a view, but the pages it reads stay in the file cache after
+       we unmap it, which is what we're after. */
+    const void *ptr;
+    int retval;
+
+    BAIL_IF(len == 0, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    ptr = __PHYSFS_platformMapFile(opaque, pos, len);
+    BAIL_IF_ERRPASS(!ptr, 0);
+    retval = __PHYSFS_platformPrefetchMapped(ptr, len);
+    __PHYSFS_platformUnmapFile(ptr, len);
+    return retval;
+} /* __PHYSFS_platformPrefetch */
+
+
 int __PHYSFS_platformFlush(void *opaque)
 {
     HANDLE h = (HANDLE) opaque;
@@ -874,6 +1330,25 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    int retval = 0;
+    LPWSTR wsrc = NULL;
+    LPWSTR wdst = NULL;
+    UTF8_TO_UNICODE_STACK(wsrc, src);
+    UTF8_TO_UNICODE_STACK(wdst, dst);
+    GOTO_IF(!wsrc || !wdst, PHYSFS_ERR_OUT_OF_MEMORY, done);
+    GOTO_IF(!MoveFileExW(wsrc, wdst, MOVEFILE_REPLACE_EXISTING),
+            errcodeFromWinApi(), done);
+    retval = 1;
+
+done:
+    __PHYSFS_smallFree(wdst);
+    __PHYSFS_smallFree(wsrc);
+    return retval;
+} /* __PHYSFS_platformRename */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     LPCRITICAL_SECTION lpcs;
@@ -910,6 +1385,111 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+/*
+ * SRW locks would be nice, but they need Vista, and they don't allow
+ *  recursion. So writers hold a critical section for as long as they have
+ *  the lock, readers just grab it long enough to bump a counter, and a
+ *  writer that has to wait for readers to drain polls for it. Writers are
+ *  rare (mounting, unmounting, etc), so the polling doesn't matter much.
+ */
+typedef struct
+{
+    CRITICAL_SECTION cs;  /* held by the writer the entire time. */
+    DWORD owner;  /* holds it exclusively, if (count) > 0. */
+    PHYSFS_uint32 count;  /* exclusive grabs by (owner). */
+    volatile LONG readers;  /* shared grabs from everyone else. */
+} WinRWLock;
+
+static inline void winYield(void)
+{
+    #ifdef PHYSFS_PLATFORM_WINRT
+    WaitForSingleObjectEx(GetCurrentThread(), 1, FALSE);  /* no Sleep(). */
+    #else
+    Sleep(1);
+    #endif
+} /* winYield */
+
+
+void *__PHYSFS_platformCreateRWLock(void)
+{
+    WinRWLock *l = (WinRWLock *) allocator.Malloc(sizeof (WinRWLock));
+    BAIL_IF(!l, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    if (!winInitializeCriticalSection(&l->cs))
+    {
+        allocator.Free(l);
+        BAIL(errcodeFromWinApi(), NULL);
+    } /* if */
+
+    l->owner = 0;
+    l->count = 0;
+    l->readers = 0;
+    return l;
+} /* __PHYSFS_platformCreateRWLock */
+
+
+void __PHYSFS_platformDestroyRWLock(void *rwlock)
+{
+    WinRWLock *l = (WinRWLock *) rwlock;
+    DeleteCriticalSection(&l->cs);
+    allocator.Free(l);
+} /* __PHYSFS_platformDestroyRWLock */
+
+
+int __PHYSFS_platformGrabRWLockShared(void *rwlock)
+{
+    WinRWLock *l = (WinRWLock *) rwlock;
+    EnterCriticalSection(&l->cs);
+    if ((l->count > 0) && (l->owner == GetCurrentThreadId()))
+        l->count++;  /* we hold it exclusively; keep the critical section. */
+    else
+    {
+        InterlockedIncrement(&l->readers);
+        LeaveCriticalSection(&l->cs);
+    } /* else */
+    return 1;
+} /* __PHYSFS_platformGrabRWLockShared */
+
+
+int __PHYSFS_platformGrabRWLockExclusive(void *rwlock)
+{
+    WinRWLock *l = (WinRWLock *) rwlock;
+    const DWORD tid = GetCurrentThreadId();
+
+    EnterCriticalSection(&l->cs);
+    if ((l->count == 0) || (l->owner != tid))
+    {
+        /* don't hold (cs) here, or a recursive reader would deadlock. */
+        while (l->readers > 0)
+        {
+            LeaveCriticalSection(&l->cs);
+            winYield();
+            EnterCriticalSection(&l->cs);
+        } /* while */
+        l->owner = tid;
+    } /* if */
+
+    l->count++;
+    return 1;
+} /* __PHYSFS_platformGrabRWLockExclusive */
+
+
+void __PHYSFS_platformReleaseRWLock(void *rwlock)
+{
+    WinRWLock *l = (WinRWLock *) rwlock;
+    if ((l->count > 0) && (l->owner == GetCurrentThreadId()))
+    {
+        if (--l->count == 0)
+            l->owner = 0;
+        LeaveCriticalSection(&l->cs);
+    } /* if */
+    else
+    {
+        InterlockedDecrement(&l->readers);
+    } /* else */
+} /* __PHYSFS_platformReleaseRWLock */
+
+
 static PHYSFS_sint64 FileTimeToPhysfsTime(const FILETIME *ft)
 {
     SYSTEMTIME st_utc;
@@ -1021,6 +1601,81 @@ int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *st, const int follo
     return 1;
 } /* __PHYSFS_platformStat */
 
+
+/* FindNextFileW() hands us everything GetFileAttributesExW() would. */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    WIN32_FIND_DATAW entw;
+    HANDLE dir = findFirstInDir(dirname, &entw);
+
+    BAIL_IF_ERRPASS(dir == INVALID_HANDLE_VALUE, PHYSFS_ENUM_ERROR);
+
+    do
+    {
+        const WCHAR *fn = entw.cFileName;
+        const DWORD attr = entw.dwFileAttributes;
+        const PHYSFS_uint64 size = (((PHYSFS_uint64) entw.nFileSizeHigh) << 32)
+                                 | entw.nFileSizeLow;
+        PHYSFS_Stat st;
+        char *utf8;
+
+        if (fn[0] == '.')  /* ignore "." and ".." */
+        {
+            if ((fn[1] == '\0') || ((fn[1] == '.') && (fn[2] == '\0')))
+                continue;
+        } /* if */
+
+        st.modtime = FileTimeToPhysfsTime(&entw.ftLastWriteTime);
+        st.accesstime = FileTimeToPhysfsTime(&entw.ftLastAccessTime);
+        st.createtime = FileTimeToPhysfsTime(&entw.ftCreationTime);
+        st.readonly = ((attr & FILE_ATTRIBUTE_READONLY) != 0);
+
+        if ((attr & PHYSFS_FILE_ATTRIBUTE_REPARSE_POINT) &&
+            (entw.dwReserved0 == PHYSFS_IO_REPARSE_TAG_SYMLINK))
+        {
+            st.filetype = PHYSFS_FILETYPE_SYMLINK;
+            st.filesize = 0;
+        } /* if */
+
+        else if (attr & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            st.filetype = PHYSFS_FILETYPE_DIRECTORY;
+            st.filesize = 0;
+        } /* else if */
+
+        else if (attr & (FILE_ATTRIBUTE_OFFLINE | FILE_ATTRIBUTE_DEVICE))
+        {
+            st.filetype = PHYSFS_FILETYPE_OTHER;
+            st.filesize = (PHYSFS_sint64) size;
+        } /* else if */
+
+        else
+        {
+            st.filetype = PHYSFS_FILETYPE_REGULAR;
+            st.filesize = (PHYSFS_sint64) size;
+        } /* else */
+
+        utf8 = unicodeToUtf8Heap(fn);
+        if (utf8 == NULL)
+            retval = PHYSFS_ENUM_ERROR;
+        else
+        {
+            retval = callback(callbackdata, origdir, utf8, &st);
+            allocator.Free(utf8);
+            if (retval == PHYSFS_ENUM_ERROR)
+                PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+        } /* else */
+    } while ((retval == PHYSFS_ENUM_OK) && (FindNextFileW(dir, &entw) != 0));
+
+    FindClose(dir);
+
+    return retval;
+} /* __PHYSFS_platformEnumerateStat */
+
 #endif  /* PHYSFS_PLATFORM_WINDOWS */
 
 /* end of physfs_platform_windows.c ... */
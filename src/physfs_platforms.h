@@ -30,6 +30,7 @@
 #  define PHYSFS_PLATFORM_WINDOWS 1
 #elif defined(__OS2__) || defined(OS2)
 #  define PHYSFS_PLATFORM_OS2 1
+#  define PHYSFS_NO_PLATFORM_READAT 1
 #elif ((defined __MACH__) && (defined __APPLE__))
 /* To check if iOS or not, we need to include this file */
 #  include <TargetConditionals.h>
@@ -76,5 +77,13 @@
 #  error Unknown platform.
 #endif
 
+/* Change notification: inotify, FSEvents, and ReadDirectoryChangesW. */
+#if PHYSFS_PLATFORM_LINUX
+#elif PHYSFS_PLATFORM_APPLE && !TARGET_OS_IPHONE
+#elif PHYSFS_PLATFORM_WINDOWS && !PHYSFS_PLATFORM_WINRT
+#else
+#  define PHYSFS_NO_PLATFORM_WATCH 1
+#endif
+
 #endif  /* include-once blocker. */
 
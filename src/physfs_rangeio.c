@@ -0,0 +1,732 @@
+/**
+ * PhysicsFS; a portable, flexible file i/o abstraction.
+ *
+ * Documentation is in physfs.h. It's verbose, honest.  :)
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/*
+ * A read-only PHYSFS_Io on top of an app-provided PHYSFS_RangeSource, for
+ *  mounting archives that live on a web server or CDN. The data is split
+ *  into fixed-size blocks; a fixed number of them are cached in memory
+ *  (least recently used gets evicted), optionally backed by one file per
+ *  block in a cache directory. A miss right after the block before it
+ *  also queues the next few blocks for background threads, so streaming
+ *  reads overlap with the fetches.
+ *
+ * All duplicates of one Io share a RangeCache. Readers pin a block while
+ *  copying out of it, so it can't be evicted under them. A block that's
+ *  being fetched is PENDING and belongs to whoever is fetching it; anyone
+ *  else who needs it waits on blockdone until it's READY (or back to
+ *  EMPTY, if the fetch failed and they should try themselves).
+ */
+
+#define __PHYSICSFS_INTERNAL__
+#include "physfs_internal.h"
+
+#define RANGEIO_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define RANGEIO_DEFAULT_CACHE_BLOCKS 64
+#define RANGEIO_READAHEAD 4  /* blocks queued after a miss; one thread each. */
+
+typedef enum RangeBlockState
+{
+    RANGEBLOCK_EMPTY,
+    RANGEBLOCK_PENDING,
+    RANGEBLOCK_READY
+} RangeBlockState;
+
+typedef struct RangeBlock
+{
+    PHYSFS_uint64 index;  /* which block of the data this is. */
+    PHYSFS_uint8 *data;  /* blocksize bytes, allocated on first use. */
+    PHYSFS_uint32 len;  /* valid bytes in (data); only the last is short. */
+    RangeBlockState state;
+    PHYSFS_uint32 refs;  /* readers copying out of (data) right now. */
+    PHYSFS_uint64 lastuse;  /* for LRU eviction. */
+    int prefetched;  /* fetched by readahead, nobody read it yet. */
+} RangeBlock;
+
+typedef struct RangeCache
+{
+    PHYSFS_RangeSource src;
+    PHYSFS_uint64 length;
+    PHYSFS_uint32 blocksize;
+    PHYSFS_uint32 numblocks;
+    RangeBlock *blocks;
+    PHYSFS_uint64 tick;
+    char *diskprefix;  /* cache dir + separator + name hash + '-', or NULL. */
+    void *lock;
+    void *blockdone;  /* posted once per waiter when a block changes. */
+    PHYSFS_uint32 waiters;
+    RangeBlock **queue;  /* readahead waiting for a thread; a ring. */
+    PHYSFS_uint32 queuehead;
+    PHYSFS_uint32 queuelen;
+    void *work;  /* posted once per queued block, and once per thread to quit. */
+    void *threads[RANGEIO_READAHEAD];
+    PHYSFS_uint32 numthreads;
+    int quitting;
+    int refcount;
+} RangeCache;
+
+typedef struct RangeIoInfo
+{
+    RangeCache *cache;
+    PHYSFS_uint64 pos;
+} RangeIoInfo;
+
+
+static int rangeDiskRead(const char *path, void *buf, const PHYSFS_uint32 len)
+{
+    void *handle = __PHYSFS_platformOpenRead(path);
+    int retval = 0;
+
+    if (handle != NULL)
+    {
+        /* a block that was cut short while writing is a miss, not data. */
+        retval = ( (__PHYSFS_platformFileLength(handle) == len) &&
+                   (__PHYSFS_platformRead(handle, buf, len) == len) );
+        __PHYSFS_platformClose(handle);
+    } /* if */
+
+    return retval;
+} /* rangeDiskRead */
+
+
+static void rangeDiskWrite(const char *path, const void *buf,
+                           const PHYSFS_uint32 len)
+{
+    void *handle = __PHYSFS_platformOpenWrite(path);
+    if (handle != NULL)
+    {
+        const int ok = ( (__PHYSFS_platformWrite(handle, buf, len) == len) &&
+                         (__PHYSFS_platformFlush(handle)) );
+        __PHYSFS_platformClose(handle);
+        if (!ok)
+            __PHYSFS_platformDelete(path);  /* don't leave a partial block. */
+    } /* if */
+} /* rangeDiskWrite */
+
+
+/* (block) must be PENDING and owned by the caller; don't hold the lock. */
+static int rangeLoadBlock(RangeCache *cache, RangeBlock *block)
+{
+    const PHYSFS_uint64 offset = block->index * cache->blocksize;
+    const PHYSFS_uint64 remain = cache->length - offset;
+    const PHYSFS_uint32 len = (remain < cache->blocksize) ?
+                                (PHYSFS_uint32) remain : cache->blocksize;
+    char *path = NULL;
+    int retval = 0;
+
+    if (block->data == NULL)
+    {
+        block->data = (PHYSFS_uint8 *) allocator.Malloc(cache->blocksize);
+        BAIL_IF(!block->data, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+
+    if (cache->diskprefix != NULL)
+    {
+        const size_t pathlen = strlen(cache->diskprefix) + 17;
+        path = (char *) __PHYSFS_smallAlloc(pathlen);
+        if (path != NULL)  /* no disk cache for this one if this fails. */
+        {
+            snprintf(path, pathlen, "%s%08x%08x", cache->diskprefix,
+                     (unsigned int) (block->index >> 32),
+                     (unsigned int) (block->index & 0xFFFFFFFF));
+            retval = rangeDiskRead(path, block->data, len);
+        } /* if */
+    } /* if */
+
+    if (!retval)
+    {
+        retval = (cache->src.fetch(cache->src.opaque, block->data,
+                                   len, offset) == len);
+        if ((retval) && (path != NULL))
+            rangeDiskWrite(path, block->data, len);
+    } /* if */
+
+    __PHYSFS_smallFree(path);
+
+    if (retval)
+        block->len = len;
+
+    return retval;
+} /* rangeLoadBlock */
+
+
+/* MAKE SURE you hold cache->lock before calling any of these! */
+
+static void rangeWake(RangeCache *cache)
+{
+    while (cache->waiters > 0)
+    {
+        __PHYSFS_platformPostSemaphore(cache->blockdone);
+        cache->waiters--;
+    } /* while */
+} /* rangeWake */
+
+/* drops the lock until something changes, then takes it back. */
+static void rangeWait(RangeCache *cache)
+{
+    cache->waiters++;
+    __PHYSFS_platformReleaseMutex(cache->lock);
+    __PHYSFS_platformWaitSemaphore(cache->blockdone);
+    __PHYSFS_platformGrabMutex(cache->lock);
+} /* rangeWait */
+
+static RangeBlock *rangeFind(RangeCache *cache, const PHYSFS_uint64 index)
+{
+    RangeBlock *block = cache->blocks;
+    PHYSFS_uint32 i;
+
+    for (i = 0; i < cache->numblocks; i++, block++)
+    {
+        if ((block->state != RANGEBLOCK_EMPTY) && (block->index == index))
+            return block;
+    } /* for */
+
+    return NULL;
+} /* rangeFind */
+
+/* take an empty block, or evict the least recently used, and mark it
+   PENDING for (index). NULL if everything is pinned or being fetched. */
+static RangeBlock *rangeClaim(RangeCache *cache, const PHYSFS_uint64 index)
+{
+    RangeBlock *retval = NULL;
+    RangeBlock *block = cache->blocks;
+    PHYSFS_uint32 i;
+
+    for (i = 0; i < cache->numblocks; i++, block++)
+    {
+        if (block->state == RANGEBLOCK_EMPTY)
+        {
+            retval = block;
+            break;
+        } /* if */
+
+        else if ((block->state == RANGEBLOCK_READY) && (block->refs == 0))
+        {
+            if ((retval == NULL) || (block->lastuse < retval->lastuse))
+                retval = block;
+        } /* else if */
+    } /* for */
+
+    if (retval != NULL)
+    {
+        retval->index = index;
+        retval->state = RANGEBLOCK_PENDING;
+        retval->refs = 0;
+        retval->lastuse = ++cache->tick;
+        retval->prefetched = 0;
+    } /* if */
+
+    return retval;
+} /* rangeClaim */
+
+/* queue the blocks after (index) for the readahead threads. */
+static void rangeReadAhead(RangeCache *cache, const PHYSFS_uint64 index)
+{
+    PHYSFS_uint64 i;
+
+    if (cache->numthreads == 0)
+        return;
+
+    for (i = index + 1; i <= index + RANGEIO_READAHEAD; i++)
+    {
+        RangeBlock *block;
+        if ((i * cache->blocksize) >= cache->length)
+            break;  /* past EOF. */
+        else if (rangeFind(cache, i) != NULL)
+            continue;  /* already have it, or it's on its way. */
+        else if (cache->queuelen == cache->numblocks)
+            break;  /* (shouldn't happen: each queued block holds a slot.) */
+
+        block = rangeClaim(cache, i);
+        if (block == NULL)
+            break;  /* cache is full of things in use. Not worth waiting. */
+
+        block->prefetched = 1;
+        cache->queue[(cache->queuehead + cache->queuelen) % cache->numblocks] = block;
+        cache->queuelen++;
+        __PHYSFS_platformPostSemaphore(cache->work);
+    } /* for */
+} /* rangeReadAhead */
+
+
+static void rangeWorker(void *data)
+{
+    RangeCache *cache = (RangeCache *) data;
+
+    while (__PHYSFS_platformWaitSemaphore(cache->work))
+    {
+        RangeBlock *block;
+        int ok;
+
+        __PHYSFS_platformGrabMutex(cache->lock);
+        if ((cache->quitting) || (cache->queuelen == 0))
+        {
+            const int quitting = cache->quitting;
+            __PHYSFS_platformReleaseMutex(cache->lock);
+            if (quitting)
+                break;
+            continue;
+        } /* if */
+
+        block = cache->queue[cache->queuehead];
+        cache->queuehead = (cache->queuehead + 1) % cache->numblocks;
+        cache->queuelen--;
+        __PHYSFS_platformReleaseMutex(cache->lock);
+
+        /* errors are thrown away here; a reader will retry it and see them. */
+        ok = rangeLoadBlock(cache, block);
+
+        __PHYSFS_platformGrabMutex(cache->lock);
+        block->state = ok ? RANGEBLOCK_READY : RANGEBLOCK_EMPTY;
+        rangeWake(cache);
+        __PHYSFS_platformReleaseMutex(cache->lock);
+    } /* while */
+} /* rangeWorker */
+
+
+/* get block (index) in memory and pinned, fetching it if we have to. */
+static RangeBlock *rangeGetBlock(RangeCache *cache, const PHYSFS_uint64 index)
+{
+    RangeBlock *block = NULL;
+    int ok;
+
+    __PHYSFS_platformGrabMutex(cache->lock);
+    while (1)
+    {
+        block = rangeFind(cache, index);
+        if (block == NULL)
+        {
+            block = rangeClaim(cache, index);
+            if (block != NULL)
+                break;  /* it's ours to fetch. */
+        } /* if */
+
+        else if (block->state == RANGEBLOCK_READY)
+        {
+            block->refs++;
+            block->lastuse = ++cache->tick;
+            if (block->prefetched)  /* caught up with readahead; keep it going. */
+            {
+                block->prefetched = 0;
+                rangeReadAhead(cache, index);
+            } /* if */
+            __PHYSFS_platformReleaseMutex(cache->lock);
+            return block;
+        } /* else if */
+
+        /* it's being fetched, or every block is busy. Try again later. */
+        rangeWait(cache);
+    } /* while */
+
+    /* if we just read the block before this one, it looks like a stream, so
+       get the next few started before we sit waiting on this one. The
+       archivers share one Io between all their open files, so looking at
+       what's in the cache works better than tracking each caller. */
+    if ((index > 0) && (rangeFind(cache, index - 1) != NULL))
+        rangeReadAhead(cache, index);
+    __PHYSFS_platformReleaseMutex(cache->lock);
+
+    ok = rangeLoadBlock(cache, block);
+
+    __PHYSFS_platformGrabMutex(cache->lock);
+    if (ok)
+    {
+        block->state = RANGEBLOCK_READY;
+        block->refs = 1;
+    } /* if */
+    else
+    {
+        block->state = RANGEBLOCK_EMPTY;
+    } /* else */
+    rangeWake(cache);
+    __PHYSFS_platformReleaseMutex(cache->lock);
+
+    return ok ? block : NULL;
+} /* rangeGetBlock */
+
+
+static void rangePutBlock(RangeCache *cache, RangeBlock *block)
+{
+    __PHYSFS_platformGrabMutex(cache->lock);
+    assert(block->refs > 0);
+    if (--block->refs == 0)
+        rangeWake(cache);  /* someone might be waiting to evict it. */
+    __PHYSFS_platformReleaseMutex(cache->lock);
+} /* rangePutBlock */
+
+
+static void rangeFreeCache(RangeCache *cache)
+{
+    PHYSFS_uint32 i;
+
+    if (cache->numthreads > 0)
+    {
+        __PHYSFS_platformGrabMutex(cache->lock);
+        cache->quitting = 1;
+        __PHYSFS_platformReleaseMutex(cache->lock);
+
+        for (i = 0; i < cache->numthreads; i++)
+            __PHYSFS_platformPostSemaphore(cache->work);
+        for (i = 0; i < cache->numthreads; i++)
+            __PHYSFS_platformWaitThread(cache->threads[i]);
+    } /* if */
+
+    if (cache->work != NULL)
+        __PHYSFS_platformDestroySemaphore(cache->work);
+    if (cache->blockdone != NULL)
+        __PHYSFS_platformDestroySemaphore(cache->blockdone);
+    if (cache->lock != NULL)
+        __PHYSFS_platformDestroyMutex(cache->lock);
+
+    if (cache->blocks != NULL)
+    {
+        for (i = 0; i < cache->numblocks; i++)
+        {
+            if (cache->blocks[i].data != NULL)
+                allocator.Free(cache->blocks[i].data);
+        } /* for */
+        allocator.Free(cache->blocks);
+    } /* if */
+
+    if (cache->queue != NULL)
+        allocator.Free(cache->queue);
+    if (cache->diskprefix != NULL)
+        allocator.Free(cache->diskprefix);
+    if (cache->src.destroy != NULL)
+        cache->src.destroy(cache->src.opaque);
+
+    allocator.Free(cache);
+} /* rangeFreeCache */
+
+
+static PHYSFS_sint64 rangeIo_readAt(PHYSFS_Io *io, void *_buf,
+                                    PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    RangeCache *cache = ((RangeIoInfo *) io->opaque)->cache;
+    PHYSFS_uint8 *buf = (PHYSFS_uint8 *) _buf;
+    PHYSFS_sint64 retval = 0;
+
+    if (offset >= cache->length)
+        return 0;  /* at or past EOF; nothing to do. */
+
+    if (len > cache->length - offset)
+        len = cache->length - offset;
+
+    while (len > 0)
+    {
+        const PHYSFS_uint64 index = offset / cache->blocksize;
+        const PHYSFS_uint32 blockofs = (PHYSFS_uint32) (offset % cache->blocksize);
+        RangeBlock *block = rangeGetBlock(cache, index);
+        PHYSFS_uint32 cpy;
+
+        if (block == NULL)  /* report what we got, or the error if nothing. */
+            return (retval > 0) ? retval : -1;
+
+        cpy = block->len - blockofs;
+        if (cpy > len)
+            cpy = (PHYSFS_uint32) len;
+        memcpy(buf, block->data + blockofs, cpy);
+        rangePutBlock(cache, block);
+
+        buf += cpy;
+        offset += cpy;
+        len -= cpy;
+        retval += cpy;
+    } /* while */
+
+    return retval;
+} /* rangeIo_readAt */
+
+static PHYSFS_sint64 rangeIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    const PHYSFS_sint64 rc = rangeIo_readAt(io, buf, len, info->pos);
+    if (rc > 0)
+        info->pos += (PHYSFS_uint64) rc;
+    return rc;
+} /* rangeIo_read */
+
+static PHYSFS_sint64 rangeIo_write(PHYSFS_Io *io, const void *buffer,
+                                   PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_OPEN_FOR_READING, -1);
+} /* rangeIo_write */
+
+static int rangeIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    BAIL_IF(offset > info->cache->length, PHYSFS_ERR_PAST_EOF, 0);
+    info->pos = offset;
+    return 1;
+} /* rangeIo_seek */
+
+static PHYSFS_sint64 rangeIo_tell(PHYSFS_Io *io)
+{
+    const RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->pos;
+} /* rangeIo_tell */
+
+static PHYSFS_sint64 rangeIo_length(PHYSFS_Io *io)
+{
+    const RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->cache->length;
+} /* rangeIo_length */
+
+static PHYSFS_Io *rangeIo_duplicate(PHYSFS_Io *io)
+{
+    RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    RangeIoInfo *newinfo = NULL;
+    PHYSFS_Io *retval = NULL;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    newinfo = (RangeIoInfo *) allocator.Malloc(sizeof (RangeIoInfo));
+    if (!newinfo)
+    {
+        allocator.Free(retval);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    __PHYSFS_ATOMIC_INCR(&info->cache->refcount);  /* share the cache. */
+
+    newinfo->cache = info->cache;
+    newinfo->pos = 0;
+    memcpy(retval, io, sizeof (*retval));
+    retval->opaque = newinfo;
+    return retval;
+} /* rangeIo_duplicate */
+
+static int rangeIo_flush(PHYSFS_Io *io) { return 1;  /* it's read-only. */ }
+
+static void rangeIo_destroy(PHYSFS_Io *io)
+{
+    RangeIoInfo *info = (RangeIoInfo *) io->opaque;
+    RangeCache *cache = info->cache;
+    allocator.Free(info);
+    allocator.Free(io);
+    if (__PHYSFS_ATOMIC_DECR(&cache->refcount) == 0)
+        rangeFreeCache(cache);
+} /* rangeIo_destroy */
+
+
+static const PHYSFS_Io __PHYSFS_rangeIoInterface =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    rangeIo_read,
+    rangeIo_write,
+    rangeIo_seek,
+    rangeIo_tell,
+    rangeIo_length,
+    rangeIo_duplicate,
+    rangeIo_flush,
+    rangeIo_destroy,
+    rangeIo_readAt
+};
+
+
+/* (cacheDir) + separator + a hash of the name and block size + '-'. Block
+   files get their index appended, in hex. Changing the block size changes what's
+   in every file, so it gets a different set of them. */
+static char *rangeMakeDiskPrefix(const char *cacheDir, const char *name,
+                                 const PHYSFS_uint32 blocksize)
+{
+    const size_t dirlen = strlen(cacheDir);
+    const size_t len = dirlen + 1 + 16 + 1 + 1;
+    PHYSFS_uint64 hash = __PHYSFS_UI64(0xCBF29CE484222325);  /* FNV-1a */
+    const PHYSFS_uint8 *ptr;
+    PHYSFS_Stat statbuf;
+    char *retval;
+    size_t i;
+
+    if (!__PHYSFS_platformStat(cacheDir, &statbuf, 1))
+        BAIL_IF_ERRPASS(!__PHYSFS_platformMkDir(cacheDir), NULL);
+    else
+    {
+        BAIL_IF(statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY,
+                PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    } /* else */
+
+    for (ptr = (const PHYSFS_uint8 *) name; *ptr; ptr++)
+        hash = (hash ^ *ptr) * __PHYSFS_UI64(0x100000001B3);
+    for (i = 0; i < sizeof (blocksize); i++)
+        hash = (hash ^ ((blocksize >> (i * 8)) & 0xFF)) * __PHYSFS_UI64(0x100000001B3);
+
+    retval = (char *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(retval, cacheDir, dirlen);
+    i = dirlen;
+    if ((i == 0) || (retval[i-1] != __PHYSFS_platformDirSeparator))
+        retval[i++] = __PHYSFS_platformDirSeparator;
+    snprintf(retval + i, len - i, "%08x%08x-",
+             (unsigned int) (hash >> 32), (unsigned int) (hash & 0xFFFFFFFF));
+    return retval;
+} /* rangeMakeDiskPrefix */
+
+
+PHYSFS_Io *PHYSFS_createRangeIo(const PHYSFS_RangeSource *src,
+                                PHYSFS_uint32 blockSize,
+                                PHYSFS_uint32 cacheBlocks,
+                                const char *cacheDir)
+{
+    PHYSFS_Io *io = NULL;
+    RangeIoInfo *info = NULL;
+    RangeCache *cache = NULL;
+    PHYSFS_sint64 len;
+
+    BAIL_IF(!PHYSFS_isInit(), PHYSFS_ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF(!src, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(src->version != 0, PHYSFS_ERR_UNSUPPORTED, NULL);
+    BAIL_IF(!src->length, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!src->fetch, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(cacheDir && !src->name, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+
+    if (blockSize == 0)
+        blockSize = RANGEIO_DEFAULT_BLOCK_SIZE;
+    if (cacheBlocks == 0)
+        cacheBlocks = RANGEIO_DEFAULT_CACHE_BLOCKS;
+
+    len = src->length(src->opaque);
+    BAIL_IF_ERRPASS(len < 0, NULL);
+
+    cache = (RangeCache *) allocator.Malloc(sizeof (RangeCache));
+    BAIL_IF(!cache, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(cache, '\0', sizeof (*cache));
+    memcpy(&cache->src, src, sizeof (cache->src));
+    cache->src.destroy = NULL;  /* don't call it if we fail. */
+    cache->length = (PHYSFS_uint64) len;
+    cache->blocksize = blockSize;
+    cache->numblocks = cacheBlocks;
+    cache->refcount = 1;
+
+    cache->blocks = (RangeBlock *) allocator.Malloc(sizeof (RangeBlock) * cacheBlocks);
+    GOTO_IF(!cache->blocks, PHYSFS_ERR_OUT_OF_MEMORY, createRangeIo_failed);
+    memset(cache->blocks, '\0', sizeof (RangeBlock) * cacheBlocks);
+    cache->queue = (RangeBlock **) allocator.Malloc(sizeof (RangeBlock *) * cacheBlocks);
+    GOTO_IF(!cache->queue, PHYSFS_ERR_OUT_OF_MEMORY, createRangeIo_failed);
+
+    cache->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!cache->lock, createRangeIo_failed);
+    cache->blockdone = __PHYSFS_platformCreateSemaphore(0);
+    GOTO_IF_ERRPASS(!cache->blockdone, createRangeIo_failed);
+
+    if (cacheDir != NULL)
+    {
+        cache->diskprefix = rangeMakeDiskPrefix(cacheDir, src->name, blockSize);
+        GOTO_IF_ERRPASS(!cache->diskprefix, createRangeIo_failed);
+    } /* if */
+
+    /* readahead is a bonus; if we can't get threads, just go without. */
+    cache->work = __PHYSFS_platformCreateSemaphore(0);
+    while ((cache->work != NULL) && (cache->numthreads < RANGEIO_READAHEAD))
+    {
+        void *t = __PHYSFS_platformCreateThread(rangeWorker, cache);
+        if (t == NULL)
+            break;
+        cache->threads[cache->numthreads++] = t;
+    } /* while */
+
+    io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, createRangeIo_failed);
+    info = (RangeIoInfo *) allocator.Malloc(sizeof (RangeIoInfo));
+    GOTO_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, createRangeIo_failed);
+
+    cache->src.destroy = src->destroy;  /* it's ours now. */
+    info->cache = cache;
+    info->pos = 0;
+    memcpy(io, &__PHYSFS_rangeIoInterface, sizeof (*io));
+    io->opaque = info;
+    return io;
+
+createRangeIo_failed:
+    if (info != NULL) allocator.Free(info);
+    if (io != NULL) allocator.Free(io);
+    rangeFreeCache(cache);
+    return NULL;
+} /* PHYSFS_createRangeIo */
+
+
+/* PHYSFS_createCachedIo() is a RangeIo over another PHYSFS_Io. */
+
+typedef struct CachedIoSource
+{
+    PHYSFS_Io *io;
+    void *lock;  /* for seek-and-read, if (io) doesn't have a readAt(). */
+} CachedIoSource;
+
+static PHYSFS_sint64 cachedIoSource_length(void *opaque)
+{
+    PHYSFS_Io *io = ((CachedIoSource *) opaque)->io;
+    return io->length(io);
+} /* cachedIoSource_length */
+
+static PHYSFS_sint64 cachedIoSource_fetch(void *opaque, void *buf,
+                                          PHYSFS_uint64 len,
+                                          PHYSFS_uint64 offset)
+{
+    CachedIoSource *src = (CachedIoSource *) opaque;
+    PHYSFS_Io *io = src->io;
+    const int locked = !__PHYSFS_ioHasReadAt(io);  /* readAt() is safe. */
+    int ok;
+
+    if (locked)
+        __PHYSFS_platformGrabMutex(src->lock);
+    ok = __PHYSFS_readAllAt(io, buf, (size_t) len, offset);
+    if (locked)
+        __PHYSFS_platformReleaseMutex(src->lock);
+
+    return ok ? (PHYSFS_sint64) len : -1;
+} /* cachedIoSource_fetch */
+
+static void cachedIoSource_destroy(void *opaque)
+{
+    CachedIoSource *src = (CachedIoSource *) opaque;
+    src->io->destroy(src->io);
+    __PHYSFS_platformDestroyMutex(src->lock);
+    allocator.Free(src);
+} /* cachedIoSource_destroy */
+
+
+PHYSFS_Io *PHYSFS_createCachedIo(PHYSFS_Io *io, PHYSFS_uint32 blockSize,
+                                 PHYSFS_uint32 cacheBlocks)
+{
+    PHYSFS_RangeSource rangesrc;
+    CachedIoSource *src = NULL;
+    PHYSFS_Io *retval = NULL;
+
+    BAIL_IF(!io, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(io->version > CURRENT_PHYSFS_IO_API_VERSION,
+            PHYSFS_ERR_UNSUPPORTED, NULL);
+
+    src = (CachedIoSource *) allocator.Malloc(sizeof (CachedIoSource));
+    BAIL_IF(!src, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    src->io = io;
+    src->lock = __PHYSFS_platformCreateMutex();
+    if (!src->lock)
+    {
+        allocator.Free(src);
+        return NULL;
+    } /* if */
+
+    memset(&rangesrc, '\0', sizeof (rangesrc));
+    rangesrc.version = 0;
+    rangesrc.opaque = src;
+    rangesrc.length = cachedIoSource_length;
+    rangesrc.fetch = cachedIoSource_fetch;
+    rangesrc.destroy = cachedIoSource_destroy;
+
+    retval = PHYSFS_createRangeIo(&rangesrc, blockSize, cacheBlocks, NULL);
+    if (!retval)  /* (io) is still the caller's; don't destroy it. */
+    {
+        __PHYSFS_platformDestroyMutex(src->lock);
+        allocator.Free(src);
+    } /* if */
+
+    return retval;
+} /* PHYSFS_createCachedIo */
+
+/* end of physfs_rangeio.c ... */
+
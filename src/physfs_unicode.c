@@ -35,6 +35,109 @@
  */
 #define UNICODE_BOGUS_CHAR_CODEPOINT '?'
 
+
+/*
+ * Most strings we see (paths, file extensions) are all or nearly all
+ *  low-ASCII, and those bytes don't need decoding or the case folding
+ *  tables. Where the CPU has 16-byte vectors that every build can count on
+ *  (SSE2 on x86-64, NEON on 64-bit ARM), we check, fold and compare ASCII a
+ *  block at a time, and drop to the codepoint-at-a-time path at the first
+ *  byte with the high bit set.
+ *
+ * A block is only loaded when the caller knows there are that many bytes
+ *  left before the string's null terminator (from strlen(), which the C
+ *  runtime does quickly), so nothing past the end of the string is read,
+ *  and sanitizers and memory checkers have nothing to complain about.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define PHYSFS_HAVE_UTF8_SSE2 1
+#include <emmintrin.h>
+#elif (defined(__aarch64__) || defined(_M_ARM64)) && !defined(__ARM_BIG_ENDIAN)
+#define PHYSFS_HAVE_UTF8_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define UTF8_BLOCK 16
+
+#if PHYSFS_HAVE_UTF8_SSE2 || PHYSFS_HAVE_UTF8_NEON
+#define PHYSFS_HAVE_UTF8_BLOCKS 1
+
+#if PHYSFS_HAVE_UTF8_SSE2
+/* Is every byte of the block low-ASCII, and not a null terminator? */
+static int utf8BlockAscii(const char *ptr)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i *) ptr);
+    const __m128i nul = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+    return (_mm_movemask_epi8(_mm_or_si128(v, nul)) == 0);
+} /* utf8BlockAscii */
+
+/* Adds 0x20 to 'A' through 'Z'. High-ASCII bytes are negative here. */
+static __m128i utf8FoldSse2(const __m128i v)
+{
+    const __m128i upper = _mm_and_si128(
+                              _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                              _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+} /* utf8FoldSse2 */
+
+/* Are both blocks low-ASCII, with no terminator, and equal once folded? */
+static int utf8BlockFoldEqual(const char *a, const char *b)
+{
+    const __m128i va = _mm_loadu_si128((const __m128i *) a);
+    const __m128i vb = _mm_loadu_si128((const __m128i *) b);
+    const __m128i nul = _mm_cmpeq_epi8(va, _mm_setzero_si128());
+    const __m128i eq = _mm_cmpeq_epi8(utf8FoldSse2(va), utf8FoldSse2(vb));
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(va, vb), nul)) != 0)
+        return 0;
+    return (_mm_movemask_epi8(eq) == 0xFFFF);
+} /* utf8BlockFoldEqual */
+
+/* (src) must have passed utf8BlockAscii(). */
+static void utf8BlockFold(const char *src, char *dst)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i *) src);
+    _mm_storeu_si128((__m128i *) dst, utf8FoldSse2(v));
+} /* utf8BlockFold */
+
+#elif PHYSFS_HAVE_UTF8_NEON
+static int utf8BlockAscii(const char *ptr)
+{
+    const uint8x16_t v = vld1q_u8((const PHYSFS_uint8 *) ptr);
+    return ((vmaxvq_u8(v) < 0x80) && (vminvq_u8(v) != 0));
+} /* utf8BlockAscii */
+
+static uint8x16_t utf8FoldNeon(const uint8x16_t v)
+{
+    const uint8x16_t upper = vandq_u8(vcgeq_u8(v, vdupq_n_u8('A')),
+                                      vcleq_u8(v, vdupq_n_u8('Z')));
+    return vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20)));
+} /* utf8FoldNeon */
+
+static int utf8BlockFoldEqual(const char *a, const char *b)
+{
+    const uint8x16_t va = vld1q_u8((const PHYSFS_uint8 *) a);
+    const uint8x16_t vb = vld1q_u8((const PHYSFS_uint8 *) b);
+    if ((vmaxvq_u8(vorrq_u8(va, vb)) >= 0x80) || (vminvq_u8(va) == 0))
+        return 0;
+    return (vminvq_u8(vceqq_u8(utf8FoldNeon(va), utf8FoldNeon(vb))) == 0xFF);
+} /* utf8BlockFoldEqual */
+
+static void utf8BlockFold(const char *src, char *dst)
+{
+    const uint8x16_t v = vld1q_u8((const PHYSFS_uint8 *) src);
+    vst1q_u8((PHYSFS_uint8 *) dst, utf8FoldNeon(v));
+} /* utf8BlockFold */
+#endif
+#endif  /* PHYSFS_HAVE_UTF8_BLOCKS */
+
+
+/* PHYSFS_caseFold() for a low-ASCII codepoint, without any table lookups. */
+static inline PHYSFS_uint32 asciiFold(const PHYSFS_uint32 ch)
+{
+    return ((ch >= 'A') && (ch <= 'Z')) ? (ch + ('a' - 'A')) : ch;
+} /* asciiFold */
+
 static PHYSFS_uint32 utf8codepoint(const char **_str)
 {
     const char *str = *_str;
@@ -546,9 +649,64 @@ int PHYSFS_caseFold(const PHYSFS_uint32 from, PHYSFS_uint32 *to)
     } \
     return 0
 
-int PHYSFS_utf8stricmp(const char *str1, const char *str2)
+static int utf8stricmpSlow(const char *str1, const char *str2)
 {
     UTFSTRICMP(8);
+} /* utf8stricmpSlow */
+
+int PHYSFS_utf8stricmp(const char *str1, const char *str2)
+{
+    #if PHYSFS_HAVE_UTF8_BLOCKS
+    /* both strings have at least this many bytes left before their ends. */
+    size_t avail = strlen(str1);
+    const size_t len2 = strlen(str2);
+    if (len2 < avail)
+        avail = len2;
+    #endif
+
+    /* settle the low-ASCII prefix here; the table walk only gets the rest. */
+    while (1)
+    {
+        int i;
+
+        #if PHYSFS_HAVE_UTF8_BLOCKS
+        if ((avail >= UTF8_BLOCK) && (utf8BlockFoldEqual(str1, str2)))
+        {
+            str1 += UTF8_BLOCK;
+            str2 += UTF8_BLOCK;
+            avail -= UTF8_BLOCK;
+            continue;
+        } /* if */
+        #endif
+
+        for (i = 0; i < UTF8_BLOCK; i++)
+        {
+            const PHYSFS_uint32 ch1 = (PHYSFS_uint32) ((PHYSFS_uint8) *str1);
+            const PHYSFS_uint32 ch2 = (PHYSFS_uint32) ((PHYSFS_uint8) *str2);
+            PHYSFS_uint32 cp1, cp2;
+
+            /* high-ASCII can fold to low-ASCII (KELVIN SIGN is a 'k'). */
+            if ((ch1 | ch2) & 0x80)
+                return utf8stricmpSlow(str1, str2);
+
+            cp1 = asciiFold(ch1);
+            cp2 = asciiFold(ch2);
+            if (cp1 < cp2)
+                return -1;
+            else if (cp1 > cp2)
+                return 1;
+            else if (cp1 == 0)
+                return 0;  /* complete match. */
+
+            str1++;
+            str2++;
+            #if PHYSFS_HAVE_UTF8_BLOCKS
+            avail--;  /* both bytes were non-null, so this can't wrap. */
+            #endif
+        } /* for */
+    } /* while */
+
+    return 0;  /* shouldn't hit this. */
 } /* PHYSFS_utf8stricmp */
 
 int PHYSFS_utf16stricmp(const PHYSFS_uint16 *str1, const PHYSFS_uint16 *str2)
@@ -563,5 +721,122 @@ int PHYSFS_ucs4stricmp(const PHYSFS_uint32 *str1, const PHYSFS_uint32 *str2)
 
 #undef UTFSTRICMP
 
+
+PHYSFS_uint32 PHYSFS_utf8HashFolded(const char *str)
+{
+    PHYSFS_uint32 hash = 5381;
+    PHYSFS_uint32 ch;
+
+    while ((ch = (PHYSFS_uint32) ((PHYSFS_uint8) *str)) != 0)
+    {
+        if (ch < 0x80)  /* no tables needed. */
+        {
+            hash = ((hash << 5) + hash) ^ asciiFold(ch);
+            str++;
+        } /* if */
+        else
+        {
+            PHYSFS_uint32 folded[3];
+            const int count = PHYSFS_caseFold(utf8codepoint(&str), folded);
+            int i;
+            for (i = 0; i < count; i++)
+                hash = ((hash << 5) + hash) ^ folded[i];
+        } /* else */
+    } /* while */
+
+    return hash;
+} /* PHYSFS_utf8HashFolded */
+
+
+void PHYSFS_utf8FoldCase(const char *src, char *dst, PHYSFS_uint64 len)
+{
+    #if PHYSFS_HAVE_UTF8_BLOCKS
+    const char *end;
+    #endif
+
+    if (len == 0)
+        return;
+
+    #if PHYSFS_HAVE_UTF8_BLOCKS
+    end = src + strlen(src);
+    #endif
+
+    len--;
+    while (len)
+    {
+        PHYSFS_uint32 ch;
+
+        #if PHYSFS_HAVE_UTF8_BLOCKS
+        if ((len >= UTF8_BLOCK) && ((end - src) >= UTF8_BLOCK) &&
+            (utf8BlockAscii(src)))
+        {
+            utf8BlockFold(src, dst);
+            src += UTF8_BLOCK;
+            dst += UTF8_BLOCK;
+            len -= UTF8_BLOCK;
+            continue;
+        } /* if */
+        #endif
+
+        ch = (PHYSFS_uint32) ((PHYSFS_uint8) *src);
+        if (ch == 0)
+            break;
+        else if (ch < 0x80)
+        {
+            *(dst++) = (char) asciiFold(ch);
+            src++;
+            len--;
+        } /* else if */
+        else
+        {
+            PHYSFS_uint32 folded[3];
+            const int count = PHYSFS_caseFold(utf8codepoint(&src), folded);
+            int i;
+            for (i = 0; i < count; i++)
+                utf8fromcodepoint(folded[i], &dst, &len);
+        } /* else */
+    } /* while */
+
+    *dst = '\0';
+} /* PHYSFS_utf8FoldCase */
+
+
+int PHYSFS_utf8IsValid(const char *str)
+{
+    #if PHYSFS_HAVE_UTF8_BLOCKS
+    const char *end = str + strlen(str);
+    #endif
+
+    while (1)
+    {
+        PHYSFS_uint32 cp;
+
+        #if PHYSFS_HAVE_UTF8_BLOCKS
+        if (((end - str) >= UTF8_BLOCK) && (utf8BlockAscii(str)))
+        {
+            str += UTF8_BLOCK;
+            continue;
+        } /* if */
+        #endif
+
+        cp = (PHYSFS_uint32) ((PHYSFS_uint8) *str);
+        if (cp == 0)
+            return 1;
+        else if (cp < 0x80)
+        {
+            str++;
+            continue;
+        } /* else if */
+
+        /* utf8codepoint() only catches some of the UTF-16 surrogates. */
+        cp = utf8codepoint(&str);
+        if ((cp == UNICODE_BOGUS_CHAR_VALUE) ||
+            ((cp >= 0xD800) && (cp <= 0xDFFF)))
+            return 0;
+    } /* while */
+
+    return 0;  /* shouldn't hit this. */
+} /* PHYSFS_utf8IsValid */
+
 /* end of physfs_unicode.c ... */
 
@@ -0,0 +1,1374 @@
+/**
+ * Benchmark program for PhysicsFS.
+ *
+ * This builds synthetic archives of every kind it knows how to write, then
+ *  times mounting, lookups, reading, seeking, enumerating and reading from
+ *  several threads at once, and prints the results as JSON on stdout, so
+ *  they can be compared between builds and releases. Progress goes to
+ *  stderr.
+ *
+ * Run it with --help for options.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+#include "physfs.h"
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_LOOKUP_ARCHIVES 16
+#define BENCH_LOOKUP_ENTRIES 100
+#define BENCH_SEQ_CHUNK (64 * 1024)
+#define BENCH_RANDOM_CHUNK 4096
+#define BENCH_NS_PER_SEC 1000000000.0
+
+typedef enum
+{
+    ARC_ZIP_STORED,
+    ARC_ZIP_DEFLATE,
+    ARC_7Z_SOLID,
+    ARC_7Z_NONSOLID,
+    ARC_GRP,
+    ARC_ISO9660,
+    ARC_DIR
+} ArchiveKind;
+
+typedef struct
+{
+    const char *name;  /* what the JSON calls it. */
+    const char *ext;  /* file extension, or NULL for a directory. */
+    ArchiveKind kind;
+} BenchArchiver;
+
+static const BenchArchiver archivers[] =
+{
+    { "zip-stored", "zip", ARC_ZIP_STORED },
+    { "zip-deflate", "zip", ARC_ZIP_DEFLATE },
+    { "7z-solid", "7z", ARC_7Z_SOLID },
+    { "7z-nonsolid", "7z", ARC_7Z_NONSOLID },
+    { "grp", "grp", ARC_GRP },
+    { "iso9660", "iso", ARC_ISO9660 },
+    { "dir", NULL, ARC_DIR }
+};
+
+typedef struct
+{
+    char name[16];  /* 8.3, so every format can hold it. */
+    PHYSFS_uint32 size;
+    PHYSFS_uint32 seed;  /* to regenerate its contents. */
+} BenchFile;
+
+typedef struct
+{
+    PHYSFS_uint8 *data;
+    size_t len;
+    size_t alloc;
+} Buffer;
+
+/* options... */
+static int quick = 0;
+static int keep = 0;
+static const char *only = NULL;
+static int max_threads = BENCH_MAX_THREADS;
+
+/* what we've made in the write dir, to delete when we're done. */
+static char **created = NULL;
+static size_t created_count = 0;
+
+static char *workdir = NULL;  /* write dir, with a trailing separator. */
+static int results_written = 0;
+
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "physfs_bench: %s failed: %s\n", what,
+            PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+    exit(1);
+} /* fail */
+
+
+static void *xmalloc(size_t len)
+{
+    void *retval = malloc(len ? len : 1);
+    if (retval == NULL)
+    {
+        fprintf(stderr, "physfs_bench: out of memory\n");
+        exit(1);
+    } /* if */
+    return retval;
+} /* xmalloc */
+
+
+static PHYSFS_uint64 now_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (PHYSFS_uint64) ((count.QuadPart / freq.QuadPart) * 1000000000) +
+           (PHYSFS_uint64) (((count.QuadPart % freq.QuadPart) * 1000000000)
+                              / freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((PHYSFS_uint64) ts.tv_sec) * 1000000000) + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((PHYSFS_uint64) tv.tv_sec) * 1000000000) + (tv.tv_usec * 1000);
+#endif
+} /* now_ns */
+
+
+/* xorshift32: quick, and the same everywhere, so archives are too. */
+static PHYSFS_uint32 rng(PHYSFS_uint32 *state)
+{
+    PHYSFS_uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+} /* rng */
+
+
+/* Buffer stuff... */
+
+static void buf_reserve(Buffer *buf, size_t len)
+{
+    if (buf->len + len > buf->alloc)
+    {
+        size_t newalloc = buf->alloc ? buf->alloc : 4096;
+        PHYSFS_uint8 *ptr;
+        while (newalloc < buf->len + len)
+            newalloc *= 2;
+        ptr = (PHYSFS_uint8 *) realloc(buf->data, newalloc);
+        if (ptr == NULL)
+        {
+            fprintf(stderr, "physfs_bench: out of memory\n");
+            exit(1);
+        } /* if */
+        buf->data = ptr;
+        buf->alloc = newalloc;
+    } /* if */
+} /* buf_reserve */
+
+static void buf_append(Buffer *buf, const void *data, size_t len)
+{
+    buf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+} /* buf_append */
+
+static void buf_zero(Buffer *buf, size_t len)
+{
+    buf_reserve(buf, len);
+    memset(buf->data + buf->len, '\0', len);
+    buf->len += len;
+} /* buf_zero */
+
+static void buf_u8(Buffer *buf, PHYSFS_uint32 val)
+{
+    const PHYSFS_uint8 b = (PHYSFS_uint8) val;
+    buf_append(buf, &b, 1);
+} /* buf_u8 */
+
+static void buf_u16(Buffer *buf, PHYSFS_uint32 val)
+{
+    buf_u8(buf, val & 0xFF);
+    buf_u8(buf, (val >> 8) & 0xFF);
+} /* buf_u16 */
+
+static void buf_u32(Buffer *buf, PHYSFS_uint32 val)
+{
+    buf_u16(buf, val & 0xFFFF);
+    buf_u16(buf, (val >> 16) & 0xFFFF);
+} /* buf_u32 */
+
+static void buf_u32be(Buffer *buf, PHYSFS_uint32 val)
+{
+    buf_u8(buf, (val >> 24) & 0xFF);
+    buf_u8(buf, (val >> 16) & 0xFF);
+    buf_u8(buf, (val >> 8) & 0xFF);
+    buf_u8(buf, val & 0xFF);
+} /* buf_u32be */
+
+static void buf_free(Buffer *buf)
+{
+    free(buf->data);
+    memset(buf, '\0', sizeof (*buf));
+} /* buf_free */
+
+static void put_u32(PHYSFS_uint8 *ptr, PHYSFS_uint32 val)
+{
+    ptr[0] = (PHYSFS_uint8) (val & 0xFF);
+    ptr[1] = (PHYSFS_uint8) ((val >> 8) & 0xFF);
+    ptr[2] = (PHYSFS_uint8) ((val >> 16) & 0xFF);
+    ptr[3] = (PHYSFS_uint8) ((val >> 24) & 0xFF);
+} /* put_u32 */
+
+
+static PHYSFS_uint32 crc32(PHYSFS_uint32 crc, const PHYSFS_uint8 *buf,
+                           size_t len)
+{
+    static PHYSFS_uint32 table[256];
+    size_t i;
+
+    if (table[1] == 0)
+    {
+        PHYSFS_uint32 j, k;
+        for (j = 0; j < 256; j++)
+        {
+            PHYSFS_uint32 val = j;
+            for (k = 0; k < 8; k++)
+                val = (val & 1) ? (0xEDB88320 ^ (val >> 1)) : (val >> 1);
+            table[j] = val;
+        } /* for */
+    } /* if */
+
+    crc = ~crc;
+    for (i = 0; i < len; i++)
+        crc = table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+} /* crc32 */
+
+
+/* Game data isn't random noise; make text that compresses a few times over. */
+static void make_contents(const BenchFile *file, PHYSFS_uint8 *out)
+{
+    static const char *words[] = {
+        "actor", "bone", "cube", "decal", "entity", "frame", "glyph",
+        "height", "index", "joint", "key", "light", "mesh", "normal",
+        "origin", "portal", "quad", "ray", "shader", "texture", "uv",
+        "vertex", "weight", "x", "yaw", "z", "0", "1", "255", "-1.5"
+    };
+    PHYSFS_uint32 state = file->seed | 1;
+    PHYSFS_uint32 i = 0;
+
+    while (i < file->size)
+    {
+        const PHYSFS_uint32 r = rng(&state);
+        const char *word = words[r % (sizeof (words) / sizeof (words[0]))];
+        while ((*word) && (i < file->size))
+            out[i++] = (PHYSFS_uint8) *(word++);
+        if (i < file->size)
+            out[i++] = ((r >> 16) % 8) ? ' ' : '\n';
+    } /* while */
+} /* make_contents */
+
+
+/*
+ * A small deflate encoder: greedy LZ77 with the fixed Huffman codes. It
+ *  doesn't compress as well as zlib, but it makes real compressed data, so
+ *  reads of it cost about what they would in a shipped game.
+ */
+
+typedef struct
+{
+    Buffer *out;
+    PHYSFS_uint32 bits;
+    int nbits;
+} BitWriter;
+
+static void put_bits(BitWriter *bw, PHYSFS_uint32 val, int count)
+{
+    bw->bits |= val << bw->nbits;
+    bw->nbits += count;
+    while (bw->nbits >= 8)
+    {
+        buf_u8(bw->out, bw->bits & 0xFF);
+        bw->bits >>= 8;
+        bw->nbits -= 8;
+    } /* while */
+} /* put_bits */
+
+/* Huffman codes go out most significant bit first. */
+static void put_code(BitWriter *bw, PHYSFS_uint32 code, int count)
+{
+    PHYSFS_uint32 rev = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        rev |= ((code >> i) & 1) << (count - 1 - i);
+    put_bits(bw, rev, count);
+} /* put_code */
+
+static void put_symbol(BitWriter *bw, int sym)
+{
+    if (sym <= 143)
+        put_code(bw, 0x30 + sym, 8);
+    else if (sym <= 255)
+        put_code(bw, 0x190 + (sym - 144), 9);
+    else if (sym <= 279)
+        put_code(bw, sym - 256, 7);
+    else
+        put_code(bw, 0xC0 + (sym - 280), 8);
+} /* put_symbol */
+
+static void put_match(BitWriter *bw, int len, int dist)
+{
+    static const int lenbase[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43,
+        51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const int lenextra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4,
+        4, 4, 5, 5, 5, 5, 0
+    };
+    static const int distbase[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257,
+        385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+        16385, 24577
+    };
+    static const int distextra[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,
+        10, 10, 11, 11, 12, 12, 13, 13
+    };
+    int i;
+
+    for (i = 28; lenbase[i] > len; i--) {}
+    put_symbol(bw, 257 + i);
+    put_bits(bw, (PHYSFS_uint32) (len - lenbase[i]), lenextra[i]);
+
+    for (i = 29; distbase[i] > dist; i--) {}
+    put_code(bw, (PHYSFS_uint32) i, 5);
+    put_bits(bw, (PHYSFS_uint32) (dist - distbase[i]), distextra[i]);
+} /* put_match */
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 16
+
+static void deflate_fixed(const PHYSFS_uint8 *src, size_t len, Buffer *out)
+{
+    int *head = (int *) xmalloc(sizeof (int) << DEFLATE_HASH_BITS);
+    int *prev = (int *) xmalloc(sizeof (int) * DEFLATE_WINDOW);
+    BitWriter bw;
+    size_t pos = 0;
+    size_t i;
+
+    for (i = 0; i < (1 << DEFLATE_HASH_BITS); i++)
+        head[i] = -1;
+
+    bw.out = out;
+    bw.bits = 0;
+    bw.nbits = 0;
+    put_bits(&bw, 1, 1);  /* BFINAL */
+    put_bits(&bw, 1, 2);  /* BTYPE=01, fixed Huffman codes. */
+
+    while (pos < len)
+    {
+        int bestlen = 0;
+        int bestdist = 0;
+
+        if (pos + 3 <= len)
+        {
+            const PHYSFS_uint32 h = ((src[pos] << 10) ^ (src[pos+1] << 5) ^
+                                     src[pos+2]) &
+                                    ((1 << DEFLATE_HASH_BITS) - 1);
+            const size_t maxlen = ((len - pos) < 258) ? (len - pos) : 258;
+            int cand = head[h];
+            int chain = DEFLATE_MAX_CHAIN;
+
+            while ((cand >= 0) && (chain-- > 0) &&
+                   (pos - (size_t) cand <= DEFLATE_WINDOW))
+            {
+                size_t n = 0;
+                while ((n < maxlen) && (src[cand + n] == src[pos + n]))
+                    n++;
+                if ((int) n > bestlen)
+                {
+                    bestlen = (int) n;
+                    bestdist = (int) (pos - (size_t) cand);
+                } /* if */
+                cand = prev[cand % DEFLATE_WINDOW];
+            } /* while */
+
+            prev[pos % DEFLATE_WINDOW] = head[h];
+            head[h] = (int) pos;
+        } /* if */
+
+        if (bestlen >= 3)
+        {
+            const size_t end = pos + bestlen;
+            put_match(&bw, bestlen, bestdist);
+            for (pos++; pos < end; pos++)  /* hash what we skipped. */
+            {
+                if (pos + 3 <= len)
+                {
+                    const PHYSFS_uint32 h = ((src[pos] << 10) ^
+                                             (src[pos+1] << 5) ^ src[pos+2]) &
+                                            ((1 << DEFLATE_HASH_BITS) - 1);
+                    prev[pos % DEFLATE_WINDOW] = head[h];
+                    head[h] = (int) pos;
+                } /* if */
+            } /* for */
+        } /* if */
+        else
+        {
+            put_symbol(&bw, src[pos]);
+            pos++;
+        } /* else */
+    } /* while */
+
+    put_symbol(&bw, 256);  /* end of block. */
+    if (bw.nbits > 0)
+        put_bits(&bw, 0, 8 - bw.nbits);
+
+    free(prev);
+    free(head);
+} /* deflate_fixed */
+
+
+/* archive writers... */
+
+static void build_zip(const BenchFile *files, size_t count, int deflate,
+                      Buffer *out)
+{
+    PHYSFS_uint32 *offsets = (PHYSFS_uint32 *) xmalloc(count * 4);
+    PHYSFS_uint32 *crcs = (PHYSFS_uint32 *) xmalloc(count * 4);
+    PHYSFS_uint32 *csizes = (PHYSFS_uint32 *) xmalloc(count * 4);
+    Buffer comp;
+    size_t cdstart;
+    size_t cdlen;
+    size_t i;
+
+    memset(&comp, '\0', sizeof (comp));
+
+    for (i = 0; i < count; i++)
+    {
+        const BenchFile *f = &files[i];
+        const PHYSFS_uint32 namelen = (PHYSFS_uint32) strlen(f->name);
+        PHYSFS_uint8 *data = (PHYSFS_uint8 *) xmalloc(f->size);
+        const PHYSFS_uint8 *payload = data;
+        size_t payloadlen = f->size;
+
+        make_contents(f, data);
+        crcs[i] = crc32(0, data, f->size);
+        if (deflate)
+        {
+            comp.len = 0;
+            deflate_fixed(data, f->size, &comp);
+            payload = comp.data;
+            payloadlen = comp.len;
+        } /* if */
+
+        offsets[i] = (PHYSFS_uint32) out->len;
+        csizes[i] = (PHYSFS_uint32) payloadlen;
+        buf_u32(out, 0x04034b50);
+        buf_u16(out, 20);  /* version needed */
+        buf_u16(out, 0);  /* flags */
+        buf_u16(out, deflate ? 8 : 0);
+        buf_u16(out, 0);  /* time */
+        buf_u16(out, 0x21);  /* date: Jan 1st, 1980. */
+        buf_u32(out, crcs[i]);
+        buf_u32(out, csizes[i]);
+        buf_u32(out, f->size);
+        buf_u16(out, namelen);
+        buf_u16(out, 0);  /* extra field length */
+        buf_append(out, f->name, namelen);
+        buf_append(out, payload, payloadlen);
+        free(data);
+    } /* for */
+
+    cdstart = out->len;
+    for (i = 0; i < count; i++)
+    {
+        const BenchFile *f = &files[i];
+        const PHYSFS_uint32 namelen = (PHYSFS_uint32) strlen(f->name);
+        buf_u32(out, 0x02014b50);
+        buf_u16(out, 20);  /* version made by */
+        buf_u16(out, 20);  /* version needed */
+        buf_u16(out, 0);  /* flags */
+        buf_u16(out, deflate ? 8 : 0);
+        buf_u16(out, 0);  /* time */
+        buf_u16(out, 0x21);  /* date */
+        buf_u32(out, crcs[i]);
+        buf_u32(out, csizes[i]);
+        buf_u32(out, f->size);
+        buf_u16(out, namelen);
+        buf_u16(out, 0);  /* extra field length */
+        buf_u16(out, 0);  /* comment length */
+        buf_u16(out, 0);  /* disk number */
+        buf_u16(out, 0);  /* internal attributes */
+        buf_u32(out, 0);  /* external attributes */
+        buf_u32(out, offsets[i]);
+        buf_append(out, f->name, namelen);
+    } /* for */
+
+    cdlen = out->len - cdstart;
+    buf_u32(out, 0x06054b50);
+    buf_u16(out, 0);  /* this disk */
+    buf_u16(out, 0);  /* disk with central dir */
+    buf_u16(out, (PHYSFS_uint32) count);
+    buf_u16(out, (PHYSFS_uint32) count);
+    buf_u32(out, (PHYSFS_uint32) cdlen);
+    buf_u32(out, (PHYSFS_uint32) cdstart);
+    buf_u16(out, 0);  /* comment length */
+
+    buf_free(&comp);
+    free(csizes);
+    free(crcs);
+    free(offsets);
+} /* build_zip */
+
+
+static void sz_number(Buffer *buf, PHYSFS_uint64 val)
+{
+    PHYSFS_uint8 first = 0;
+    PHYSFS_uint8 mask = 0x80;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        if (val < (((PHYSFS_uint64) 1) << (7 * (i + 1))))
+        {
+            first |= (PHYSFS_uint8) (val >> (8 * i));
+            break;
+        } /* if */
+        first |= mask;
+        mask >>= 1;
+    } /* for */
+
+    buf_u8(buf, first);
+    for (; i > 0; i--)
+    {
+        buf_u8(buf, (PHYSFS_uint32) (val & 0xFF));
+        val >>= 8;
+    } /* for */
+} /* sz_number */
+
+/* We can't write LZMA, so these use the "copy" coder. Solid archives still
+   make every read decode (well, copy) a block with many files in it. */
+static void build_7z(const BenchFile *files, size_t count, int solid,
+                     Buffer *out)
+{
+    const size_t folders = solid ? 1 : count;
+    PHYSFS_uint64 total = 0;
+    Buffer hdr;
+    size_t i;
+
+    memset(&hdr, '\0', sizeof (hdr));
+
+    buf_zero(out, 32);  /* signature header, filled in at the end. */
+    for (i = 0; i < count; i++)
+    {
+        buf_reserve(out, files[i].size);
+        make_contents(&files[i], out->data + out->len);
+        out->len += files[i].size;
+        total += files[i].size;
+    } /* for */
+
+    buf_u8(&hdr, 0x01);  /* kHeader */
+    buf_u8(&hdr, 0x04);  /* kMainStreamsInfo */
+
+    buf_u8(&hdr, 0x06);  /* kPackInfo */
+    sz_number(&hdr, 0);  /* pack position */
+    sz_number(&hdr, folders);
+    buf_u8(&hdr, 0x09);  /* kSize */
+    for (i = 0; i < folders; i++)
+        sz_number(&hdr, solid ? total : files[i].size);
+    buf_u8(&hdr, 0x00);  /* kEnd */
+
+    buf_u8(&hdr, 0x07);  /* kUnPackInfo */
+    buf_u8(&hdr, 0x0B);  /* kFolder */
+    sz_number(&hdr, folders);
+    buf_u8(&hdr, 0x00);  /* not external */
+    for (i = 0; i < folders; i++)
+    {
+        sz_number(&hdr, 1);  /* one coder... */
+        buf_u8(&hdr, 0x01);  /* ...simple, with a one-byte id... */
+        buf_u8(&hdr, 0x00);  /* ...that's "copy". */
+    } /* for */
+    buf_u8(&hdr, 0x0C);  /* kCodersUnPackSize */
+    for (i = 0; i < folders; i++)
+        sz_number(&hdr, solid ? total : files[i].size);
+    buf_u8(&hdr, 0x00);  /* kEnd */
+
+    if (solid)
+    {
+        buf_u8(&hdr, 0x08);  /* kSubStreamsInfo */
+        buf_u8(&hdr, 0x0D);  /* kNumUnPackStream */
+        sz_number(&hdr, count);
+        buf_u8(&hdr, 0x09);  /* kSize, all but the last one. */
+        for (i = 0; i + 1 < count; i++)
+            sz_number(&hdr, files[i].size);
+        buf_u8(&hdr, 0x00);  /* kEnd */
+    } /* if */
+
+    buf_u8(&hdr, 0x00);  /* kEnd of kMainStreamsInfo */
+
+    buf_u8(&hdr, 0x05);  /* kFilesInfo */
+    sz_number(&hdr, count);
+    {
+        size_t nameslen = 1;
+        for (i = 0; i < count; i++)
+            nameslen += (strlen(files[i].name) + 1) * 2;
+        buf_u8(&hdr, 0x11);  /* kName */
+        sz_number(&hdr, nameslen);
+        buf_u8(&hdr, 0x00);  /* not external */
+        for (i = 0; i < count; i++)
+        {
+            const char *ptr = files[i].name;
+            do
+            {
+                buf_u16(&hdr, (PHYSFS_uint8) *ptr);  /* ASCII to UTF-16LE. */
+            } while (*(ptr++));
+        } /* for */
+    }
+    buf_u8(&hdr, 0x00);  /* kEnd of kFilesInfo */
+    buf_u8(&hdr, 0x00);  /* kEnd of kHeader */
+
+    {
+        static const PHYSFS_uint8 sig[] = {
+            '7', 'z', 0xBC, 0xAF, 0x27, 0x1C, 0, 4
+        };
+        PHYSFS_uint8 *ptr = out->data;
+        const PHYSFS_uint64 hdroffset = out->len - 32;
+
+        memcpy(ptr, sig, sizeof (sig));
+        put_u32(ptr + 12, (PHYSFS_uint32) (hdroffset & 0xFFFFFFFF));
+        put_u32(ptr + 16, (PHYSFS_uint32) (hdroffset >> 32));
+        put_u32(ptr + 20, (PHYSFS_uint32) hdr.len);
+        put_u32(ptr + 24, 0);
+        put_u32(ptr + 28, crc32(0, hdr.data, hdr.len));
+        put_u32(ptr + 8, crc32(0, ptr + 12, 20));
+    }
+
+    buf_append(out, hdr.data, hdr.len);
+    buf_free(&hdr);
+} /* build_7z */
+
+
+static void build_grp(const BenchFile *files, size_t count, Buffer *out)
+{
+    size_t i;
+
+    buf_append(out, "KenSilverman", 12);
+    buf_u32(out, (PHYSFS_uint32) count);
+    for (i = 0; i < count; i++)
+    {
+        char name[12];
+        memset(name, ' ', sizeof (name));
+        memcpy(name, files[i].name, strlen(files[i].name));
+        buf_append(out, name, sizeof (name));
+        buf_u32(out, files[i].size);
+    } /* for */
+
+    for (i = 0; i < count; i++)
+    {
+        buf_reserve(out, files[i].size);
+        make_contents(&files[i], out->data + out->len);
+        out->len += files[i].size;
+    } /* for */
+} /* build_grp */
+
+
+static void iso_both32(Buffer *buf, PHYSFS_uint32 val)
+{
+    buf_u32(buf, val);
+    buf_u32be(buf, val);
+} /* iso_both32 */
+
+static void iso_dirent(Buffer *buf, const char *name, size_t namelen,
+                       PHYSFS_uint32 sector, PHYSFS_uint32 len, int isdir)
+{
+    const size_t reclen = 33 + namelen + ((namelen % 2) ? 0 : 1);
+    buf_u8(buf, (PHYSFS_uint32) reclen);
+    buf_u8(buf, 0);  /* extended attribute record length */
+    iso_both32(buf, sector);
+    iso_both32(buf, len);
+    buf_u8(buf, 120);  /* 2020... */
+    buf_u8(buf, 1);  /* ...January... */
+    buf_u8(buf, 1);  /* ...1st, midnight. */
+    buf_zero(buf, 4);  /* hour, minute, second, GMT offset */
+    buf_u8(buf, isdir ? 2 : 0);
+    buf_zero(buf, 2);  /* file unit size, interleave gap */
+    buf_u16(buf, 1);  /* volume sequence number, both-endian */
+    buf_u8(buf, 0);
+    buf_u8(buf, 1);
+    buf_u8(buf, (PHYSFS_uint32) namelen);
+    buf_append(buf, name, namelen);
+    if ((namelen % 2) == 0)
+        buf_u8(buf, 0);
+} /* iso_dirent */
+
+static size_t iso_dirent_len(size_t namelen)
+{
+    return 33 + namelen + ((namelen % 2) ? 0 : 1);
+} /* iso_dirent_len */
+
+static void build_iso(const BenchFile *files, size_t count, Buffer *out)
+{
+    const PHYSFS_uint32 rootsector = 18;
+    PHYSFS_uint32 rootsectors = 1;
+    PHYSFS_uint32 sector;
+    PHYSFS_uint32 total;
+    size_t pos = 0;
+    size_t i;
+    Buffer dir;
+
+    memset(&dir, '\0', sizeof (dir));
+
+    /* see how many sectors the root directory needs. */
+    for (i = 0; i < count; i++)
+    {
+        const size_t reclen = iso_dirent_len(strlen(files[i].name) + 2);
+        if ((pos % 2048) + reclen > 2048)
+        {
+            pos = ((pos / 2048) + 1) * 2048;
+            rootsectors++;
+        } /* if */
+        pos += reclen;
+    } /* for */
+    if ((pos % 2048) == 0 && (pos > 0))
+        rootsectors++;  /* PhysicsFS wants a zero byte to end the list. */
+
+    /* then write it, with the file data after it. */
+    sector = rootsector + rootsectors;
+    for (i = 0; i < count; i++)
+    {
+        char name[20];
+        const size_t namelen = (size_t) sprintf(name, "%s;1", files[i].name);
+        const size_t reclen = iso_dirent_len(namelen);
+        if ((dir.len % 2048) + reclen > 2048)
+            buf_zero(&dir, 2048 - (dir.len % 2048));
+        iso_dirent(&dir, name, namelen, sector, files[i].size, 0);
+        sector += (files[i].size + 2047) / 2048;
+    } /* for */
+    buf_zero(&dir, (rootsectors * 2048) - dir.len);
+    total = sector;
+
+    buf_zero(out, 16 * 2048);  /* system area */
+
+    /* primary volume descriptor. */
+    buf_u8(out, 1);
+    buf_append(out, "CD001", 5);
+    buf_u8(out, 1);  /* version */
+    buf_u8(out, 0);
+    buf_append(out, "PHYSFS_BENCH                    ", 32);  /* system */
+    buf_append(out, "BENCH                           ", 32);  /* volume */
+    buf_zero(out, 8);
+    iso_both32(out, total);
+    buf_zero(out, 32);  /* escape sequences */
+    buf_u16(out, 1); buf_u8(out, 0); buf_u8(out, 1);  /* set size */
+    buf_u16(out, 1); buf_u8(out, 0); buf_u8(out, 1);  /* sequence number */
+    buf_u16(out, 2048); buf_u8(out, 2048 >> 8); buf_u8(out, 0);
+    iso_both32(out, 0);  /* path table size; we don't write one. */
+    buf_zero(out, 16);  /* path table locations */
+    iso_dirent(out, "\0", 1, rootsector, rootsectors * 2048, 1);
+    buf_zero(out, (17 * 2048) - out->len);
+    out->data[(16 * 2048) + 881] = 1;  /* file structure version */
+
+    /* volume descriptor set terminator. */
+    buf_u8(out, 255);
+    buf_append(out, "CD001", 5);
+    buf_u8(out, 1);
+    buf_zero(out, 2048 - 7);
+
+    buf_append(out, dir.data, dir.len);
+    buf_free(&dir);
+
+    for (i = 0; i < count; i++)
+    {
+        const size_t padded = ((files[i].size + 2047) / 2048) * 2048;
+        buf_reserve(out, padded);
+        make_contents(&files[i], out->data + out->len);
+        memset(out->data + out->len + files[i].size, '\0',
+               padded - files[i].size);
+        out->len += padded;
+    } /* for */
+} /* build_iso */
+
+
+/* writing into the write dir... */
+
+static void remember(const char *name)
+{
+    created = (char **) realloc(created, sizeof (char *) * (created_count+1));
+    if (created == NULL)
+    {
+        fprintf(stderr, "physfs_bench: out of memory\n");
+        exit(1);
+    } /* if */
+    created[created_count] = (char *) xmalloc(strlen(name) + 1);
+    strcpy(created[created_count++], name);
+} /* remember */
+
+static void write_file(const char *name, const void *data, size_t len)
+{
+    PHYSFS_File *f = PHYSFS_openWrite(name);
+    if (f == NULL)
+        fail(name);
+    remember(name);
+    if (PHYSFS_writeBytes(f, data, len) != (PHYSFS_sint64) len)
+        fail(name);
+    if (!PHYSFS_close(f))
+        fail(name);
+} /* write_file */
+
+/* Make (count) files with the name prefix (set) and this size range. */
+static BenchFile *make_files(PHYSFS_uint32 set, size_t count,
+                             PHYSFS_uint32 minsize, PHYSFS_uint32 maxsize)
+{
+    BenchFile *retval = (BenchFile *) xmalloc(sizeof (BenchFile) * count);
+    PHYSFS_uint32 state = 0x9E3779B9 ^ (set * 7919) ^ (PHYSFS_uint32) count;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        sprintf(retval[i].name, "%02u%06u.dat", (unsigned int) set,
+                (unsigned int) i);
+        retval[i].size = minsize;
+        if (maxsize > minsize)
+            retval[i].size += rng(&state) % (maxsize - minsize);
+        retval[i].seed = rng(&state);
+    } /* for */
+
+    return retval;
+} /* make_files */
+
+/* Write an archive of (files) named (base), and return the path to mount. */
+static char *make_archive(const BenchArchiver *arc, const char *base,
+                          const BenchFile *files, size_t count)
+{
+    char name[64];
+    char *retval;
+    Buffer buf;
+    size_t i;
+
+    memset(&buf, '\0', sizeof (buf));
+
+    if (arc->ext == NULL)
+    {
+        sprintf(name, "%s-%s", arc->name, base);
+        if (!PHYSFS_mkdir(name))
+            fail(name);
+        remember(name);
+        for (i = 0; i < count; i++)
+        {
+            char fname[96];
+            buf.len = 0;
+            buf_reserve(&buf, files[i].size);
+            make_contents(&files[i], buf.data);
+            sprintf(fname, "%s/%s", name, files[i].name);
+            write_file(fname, buf.data, files[i].size);
+        } /* for */
+    } /* if */
+    else
+    {
+        sprintf(name, "%s-%s.%s", arc->name, base, arc->ext);
+        switch (arc->kind)
+        {
+            case ARC_ZIP_STORED: build_zip(files, count, 0, &buf); break;
+            case ARC_ZIP_DEFLATE: build_zip(files, count, 1, &buf); break;
+            case ARC_7Z_SOLID: build_7z(files, count, 1, &buf); break;
+            case ARC_7Z_NONSOLID: build_7z(files, count, 0, &buf); break;
+            case ARC_GRP: build_grp(files, count, &buf); break;
+            case ARC_ISO9660: build_iso(files, count, &buf); break;
+            case ARC_DIR: break;  /* handled above. */
+        } /* switch */
+        write_file(name, buf.data, buf.len);
+    } /* else */
+
+    buf_free(&buf);
+
+    retval = (char *) xmalloc(strlen(workdir) + strlen(name) + 1);
+    strcpy(retval, workdir);
+    strcat(retval, name);
+    return retval;
+} /* make_archive */
+
+static void cleanup(void)
+{
+    while (created_count > 0)  /* newest first, so dirs are empty. */
+    {
+        char *name = created[--created_count];
+        if (!keep)
+            PHYSFS_delete(name);
+        free(name);
+    } /* while */
+    free(created);
+    created = NULL;
+} /* cleanup */
+
+
+/* output... */
+
+static void result(const BenchArchiver *arc, const char *test,
+                   const char *fmt, ...)
+{
+    va_list ap;
+    printf("%s\n    { \"archiver\": \"%s\", \"test\": \"%s\"",
+           results_written++ ? "," : "", arc->name, test);
+    if (fmt != NULL)
+    {
+        printf(", ");
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+    } /* if */
+    printf(" }");
+    fflush(stdout);
+} /* result */
+
+
+/* the benchmarks... */
+
+static void must_mount(const char *path)
+{
+    if (!PHYSFS_mount(path, NULL, 1))
+        fail(path);
+} /* must_mount */
+
+static void must_unmount(const char *path)
+{
+    if (!PHYSFS_unmount(path))
+        fail(path);
+} /* must_unmount */
+
+static void bench_mount(const BenchArchiver *arc, const char *path,
+                        size_t count)
+{
+    PHYSFS_uint64 best_mount = (PHYSFS_uint64) -1;
+    PHYSFS_uint64 best_enum = (PHYSFS_uint64) -1;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        PHYSFS_uint64 start = now_ns();
+        PHYSFS_uint64 elapsed;
+        char **list;
+
+        must_mount(path);
+        elapsed = now_ns() - start;
+        if (elapsed < best_mount)
+            best_mount = elapsed;
+
+        start = now_ns();
+        list = PHYSFS_enumerateFiles("/");
+        elapsed = now_ns() - start;
+        if (list == NULL)
+            fail("PHYSFS_enumerateFiles");
+        PHYSFS_freeList(list);
+        if (elapsed < best_enum)
+            best_enum = elapsed;
+
+        must_unmount(path);
+    } /* for */
+
+    result(arc, "mount", "\"entries\": %u, \"ms\": %.3f",
+           (unsigned int) count, best_mount / 1000000.0);
+    result(arc, "enumerate", "\"entries\": %u, \"ms\": %.3f, "
+           "\"ns_per_entry\": %.1f", (unsigned int) count,
+           best_enum / 1000000.0, ((double) best_enum) / count);
+} /* bench_mount */
+
+
+static double time_opens(const char *fname, int iterations)
+{
+    const PHYSFS_uint64 start = now_ns();
+    int i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        PHYSFS_File *f = PHYSFS_openRead(fname);
+        if (f == NULL)
+            fail(fname);
+        PHYSFS_close(f);
+    } /* for */
+
+    return ((double) (now_ns() - start)) / iterations;
+} /* time_opens */
+
+static void bench_lookup(const BenchArchiver *arc)
+{
+    const int iterations = quick ? 500 : 2000;
+    char *paths[BENCH_LOOKUP_ARCHIVES];
+    PHYSFS_uint64 start;
+    double first, last, miss;
+    char name[32];
+    int i;
+
+    for (i = 0; i < BENCH_LOOKUP_ARCHIVES; i++)
+    {
+        BenchFile *files = make_files((PHYSFS_uint32) i, BENCH_LOOKUP_ENTRIES,
+                                      256, 1024);
+        sprintf(name, "lookup%02d", i);
+        paths[i] = make_archive(arc, name, files, BENCH_LOOKUP_ENTRIES);
+        free(files);
+        must_mount(paths[i]);
+    } /* for */
+
+    first = time_opens("00000050.dat", iterations);
+    sprintf(name, "%02d000050.dat", BENCH_LOOKUP_ARCHIVES - 1);
+    last = time_opens(name, iterations);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        if (PHYSFS_exists("nope.dat"))
+            fail("PHYSFS_exists");
+    } /* for */
+    miss = ((double) (now_ns() - start)) / iterations;
+
+    for (i = 0; i < BENCH_LOOKUP_ARCHIVES; i++)
+    {
+        must_unmount(paths[i]);
+        free(paths[i]);
+    } /* for */
+
+    result(arc, "open_first_mount", "\"mounts\": %d, \"ns_per_op\": %.1f",
+           BENCH_LOOKUP_ARCHIVES, first);
+    result(arc, "open_last_mount", "\"mounts\": %d, \"ns_per_op\": %.1f",
+           BENCH_LOOKUP_ARCHIVES, last);
+    result(arc, "exists_miss", "\"mounts\": %d, \"ns_per_op\": %.1f",
+           BENCH_LOOKUP_ARCHIVES, miss);
+} /* bench_lookup */
+
+
+static void bench_read(const BenchArchiver *arc)
+{
+    const PHYSFS_uint32 size = (quick ? 2 : 16) * 1024 * 1024;
+    const PHYSFS_uint64 budget = (quick ? 200 : 1000) * 1000000;  /* ns */
+    const int maxops = quick ? 500 : 5000;
+    PHYSFS_uint8 *buf = (PHYSFS_uint8 *) xmalloc(BENCH_SEQ_CHUNK);
+    PHYSFS_uint64 best = (PHYSFS_uint64) -1;
+    PHYSFS_uint64 start, elapsed;
+    PHYSFS_uint32 state = 12345;
+    BenchFile *files = make_files(0, 1, size, size);
+    char *path = make_archive(arc, "read", files, 1);
+    PHYSFS_File *f;
+    int ops = 0;
+    int i;
+
+    must_mount(path);
+
+    for (i = 0; i < 3; i++)
+    {
+        PHYSFS_sint64 br;
+        f = PHYSFS_openRead(files[0].name);
+        if (f == NULL)
+            fail(files[0].name);
+        start = now_ns();
+        while ((br = PHYSFS_readBytes(f, buf, BENCH_SEQ_CHUNK)) > 0) {}
+        elapsed = now_ns() - start;
+        if (br < 0)
+            fail("PHYSFS_readBytes");
+        PHYSFS_close(f);
+        if (elapsed < best)
+            best = elapsed;
+    } /* for */
+
+    result(arc, "read_sequential", "\"bytes\": %u, \"chunk\": %d, "
+           "\"ms\": %.3f, \"mb_per_sec\": %.1f", (unsigned int) size,
+           BENCH_SEQ_CHUNK, best / 1000000.0,
+           (size / (1024.0 * 1024.0)) / (best / BENCH_NS_PER_SEC));
+
+    /* random seeks eat time for compressed files; stop after (budget). */
+    f = PHYSFS_openRead(files[0].name);
+    if (f == NULL)
+        fail(files[0].name);
+    start = now_ns();
+    do
+    {
+        const PHYSFS_uint32 pos = rng(&state) % (size - BENCH_RANDOM_CHUNK);
+        if (!PHYSFS_seek(f, pos))
+            fail("PHYSFS_seek");
+        if (PHYSFS_readBytes(f, buf, BENCH_RANDOM_CHUNK) != BENCH_RANDOM_CHUNK)
+            fail("PHYSFS_readBytes");
+        ops++;
+        elapsed = now_ns() - start;
+    } while ((ops < maxops) && (elapsed < budget));
+    PHYSFS_close(f);
+
+    result(arc, "read_random", "\"bytes\": %u, \"chunk\": %d, \"ops\": %d, "
+           "\"ms\": %.3f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f",
+           (unsigned int) size, BENCH_RANDOM_CHUNK, ops, elapsed / 1000000.0,
+           ops / (elapsed / BENCH_NS_PER_SEC),
+           ((ops * (double) BENCH_RANDOM_CHUNK) / (1024.0 * 1024.0)) /
+                (elapsed / BENCH_NS_PER_SEC));
+
+    must_unmount(path);
+    free(path);
+    free(files);
+    free(buf);
+} /* bench_read */
+
+
+typedef struct
+{
+    const BenchFile *files;
+    size_t count;
+    int ops;
+    PHYSFS_uint32 seed;
+    int failed;
+} ThreadJob;
+
+static void thread_job(ThreadJob *job)
+{
+    PHYSFS_uint8 buf[4096];
+    PHYSFS_uint32 state = job->seed | 1;
+    int i;
+
+    for (i = 0; i < job->ops; i++)
+    {
+        const BenchFile *file = &job->files[rng(&state) % job->count];
+        PHYSFS_File *f = PHYSFS_openRead(file->name);
+        PHYSFS_sint64 br;
+        PHYSFS_uint64 total = 0;
+
+        if (f == NULL)
+        {
+            job->failed = 1;
+            return;
+        } /* if */
+
+        while ((br = PHYSFS_readBytes(f, buf, sizeof (buf))) > 0)
+            total += (PHYSFS_uint64) br;
+        PHYSFS_close(f);
+
+        if (total != file->size)
+        {
+            job->failed = 1;
+            return;
+        } /* if */
+    } /* for */
+} /* thread_job */
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID arg)
+{
+    thread_job((ThreadJob *) arg);
+    return 0;
+} /* thread_entry */
+#else
+static void *thread_entry(void *arg)
+{
+    thread_job((ThreadJob *) arg);
+    return NULL;
+} /* thread_entry */
+#endif
+
+static void bench_threads(const BenchArchiver *arc, const BenchFile *files,
+                          size_t count, const char *path)
+{
+    const int totalops = quick ? 800 : 4000;
+    double base = 0.0;
+    int threads;
+
+    must_mount(path);
+
+    for (threads = 1; threads <= max_threads; threads *= 2)
+    {
+        ThreadJob jobs[BENCH_MAX_THREADS];
+        PHYSFS_uint64 start, elapsed;
+        double opspersec;
+        int i;
+
+        for (i = 0; i < threads; i++)
+        {
+            jobs[i].files = files;
+            jobs[i].count = count;
+            jobs[i].ops = totalops / threads;
+            jobs[i].seed = 0xC0FFEE + (PHYSFS_uint32) i;
+            jobs[i].failed = 0;
+        } /* for */
+
+        start = now_ns();
+        {
+            #ifdef _WIN32
+            HANDLE handles[BENCH_MAX_THREADS];
+            for (i = 1; i < threads; i++)
+            {
+                handles[i] = CreateThread(NULL, 0, thread_entry, &jobs[i],
+                                          0, NULL);
+                if (handles[i] == NULL)
+                    fail("CreateThread");
+            } /* for */
+            thread_job(&jobs[0]);
+            for (i = 1; i < threads; i++)
+            {
+                WaitForSingleObject(handles[i], INFINITE);
+                CloseHandle(handles[i]);
+            } /* for */
+            #else
+            pthread_t handles[BENCH_MAX_THREADS];
+            for (i = 1; i < threads; i++)
+            {
+                if (pthread_create(&handles[i], NULL, thread_entry, &jobs[i]))
+                    fail("pthread_create");
+            } /* for */
+            thread_job(&jobs[0]);
+            for (i = 1; i < threads; i++)
+                pthread_join(handles[i], NULL);
+            #endif
+        }
+        elapsed = now_ns() - start;
+
+        for (i = 0; i < threads; i++)
+        {
+            if (jobs[i].failed)
+                fail("threaded read");
+        } /* for */
+
+        opspersec = (jobs[0].ops * threads) / (elapsed / BENCH_NS_PER_SEC);
+        if (threads == 1)
+            base = opspersec;
+
+        result(arc, "threads", "\"threads\": %d, \"ops\": %d, \"ms\": %.3f, "
+               "\"ops_per_sec\": %.1f, \"speedup\": %.2f", threads,
+               jobs[0].ops * threads, elapsed / 1000000.0, opspersec,
+               opspersec / base);
+    } /* for */
+
+    must_unmount(path);
+} /* bench_threads */
+
+
+static void bench_archiver(const BenchArchiver *arc)
+{
+    static const size_t full_counts[] = { 100, 1000, 10000 };
+    static const size_t quick_counts[] = { 100, 1000 };
+    const size_t *counts = quick ? quick_counts : full_counts;
+    const size_t numcounts = quick ? 2 : 3;
+    size_t i;
+
+    for (i = 0; i < numcounts; i++)
+    {
+        BenchFile *files = make_files(0, counts[i], 256, 2048);
+        char base[32];
+        char *path;
+
+        fprintf(stderr, "%s: %u entries\n", arc->name,
+                (unsigned int) counts[i]);
+        sprintf(base, "mount%u", (unsigned int) counts[i]);
+        path = make_archive(arc, base, files, counts[i]);
+        bench_mount(arc, path, counts[i]);
+        if (counts[i] == 1000)
+            bench_threads(arc, files, counts[i], path);
+        free(path);
+        free(files);
+    } /* for */
+
+    fprintf(stderr, "%s: lookups\n", arc->name);
+    bench_lookup(arc);
+    fprintf(stderr, "%s: reads\n", arc->name);
+    bench_read(arc);
+    cleanup();
+} /* bench_archiver */
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "USAGE: %s [--quick] [--keep] [--dir PATH] [--only ARCHIVER]\n"
+        "       [--threads N]\n\n"
+        "  --quick          smaller archives and fewer iterations.\n"
+        "  --keep           don't delete the generated archives.\n"
+        "  --dir PATH       where to write archives (default: a pref dir).\n"
+        "  --only ARCHIVER  only benchmark one of:", argv0);
+    {
+        size_t i;
+        for (i = 0; i < sizeof (archivers) / sizeof (archivers[0]); i++)
+            fprintf(stderr, " %s", archivers[i].name);
+    }
+    fprintf(stderr, "\n  --threads N      most threads to scale up to (1-%d).\n"
+                    "\nResults are written to stdout as JSON.\n",
+                    BENCH_MAX_THREADS);
+} /* usage */
+
+
+int main(int argc, char **argv)
+{
+    const char *dir = NULL;
+    PHYSFS_Version linked;
+    const char *sep;
+    size_t i;
+    int argi;
+
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strcmp(arg, "--quick") == 0)
+            quick = 1;
+        else if (strcmp(arg, "--keep") == 0)
+            keep = 1;
+        else if ((strcmp(arg, "--dir") == 0) && (argi + 1 < argc))
+            dir = argv[++argi];
+        else if ((strcmp(arg, "--only") == 0) && (argi + 1 < argc))
+            only = argv[++argi];
+        else if ((strcmp(arg, "--threads") == 0) && (argi + 1 < argc))
+        {
+            max_threads = atoi(argv[++argi]);
+            if ((max_threads < 1) || (max_threads > BENCH_MAX_THREADS))
+            {
+                usage(argv[0]);
+                return 2;
+            } /* if */
+        } /* else if */
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        } /* else */
+    } /* for */
+
+    if (!PHYSFS_init(argv[0]))
+        fail("PHYSFS_init");
+
+    if (dir == NULL)
+    {
+        dir = PHYSFS_getPrefDir("icculus.org", "physfs_bench");
+        if (dir == NULL)
+            fail("PHYSFS_getPrefDir");
+    } /* if */
+
+    if (!PHYSFS_setWriteDir(dir))
+        fail(dir);
+
+    sep = PHYSFS_getDirSeparator();
+    workdir = (char *) xmalloc(strlen(dir) + strlen(sep) + 1);
+    strcpy(workdir, dir);
+    if ((strlen(dir) < strlen(sep)) ||
+        (strcmp(dir + strlen(dir) - strlen(sep), sep) != 0))
+        strcat(workdir, sep);
+
+    PHYSFS_getLinkedVersion(&linked);
+    printf("{\n  \"benchmark\": \"physfs_bench\",\n"
+           "  \"physfs_version\": \"%d.%d.%d\",\n  \"quick\": %s,\n"
+           "  \"results\": [", (int) linked.major, (int) linked.minor,
+           (int) linked.patch, quick ? "true" : "false");
+
+    for (i = 0; i < sizeof (archivers) / sizeof (archivers[0]); i++)
+    {
+        if ((only == NULL) || (strcmp(only, archivers[i].name) == 0))
+            bench_archiver(&archivers[i]);
+    } /* for */
+
+    printf("\n  ]\n}\n");
+
+    cleanup();
+    free(workdir);
+    PHYSFS_deinit();
+    return 0;
+} /* main */
+
+/* end of physfs_bench.c ... */
+
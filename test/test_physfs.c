@@ -458,6 +458,47 @@ static int cmd_permitsyms(char *args)
 } /* cmd_permitsyms */
 
 
+static int cmd_setpathindex(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_setSearchPathIndex(num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+    {
+        printf("Search path index is now %s.\n",
+                PHYSFS_searchPathIndexed() ? "enabled" : "disabled");
+    } /* else */
+
+    return 1;
+} /* cmd_setpathindex */
+
+
+static int cmd_maparchives(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    PHYSFS_setMapArchives(num);
+    printf("Archives mounted from now on will %sbe memory-mapped.\n",
+            PHYSFS_archivesMapped() ? "" : "not ");
+    return 1;
+} /* cmd_maparchives */
+
+
 static int cmd_setbuffer(char *args)
 {
     if (*args == '\"')
@@ -871,6 +912,31 @@ static int cmd_cat(char *args)
     return 1;
 } /* cmd_cat */
 
+static int cmd_mapfile(char *args)
+{
+    PHYSFS_File *f;
+    const void *ptr = NULL;
+    PHYSFS_uint64 len = 0;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    f = PHYSFS_mapFile(args, &ptr, &len);
+    if (f == NULL)
+        printf("failed to map. Reason: [%s].\n", PHYSFS_getLastError());
+    else
+    {
+        fwrite(ptr, 1, (size_t) len, stdout);
+        printf("\n\n (mapped %lu bytes.)\n\n", (unsigned long) len);
+        PHYSFS_close(f);
+    } /* else */
+
+    return 1;
+} /* cmd_mapfile */
+
 static int cmd_cat2(char *args)
 {
     PHYSFS_File *f1 = NULL;
@@ -1070,6 +1136,74 @@ static int cmd_crc32(char *args)
 } /* cmd_crc32 */
 
 
+#define ASYNCREADS_COUNT 8
+#define ASYNCREADS_SIZE 4096
+static char asyncreads_buffers[ASYNCREADS_COUNT][ASYNCREADS_SIZE];
+static void asyncreads_callback(void *data, const PHYSFS_AsyncResult *result)
+{
+    int *done = (int *) data;
+
+    /* hold up the first read, so the pool starts shutting down with the
+       rest still queued behind it on the same handle. */
+    if (result->buffer == asyncreads_buffers[0])
+    {
+        const clock_t start = clock();
+        while ((clock() - start) < (CLOCKS_PER_SEC / 4)) { /* spin */ }
+    } /* if */
+
+    if (result->result >= 0)
+        done[0]++;  /* workers run one read per handle at a time. */
+    else
+        done[1]++;
+} /* asyncreads_callback */
+
+/* Queue several reads on one handle, then restart the pool under them. */
+static int cmd_asyncreads(char *args)
+{
+    PHYSFS_File *f;
+    int done[2] = { 0, 0 };
+    int queued = 0;
+    int i;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    f = PHYSFS_openRead(args);
+    if (f == NULL)
+    {
+        printf("failed to open. Reason: [%s].\n", PHYSFS_getLastError());
+        return 1;
+    } /* if */
+
+    for (i = 0; i < ASYNCREADS_COUNT; i++)
+    {
+        if (PHYSFS_readAsync(f, asyncreads_buffers[i], ASYNCREADS_SIZE,
+                             (PHYSFS_uint64) i * ASYNCREADS_SIZE, 0,
+                             asyncreads_callback, done) == 0)
+            printf("failed to queue read %d. Reason: [%s].\n", i,
+                   PHYSFS_getLastError());
+        else
+            queued++;
+    } /* for */
+
+    /* this lets everything queued finish before it returns. */
+    if (!PHYSFS_setAsyncThreads(4))
+        printf("failed to set async threads. Reason: [%s].\n",
+               PHYSFS_getLastError());
+
+    printf("%d reads queued, %d finished, %d failed.\n",
+           queued, done[0], done[1]);
+    if (done[0] + done[1] != queued)
+        printf("FAIL: not every read called back!\n");
+
+    PHYSFS_close(f);
+    return 1;
+} /* cmd_asyncreads */
+
+
 static int cmd_filelength(char *args)
 {
     PHYSFS_File *f;
@@ -1322,6 +1456,8 @@ static const command_info commands[] =
     { "getwritedir",    cmd_getwritedir,    0, NULL                         },
     { "setwritedir",    cmd_setwritedir,    1, "<newWriteDir>"              },
     { "permitsymlinks", cmd_permitsyms,     1, "<1or0>"                     },
+    { "setpathindex",   cmd_setpathindex,   1, "<1or0>"                     },
+    { "maparchives",    cmd_maparchives,    1, "<1or0>"                     },
     { "setsaneconfig",  cmd_setsaneconfig,  5, "<org> <appName> <arcExt> <includeCdRoms> <archivesFirst>" },
     { "mkdir",          cmd_mkdir,          1, "<dirToMk>"                  },
     { "delete",         cmd_delete,         1, "<dirToDelete>"              },
@@ -1331,6 +1467,7 @@ static const command_info commands[] =
     { "issymlink",      cmd_issymlink,      1, "<fileToCheck>"              },
     { "cat",            cmd_cat,            1, "<fileToCat>"                },
     { "cat2",           cmd_cat2,           2, "<fileToCat1> <fileToCat2>"  },
+    { "mapfile",        cmd_mapfile,        1, "<fileToMap>"                },
     { "filelength",     cmd_filelength,     1, "<fileToCheck>"              },
     { "stat",           cmd_stat,           1, "<fileToStat>"               },
     { "append",         cmd_append,         1, "<fileToAppend>"             },
@@ -1339,6 +1476,7 @@ static const command_info commands[] =
     { "setbuffer",      cmd_setbuffer,      1, "<bufferSize>"               },
     { "stressbuffer",   cmd_stressbuffer,   1, "<bufferSize>"               },
     { "crc32",          cmd_crc32,          1, "<fileToHash>"               },
+    { "asyncreads",     cmd_asyncreads,     1, "<fileToRead>"               },
     { "getmountpoint",  cmd_getmountpoint,  1, "<dir>"                      },
     { NULL,             NULL,              -1, NULL                         }
 };